@@ -0,0 +1,446 @@
+/*
+ * Marvin - an UCI/XBoard compatible chess engine
+ * Copyright (C) 2023 Martin Danielsson
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <inttypes.h>
+
+#include "analyze.h"
+#include "engine.h"
+#include "search.h"
+#include "position.h"
+#include "fen.h"
+#include "bitboard.h"
+#include "hash.h"
+#include "smp.h"
+#include "timectl.h"
+#include "thread.h"
+#include "utils.h"
+
+/* The maximum length of a line in the input file */
+#define MAX_LINE_LENGTH 1024
+
+/* The maximum number of positions analyzed concurrently */
+#define MAX_ANALYZERS 256
+
+/* The maximum length of a line in the output file */
+#define RESULT_MAX_LENGTH (4*MAX_LINE_LENGTH+MAX_MOVES*(MAX_MOVESTR_LENGTH+1))
+
+/* Size of the buffer used for the output file */
+#define OUTPUT_BUFFER_SIZE (1024*1024)
+
+/* Data shared by all analyzers */
+struct analysis {
+    /* Input and output files, protected by the lock */
+    FILE    *infp;
+    FILE    *outfp;
+    mutex_t lock;
+    int64_t lineno;
+
+    /* Search limits */
+    int      depth;
+    uint64_t nodes;
+    int      movetime;
+
+    /* Statistics, protected by the lock */
+    int64_t  nanalyzed;
+    int64_t  nskipped;
+    uint64_t total_nodes;
+};
+
+/* An engine searching positions in a thread of its own */
+struct analyzer {
+    struct engine   *engine;
+    struct analysis *analysis;
+    thread_t        thread;
+};
+
+/*
+ * Read the next line from the input file. Blank lines and lines
+ * starting with '#' are skipped.
+ */
+static bool read_line(struct analysis *analysis, char *line, int64_t *lineno)
+{
+    bool found = false;
+    int  len;
+
+    mutex_lock(&analysis->lock);
+    while (fgets(line, MAX_LINE_LENGTH, analysis->infp) != NULL) {
+        analysis->lineno++;
+        len = strlen(line);
+        while ((len > 0) && isspace((unsigned char)line[len-1])) {
+            line[--len] = '\0';
+        }
+        if ((len > 0) && (line[0] != '#')) {
+            *lineno = analysis->lineno;
+            found = true;
+            break;
+        }
+    }
+    mutex_unlock(&analysis->lock);
+
+    return found;
+}
+
+/*
+ * Split an EPD line into the position and the operations. The position
+ * consists of the first four fields and optionally the two move counters
+ * used by FEN strings. The id operation, if any, is copied to id.
+ */
+static void parse_epd(char *line, char *fen, char *id)
+{
+    char *iter = line;
+    char *quote;
+    int  nfields;
+    int  len;
+
+    id[0] = '\0';
+    for (nfields=0;(nfields<6) && (*iter!='\0');nfields++) {
+        iter = skip_whitespace(iter);
+        if ((nfields >= 4) && !isdigit((unsigned char)*iter)) {
+            break;
+        }
+        while ((*iter != '\0') && !isspace((unsigned char)*iter)) {
+            iter++;
+        }
+    }
+    len = iter - line;
+    strncpy(fen, line, len);
+    fen[len] = '\0';
+
+    /* Find the id operation */
+    iter = strstr(iter, "id \"");
+    if (iter != NULL) {
+        iter += strlen("id \"");
+        quote = strchr(iter, '"');
+        if (quote != NULL) {
+            len = quote - iter;
+            strncpy(id, iter, len);
+            id[len] = '\0';
+        }
+    }
+}
+
+/*
+ * Check that a position can be searched. Both sides must have exactly one
+ * king and the side not to move must not be in check.
+ */
+static bool is_searchable(struct position *pos)
+{
+    return (BITCOUNT(pos->bb_pieces[WHITE_KING]) == 1) &&
+           (BITCOUNT(pos->bb_pieces[BLACK_KING]) == 1) &&
+           !pos_in_check(pos, FLIP_COLOR(pos->stm));
+}
+
+/*
+ * Format the result of a search as an EPD line. The position is written
+ * using the first four FEN fields followed by the analysis operations.
+ */
+static void format_result(struct engine *engine, char *id, int score,
+                          time_t elapsed, char *buffer)
+{
+    char            fen[FEN_MAX_LENGTH];
+    char            movestr[MAX_MOVESTR_LENGTH];
+    struct pvline   *pv = &engine->best_line.pv;
+    char            *iter;
+    int             nfields;
+    int             k;
+
+    /* Remove the move counters from the FEN string */
+    fen_build_string(&engine->pos, fen);
+    iter = fen;
+    for (nfields=0;nfields<4;nfields++) {
+        iter = strchr(iter+1, ' ');
+        if (iter == NULL) {
+            break;
+        }
+    }
+    if (iter != NULL) {
+        *iter = '\0';
+    }
+
+    sprintf(buffer, "%s acd %d; acn %"PRIu64"; acs %d; ce %d; pv", fen,
+            engine->best_line.depth, smp_nodes(engine), (int)(elapsed/1000),
+            score);
+    for (k=0;k<pv->size;k++) {
+        pos_move2str(pv->moves[k], movestr);
+        strcat(buffer, " ");
+        strcat(buffer, movestr);
+    }
+    strcat(buffer, ";");
+    if (id[0] != '\0') {
+        strcat(buffer, " id \"");
+        strncat(buffer, id, MAX_LINE_LENGTH);
+        strcat(buffer, "\";");
+    }
+    strcat(buffer, "\n");
+}
+
+static thread_retval_t analyzer_func(void *data)
+{
+    struct analyzer *analyzer = data;
+    struct analysis *analysis = analyzer->analysis;
+    struct engine   *engine = analyzer->engine;
+    char            line[MAX_LINE_LENGTH];
+    char            fen[MAX_LINE_LENGTH];
+    char            id[MAX_LINE_LENGTH];
+    char            result[RESULT_MAX_LENGTH];
+    int64_t         lineno;
+    int             flags;
+    int             score;
+    uint32_t        move;
+
+    /* Setup search limits */
+    flags = 0;
+    engine->sd = MAX_SEARCH_DEPTH;
+    if (analysis->depth > 0) {
+        engine->sd = analysis->depth;
+        flags |= TC_DEPTH_LIMIT;
+    }
+    if (analysis->nodes > 0) {
+        engine->max_nodes = analysis->nodes;
+        flags |= TC_NODE_LIMIT;
+    }
+    if (analysis->movetime > 0) {
+        flags |= TC_FIXED_TIME|TC_TIME_LIMIT;
+    }
+    engine->exit_on_mate = true;
+
+    /*
+     * Search positions until the input is exhausted. The transposition
+     * table is shared by all analyzers and is never cleared so that
+     * related positions can benefit from each other.
+     */
+    while (read_line(analysis, line, &lineno)) {
+        parse_epd(line, fen, id);
+        if (!pos_setup_from_fen(&engine->pos, fen) ||
+            !is_searchable(&engine->pos)) {
+            mutex_lock(&analysis->lock);
+            printf("Error: invalid position on line %"PRId64"\n", lineno);
+            analysis->nskipped++;
+            mutex_unlock(&analysis->lock);
+            continue;
+        }
+
+        smp_newgame(engine);
+        engine->move_filter.size = 0;
+        tc_start_clock(engine);
+        tc_configure_time_control(engine, analysis->movetime, 0, 0, flags);
+        score = 0;
+        move = search_position(engine, false, NULL, &score);
+        tc_stop_clock(engine);
+        if (move == NOMOVE) {
+            mutex_lock(&analysis->lock);
+            analysis->nskipped++;
+            mutex_unlock(&analysis->lock);
+            continue;
+        }
+        format_result(engine, id, score, tc_elapsed_time(engine), result);
+
+        mutex_lock(&analysis->lock);
+        fputs(result, analysis->outfp);
+        analysis->nanalyzed++;
+        analysis->total_nodes += smp_nodes(engine);
+        mutex_unlock(&analysis->lock);
+    }
+
+    return (thread_retval_t)0;
+}
+
+static int analyze(char *input, char *output, struct analysis *analysis,
+                   int hash_size, int nthreads, int nsearch_threads)
+{
+    struct analyzer *analyzers;
+    int             nanalyzers;
+    int             ret = 0;
+    int             k;
+    time_t          start;
+    char            *buffer;
+
+    /* Open input and output files */
+    analysis->infp = fopen(input, "r");
+    if (analysis->infp == NULL) {
+        printf("Error: failed to open input file, %s\n", input);
+        return 1;
+    }
+    analysis->outfp = fopen(output, "w");
+    if (analysis->outfp == NULL) {
+        printf("Error: failed to open output file, %s\n", output);
+        fclose(analysis->infp);
+        return 1;
+    }
+    buffer = malloc(OUTPUT_BUFFER_SIZE);
+    if (buffer != NULL) {
+        setvbuf(analysis->outfp, buffer, _IOFBF, OUTPUT_BUFFER_SIZE);
+    }
+    mutex_init(&analysis->lock);
+    analysis->lineno = 0;
+    analysis->nanalyzed = 0;
+    analysis->nskipped = 0;
+    analysis->total_nodes = 0ULL;
+
+    /*
+     * Create one engine for each group of search threads. The first
+     * engine owns the transposition table and the others borrow it.
+     */
+    nanalyzers = MIN(nthreads/nsearch_threads, MAX_ANALYZERS);
+    nanalyzers = MAX(nanalyzers, 1);
+    analyzers = malloc(sizeof(struct analyzer)*nanalyzers);
+    if (analyzers == NULL) {
+        printf("Error: failed to allocate memory\n");
+        fclose(analysis->outfp);
+        fclose(analysis->infp);
+        free(buffer);
+        return 1;
+    }
+    for (k=0;k<nanalyzers;k++) {
+        analyzers[k].analysis = analysis;
+        analyzers[k].engine = engine_create(
+                                    k == 0?hash_size:MIN_MAIN_HASH_SIZE,
+                                    nsearch_threads);
+        if (k > 0) {
+            hash_tt_share_table(analyzers[k].engine, analyzers[0].engine);
+        }
+    }
+
+    /* Analyze all positions */
+    start = get_current_time();
+    for (k=0;k<nanalyzers;k++) {
+        thread_create(&analyzers[k].thread, analyzer_func, &analyzers[k]);
+    }
+    for (k=0;k<nanalyzers;k++) {
+        thread_join(&analyzers[k].thread);
+    }
+    printf("Analyzed %"PRId64" positions in %.1fs (%"PRIu64" nodes)\n",
+           analysis->nanalyzed, (get_current_time()-start)/1000.0,
+           analysis->total_nodes);
+    if (analysis->nskipped > 0) {
+        printf("Skipped %"PRId64" positions\n", analysis->nskipped);
+    }
+
+    /* Clean up. The owner of the transposition table is destroyed last. */
+    for (k=nanalyzers-1;k>=0;k--) {
+        engine_destroy(analyzers[k].engine);
+    }
+    free(analyzers);
+    mutex_destroy(&analysis->lock);
+    if (fclose(analysis->outfp) != 0) {
+        printf("Error: failed to write data\n");
+        ret = 1;
+    }
+    fclose(analysis->infp);
+    free(buffer);
+
+    return ret;
+}
+
+static void analyze_usage(void)
+{
+    printf("marvin --analyze <epd> <options>\n");
+    printf("Options:\n");
+    printf("\t--output (-o) <file>\n");
+    printf("\t--depth (-d) <int>\n");
+    printf("\t--nodes (-n) <int>\n");
+    printf("\t--movetime (-m) <int>\n");
+    printf("\t--threads (-t) <int>\n");
+    printf("\t--search-threads (-s) <int>\n");
+    printf("\t--hash (-H) <int>\n");
+    printf("\t--help (-h)\n");
+}
+
+int analyze_epd(int argc, char *argv[])
+{
+    struct analysis analysis;
+    int             iter;
+    char            *input_file = NULL;
+    char            *output_file = NULL;
+    int             nthreads = 1;
+    int             nsearch_threads = 1;
+    int             hash_size = DEFAULT_MAIN_HASH_SIZE;
+
+    memset(&analysis, 0, sizeof(analysis));
+
+    /* Parse command line options */
+    iter = 2;
+    while (iter < argc) {
+        if ((MATCH(argv[iter], "-o") || MATCH(argv[iter], "--output")) &&
+            ((iter+1) < argc)) {
+            iter++;
+            output_file = argv[iter];
+        } else if ((MATCH(argv[iter], "-d") ||
+                    MATCH(argv[iter], "--depth")) &&
+                   ((iter+1) < argc)) {
+            iter++;
+            analysis.depth = atoi(argv[iter]);
+        } else if ((MATCH(argv[iter], "-n") ||
+                    MATCH(argv[iter], "--nodes")) &&
+                   ((iter+1) < argc)) {
+            iter++;
+            analysis.nodes = strtoull(argv[iter], NULL, 10);
+        } else if ((MATCH(argv[iter], "-m") ||
+                    MATCH(argv[iter], "--movetime")) &&
+                   ((iter+1) < argc)) {
+            iter++;
+            analysis.movetime = atoi(argv[iter]);
+        } else if ((MATCH(argv[iter], "-t") ||
+                    MATCH(argv[iter], "--threads")) &&
+                   ((iter+1) < argc)) {
+            iter++;
+            nthreads = atoi(argv[iter]);
+        } else if ((MATCH(argv[iter], "-s") ||
+                    MATCH(argv[iter], "--search-threads")) &&
+                   ((iter+1) < argc)) {
+            iter++;
+            nsearch_threads = atoi(argv[iter]);
+        } else if ((MATCH(argv[iter], "-H") ||
+                    MATCH(argv[iter], "--hash")) &&
+                   ((iter+1) < argc)) {
+            iter++;
+            hash_size = atoi(argv[iter]);
+        } else if (MATCH(argv[iter], "-h") || MATCH(argv[iter], "--help")) {
+            analyze_usage();
+            return 0;
+        } else if ((argv[iter][0] != '-') && (input_file == NULL)) {
+            input_file = argv[iter];
+        } else {
+            printf("Error: unknown argument, %s\n", argv[iter]);
+            analyze_usage();
+            return 1;
+        }
+
+        iter++;
+    }
+
+    /* Validate options */
+    if (!input_file || !output_file ||
+        (analysis.depth < 0) || (analysis.depth >= MAX_SEARCH_DEPTH) ||
+        (analysis.movetime < 0) ||
+        ((analysis.depth == 0) && (analysis.nodes == 0) &&
+         (analysis.movetime == 0)) ||
+        (nthreads <= 0) || (nsearch_threads <= 0) ||
+        (nsearch_threads > MAX_WORKERS) ||
+        (hash_size < MIN_MAIN_HASH_SIZE) || (hash_size > hash_tt_max_size())) {
+        printf("Error: invalid options\n");
+        analyze_usage();
+        return 1;
+    }
+
+    return analyze(input_file, output_file, &analysis, hash_size, nthreads,
+                   nsearch_threads);
+}
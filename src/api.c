@@ -0,0 +1,179 @@
+/*
+ * Marvin - an UCI/XBoard compatible chess engine
+ * Copyright (C) 2023 Martin Danielsson
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdatomic.h>
+
+#include "api.h"
+#include "engine.h"
+#include "search.h"
+#include "position.h"
+#include "timectl.h"
+#include "smp.h"
+#include "hash.h"
+#include "nnue.h"
+#include "bitboard.h"
+#include "data.h"
+#include "numa.h"
+#include "cpu.h"
+#include "utils.h"
+#include "material.h"
+#include "key.h"
+
+bool api_init(char *netfile)
+{
+    cpu_init();
+    engine_init();
+    numa_init();
+    data_init();
+    nnue_init();
+    bb_init();
+    material_init();
+    key_init_cuckoo_tables();
+    search_init();
+
+    engine_loaded_net = nnue_load_net(netfile);
+    engine_using_nnue = engine_loaded_net;
+
+    return engine_loaded_net;
+}
+
+void api_cleanup(void)
+{
+    nnue_destroy();
+}
+
+struct engine* api_create_engine(int hash_size, int nthreads)
+{
+    hash_size = CLAMP(hash_size, MIN_MAIN_HASH_SIZE, hash_tt_max_size());
+    nthreads = CLAMP(nthreads, 1, MAX_WORKERS);
+
+    return engine_create(hash_size, nthreads);
+}
+
+void api_destroy_engine(struct engine *engine)
+{
+    engine_destroy(engine);
+}
+
+bool api_set_position(struct engine *engine, char *fen, char *moves)
+{
+    char     movestr[MAX_MOVESTR_LENGTH];
+    uint32_t move;
+    int      len;
+
+    assert(engine != NULL);
+
+    if (fen == NULL) {
+        pos_setup_start_position(&engine->pos);
+    } else if (!pos_setup_from_fen(&engine->pos, fen)) {
+        pos_setup_start_position(&engine->pos);
+        return false;
+    }
+
+    /* Play all moves on the internal board */
+    while ((moves != NULL) && (sscanf(moves, " %6s%n", movestr, &len) == 1)) {
+        moves += len;
+        move = pos_str2move(movestr, &engine->pos);
+        if ((move == NOMOVE) || !pos_make_move(&engine->pos, move)) {
+            pos_setup_start_position(&engine->pos);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void api_new_game(struct engine *engine)
+{
+    assert(engine != NULL);
+
+    hash_tt_clear_table(engine);
+    smp_newgame(engine);
+}
+
+bool api_search(struct engine *engine, struct api_limits *limits,
+                struct api_result *result)
+{
+    uint32_t best_move;
+    uint32_t ponder_move;
+    int      score = 0;
+    int      flags = 0;
+
+    assert(engine != NULL);
+    assert(limits != NULL);
+    assert(result != NULL);
+
+    /*
+     * Only stops requested while this search is running count. Stops
+     * that arrive before the workers are ready are picked up when
+     * they are prepared.
+     */
+    atomic_store(&engine->stop_requested, false);
+
+    /* Setup search parameters */
+    engine->move_filter.size = 0;
+    engine->exit_on_mate = true;
+    engine->sd = MAX_SEARCH_DEPTH;
+    engine->max_nodes = 0ULL;
+    if (limits->depth > 0) {
+        engine->sd = MIN(limits->depth, MAX_SEARCH_DEPTH);
+        flags |= TC_DEPTH_LIMIT;
+    }
+    if (limits->nodes > 0ULL) {
+        engine->max_nodes = limits->nodes;
+        flags |= TC_NODE_LIMIT;
+    }
+    if (limits->movetime > 0) {
+        flags |= TC_FIXED_TIME|TC_TIME_LIMIT;
+    } else if (flags == 0) {
+        flags = TC_INFINITE_TIME;
+        engine->exit_on_mate = false;
+    }
+
+    /* Search the position */
+    tc_start_clock(engine);
+    tc_configure_time_control(engine, limits->movetime, 0, 0, flags);
+    best_move = search_position(engine, false, &ponder_move, &score);
+    tc_stop_clock(engine);
+
+    /* Report the result */
+    memset(result, 0, sizeof(struct api_result));
+    if (best_move == NOMOVE) {
+        return false;
+    }
+    pos_move2str(best_move, result->bestmove);
+    if (ponder_move != NOMOVE) {
+        pos_move2str(ponder_move, result->pondermove);
+    }
+    result->score = score;
+    result->depth = engine->completed_depth;
+    result->nodes = smp_nodes(engine);
+    result->time = (int)tc_elapsed_time(engine);
+
+    return true;
+}
+
+void api_stop(struct engine *engine)
+{
+    assert(engine != NULL);
+
+    atomic_store(&engine->stop_requested, true);
+    smp_stop_all(engine);
+}
@@ -0,0 +1,132 @@
+/*
+ * Marvin - an UCI/XBoard compatible chess engine
+ * Copyright (C) 2023 Martin Danielsson
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef API_H
+#define API_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "types.h"
+
+/*
+ * A small C API for embedding the engine in other programs. Each engine
+ * created through the API is independent of all other engines. It has its
+ * own transposition table, worker threads and time control so several
+ * engines can search concurrently from different threads. The NNUE
+ * weights and other read-only tables are shared by all engines.
+ */
+
+/* Limits for a search. A limit that is zero is not used. */
+struct api_limits {
+    /* The maximum depth to search to */
+    int depth;
+    /* The maximum number of nodes to search */
+    uint64_t nodes;
+    /* The time to search (in milliseconds) */
+    int movetime;
+};
+
+/* The result of a search */
+struct api_result {
+    /* The best move and the expected reply in coordinate notation */
+    char bestmove[MAX_MOVESTR_LENGTH];
+    char pondermove[MAX_MOVESTR_LENGTH];
+    /* The score from the point of view of the side to move */
+    int score;
+    /* The highest completed depth */
+    int depth;
+    /* The number of nodes searched */
+    uint64_t nodes;
+    /* The time spent searching (in milliseconds) */
+    int time;
+};
+
+/*
+ * Initialize the components shared by all engines. Must be called once
+ * before any engine is created.
+ *
+ * @param netfile The NNUE net to use. If NULL then the embedded net is used.
+ * @return Returns true if the net was successfully loaded.
+ */
+bool api_init(char *netfile);
+
+/*
+ * Clean up the components shared by all engines. All engines must have
+ * been destroyed before this function is called.
+ */
+void api_cleanup(void);
+
+/*
+ * Create a new engine.
+ *
+ * @param hash_size The size of the transposition table (in MB).
+ * @param nthreads The number of threads to search with.
+ * @return Returns the new engine, or NULL in case of an error.
+ */
+struct engine* api_create_engine(int hash_size, int nthreads);
+
+/*
+ * Destroy an engine.
+ *
+ * @param engine The engine to destroy.
+ */
+void api_destroy_engine(struct engine *engine);
+
+/*
+ * Setup the position to search.
+ *
+ * @param engine The engine.
+ * @param fen The position in FEN notation. If NULL then the start
+ *            position is used.
+ * @param moves Space separated list of moves, in coordinate notation,
+ *              to play from the position. May be NULL.
+ * @return Returns true if the position was successfully set up. If the
+ *         position is invalid then the start position is set up instead.
+ */
+bool api_set_position(struct engine *engine, char *fen, char *moves);
+
+/*
+ * Indicate that the following searches are from a new game.
+ *
+ * @param engine The engine.
+ */
+void api_new_game(struct engine *engine);
+
+/*
+ * Search the current position. The function blocks until the search is
+ * finished. If no limit is given then the search continues until
+ * api_stop is called.
+ *
+ * @param engine The engine.
+ * @param limits Limits for the search.
+ * @param result Location to store the result at.
+ * @return Returns false if there is no legal move in the position.
+ */
+bool api_search(struct engine *engine, struct api_limits *limits,
+                struct api_result *result);
+
+/*
+ * Stop an ongoing search. The function may be called from any thread
+ * once api_search has been called, also before the search has actually
+ * started.
+ *
+ * @param engine The engine.
+ */
+void api_stop(struct engine *engine);
+
+#endif
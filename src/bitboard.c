@@ -19,6 +19,9 @@
 #include <stdint.h>
 #include <string.h>
 #include <stdio.h>
+#if defined(USE_PEXT) || defined(USE_DISPATCH)
+#include <immintrin.h>
+#endif
 
 #include "bitboard.h"
 #include "data.h"
@@ -241,13 +244,36 @@ static const uint64_t bishop_masks[NSQUARES] = {
  * Database of rook moves. The second dimensions is the number
  * of possible occupancy combinations for a rook on a given square.
  */
-static uint64_t rook_moves_db[102400];
+#define ROOK_DB_SIZE 102400
+static uint64_t rook_moves_storage[ROOK_DB_SIZE];
 
 /*
  * Database of bishop moves. The second dimensions is the number
  * of possible occupancy combinations for a bishop on a given square.
  */
-static uint64_t bishop_moves_db[5258];
+#define BISHOP_DB_SIZE 5258
+static uint64_t bishop_moves_storage[BISHOP_DB_SIZE];
+
+/*
+ * The databases that are used. Normally these point to the private
+ * storage above, but they can also be located in shared memory.
+ */
+static uint64_t *rook_moves_db = rook_moves_storage;
+static uint64_t *bishop_moves_db = bishop_moves_storage;
+
+/*
+ * Flag indicating if the slider databases are indexed using the PEXT
+ * instruction instead of magic multiplication. For builds with runtime
+ * dispatch this is selected by bb_select_pext before the databases are
+ * initialized.
+ */
+#ifdef USE_PEXT
+static const bool use_pext = true;
+#elif defined(USE_DISPATCH)
+static bool use_pext = false;
+#else
+static const bool use_pext = false;
+#endif
 
 /* Table of magic information for rooks */
 struct magic rook_magic_table[NSQUARES];
@@ -307,6 +333,34 @@ static uint64_t get_slider_moves(int sq, int fdir, int rdir, uint64_t occ)
     return moves;
 }
 
+/* Calculate the database index for an occupancy using PEXT */
+#if defined(USE_PEXT)
+static uint64_t pext_index(uint64_t occ, uint64_t mask)
+{
+    return _pext_u64(occ, mask);
+}
+#elif defined(USE_DISPATCH)
+__attribute__((target("bmi2")))
+static uint64_t pext_index(uint64_t occ, uint64_t mask)
+{
+    return _pext_u64(occ, mask);
+}
+#endif
+
+/* Calculate the database index for an occupancy */
+static int database_index(uint64_t occ, uint64_t mask, uint64_t magic,
+                          int shift)
+{
+#if defined(USE_PEXT) || defined(USE_DISPATCH)
+    if (use_pext) {
+        return (int)pext_index(occ, mask);
+    }
+#else
+    (void)mask;
+#endif
+    return (int)((occ*magic)>>shift);
+}
+
 /* Get the occupancy combination sqecified by index */
 static uint64_t get_occupancy_combination(int index, uint64_t *occbits,
                                           int nblockers)
@@ -331,9 +385,11 @@ static uint64_t get_occupancy_combination(int index, uint64_t *occbits,
 /*
  * Initialize the magic bitboard databases for rooks and bishops. The
  * databases contains a bitboard with possible moves for each
- * square/occupancy combination.
+ * square/occupancy combination. If populate is false then only the
+ * magic tables are initialized and the databases are assumed to
+ * already be populated.
  */
-static void init_magic_databases(void)
+static void init_magic_databases(bool populate)
 {
     uint64_t *iter;
     uint64_t occbits[12];
@@ -351,7 +407,9 @@ static void init_magic_databases(void)
     int      nocc;
 
     /* Populate the bishop database */
-    memset(bishop_moves_db, 0, sizeof(bishop_moves_db));
+    if (populate) {
+        memset(bishop_moves_db, 0, BISHOP_DB_SIZE*sizeof(uint64_t));
+    }
     next_index = 0;
     iter = &bishop_moves_db[next_index];
     for (sq=0;sq<NSQUARES;sq++) {
@@ -395,13 +453,15 @@ static void init_magic_databases(void)
         max_index = 0;
         for (k=0;k<nocc;k++) {
             occ = get_occupancy_combination(k, occbits, nblockers);
-            moves = get_slider_moves(sq, -1, 1, occ);
-            moves |= get_slider_moves(sq, 1, 1, occ);
-            moves |= get_slider_moves(sq, -1, -1, occ);
-            moves |= get_slider_moves(sq, 1, -1, occ);
-            index = (occ*magic)>>shift;
+            index = database_index(occ, mask, magic, shift);
             max_index = MAX(max_index, index);
-            iter[index] = moves;
+            if (populate) {
+                moves = get_slider_moves(sq, -1, 1, occ);
+                moves |= get_slider_moves(sq, 1, 1, occ);
+                moves |= get_slider_moves(sq, -1, -1, occ);
+                moves |= get_slider_moves(sq, 1, -1, occ);
+                iter[index] = moves;
+            }
         }
 
         /* Calculate the location in the database for the next square */
@@ -410,7 +470,9 @@ static void init_magic_databases(void)
     }
 
     /* Populate the rook database */
-    memset(rook_moves_db, 0, sizeof(rook_moves_db));
+    if (populate) {
+        memset(rook_moves_db, 0, ROOK_DB_SIZE*sizeof(uint64_t));
+    }
     next_index = 0;
     iter = &rook_moves_db[next_index];
     for (sq=0;sq<NSQUARES;sq++) {
@@ -454,13 +516,15 @@ static void init_magic_databases(void)
         max_index = 0;
         for (k=0;k<nocc;k++) {
             occ = get_occupancy_combination(k, occbits, nblockers);
-            moves = get_slider_moves(sq, 1, 0, occ);
-            moves |= get_slider_moves(sq, -1, 0, occ);
-            moves |= get_slider_moves(sq, 0, 1, occ);
-            moves |= get_slider_moves(sq, 0, -1, occ);
-            index = (occ*magic)>>shift;
+            index = database_index(occ, mask, magic, shift);
             max_index = MAX(max_index, index);
-            iter[index] = moves;
+            if (populate) {
+                moves = get_slider_moves(sq, 1, 0, occ);
+                moves |= get_slider_moves(sq, -1, 0, occ);
+                moves |= get_slider_moves(sq, 0, 1, occ);
+                moves |= get_slider_moves(sq, 0, -1, occ);
+                iter[index] = moves;
+            }
         }
 
         /* Calculate the location in the database for the next square */
@@ -598,7 +662,24 @@ static void precalc_knight_moves(void)
 
 void bb_init(void)
 {
-    init_magic_databases();
+    init_magic_databases(true);
+    precalc_pawn_moves();
+    precalc_king_moves();
+    precalc_knight_moves();
+}
+
+uint64_t bb_shared_size(void)
+{
+    return (ROOK_DB_SIZE+BISHOP_DB_SIZE)*sizeof(uint64_t);
+}
+
+void bb_init_shared(uint64_t *memory, bool populate)
+{
+    assert(memory != NULL);
+
+    rook_moves_db = memory;
+    bishop_moves_db = memory + ROOK_DB_SIZE;
+    init_magic_databases(populate);
     precalc_pawn_moves();
     precalc_king_moves();
     precalc_knight_moves();
@@ -687,7 +768,8 @@ uint64_t bb_knight_moves(int from)
     return knight_moves_table[from];
 }
 
-uint64_t bb_bishop_moves(uint64_t occ, int from)
+#ifndef USE_PEXT
+static uint64_t magic_bishop_moves(uint64_t occ, int from)
 {
     struct magic *ptr;
     uint64_t     index;
@@ -702,7 +784,7 @@ uint64_t bb_bishop_moves(uint64_t occ, int from)
     return ptr->moves[index];
 }
 
-uint64_t bb_rook_moves(uint64_t occ, int from)
+static uint64_t magic_rook_moves(uint64_t occ, int from)
 {
     struct magic *ptr;
     uint64_t     index;
@@ -716,6 +798,68 @@ uint64_t bb_rook_moves(uint64_t occ, int from)
 
     return ptr->moves[index];
 }
+#endif
+
+#if defined(USE_PEXT) || defined(USE_DISPATCH)
+#ifdef USE_DISPATCH
+__attribute__((target("bmi2")))
+#endif
+static uint64_t pext_bishop_moves(uint64_t occ, int from)
+{
+    assert(valid_square(from));
+
+    return bishop_magic_table[from].moves[
+                                _pext_u64(occ, bishop_magic_table[from].mask)];
+}
+
+#ifdef USE_DISPATCH
+__attribute__((target("bmi2")))
+#endif
+static uint64_t pext_rook_moves(uint64_t occ, int from)
+{
+    assert(valid_square(from));
+
+    return rook_magic_table[from].moves[
+                                _pext_u64(occ, rook_magic_table[from].mask)];
+}
+#endif
+
+#if defined(USE_PEXT)
+uint64_t bb_bishop_moves(uint64_t occ, int from)
+{
+    return pext_bishop_moves(occ, from);
+}
+
+uint64_t bb_rook_moves(uint64_t occ, int from)
+{
+    return pext_rook_moves(occ, from);
+}
+#elif defined(USE_DISPATCH)
+uint64_t (*bb_bishop_moves)(uint64_t occ, int from) = magic_bishop_moves;
+uint64_t (*bb_rook_moves)(uint64_t occ, int from) = magic_rook_moves;
+
+void bb_select_pext(bool enable)
+{
+    use_pext = enable;
+    bb_bishop_moves = enable?pext_bishop_moves:magic_bishop_moves;
+    bb_rook_moves = enable?pext_rook_moves:magic_rook_moves;
+}
+#else
+uint64_t bb_bishop_moves(uint64_t occ, int from)
+{
+    return magic_bishop_moves(occ, from);
+}
+
+uint64_t bb_rook_moves(uint64_t occ, int from)
+{
+    return magic_rook_moves(occ, from);
+}
+#endif
+
+bool bb_uses_pext(void)
+{
+    return use_pext;
+}
 
 uint64_t bb_queen_moves(uint64_t occ, int from)
 {
@@ -60,6 +60,24 @@
 /* Initialize the bitboard component */
 void bb_init(void);
 
+/*
+ * Get the size of the tables that can be placed in shared memory.
+ *
+ * @return Returns the size in bytes.
+ */
+uint64_t bb_shared_size(void);
+
+/*
+ * Initialize the bitboard component with the large move databases
+ * located in shared memory.
+ *
+ * @param memory Memory of at least bb_shared_size() bytes.
+ * @param populate If true the databases are written, otherwise they
+ *                 are assumed to have been populated by a different
+ *                 process already.
+ */
+void bb_init_shared(uint64_t *memory, bool populate);
+
 /*
  * Generate a bitboard of pawn moves (excluding captures).
  *
@@ -115,7 +133,11 @@ uint64_t bb_knight_moves(int from);
  * @return Bitboard of possible moves. The bitboard includes captures of
  *         friendly pieces which should be masked off.
  */
+#ifdef USE_DISPATCH
+extern uint64_t (*bb_bishop_moves)(uint64_t occ, int from);
+#else
 uint64_t bb_bishop_moves(uint64_t occ, int from);
+#endif
 
 /*
  * Generate a bitboard of rook moves.
@@ -124,7 +146,28 @@ uint64_t bb_bishop_moves(uint64_t occ, int from);
  * @param from Location of the piece.The bitboard includes captures of
  *         friendly pieces which should be masked off.
  */
+#ifdef USE_DISPATCH
+extern uint64_t (*bb_rook_moves)(uint64_t occ, int from);
+#else
 uint64_t bb_rook_moves(uint64_t occ, int from);
+#endif
+
+#ifdef USE_DISPATCH
+/*
+ * Select if the slider databases should be indexed using the PEXT
+ * instruction. Must be called before the databases are initialized.
+ *
+ * @param enable Flag indicating if PEXT should be used.
+ */
+void bb_select_pext(bool enable);
+#endif
+
+/*
+ * Check if the slider databases are indexed using the PEXT instruction.
+ *
+ * @return Returns true if PEXT is used.
+ */
+bool bb_uses_pext(void);
 
 /*
  * Generate a bitboard of queen moves.
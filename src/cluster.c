@@ -0,0 +1,1158 @@
+/*
+ * Marvin - an UCI/XBoard compatible chess engine
+ * Copyright (C) 2023 Martin Danielsson
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <stdatomic.h>
+#if !defined(WINDOWS)
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#endif
+
+#include "cluster.h"
+#include "engine.h"
+#include "hash.h"
+#include "smp.h"
+#include "search.h"
+#include "position.h"
+#include "fen.h"
+#include "timectl.h"
+#include "thread.h"
+#include "utils.h"
+#include "debug.h"
+#include "config.h"
+
+#if !defined(WINDOWS)
+
+/*
+ * The nodes of a cluster form a star with the master engine in the
+ * center. Every message starts with a header holding the type and the
+ * length of the payload, both as 32-bit little endian values.
+ */
+#define MSG_HEADER_SIZE 8
+#define MAX_MESSAGE_SIZE 16384
+
+/* The size of one transposition table entry on the wire */
+#define TT_ENTRY_SIZE 18
+
+/* The maximum number of entries sent in one message */
+#define TT_BATCH_SIZE 512
+
+/*
+ * The maximum number of entries waiting to be sent. Entries that
+ * are stored when the queue is full are not shared.
+ */
+#define TT_QUEUE_SIZE 8192
+
+/* How often the network thread checks the sockets (in ms) */
+#define POLL_INTERVAL 5
+
+/* How often a helper reports the number of searched nodes (in ms) */
+#define NODES_INTERVAL 50
+
+/* How long to wait for the helpers to report their results (in ms) */
+#define RESULT_TIMEOUT 1000
+
+/* The address a helper listens on unless another one is given */
+#define CLUSTER_DEFAULT_ADDRESS "127.0.0.1"
+
+/* Cluster message types */
+enum message_type {
+    MSG_SEARCH = 1,
+    MSG_STOP,
+    MSG_TT_ENTRIES,
+    MSG_NODES,
+    MSG_RESULT,
+    MSG_HELLO
+};
+
+/* A transposition table entry waiting to be sent */
+struct shared_entry {
+    uint64_t key;
+    uint32_t move;
+    int16_t  score;
+    int16_t  eval;
+    uint8_t  depth;
+    uint8_t  type;
+    /* The connection the entry was received on, or -1 if it is local */
+    int8_t   source;
+};
+
+/* A connection to another node in the cluster */
+struct connection {
+    int                  fd;
+    atomic_bool          failed;
+    /*
+     * Set when the peer has sent the shared secret. A helper ignores
+     * all other messages until the master has been authenticated.
+     */
+    bool                 authenticated;
+    mutex_t              send_lock;
+    uint8_t              rxbuf[MAX_MESSAGE_SIZE];
+    int                  rxlen;
+    atomic_uint_fast64_t nodes;
+    bool                 has_result;
+    struct pvinfo        result;
+};
+
+struct cluster {
+    struct engine       *engine;
+    bool                master;
+    struct connection   *conns;
+    int                 nconns;
+    /*
+     * Protects the entry queue, the search state and the results
+     * received from the helpers.
+     */
+    mutex_t             lock;
+    struct shared_entry *queue;
+    struct shared_entry *outgoing;
+    int                 nqueued;
+    bool                searching;
+    uint32_t            search_id;
+    /* Network thread used by the master */
+    thread_t            thread;
+    atomic_bool         exit;
+    /* Search thread used by a helper */
+    thread_t            search_thread;
+    bool                running;
+    atomic_bool         search_done;
+};
+
+static struct cluster* create_cluster(struct engine *engine, bool master)
+{
+    struct cluster *cluster;
+    int            k;
+
+    cluster = calloc(1, sizeof(struct cluster));
+    if (cluster == NULL) {
+        return NULL;
+    }
+    cluster->conns = calloc(MAX_CLUSTER_NODES, sizeof(struct connection));
+    cluster->queue = malloc(TT_QUEUE_SIZE*sizeof(struct shared_entry));
+    cluster->outgoing = malloc(TT_QUEUE_SIZE*sizeof(struct shared_entry));
+    if ((cluster->conns == NULL) || (cluster->queue == NULL) ||
+        (cluster->outgoing == NULL)) {
+        free(cluster->conns);
+        free(cluster->queue);
+        free(cluster->outgoing);
+        free(cluster);
+        return NULL;
+    }
+
+    cluster->engine = engine;
+    cluster->master = master;
+    mutex_init(&cluster->lock);
+    for (k=0;k<MAX_CLUSTER_NODES;k++) {
+        cluster->conns[k].fd = -1;
+        mutex_init(&cluster->conns[k].send_lock);
+    }
+
+    return cluster;
+}
+
+static void destroy_cluster(struct cluster *cluster)
+{
+    int k;
+
+    for (k=0;k<MAX_CLUSTER_NODES;k++) {
+        if (cluster->conns[k].fd >= 0) {
+            close(cluster->conns[k].fd);
+        }
+        mutex_destroy(&cluster->conns[k].send_lock);
+    }
+    mutex_destroy(&cluster->lock);
+    free(cluster->conns);
+    free(cluster->queue);
+    free(cluster->outgoing);
+    free(cluster);
+}
+
+static void add_connection(struct cluster *cluster, int fd)
+{
+    struct connection *conn = &cluster->conns[cluster->nconns];
+    int               flag = 1;
+
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+
+    conn->fd = fd;
+    conn->rxlen = 0;
+    conn->has_result = false;
+    conn->authenticated = cluster->master;
+    atomic_store(&conn->failed, false);
+    atomic_store(&conn->nodes, 0ULL);
+    cluster->nconns++;
+}
+
+static int open_connection(char *host, char *port)
+{
+    struct addrinfo hints;
+    struct addrinfo *result;
+    struct addrinfo *iter;
+    int             fd;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host, port, &hints, &result) != 0) {
+        return -1;
+    }
+
+    fd = -1;
+    for (iter=result;iter!=NULL;iter=iter->ai_next) {
+        fd = socket(iter->ai_family, iter->ai_socktype, iter->ai_protocol);
+        if (fd < 0) {
+            continue;
+        }
+        if (connect(fd, iter->ai_addr, iter->ai_addrlen) == 0) {
+            break;
+        }
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(result);
+
+    return fd;
+}
+
+/*
+ * Send a message. The payload is expected to start MSG_HEADER_SIZE
+ * bytes into the buffer so that the header can be filled in and the
+ * whole message written with a single call.
+ */
+static void send_message(struct connection *conn, enum message_type type,
+                         uint8_t *buffer, int len)
+{
+    ssize_t nwritten;
+    int     offset;
+
+    if (atomic_load(&conn->failed)) {
+        return;
+    }
+
+    write_uint32_le(&buffer[0], (uint32_t)type);
+    write_uint32_le(&buffer[4], (uint32_t)len);
+    len += MSG_HEADER_SIZE;
+
+    mutex_lock(&conn->send_lock);
+    offset = 0;
+    while (offset < len) {
+        nwritten = send(conn->fd, buffer+offset, len-offset, MSG_NOSIGNAL);
+        if (nwritten < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            atomic_store(&conn->failed, true);
+            break;
+        }
+        offset += (int)nwritten;
+    }
+    mutex_unlock(&conn->send_lock);
+}
+
+static void send_search_id(struct connection *conn, enum message_type type,
+                           uint32_t id)
+{
+    uint8_t buffer[MSG_HEADER_SIZE+4];
+
+    write_uint32_le(&buffer[MSG_HEADER_SIZE], id);
+    send_message(conn, type, buffer, 4);
+}
+
+/*
+ * Send all queued entries. The master relays entries received from
+ * one helper to all the other helpers.
+ */
+static void flush_queue(struct cluster *cluster)
+{
+    uint8_t             buffer[MSG_HEADER_SIZE+4+TT_BATCH_SIZE*TT_ENTRY_SIZE];
+    struct shared_entry *entry;
+    uint8_t             *iter;
+    int                 nentries;
+    int                 count;
+    int                 k;
+    int                 l;
+
+    mutex_lock(&cluster->lock);
+    nentries = cluster->nqueued;
+    memcpy(cluster->outgoing, cluster->queue,
+           nentries*sizeof(struct shared_entry));
+    cluster->nqueued = 0;
+    mutex_unlock(&cluster->lock);
+
+    if (nentries == 0) {
+        return;
+    }
+
+    for (k=0;k<cluster->nconns;k++) {
+        count = 0;
+        iter = &buffer[MSG_HEADER_SIZE+4];
+        for (l=0;l<nentries;l++) {
+            entry = &cluster->outgoing[l];
+            if (entry->source == k) {
+                continue;
+            }
+            write_uint64_le(iter, entry->key);
+            write_uint32_le(iter+8, entry->move);
+            write_uint16_le(iter+12, (uint16_t)entry->score);
+            write_uint16_le(iter+14, (uint16_t)entry->eval);
+            iter[16] = entry->depth;
+            iter[17] = entry->type;
+            iter += TT_ENTRY_SIZE;
+            count++;
+
+            if (count == TT_BATCH_SIZE) {
+                write_uint32_le(&buffer[MSG_HEADER_SIZE], count);
+                send_message(&cluster->conns[k], MSG_TT_ENTRIES, buffer,
+                             4+count*TT_ENTRY_SIZE);
+                count = 0;
+                iter = &buffer[MSG_HEADER_SIZE+4];
+            }
+        }
+        if (count > 0) {
+            write_uint32_le(&buffer[MSG_HEADER_SIZE], count);
+            send_message(&cluster->conns[k], MSG_TT_ENTRIES, buffer,
+                         4+count*TT_ENTRY_SIZE);
+        }
+    }
+}
+
+static void receive_entries(struct cluster *cluster, int source,
+                            uint8_t *payload, int len)
+{
+    struct shared_entry *queued;
+    struct shared_entry entry;
+    uint8_t             *iter;
+    uint32_t            count;
+    uint32_t            k;
+
+    if (len < 4) {
+        return;
+    }
+    count = read_uint32_le(payload);
+    if ((count > ((MAX_MESSAGE_SIZE-4)/TT_ENTRY_SIZE)) ||
+        ((uint32_t)len != (4+count*TT_ENTRY_SIZE))) {
+        return;
+    }
+
+    /*
+     * Entries are only stored while searching since the table may
+     * be resized or cleared between searches.
+     */
+    mutex_lock(&cluster->lock);
+    if (!cluster->searching) {
+        mutex_unlock(&cluster->lock);
+        return;
+    }
+    iter = payload + 4;
+    for (k=0;k<count;k++,iter+=TT_ENTRY_SIZE) {
+        entry.key = read_uint64_le(iter);
+        entry.move = read_uint32_le(iter+8);
+        entry.score = (int16_t)read_uint16_le(iter+12);
+        entry.eval = (int16_t)read_uint16_le(iter+14);
+        entry.depth = iter[16];
+        entry.type = iter[17];
+        entry.source = (int8_t)source;
+        if ((entry.depth >= MAX_SEARCH_DEPTH) || (entry.type > TT_ALPHA)) {
+            continue;
+        }
+
+        hash_tt_store_entry(cluster->engine, entry.key, entry.move,
+                            entry.depth, entry.score, entry.type, entry.eval);
+        if (cluster->master && (cluster->nconns > 1) &&
+            (cluster->nqueued < TT_QUEUE_SIZE)) {
+            queued = &cluster->queue[cluster->nqueued++];
+            *queued = entry;
+        }
+    }
+    mutex_unlock(&cluster->lock);
+}
+
+static void receive_result(struct cluster *cluster, int source,
+                           uint8_t *payload, int len)
+{
+    struct connection *conn = &cluster->conns[source];
+    struct pvinfo     *result = &conn->result;
+    int               npv;
+    int               k;
+
+    if (len < 12) {
+        return;
+    }
+    npv = read_uint16_le(payload+10);
+    if ((npv > MAX_PLY) || (len != (12+npv*4))) {
+        return;
+    }
+
+    mutex_lock(&cluster->lock);
+    if (read_uint32_le(payload) == cluster->search_id) {
+        result->score = (int32_t)read_uint32_le(payload+4);
+        result->depth = payload[8];
+        result->seldepth = payload[9];
+        result->pv.size = npv;
+        for (k=0;k<npv;k++) {
+            result->pv.moves[k] = read_uint32_le(payload+12+k*4);
+        }
+        conn->has_result = true;
+    }
+    mutex_unlock(&cluster->lock);
+}
+
+static void receive_nodes(struct cluster *cluster, int source,
+                          uint8_t *payload, int len)
+{
+    if (len != 12) {
+        return;
+    }
+
+    mutex_lock(&cluster->lock);
+    if (read_uint32_le(payload) == cluster->search_id) {
+        atomic_store(&cluster->conns[source].nodes,
+                     read_uint64_le(payload+4));
+    }
+    mutex_unlock(&cluster->lock);
+}
+
+static thread_retval_t node_search_func(void *data)
+{
+    struct cluster *cluster = data;
+
+    (void)search_position(cluster->engine, false, NULL, NULL);
+    atomic_store(&cluster->search_done, true);
+
+    return (thread_retval_t)0;
+}
+
+static void finish_node_search(struct cluster *cluster)
+{
+    uint8_t       buffer[MSG_HEADER_SIZE+12+MAX_PLY*4];
+    struct pvinfo *line = &cluster->engine->best_line;
+    int           k;
+
+    if (!cluster->running) {
+        return;
+    }
+
+    thread_join(&cluster->search_thread);
+    cluster->running = false;
+
+    mutex_lock(&cluster->lock);
+    cluster->searching = false;
+    cluster->nqueued = 0;
+    mutex_unlock(&cluster->lock);
+
+    write_uint32_le(&buffer[MSG_HEADER_SIZE], cluster->search_id);
+    write_uint32_le(&buffer[MSG_HEADER_SIZE+4], (uint32_t)line->score);
+    buffer[MSG_HEADER_SIZE+8] = (uint8_t)line->depth;
+    buffer[MSG_HEADER_SIZE+9] = (uint8_t)MIN(line->seldepth, UINT8_MAX);
+    write_uint16_le(&buffer[MSG_HEADER_SIZE+10], (uint16_t)line->pv.size);
+    for (k=0;k<line->pv.size;k++) {
+        write_uint32_le(&buffer[MSG_HEADER_SIZE+12+k*4], line->pv.moves[k]);
+    }
+    send_message(&cluster->conns[0], MSG_RESULT, buffer, 12+line->pv.size*4);
+}
+
+static void start_node_search(struct cluster *cluster, uint8_t *payload,
+                              int len)
+{
+    struct engine *engine = cluster->engine;
+    char          fen[FEN_MAX_LENGTH+1];
+    uint32_t      move;
+    int           nfilter;
+    int           nmoves;
+    int           fenlen;
+    int           k;
+
+    if (len < 12) {
+        return;
+    }
+    nfilter = read_uint16_le(payload+6);
+    nmoves = read_uint16_le(payload+8);
+    fenlen = read_uint16_le(payload+10);
+    if ((nfilter > MAX_MOVES) || ((nmoves+MAX_PLY) > MAX_HISTORY_SIZE) ||
+        (fenlen > FEN_MAX_LENGTH) ||
+        (len != (12+(nfilter+nmoves)*4+fenlen))) {
+        return;
+    }
+
+    /* Stop any search that is still running */
+    if (cluster->running) {
+        smp_stop_all(engine);
+        finish_node_search(cluster);
+    }
+
+    /* Setup the position */
+    engine_variant = (payload[4] != 0)?VARIANT_FRC:VARIANT_STANDARD;
+    memcpy(fen, payload+12+(nfilter+nmoves)*4, fenlen);
+    fen[fenlen] = '\0';
+    if (!pos_setup_from_fen(&engine->pos, fen)) {
+        return;
+    }
+    for (k=0;k<nmoves;k++) {
+        move = read_uint32_le(payload+12+(nfilter+k)*4);
+        if (!pos_is_move_pseudo_legal(&engine->pos, move) ||
+            !pos_make_move(&engine->pos, move)) {
+            return;
+        }
+    }
+
+    /* Search with the same limits as the master */
+    engine->move_filter.size = nfilter;
+    for (k=0;k<nfilter;k++) {
+        engine->move_filter.moves[k] = read_uint32_le(payload+12+k*4);
+    }
+    engine->sd = CLAMP(payload[5], 1, MAX_SEARCH_DEPTH);
+    engine->multipv = 1;
+    engine->exit_on_mate = false;
+    tc_configure_time_control(engine, 0, 0, 0, TC_INFINITE_TIME);
+
+    mutex_lock(&cluster->lock);
+    cluster->search_id = read_uint32_le(payload);
+    cluster->searching = true;
+    cluster->nqueued = 0;
+    mutex_unlock(&cluster->lock);
+
+    atomic_store(&cluster->search_done, false);
+    cluster->running = true;
+    thread_create(&cluster->search_thread, node_search_func, cluster);
+}
+
+/*
+ * Check the secret sent by a master. The comparison always looks at
+ * the whole secret so that the time taken doesn't reveal how much of
+ * it matched.
+ */
+static bool check_secret(uint8_t *payload, int len)
+{
+    int     secret_len = (int)strlen(engine_cluster_secret);
+    uint8_t diff;
+    int     k;
+
+    if ((secret_len == 0) || (len != secret_len)) {
+        return false;
+    }
+    diff = 0;
+    for (k=0;k<len;k++) {
+        diff |= payload[k]^(uint8_t)engine_cluster_secret[k];
+    }
+    return diff == 0;
+}
+
+static void process_message(struct cluster *cluster, int source,
+                            enum message_type type, uint8_t *payload, int len)
+{
+    struct connection *conn = &cluster->conns[source];
+
+    if (!conn->authenticated) {
+        if ((type == MSG_HELLO) && check_secret(payload, len)) {
+            conn->authenticated = true;
+        } else {
+            atomic_store(&conn->failed, true);
+        }
+        return;
+    }
+
+    switch (type) {
+    case MSG_TT_ENTRIES:
+        receive_entries(cluster, source, payload, len);
+        break;
+    case MSG_RESULT:
+        if (cluster->master) {
+            receive_result(cluster, source, payload, len);
+        }
+        break;
+    case MSG_NODES:
+        if (cluster->master) {
+            receive_nodes(cluster, source, payload, len);
+        }
+        break;
+    case MSG_SEARCH:
+        if (!cluster->master) {
+            start_node_search(cluster, payload, len);
+        }
+        break;
+    case MSG_STOP:
+        if (!cluster->master && (len == 4) &&
+            (read_uint32_le(payload) == cluster->search_id)) {
+            smp_stop_all(cluster->engine);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+/*
+ * Read available data from a connection and process all complete
+ * messages. Returns false if the connection has been closed.
+ */
+static bool receive_messages(struct cluster *cluster, int source)
+{
+    struct connection *conn = &cluster->conns[source];
+    ssize_t           nread;
+    uint32_t          type;
+    uint32_t          len;
+    int               offset;
+
+    nread = recv(conn->fd, conn->rxbuf+conn->rxlen,
+                 MAX_MESSAGE_SIZE-conn->rxlen, 0);
+    if (nread < 0) {
+        return errno == EINTR;
+    } else if (nread == 0) {
+        return false;
+    }
+    conn->rxlen += (int)nread;
+
+    offset = 0;
+    while ((conn->rxlen-offset) >= MSG_HEADER_SIZE) {
+        if (atomic_load(&conn->failed)) {
+            return false;
+        }
+        type = read_uint32_le(conn->rxbuf+offset);
+        len = read_uint32_le(conn->rxbuf+offset+4);
+        if (len > (MAX_MESSAGE_SIZE-MSG_HEADER_SIZE)) {
+            return false;
+        }
+        if ((uint32_t)(conn->rxlen-offset) < (MSG_HEADER_SIZE+len)) {
+            break;
+        }
+        process_message(cluster, source, (enum message_type)type,
+                        conn->rxbuf+offset+MSG_HEADER_SIZE, (int)len);
+        offset += MSG_HEADER_SIZE + len;
+    }
+    memmove(conn->rxbuf, conn->rxbuf+offset, conn->rxlen-offset);
+    conn->rxlen -= offset;
+
+    return !atomic_load(&conn->failed);
+}
+
+static thread_retval_t master_thread_func(void *data)
+{
+    struct cluster *cluster = data;
+    struct pollfd  fds[MAX_CLUSTER_NODES];
+    int            k;
+
+    while (!atomic_load(&cluster->exit)) {
+        for (k=0;k<cluster->nconns;k++) {
+            fds[k].fd = atomic_load(&cluster->conns[k].failed)?
+                                                -1:cluster->conns[k].fd;
+            fds[k].events = POLLIN;
+            fds[k].revents = 0;
+        }
+        if (poll(fds, cluster->nconns, POLL_INTERVAL) > 0) {
+            for (k=0;k<cluster->nconns;k++) {
+                if ((fds[k].revents&(POLLIN|POLLHUP|POLLERR)) &&
+                    !receive_messages(cluster, k)) {
+                    LOG_INFO1("Lost connection to cluster node %d\n", k);
+                    atomic_store(&cluster->conns[k].failed, true);
+                }
+            }
+        }
+        flush_queue(cluster);
+    }
+
+    return (thread_retval_t)0;
+}
+
+static bool is_root_move(struct engine *engine, uint32_t move)
+{
+    int size;
+    int k;
+
+    if (!pos_is_move_pseudo_legal(&engine->pos, move) ||
+        !pos_is_legal(&engine->pos, move)) {
+        return false;
+    }
+    /* The size is published last when a root probe replaces the filter */
+    size = __atomic_load_n(&engine->move_filter.size, __ATOMIC_ACQUIRE);
+    if (size == 0) {
+        return true;
+    }
+    for (k=0;k<size;k++) {
+        if (engine->move_filter.moves[k] == move) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int cluster_connect(struct engine *engine, char *nodes)
+{
+    struct cluster *cluster;
+    char           buffer[MAX_PATH_LENGTH+1];
+    uint8_t        hello[MSG_HEADER_SIZE+MAX_PATH_LENGTH];
+    int            hello_len;
+    char           *node;
+    char           *port;
+    char           *saveptr;
+    int            fd;
+
+    assert(engine != NULL);
+    assert(nodes != NULL);
+
+    cluster_disconnect(engine);
+
+    strncpy(buffer, nodes, MAX_PATH_LENGTH);
+    buffer[MAX_PATH_LENGTH] = '\0';
+    node = strtok_r(buffer, ", ", &saveptr);
+    if (node == NULL) {
+        return 0;
+    }
+
+    cluster = create_cluster(engine, true);
+    if (cluster == NULL) {
+        return 0;
+    }
+    hello_len = (int)strlen(engine_cluster_secret);
+    memcpy(&hello[MSG_HEADER_SIZE], engine_cluster_secret, hello_len);
+    while ((node != NULL) && (cluster->nconns < MAX_CLUSTER_NODES)) {
+        port = strrchr(node, ':');
+        if (port != NULL) {
+            *port = '\0';
+            fd = open_connection(node, port+1);
+            if (fd >= 0) {
+                add_connection(cluster, fd);
+                send_message(&cluster->conns[cluster->nconns-1], MSG_HELLO,
+                             hello, hello_len);
+                LOG_INFO1("Connected to cluster node %s:%s\n", node, port+1);
+            } else {
+                LOG_INFO1("Failed to connect to cluster node %s:%s\n", node,
+                          port+1);
+            }
+        }
+        node = strtok_r(NULL, ", ", &saveptr);
+    }
+    if (cluster->nconns == 0) {
+        destroy_cluster(cluster);
+        return 0;
+    }
+
+    atomic_store(&cluster->exit, false);
+    thread_create(&cluster->thread, master_thread_func, cluster);
+    engine->cluster = cluster;
+
+    return cluster->nconns;
+}
+
+void cluster_disconnect(struct engine *engine)
+{
+    struct cluster *cluster = engine->cluster;
+
+    if ((cluster == NULL) || !cluster->master) {
+        return;
+    }
+
+    atomic_store(&cluster->exit, true);
+    thread_join(&cluster->thread);
+    engine->cluster = NULL;
+    destroy_cluster(cluster);
+}
+
+void cluster_start_search(struct engine *engine)
+{
+    struct cluster  *cluster = engine->cluster;
+    uint8_t         buffer[MSG_HEADER_SIZE+12+(MAX_MOVES+MAX_HISTORY_SIZE)*4+
+                           FEN_MAX_LENGTH];
+    struct position *root;
+    uint8_t         *iter;
+    char            fen[FEN_MAX_LENGTH+1];
+    int             nmoves;
+    int             fenlen;
+    int             first;
+    int             k;
+
+    if ((cluster == NULL) || !cluster->master) {
+        return;
+    }
+
+    /*
+     * Send the position after the last irreversible move together
+     * with the moves leading to the current position. Earlier moves
+     * cannot affect the search.
+     */
+    root = malloc(sizeof(struct position));
+    if (root == NULL) {
+        return;
+    }
+    *root = engine->pos;
+    nmoves = MIN(root->fifty, root->ply);
+    for (k=0;k<nmoves;k++) {
+        pos_unmake_move(root);
+    }
+    fen_build_string(root, fen);
+    free(root);
+    fenlen = (int)strlen(fen);
+    first = engine->pos.ply - nmoves;
+
+    mutex_lock(&cluster->lock);
+    cluster->search_id++;
+    cluster->searching = true;
+    cluster->nqueued = 0;
+    for (k=0;k<cluster->nconns;k++) {
+        atomic_store(&cluster->conns[k].nodes, 0ULL);
+        cluster->conns[k].has_result = false;
+    }
+    mutex_unlock(&cluster->lock);
+
+    iter = &buffer[MSG_HEADER_SIZE];
+    write_uint32_le(iter, cluster->search_id);
+    iter[4] = (engine_variant == VARIANT_FRC)?1:0;
+    iter[5] = (uint8_t)engine->sd;
+    write_uint16_le(iter+6, (uint16_t)engine->move_filter.size);
+    write_uint16_le(iter+8, (uint16_t)nmoves);
+    write_uint16_le(iter+10, (uint16_t)fenlen);
+    iter += 12;
+    for (k=0;k<engine->move_filter.size;k++,iter+=4) {
+        write_uint32_le(iter, engine->move_filter.moves[k]);
+    }
+    for (k=0;k<nmoves;k++,iter+=4) {
+        write_uint32_le(iter, engine->pos.history[first+k].move);
+    }
+    memcpy(iter, fen, fenlen);
+    iter += fenlen;
+
+    for (k=0;k<cluster->nconns;k++) {
+        send_message(&cluster->conns[k], MSG_SEARCH, buffer,
+                     (int)(iter-&buffer[MSG_HEADER_SIZE]));
+    }
+}
+
+bool cluster_finish_search(struct engine *engine, struct pvinfo *best)
+{
+    struct cluster *cluster = engine->cluster;
+    struct pvinfo  lines[MAX_CLUSTER_NODES+1];
+    int64_t        votes[MAX_CLUSTER_NODES+1];
+    uint64_t       start;
+    bool           done;
+    int            nlines;
+    int            min_score;
+    int            winner;
+    int            k;
+    int            l;
+
+    if ((cluster == NULL) || !cluster->master) {
+        return false;
+    }
+
+    /* Stop the helpers and wait for their results */
+    for (k=0;k<cluster->nconns;k++) {
+        send_search_id(&cluster->conns[k], MSG_STOP, cluster->search_id);
+    }
+    start = get_current_time_us();
+    do {
+        done = true;
+        mutex_lock(&cluster->lock);
+        for (k=0;k<cluster->nconns;k++) {
+            if (!cluster->conns[k].has_result &&
+                !atomic_load(&cluster->conns[k].failed)) {
+                done = false;
+            }
+        }
+        mutex_unlock(&cluster->lock);
+        if (!done) {
+            sleep_ms(1);
+        }
+    } while (!done &&
+             ((get_current_time_us()-start) < (RESULT_TIMEOUT*1000ULL)));
+
+    /* Collect the lines to vote between */
+    nlines = 0;
+    if (best->pv.size >= 1) {
+        lines[nlines++] = *best;
+    }
+    mutex_lock(&cluster->lock);
+    cluster->searching = false;
+    cluster->nqueued = 0;
+    for (k=0;k<cluster->nconns;k++) {
+        if (cluster->conns[k].has_result &&
+            (cluster->conns[k].result.pv.size >= 1) &&
+            is_root_move(engine, cluster->conns[k].result.pv.moves[0])) {
+            lines[nlines++] = cluster->conns[k].result;
+        }
+    }
+    mutex_unlock(&cluster->lock);
+    if ((engine->multipv != 1) || (nlines == 0) ||
+        ((nlines == 1) && (best->pv.size >= 1))) {
+        return false;
+    }
+
+    /*
+     * Each line votes for its first move with a weight based on
+     * the depth and the score of the line. The deepest line that
+     * starts with the winning move is selected.
+     */
+    min_score = lines[0].score;
+    for (k=1;k<nlines;k++) {
+        min_score = MIN(min_score, lines[k].score);
+    }
+    for (k=0;k<nlines;k++) {
+        votes[k] = 0;
+        for (l=0;l<nlines;l++) {
+            if (lines[l].pv.moves[0] == lines[k].pv.moves[0]) {
+                votes[k] += (int64_t)(lines[l].score-min_score+14)*
+                                                            lines[l].depth;
+            }
+        }
+    }
+    winner = 0;
+    for (k=1;k<nlines;k++) {
+        if ((votes[k] > votes[winner]) ||
+            ((votes[k] == votes[winner]) &&
+             (lines[k].depth > lines[winner].depth))) {
+            winner = k;
+        }
+    }
+    if ((best->pv.size >= 1) && (winner == 0)) {
+        return false;
+    }
+
+    *best = lines[winner];
+    return true;
+}
+
+void cluster_share_tt_entry(struct cluster *cluster, uint64_t key,
+                            uint32_t move, int depth, int score, int type,
+                            int eval)
+{
+    struct shared_entry *entry;
+
+    mutex_lock(&cluster->lock);
+    if (cluster->searching && (cluster->nqueued < TT_QUEUE_SIZE)) {
+        entry = &cluster->queue[cluster->nqueued++];
+        entry->key = key;
+        entry->move = move;
+        entry->score = (int16_t)score;
+        entry->eval = (int16_t)CLAMP(eval, INT16_MIN, INT16_MAX);
+        entry->depth = (uint8_t)depth;
+        entry->type = (uint8_t)type;
+        entry->source = -1;
+    }
+    mutex_unlock(&cluster->lock);
+}
+
+uint64_t cluster_nodes(struct engine *engine)
+{
+    struct cluster *cluster = engine->cluster;
+    uint64_t       nodes;
+    int            k;
+
+    if ((cluster == NULL) || !cluster->master) {
+        return 0ULL;
+    }
+
+    nodes = 0ULL;
+    for (k=0;k<cluster->nconns;k++) {
+        nodes += atomic_load_explicit(&cluster->conns[k].nodes,
+                                      memory_order_relaxed);
+    }
+    return nodes;
+}
+
+static void serve_master(struct cluster *cluster)
+{
+    struct connection *conn = &cluster->conns[0];
+    struct pollfd     fds;
+    uint8_t           buffer[MSG_HEADER_SIZE+12];
+    uint64_t          last_report;
+    uint64_t          now;
+
+    last_report = 0ULL;
+    while (!atomic_load(&conn->failed)) {
+        fds.fd = conn->fd;
+        fds.events = POLLIN;
+        fds.revents = 0;
+        if ((poll(&fds, 1, POLL_INTERVAL) > 0) &&
+            (fds.revents&(POLLIN|POLLHUP|POLLERR)) &&
+            !receive_messages(cluster, 0)) {
+            break;
+        }
+
+        if (cluster->running && atomic_load(&cluster->search_done)) {
+            finish_node_search(cluster);
+        }
+        flush_queue(cluster);
+
+        /* Report the number of searched nodes */
+        now = get_current_time_us();
+        if (cluster->running && ((now-last_report) >= NODES_INTERVAL*1000)) {
+            write_uint32_le(&buffer[MSG_HEADER_SIZE], cluster->search_id);
+            write_uint64_le(&buffer[MSG_HEADER_SIZE+4],
+                            smp_nodes(cluster->engine));
+            send_message(conn, MSG_NODES, buffer, 12);
+            last_report = now;
+        }
+    }
+
+    /* Abort the search if the master went away */
+    if (cluster->running) {
+        smp_stop_all(cluster->engine);
+        finish_node_search(cluster);
+    }
+}
+
+int cluster_run_node(int argc, char *argv[])
+{
+    struct engine  *engine;
+    struct cluster *cluster;
+    char           *address = CLUSTER_DEFAULT_ADDRESS;
+    char           *port;
+    int            nthreads = engine_default_num_threads;
+    int            hash_size = engine_default_hash_size;
+    int            listener;
+    int            fd;
+
+    if ((argc >= 4) && !strcmp(argv[2], "--bind")) {
+        address = argv[3];
+        argc -= 2;
+        argv += 2;
+    }
+    if ((argc < 3) || (argc > 5)) {
+        printf("Usage: marvin --cluster-node [--bind <address>] <port> "
+               "[<threads> [<hash>]]\n");
+        return 1;
+    }
+    port = argv[2];
+    if (argc > 3) {
+        nthreads = atoi(argv[3]);
+    }
+    if (argc > 4) {
+        hash_size = atoi(argv[4]);
+    }
+    if ((nthreads < 1) || (nthreads > MAX_WORKERS) ||
+        (hash_size < MIN_MAIN_HASH_SIZE) || (hash_size > hash_tt_max_size())) {
+        printf("Error: invalid options\n");
+        return 1;
+    }
+    if (engine_cluster_secret[0] == '\0') {
+        printf("Error: no cluster secret configured\n");
+        return 1;
+    }
+
+    listener = open_listen_socket(address, port, 1);
+    if (listener < 0) {
+        printf("Error: failed to listen on %s port %s\n", address, port);
+        return 1;
+    }
+
+    engine = engine_create(hash_size, nthreads);
+    if (engine == NULL) {
+        close(listener);
+        return 1;
+    }
+    cluster = create_cluster(engine, false);
+    if (cluster == NULL) {
+        engine_destroy(engine);
+        close(listener);
+        return 1;
+    }
+    engine->cluster = cluster;
+
+    /* Serve one master at a time */
+    printf("Listening on %s port %s\n", address, port);
+    while (true) {
+        fd = accept(listener, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        add_connection(cluster, fd);
+        printf("Master connected\n");
+
+        serve_master(cluster);
+
+        close(fd);
+        cluster->conns[0].fd = -1;
+        cluster->nconns = 0;
+        printf("Master disconnected\n");
+    }
+
+    engine->cluster = NULL;
+    destroy_cluster(cluster);
+    engine_destroy(engine);
+    close(listener);
+
+    return 0;
+}
+
+#else
+
+int cluster_connect(struct engine *engine, char *nodes)
+{
+    (void)engine;
+    (void)nodes;
+
+    return 0;
+}
+
+void cluster_disconnect(struct engine *engine)
+{
+    (void)engine;
+}
+
+void cluster_start_search(struct engine *engine)
+{
+    (void)engine;
+}
+
+bool cluster_finish_search(struct engine *engine, struct pvinfo *best)
+{
+    (void)engine;
+    (void)best;
+
+    return false;
+}
+
+void cluster_share_tt_entry(struct cluster *cluster, uint64_t key,
+                            uint32_t move, int depth, int score, int type,
+                            int eval)
+{
+    (void)cluster;
+    (void)key;
+    (void)move;
+    (void)depth;
+    (void)score;
+    (void)type;
+    (void)eval;
+}
+
+uint64_t cluster_nodes(struct engine *engine)
+{
+    (void)engine;
+
+    return 0ULL;
+}
+
+int cluster_run_node(int argc, char *argv[])
+{
+    (void)argc;
+    (void)argv;
+
+    printf("Cluster mode is not supported on this platform\n");
+    return 1;
+}
+
+#endif
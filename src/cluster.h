@@ -0,0 +1,114 @@
+/*
+ * Marvin - an UCI/XBoard compatible chess engine
+ * Copyright (C) 2023 Martin Danielsson
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef CLUSTER_H
+#define CLUSTER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "types.h"
+
+/*
+ * The minimum depth of transposition table entries that are
+ * shared with the other nodes in a cluster.
+ */
+#define CLUSTER_MIN_DEPTH 8
+
+/* The maximum number of helper nodes in a cluster */
+#define MAX_CLUSTER_NODES 16
+
+/*
+ * Connect an engine to a set of helper nodes. The helpers are started
+ * with the --cluster-node option and are given as a comma-separated list
+ * of host:port pairs. Any previous connections are closed first and an
+ * empty list disconnects the engine from the cluster.
+ *
+ * @param engine The engine.
+ * @param nodes The helper nodes to connect to.
+ * @return Returns the number of helpers that could be connected.
+ */
+int cluster_connect(struct engine *engine, char *nodes);
+
+/*
+ * Disconnect an engine from its helper nodes.
+ *
+ * @param engine The engine.
+ */
+void cluster_disconnect(struct engine *engine);
+
+/*
+ * Tell the helper nodes to start searching the current position of
+ * the engine. Has no effect if the engine is not part of a cluster.
+ *
+ * @param engine The engine.
+ */
+void cluster_start_search(struct engine *engine);
+
+/*
+ * Stop the helper nodes and collect their results. The best move is
+ * selected by a vote between the lines found by the helpers and the
+ * best local line, where each line is weighted by its depth and score.
+ *
+ * @param engine The engine.
+ * @param best The best local line. Updated with the winning line.
+ * @return Returns true if the line was replaced by one from a helper.
+ */
+bool cluster_finish_search(struct engine *engine, struct pvinfo *best);
+
+/*
+ * Queue a transposition table entry to be sent to the other nodes
+ * in the cluster. Mate scores should already be relative to the
+ * position.
+ *
+ * @param cluster The cluster.
+ * @param key The position key.
+ * @param move The best move found.
+ * @param depth The depth to which the position was searched.
+ * @param score The score for the position.
+ * @param type The type of the score.
+ * @param eval The static evaluation of the position.
+ */
+void cluster_share_tt_entry(struct cluster *cluster, uint64_t key,
+                            uint32_t move, int depth, int score, int type,
+                            int eval);
+
+/*
+ * Get the number of nodes searched by the helper nodes during
+ * the current search.
+ *
+ * @param engine The engine.
+ * @return Returns the number of nodes.
+ */
+uint64_t cluster_nodes(struct engine *engine);
+
+/*
+ * Run a helper node. The node listens for a master engine on the
+ * given port and searches the positions it is sent. A master has to
+ * send the secret from the CLUSTER_SECRET configuration entry before
+ * it is served. Unless another address is given with --bind the node
+ * only accepts connections from the local host.
+ *
+ * Syntax: --cluster-node [--bind <address>] <port> [<threads> [<hash>]]
+ *
+ * @param argc The number of command line arguments.
+ * @param argv The command line arguments.
+ * @return Return 0 on success or a positive value in case of error.
+ */
+int cluster_run_node(int argc, char *argv[]);
+
+#endif
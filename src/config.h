@@ -34,17 +34,55 @@
 #define MAX_MAIN_HASH_SIZE_32BIT 1024
 #define MAX_MAIN_HASH_SIZE_64BIT 131072
 
+/* The size of the pawn hash table used by each worker (in KB) */
+#define PAWN_HASH_SIZE 1024
+#define LOW_MEMORY_PAWN_HASH_SIZE 64
+
+/* The size of the material hash table used by each worker (in KB) */
+#define MATERIAL_HASH_SIZE 1024
+#define LOW_MEMORY_MATERIAL_HASH_SIZE 16
+
+/* Limits for the number of pieces of preloaded tablebases */
+#define TB_MAX_PIECES 7
+
+/* The default amount of tablebase data to preload (in MB) */
+#define DEFAULT_SYZYGY_PRELOAD_MEMORY 1024
+#define MAX_SYZYGY_PRELOAD_MEMORY 1048576
+
+/* The number of events kept for each worker when tracing a search */
+#define TRACE_BUFFER_SIZE 65536
+
+/*
+ * The number of entries in the tablebase WDL cache used by
+ * each worker (must be a power of 2).
+ */
+#define EGTB_CACHE_SIZE 4096
+
+/* The default size of the perft hash table (in MB) */
+#define PERFT_HASH_SIZE 64
+
 /* Move overhead (in ms) to avoid losing on time */
 #define DEFAULT_MOVE_OVERHEAD 50
 #define MIN_MOVE_OVERHEAD 0
 #define MAX_MOVE_OVERHEAD 2000
 
-/* The size to use for the NNUE cache (in MB) */
-#define NNUE_CACHE_SIZE 2
+/*
+ * The size to use for the NNUE cache (in MB). This value can
+ * be configured at runtime by using the UCI EvalCache option.
+ */
+#define DEFAULT_EVAL_CACHE_SIZE 2
+#define MIN_EVAL_CACHE_SIZE 0
+#define MAX_EVAL_CACHE_SIZE 4096
 
 /* The maximum number of supported worker threads */
 #define MAX_WORKERS 512
 
+/*
+ * The number of entries in the table used to keep track of which
+ * positions are currently being searched (must be a power of 2).
+ */
+#define BUSY_TABLE_SIZE 32768
+
 /* The maximum number of MultiPV lines that can be reported */
 #define MAX_MULTIPV_LINES 32
 
@@ -0,0 +1,79 @@
+/*
+ * Marvin - an UCI/XBoard compatible chess engine
+ * Copyright (C) 2015 Martin Danielsson
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdbool.h>
+
+#include "cpu.h"
+#include "simd.h"
+#include "utils.h"
+#include "bitboard.h"
+
+#ifdef USE_DISPATCH
+/* The kernels selected by cpu_init */
+struct simd_kernels simd_kernels;
+
+/* Check for a CPU feature using cpuid */
+#define HAS_FEATURE(f) __builtin_cpu_supports(f)
+#endif
+
+void cpu_init(void)
+{
+#ifdef USE_DISPATCH
+    __builtin_cpu_init();
+
+    if (HAS_FEATURE("avx512f") && HAS_FEATURE("avx512bw") &&
+        HAS_FEATURE("avx512vnni")) {
+        simd_kernels = simd_kernels_vnni;
+    } else if (HAS_FEATURE("avx512f") && HAS_FEATURE("avx512bw")) {
+        simd_kernels = simd_kernels_avx512;
+    } else if (HAS_FEATURE("avx2")) {
+        simd_kernels = simd_kernels_avx2;
+    } else if (HAS_FEATURE("ssse3") && HAS_FEATURE("sse4.1")) {
+        simd_kernels = simd_kernels_sse;
+    } else {
+        simd_kernels = simd_kernels_generic;
+    }
+
+    select_pop_count(HAS_FEATURE("popcnt"));
+
+    /*
+     * PEXT is implemented in microcode on Zen 1 and Zen 2 which makes
+     * it slower than magic multiplication there.
+     */
+    bb_select_pext(HAS_FEATURE("bmi2") && !__builtin_cpu_is("znver1") &&
+                   !__builtin_cpu_is("znver2"));
+#endif
+}
+
+const char* cpu_simd_name(void)
+{
+#if defined(USE_DISPATCH)
+    return simd_kernels.name;
+#elif defined(USE_VNNI)
+    return "vnni";
+#elif defined(USE_AVX512)
+    return "avx512";
+#elif defined(USE_AVX2)
+    return "avx2";
+#elif defined(USE_SSE)
+    return "sse";
+#elif defined(USE_NEON)
+    return "neon";
+#else
+    return "generic";
+#endif
+}
@@ -0,0 +1,36 @@
+/*
+ * Marvin - an UCI/XBoard compatible chess engine
+ * Copyright (C) 2015 Martin Danielsson
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef CPU_H
+#define CPU_H
+
+/*
+ * Initialize the CPU component. In builds with runtime dispatch this
+ * detects the features of the CPU and selects the best implementation
+ * of the SIMD kernels and the popcount helper. Must be called before
+ * any other component is initialized.
+ */
+void cpu_init(void);
+
+/*
+ * Get the name of the SIMD kernels that are used.
+ *
+ * @return Returns the name of the kernels.
+ */
+const char* cpu_simd_name(void);
+
+#endif
@@ -98,6 +98,8 @@ int material_values[NPIECES] = {100,  100,      /* pawn */
 
 uint64_t range_mask[NSQUARES][NSQUARES];
 
+uint64_t between_mask[NSQUARES][NSQUARES];
+
 static void init_king_zones(void)
 {
     int sq;
@@ -172,6 +174,8 @@ void data_init(void)
     int rank;
     int file;
     int sq;
+    int fdelta;
+    int rdelta;
 
     /* Initialize square masks */
     white_square_mask = 0ULL;
@@ -348,6 +352,28 @@ void data_init(void)
         }
     }
 
+    /* Between masks */
+    for (k=0;k<NSQUARES;k++) {
+        for (l=0;l<NSQUARES;l++) {
+            between_mask[k][l] = 0ULL;
+            if ((k == l) || (range_mask[k][l] == 0ULL)) {
+                continue;
+            }
+
+            fdelta = (FILENR(l) > FILENR(k))?1:(FILENR(l) < FILENR(k))?-1:0;
+            rdelta = (RANKNR(l) > RANKNR(k))?1:(RANKNR(l) < RANKNR(k))?-1:0;
+            file = FILENR(k) + fdelta;
+            rank = RANKNR(k) + rdelta;
+            sq = SQUARE(file, rank);
+            while (sq != l) {
+                between_mask[k][l] |= sq_mask[sq];
+                file += fdelta;
+                rank += rdelta;
+                sq = SQUARE(file, rank);
+            }
+        }
+    }
+
     /* Initialize king attack zone masks */
     init_king_zones();
 }
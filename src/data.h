@@ -161,6 +161,13 @@ extern int material_values[NPIECES];
  */
 extern uint64_t range_mask[NSQUARES][NSQUARES];
 
+/*
+ * Bitboards for the squares strictly between two squares on the same rank,
+ * file or diagonal. If the squares are not on the same rank, file or
+ * diagonal then the bitboard is empty.
+ */
+extern uint64_t between_mask[NSQUARES][NSQUARES];
+
 /* Initialize global data */
 void data_init(void);
 
@@ -15,13 +15,220 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <inttypes.h>
+
 #include "egtb.h"
 #include "tbprobe.h"
 #include "bitboard.h"
+#include "engine.h"
+#include "thread.h"
+#include "utils.h"
+#include "debug.h"
+
+/* Separator used between directories in the tablebase path */
+#ifdef WINDOWS
+#define PATH_SEPARATOR ';'
+#define DIR_SEPARATOR "\\"
+#else
+#define PATH_SEPARATOR ':'
+#define DIR_SEPARATOR "/"
+#endif
+
+/*
+ * The maximum number of non-king pieces for one side of a table, and
+ * the number of different sets of such pieces.
+ */
+#define MAX_TB_PIECES 5
+#define MAX_PIECE_SETS 126
+
+/* The size of the buffer used when reading table files */
+#define PRELOAD_BUFFER_SIZE (1024*1024)
+
+/* Parameters for a running preload */
+struct preload_job {
+    char     path[MAX_PATH_LENGTH+1];
+    int      max_pieces;
+    uint64_t max_bytes;
+};
+
+static struct preload_job preload_job;
+static thread_t preload_thread;
+static bool preload_running = false;
+static atomic_bool preload_abort = false;
+
+/*
+ * Generate the names of all sets of non-king pieces of a given size. The
+ * pieces are listed in the same order as in the names of tables.
+ */
+static int piece_sets(int npieces, int first, char *prefix, int len,
+                      char sets[][MAX_TB_PIECES+1], int nsets)
+{
+    static const char pieces[] = "QRBNP";
+    int               k;
+
+    if (len == npieces) {
+        memcpy(sets[nsets], prefix, len);
+        sets[nsets][len] = '\0';
+        return nsets + 1;
+    }
+    for (k=first;k<(int)strlen(pieces);k++) {
+        prefix[len] = pieces[k];
+        nsets = piece_sets(npieces, k, prefix, len+1, sets, nsets);
+    }
+    return nsets;
+}
+
+/*
+ * Read a table file in order to bring it into the page cache.
+ *
+ * @return Returns the number of bytes read.
+ */
+static uint64_t preload_file(char *file, uint8_t *buffer, uint64_t max_bytes)
+{
+    FILE     *fp;
+    uint64_t nread;
+    size_t   n;
+
+    fp = fopen(file, "rb");
+    if (fp == NULL) {
+        return 0ULL;
+    }
+
+    nread = 0ULL;
+    while ((nread < max_bytes) && !atomic_load(&preload_abort)) {
+        n = fread(buffer, 1, PRELOAD_BUFFER_SIZE, fp);
+        nread += n;
+        if (n < PRELOAD_BUFFER_SIZE) {
+            break;
+        }
+    }
+    fclose(fp);
+
+    return nread;
+}
+
+static thread_retval_t preload_thread_func(void *data)
+{
+    struct preload_job *job = data;
+    static char        sets[MAX_TB_PIECES+1][MAX_PIECE_SETS][MAX_TB_PIECES+1];
+    int                nsets[MAX_TB_PIECES+1];
+    char               prefix[MAX_TB_PIECES];
+    char               file[MAX_PATH_LENGTH+32];
+    char               *dir;
+    char               *sep;
+    uint8_t            *buffer;
+    uint64_t           start;
+    uint64_t           nbytes;
+    uint64_t           n;
+    int                nfiles;
+    int                total;
+    int                white;
+    int                k;
+    int                l;
+
+    buffer = malloc(PRELOAD_BUFFER_SIZE);
+    if (buffer == NULL) {
+        return (thread_retval_t)0;
+    }
+    for (k=0;k<=MAX_TB_PIECES;k++) {
+        nsets[k] = piece_sets(k, 0, prefix, 0, sets[k], 0);
+    }
+
+    /*
+     * Read the tables with the fewest number of pieces first since
+     * they are the ones most likely to be probed.
+     */
+    start = get_current_time_us();
+    nbytes = 0ULL;
+    nfiles = 0;
+    for (total=0;total<=(job->max_pieces-2);total++) {
+        for (white=total;white>=0;white--) {
+            for (k=0;k<nsets[white];k++) {
+                for (l=0;l<nsets[total-white];l++) {
+                    if (atomic_load(&preload_abort) ||
+                        (nbytes >= job->max_bytes)) {
+                        goto done;
+                    }
+
+                    /* Look for the table in all directories */
+                    dir = job->path;
+                    while (dir != NULL) {
+                        sep = strchr(dir, PATH_SEPARATOR);
+                        snprintf(file, sizeof(file), "%.*s%sK%svK%s.rtbw",
+                                 sep != NULL?(int)(sep-dir):(int)strlen(dir),
+                                 dir, DIR_SEPARATOR, sets[white][k],
+                                 sets[total-white][l]);
+                        n = preload_file(file, buffer, job->max_bytes-nbytes);
+                        if (n > 0ULL) {
+                            nbytes += n;
+                            nfiles++;
+                            break;
+                        }
+                        dir = sep != NULL?sep+1:NULL;
+                    }
+                }
+            }
+        }
+    }
+
+done:
+    free(buffer);
+    LOG_INFO1("Preloaded %d tablebase files (%"PRIu64" MB) in %.1fs\n",
+              nfiles, nbytes/(1024ULL*1024ULL),
+              (get_current_time_us()-start)/1000000.0);
+    if (engine_protocol == PROTOCOL_UCI) {
+        engine_write_command(
+                "info string Preloaded %d tablebase files (%"PRIu64" MB) in"
+                " %.1fs", nfiles, nbytes/(1024ULL*1024ULL),
+                (get_current_time_us()-start)/1000000.0);
+    }
+
+    return (thread_retval_t)0;
+}
+
+static void stop_preload(void)
+{
+    if (!preload_running) {
+        return;
+    }
+    atomic_store(&preload_abort, true);
+    thread_join(&preload_thread);
+    preload_running = false;
+}
 
 void egtb_init(char *path)
 {
+    stop_preload();
     tb_init(path);
+    egtb_preload(path, engine_syzygy_preload_pieces,
+                 engine_syzygy_preload_memory);
+}
+
+void egtb_preload(char *path, int max_pieces, int max_mb)
+{
+    stop_preload();
+
+    max_pieces = MIN(max_pieces, (int)TB_LARGEST);
+    if ((path[0] == '\0') || (max_pieces < 3) || (max_mb <= 0)) {
+        return;
+    }
+
+    /*
+     * The tables are read by a separate thread, which only brings the
+     * files into the page cache of the operating system. Fathom then finds
+     * the data already in memory once it maps the files.
+     */
+    strncpy(preload_job.path, path, MAX_PATH_LENGTH);
+    preload_job.path[MAX_PATH_LENGTH] = '\0';
+    preload_job.max_pieces = max_pieces;
+    preload_job.max_bytes = ((uint64_t)max_mb)*1024ULL*1024ULL;
+    atomic_store(&preload_abort, false);
+    preload_running = true;
+    thread_create(&preload_thread, preload_thread_func, &preload_job);
 }
 
 bool egtb_should_probe(struct position *pos)
@@ -106,7 +313,33 @@ bool egtb_probe_dtz_tables(struct position *pos, uint32_t *move, int *score)
 
 bool egtb_probe_wdl_tables(struct position *pos, int *score)
 {
-    unsigned int res;
+    struct search_worker   *worker = pos->worker;
+    struct egtb_cache_item *item = NULL;
+    unsigned int           res;
+
+    /*
+     * Positions with castling rights or a non-zero fifty move counter
+     * are never found in the tablebases, so there is no need to cache them.
+     */
+    if ((pos->castle != 0) || (pos->fifty != 0)) {
+        *score = 0;
+        return false;
+    }
+
+    /*
+     * Check the cache of the worker first. Looking up a position in
+     * the tablebases can be expensive since it may require pages of the
+     * table files to be read and decompressed.
+     */
+    if (worker != NULL) {
+        worker->egtb_probes++;
+        item = &worker->egtb_cache[pos->key&(EGTB_CACHE_SIZE-1)];
+        if ((item->result != 0) && (item->key == pos->key)) {
+            worker->egtb_cache_hits++;
+            res = item->result - 1;
+            goto found;
+        }
+    }
 
     res = tb_probe_wdl(pos->bb_sides[WHITE], pos->bb_sides[BLACK],
                     pos->bb_pieces[WHITE_KING]|pos->bb_pieces[BLACK_KING],
@@ -122,7 +355,12 @@ bool egtb_probe_wdl_tables(struct position *pos, int *score)
         *score = 0;
         return false;
     }
+    if (item != NULL) {
+        item->key = pos->key;
+        item->result = (uint8_t)(res + 1);
+    }
 
+found:
     switch (res) {
     case TB_WIN:
         *score = TABLEBASE_WIN - pos->height;
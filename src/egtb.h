@@ -28,6 +28,18 @@
 
 void egtb_init(char *path);
 
+/*
+ * Read the WDL tables with a limited number of pieces in the background
+ * in order to bring them into the file cache of the operating system. Any
+ * preload that is already running is stopped first.
+ *
+ * @param path The tablebase path.
+ * @param max_pieces The maximum number of pieces (including kings) of
+ *                   tables to read. If less than 3 nothing is read.
+ * @param max_mb The maximum amount of data to read (in MB).
+ */
+void egtb_preload(char *path, int max_pieces, int max_mb);
+
 bool egtb_should_probe(struct position *pos);
 
 bool egtb_probe_dtz_tables(struct position *pos, uint32_t *move, int *score);
@@ -21,6 +21,7 @@
 #include <string.h>
 #include <ctype.h>
 #include <inttypes.h>
+#include <stdatomic.h>
 
 #include "engine.h"
 #include "uci.h"
@@ -38,6 +39,9 @@
 #include "position.h"
 #include "hash.h"
 #include "egtb.h"
+#include "numa.h"
+#include "stats.h"
+#include "cluster.h"
 
 /* The maximum length of a line in the configuration file */
 #define CFG_MAX_LINE_LENGTH 1024
@@ -48,15 +52,40 @@
 /* Size of the transmit buffer */
 #define TX_BUFFER_SIZE 4096
 
+/* Size of the buffer used for queueing commands before they are sent */
+#define OUTPUT_BUFFER_SIZE (16*TX_BUFFER_SIZE)
+
+/* The maximum number of received commands waiting to be processed */
+#define INPUT_QUEUE_SIZE 16
+
 /* Global engine variables */
 enum protocol engine_protocol = PROTOCOL_UNSPECIFIED;
 enum variant engine_variant = VARIANT_STANDARD;
 char engine_syzygy_path[MAX_PATH_LENGTH+1] = {'\0'};
+int engine_syzygy_preload_pieces = 0;
+int engine_syzygy_preload_memory = DEFAULT_SYZYGY_PRELOAD_MEMORY;
 int engine_default_hash_size = DEFAULT_MAIN_HASH_SIZE;
 int engine_default_num_threads = 1;
+bool engine_large_pages = false;
+int engine_eval_cache_size = DEFAULT_EVAL_CACHE_SIZE;
+bool engine_eval_cache_shared = false;
+
+/* Flag indicating if the tables of the workers should be kept small */
+bool engine_low_memory = false;
+
+/* Flag indicating if read-only tables should be placed in shared memory */
+bool engine_shared_tables = false;
+
+/* Flag indicating if workers should defer moves searched by other workers */
+bool engine_abdada = false;
+
+/* File to write search traces to, empty if tracing is disabled */
+char engine_trace_file[MAX_PATH_LENGTH+1] = {'\0'};
 bool engine_using_nnue = false;
 bool engine_loaded_net = false;
 char engine_eval_file[MAX_PATH_LENGTH+1] = {'\0'};
+char engine_cluster_nodes[MAX_PATH_LENGTH+1] = {'\0'};
+char engine_cluster_secret[MAX_PATH_LENGTH+1] = {'\0'};
 
 /* Buffer used for receiving commands */
 static char rx_buffer[RX_BUFFER_SIZE+1];
@@ -70,9 +99,85 @@ static char tx_buffer[TX_BUFFER_SIZE+1];
  */
 static char pending_cmd_buffer[RX_BUFFER_SIZE+1];
 
+/* Commands waiting to be sent */
+static char output_buffer[OUTPUT_BUFFER_SIZE];
+static int output_size = 0;
+
 /* Lock used to synchronize command output */
 static mutex_t tx_lock;
 
+/*
+ * Queue of commands read by the input thread. The queue is protected
+ * by input_lock and the events are used to signal when a command has
+ * been added to or removed from the queue.
+ */
+static char input_queue[INPUT_QUEUE_SIZE][RX_BUFFER_SIZE+1];
+static int input_head = 0;
+static int input_count = 0;
+static bool input_eof = false;
+static bool input_closing = false;
+static mutex_t input_lock;
+static event_t input_added_event;
+static event_t input_removed_event;
+static thread_t input_thread;
+
+/* The streams used by the current session */
+static FILE *input_stream = NULL;
+static FILE *output_stream = NULL;
+
+/*
+ * Flag indicating that there is input waiting to be processed. This
+ * is the only thing that is checked by the search so that it never
+ * has to do any system calls to look for input.
+ */
+static atomic_bool input_pending = false;
+
+static thread_retval_t input_thread_func(void *data)
+{
+    char buffer[RX_BUFFER_SIZE+1];
+    bool eof;
+
+    (void)data;
+
+    while (true) {
+        eof = fgets(buffer, RX_BUFFER_SIZE, input_stream) == NULL;
+
+        /*
+         * Wait until there is room in the queue. If the session is
+         * closing then the queue is never emptied so the thread exits.
+         */
+        mutex_lock(&input_lock);
+        while (!eof && !input_closing && (input_count == INPUT_QUEUE_SIZE)) {
+            mutex_unlock(&input_lock);
+            event_wait(&input_removed_event);
+            mutex_lock(&input_lock);
+        }
+        if (input_closing) {
+            mutex_unlock(&input_lock);
+            break;
+        }
+
+        /* Add the command to the queue */
+        if (eof) {
+            input_eof = true;
+        } else {
+            strcpy(input_queue[(input_head+input_count)%INPUT_QUEUE_SIZE],
+                   buffer);
+            input_count++;
+        }
+        atomic_store(&input_pending, true);
+        mutex_unlock(&input_lock);
+        event_set(&input_added_event);
+
+        if (eof) {
+            break;
+        }
+    }
+
+    return (thread_retval_t)0;
+}
+
+
 /*
  * Custom command
  * Syntax: display
@@ -84,11 +189,12 @@ static void cmd_display(struct engine *engine)
 
 /*
  * Custom command
- * Syntax: divide <depth>
+ * Syntax: divide <depth> [<hash>]
  */
 static void cmd_divide(char *cmd, struct engine *engine)
 {
     int  depth;
+    int  hash_size;
     char *iter;
 
     iter = strchr(cmd, ' ');
@@ -97,11 +203,15 @@ static void cmd_divide(char *cmd, struct engine *engine)
     }
     iter++;
 
-    if (sscanf(iter, "%d", &depth) != 1) {
+    hash_size = PERFT_HASH_SIZE;
+    if (sscanf(iter, "%d %d", &depth, &hash_size) < 1) {
+        return;
+    }
+    if ((depth <= 0) || (hash_size < 0)) {
         return;
     }
 
-    test_run_divide(&engine->pos, depth);
+    test_run_divide(engine, depth, hash_size);
 }
 
 /*
@@ -126,11 +236,12 @@ static void cmd_eval(struct engine *engine)
 
 /*
  * Custom command
- * Syntax: perft <depth>
+ * Syntax: perft <depth> [<hash>]
  */
 static void cmd_perft(char *cmd, struct engine *engine)
 {
     int  depth;
+    int  hash_size;
     char *iter;
 
     iter = strchr(cmd, ' ');
@@ -139,28 +250,86 @@ static void cmd_perft(char *cmd, struct engine *engine)
     }
     iter++;
 
-    if (sscanf(iter, "%d", &depth) != 1) {
+    hash_size = PERFT_HASH_SIZE;
+    if (sscanf(iter, "%d %d", &depth, &hash_size) < 1) {
         return;
     }
+    if ((depth <= 0) || (hash_size < 0)) {
+        return;
+    }
+
+    test_run_perft(engine, depth, hash_size);
+}
+
+/*
+ * Custom command
+ * Syntax: stats [reset]
+ */
+static void cmd_stats(char *cmd, struct engine *engine)
+{
+    char *iter;
 
-    test_run_perft(&engine->pos, depth);
+    iter = skip_whitespace(cmd+strlen("stats"));
+    if (MATCH(iter, "reset")) {
+        stats_reset(engine);
+    } else {
+        stats_print(engine);
+    }
 }
 
 /*
  * Custom command
- * Syntax: bench
+ * Syntax: bench [<depth> [<threads> [<hash> [<fenfile>]]]] [json]
+ *               [reproducible]
  */
-static void cmd_bench(void)
+static void cmd_bench(char *cmd)
+{
+    struct bench_options options;
+    int                  values[3] = {0, 0, 0};
+    char                 fenfile[MAX_PATH_LENGTH];
+    char                 token[MAX_PATH_LENGTH];
+    int                  nargs = 0;
+    int                  len;
+    char                 *iter;
+
+    memset(&options, 0, sizeof(options));
+    options.threshold = DEFAULT_BENCH_THRESHOLD;
+    iter = cmd + strlen("bench");
+    while ((strlen(iter) < sizeof(token)) &&
+           (sscanf(iter, "%s%n", token, &len) == 1)) {
+        iter += len;
+        if (MATCH(token, "json")) {
+            options.json = true;
+        } else if (MATCH(token, "reproducible")) {
+            options.reproducible = true;
+        } else if (nargs < 3) {
+            values[nargs++] = atoi(token);
+        } else if (options.fenfile == NULL) {
+            strcpy(fenfile, token);
+            options.fenfile = fenfile;
+        }
+    }
+    options.depth = values[0];
+    options.nthreads = values[1];
+    options.hash_size = values[2];
+
+    (void)test_run_benchmark(&options);
+}
+
+void engine_init(void)
 {
-    test_run_benchmark();
+    mutex_init(&tx_lock);
 }
 
 void engine_read_config_file(char *cfgfile)
 {
-    FILE *fp;
-    char buffer[CFG_MAX_LINE_LENGTH];
-    char *line;
-    int  int_val;
+    FILE             *fp;
+    enum numa_policy policy;
+    char             buffer[CFG_MAX_LINE_LENGTH];
+    char             str_val[CFG_MAX_LINE_LENGTH];
+    char             *line;
+    int              int_val;
+    bool             eval_cache_set = false;
 
     /* Initialise */
     fp = fopen(cfgfile, "r");
@@ -178,48 +347,260 @@ void engine_read_config_file(char *cfgfile)
             dbg_set_log_level(int_val);
         } else if (sscanf(line, "SYZYGY_PATH=%s", engine_syzygy_path) == 1) {
             egtb_init(engine_syzygy_path);
+        } else if (sscanf(line, "SYZYGY_PRELOAD_PIECES=%d", &int_val) == 1) {
+            engine_syzygy_preload_pieces = CLAMP(int_val, 0, TB_MAX_PIECES);
+            egtb_preload(engine_syzygy_path, engine_syzygy_preload_pieces,
+                         engine_syzygy_preload_memory);
+        } else if (sscanf(line, "SYZYGY_PRELOAD_MEMORY=%d", &int_val) == 1) {
+            engine_syzygy_preload_memory = MAX(int_val, 0);
+            egtb_preload(engine_syzygy_path, engine_syzygy_preload_pieces,
+                         engine_syzygy_preload_memory);
         } else if (sscanf(line, "NUM_THREADS=%d", &int_val) == 1) {
             engine_default_num_threads = CLAMP(int_val, 1, MAX_WORKERS);
+        } else if (sscanf(line, "LARGE_PAGES=%d", &int_val) == 1) {
+            engine_large_pages = int_val != 0;
+        } else if (sscanf(line, "EVAL_CACHE_SIZE=%d", &int_val) == 1) {
+            engine_eval_cache_size = CLAMP(int_val, MIN_EVAL_CACHE_SIZE,
+                                           MAX_EVAL_CACHE_SIZE);
+            eval_cache_set = true;
+        } else if (sscanf(line, "EVAL_CACHE_SHARED=%d", &int_val) == 1) {
+            engine_eval_cache_shared = int_val != 0;
+        } else if (sscanf(line, "SHARED_TABLES=%d", &int_val) == 1) {
+            engine_shared_tables = int_val != 0;
+        } else if (sscanf(line, "ABDADA=%d", &int_val) == 1) {
+            engine_abdada = int_val != 0;
+        } else if (sscanf(line, "LOW_MEMORY=%d", &int_val) == 1) {
+            engine_low_memory = int_val != 0;
+        } else if (sscanf(line, "NUMA_POLICY=%s", str_val) == 1) {
+            if (numa_policy_from_name(str_val, &policy)) {
+                numa_set_policy(policy);
+            } else {
+                printf("info string Unknown NUMA policy %s\n", str_val);
+            }
+        } else if (sscanf(line, "CLUSTER_NODES=%s",
+                          engine_cluster_nodes) == 1) {
+            /* The helper nodes are connected when the engine is started */
+        } else if (sscanf(line, "CLUSTER_SECRET=%s",
+                          engine_cluster_secret) == 1) {
+            /* Sent to the helper nodes when connecting to them */
         }
 
         /* Next line */
         line = fgets(buffer, CFG_MAX_LINE_LENGTH, fp);
     }
 
+    /*
+     * Unless a size is given explicitly the low memory profile
+     * doesn't use an NNUE cache.
+     */
+    if (engine_low_memory && !eval_cache_set) {
+        engine_eval_cache_size = 0;
+    }
+
     /* Clean up */
     fclose(fp);
 }
 
-struct engine* engine_create(void)
+static struct engine* allocate_engine(int hash_size, int nthreads,
+                                      bool async)
 {
     struct engine *engine;
 
+    assert((hash_size >= MIN_MAIN_HASH_SIZE) &&
+           (hash_size <= hash_tt_max_size()));
+    assert((nthreads >= 1) && (nthreads <= MAX_WORKERS));
+
     engine = aligned_malloc(64, sizeof(struct engine));
     if (engine == NULL) {
         return NULL;
     }
     memset(engine, 0, sizeof(struct engine));
     pos_reset(&engine->pos);
-    pos_setup_start_position(&engine->pos);
     engine->multipv = 1;
+    engine->sd = MAX_SEARCH_DEPTH;
+
+    /*
+     * Create the workers before the transposition table
+     * since they are used to clear it.
+     */
+    tc_init(engine);
+    smp_init(engine);
+    smp_create_workers(engine, nthreads);
+    if (async) {
+        hash_tt_create_table_async(engine, hash_size);
+    } else {
+        hash_tt_create_table(engine, hash_size);
+    }
+
+    return engine;
+}
+
+struct engine* engine_create(int hash_size, int nthreads)
+{
+    struct engine *engine;
+
+    engine = allocate_engine(hash_size, nthreads, false);
+    if (engine != NULL) {
+        engine_setup_position(engine);
+    }
 
     return engine;
 }
 
+struct engine* engine_create_early(int hash_size, int nthreads)
+{
+    return allocate_engine(hash_size, nthreads, true);
+}
+
+void engine_setup_position(struct engine *engine)
+{
+    assert(engine != NULL);
+
+    pos_setup_start_position(&engine->pos);
+}
+
 void engine_destroy(struct engine *engine)
 {
     assert(engine != NULL);
 
+    cluster_disconnect(engine);
+    hash_tt_destroy_table(engine);
+    smp_destroy_workers(engine);
+    smp_destroy(engine);
     aligned_free(engine);
 }
 
+void engine_print_memory_usage(struct engine *engine)
+{
+    struct search_worker *worker;
+    uint64_t             stacks;
+    uint64_t             history;
+    uint64_t             refresh_cache;
+    uint64_t             other;
+    uint64_t             nnue_cache = 0ULL;
+    uint64_t             pawntt = 0ULL;
+    uint64_t             mattt = 0ULL;
+    int                  nworkers = engine->pool.nworkers;
+    int                  k;
+
+    assert(engine != NULL);
+    assert(nworkers > 0);
+
+    worker = engine->pool.workers[0];
+    stacks = sizeof(worker->pv_table) + sizeof(worker->pv_length) +
+             sizeof(worker->killer_table) + sizeof(worker->move_stack) +
+             sizeof(worker->quiet_stack);
+    history = sizeof(worker->countermove_table) +
+              sizeof(worker->history_table) +
+              sizeof(worker->counter_history) +
+              sizeof(worker->follow_history);
+    other = sizeof(struct search_worker) - sizeof(worker->pos) - stacks -
+            history - sizeof(worker->egtb_cache);
+    refresh_cache = (uint64_t)worker->nnue_refresh_buckets*NSIDES*
+                                            sizeof(struct nnue_refresh_item);
+
+    for (k=0;k<nworkers;k++) {
+        worker = engine->pool.workers[k];
+        if (!worker->nnue_cache_shared) {
+            nnue_cache += worker->nnue_cache_size*
+                                            sizeof(struct nnue_cache_bucket);
+        }
+        pawntt += worker->pawntt_size*sizeof(struct pawntt_item);
+        mattt += worker->mattt_size*sizeof(struct material_item);
+    }
+    nnue_cache += engine->pool.shared_nnue_cache_size*
+                                            sizeof(struct nnue_cache_bucket);
+
+    /*
+     * Sizes are reported as allocated. The pages of the workers
+     * are only committed when they are used so the resident size
+     * is usually smaller.
+     */
+    printf("info string Memory (KB), %d worker%s%s\n", nworkers,
+           (nworkers > 1)?"s":"", engine_low_memory?", low memory profile":"");
+    printf("info string   engine: %" PRIu64 "\n",
+           (uint64_t)sizeof(struct engine)/1024);
+    printf("info string   transposition table: %" PRIu64 "\n",
+           (uint64_t)hash_tt_size(engine)*1024);
+    printf("info string   workers: %" PRIu64 "\n",
+           (uint64_t)nworkers*sizeof(struct search_worker)/1024);
+    printf("info string     position and eval stack: %" PRIu64 "\n",
+           (uint64_t)nworkers*sizeof(worker->pos)/1024);
+    printf("info string     search stacks: %" PRIu64 "\n",
+           nworkers*stacks/1024);
+    printf("info string     history tables: %" PRIu64 "\n",
+           nworkers*history/1024);
+    printf("info string     NNUE refresh cache: %" PRIu64 "\n",
+           nworkers*refresh_cache/1024);
+    printf("info string     tablebase cache: %" PRIu64 "\n",
+           (uint64_t)nworkers*sizeof(worker->egtb_cache)/1024);
+    printf("info string     other: %" PRIu64 "\n", nworkers*other/1024);
+    printf("info string   NNUE cache: %" PRIu64 "\n", nnue_cache/1024);
+    printf("info string   pawn hash: %" PRIu64 "\n", pawntt/1024);
+    printf("info string   material hash: %" PRIu64 "\n", mattt/1024);
+}
+
+void engine_open_session(FILE *input, FILE *output)
+{
+    assert(input != NULL);
+    assert(output != NULL);
+
+    mutex_lock(&tx_lock);
+    output_size = 0;
+    output_stream = output;
+    mutex_unlock(&tx_lock);
+
+    input_stream = input;
+    input_head = 0;
+    input_count = 0;
+    input_eof = false;
+    input_closing = false;
+    atomic_store(&input_pending, false);
+    pending_cmd_buffer[0] = '\0';
+
+    /* Start the thread responsible for reading commands */
+    mutex_init(&input_lock);
+    event_init(&input_added_event);
+    event_init(&input_removed_event);
+    thread_create(&input_thread, input_thread_func, NULL);
+}
+
+void engine_close_session(void)
+{
+    /*
+     * The command loop has exited so the input thread may be waiting
+     * for room in a queue that is never going to be emptied. Wake it up
+     * and let it know that it should exit.
+     */
+    mutex_lock(&input_lock);
+    input_closing = true;
+    mutex_unlock(&input_lock);
+    event_set(&input_removed_event);
+    thread_join(&input_thread);
+    event_destroy(&input_removed_event);
+    event_destroy(&input_added_event);
+    mutex_destroy(&input_lock);
+
+    input_stream = NULL;
+
+    /*
+     * Background threads, like the Syzygy preloader, may still write
+     * commands after the session has finished so the stream is cleared
+     * under the output lock.
+     */
+    engine_flush_commands();
+    mutex_lock(&tx_lock);
+    output_stream = NULL;
+    mutex_unlock(&tx_lock);
+}
+
 void engine_loop(struct engine *engine)
 {
     char *cmd;
     bool stop = false;
     bool handled = false;
 
-    mutex_init(&tx_lock);
+    assert(output_stream != NULL);
 
     /* Enter the main command loop */
     while (!stop) {
@@ -246,7 +627,9 @@ void engine_loop(struct engine *engine)
         } else if (MATCH(cmd, "perft")) {
             cmd_perft(cmd, engine);
         } else if (MATCH(cmd, "bench")) {
-            cmd_bench();
+            cmd_bench(cmd);
+        } else if (MATCH(cmd, "stats")) {
+            cmd_stats(cmd, engine);
         } else {
             handled = false;
         }
@@ -262,19 +645,33 @@ void engine_loop(struct engine *engine)
             LOG_INFO1("Unknown command: %s\n", cmd);
         }
     }
-
-    mutex_destroy(&tx_lock);
 }
 
 char* engine_read_command(void)
 {
     char *iter;
 
-    /* Read command from stdin */
-    if (fgets(rx_buffer, RX_BUFFER_SIZE, stdin) == NULL) {
+    /* Wait for the input thread to read a command */
+    mutex_lock(&input_lock);
+    while ((input_count == 0) && !input_eof) {
+        mutex_unlock(&input_lock);
+        event_wait(&input_added_event);
+        mutex_lock(&input_lock);
+    }
+    if (input_count == 0) {
+        atomic_store(&input_pending, false);
+        mutex_unlock(&input_lock);
         return NULL;
     }
 
+    /* Take the first command from the queue */
+    strcpy(rx_buffer, input_queue[input_head]);
+    input_head = (input_head+1)%INPUT_QUEUE_SIZE;
+    input_count--;
+    atomic_store(&input_pending, (input_count > 0) || input_eof);
+    mutex_unlock(&input_lock);
+    event_set(&input_removed_event);
+
     /* Remove trailing white space */
     iter = &rx_buffer[strlen(&rx_buffer[0])-1];
     while ((iter > &rx_buffer[0]) && (isspace(*iter))) {
@@ -287,6 +684,46 @@ char* engine_read_command(void)
     return rx_buffer;
 }
 
+/*
+ * Write all queued commands. Must be called with tx_lock held. If no
+ * session is open the commands are dropped.
+ */
+static void flush_output(void)
+{
+    if (output_size == 0) {
+        return;
+    }
+    if (output_stream == NULL) {
+        output_size = 0;
+        return;
+    }
+
+    (void)fwrite(output_buffer, 1, output_size, output_stream);
+    output_size = 0;
+}
+
+/* Add a command to the output buffer. Must be called with tx_lock held. */
+static void queue_output(char *format, va_list ap)
+{
+    int len;
+
+    len = vsnprintf(tx_buffer, TX_BUFFER_SIZE, format, ap);
+    if (len < 0) {
+        return;
+    }
+    if (len >= TX_BUFFER_SIZE) {
+        len = TX_BUFFER_SIZE - 1;
+    }
+    if ((output_size+len+1) > OUTPUT_BUFFER_SIZE) {
+        flush_output();
+    }
+    memcpy(&output_buffer[output_size], tx_buffer, len);
+    output_buffer[output_size+len] = '\n';
+    output_size += len + 1;
+
+    LOG_INFO2("<== %s\n", tx_buffer);
+}
+
 void engine_write_command(char *format, ...)
 {
     va_list ap;
@@ -296,13 +733,33 @@ void engine_write_command(char *format, ...)
     mutex_lock(&tx_lock);
 
     va_start(ap, format);
-    vsprintf(tx_buffer, format, ap);
-    printf("%s\n", tx_buffer);
+    queue_output(format, ap);
     va_end(ap);
+    flush_output();
 
     mutex_unlock(&tx_lock);
+}
 
-    LOG_INFO2("<== %s\n", tx_buffer);
+void engine_queue_command(char *format, ...)
+{
+    va_list ap;
+
+    assert(format != NULL);
+
+    mutex_lock(&tx_lock);
+
+    va_start(ap, format);
+    queue_output(format, ap);
+    va_end(ap);
+
+    mutex_unlock(&tx_lock);
+}
+
+void engine_flush_commands(void)
+{
+    mutex_lock(&tx_lock);
+    flush_output();
+    mutex_unlock(&tx_lock);
 }
 
 void engine_set_pending_command(char *cmd)
@@ -324,7 +781,12 @@ void engine_clear_pending_command(void)
 
 bool engine_check_input(struct search_worker *worker)
 {
-    if (!poll_input()) {
+    /* Engines that are not driven by a protocol never read input */
+    if (engine_protocol == PROTOCOL_UNSPECIFIED) {
+        return false;
+    }
+
+    if (!atomic_load_explicit(&input_pending, memory_order_relaxed)) {
         return false;
     }
 
@@ -339,6 +801,10 @@ bool engine_check_input(struct search_worker *worker)
 
 bool engine_wait_for_input(struct search_worker *worker)
 {
+    if (engine_protocol == PROTOCOL_UNSPECIFIED) {
+        return false;
+    }
+
     if (engine_protocol == PROTOCOL_UCI) {
         return uci_check_input(worker);
     } else {
@@ -394,3 +860,14 @@ void engine_send_multipv_info(struct search_worker *worker)
         uci_send_multipv_info(worker);
     }
 }
+
+void engine_send_depth_info(struct engine *engine, int depth)
+{
+    if (engine_protocol == PROTOCOL_UNSPECIFIED) {
+        return;
+    }
+
+    if (engine_protocol == PROTOCOL_UCI) {
+        uci_send_depth_info(engine, depth);
+    }
+}
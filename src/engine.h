@@ -18,6 +18,7 @@
 #ifndef ENGINE_H
 #define ENGINE_H
 
+#include <stdio.h>
 #include <stdbool.h>
 
 #include "types.h"
@@ -43,11 +44,28 @@ enum variant {
 extern enum protocol engine_protocol;
 extern enum variant engine_variant;
 extern char engine_syzygy_path[MAX_PATH_LENGTH+1];
+extern int engine_syzygy_preload_pieces;
+extern int engine_syzygy_preload_memory;
 extern int engine_default_hash_size;
 extern int engine_default_num_threads;
+extern bool engine_large_pages;
+extern int engine_eval_cache_size;
+extern bool engine_eval_cache_shared;
+extern bool engine_low_memory;
+extern bool engine_shared_tables;
+extern bool engine_abdada;
+extern char engine_trace_file[MAX_PATH_LENGTH+1];
 extern bool engine_using_nnue;
 extern bool engine_loaded_net;
 extern char engine_eval_file[MAX_PATH_LENGTH+1];
+extern char engine_cluster_nodes[MAX_PATH_LENGTH+1];
+extern char engine_cluster_secret[MAX_PATH_LENGTH+1];
+
+/*
+ * Initialize the engine component. Must be called once at startup
+ * before any engine is created.
+ */
+void engine_init(void);
 
 /*
  * Read and parse a config file.
@@ -57,11 +75,37 @@ extern char engine_eval_file[MAX_PATH_LENGTH+1];
 void engine_read_config_file(char *cfgfile);
 
 /*
- * Create a new engine object.
+ * Create a new engine object. Each engine has its own transposition table,
+ * worker threads and time control so several engines can search
+ * concurrently in the same process.
  *
+ * @param hash_size The size of the transposition table (in MB).
+ * @param nthreads The number of threads to search with.
  * @return Returns the new engine object.
  */
-struct engine* engine_create(void);
+struct engine* engine_create(int hash_size, int nthreads);
+
+/*
+ * Create a new engine object while the rest of the engine is still being
+ * initialized. Only the worker threads are required so the engine can be
+ * created before the NNUE net and the move tables are setup. The
+ * transposition table is allocated and cleared in the background and the
+ * position of the engine must be setup with engine_setup_position before
+ * the engine is used.
+ *
+ * @param hash_size The size of the transposition table (in MB).
+ * @param nthreads The number of threads to search with.
+ * @return Returns the new engine object.
+ */
+struct engine* engine_create_early(int hash_size, int nthreads);
+
+/*
+ * Setup the start position for an engine created with
+ * engine_create_early.
+ *
+ * @param engine The engine.
+ */
+void engine_setup_position(struct engine *engine);
 
 /*
  * Destroy an engine object.
@@ -71,7 +115,35 @@ struct engine* engine_create(void);
 void engine_destroy(struct engine *engine);
 
 /*
- * The main engine loop.
+ * Print an info string breakdown of the memory allocated by an engine
+ * for each of its components.
+ *
+ * @param engine The engine.
+ */
+void engine_print_memory_usage(struct engine *engine);
+
+/*
+ * Start a session in which the engine is driven through a pair of
+ * streams. A separate thread reads commands from the input stream
+ * until it is closed. Commands written while no session is open
+ * are dropped.
+ *
+ * @param input The stream to read commands from.
+ * @param output The stream to write commands to.
+ */
+void engine_open_session(FILE *input, FILE *output);
+
+/*
+ * Finish the current session. Waits for the input thread to exit so
+ * the input stream must have reached its end, or have been shut down,
+ * before this function is called. Commands that are still waiting in
+ * the input queue are discarded.
+ */
+void engine_close_session(void);
+
+/*
+ * The main engine loop. Processes commands from the current session
+ * until the quit command is received or the input stream is closed.
  *
  * @param engine The engine object.
  */
@@ -85,12 +157,25 @@ void engine_loop(struct engine *engine);
 char* engine_read_command(void);
 
 /*
- * Write a command.
+ * Write a command. The command is sent immediately together with
+ * any previously queued commands.
  *
  * @param format. The command format string.
  */
 void engine_write_command(char *format, ...);
 
+/*
+ * Queue a command to be sent with the next call to engine_write_command
+ * or engine_flush_commands. Used to send several commands that belong
+ * to the same event with a single write.
+ *
+ * @param format. The command format string.
+ */
+void engine_queue_command(char *format, ...);
+
+/* Send all queued commands */
+void engine_flush_commands(void);
+
 /*
  * Set a pending command to execute when the search finishes.
  *
@@ -159,4 +244,13 @@ void engine_send_move_info(struct search_worker *worker, int movenumber,
  */
 void engine_send_multipv_info(struct search_worker *worker);
 
+/*
+ * Send information about a completed iteration that didn't produce
+ * a new principle variation.
+ *
+ * @param engine The engine.
+ * @param depth The depth of the iteration.
+ */
+void engine_send_depth_info(struct engine *engine, int depth);
+
 #endif
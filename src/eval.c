@@ -32,13 +32,8 @@
 #include "nnue.h"
 #include "data.h"
 #include "position.h"
-
-/* Phase valuse for different piece types */
-#define PAWN_PHASE      0
-#define KNIGHT_PHASE    1
-#define BISHOP_PHASE    1
-#define ROOK_PHASE      2
-#define QUEEN_PHASE     4
+#include "material.h"
+#include "tuner.h"
 
 /* Attack weights for the different piece types */
 #define KNIGHT_ATTACK_WEIGHT    1
@@ -52,6 +47,22 @@
 /* Material difference used to decide when to switch between NNUE and HCE */
 #define HYBRID_EVAL_THRESHOLD 700
 
+/*
+ * Record the contribution of an evaluation parameter when tracing
+ * the evaluation for the tuner. In regular builds nothing is recorded.
+ */
+#ifdef TUNER
+#define TRACE(t, param, side, count) \
+                            tuner_trace_param((t), &(param), (side), (count))
+#else
+#define TRACE(t, param, side, count) (void)(t)
+#endif
+#define TRACE_MG_EG(t, mg, eg, side, count) \
+    do {                                    \
+        TRACE((t), mg, (side), (count));    \
+        TRACE((t), eg, (side), (count));    \
+    } while (0)
+
 /* Different evaluation components */
 struct eval {
     bool endgame[NSIDES];
@@ -59,12 +70,15 @@ struct eval {
     uint64_t candidates;
     int phase;
     uint64_t rear_span[NSIDES];
-    uint8_t pawn_shield[NSIDES][2][3];
+    int pawn_shield[NSIDES][2];
     uint64_t attacked_by[NPIECES];
     uint64_t attacked[NSIDES];
     uint64_t attacked2[NSIDES];
+    int king_sq[NSIDES];
+    uint64_t king_zone[NSIDES];
     int nbr_king_attackers[NPIECES];
     int score[NPHASES][NSIDES];
+    struct eval_trace *trace;
 };
 
 /* Table of attack weights for all pieces */
@@ -82,16 +96,12 @@ static int nbr_attackers_weight[6] = {
     0, 0, 45, 100, 100, 100
 };
 
-static int material_phase_value[NPIECES] = {
-    0, 0, 1, 1, 1, 1, 2, 2, 4, 4, 0, 0
-};
-
 /*
- * Calculate a score that is an interpolation of the middlegame and endgame
- * based on the current phase of the game. The formula is taken from
+ * Calculate the weight of the endgame score, between 0 and 256, based on
+ * the current phase of the game. The formula is taken from
  * https://chessprogramming.wikispaces.com/Tapered+Eval
  */
-static int calculate_tapered_eval(int matphase, int score_mg, int score_eg)
+static int calculate_phase(int matphase)
 {
     int total_phase;
     int phase;
@@ -103,7 +113,18 @@ static int calculate_tapered_eval(int matphase, int score_mg, int score_eg)
      * Guard against negative phase values. The phase value might
      * become negative in case of promotion.
      */
-    phase = MAX(phase, 0);
+    return MAX(phase, 0);
+}
+
+/*
+ * Calculate a score that is an interpolation of the middlegame and endgame
+ * based on the current phase of the game.
+ */
+static int calculate_tapered_eval(int matphase, int score_mg, int score_eg)
+{
+    int phase;
+
+    phase = calculate_phase(matphase);
 
     return ((score_mg*(256 - phase)) + (score_eg*phase))/256;
 }
@@ -147,6 +168,7 @@ static void evaluate_space(struct position *pos, struct eval *eval)
                     (~pos->bb_pieces[side+PAWN]) &
                     (~eval->attacked[FLIP_COLOR(side)]);
         eval->score[MIDDLEGAME][side] += BITCOUNT(squares)*SPACE_SQUARE;
+        TRACE(eval->trace, SPACE_SQUARE, side, BITCOUNT(squares));
     }
 }
 
@@ -177,6 +199,8 @@ static void evaluate_threats(struct position *pos, struct eval *eval, int side)
     count = BITCOUNT(bb);
     eval->score[MIDDLEGAME][side] += count*THREAT_MINOR_BY_PAWN_MG;
     eval->score[ENDGAME][side] += count*THREAT_MINOR_BY_PAWN_EG;
+    TRACE_MG_EG(eval->trace, THREAT_MINOR_BY_PAWN_MG, THREAT_MINOR_BY_PAWN_EG,
+                side, count);
 
     /* Give a bonus for attacks on opponent pieces following a safe pawn push */
     pawn_push = bb_pawn_pushes(pos->bb_pieces[PAWN+side], pos->bb_all, side);
@@ -186,6 +210,8 @@ static void evaluate_threats(struct position *pos, struct eval *eval, int side)
     count = BITCOUNT(bb_pawn_attacks(pawn_push, side)&pos->bb_sides[oside]);
     eval->score[MIDDLEGAME][side] += count*THREAT_PAWN_PUSH_MG;
     eval->score[ENDGAME][side] += count*THREAT_PAWN_PUSH_EG;
+    TRACE_MG_EG(eval->trace, THREAT_PAWN_PUSH_MG, THREAT_PAWN_PUSH_EG, side,
+                count);
 
     /*
      * Give a bonus for knights attacking higher value
@@ -199,6 +225,8 @@ static void evaluate_threats(struct position *pos, struct eval *eval, int side)
         index = VALUE(pos->pieces[sq])/2;
         eval->score[MIDDLEGAME][side] += THREAT_BY_KNIGHT_MG[index];
         eval->score[ENDGAME][side] += THREAT_BY_KNIGHT_EG[index];
+        TRACE_MG_EG(eval->trace, THREAT_BY_KNIGHT_MG[index],
+                    THREAT_BY_KNIGHT_EG[index], side, 1);
     }
 
     /*
@@ -213,6 +241,8 @@ static void evaluate_threats(struct position *pos, struct eval *eval, int side)
         index = VALUE(pos->pieces[sq])/2;
         eval->score[MIDDLEGAME][side] += THREAT_BY_BISHOP_MG[index];
         eval->score[ENDGAME][side] += THREAT_BY_BISHOP_EG[index];
+        TRACE_MG_EG(eval->trace, THREAT_BY_BISHOP_MG[index],
+                    THREAT_BY_BISHOP_EG[index], side, 1);
     }
 
     /*
@@ -227,6 +257,8 @@ static void evaluate_threats(struct position *pos, struct eval *eval, int side)
         index = VALUE(pos->pieces[sq])/2;
         eval->score[MIDDLEGAME][side] += THREAT_BY_ROOK_MG[index];
         eval->score[ENDGAME][side] += THREAT_BY_ROOK_EG[index];
+        TRACE_MG_EG(eval->trace, THREAT_BY_ROOK_MG[index],
+                    THREAT_BY_ROOK_EG[index], side, 1);
     }
 
     /*
@@ -241,9 +273,14 @@ static void evaluate_threats(struct position *pos, struct eval *eval, int side)
         index = VALUE(pos->pieces[sq])/2;
         eval->score[MIDDLEGAME][side] += THREAT_BY_QUEEN_MG[index];
         eval->score[ENDGAME][side] += THREAT_BY_QUEEN_EG[index];
+        TRACE_MG_EG(eval->trace, THREAT_BY_QUEEN_MG[index],
+                    THREAT_BY_QUEEN_EG[index], side, 1);
     }
 }
 
+static int calculate_pawn_shield(struct position *pos, int side, int first,
+                                 struct eval_trace *trace);
+
 static void evaluate_pawn_shield(struct position *pos, struct eval *eval,
                                  int king_sq, int side)
 {
@@ -251,14 +288,8 @@ static void evaluate_pawn_shield(struct position *pos, struct eval *eval,
                                   sq_mask[A8]|sq_mask[B8]|sq_mask[C8]};
     uint64_t kingside[NSIDES] = {sq_mask[F1]|sq_mask[G1]|sq_mask[H1],
                                  sq_mask[F8]|sq_mask[G8]|sq_mask[H8]};
-    int      king_file;
-    int      king_rank;
-    int      first;
-    int      last;
-    int      file;
-    uint64_t bb;
-    int      dist;
-    int      sq;
+    int king_file;
+    int king_rank;
 
     king_file = FILENR(king_sq);
     king_rank = RANKNR(king_sq);
@@ -285,26 +316,51 @@ static void evaluate_pawn_shield(struct position *pos, struct eval *eval,
         return;
     }
 
-    /* Don't apply pawn shield bonus if the king is in the center */
+    /*
+     * Don't apply pawn shield bonus if the king is in the center. The
+     * shield itself only depends on the pawns and is calculated by
+     * evaluate_pawn_structure. When tracing, the shield is calculated
+     * again to find out which terms it consists of.
+     */
     if (king_file < FILE_D) {
-        first = FILE_A;
-        last = FILE_C;
+        eval->score[MIDDLEGAME][side] += eval->pawn_shield[side][0];
+#ifdef TUNER
+        (void)calculate_pawn_shield(pos, side, FILE_A, eval->trace);
+#endif
     } else if (king_file > FILE_E) {
-        first = FILE_F;
-        last = FILE_H;
-    } else {
-        return;
+        eval->score[MIDDLEGAME][side] += eval->pawn_shield[side][1];
+#ifdef TUNER
+        (void)calculate_pawn_shield(pos, side, FILE_F, eval->trace);
+#endif
     }
+}
 
-    for (file=first;file<=last;file++) {
-        sq = SQUARE(file, king_rank);
+/*
+ * Calculate the pawn shield score for a king on the back rank, either on
+ * the queenside (files A-C) or on the kingside (files F-H).
+ */
+static int calculate_pawn_shield(struct position *pos, int side, int first,
+                                 struct eval_trace *trace)
+{
+    uint64_t bb;
+    int      score;
+    int      file;
+    int      dist;
+    int      sq;
+
+    score = 0;
+    for (file=first;file<=first+2;file++) {
+        sq = SQUARE(file, (side == WHITE)?RANK_1:RANK_8);
         bb = front_span[side][sq]&pos->bb_pieces[PAWN+side];
         dist = (bb == 0ULL)?0:(side == WHITE)?RANKNR(LSB(bb))-RANKNR(sq):
                                               RANKNR(sq)-RANKNR(MSB(bb));
         if (dist <= 2) {
-            eval->score[MIDDLEGAME][side] += PAWN_SHIELD[dist];
+            score += PAWN_SHIELD[dist];
+            TRACE(trace, PAWN_SHIELD[dist], side, 1);
         }
     }
+
+    return score;
 }
 
 /*
@@ -402,7 +458,9 @@ static bool is_backward_pawn(struct position *pos, int side, int sq)
     return false;
 }
 
-static void evaluate_pawn_structure(struct position *pos, struct eval *eval)
+static void evaluate_pawn_structure(struct position *pos,
+                                    struct pawntt_item *item,
+                                    struct eval_trace *trace)
 {
     uint64_t pieces;
     int      sq;
@@ -421,6 +479,9 @@ static void evaluate_pawn_structure(struct position *pos, struct eval *eval)
     uint64_t neighbours;
     uint64_t attacks;
 
+    memset(item, 0, sizeof(struct pawntt_item));
+    item->pawnkey = pos->pawnkey;
+
     pieces = pos->bb_pieces[WHITE_PAWN]|pos->bb_pieces[BLACK_PAWN];
     while (pieces != 0ULL) {
         isolated = false;
@@ -432,25 +493,29 @@ static void evaluate_pawn_structure(struct position *pos, struct eval *eval)
         attackspan = rear_attackspan[side][sq]|front_attackspan[side][sq];
 
         psq = (side == WHITE)?sq:MIRROR(sq);
-        eval->score[MIDDLEGAME][side] += PSQ_TABLE_PAWN_MG[psq];
-        eval->score[ENDGAME][side] += PSQ_TABLE_PAWN_EG[psq];
-        eval->score[MIDDLEGAME][side] += PAWN_BASE_VALUE;
-        eval->score[ENDGAME][side] += PAWN_BASE_VALUE;
-        eval->phase += material_phase_value[PAWN+side];
+        item->score[MIDDLEGAME][side] += PSQ_TABLE_PAWN_MG[psq];
+        item->score[ENDGAME][side] += PSQ_TABLE_PAWN_EG[psq];
+        TRACE_MG_EG(trace, PSQ_TABLE_PAWN_MG[psq], PSQ_TABLE_PAWN_EG[psq],
+                    side, 1);
+        item->score[MIDDLEGAME][side] += PAWN_BASE_VALUE;
+        item->score[ENDGAME][side] += PAWN_BASE_VALUE;
 
         /* Look for isolated pawns */
         if ((attackspan&pos->bb_pieces[side+PAWN]) == 0ULL) {
             isolated = true;
-            eval->score[MIDDLEGAME][side] += ISOLATED_PAWN_MG;
-            eval->score[ENDGAME][side] += ISOLATED_PAWN_EG;
+            item->score[MIDDLEGAME][side] += ISOLATED_PAWN_MG;
+            item->score[ENDGAME][side] += ISOLATED_PAWN_EG;
+            TRACE_MG_EG(trace, ISOLATED_PAWN_MG, ISOLATED_PAWN_EG, side, 1);
         }
 
         /* Look for passed pawns */
         if (ISEMPTY(front_attackspan[side][sq]&pos->bb_pieces[oside+PAWN]) &&
             ISEMPTY(front_span[side][sq]&pos->bb_pieces[oside+PAWN])) {
-            SETBIT(eval->passers, sq);
-            eval->score[MIDDLEGAME][side] += PASSED_PAWN_MG[rel_rank];
-            eval->score[ENDGAME][side] += PASSED_PAWN_EG[rel_rank];
+            SETBIT(item->passers, sq);
+            item->score[MIDDLEGAME][side] += PASSED_PAWN_MG[rel_rank];
+            item->score[ENDGAME][side] += PASSED_PAWN_EG[rel_rank];
+            TRACE_MG_EG(trace, PASSED_PAWN_MG[rel_rank],
+                        PASSED_PAWN_EG[rel_rank], side, 1);
         }
 
         /* Look for candidate passed pawns */
@@ -458,48 +523,95 @@ static void evaluate_pawn_structure(struct position *pos, struct eval *eval)
         helpers = rear_attackspan[side][sq]&pos->bb_pieces[side+PAWN];
         attackers = bb_pawn_attacks_to(sq, oside)&pos->bb_pieces[oside+PAWN];
         defenders = bb_pawn_attacks_to(sq, side)&pos->bb_pieces[side+PAWN];
-        if (!ISBITSET(eval->passers&pos->bb_sides[side], sq) &&
+        if (!ISBITSET(item->passers&pos->bb_sides[side], sq) &&
             ISEMPTY(front_span[side][sq]&pos->bb_pieces[oside+PAWN]) &&
             (BITCOUNT(helpers) >= BITCOUNT(sentries)) &&
             (BITCOUNT(defenders) >= BITCOUNT(attackers))) {
-            SETBIT(eval->candidates, sq);
-            eval->score[MIDDLEGAME][side] += CANDIDATE_PASSED_PAWN_MG[rel_rank];
-            eval->score[ENDGAME][side] += CANDIDATE_PASSED_PAWN_EG[rel_rank];
+            SETBIT(item->candidates, sq);
+            item->score[MIDDLEGAME][side] += CANDIDATE_PASSED_PAWN_MG[rel_rank];
+            item->score[ENDGAME][side] += CANDIDATE_PASSED_PAWN_EG[rel_rank];
+            TRACE_MG_EG(trace, CANDIDATE_PASSED_PAWN_MG[rel_rank],
+                        CANDIDATE_PASSED_PAWN_EG[rel_rank], side, 1);
         }
 
         /* Check if the pawn is considered backward */
         if (!isolated && is_backward_pawn(pos, side, sq)) {
-            eval->score[MIDDLEGAME][side] += BACKWARD_PAWN_MG;
-            eval->score[ENDGAME][side] += BACKWARD_PAWN_EG;
+            item->score[MIDDLEGAME][side] += BACKWARD_PAWN_MG;
+            item->score[ENDGAME][side] += BACKWARD_PAWN_EG;
+            TRACE_MG_EG(trace, BACKWARD_PAWN_MG, BACKWARD_PAWN_EG, side, 1);
         }
 
         /* Check if the pawn is connected */
         neighbours = rear_attackspan[side][sq]&pos->bb_pieces[side+PAWN];
         if (!ISEMPTY(neighbours&rank_mask[rank]) ||
             !ISEMPTY(neighbours&bb_pawn_attacks_to(sq, side))) {
-            eval->score[MIDDLEGAME][side] += CONNECTED_PAWNS_MG[rel_rank];
-            eval->score[ENDGAME][side] += CONNECTED_PAWNS_EG[rel_rank];
+            item->score[MIDDLEGAME][side] += CONNECTED_PAWNS_MG[rel_rank];
+            item->score[ENDGAME][side] += CONNECTED_PAWNS_EG[rel_rank];
+            TRACE_MG_EG(trace, CONNECTED_PAWNS_MG[rel_rank],
+                        CONNECTED_PAWNS_EG[rel_rank], side, 1);
         }
 
         /* Update pawn attacks */
         attacks = bb_pawn_attacks_from(sq, side);
-        eval->attacked2[side] |= (attacks&eval->attacked[side]);
-        eval->attacked[side] |= attacks;
-        eval->attacked_by[side+PAWN] |= attacks;
+        item->attacks2[side] |= (attacks&item->attacks[side]);
+        item->attacks[side] |= attacks;
 
         /* Update rear span information */
-        eval->rear_span[side] |= rear_span[side][sq];
+        item->rear_span[side] |= rear_span[side][sq];
     }
 
     /* Look for double pawns */
     for (side=0;side<NSIDES;side++) {
         for (file=0;file<NFILES;file++) {
             if (BITCOUNT(pos->bb_pieces[side+PAWN]&file_mask[file]) >= 2) {
-                eval->score[MIDDLEGAME][side] += DOUBLE_PAWNS_MG;
-                eval->score[ENDGAME][side] += DOUBLE_PAWNS_EG;
+                item->score[MIDDLEGAME][side] += DOUBLE_PAWNS_MG;
+                item->score[ENDGAME][side] += DOUBLE_PAWNS_EG;
+                TRACE_MG_EG(trace, DOUBLE_PAWNS_MG, DOUBLE_PAWNS_EG, side, 1);
             }
         }
     }
+
+    /* Pawn shield for a king on either side of the board */
+    for (side=0;side<NSIDES;side++) {
+        item->shield[side][0] = calculate_pawn_shield(pos, side, FILE_A,
+                                                      NULL);
+        item->shield[side][1] = calculate_pawn_shield(pos, side, FILE_F,
+                                                      NULL);
+    }
+}
+
+/*
+ * Evaluate all terms that only depend on the pawn structure. The result
+ * is cached in the pawn hash table of the worker, if there is one.
+ */
+static void evaluate_pawns(struct position *pos, struct eval *eval)
+{
+    struct pawntt_item item;
+    int                side;
+
+    if ((pos->worker == NULL) ||
+        !hash_pawntt_lookup(pos->worker, pos->pawnkey, &item)) {
+        evaluate_pawn_structure(pos, &item, eval->trace);
+        if (pos->worker != NULL) {
+            hash_pawntt_store(pos->worker, &item);
+        }
+    }
+
+    eval->passers = item.passers;
+    eval->candidates = item.candidates;
+    for (side=0;side<NSIDES;side++) {
+        eval->score[MIDDLEGAME][side] += item.score[MIDDLEGAME][side];
+        eval->score[ENDGAME][side] += item.score[ENDGAME][side];
+        eval->pawn_shield[side][0] = item.shield[side][0];
+        eval->pawn_shield[side][1] = item.shield[side][1];
+        eval->rear_span[side] = item.rear_span[side];
+
+        /* The king attacks have already been added */
+        eval->attacked2[side] |= (item.attacks2[side]|
+                                  (item.attacks[side]&eval->attacked[side]));
+        eval->attacked[side] |= item.attacks[side];
+        eval->attacked_by[PAWN+side] |= item.attacks[side];
+    }
 }
 
 /*
@@ -560,11 +672,15 @@ static void evaluate_passers(struct position *pos, struct eval *eval)
         /* Calculate a score based on the distance to each king */
         eval->score[ENDGAME][side] += OPPONENT_KING_PASSER_DIST*odist;
         eval->score[ENDGAME][side] += FRIENDLY_KING_PASSER_DIST*dist;
+        TRACE(eval->trace, OPPONENT_KING_PASSER_DIST, side, odist);
+        TRACE(eval->trace, FRIENDLY_KING_PASSER_DIST, side, dist);
 
         /* Free pawn */
         if (is_free_pawn(pos, eval, side, sq)) {
             eval->score[MIDDLEGAME][side] += FREE_PASSED_PAWN_MG;
             eval->score[ENDGAME][side] += FREE_PASSED_PAWN_EG;
+            TRACE_MG_EG(eval->trace, FREE_PASSED_PAWN_MG, FREE_PASSED_PAWN_EG,
+                        side, 1);
         }
     }
 }
@@ -575,54 +691,66 @@ static void evaluate_knights(struct position *pos, struct eval *eval)
     uint64_t moves;
     uint64_t safe_moves;
     uint64_t attacks;
+    uint64_t zone;
+    uint64_t unsafe;
     int      sq;
     int      psq;
-    int      king_sq;
     int      side;
     int      opp_side;
 
-    pieces = pos->bb_pieces[WHITE_KNIGHT]|pos->bb_pieces[BLACK_KNIGHT];
-    while (pieces != 0ULL) {
-        sq = POPBIT(&pieces);
-        side = COLOR(pos->pieces[sq]);
+    for (side=0;side<NSIDES;side++) {
         opp_side = FLIP_COLOR(side);
-        king_sq = LSB(pos->bb_pieces[KING+opp_side]);
-        moves = bb_knight_moves(sq);
-        attacks = moves;
-        moves &= (~pos->bb_sides[side]);
-
-        psq = (side == WHITE)?sq:MIRROR(sq);
-        eval->score[MIDDLEGAME][side] += PSQ_TABLE_KNIGHT_MG[psq];
-        eval->score[ENDGAME][side] += PSQ_TABLE_KNIGHT_EG[psq];
-        eval->score[MIDDLEGAME][side] += KNIGHT_MATERIAL_VALUE_MG;
-        eval->score[ENDGAME][side] += KNIGHT_MATERIAL_VALUE_EG;
-        eval->phase += material_phase_value[KNIGHT+side];
-
-        /* Mobility */
-        safe_moves = moves&(~eval->attacked_by[PAWN+FLIP_COLOR(side)]);
-        eval->score[MIDDLEGAME][side] += (BITCOUNT(safe_moves)*
-                                                            KNIGHT_MOBILITY_MG);
-        eval->score[ENDGAME][side] += (BITCOUNT(safe_moves)*KNIGHT_MOBILITY_EG);
-
-        /* Preassure on enemy king */
-        if (!ISEMPTY(moves&king_zone[opp_side][king_sq])) {
-            eval->nbr_king_attackers[KNIGHT+side]++;
-        }
+        zone = eval->king_zone[opp_side];
+        unsafe = eval->attacked_by[PAWN+opp_side];
+        pieces = pos->bb_pieces[KNIGHT+side];
+        while (pieces != 0ULL) {
+            sq = POPBIT(&pieces);
+            moves = bb_knight_moves(sq);
+            attacks = moves;
+            moves &= (~pos->bb_sides[side]);
+
+            psq = (side == WHITE)?sq:MIRROR(sq);
+            eval->score[MIDDLEGAME][side] += PSQ_TABLE_KNIGHT_MG[psq];
+            eval->score[ENDGAME][side] += PSQ_TABLE_KNIGHT_EG[psq];
+            eval->score[MIDDLEGAME][side] += KNIGHT_MATERIAL_VALUE_MG;
+            eval->score[ENDGAME][side] += KNIGHT_MATERIAL_VALUE_EG;
+            TRACE_MG_EG(eval->trace, PSQ_TABLE_KNIGHT_MG[psq],
+                        PSQ_TABLE_KNIGHT_EG[psq], side, 1);
+            TRACE_MG_EG(eval->trace, KNIGHT_MATERIAL_VALUE_MG,
+                        KNIGHT_MATERIAL_VALUE_EG, side, 1);
+
+            /* Mobility */
+            safe_moves = moves&(~unsafe);
+            eval->score[MIDDLEGAME][side] += (BITCOUNT(safe_moves)*
+                                                        KNIGHT_MOBILITY_MG);
+            eval->score[ENDGAME][side] += (BITCOUNT(safe_moves)*
+                                                        KNIGHT_MOBILITY_EG);
+            TRACE_MG_EG(eval->trace, KNIGHT_MOBILITY_MG, KNIGHT_MOBILITY_EG,
+                        side, BITCOUNT(safe_moves));
+
+            /* Preassure on enemy king */
+            if (!ISEMPTY(moves&zone)) {
+                eval->nbr_king_attackers[KNIGHT+side]++;
+            }
 
-        /* Outposts */
-        if (sq_mask[sq]&outpost_squares[side] &&
-            ((front_attackspan[side][sq]&pos->bb_pieces[opp_side+PAWN]) == 0)) {
-            if (eval->attacked_by[PAWN+side]&sq_mask[sq]) {
-                eval->score[MIDDLEGAME][side] += PROTECTED_KNIGHT_OUTPOST;
-            } else {
-                eval->score[MIDDLEGAME][side] += KNIGHT_OUTPOST;
+            /* Outposts */
+            if (sq_mask[sq]&outpost_squares[side] &&
+                ((front_attackspan[side][sq]&
+                                    pos->bb_pieces[opp_side+PAWN]) == 0)) {
+                if (eval->attacked_by[PAWN+side]&sq_mask[sq]) {
+                    eval->score[MIDDLEGAME][side] += PROTECTED_KNIGHT_OUTPOST;
+                    TRACE(eval->trace, PROTECTED_KNIGHT_OUTPOST, side, 1);
+                } else {
+                    eval->score[MIDDLEGAME][side] += KNIGHT_OUTPOST;
+                    TRACE(eval->trace, KNIGHT_OUTPOST, side, 1);
+                }
             }
-        }
 
-        /* Update attacks */
-        eval->attacked_by[KNIGHT+side] |= attacks;
-        eval->attacked2[side] |= (attacks&eval->attacked[side]);
-        eval->attacked[side] |= attacks;
+            /* Update attacks */
+            eval->attacked_by[KNIGHT+side] |= attacks;
+            eval->attacked2[side] |= (attacks&eval->attacked[side]);
+            eval->attacked[side] |= attacks;
+        }
     }
 }
 
@@ -632,60 +760,67 @@ static void evaluate_bishops(struct position *pos, struct eval *eval)
     uint64_t moves;
     uint64_t safe_moves;
     uint64_t attacks;
+    uint64_t zone;
+    uint64_t unsafe;
     int      sq;
     int      psq;
-    int      king_sq;
     int      side;
     int      opp_side;
 
-    /*
-     * Check if both bishops are still on the board. To be correct
-     * also check if the two (or more) bishops operate on different
-     * color squares. The only case when a player can have
-     * two bishops on the same color squares is if he underpromotes
-     * to a bishop. This is so unlikely that it should be safe to assume
-     * that the bishops operate on different color squares.
-     */
     for (side=0;side<NSIDES;side++) {
+        /*
+         * Check if both bishops are still on the board. To be correct
+         * also check if the two (or more) bishops operate on different
+         * color squares. The only case when a player can have
+         * two bishops on the same color squares is if he underpromotes
+         * to a bishop. This is so unlikely that it should be safe to
+         * assume that the bishops operate on different color squares.
+         */
         if (BITCOUNT(pos->bb_pieces[side+BISHOP]) >= 2) {
             eval->score[MIDDLEGAME][side] += BISHOP_PAIR_MG;
             eval->score[ENDGAME][side] += BISHOP_PAIR_EG;
+            TRACE_MG_EG(eval->trace, BISHOP_PAIR_MG, BISHOP_PAIR_EG, side, 1);
         }
-    }
 
-    pieces = pos->bb_pieces[WHITE_BISHOP]|pos->bb_pieces[BLACK_BISHOP];
-    while (pieces != 0ULL) {
-        sq = POPBIT(&pieces);
-        side = COLOR(pos->pieces[sq]);
         opp_side = FLIP_COLOR(side);
-        king_sq = LSB(pos->bb_pieces[KING+opp_side]);
-        moves = bb_bishop_moves(pos->bb_all, sq);
-        attacks = moves;
-        moves &= (~pos->bb_sides[side]);
+        zone = eval->king_zone[opp_side];
+        unsafe = eval->attacked_by[PAWN+opp_side];
+        pieces = pos->bb_pieces[BISHOP+side];
+        while (pieces != 0ULL) {
+            sq = POPBIT(&pieces);
+            moves = bb_bishop_moves(pos->bb_all, sq);
+            attacks = moves;
+            moves &= (~pos->bb_sides[side]);
+
+            psq = (side == WHITE)?sq:MIRROR(sq);
+            eval->score[MIDDLEGAME][side] += PSQ_TABLE_BISHOP_MG[psq];
+            eval->score[ENDGAME][side] += PSQ_TABLE_BISHOP_EG[psq];
+            eval->score[MIDDLEGAME][side] += BISHOP_MATERIAL_VALUE_MG;
+            eval->score[ENDGAME][side] += BISHOP_MATERIAL_VALUE_EG;
+            TRACE_MG_EG(eval->trace, PSQ_TABLE_BISHOP_MG[psq],
+                        PSQ_TABLE_BISHOP_EG[psq], side, 1);
+            TRACE_MG_EG(eval->trace, BISHOP_MATERIAL_VALUE_MG,
+                        BISHOP_MATERIAL_VALUE_EG, side, 1);
+
+            /* Mobility */
+            safe_moves = moves&(~unsafe);
+            eval->score[MIDDLEGAME][side] += (BITCOUNT(safe_moves)*
+                                                        BISHOP_MOBILITY_MG);
+            eval->score[ENDGAME][side] += (BITCOUNT(safe_moves)*
+                                                        BISHOP_MOBILITY_EG);
+            TRACE_MG_EG(eval->trace, BISHOP_MOBILITY_MG, BISHOP_MOBILITY_EG,
+                        side, BITCOUNT(safe_moves));
+
+            /* Preassure on enemy king */
+            if (!ISEMPTY(moves&zone)) {
+                eval->nbr_king_attackers[BISHOP+side]++;
+            }
 
-        psq = (side == WHITE)?sq:MIRROR(sq);
-        eval->score[MIDDLEGAME][side] += PSQ_TABLE_BISHOP_MG[psq];
-        eval->score[ENDGAME][side] += PSQ_TABLE_BISHOP_EG[psq];
-        eval->score[MIDDLEGAME][side] += BISHOP_MATERIAL_VALUE_MG;
-        eval->score[ENDGAME][side] += BISHOP_MATERIAL_VALUE_EG;
-        eval->phase += material_phase_value[BISHOP+side];
-
-        /* Mobility */
-        safe_moves = moves&(~eval->attacked_by[PAWN+FLIP_COLOR(side)]);
-        eval->score[MIDDLEGAME][side] += (BITCOUNT(safe_moves)*
-                                                            BISHOP_MOBILITY_MG);
-        eval->score[ENDGAME][side] += (BITCOUNT(safe_moves)*
-                                                            BISHOP_MOBILITY_EG);
-
-        /* Preassure on enemy king */
-        if (!ISEMPTY(moves&king_zone[opp_side][king_sq])) {
-            eval->nbr_king_attackers[BISHOP+side]++;
+            /* Update attacks */
+            eval->attacked_by[BISHOP+side] |= attacks;
+            eval->attacked2[side] |= (attacks&eval->attacked[side]);
+            eval->attacked[side] |= attacks;
         }
-
-        /* Update attacks */
-        eval->attacked_by[BISHOP+side] |= attacks;
-        eval->attacked2[side] |= (attacks&eval->attacked[side]);
-        eval->attacked[side] |= attacks;
     }
 }
 
@@ -698,69 +833,84 @@ static void evaluate_rooks(struct position *pos, struct eval *eval)
     uint64_t moves;
     uint64_t safe_moves;
     uint64_t attacks;
+    uint64_t zone;
+    uint64_t unsafe;
     int      sq;
     int      psq;
     int      file;
-    int      king_sq;
     int      side;
     int      opp_side;
 
     all_pawns = pos->bb_pieces[WHITE_PAWN]|pos->bb_pieces[BLACK_PAWN];
-    pieces = pos->bb_pieces[WHITE_ROOK]|pos->bb_pieces[BLACK_ROOK];
-    while (pieces != 0ULL) {
-        sq = POPBIT(&pieces);
-        side = COLOR(pos->pieces[sq]);
+    for (side=0;side<NSIDES;side++) {
         opp_side = FLIP_COLOR(side);
-        king_sq = LSB(pos->bb_pieces[KING+opp_side]);
-        file = FILENR(sq);
-        moves = bb_rook_moves(pos->bb_all, sq);
-        attacks = moves;
-        moves &= (~pos->bb_sides[side]);
-
-        psq = (side == WHITE)?sq:MIRROR(sq);
-        eval->score[MIDDLEGAME][side] += PSQ_TABLE_ROOK_MG[psq];
-        eval->score[ENDGAME][side] += PSQ_TABLE_ROOK_EG[psq];
-        eval->score[MIDDLEGAME][side] += ROOK_MATERIAL_VALUE_MG;
-        eval->score[ENDGAME][side] += ROOK_MATERIAL_VALUE_EG;
-        eval->phase += material_phase_value[ROOK+side];
-
-        /* Open and half-open files */
-        if ((file_mask[file]&all_pawns) == 0ULL) {
-            eval->score[MIDDLEGAME][side] += ROOK_OPEN_FILE_MG;
-            eval->score[ENDGAME][side] += ROOK_OPEN_FILE_EG;
-        } else if ((file_mask[file]&pos->bb_pieces[PAWN+side]) == 0ULL) {
-            eval->score[MIDDLEGAME][side] += ROOK_HALF_OPEN_FILE_MG;
-            eval->score[ENDGAME][side] += ROOK_HALF_OPEN_FILE_EG;
-        }
+        zone = eval->king_zone[opp_side];
+        unsafe = eval->attacked_by[PAWN+opp_side];
+        pieces = pos->bb_pieces[ROOK+side];
+        while (pieces != 0ULL) {
+            sq = POPBIT(&pieces);
+            file = FILENR(sq);
+            moves = bb_rook_moves(pos->bb_all, sq);
+            attacks = moves;
+            moves &= (~pos->bb_sides[side]);
+
+            psq = (side == WHITE)?sq:MIRROR(sq);
+            eval->score[MIDDLEGAME][side] += PSQ_TABLE_ROOK_MG[psq];
+            eval->score[ENDGAME][side] += PSQ_TABLE_ROOK_EG[psq];
+            eval->score[MIDDLEGAME][side] += ROOK_MATERIAL_VALUE_MG;
+            eval->score[ENDGAME][side] += ROOK_MATERIAL_VALUE_EG;
+            TRACE_MG_EG(eval->trace, PSQ_TABLE_ROOK_MG[psq],
+                        PSQ_TABLE_ROOK_EG[psq], side, 1);
+            TRACE_MG_EG(eval->trace, ROOK_MATERIAL_VALUE_MG,
+                        ROOK_MATERIAL_VALUE_EG, side, 1);
+
+            /* Open and half-open files */
+            if ((file_mask[file]&all_pawns) == 0ULL) {
+                eval->score[MIDDLEGAME][side] += ROOK_OPEN_FILE_MG;
+                eval->score[ENDGAME][side] += ROOK_OPEN_FILE_EG;
+                TRACE_MG_EG(eval->trace, ROOK_OPEN_FILE_MG, ROOK_OPEN_FILE_EG,
+                            side, 1);
+            } else if ((file_mask[file]&pos->bb_pieces[PAWN+side]) == 0ULL) {
+                eval->score[MIDDLEGAME][side] += ROOK_HALF_OPEN_FILE_MG;
+                eval->score[ENDGAME][side] += ROOK_HALF_OPEN_FILE_EG;
+                TRACE_MG_EG(eval->trace, ROOK_HALF_OPEN_FILE_MG,
+                            ROOK_HALF_OPEN_FILE_EG, side, 1);
+            }
 
-        /* 7th rank */
-        if (ISBITSET(rank7[side], sq)) {
-            /*
-             * Only give bonus if the enemy king is on the 8th rank
-             * or if there are enenmy pawns on the 7th rank.
-             */
-            if ((pos->bb_pieces[KING+FLIP_COLOR(side)]&rank8[side]) ||
-                (pos->bb_pieces[PAWN+FLIP_COLOR(side)]&rank7[side])) {
-                eval->score[MIDDLEGAME][side] += ROOK_ON_7TH_MG;
-                eval->score[ENDGAME][side] += ROOK_ON_7TH_EG;
+            /* 7th rank */
+            if (ISBITSET(rank7[side], sq)) {
+                /*
+                 * Only give bonus if the enemy king is on the 8th rank
+                 * or if there are enenmy pawns on the 7th rank.
+                 */
+                if ((pos->bb_pieces[KING+opp_side]&rank8[side]) ||
+                    (pos->bb_pieces[PAWN+opp_side]&rank7[side])) {
+                    eval->score[MIDDLEGAME][side] += ROOK_ON_7TH_MG;
+                    eval->score[ENDGAME][side] += ROOK_ON_7TH_EG;
+                    TRACE_MG_EG(eval->trace, ROOK_ON_7TH_MG, ROOK_ON_7TH_EG,
+                                side, 1);
+                }
             }
-        }
 
-        /* Mobility */
-        safe_moves = moves&(~eval->attacked_by[PAWN+FLIP_COLOR(side)]);
-        eval->score[MIDDLEGAME][side] += (BITCOUNT(safe_moves)*
-                                                            ROOK_MOBILITY_MG);
-        eval->score[ENDGAME][side] += (BITCOUNT(safe_moves)*ROOK_MOBILITY_EG);
+            /* Mobility */
+            safe_moves = moves&(~unsafe);
+            eval->score[MIDDLEGAME][side] += (BITCOUNT(safe_moves)*
+                                                        ROOK_MOBILITY_MG);
+            eval->score[ENDGAME][side] += (BITCOUNT(safe_moves)*
+                                                        ROOK_MOBILITY_EG);
+            TRACE_MG_EG(eval->trace, ROOK_MOBILITY_MG, ROOK_MOBILITY_EG, side,
+                        BITCOUNT(safe_moves));
+
+            /* Preassure on enemy king */
+            if (!ISEMPTY(moves&zone)) {
+                eval->nbr_king_attackers[ROOK+side]++;
+            }
 
-        /* Preassure on enemy king */
-        if (!ISEMPTY(moves&king_zone[opp_side][king_sq])) {
-            eval->nbr_king_attackers[ROOK+side]++;
+            /* Update attacks */
+            eval->attacked_by[ROOK+side] |= attacks;
+            eval->attacked2[side] |= (attacks&eval->attacked[side]);
+            eval->attacked[side] |= attacks;
         }
-
-        /* Update attacks */
-        eval->attacked_by[ROOK+side] |= attacks;
-        eval->attacked2[side] |= (attacks&eval->attacked[side]);
-        eval->attacked[side] |= attacks;
     }
 }
 
@@ -771,61 +921,72 @@ static void evaluate_queens(struct position *pos, struct eval *eval)
     uint64_t moves;
     uint64_t safe_moves;
     uint64_t attacks;
+    uint64_t zone;
     uint64_t unsafe;
     int      opp_side;
     int      sq;
     int      psq;
     int      file;
-    int      king_sq;
     int      side;
 
     all_pawns = pos->bb_pieces[WHITE_PAWN]|pos->bb_pieces[BLACK_PAWN];
-    pieces = pos->bb_pieces[WHITE_QUEEN]|pos->bb_pieces[BLACK_QUEEN];
-    while (pieces != 0ULL) {
-        sq = POPBIT(&pieces);
-        side = COLOR(pos->pieces[sq]);
+    for (side=0;side<NSIDES;side++) {
         opp_side = FLIP_COLOR(side);
-        file = FILENR(sq);
-        moves = bb_queen_moves(pos->bb_all, sq);
-        attacks = moves;
-        moves &= (~pos->bb_sides[side]);
-        king_sq = LSB(pos->bb_pieces[KING+opp_side]);
+        zone = eval->king_zone[opp_side];
         unsafe = eval->attacked_by[PAWN+opp_side]|
                  eval->attacked_by[KNIGHT+opp_side]|
                  eval->attacked_by[BISHOP+opp_side]|
                  eval->attacked_by[ROOK+opp_side];
+        pieces = pos->bb_pieces[QUEEN+side];
+        while (pieces != 0ULL) {
+            sq = POPBIT(&pieces);
+            file = FILENR(sq);
+            moves = bb_queen_moves(pos->bb_all, sq);
+            attacks = moves;
+            moves &= (~pos->bb_sides[side]);
+
+            psq = (side == WHITE)?sq:MIRROR(sq);
+            eval->score[MIDDLEGAME][side] += PSQ_TABLE_QUEEN_MG[psq];
+            eval->score[ENDGAME][side] += PSQ_TABLE_QUEEN_EG[psq];
+            eval->score[MIDDLEGAME][side] += QUEEN_MATERIAL_VALUE_MG;
+            eval->score[ENDGAME][side] += QUEEN_MATERIAL_VALUE_EG;
+            TRACE_MG_EG(eval->trace, PSQ_TABLE_QUEEN_MG[psq],
+                        PSQ_TABLE_QUEEN_EG[psq], side, 1);
+            TRACE_MG_EG(eval->trace, QUEEN_MATERIAL_VALUE_MG,
+                        QUEEN_MATERIAL_VALUE_EG, side, 1);
+
+            /* Open and half-open files */
+            if ((file_mask[file]&all_pawns) == 0ULL) {
+                eval->score[MIDDLEGAME][side] += QUEEN_OPEN_FILE_MG;
+                eval->score[ENDGAME][side] += QUEEN_OPEN_FILE_EG;
+                TRACE_MG_EG(eval->trace, QUEEN_OPEN_FILE_MG, QUEEN_OPEN_FILE_EG,
+                            side, 1);
+            } else if ((file_mask[file]&pos->bb_pieces[PAWN+side]) == 0ULL) {
+                eval->score[MIDDLEGAME][side] += QUEEN_HALF_OPEN_FILE_MG;
+                eval->score[ENDGAME][side] += QUEEN_HALF_OPEN_FILE_EG;
+                TRACE_MG_EG(eval->trace, QUEEN_HALF_OPEN_FILE_MG,
+                            QUEEN_HALF_OPEN_FILE_EG, side, 1);
+            }
 
-        psq = (side == WHITE)?sq:MIRROR(sq);
-        eval->score[MIDDLEGAME][side] += PSQ_TABLE_QUEEN_MG[psq];
-        eval->score[ENDGAME][side] += PSQ_TABLE_QUEEN_EG[psq];
-        eval->score[MIDDLEGAME][side] += QUEEN_MATERIAL_VALUE_MG;
-        eval->score[ENDGAME][side] += QUEEN_MATERIAL_VALUE_EG;
-        eval->phase += material_phase_value[QUEEN+side];
-
-        /* Open and half-open files */
-        if ((file_mask[file]&all_pawns) == 0ULL) {
-            eval->score[MIDDLEGAME][side] += QUEEN_OPEN_FILE_MG;
-            eval->score[ENDGAME][side] += QUEEN_OPEN_FILE_EG;
-        } else if ((file_mask[file]&pos->bb_pieces[PAWN+side]) == 0ULL) {
-            eval->score[MIDDLEGAME][side] += QUEEN_HALF_OPEN_FILE_MG;
-            eval->score[ENDGAME][side] += QUEEN_HALF_OPEN_FILE_EG;
-        }
-
-        /* Mobility */
-        safe_moves = moves&(~unsafe);
-        eval->score[MIDDLEGAME][side] += (BITCOUNT(safe_moves)*
-                                                            QUEEN_MOBILITY_MG);
-        eval->score[ENDGAME][side] += (BITCOUNT(safe_moves)*QUEEN_MOBILITY_EG);
+            /* Mobility */
+            safe_moves = moves&(~unsafe);
+            eval->score[MIDDLEGAME][side] += (BITCOUNT(safe_moves)*
+                                                        QUEEN_MOBILITY_MG);
+            eval->score[ENDGAME][side] += (BITCOUNT(safe_moves)*
+                                                        QUEEN_MOBILITY_EG);
+            TRACE_MG_EG(eval->trace, QUEEN_MOBILITY_MG, QUEEN_MOBILITY_EG, side,
+                        BITCOUNT(safe_moves));
+
+            /* Preassure on enemy king */
+            if (!ISEMPTY(moves&zone)) {
+                eval->nbr_king_attackers[QUEEN+side]++;
+            }
 
-        /* Preassure on enemy king */
-        if (!ISEMPTY(moves&king_zone[opp_side][king_sq])) {
-            eval->nbr_king_attackers[QUEEN+side]++;
+            /* Update attacks */
+            eval->attacked_by[QUEEN+side] |= attacks;
+            eval->attacked2[side] |= (attacks&eval->attacked[side]);
+            eval->attacked[side] |= attacks;
         }
-
-        /* Update attacks */
-        eval->attacked_by[QUEEN+side] |= attacks;
-        eval->attacked2[side] |= (attacks&eval->attacked[side]);
-        eval->attacked[side] |= attacks;
     }
 }
 
@@ -847,6 +1008,8 @@ static void evaluate_kings(struct position *pos, struct eval *eval)
         psq = (side == WHITE)?sq:MIRROR(sq);
         eval->score[MIDDLEGAME][side] += PSQ_TABLE_KING_MG[psq];
         eval->score[ENDGAME][side] += PSQ_TABLE_KING_EG[psq];
+        TRACE_MG_EG(eval->trace, PSQ_TABLE_KING_MG[psq], PSQ_TABLE_KING_EG[psq],
+                    side, 1);
 
         /* Calculate preassure on the enemy king */
         nattackers = 0;
@@ -862,6 +1025,8 @@ static void evaluate_kings(struct position *pos, struct eval *eval)
         score *= nbr_attackers_weight[nattackers];
         eval->score[MIDDLEGAME][side] += (score*KING_ATTACK_SCALE_MG)/100;
         eval->score[ENDGAME][side] += (score*KING_ATTACK_SCALE_EG)/100;
+        TRACE_MG_EG(eval->trace, KING_ATTACK_SCALE_MG, KING_ATTACK_SCALE_EG,
+                    side, score);
 
         /* Evaluate pawn shield */
         evaluate_pawn_shield(pos, eval, sq, side);
@@ -871,38 +1036,40 @@ static void evaluate_kings(struct position *pos, struct eval *eval)
 /*
  * Initialize attack tables with king attack information. This is
  * done here since the information is needed during king evaluation
- * later.
+ * later. The king squares and king zones are also set up here since
+ * they are used when evaluating all other pieces.
  */
 static void init_attack_tables(struct position *pos, struct eval *eval)
 {
     uint64_t attacks;
+    int      side;
     int      sq;
 
-    /* White king attacks */
-    sq = LSB(pos->bb_pieces[WHITE_KING]);
-    attacks = bb_king_moves(sq);
-    eval->attacked_by[WHITE_KING] |= attacks;
-    eval->attacked2[WHITE] |= (attacks&eval->attacked[WHITE]);
-    eval->attacked[WHITE] |= eval->attacked_by[WHITE_KING];
-
-    /* Black king attacks */
-    sq = LSB(pos->bb_pieces[BLACK_KING]);
-    attacks = bb_king_moves(sq);
-    eval->attacked_by[BLACK_KING] |= attacks;
-    eval->attacked2[BLACK] |= (attacks&eval->attacked[BLACK]);
-    eval->attacked[BLACK] |= eval->attacked_by[BLACK_KING];
+    for (side=0;side<NSIDES;side++) {
+        sq = LSB(pos->bb_pieces[KING+side]);
+        eval->king_sq[side] = sq;
+        eval->king_zone[side] = king_zone[side][sq];
+
+        attacks = bb_king_moves(sq);
+        eval->attacked_by[KING+side] |= attacks;
+        eval->attacked2[side] |= (attacks&eval->attacked[side]);
+        eval->attacked[side] |= attacks;
+    }
 }
 
-static void do_eval(struct position *pos, struct eval *eval)
+static void do_eval(struct position *pos, struct material_item *mat,
+                    struct eval *eval, struct eval_trace *trace)
 {
     /* Initialize eval struct */
     memset(eval, 0, sizeof(struct eval));
+    eval->phase = mat->phase;
+    eval->trace = trace;
 
     /* Init attack table */
     init_attack_tables(pos, eval);
 
     /* Evaluate the position */
-    evaluate_pawn_structure(pos, eval);
+    evaluate_pawns(pos, eval);
     evaluate_knights(pos, eval);
     evaluate_bishops(pos, eval);
     evaluate_rooks(pos, eval);
@@ -916,14 +1083,23 @@ static void do_eval(struct position *pos, struct eval *eval)
 
 int eval_evaluate(struct position *pos, bool force_hce)
 {
-    struct eval eval;
-    int         k;
-    int         score[NPHASES];
-    int         tapered_score;
-    int         nnue_score;
+    struct eval          eval;
+    struct material_item mat;
+    int                  k;
+    int                  score[NPHASES];
+    int                  tapered_score;
+    int                  nnue_score;
+    int                  endgame_score;
+    int                  strong;
 
     assert(valid_position(pos));
 
+    /* Check if there is a specialized evaluator for this endgame */
+    material_probe(pos, &mat);
+    if (material_evaluate_endgame(pos, &mat, &endgame_score)) {
+        return endgame_score;
+    }
+
     /* Check if NNUE or classic eval should be used */
     if (engine_using_nnue && engine_loaded_net && !force_hce) {
         nnue_score = nnue_evaluate(pos);
@@ -931,7 +1107,16 @@ int eval_evaluate(struct position *pos, bool force_hce)
     }
 
     /* Evaluate the position */
-    do_eval(pos, &eval);
+    do_eval(pos, &mat, &eval, NULL);
+
+    /* Scale down the endgame score for drawish material configurations */
+    strong = (eval.score[ENDGAME][WHITE] > eval.score[ENDGAME][BLACK])?
+                                                                WHITE:BLACK;
+    for (k=0;k<NSIDES;k++) {
+        eval.score[ENDGAME][k] =
+                    (eval.score[ENDGAME][k]*mat.scale[strong])/
+                                                        MATERIAL_SCALE_NORMAL;
+    }
 
     /* Summarize each evaluation term from side to moves's pov */
     for (k=0;k<NPHASES;k++) {
@@ -947,6 +1132,39 @@ int eval_evaluate(struct position *pos, bool force_hce)
     return pos->eval_stack[pos->height].score;
 }
 
+#ifdef TUNER
+bool eval_trace_position(struct position *pos, struct eval_trace *trace)
+{
+    struct eval          eval;
+    struct material_item mat;
+    int                  k;
+    int                  score;
+
+    assert(valid_position(pos));
+    assert(trace != NULL);
+
+    /* Positions handled by specialized evaluators can't be traced */
+    material_probe(pos, &mat);
+    if (material_evaluate_endgame(pos, &mat, &score)) {
+        return false;
+    }
+
+    memset(trace, 0, sizeof(struct eval_trace));
+    do_eval(pos, &mat, &eval, trace);
+
+    for (k=0;k<NPHASES;k++) {
+        trace->score[k] = eval.score[k][WHITE] - eval.score[k][BLACK];
+    }
+    trace->phase = calculate_phase(eval.phase);
+    for (k=0;k<NSIDES;k++) {
+        trace->scale[k] = mat.scale[k];
+    }
+    trace->tempo = (pos->stm == WHITE)?TEMPO_BONUS:-TEMPO_BONUS;
+
+    return true;
+}
+#endif
+
 void eval_init_material(struct position *pos)
 {
     uint64_t pieces;
@@ -30,6 +30,22 @@
  */
 int eval_evaluate(struct position *pos, bool force_hce);
 
+#ifdef TUNER
+struct eval_trace;
+
+/*
+ * Evaluate a position using the classical evaluation and record how
+ * the score depends on each evaluation parameter. Only available in
+ * builds with TUNER defined.
+ *
+ * @param pos The position.
+ * @param trace Location to store the trace at.
+ * @return Returns false if the position is evaluated by a specialized
+ *         endgame evaluator, in which case nothing is recorded.
+ */
+bool eval_trace_position(struct position *pos, struct eval_trace *trace);
+#endif
+
 /*
  * Initialize the material counter.
  *
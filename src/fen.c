@@ -1139,6 +1139,9 @@ bool fen_setup_board(struct position *pos, char *fenstr)
             } else if (*iter == ' ') {
                 /* End of piece placement field */
                 break;
+            } else if (*iter == '\0') {
+                /* Truncated string */
+                return false;
             } else if (IS_PIECE(*iter)) {
                 /* Piece */
                 pos->pieces[SQUARE(file, rank)] = char2piece(*iter);
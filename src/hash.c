@@ -30,6 +30,9 @@
 #include "smp.h"
 #include "config.h"
 #include "engine.h"
+#include "numa.h"
+#include "debug.h"
+#include "cluster.h"
 
 /*
  * Since a move only uses 22 out of 32 bits the
@@ -39,18 +42,60 @@
 #define GETDATE(v)      (((v)&0xFFC00000)>>22)
 #define MOVEDATE(m, d)  ((m)|((d)<<22))
 
-/* Main transposition table */
-static struct tt_bucket *transposition_table = NULL;
-static int tt_size_in_mb = 0;
-static uint64_t tt_size = 0ULL;
-static uint8_t tt_date = 0;
+/*
+ * The type field of an item only uses the lower two bits so
+ * the upper bit is used to mark items that are in use.
+ */
+#define TT_USED         0x80
+#define GETTYPE(v)      ((v)&0x03)
+
+/* The part of the position key stored in an item */
+#define KEY16(k)        ((uint16_t)((k)>>48))
 
-static uint64_t largest_power_of_2(uint64_t size, int item_size)
+/* Identifier at the start of transposition table files */
+#define TT_FILE_MAGIC   "MARVINTT"
+
+/* The number of buckets read or written in one go for table files */
+#define TT_FILE_CHUNK_SIZE 65536ULL
+
+/*
+ * Header of a file containing a saved transposition table. The buckets
+ * are stored as is directly after the header so a file can only be
+ * loaded by the same version of the engine.
+ */
+struct tt_file_header {
+    char     magic[8];
+    char     version[16];
+    uint64_t size;
+    uint32_t size_in_mb;
+    uint32_t bucket_size;
+    uint32_t epoch;
+    uint8_t  date;
+    uint8_t  pad[3];
+};
+
+static uint16_t item_checksum(struct tt_item *item)
+{
+    return (uint16_t)(item->move^(item->move>>16)^(uint16_t)item->score^
+                      (uint16_t)item->eval^item->depth^(item->type<<8));
+}
+
+static bool item_matches(struct tt_item *item, uint64_t key)
+{
+    return ((item->type&TT_USED) != 0) &&
+                    ((item->key^item_checksum(item)) == KEY16(key));
+}
+
+/* Convert a table size to bytes */
+#define KB_TO_BYTES(kb) ((uint64_t)(kb)*1024ULL)
+#define MB_TO_BYTES(mb) ((uint64_t)(mb)*1024ULL*1024ULL)
+
+static uint64_t largest_power_of_2(uint64_t nbytes, int item_size)
 {
     uint64_t largest;
     uint64_t nitems;
 
-    nitems = (size*1024ULL*1024ULL)/item_size;
+    nitems = nbytes/item_size;
     largest = 1ULL;
     while (largest <= nitems) {
         largest <<= 1ULL;
@@ -60,124 +105,276 @@ static uint64_t largest_power_of_2(uint64_t size, int item_size)
     return largest;
 }
 
-static void allocate_tt(int size)
+static void* allocate_tt_memory(struct tt_table *tt, uint64_t size)
 {
-    tt_size = largest_power_of_2(size, sizeof(struct tt_bucket));
-    transposition_table = aligned_malloc(CACHE_LINE_SIZE,
-                                         tt_size*sizeof(struct tt_bucket));
-    if (transposition_table == NULL) {
-        tt_size = largest_power_of_2(MIN_MAIN_HASH_SIZE,
-                                     sizeof(struct tt_bucket));
-        transposition_table = aligned_malloc(CACHE_LINE_SIZE,
-                                             tt_size*sizeof(struct tt_bucket));
+    void *ptr;
+
+    tt->mapped = false;
+    tt->large_pages = engine_large_pages;
+    if (!tt->large_pages) {
+        return aligned_malloc(CACHE_LINE_SIZE, size);
+    }
+
+    /*
+     * Spread the table over all NUMA nodes before it is touched for
+     * the first time. Otherwise all pages end up on the node of the
+     * thread that happens to clear them.
+     */
+    ptr = large_pages_malloc(size, &tt->mapped);
+    if (ptr != NULL) {
+        numa_interleave_memory(ptr, size);
+    }
+    return ptr;
+}
+
+static void allocate_tt(struct tt_table *tt, int size)
+{
+    tt->size = largest_power_of_2(MB_TO_BYTES(size),
+                                  sizeof(struct tt_bucket));
+    tt->buckets = allocate_tt_memory(tt, tt->size*sizeof(struct tt_bucket));
+    if (tt->buckets == NULL) {
+        tt->size = largest_power_of_2(MB_TO_BYTES(MIN_MAIN_HASH_SIZE),
+                                      sizeof(struct tt_bucket));
+        tt->buckets = allocate_tt_memory(tt,
+                                         tt->size*sizeof(struct tt_bucket));
+    }
+    assert(tt->buckets != NULL);
+
+    LOG_INFO1("Allocated %d MB transposition table (%s)\n",
+              (int)((tt->size*sizeof(struct tt_bucket))/(1024ULL*1024ULL)),
+              tt->mapped?"large pages":"default pages");
+}
+
+static thread_retval_t resize_thread_func(void *data)
+{
+    struct engine   *engine = data;
+    struct tt_table *tt = &engine->tt;
+    size_t          nbytes;
+
+    allocate_tt(tt, tt->size_in_mb);
+
+    /*
+     * Clear the table using the worker threads. Besides clearing the
+     * memory this also makes sure that all pages are committed before
+     * the table is used.
+     */
+    nbytes = tt->size*sizeof(struct tt_bucket);
+    smp_parallel_memset(engine, tt->buckets, 0, nbytes);
+    tt->epoch = 1;
+
+    engine_write_command("info string Hash table of %d MB ready",
+                         (int)(nbytes/(1024ULL*1024ULL)));
+
+    return (thread_retval_t)0;
+}
+
+static void wait_for_resize(struct tt_table *tt)
+{
+    if (tt->resizing) {
+        thread_join(&tt->resize_thread);
+        tt->resizing = false;
     }
-    assert(transposition_table != NULL);
 }
 
 static void allocate_nnue_cache(struct search_worker *worker, int size)
 {
-    worker->nnue_cache_size = largest_power_of_2(size,
-                                                sizeof(struct nnue_cache_item));
-    worker->nnue_cache = aligned_malloc(CACHE_LINE_SIZE,
-                        worker->nnue_cache_size*sizeof(struct nnue_cache_item));
+    worker->nnue_cache_size = largest_power_of_2(MB_TO_BYTES(size),
+                                            sizeof(struct nnue_cache_bucket));
+    worker->nnue_cache = numa_alloc(
+                    worker->nnue_cache_size*sizeof(struct nnue_cache_bucket),
+                    numa_node_for_worker(worker->id));
     assert(worker->nnue_cache != NULL);
 }
 
+static void allocate_shared_nnue_cache(struct worker_pool *pool, int size)
+{
+    uint64_t nbytes;
+
+    pool->shared_nnue_cache_size = largest_power_of_2(MB_TO_BYTES(size),
+                                            sizeof(struct nnue_cache_bucket));
+    nbytes = pool->shared_nnue_cache_size*sizeof(struct nnue_cache_bucket);
+    pool->shared_nnue_cache = numa_alloc(nbytes, -1);
+    assert(pool->shared_nnue_cache != NULL);
+    numa_interleave_memory(pool->shared_nnue_cache, nbytes);
+    memset(pool->shared_nnue_cache, 0, nbytes);
+}
+
 int hash_tt_max_size(void)
 {
 	return is64bit()?MAX_MAIN_HASH_SIZE_64BIT:MAX_MAIN_HASH_SIZE_32BIT;
 }
 
-int hash_tt_size(void)
+int hash_tt_size(struct engine *engine)
 {
-    return tt_size_in_mb;
+    return engine->tt.size_in_mb;
 }
 
-void hash_tt_create_table(int size)
+void hash_tt_create_table(struct engine *engine, int size)
 {
     assert((size >= MIN_MAIN_HASH_SIZE) && (size <= hash_tt_max_size()));
 	
-    hash_tt_destroy_table();
+    hash_tt_destroy_table(engine);
+
+    engine->tt.size_in_mb = size;
+    allocate_tt(&engine->tt, size);
+    hash_tt_clear_table(engine);
+}
+
+void hash_tt_create_table_async(struct engine *engine, int size)
+{
+    struct tt_table *tt = &engine->tt;
+
+    assert((size >= MIN_MAIN_HASH_SIZE) && (size <= hash_tt_max_size()));
+
+    hash_tt_destroy_table(engine);
 
-    tt_size_in_mb = size;
-    allocate_tt(size);
-    hash_tt_clear_table();
+    tt->size_in_mb = size;
+    tt->resizing = true;
+    thread_create(&tt->resize_thread, resize_thread_func, engine);
 }
 
-void hash_tt_destroy_table(void)
+void hash_tt_wait_for_table(struct engine *engine)
 {
-    aligned_free(transposition_table);
-    transposition_table = NULL;
-    tt_size_in_mb = 0;
-    tt_size = 0ULL;
-    tt_date = 0;
+    wait_for_resize(&engine->tt);
 }
 
-void hash_tt_clear_table(void)
+void hash_tt_share_table(struct engine *engine, struct engine *owner)
 {
-    assert(transposition_table != NULL);
+    wait_for_resize(&owner->tt);
+    assert(owner->tt.buckets != NULL);
 
-    parallel_memset(transposition_table, 0, tt_size*sizeof(struct tt_bucket),
-                    smp_number_of_workers());
+    hash_tt_destroy_table(engine);
+
+    owner->tt.shared = true;
+    engine->tt = owner->tt;
+    engine->tt.borrowed = true;
 }
 
-void hash_tt_age_table(void)
+void hash_tt_destroy_table(struct engine *engine)
 {
-    tt_date++;
+    struct tt_table *tt = &engine->tt;
+
+    wait_for_resize(tt);
+
+    if (tt->borrowed) {
+        /* The memory is released by the owner */
+    } else if (tt->large_pages) {
+        large_pages_free(tt->buckets, tt->size*sizeof(struct tt_bucket),
+                         tt->mapped);
+    } else {
+        aligned_free(tt->buckets);
+    }
+    tt->buckets = NULL;
+    tt->mapped = false;
+    tt->large_pages = false;
+    tt->borrowed = false;
+    tt->shared = false;
+    tt->size_in_mb = 0;
+    tt->size = 0ULL;
+    tt->date = 0;
+    tt->epoch = 0;
 }
 
-void hash_tt_store(struct position *pos, uint32_t move, int depth, int score,
-                   int type)
+void hash_tt_clear_table(struct engine *engine)
+{
+    struct tt_table *tt = &engine->tt;
+
+    wait_for_resize(tt);
+    assert(tt->buckets != NULL);
+
+    /*
+     * Normally the table is cleared by moving to a new epoch, which
+     * makes all existing buckets appear empty. The memory is only
+     * cleared for real when the table is new or when the epoch
+     * counter wraps around. A table used by several engines is also
+     * cleared for real since each engine has its own copy of the
+     * epoch. Cleared buckets have epoch 0, which is never used for a
+     * table in use.
+     */
+    if (!tt->borrowed && !tt->shared && (tt->epoch > 0) &&
+        (tt->epoch < UINT32_MAX)) {
+        tt->epoch++;
+        return;
+    }
+    smp_parallel_memset(engine, tt->buckets, 0,
+                        tt->size*sizeof(struct tt_bucket));
+    if (!tt->borrowed && !tt->shared) {
+        tt->epoch = 1;
+    }
+}
+
+void hash_tt_age_table(struct engine *engine)
+{
+    /*
+     * A table that is shared with other engines is used concurrently
+     * so the date is left unchanged, both by the owner and by the
+     * borrowers. Otherwise the engines would consider each others
+     * entries to be old.
+     */
+    if (!engine->tt.borrowed && !engine->tt.shared) {
+        engine->tt.date++;
+    }
+}
+
+void hash_tt_partition_table(struct engine *engine, int nparts)
+{
+    struct tt_table *tt = &engine->tt;
+    uint64_t        size;
+
+    assert(nparts >= 1);
+
+    if ((nparts == 1) || (tt->buckets == NULL)) {
+        tt->partition_size = 0ULL;
+        return;
+    }
+
+    /* The size of each part must be a power of 2 */
+    size = 1ULL;
+    while ((size*2*nparts) <= tt->size) {
+        size *= 2;
+    }
+    tt->partition_size = size;
+}
+
+/*
+ * Find the bucket for a key. When the table is partitioned each
+ * worker only uses its own part of the table.
+ */
+static struct tt_bucket* find_bucket(struct tt_table *tt,
+                                     struct search_worker *worker,
+                                     uint64_t key)
+{
+    if ((tt->partition_size > 0ULL) && (worker != NULL)) {
+        return &tt->buckets[(uint64_t)worker->id*tt->partition_size +
+                            (key&(tt->partition_size-1))];
+    }
+    return &tt->buckets[key&(tt->size-1)];
+}
+
+static void store_item(struct tt_table *tt, struct search_worker *worker,
+                       uint64_t key, uint32_t move, int depth, int score,
+                       int type, int eval)
 {
-    uint64_t         idx;
     struct tt_bucket *bucket;
     struct tt_item   *item;
     struct tt_item   *worst_item;
+    struct tt_item   new_item;
     int              item_score;
     int              worst_score;
     int              k;
     uint8_t          age;
 
-    assert(valid_position(pos));
-    assert(valid_move(move));
-    assert((score > -INFINITE_SCORE) && (score < INFINITE_SCORE));
-
-    if (transposition_table == NULL) {
-        return;
-    }
+    /* Find the correct bucket */
+    bucket = find_bucket(tt, worker, key);
 
-    /*
-     * Mate scores are dependent on search depth so if nothing is done
-     * they will be incorrect if the position is found at a different
-     * depth. Therefore the scores are adjusted so that they are stored
-     * as mate-in-n from the _current_ position instead of from the root
-     * of the search tree. Based on this a correct mate score can be
-     * calculated when retrieving the entry.
-     *
-     * Additionally only store mate scores as TT_EXACT entries, not
-     * as boundaries. The reason is that the score have taken on a
-     * different meaning in these cases since the mate was actually
-     * found in a different part of the tree.
-     *
-     * The same reasoning also applies to tablebase wins/losses so
-     * they are treated the same way.
-     */
-    if (score > KNOWN_WIN) {
-        if (type != TT_EXACT) {
-            return;
-        }
-        score += pos->height;
-    } else if (score < -KNOWN_WIN) {
-        if (type != TT_EXACT) {
-            return;
+    /* Empty buckets that belong to an earlier epoch */
+    if (bucket->epoch != tt->epoch) {
+        for (k=0;k<TT_BUCKET_SIZE;k++) {
+            bucket->items[k].type = 0;
         }
-        score -= pos->height;
+        bucket->epoch = tt->epoch;
     }
 
-    /* Find the correct bucket */
-    idx = (uint64_t)(pos->key&(tt_size-1));
-    bucket = &transposition_table[idx];
-
     /*
      * Iterate over all items and find the best
      * location to store this position at.
@@ -192,8 +389,8 @@ void hash_tt_store(struct position *pos, uint32_t move, int depth, int score,
          * replace it if the new search is to a greater
          * depth or if the item have an older date.
          */
-        if (pos->key == item->key) {
-            if ((depth >= item->depth) || (tt_date != GETDATE(item->move))) {
+        if (item_matches(item, key)) {
+            if ((depth >= item->depth) || (tt->date != GETDATE(item->move))) {
                 worst_item = item;
                 break;
             }
@@ -203,7 +400,7 @@ void hash_tt_store(struct position *pos, uint32_t move, int depth, int score,
              * the current position.
              */
             return;
-        } else if (item->key == 0ULL) {
+        } else if ((item->type&TT_USED) == 0) {
             worst_item = item;
             break;
         }
@@ -213,7 +410,7 @@ void hash_tt_store(struct position *pos, uint32_t move, int depth, int score,
          * prefer searches to a higher depth and to prefer
          * newer searches before older ones.
          */
-        age = tt_date - GETDATE(item->move);
+        age = tt->date - GETDATE(item->move);
         item_score = (256 - age - 1) + item->depth*256;
 
         /* Remeber the item with the worst score */
@@ -224,52 +421,260 @@ void hash_tt_store(struct position *pos, uint32_t move, int depth, int score,
     }
     assert(worst_item != NULL);
 
-    /* Replace the worst item */
-    worst_item->key = pos->key;
-    worst_item->move = MOVEDATE(move, tt_date);
-    worst_item->score = (int16_t)score;
-    worst_item->depth = depth;
-    worst_item->type = type;
+    /*
+     * Replace the worst item. The item is prepared locally
+     * and then written to the table with a single copy.
+     */
+    new_item.move = MOVEDATE(move, tt->date);
+    new_item.score = (int16_t)score;
+    new_item.eval = CLAMP(eval, INT16_MIN, INT16_MAX);
+    new_item.depth = depth;
+    new_item.type = type|TT_USED;
+    new_item.key = KEY16(key)^item_checksum(&new_item);
+    *worst_item = new_item;
+}
+
+void hash_tt_store(struct position *pos, uint32_t move, int depth, int score,
+                   int type, int eval)
+{
+    struct tt_table *tt = &pos->engine->tt;
+
+    assert(valid_position(pos));
+    assert(valid_move(move));
+    assert((score > -INFINITE_SCORE) && (score < INFINITE_SCORE));
+
+    if (tt->buckets == NULL) {
+        return;
+    }
+
+    /*
+     * Mate scores are dependent on search depth so if nothing is done
+     * they will be incorrect if the position is found at a different
+     * depth. Therefore the scores are adjusted so that they are stored
+     * as mate-in-n from the _current_ position instead of from the root
+     * of the search tree. Based on this a correct mate score can be
+     * calculated when retrieving the entry.
+     *
+     * Additionally only store mate scores as TT_EXACT entries, not
+     * as boundaries. The reason is that the score have taken on a
+     * different meaning in these cases since the mate was actually
+     * found in a different part of the tree.
+     *
+     * The same reasoning also applies to tablebase wins/losses so
+     * they are treated the same way.
+     */
+    if (score > KNOWN_WIN) {
+        if (type != TT_EXACT) {
+            return;
+        }
+        score += pos->height;
+    } else if (score < -KNOWN_WIN) {
+        if (type != TT_EXACT) {
+            return;
+        }
+        score -= pos->height;
+    }
+
+    /* Let the other nodes in a cluster know about deep entries */
+    if ((depth >= CLUSTER_MIN_DEPTH) && (pos->engine->cluster != NULL)) {
+        cluster_share_tt_entry(pos->engine->cluster, pos->key, move, depth,
+                               score, type, eval);
+    }
+
+    store_item(tt, pos->worker, pos->key, move, depth, score, type, eval);
+}
+
+void hash_tt_store_entry(struct engine *engine, uint64_t key, uint32_t move,
+                         int depth, int score, int type, int eval)
+{
+    struct tt_table *tt = &engine->tt;
+
+    assert(valid_move(move));
+
+    if (tt->buckets == NULL) {
+        return;
+    }
+
+    store_item(tt, NULL, key, move, depth, score, type, eval);
 }
 
 bool hash_tt_lookup(struct position *pos, struct tt_item *item)
 {
-    uint64_t         idx;
+    struct tt_table  *tt = &pos->engine->tt;
     struct tt_bucket *bucket;
-    struct tt_item   *tmp;
+    struct tt_item   tmp;
     int              k;
 
     assert(valid_position(pos));
     assert(item != NULL);
 
-    if (transposition_table == NULL) {
+    if (tt->buckets == NULL) {
         return false;
     }
 
     /* Find the correct bucket */
-    idx = (uint64_t)(pos->key&(tt_size-1));
-    bucket = &transposition_table[idx];
+    bucket = find_bucket(tt, pos->worker, pos->key);
+    if (pos->worker != NULL) {
+        pos->worker->tt_probes++;
+    }
+    if (bucket->epoch != tt->epoch) {
+        return false;
+    }
 
     /*
      * Find the first item, if any, that have
-     * the same key as the current position.
+     * the same key as the current position. The item
+     * is copied before it is verified since other threads
+     * may update the table concurrently.
      */
     for (k=0;k<TT_BUCKET_SIZE;k++) {
-        tmp = &bucket->items[k];
-        if (pos->key == tmp->key) {
-            memcpy(item, tmp, sizeof(struct tt_item));
+        tmp = bucket->items[k];
+        if (!item_matches(&tmp, pos->key)) {
+            continue;
+        }
 
-            /* Mask of the date from the move */
-            item->move = GETMOVE(item->move);
-            return true;
+        /* Mask of the date from the move and the flag from the type */
+        *item = tmp;
+        item->move = GETMOVE(item->move);
+        item->type = GETTYPE(item->type);
+
+        /*
+         * Since only part of the key is stored there is a small
+         * risk of a false match so make sure that the move can
+         * actually be played in the position. If it can't then
+         * another item in the bucket may still be the right one.
+         */
+        if ((item->move != NOMOVE) &&
+            !pos_is_move_pseudo_legal(pos, item->move)) {
+            continue;
         }
+        if (pos->worker != NULL) {
+            pos->worker->tt_hits++;
+        }
+        return true;
     }
 
     return false;
 }
 
+bool hash_tt_save_table(struct engine *engine, char *path)
+{
+    struct tt_table       *tt = &engine->tt;
+    struct tt_file_header header;
+    FILE                  *fp;
+    uint64_t              k;
+    uint64_t              n;
+    bool                  ok;
+
+    assert(path != NULL);
+
+    wait_for_resize(tt);
+    if (tt->buckets == NULL) {
+        return false;
+    }
+
+    fp = fopen(path, "wb");
+    if (fp == NULL) {
+        return false;
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TT_FILE_MAGIC, sizeof(header.magic));
+    strncpy(header.version, APP_VERSION, sizeof(header.version)-1);
+    header.size = tt->size;
+    header.size_in_mb = tt->size_in_mb;
+    header.bucket_size = sizeof(struct tt_bucket);
+    header.epoch = tt->epoch;
+    header.date = tt->date;
+    ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+
+    /* Write the buckets in large chunks */
+    for (k=0;ok&&(k<tt->size);k+=n) {
+        n = MIN(TT_FILE_CHUNK_SIZE, tt->size-k);
+        ok = fwrite(&tt->buckets[k], sizeof(struct tt_bucket), n, fp) == n;
+    }
+
+    if (fclose(fp) != 0) {
+        ok = false;
+    }
+    LOG_INFO1("Saved transposition table to %s (%s)\n", path,
+              ok?"ok":"failed");
+    return ok;
+}
+
+bool hash_tt_load_table(struct engine *engine, char *path)
+{
+    struct tt_table       *tt = &engine->tt;
+    struct tt_file_header header;
+    FILE                  *fp;
+    uint64_t              k;
+    uint64_t              n;
+    bool                  ok;
+
+    assert(path != NULL);
+
+    wait_for_resize(tt);
+    fp = fopen(path, "rb");
+    if (fp == NULL) {
+        return false;
+    }
+
+    /* Make sure the file was written by a compatible engine */
+    if ((fread(&header, sizeof(header), 1, fp) != 1) ||
+        (memcmp(header.magic, TT_FILE_MAGIC, sizeof(header.magic)) != 0) ||
+        (strncmp(header.version, APP_VERSION, sizeof(header.version)) != 0) ||
+        (header.bucket_size != sizeof(struct tt_bucket)) ||
+        (header.epoch == 0) ||
+        (header.size_in_mb < MIN_MAIN_HASH_SIZE) ||
+        (header.size_in_mb > (uint32_t)hash_tt_max_size())) {
+        fclose(fp);
+        return false;
+    }
+
+    /*
+     * Resize the table to match the saved one. A borrowed table
+     * cannot be resized since it is owned by another engine.
+     */
+    if ((header.size != tt->size) && !tt->borrowed) {
+        hash_tt_create_table(engine, (int)header.size_in_mb);
+    }
+    if ((tt->buckets == NULL) || (header.size != tt->size) ||
+        (tt->borrowed && (header.epoch != tt->epoch))) {
+        fclose(fp);
+        return false;
+    }
+
+    /* Read the buckets in large chunks */
+    ok = true;
+    for (k=0;ok&&(k<tt->size);k+=n) {
+        n = MIN(TT_FILE_CHUNK_SIZE, tt->size-k);
+        ok = fread(&tt->buckets[k], sizeof(struct tt_bucket), n, fp) == n;
+    }
+    fclose(fp);
+
+    /*
+     * Don't leave a partially loaded table behind. The epoch is reset
+     * to force the memory to be cleared since the loaded buckets can
+     * have any epoch.
+     */
+    if (!ok) {
+        if (!tt->borrowed) {
+            tt->epoch = 0;
+        }
+        hash_tt_clear_table(engine);
+        return false;
+    }
+    if (!tt->borrowed) {
+        tt->date = header.date;
+        tt->epoch = header.epoch;
+    }
+
+    LOG_INFO1("Loaded transposition table from %s\n", path);
+    return true;
+}
+
 /* Transposition table usage is estimated based on the first 1000 buckets */
-int hash_tt_usage(void)
+int hash_tt_usage(struct engine *engine)
 {
     struct tt_bucket *bucket;
     int k;
@@ -278,9 +683,13 @@ int hash_tt_usage(void)
 
     nused = 0;
     for (k=0;k<1000;k++) {
-        bucket = &transposition_table[k];
+        bucket = &engine->tt.buckets[k];
+        if (bucket->epoch != engine->tt.epoch) {
+            continue;
+        }
         for (idx=0;idx<TT_BUCKET_SIZE;idx++) {
-            if (GETDATE(bucket->items[idx].move) == tt_date) {
+            if (((bucket->items[idx].type&TT_USED) != 0) &&
+                (GETDATE(bucket->items[idx].move) == engine->tt.date)) {
                 nused++;
             }
         }
@@ -289,36 +698,81 @@ int hash_tt_usage(void)
     return nused/TT_BUCKET_SIZE;
 }
 
-void hash_nnue_create_table(struct search_worker *worker, int size)
+void hash_nnue_create_table(struct search_worker *worker, int size,
+                            bool shared)
 {
+    struct worker_pool *pool = &worker->engine->pool;
+
     assert(size >= 0);
 
     hash_nnue_destroy_table(worker);
+    if (size == 0) {
+        return;
+    }
+
+    /*
+     * A shared cache is created by the first worker
+     * using it and destroyed by the last one.
+     */
+    if (shared) {
+        if (pool->shared_nnue_cache == NULL) {
+            allocate_shared_nnue_cache(pool, size);
+        }
+        pool->shared_nnue_cache_users++;
+        worker->nnue_cache = pool->shared_nnue_cache;
+        worker->nnue_cache_size = pool->shared_nnue_cache_size;
+        worker->nnue_cache_shared = true;
+        return;
+    }
 
     allocate_nnue_cache(worker, size);
+    worker->nnue_cache_shared = false;
     hash_nnue_clear_table(worker);
 }
 
 void hash_nnue_destroy_table(struct search_worker *worker)
 {
-    aligned_free(worker->nnue_cache);
+    struct worker_pool *pool = &worker->engine->pool;
+
+    if (worker->nnue_cache == NULL) {
+        return;
+    }
+
+    if (worker->nnue_cache_shared) {
+        pool->shared_nnue_cache_users--;
+        if (pool->shared_nnue_cache_users == 0) {
+            numa_free(pool->shared_nnue_cache,
+                pool->shared_nnue_cache_size*sizeof(struct nnue_cache_bucket));
+            pool->shared_nnue_cache = NULL;
+            pool->shared_nnue_cache_size = 0ULL;
+        }
+    } else {
+        numa_free(worker->nnue_cache,
+                  worker->nnue_cache_size*sizeof(struct nnue_cache_bucket));
+    }
     worker->nnue_cache = NULL;
-    worker->nnue_cache_size = 0;
+    worker->nnue_cache_size = 0ULL;
+    worker->nnue_cache_shared = false;
 }
 
 void hash_nnue_clear_table(struct search_worker *worker)
 {
     assert(worker != NULL);
-    assert(worker->nnue_cache != NULL);
+
+    if (worker->nnue_cache == NULL) {
+        return;
+    }
 
     memset(worker->nnue_cache, 0,
-           worker->nnue_cache_size*sizeof(struct nnue_cache_item));
+           worker->nnue_cache_size*sizeof(struct nnue_cache_bucket));
 }
 
 void hash_nnue_store(struct search_worker *worker, int score)
 {
-    struct position *pos;
-    uint32_t        idx;
+    struct position          *pos;
+    struct nnue_cache_bucket *bucket;
+    uint64_t                 data;
+    int                      k;
 
     assert(valid_position(&worker->pos));
 
@@ -328,22 +782,28 @@ void hash_nnue_store(struct search_worker *worker, int score)
         return;
     }
 
-    /* Find the correct position in the table */
-    idx = (uint32_t)(pos->key&(worker->nnue_cache_size-1));
+    /* Find the correct bucket */
+    bucket = &worker->nnue_cache[pos->key&(worker->nnue_cache_size-1)];
 
     /*
-     * Insert the item in the table. An always-replace strategy
-     * is used in case the position is already taken.
+     * Insert the item first in the bucket and push out
+     * the oldest item from the end of the bucket.
      */
-    worker->nnue_cache[idx].score = score;
-    worker->nnue_cache[idx].key = pos->key;
+    for (k=NNUE_CACHE_BUCKET_SIZE-1;k>0;k--) {
+        bucket->items[k] = bucket->items[k-1];
+    }
+    data = (uint64_t)(int64_t)score;
+    bucket->items[0].key = pos->key^data;
+    bucket->items[0].score = data;
 }
 
 bool hash_nnue_lookup(struct search_worker *worker, int *score)
 {
-    struct position *pos;
-    uint32_t        idx;
-    bool            found;
+    struct position          *pos;
+    struct nnue_cache_bucket *bucket;
+    uint64_t                 key;
+    uint64_t                 data;
+    int                      k;
 
     assert(valid_position(&worker->pos));
     assert(score != NULL);
@@ -355,23 +815,176 @@ bool hash_nnue_lookup(struct search_worker *worker, int *score)
     }
 
     /*
-     * Find the correct position in the table and check
-     * if it contains an item for this position.
+     * Find the correct bucket and check if it contains an item for
+     * this position. The item is only accepted if the key and the
+     * score are consistent with each other.
      */
-    found = false;
-    idx = (uint32_t)(pos->key&(worker->nnue_cache_size-1));
-    if (worker->nnue_cache[idx].key == pos->key) {
-        found = true;
-        *score = worker->nnue_cache[idx].score;
+    worker->nnue_cache_probes++;
+    bucket = &worker->nnue_cache[pos->key&(worker->nnue_cache_size-1)];
+    for (k=0;k<NNUE_CACHE_BUCKET_SIZE;k++) {
+        key = bucket->items[k].key;
+        data = bucket->items[k].score;
+        if ((key^data) == pos->key) {
+            worker->nnue_cache_hits++;
+            *score = (int)(int64_t)data;
+            return true;
+        }
     }
 
-    return found;
+    return false;
 }
 
-void hash_prefetch(struct search_worker *worker)
+void hash_pawntt_create_table(struct search_worker *worker, int size)
 {
-    (void)worker;
+    assert(size > 0);
 
-    PREFETCH_ADDRESS(&transposition_table[worker->pos.key&(tt_size-1)]);
-    PREFETCH_ADDRESS(&worker->nnue_cache[worker->pos.key&(worker->nnue_cache_size-1)]);
+    hash_pawntt_destroy_table(worker);
+
+    worker->pawntt_size = largest_power_of_2(KB_TO_BYTES(size),
+                                             sizeof(struct pawntt_item));
+    worker->pawntt = numa_alloc(worker->pawntt_size*sizeof(struct pawntt_item),
+                                numa_node_for_worker(worker->id));
+    assert(worker->pawntt != NULL);
+    hash_pawntt_clear_table(worker);
+}
+
+void hash_pawntt_destroy_table(struct search_worker *worker)
+{
+    if (worker->pawntt == NULL) {
+        return;
+    }
+
+    numa_free(worker->pawntt, worker->pawntt_size*sizeof(struct pawntt_item));
+    worker->pawntt = NULL;
+    worker->pawntt_size = 0ULL;
+}
+
+void hash_pawntt_clear_table(struct search_worker *worker)
+{
+    assert(worker != NULL);
+
+    if (worker->pawntt == NULL) {
+        return;
+    }
+
+    /*
+     * A pawn key of zero is only used for positions without pawns
+     * so the items have to be marked as unused explicitly.
+     */
+    memset(worker->pawntt, 0, worker->pawntt_size*sizeof(struct pawntt_item));
+    worker->pawntt[0].pawnkey = 1ULL;
+}
+
+void hash_pawntt_store(struct search_worker *worker, struct pawntt_item *item)
+{
+    assert(item != NULL);
+
+    if (worker->pawntt == NULL) {
+        return;
+    }
+
+    worker->pawntt[item->pawnkey&(worker->pawntt_size-1)] = *item;
+}
+
+bool hash_pawntt_lookup(struct search_worker *worker, uint64_t pawnkey,
+                        struct pawntt_item *item)
+{
+    struct pawntt_item *entry;
+
+    assert(item != NULL);
+
+    if (worker->pawntt == NULL) {
+        return false;
+    }
+
+    entry = &worker->pawntt[pawnkey&(worker->pawntt_size-1)];
+    if (entry->pawnkey != pawnkey) {
+        return false;
+    }
+    *item = *entry;
+
+    return true;
+}
+
+void hash_mattt_create_table(struct search_worker *worker, int size)
+{
+    assert(size > 0);
+
+    hash_mattt_destroy_table(worker);
+
+    worker->mattt_size = largest_power_of_2(KB_TO_BYTES(size),
+                                            sizeof(struct material_item));
+    worker->mattt = numa_alloc(worker->mattt_size*sizeof(struct material_item),
+                               numa_node_for_worker(worker->id));
+    assert(worker->mattt != NULL);
+    hash_mattt_clear_table(worker);
+}
+
+void hash_mattt_destroy_table(struct search_worker *worker)
+{
+    if (worker->mattt == NULL) {
+        return;
+    }
+
+    numa_free(worker->mattt, worker->mattt_size*sizeof(struct material_item));
+    worker->mattt = NULL;
+    worker->mattt_size = 0ULL;
+}
+
+void hash_mattt_clear_table(struct search_worker *worker)
+{
+    assert(worker != NULL);
+
+    if (worker->mattt == NULL) {
+        return;
+    }
+
+    /*
+     * A material key of zero is used for positions with only the
+     * two kings so the items have to be marked as unused explicitly.
+     */
+    memset(worker->mattt, 0, worker->mattt_size*sizeof(struct material_item));
+    worker->mattt[0].matkey = 1ULL;
+}
+
+void hash_mattt_store(struct search_worker *worker,
+                      struct material_item *item)
+{
+    assert(item != NULL);
+
+    if (worker->mattt == NULL) {
+        return;
+    }
+
+    worker->mattt[item->matkey&(worker->mattt_size-1)] = *item;
+}
+
+bool hash_mattt_lookup(struct search_worker *worker, uint64_t matkey,
+                       struct material_item *item)
+{
+    struct material_item *entry;
+
+    assert(item != NULL);
+
+    if (worker->mattt == NULL) {
+        return false;
+    }
+
+    entry = &worker->mattt[matkey&(worker->mattt_size-1)];
+    if (entry->matkey != matkey) {
+        return false;
+    }
+    *item = *entry;
+
+    return true;
+}
+
+void hash_prefetch(struct search_worker *worker, uint64_t key)
+{
+    struct tt_table *tt = &worker->engine->tt;
+
+    PREFETCH_ADDRESS(find_bucket(tt, worker, key));
+    if (worker->nnue_cache != NULL) {
+        PREFETCH_ADDRESS(&worker->nnue_cache[key&(worker->nnue_cache_size-1)]);
+    }
 }
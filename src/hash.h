@@ -22,11 +22,15 @@
 
 #include "types.h"
 
-/* Different flags for transposition table entries */
+/*
+ * Different flags for transposition table entries. For TT_EVAL_ONLY
+ * entries only the static evaluation is valid.
+ */
 enum {
     TT_EXACT,
     TT_BETA,
-    TT_ALPHA
+    TT_ALPHA,
+    TT_EVAL_ONLY
 };
 
 /*
@@ -39,46 +43,140 @@ int hash_tt_max_size(void);
 /*
  * Get the size of the transposition table size.
  *
+ * @param engine The engine.
  * @return Returns the size (in MB).
  */
-int hash_tt_size(void);
+int hash_tt_size(struct engine *engine);
 
 /*
- * Create the main transposition table.
+ * Create the main transposition table of an engine. The workers of the
+ * engine must have been created before the table.
  *
+ * @param engine The engine.
  * @param size The amount of memory to use for the table (in MB).
  */
-void hash_tt_create_table(int size);
+void hash_tt_create_table(struct engine *engine, int size);
+
+/*
+ * Create the main transposition table in the background. The function
+ * returns directly and the table is allocated by a separate thread and
+ * cleared by the worker threads of the engine. An info string is sent
+ * when the table is ready to be used. Functions operating on the table
+ * wait for the table to become ready before using it, but a search, or
+ * anything else using the worker threads, must call
+ * hash_tt_wait_for_table before starting.
+ *
+ * @param engine The engine.
+ * @param size The size of the table (in MB).
+ */
+void hash_tt_create_table_async(struct engine *engine, int size);
+
+/*
+ * Wait for a table created by hash_tt_create_table_async to become ready.
+ *
+ * @param engine The engine.
+ */
+void hash_tt_wait_for_table(struct engine *engine);
+
+/*
+ * Let an engine use the main transposition table of another engine
+ * instead of its own. The table can then be used by both engines
+ * concurrently. The owner must not destroy or resize the table while
+ * it is being used by other engines. The table is not aged while it is
+ * shared so that all engines agree on the date of the entries.
+ *
+ * @param engine The engine that should borrow the table.
+ * @param owner The engine owning the table.
+ */
+void hash_tt_share_table(struct engine *engine, struct engine *owner);
 
 /*
  * Destroy the main transposition table.
+ *
+ * @param engine The engine.
  */
-void hash_tt_destroy_table(void);
+void hash_tt_destroy_table(struct engine *engine);
 
 /*
- * Clear the main transposition table.
+ * Clear the main transposition table. Usually this only starts a new
+ * epoch for the table, which makes all existing entries invalid, so it is
+ * cheap even for large tables.
+ *
+ * @param engine The engine.
  */
-void hash_tt_clear_table(void);
+void hash_tt_clear_table(struct engine *engine);
 
 /*
  * Increase the age of the main transposition table.
+ *
+ * @param engine The engine.
+ */
+void hash_tt_age_table(struct engine *engine);
+
+/*
+ * Split the main transposition table into one private part for each
+ * worker, so that the workers can't affect each other through the table.
+ * Entries stored without a worker still use the whole table.
+ *
+ * @param engine The engine.
+ * @param nparts The number of parts, or 1 to let all workers share the
+ *               whole table.
+ */
+void hash_tt_partition_table(struct engine *engine, int nparts);
+
+/*
+ * Save the main transposition table to a file.
+ *
+ * @param engine The engine.
+ * @param path The file to save the table to.
+ * @return Returns true if the table was saved successfully.
  */
-void hash_tt_age_table(void);
+bool hash_tt_save_table(struct engine *engine, char *path);
 
 /*
- * Store a new position in the main transposition table.
+ * Load the main transposition table from a file created by
+ * hash_tt_save_table. The table is resized to the size of the
+ * saved table if needed.
+ *
+ * @param engine The engine.
+ * @param path The file to load the table from.
+ * @return Returns true if the table was loaded successfully.
+ */
+bool hash_tt_load_table(struct engine *engine, char *path);
+
+/*
+ * Store a new position in the main transposition table of the
+ * engine owning the position.
  *
  * @param pos The board structure.
  * @param move The best move found.
  * @param depth The depth to which the position was searched.
  * @param score The score for the position.
  * @param type The type of the score.
+ * @param eval The static evaluation of the position.
  */
 void hash_tt_store(struct position *pos, uint32_t move, int depth, int score,
-                   int type);
+                   int type, int eval);
+
+/*
+ * Store an entry received from another engine in the main transposition
+ * table. Unlike hash_tt_store the key is given explicitly and mate scores
+ * are expected to already be relative to the position.
+ *
+ * @param engine The engine.
+ * @param key The position key.
+ * @param move The best move found.
+ * @param depth The depth to which the position was searched.
+ * @param score The score for the position.
+ * @param type The type of the score.
+ * @param eval The static evaluation of the position.
+ */
+void hash_tt_store_entry(struct engine *engine, uint64_t key, uint32_t move,
+                         int depth, int score, int type, int eval);
 
 /*
- * Lookup the current position in the main transposition table.
+ * Lookup the current position in the main transposition table of
+ * the engine owning the position.
  *
  * @param pos The board structure.
  * @param item Location to store the transposition table item at.
@@ -89,17 +187,22 @@ bool hash_tt_lookup(struct position *pos, struct tt_item *item);
 /*
  * Get the transposition table usage.
  *
+ * @param engine The engine.
  * @return Returns how many permill of the transposition table that is used.
  */
-int hash_tt_usage(void);
+int hash_tt_usage(struct engine *engine);
 
 /*
  * Create the NNUE cache.
  *
  * @param worker The worker.
- * @param size The amount of memory to use for the cache (in MB).
+ * @param size The amount of memory to use for the cache (in MB). If the
+ *             size is zero then no cache is used.
+ * @param shared If true then the worker uses a cache that is shared by
+ *               all workers instead of a private one.
  */
-void hash_nnue_create_table(struct search_worker *worker, int size);
+void hash_nnue_create_table(struct search_worker *worker, int size,
+                            bool shared);
 
 /*
  * Destroy the NNUE cache.
@@ -132,11 +235,97 @@ void hash_nnue_store(struct search_worker *worker, int score);
  */
 bool hash_nnue_lookup(struct search_worker *worker, int *score);
 
+/*
+ * Create the pawn hash table.
+ *
+ * @param worker The worker.
+ * @param size The amount of memory to use for the table (in KB).
+ */
+void hash_pawntt_create_table(struct search_worker *worker, int size);
+
+/*
+ * Destroy the pawn hash table.
+ *
+ * @param worker The worker.
+ */
+void hash_pawntt_destroy_table(struct search_worker *worker);
+
+/*
+ * Clear the pawn hash table.
+ *
+ * @param worker The worker.
+ */
+void hash_pawntt_clear_table(struct search_worker *worker);
+
+/*
+ * Store a new item in the pawn hash table. The item is stored
+ * using the pawn key of the item.
+ *
+ * @param worker The worker.
+ * @param item The item to store.
+ */
+void hash_pawntt_store(struct search_worker *worker, struct pawntt_item *item);
+
+/*
+ * Lookup a pawn structure in the pawn hash table.
+ *
+ * @param worker The worker.
+ * @param pawnkey The pawn key of the pawn structure.
+ * @param item Location to store the found item at.
+ * @return Returns true if an item was found in the table, false otherwise.
+ */
+bool hash_pawntt_lookup(struct search_worker *worker, uint64_t pawnkey,
+                        struct pawntt_item *item);
+
+/*
+ * Create the material hash table.
+ *
+ * @param worker The worker.
+ * @param size The amount of memory to use for the table (in KB).
+ */
+void hash_mattt_create_table(struct search_worker *worker, int size);
+
+/*
+ * Destroy the material hash table.
+ *
+ * @param worker The worker.
+ */
+void hash_mattt_destroy_table(struct search_worker *worker);
+
+/*
+ * Clear the material hash table.
+ *
+ * @param worker The worker.
+ */
+void hash_mattt_clear_table(struct search_worker *worker);
+
+/*
+ * Store a new item in the material hash table. The item is stored
+ * using the material key of the item.
+ *
+ * @param worker The worker.
+ * @param item The item to store.
+ */
+void hash_mattt_store(struct search_worker *worker,
+                      struct material_item *item);
+
+/*
+ * Lookup a material configuration in the material hash table.
+ *
+ * @param worker The worker.
+ * @param matkey The material key of the material configuration.
+ * @param item Location to store the found item at.
+ * @return Returns true if an item was found in the table, false otherwise.
+ */
+bool hash_mattt_lookup(struct search_worker *worker, uint64_t matkey,
+                       struct material_item *item);
+
 /*
  * Prefetch hash table entries for a specific position.
  *
  * @param worker The worker.
+ * @param key The key of the position.
  */
-void hash_prefetch(struct search_worker *worker);
+void hash_prefetch(struct search_worker *worker, uint64_t key);
 
 #endif
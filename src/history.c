@@ -26,29 +26,39 @@
 #include "validation.h"
 #include "data.h"
 
-/* The maximum allowed history score */
+/*
+ * The maximum allowed history score. Must fit in the 16-bit
+ * entries of the history tables.
+ */
 #define MAX_HISTORY_SCORE 16384
 
 static int calc_update_delta(int depth, bool best)
 {
     int delta;
 
-    delta = 32*depth*depth;
+    delta = MIN(32*depth*depth, MAX_HISTORY_SCORE);
     return best ? delta: -delta;
 }
 
-static void update_history_score(int *score, int delta)
+/*
+ * Apply a gravity style update to a history score. The bonus is scaled
+ * down the closer the score gets to the limit which together with the
+ * bounded delta keeps the score within +/- MAX_HISTORY_SCORE.
+ */
+static void update_history_score(int16_t *score, int delta)
 {
-    *score += delta - *score*abs(delta)/MAX_HISTORY_SCORE;
+    int value;
+
+    value = *score;
+    value += delta - value*abs(delta)/MAX_HISTORY_SCORE;
+    *score = (int16_t)(CLAMP(value, -MAX_HISTORY_SCORE, MAX_HISTORY_SCORE));
 }
 
 void history_clear_tables(struct search_worker *worker)
 {
-    memset(worker->history_table, 0, sizeof(int)*NPIECES*NSQUARES);
-    memset(worker->counter_history, 0,
-           sizeof(int)*NPIECES*NSQUARES*NPIECES*NSQUARES);
-    memset(worker->follow_history, 0,
-           sizeof(int)*NPIECES*NSQUARES*NPIECES*NSQUARES);
+    memset(worker->history_table, 0, sizeof(worker->history_table));
+    memset(worker->counter_history, 0, sizeof(worker->counter_history));
+    memset(worker->follow_history, 0, sizeof(worker->follow_history));
 }
 
 void history_update_tables(struct search_worker *worker, struct movelist *list,
@@ -184,6 +194,18 @@ void killer_clear_table(struct search_worker *worker)
     }
 }
 
+void killer_shift_table(struct search_worker *worker, int nplies)
+{
+    int k;
+
+    assert(nplies >= 0);
+
+    for (k=0;k<MAX_PLY;k++) {
+        worker->killer_table[k] = ((k+nplies) < MAX_PLY)?
+                                    worker->killer_table[k+nplies]:NOMOVE;
+    }
+}
+
 void killer_add_move(struct search_worker *worker, uint32_t move)
 {
     struct position *pos = &worker->pos;
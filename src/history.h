@@ -68,6 +68,16 @@ void history_get_scores(struct search_worker *worker, uint32_t move,
  */
 void killer_clear_table(struct search_worker *worker);
 
+/*
+ * Move the killer moves towards the root. Used when the root has advanced
+ * along the line searched earlier, so that the killer moves of a ply are
+ * kept for the positions at the same distance from the new root.
+ *
+ * @param worker The worker.
+ * @param nplies The number of plies the root has advanced.
+ */
+void killer_shift_table(struct search_worker *worker, int nplies);
+
 /*
  * Add a move to the killer move table.
  *
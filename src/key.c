@@ -22,6 +22,14 @@
 #include "utils.h"
 #include "validation.h"
 #include "bitboard.h"
+#include "data.h"
+
+/* The number of entries in the cuckoo tables */
+#define CUCKOO_TABLE_SIZE 8192
+
+/* The two hash functions used for the cuckoo tables */
+#define CUCKOO_H1(k) ((int)((k)&(CUCKOO_TABLE_SIZE-1)))
+#define CUCKOO_H2(k) ((int)(((k)>>16)&(CUCKOO_TABLE_SIZE-1)))
 
 /* 64-bit value for each piece/square combination */
 static uint64_t piece_values[NPIECES][NSQUARES] = {
@@ -464,6 +472,10 @@ static uint64_t castle_values[16] = {
     17026459123590339232ULL, 15031333701544438364ULL
 };
 
+/* Key differences and moves for all reversible moves */
+static uint64_t cuckoo_keys[CUCKOO_TABLE_SIZE];
+static uint32_t cuckoo_moves[CUCKOO_TABLE_SIZE];
+
 uint64_t key_generate(struct position *pos)
 {
     uint64_t key;
@@ -494,12 +506,140 @@ uint64_t key_generate(struct position *pos)
     return key;
 }
 
+uint64_t key_generate_pawnkey(struct position *pos)
+{
+    uint64_t key;
+    uint64_t pieces;
+    int      sq;
+
+    assert(valid_position(pos));
+
+    key = 0ULL;
+    pieces = pos->bb_pieces[WHITE_PAWN]|pos->bb_pieces[BLACK_PAWN];
+    while (pieces != 0ULL) {
+        sq = POPBIT(&pieces);
+        key ^= piece_values[pos->pieces[sq]][sq];
+    }
+
+    return key;
+}
+
+uint64_t key_generate_matkey(struct position *pos)
+{
+    uint64_t key;
+    int      piece;
+    int      count;
+    int      k;
+
+    assert(valid_position(pos));
+
+    key = 0ULL;
+    for (piece=0;piece<NPIECES;piece++) {
+        if (VALUE(piece) == KING) {
+            continue;
+        }
+        count = BITCOUNT(pos->bb_pieces[piece]);
+        for (k=0;k<count;k++) {
+            key ^= piece_values[piece][k];
+        }
+    }
+
+    return key;
+}
+
+/*
+ * Calculate the castling availability after a move, using the same
+ * rules as for updating the position when the move is made.
+ */
+static int castling_after_move(struct position *pos, int piece, int from,
+                               int to)
+{
+    int castle = pos->castle;
+
+    if (pos->stm == WHITE) {
+        if (piece == WHITE_KING) {
+            castle &= ~(WHITE_KINGSIDE|WHITE_QUEENSIDE);
+        } else if ((piece == WHITE_ROOK) && (from == pos->castle_wk)) {
+            castle &= ~WHITE_KINGSIDE;
+        } else if ((piece == WHITE_ROOK) && (from == pos->castle_wq)) {
+            castle &= ~WHITE_QUEENSIDE;
+        }
+        if (to == pos->castle_bk) {
+            castle &= ~BLACK_KINGSIDE;
+        } else if (to == pos->castle_bq) {
+            castle &= ~BLACK_QUEENSIDE;
+        }
+    } else {
+        if (piece == BLACK_KING) {
+            castle &= ~(BLACK_KINGSIDE|BLACK_QUEENSIDE);
+        } else if ((piece == BLACK_ROOK) && (from == pos->castle_bk)) {
+            castle &= ~BLACK_KINGSIDE;
+        } else if ((piece == BLACK_ROOK) && (from == pos->castle_bq)) {
+            castle &= ~BLACK_QUEENSIDE;
+        }
+        if (to == pos->castle_wk) {
+            castle &= ~WHITE_KINGSIDE;
+        } else if (to == pos->castle_wq) {
+            castle &= ~WHITE_QUEENSIDE;
+        }
+    }
+
+    return castle;
+}
+
+uint64_t key_after_move(struct position *pos, uint32_t move)
+{
+    uint64_t key = pos->key;
+    int      from = FROM(move);
+    int      to = TO_CASTLE(move);
+    int      piece = pos->pieces[from];
+    int      side = pos->stm;
+    int      ep_sq = NO_SQUARE;
+
+    /* Update en passant square and castling availability */
+    if ((VALUE(piece) == PAWN) && (abs(to-from) == 16)) {
+        ep_sq = (side == WHITE)?to-8:to+8;
+    }
+    key = key_update_ep_square(key, pos->ep_sq, ep_sq);
+    if (pos->castle != 0) {
+        key = key_update_castling(key, pos->castle,
+                                  castling_after_move(pos, piece, from, to));
+    }
+
+    /* Update pieces */
+    key = key_update_piece(key, piece, from);
+    if (ISCAPTURE(move)) {
+        key = key_update_piece(key, pos->pieces[to], to);
+    } else if (ISENPASSANT(move)) {
+        key = key_update_piece(key, PAWN+FLIP_COLOR(side),
+                               (side == WHITE)?to-8:to+8);
+    }
+    if (ISKINGSIDECASTLE(move)) {
+        key = key_update_piece(key, side+ROOK, TO(move));
+        key = key_update_piece(key, side+ROOK, (side == WHITE)?F1:F8);
+    } else if (ISQUEENSIDECASTLE(move)) {
+        key = key_update_piece(key, side+ROOK, TO(move));
+        key = key_update_piece(key, side+ROOK, (side == WHITE)?D1:D8);
+    }
+    key = key_update_piece(key, ISPROMOTION(move)?PROMOTION(move):piece, to);
+
+    return key_update_side(key, FLIP_COLOR(side));
+}
+
 uint64_t key_update_piece(uint64_t key, int piece, int sq)
 {
     key ^= piece_values[piece][sq];
     return key;
 }
 
+uint64_t key_update_material(uint64_t key, int piece, int count)
+{
+    assert(count > 0);
+
+    key ^= piece_values[piece][count-1];
+    return key;
+}
+
 uint64_t key_update_ep_square(uint64_t key, int old_sq, int new_sq)
 {
     if (old_sq != NO_SQUARE) {
@@ -548,3 +688,66 @@ uint64_t key_set_castling(uint64_t key, int castle)
     key ^= castle_values[castle];
     return key;
 }
+
+void key_init_cuckoo_tables(void)
+{
+    int      piece;
+    int      from;
+    int      to;
+    int      idx;
+    uint64_t key;
+    uint64_t tmp_key;
+    uint32_t move;
+    uint32_t tmp_move;
+
+    for (idx=0;idx<CUCKOO_TABLE_SIZE;idx++) {
+        cuckoo_keys[idx] = 0ULL;
+        cuckoo_moves[idx] = NOMOVE;
+    }
+
+    for (piece=WHITE_KNIGHT;piece<NPIECES;piece++) {
+        for (from=0;from<NSQUARES;from++) {
+            for (to=from+1;to<NSQUARES;to++) {
+                if (!ISBITSET(bb_moves_for_piece(0ULL, from, piece), to)) {
+                    continue;
+                }
+
+                /*
+                 * Insert the move, displacing any existing entry to
+                 * its alternative slot until an empty slot is found.
+                 */
+                move = MOVE(from, to, NO_PIECE, NORMAL);
+                key = piece_values[piece][from]^piece_values[piece][to]^
+                      color_values[WHITE]^color_values[BLACK];
+                idx = CUCKOO_H1(key);
+                while (true) {
+                    tmp_key = cuckoo_keys[idx];
+                    tmp_move = cuckoo_moves[idx];
+                    cuckoo_keys[idx] = key;
+                    cuckoo_moves[idx] = move;
+                    if (tmp_move == NOMOVE) {
+                        break;
+                    }
+                    key = tmp_key;
+                    move = tmp_move;
+                    idx = (idx == CUCKOO_H1(key))?
+                                            CUCKOO_H2(key):CUCKOO_H1(key);
+                }
+            }
+        }
+    }
+}
+
+uint32_t key_find_reversible_move(uint64_t diff)
+{
+    int idx;
+
+    idx = CUCKOO_H1(diff);
+    if (cuckoo_keys[idx] != diff) {
+        idx = CUCKOO_H2(diff);
+        if (cuckoo_keys[idx] != diff) {
+            return NOMOVE;
+        }
+    }
+    return cuckoo_moves[idx];
+}
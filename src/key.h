@@ -30,6 +30,35 @@
  */
 uint64_t key_generate(struct position *pos);
 
+/*
+ * Generate a key for the pawn structure of a chess position. The key
+ * only depends on the location of the pawns.
+ *
+ * @param pos A chess position.
+ * @return Returns the pawn key.
+ */
+uint64_t key_generate_pawnkey(struct position *pos);
+
+/*
+ * Generate a key for the material configuration of a chess position. The
+ * key only depends on the number of pieces of each type.
+ *
+ * @param pos A chess position.
+ * @return Returns the material key.
+ */
+uint64_t key_generate_matkey(struct position *pos);
+
+/*
+ * Calculate the key of the position after a move without making the
+ * move. Used to start fetching data for the resulting position before
+ * the board is updated.
+ *
+ * @param pos A chess position.
+ * @param move A legal move in the position.
+ * @return Returns the key of the position after the move.
+ */
+uint64_t key_after_move(struct position *pos, uint32_t move);
+
 /*
  * Update a piece in the key.
  *
@@ -40,6 +69,17 @@ uint64_t key_generate(struct position *pos);
  */
 uint64_t key_update_piece(uint64_t key, int piece, int sq);
 
+/*
+ * Update the material key when a piece is added or removed.
+ *
+ * @param key The key to update.
+ * @param piece The piece to add/remove.
+ * @param count The number of pieces of this type including the piece
+ *              being added/removed.
+ * @return Returns the updated key.
+ */
+uint64_t key_update_material(uint64_t key, int piece, int count);
+
 /*
  * Update the en passant square in the key.
  *
@@ -107,4 +147,22 @@ uint64_t key_set_side(uint64_t key, int color);
  */
 uint64_t key_set_castling(uint64_t key, int castle);
 
+/*
+ * Initialize the cuckoo tables used for detecting upcoming repetitions.
+ * The tables contain the key difference for every reversible move of
+ * a non-pawn piece on an empty board. Must be called after the move
+ * databases have been initialized.
+ */
+void key_init_cuckoo_tables(void);
+
+/*
+ * Find the reversible move corresponding to a key difference.
+ *
+ * @param diff The difference between two keys.
+ * @return Returns a move between the two squares involved, or NOMOVE
+ *         if no reversible move results in this difference. The move
+ *         can go in either direction.
+ */
+uint32_t key_find_reversible_move(uint64_t diff);
+
 #endif
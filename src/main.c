@@ -20,6 +20,7 @@
 #include <time.h>
 #include <string.h>
 #include <limits.h>
+#include <inttypes.h>
 
 #include "utils.h"
 #include "types.h"
@@ -38,12 +39,78 @@
 #include "nnue.h"
 #include "data.h"
 #include "sfen.h"
+#include "sfenio.h"
+#include "analyze.h"
+#include "numa.h"
+#include "cpu.h"
+#include "sharedmem.h"
+#include "material.h"
+#include "key.h"
+#include "cluster.h"
+#include "server.h"
+#include "thread.h"
+#include "tuner.h"
+
+/* Thread used to initialize the material component during startup */
+static thread_t material_init_thread;
+static bool material_init_running = false;
 
 static void cleanup(void)
 {
     dbg_log_close();
 }
 
+/*
+ * Log the time spent in a phase of the startup.
+ *
+ * @param phase The name of the phase.
+ * @param start The time when the phase was started (in us).
+ * @return Returns the current time (in us).
+ */
+static uint64_t log_phase_time(char *phase, uint64_t start)
+{
+    uint64_t now = get_current_time_us();
+
+    LOG_INFO1("Startup: %s took %" PRIu64 " us\n", phase, now-start);
+
+    return now;
+}
+
+/*
+ * Generating the KPK bitbase is the slowest part of the startup and it
+ * doesn't depend on anything but the bitboard tables, so unless there is
+ * only one CPU it is done by a separate thread while the rest of the
+ * engine is set up.
+ */
+static thread_retval_t material_init_func(void *data)
+{
+    uint64_t start = get_current_time_us();
+
+    (void)data;
+
+    material_init();
+    (void)log_phase_time("material tables (background)", start);
+
+    return (thread_retval_t)0;
+}
+
+static void wait_for_material_init(void)
+{
+    if (material_init_running) {
+        thread_join(&material_init_thread);
+        material_init_running = false;
+    }
+}
+
+/* Print the NUMA topology if it affects how threads are placed */
+static void print_numa_topology(void)
+{
+    if ((numa_number_of_nodes() > 1) ||
+        (numa_get_policy() != NUMA_POLICY_NONE)) {
+        numa_print_topology();
+    }
+}
+
 static void print_version(void)
 {
     printf("%s %s (%s)\n", APP_NAME, APP_VERSION, APP_ARCH);
@@ -52,13 +119,79 @@ static void print_version(void)
     if (!engine_using_nnue || !engine_loaded_net) {
         printf("Using classic evaluation\n");
     } else {
-        printf("Using NNUE evaluation\n");
+        printf("Using NNUE evaluation (%s)\n", cpu_simd_name());
     }
 }
 
+/*
+ * Syntax: --bench [<depth> [<threads> [<hash> [<fenfile>]]]] [--json]
+ *                 [--reproducible] [--nodes <nodes>]
+ *                 [--baseline <file> [--threshold <percent>]]
+ *                 [--save-baseline <file>]
+ */
+static int run_benchmark(int argc, char *argv[])
+{
+    struct bench_options options;
+    int                  values[3] = {0, 0, 0};
+    int                  nargs = 0;
+    int                  k;
+
+    memset(&options, 0, sizeof(options));
+    options.threshold = DEFAULT_BENCH_THRESHOLD;
+    for (k=2;k<argc;k++) {
+        if (MATCH(argv[k], "--json")) {
+            options.json = true;
+        } else if (MATCH(argv[k], "--reproducible")) {
+            options.reproducible = true;
+        } else if (MATCH(argv[k], "--nodes") && ((k+1) < argc)) {
+            options.nodes = strtoull(argv[++k], NULL, 10);
+        } else if (MATCH(argv[k], "--baseline") && ((k+1) < argc)) {
+            options.baseline = argv[++k];
+        } else if (MATCH(argv[k], "--threshold") && ((k+1) < argc)) {
+            options.threshold = atoi(argv[++k]);
+        } else if (MATCH(argv[k], "--save-baseline") && ((k+1) < argc)) {
+            options.save_baseline = argv[++k];
+        } else if (nargs < 3) {
+            values[nargs++] = atoi(argv[k]);
+        } else if (options.fenfile == NULL) {
+            options.fenfile = argv[k];
+        }
+    }
+    options.depth = values[0];
+    options.nthreads = values[1];
+    options.hash_size = values[2];
+
+    return test_run_benchmark(&options)?0:1;
+}
+
+/*
+ * Syntax: --microbench [<repetitions> [<fenfile>]] [--json]
+ */
+static void run_microbenchmark(int argc, char *argv[])
+{
+    int  repetitions = 0;
+    char *fenfile = NULL;
+    bool json = false;
+    int  nargs = 0;
+    int  k;
+
+    for (k=2;k<argc;k++) {
+        if (MATCH(argv[k], "--json")) {
+            json = true;
+        } else if (nargs++ == 0) {
+            repetitions = atoi(argv[k]);
+        } else if (fenfile == NULL) {
+            fenfile = argv[k];
+        }
+    }
+
+    test_run_microbenchmark(repetitions, fenfile, json);
+}
+
 int main(int argc, char *argv[])
 {
     struct engine *engine;
+    uint64_t      start;
 
     /* Register a clean up function */
     atexit(cleanup);
@@ -70,59 +203,146 @@ int main(int argc, char *argv[])
     /* Seed random number generator */
     srand((unsigned int)time(NULL));
 
-    /* Setup the default NNUE net */
-    strcpy(engine_eval_file, NETFILE_NAME);
-    nnue_init();
-    engine_loaded_net = nnue_load_net(NULL);
-    engine_using_nnue = engine_loaded_net;
+    /* Select implementations based on the features of the CPU */
+    cpu_init();
+    engine_init();
 
     /* Read configuration file */
+    start = get_current_time_us();
     engine_read_config_file(CONFIGFILE_NAME);
+    start = log_phase_time("configuration", start);
 
     /* Initialize components */
+    numa_init();
     data_init();
-    bb_init();
-    search_init();
-    polybook_open(BOOKFILE_NAME);
+    nnue_init();
+    start = log_phase_time("data tables", start);
 
-    /* Setup SMP */
-    smp_init();
-    smp_create_workers(engine_default_num_threads);
+    /*
+     * Creating the engine is dominated by clearing the transposition
+     * table. When the engine is started without any options, and there
+     * is more than one CPU, the engine is therefore created here so that
+     * the table is cleared in the background while the NNUE net and the
+     * remaining tables are setup.
+     */
+    engine = NULL;
+    if ((argc == 1) && (numa_number_of_cpus() != 1)) {
+        print_numa_topology();
+        engine = engine_create_early(engine_default_hash_size,
+                                     engine_default_num_threads);
+        if (engine == NULL) {
+            return 1;
+        }
+        start = log_phase_time("engine workers", start);
+    }
 
-    /* Setup main transposition table */
-    hash_tt_create_table(engine_default_hash_size);
+    /*
+     * Setup the default NNUE net and the move databases, either
+     * in shared memory or privately.
+     */
+    strcpy(engine_eval_file, NETFILE_NAME);
+    if (engine_shared_tables && sharedmem_init()) {
+        engine_loaded_net = true;
+    } else {
+        engine_loaded_net = nnue_load_net(NULL);
+        start = log_phase_time("NNUE net", start);
+        bb_init();
+    }
+    start = log_phase_time("move tables", start);
+    engine_using_nnue = engine_loaded_net;
+    if (numa_number_of_cpus() != 1) {
+        thread_create(&material_init_thread, material_init_func, NULL);
+        material_init_running = true;
+    } else {
+        material_init();
+        start = log_phase_time("material tables", start);
+    }
+    key_init_cuckoo_tables();
+    sfenio_init();
+    search_init();
+    start = log_phase_time("search tables", start);
+    polybook_open(BOOKFILE_NAME);
+    start = log_phase_time("opening book", start);
 
     /* Handle command line options */
-    if ((argc == 2) &&
+    if (argc >= 2) {
+        wait_for_material_init();
+    }
+    if ((argc >= 2) &&
         (MATCH(argv[1], "-b") || MATCH(argv[1], "--bench"))) {
-        test_run_benchmark();
+        return run_benchmark(argc, argv);
+    } else if ((argc >= 2) && MATCH(argv[1], "--microbench")) {
+        run_microbenchmark(argc, argv);
         return 0;
     } else if ((argc == 2) &&
                (MATCH(argv[1], "-v") || MATCH(argv[1], "--version"))) {
         print_version();
         return 0;
+    } else if (((argc == 3) || (argc == 4)) &&
+               MATCH(argv[1], "--export-net")) {
+        if ((argc == 4) && !nnue_load_net(argv[3])) {
+            printf("Failed to load %s\n", argv[3]);
+            return 1;
+        }
+        if (!nnue_export_net(argv[2])) {
+            printf("Failed to write %s\n", argv[2]);
+            return 1;
+        }
+        return 0;
     } else if ((argc >= 2) && (MATCH(argv[1], "--generate"))) {
         return sfen_generate(argc, argv);
     } else if ((argc >= 2) && (MATCH(argv[1], "--rescore"))) {
         return sfen_rescore(argc, argv);
+    } else if ((argc >= 2) && (MATCH(argv[1], "--evaluate"))) {
+        return sfen_evaluate(argc, argv);
+    } else if ((argc >= 2) && (MATCH(argv[1], "--convert"))) {
+        return sfen_convert(argc, argv);
+    } else if ((argc >= 2) && (MATCH(argv[1], "--sfen-bench"))) {
+        return sfen_benchmark(argc, argv);
+    } else if ((argc >= 2) && (MATCH(argv[1], "--analyze"))) {
+        return analyze_epd(argc, argv);
+    } else if ((argc >= 2) && (MATCH(argv[1], "--cluster-node"))) {
+        return cluster_run_node(argc, argv);
+    } else if ((argc >= 2) && (MATCH(argv[1], "--server"))) {
+        return server_run(argc, argv);
+    } else if ((argc >= 2) && (MATCH(argv[1], "--tune"))) {
+        return tuner_run(argc, argv);
     }
 
-    /* Create engine */
-    engine = engine_create();
+    /* Create engine, unless it was created early */
     if (engine == NULL) {
-        return 1;
+        print_numa_topology();
+        engine = engine_create(engine_default_hash_size,
+                               engine_default_num_threads);
+        if (engine == NULL) {
+            return 1;
+        }
+    } else {
+        engine_setup_position(engine);
+        hash_tt_wait_for_table(engine);
+    }
+    (void)log_phase_time("engine", start);
+    wait_for_material_init();
+    if (engine_low_memory) {
+        engine_print_memory_usage(engine);
+    }
+    if (engine_cluster_nodes[0] != '\0') {
+        cluster_connect(engine, engine_cluster_nodes);
     }
 
-    /* Enter the main engine loop */
+    /*
+     * Enter the main engine loop. The session is never closed since
+     * the input thread is usually blocked reading stdin. Instead it is
+     * terminated together with the process.
+     */
+    engine_open_session(stdin, stdout);
     engine_loop(engine);
 
     /* Clean up */
     polybook_close();
     engine_destroy(engine);
-    hash_tt_destroy_table();
-    smp_destroy_workers();
-    smp_destroy();
     nnue_destroy();
+    sharedmem_destroy();
 
     return 0;
 }
@@ -0,0 +1,533 @@
+/*
+ * Marvin - an UCI/XBoard compatible chess engine
+ * Copyright (C) 2023 Martin Danielsson
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <assert.h>
+#include <stdatomic.h>
+
+#include "mate.h"
+#include "search.h"
+#include "hash.h"
+#include "movegen.h"
+#include "position.h"
+#include "engine.h"
+#include "timectl.h"
+#include "smp.h"
+#include "utils.h"
+#include "validation.h"
+
+/* Check time and input every 1024 nodes */
+#define CHECKUP(n) (((n)&1023)==0)
+
+/* Move ordering scores */
+#define HASH_MOVE_SCORE 3
+#define CHECK_SCORE 2
+#define TACTICAL_SCORE 1
+
+/*
+ * Entry in the mate table. The key is stored xor:ed with the data so
+ * that entries that are only partially written by another thread are
+ * detected and ignored.
+ */
+struct mate_entry {
+    uint64_t key;
+    uint64_t data;
+};
+
+/* Shared state for a mate search where root moves are split between workers */
+struct mate_job {
+    struct engine     *engine;
+    int               depth;
+    struct movelist   moves;
+    atomic_int        next;
+    atomic_int        mate_idx;
+    atomic_bool       found;
+    struct mate_entry *table;
+    uint64_t          size;
+};
+
+/*
+ * Mate scores are stored relative to the position instead of relative
+ * to the root, in the same way as in the main transposition table. Since
+ * the mate search never prunes any moves, and never considers draws by
+ * repetition, the stored results do not depend on how the position was
+ * reached and both bounds can be trusted.
+ */
+static bool mate_probe(struct mate_job *job, struct position *pos, int *depth,
+                       int *score, int *type, uint32_t *move)
+{
+    struct mate_entry *entry;
+    uint64_t          data;
+
+    if (job->table == NULL) {
+        return false;
+    }
+
+    entry = &job->table[pos->key&(job->size-1)];
+    data = entry->data;
+    if ((entry->key^data) != pos->key) {
+        return false;
+    }
+
+    *move = (uint32_t)(data&0xFFFFFFFFULL);
+    *score = (int16_t)((data >> 32)&0xFFFF);
+    *depth = (int)((data >> 48)&0xFF);
+    *type = (int)((data >> 56)&0x03);
+    if (*score > KNOWN_WIN) {
+        *score -= pos->height;
+    } else if (*score < -KNOWN_WIN) {
+        *score += pos->height;
+    }
+    return true;
+}
+
+static void mate_store(struct mate_job *job, struct position *pos, int depth,
+                       int score, int type, uint32_t move)
+{
+    struct mate_entry *entry;
+    uint64_t          data;
+
+    if (job->table == NULL) {
+        return;
+    }
+
+    if (score > KNOWN_WIN) {
+        score += pos->height;
+    } else if (score < -KNOWN_WIN) {
+        score -= pos->height;
+    }
+
+    entry = &job->table[pos->key&(job->size-1)];
+    data = (uint64_t)move|((uint64_t)(uint16_t)score << 32)|
+                                ((uint64_t)depth << 48)|((uint64_t)type << 56);
+    entry->key = pos->key^data;
+    entry->data = data;
+}
+
+/*
+ * Check if the search should be stopped, either because another worker
+ * has found a mate or because the search has been stopped. Time, node
+ * limits and input are only checked by the main worker.
+ */
+static bool should_stop(struct search_worker *worker, struct mate_job *job)
+{
+    struct engine *engine = worker->engine;
+
+    if (atomic_load_explicit(&job->found, memory_order_relaxed) ||
+        smp_should_stop(engine)) {
+        return true;
+    }
+
+    smp_publish_counters(worker, false);
+    if (worker->id != 0) {
+        return false;
+    }
+
+    if (engine_check_input(worker)) {
+        smp_stop_all(engine);
+        return true;
+    }
+    if (!CHECKUP(worker->nodes)) {
+        return false;
+    }
+    if ((((tc_get_flags(engine)&TC_NODE_LIMIT) != 0) &&
+         ((smp_nodes(engine)+worker->nodes-worker->published_nodes) >=
+                                                        engine->max_nodes)) ||
+        (((tc_get_flags(engine)&TC_TIME_LIMIT) != 0) &&
+         !tc_check_time(worker))) {
+        smp_stop_all(engine);
+        return true;
+    }
+    return false;
+}
+
+static bool has_legal_move(struct position *pos)
+{
+    struct movelist list;
+    int             k;
+
+    gen_check_evasions(pos, &list);
+    for (k=0;k<list.size;k++) {
+        if (pos_is_legal(pos, list.moves[k])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Order the moves so that the hash move comes first, followed by
+ * checks and then by other tactical moves.
+ */
+static void score_moves(struct position *pos, struct movelist *list,
+                        uint32_t hash_move, int *scores)
+{
+    uint32_t move;
+    int      k;
+
+    for (k=0;k<list->size;k++) {
+        move = list->moves[k];
+        if (move == hash_move) {
+            scores[k] = HASH_MOVE_SCORE;
+        } else if (pos_move_gives_check(pos, move)) {
+            scores[k] = CHECK_SCORE;
+        } else if (ISTACTICAL(move)) {
+            scores[k] = TACTICAL_SCORE;
+        } else {
+            scores[k] = 0;
+        }
+    }
+}
+
+static uint32_t select_move(struct movelist *list, int *scores, int idx)
+{
+    uint32_t move;
+    int      best;
+    int      score;
+    int      k;
+
+    best = idx;
+    for (k=idx+1;k<list->size;k++) {
+        if (scores[k] > scores[best]) {
+            best = k;
+        }
+    }
+
+    move = list->moves[best];
+    score = scores[best];
+    list->moves[best] = list->moves[idx];
+    scores[best] = scores[idx];
+    list->moves[idx] = move;
+    scores[idx] = score;
+
+    return move;
+}
+
+/*
+ * The score of a position is either a mate score or zero if no mate was
+ * found within the given depth. The side that is trying to mate is to
+ * move at even heights, and when it only has one move left only checking
+ * moves can mate so all other moves are skipped.
+ */
+static int mate_search(struct search_worker *worker, struct mate_job *job,
+                       int depth, int alpha, int beta)
+{
+    struct position *pos = &worker->pos;
+    struct movelist list;
+    struct tt_item  tt_item;
+    int             scores[MAX_MOVES];
+    int             score;
+    int             best_score;
+    int             tt_depth;
+    int             tt_score;
+    int             tt_type;
+    int             k;
+    uint32_t        move;
+    uint32_t        best_move;
+    uint32_t        hash_move;
+    bool            in_check;
+    bool            checks_only;
+    bool            found_move;
+    int             tt_flag;
+
+    assert(valid_position(pos));
+
+    worker->nodes++;
+    if (should_stop(worker, job)) {
+        return 0;
+    }
+
+    /*
+     * At the horizon the only thing that matters is if the
+     * side to move has been checkmated.
+     */
+    in_check = pos->checkers != 0ULL;
+    if (depth == 0) {
+        return (in_check && !has_legal_move(pos))?-CHECKMATE+pos->height:0;
+    }
+
+    /* Mate distance pruning */
+    alpha = MAX(alpha, -CHECKMATE+pos->height);
+    beta = MIN(beta, CHECKMATE-pos->height-1);
+    if (alpha >= beta) {
+        return alpha;
+    }
+
+    /* Check if the position has already been searched deep enough */
+    hash_move = NOMOVE;
+    if (mate_probe(job, pos, &tt_depth, &tt_score, &tt_type, &hash_move) &&
+        (tt_depth >= depth)) {
+        if ((tt_type == TT_EXACT) ||
+            ((tt_type == TT_BETA) && (tt_score >= beta)) ||
+            ((tt_type == TT_ALPHA) && (tt_score <= alpha))) {
+            return tt_score;
+        }
+    }
+    if ((hash_move == NOMOVE) && hash_tt_lookup(pos, &tt_item)) {
+        hash_move = tt_item.move;
+    }
+
+    /* Generate moves */
+    list.size = 0;
+    checks_only = ((pos->height%2) == 0) && (depth == 1);
+    if (in_check) {
+        gen_check_evasions(pos, &list);
+    } else if (checks_only) {
+        gen_capture_moves(pos, &list);
+        gen_promotion_moves(pos, &list, true);
+        gen_quiet_checks(pos, &list);
+    } else {
+        gen_moves(pos, &list);
+    }
+    score_moves(pos, &list, hash_move, scores);
+
+    /* Search all moves */
+    tt_flag = TT_ALPHA;
+    best_score = -INFINITE_SCORE;
+    best_move = NOMOVE;
+    found_move = false;
+    for (k=0;k<list.size;k++) {
+        move = select_move(&list, scores, k);
+        if (!pos_is_legal(pos, move)) {
+            continue;
+        }
+        found_move = true;
+        if (checks_only && !pos_move_gives_check(pos, move)) {
+            continue;
+        }
+
+        (void)pos_make_move(pos, move);
+        score = -mate_search(worker, job, depth-1, -beta, -alpha);
+        pos_unmake_move(pos);
+        if (should_stop(worker, job)) {
+            return 0;
+        }
+
+        if (score > best_score) {
+            best_score = score;
+            best_move = move;
+            if (score > alpha) {
+                if (score >= beta) {
+                    tt_flag = TT_BETA;
+                    break;
+                }
+                alpha = score;
+                tt_flag = TT_EXACT;
+            }
+        }
+    }
+
+    /*
+     * If no move was searched then the side to move is either
+     * checkmated or it doesn't have any checking moves left.
+     */
+    if (best_move == NOMOVE) {
+        return (in_check && !found_move)?-CHECKMATE+pos->height:0;
+    }
+
+    mate_store(job, pos, depth, best_score, tt_flag, best_move);
+
+    return best_score;
+}
+
+static void mate_job_func(int idx, void *data)
+{
+    struct mate_job      *job = data;
+    struct search_worker *worker;
+    struct position      *pos;
+    int                  alpha;
+    int                  score;
+    int                  expected;
+    int                  k;
+
+    worker = smp_get_worker(job->engine, idx);
+    worker->depth = job->depth;
+    pos = &worker->pos;
+
+    /*
+     * Only mates of exactly the current depth are of interest since
+     * shorter mates have been ruled out by earlier iterations. This
+     * means that all root moves can be searched with a null window.
+     */
+    alpha = CHECKMATE - job->depth - 1;
+
+    /* Grab root moves until a mate is found or all have been searched */
+    while (!atomic_load(&job->found) && !smp_should_stop(job->engine)) {
+        k = atomic_fetch_add(&job->next, 1);
+        if (k >= job->moves.size) {
+            break;
+        }
+        (void)pos_make_move(pos, job->moves.moves[k]);
+        score = -mate_search(worker, job, job->depth-1, -alpha-1, -alpha);
+        pos_unmake_move(pos);
+        if (!should_stop(worker, job) && (score > alpha)) {
+            expected = -1;
+            if (atomic_compare_exchange_strong(&job->mate_idx, &expected, k)) {
+                atomic_store(&job->found, true);
+            }
+        }
+    }
+
+    smp_publish_counters(worker, true);
+}
+
+/*
+ * The line is built by following the moves stored in the mate
+ * table. The result is usually the full mating line but it may be
+ * cut short if entries have been overwritten.
+ */
+static void extract_line(struct mate_job *job, struct position *pos,
+                         uint32_t first, struct pvline *line)
+{
+    uint32_t move;
+    int      depth;
+    int      score;
+    int      type;
+    int      k;
+
+    line->size = 0;
+    move = first;
+    while (line->size < job->depth) {
+        if (!pos_is_move_pseudo_legal(pos, move) ||
+            !pos_is_legal(pos, move)) {
+            break;
+        }
+        (void)pos_make_move(pos, move);
+        line->moves[line->size++] = move;
+        if (!mate_probe(job, pos, &depth, &score, &type, &move)) {
+            break;
+        }
+    }
+    for (k=0;k<line->size;k++) {
+        pos_unmake_move(pos);
+    }
+}
+
+static void sort_root_moves(struct position *pos, struct movelist *list)
+{
+    int scores[MAX_MOVES];
+    int k;
+
+    score_moves(pos, list, NOMOVE, scores);
+    for (k=0;k<list->size;k++) {
+        (void)select_move(list, scores, k);
+    }
+}
+
+uint32_t mate_search_position(struct engine *engine, int nmoves, int *score)
+{
+    struct mate_job      job;
+    struct pvinfo        pvinfo;
+    struct tt_item       tt_item;
+    struct search_worker *worker;
+    uint64_t             size;
+    uint32_t             best_move;
+    int                  n;
+    int                  k;
+
+    assert(engine != NULL);
+    assert(valid_position(&engine->pos));
+    assert(nmoves > 0);
+
+    if (score != NULL) {
+        *score = 0;
+    }
+
+    /* Prepare for search */
+    tc_allocate_time(engine);
+    engine->root_in_tb = false;
+    engine->pondering = false;
+    engine->pos.height = 0;
+    tc_new_search(engine);
+    gen_legal_moves(&engine->pos, &job.moves);
+    if (job.moves.size == 0) {
+        return NOMOVE;
+    }
+    sort_root_moves(&engine->pos, &job.moves);
+    smp_prepare_workers(engine);
+
+    /* Allocate the mate table, the number of entries must be a power of 2 */
+    size = ((uint64_t)MATE_TABLE_SIZE*1024ULL*1024ULL)/
+                                                    sizeof(struct mate_entry);
+    job.size = 1ULL;
+    while ((job.size*2) <= size) {
+        job.size *= 2;
+    }
+    job.table = aligned_malloc(64, job.size*sizeof(struct mate_entry));
+    if (job.table != NULL) {
+        smp_parallel_memset(engine, job.table, 0,
+                            job.size*sizeof(struct mate_entry));
+    } else {
+        job.size = 0ULL;
+    }
+    job.engine = engine;
+
+    /*
+     * Deepen the search one move at a time until a mate is found. The
+     * number of plies has to stay below the maximum search depth for
+     * mate scores to be recognized.
+     */
+    best_move = NOMOVE;
+    for (n=1;(n<=nmoves)&&((2*n-1)<MAX_SEARCH_DEPTH);n++) {
+        job.depth = 2*n - 1;
+        atomic_init(&job.next, 0);
+        atomic_init(&job.mate_idx, -1);
+        atomic_init(&job.found, false);
+
+        smp_run_job(engine, mate_job_func, &job);
+
+        k = atomic_load(&job.mate_idx);
+        if (k >= 0) {
+            best_move = job.moves.moves[k];
+            worker = smp_get_worker(engine, 0);
+            pvinfo.depth = job.depth;
+            pvinfo.seldepth = job.depth;
+            pvinfo.score = CHECKMATE - job.depth;
+            extract_line(&job, &worker->pos, best_move, &pvinfo.pv);
+            engine_send_pv_info(engine, &pvinfo);
+            engine->best_line = pvinfo;
+            if (score != NULL) {
+                *score = pvinfo.score;
+            }
+            break;
+        }
+        if (smp_should_stop(engine)) {
+            break;
+        }
+        engine_send_depth_info(engine, job.depth);
+    }
+
+    /*
+     * If no mate was found then fall back to the move from the main
+     * transposition table, or to any legal move.
+     */
+    if (best_move == NOMOVE) {
+        best_move = job.moves.moves[0];
+        if (hash_tt_lookup(&smp_get_worker(engine, 0)->pos, &tt_item)) {
+            for (k=0;k<job.moves.size;k++) {
+                if (job.moves.moves[k] == tt_item.move) {
+                    best_move = tt_item.move;
+                    break;
+                }
+            }
+        }
+    }
+
+    aligned_free(job.table);
+    smp_reset_workers(engine);
+
+    return best_move;
+}
@@ -0,0 +1,50 @@
+/*
+ * Marvin - an UCI/XBoard compatible chess engine
+ * Copyright (C) 2023 Martin Danielsson
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef MATE_H
+#define MATE_H
+
+#include <stdint.h>
+
+#include "types.h"
+
+/* The amount of memory used for the table of proven and disproven mates */
+#define MATE_TABLE_SIZE 64
+
+/*
+ * Search for a forced mate for the side to move in the current
+ * position of the engine. Unlike the normal search the mate search
+ * never evaluates positions and never prunes moves, so a mate that
+ * exists within the given number of moves is always found unless the
+ * search is stopped. The search deepens one move at a time, which
+ * means that the first mate found is also the shortest one. The root
+ * moves are split between all workers of the engine.
+ *
+ * The time control of the engine must have been configured before
+ * the search is started.
+ *
+ * @param engine The engine.
+ * @param nmoves The maximum number of moves to find a mate in.
+ * @param score Location to store the score at. Set to zero if no mate
+ *              was found. May be NULL.
+ * @return Returns the first move of the mate. If no mate was found a
+ *         legal move is returned instead, or NOMOVE if there are no
+ *         legal moves.
+ */
+uint32_t mate_search_position(struct engine *engine, int nmoves, int *score);
+
+#endif
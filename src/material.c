@@ -0,0 +1,486 @@
+/*
+ * Marvin - an UCI/XBoard compatible chess engine
+ * Copyright (C) 2023 Martin Danielsson
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "material.h"
+#include "bitboard.h"
+#include "data.h"
+#include "hash.h"
+#include "validation.h"
+
+/*
+ * The number of positions in the KPK bitbase. The bitbase is indexed by
+ * the side to move, the squares of the two kings and the square of the
+ * pawn. The pawn is always assumed to be on file A-D and rank 2-7.
+ */
+#define KPK_SIZE (NSIDES*24*NSQUARES*NSQUARES)
+
+/* Results used while generating the KPK bitbase */
+#define KPK_INVALID 0
+#define KPK_UNKNOWN 1
+#define KPK_DRAW    2
+#define KPK_WIN     4
+
+/* Base score for endgames that are known to be won */
+#define WINNING_SCORE 1000
+
+/* Mirror a square in the vertical axis, for instance H1 becomes A1 */
+#define MIRROR_FILE(sq) ((sq)^7)
+
+/* Bitbase with one bit per KPK position. The bit is set for won positions */
+static uint32_t kpk_bitbase[KPK_SIZE/32];
+
+/* Phase values for different piece types */
+#define PAWN_PHASE      0
+#define KNIGHT_PHASE    1
+#define BISHOP_PHASE    1
+#define ROOK_PHASE      2
+#define QUEEN_PHASE     4
+
+/* The contribution of each piece to the game phase */
+static int material_phase_value[NPIECES] = {
+    PAWN_PHASE, PAWN_PHASE,
+    KNIGHT_PHASE, KNIGHT_PHASE,
+    BISHOP_PHASE, BISHOP_PHASE,
+    ROOK_PHASE, ROOK_PHASE,
+    QUEEN_PHASE, QUEEN_PHASE,
+    0, 0
+};
+
+/*
+ * The number of moves it takes for a king to move
+ * from one square to another.
+ */
+static int distance(int from, int to)
+{
+    int file_delta;
+    int rank_delta;
+
+    file_delta = abs(FILENR(to) - FILENR(from));
+    rank_delta = abs(RANKNR(to) - RANKNR(from));
+
+    return (file_delta > rank_delta)?file_delta:rank_delta;
+}
+
+static int kpk_index(int stm, int wksq, int bksq, int psq)
+{
+    assert(FILENR(psq) <= FILE_D);
+    assert((RANKNR(psq) >= RANK_2) && (RANKNR(psq) <= RANK_7));
+
+    return wksq|(bksq << 6)|(stm << 12)|(FILENR(psq) << 13)|
+                                                ((RANK_7-RANKNR(psq)) << 15);
+}
+
+static void kpk_decode(int idx, int *stm, int *wksq, int *bksq, int *psq)
+{
+    *wksq = idx&0x3F;
+    *bksq = (idx >> 6)&0x3F;
+    *stm = (idx >> 12)&0x01;
+    *psq = SQUARE((idx >> 13)&0x03, RANK_7-((idx >> 15)&0x07));
+}
+
+/*
+ * Calculate the result for positions that can be decided without looking
+ * at the successors. That is, illegal positions, positions where the pawn
+ * can promote safely and positions where black can capture the pawn or
+ * is stalemated.
+ */
+static uint8_t kpk_initial_result(int stm, int wksq, int bksq, int psq)
+{
+    uint64_t wkmoves;
+    uint64_t bkmoves;
+    uint64_t pattacks;
+    int      promo_sq;
+
+    wkmoves = bb_king_moves(wksq);
+    bkmoves = bb_king_moves(bksq);
+    pattacks = bb_pawn_attacks_from(psq, WHITE);
+    promo_sq = psq + 8;
+
+    if ((distance(wksq, bksq) <= 1) || (wksq == psq) || (bksq == psq) ||
+        ((stm == WHITE) && ISBITSET(pattacks, bksq))) {
+        return KPK_INVALID;
+    }
+
+    if ((stm == WHITE) && (RANKNR(psq) == RANK_7) && (wksq != promo_sq) &&
+        ((distance(bksq, promo_sq) > 1) || ISBITSET(wkmoves, promo_sq))) {
+        return KPK_WIN;
+    }
+
+    if ((stm == BLACK) &&
+        (((bkmoves&(~(wkmoves|pattacks))) == 0ULL) ||
+         ((bkmoves&sq_mask[psq]&(~wkmoves)) != 0ULL))) {
+        return KPK_DRAW;
+    }
+
+    return KPK_UNKNOWN;
+}
+
+/*
+ * Classify a position based on the results of all its successors. A
+ * position is a win for white if at least one white move leads to a win
+ * and a draw for black if at least one black move leads to a draw.
+ */
+static uint8_t kpk_classify(uint8_t *db, int idx)
+{
+    uint64_t moves;
+    uint8_t  result;
+    uint8_t  good;
+    uint8_t  bad;
+    int      stm;
+    int      wksq;
+    int      bksq;
+    int      psq;
+    int      sq;
+
+    kpk_decode(idx, &stm, &wksq, &bksq, &psq);
+    good = (stm == WHITE)?KPK_WIN:KPK_DRAW;
+    bad = (stm == WHITE)?KPK_DRAW:KPK_WIN;
+
+    result = KPK_INVALID;
+    moves = bb_king_moves((stm == WHITE)?wksq:bksq);
+    while (moves != 0ULL) {
+        sq = POPBIT(&moves);
+        result |= (stm == WHITE)?db[kpk_index(BLACK, sq, bksq, psq)]:
+                                 db[kpk_index(WHITE, wksq, sq, psq)];
+    }
+
+    if (stm == WHITE) {
+        if (RANKNR(psq) < RANK_7) {
+            result |= db[kpk_index(BLACK, wksq, bksq, psq+8)];
+        }
+        if ((RANKNR(psq) == RANK_2) && (wksq != (psq+8)) &&
+            (bksq != (psq+8))) {
+            result |= db[kpk_index(BLACK, wksq, bksq, psq+16)];
+        }
+    }
+
+    if ((result&good) != 0) {
+        return good;
+    }
+    return ((result&KPK_UNKNOWN) != 0)?KPK_UNKNOWN:bad;
+}
+
+/*
+ * Check if a KPK position is won for the side with the pawn. The position
+ * must be normalized so that white has the pawn and the pawn is on
+ * file A-D.
+ */
+static bool kpk_probe(int stm, int wksq, int bksq, int psq)
+{
+    int idx;
+
+    idx = kpk_index(stm, wksq, bksq, psq);
+
+    return (kpk_bitbase[idx/32]&(1U << (idx%32))) != 0;
+}
+
+static void calculate_material_info(struct position *pos,
+                                    struct material_item *item)
+{
+    int count[NPIECES];
+    int npm[NSIDES];
+    int piece;
+    int side;
+    int opp;
+
+    item->matkey = pos->matkey;
+    item->phase = 0;
+    for (piece=0;piece<NPIECES;piece++) {
+        count[piece] = BITCOUNT(pos->bb_pieces[piece]);
+        item->phase += count[piece]*material_phase_value[piece];
+    }
+
+    /* Non-pawn material for both sides */
+    npm[WHITE] = 0;
+    npm[BLACK] = 0;
+    for (piece=KNIGHT;piece<KING;piece++) {
+        npm[COLOR(piece)] += count[piece]*material_values[piece];
+    }
+
+    /* Check if any of the sides has enough material to deliver mate */
+    if ((count[WHITE_PAWN] > 0) || (count[BLACK_PAWN] > 0) ||
+        (count[WHITE_ROOK] > 0) || (count[BLACK_ROOK] > 0) ||
+        (count[WHITE_QUEEN] > 0) || (count[BLACK_QUEEN] > 0)) {
+        item->mating = MATING_POSSIBLE;
+    } else if ((npm[WHITE] == 0) && (npm[BLACK] == 0)) {
+        item->mating = MATING_IMPOSSIBLE;
+    } else if ((npm[WHITE] == 0) || (npm[BLACK] == 0)) {
+        side = (npm[WHITE] > 0)?WHITE:BLACK;
+        if ((count[KNIGHT+side] == 1) && (count[BISHOP+side] == 0)) {
+            item->mating = MATING_IMPOSSIBLE;
+        } else if (count[KNIGHT+side] == 0) {
+            item->mating = MATING_BISHOP_COLORS;
+        } else {
+            item->mating = MATING_POSSIBLE;
+        }
+    } else {
+        item->mating = MATING_POSSIBLE;
+    }
+
+    /*
+     * Without pawns a side usually needs to be more than a minor piece
+     * ahead in order to win so scale down the endgame score in such cases.
+     */
+    for (side=0;side<NSIDES;side++) {
+        opp = FLIP_COLOR(side);
+        item->scale[side] = MATERIAL_SCALE_NORMAL;
+        if ((count[PAWN+side] == 0) &&
+            ((npm[side]-npm[opp]) <= material_values[BISHOP+side])) {
+            if (npm[side] < material_values[ROOK+side]) {
+                item->scale[side] = 0;
+            } else if (npm[opp] <= material_values[BISHOP+opp]) {
+                item->scale[side] = 4;
+            } else {
+                item->scale[side] = 14;
+            }
+        }
+    }
+
+    /* Check for endgames that have a specialized evaluator */
+    item->endgame = ENDGAME_NONE;
+    item->strong_side = WHITE;
+    for (side=0;side<NSIDES;side++) {
+        opp = FLIP_COLOR(side);
+        if ((npm[side] == 0) && (count[PAWN+side] == 1) &&
+            (npm[opp] == 0) && (count[PAWN+opp] == 0)) {
+            item->endgame = ENDGAME_KPK;
+            item->strong_side = side;
+        } else if ((count[PAWN+side] == 0) && (count[KNIGHT+side] == 1) &&
+                   (count[BISHOP+side] == 1) && (count[ROOK+side] == 0) &&
+                   (count[QUEEN+side] == 0) && (npm[opp] == 0) &&
+                   (count[PAWN+opp] == 0)) {
+            item->endgame = ENDGAME_KBNK;
+            item->strong_side = side;
+        } else if ((count[PAWN+side] == 0) && (count[ROOK+side] == 1) &&
+                   (npm[side] == material_values[ROOK+side]) &&
+                   (npm[opp] == 0) && (count[PAWN+opp] == 1)) {
+            item->endgame = ENDGAME_KRKP;
+            item->strong_side = side;
+        }
+    }
+}
+
+/*
+ * King and pawn versus king. The result is taken from the KPK bitbase
+ * and drawn positions are evaluated as exact draws.
+ */
+static int evaluate_kpk(struct position *pos, int strong)
+{
+    int stm;
+    int wksq;
+    int bksq;
+    int psq;
+
+    stm = (pos->stm == strong)?WHITE:BLACK;
+    wksq = LSB(pos->bb_pieces[KING+strong]);
+    bksq = LSB(pos->bb_pieces[KING+FLIP_COLOR(strong)]);
+    psq = LSB(pos->bb_pieces[PAWN+strong]);
+
+    /* Normalize the position so that white has the pawn on file A-D */
+    if (strong == BLACK) {
+        wksq = MIRROR(wksq);
+        bksq = MIRROR(bksq);
+        psq = MIRROR(psq);
+    }
+    if (FILENR(psq) > FILE_D) {
+        wksq = MIRROR_FILE(wksq);
+        bksq = MIRROR_FILE(bksq);
+        psq = MIRROR_FILE(psq);
+    }
+
+    if (!kpk_probe(stm, wksq, bksq, psq)) {
+        return 0;
+    }
+    return WINNING_SCORE + material_values[WHITE_PAWN] + 10*RANKNR(psq);
+}
+
+/*
+ * King, bishop and knight versus king. The defending king is driven
+ * towards a corner of the same color as the bishop since mate can only
+ * be delivered in those corners.
+ */
+static int evaluate_kbnk(struct position *pos, int strong)
+{
+    int sksq;
+    int wksq;
+    int bsq;
+    int corner_dist;
+    int dist;
+
+    sksq = LSB(pos->bb_pieces[KING+strong]);
+    wksq = LSB(pos->bb_pieces[KING+FLIP_COLOR(strong)]);
+    bsq = LSB(pos->bb_pieces[BISHOP+strong]);
+
+    if (sq_color[bsq] == sq_color[A1]) {
+        corner_dist = distance(wksq, A1);
+        dist = distance(wksq, H8);
+    } else {
+        corner_dist = distance(wksq, A8);
+        dist = distance(wksq, H1);
+    }
+    if (dist < corner_dist) {
+        corner_dist = dist;
+    }
+
+    return WINNING_SCORE + 50*(7-corner_dist) + 10*(7-distance(sksq, wksq));
+}
+
+/*
+ * King and rook versus king and pawn. The evaluation is based on
+ * the rules used by Stockfish.
+ */
+static int evaluate_krkp(struct position *pos, int strong)
+{
+    int sksq;
+    int wksq;
+    int rsq;
+    int psq;
+    int queening_sq;
+    int tempo_strong;
+    int tempo_weak;
+
+    sksq = LSB(pos->bb_pieces[KING+strong]);
+    wksq = LSB(pos->bb_pieces[KING+FLIP_COLOR(strong)]);
+    rsq = LSB(pos->bb_pieces[ROOK+strong]);
+    psq = LSB(pos->bb_pieces[PAWN+FLIP_COLOR(strong)]);
+    tempo_strong = (pos->stm == strong)?1:0;
+    tempo_weak = 1 - tempo_strong;
+
+    /* Normalize the position so that the pawn moves towards rank 1 */
+    if (strong == BLACK) {
+        sksq = MIRROR(sksq);
+        wksq = MIRROR(wksq);
+        rsq = MIRROR(rsq);
+        psq = MIRROR(psq);
+    }
+    queening_sq = SQUARE(FILENR(psq), RANK_1);
+
+    /* The stronger king is in front of the pawn */
+    if (ISBITSET(front_span[WHITE][sksq], psq)) {
+        return material_values[WHITE_ROOK] - distance(sksq, psq);
+    }
+
+    /* The weaker king is too far away from the pawn and the rook */
+    if ((distance(wksq, psq) >= (3+tempo_weak)) && (distance(wksq, rsq) >= 3)) {
+        return material_values[WHITE_ROOK] - distance(sksq, psq);
+    }
+
+    /* The pawn is advanced and supported by the weaker king */
+    if ((RANKNR(wksq) <= RANK_3) && (distance(wksq, psq) == 1) &&
+        (RANKNR(sksq) >= RANK_4) &&
+        (distance(sksq, psq) > (2+tempo_strong))) {
+        return 40 - 4*distance(sksq, psq);
+    }
+
+    return 100 - 4*(distance(sksq, psq-8) - distance(wksq, psq-8) -
+                    distance(psq, queening_sq));
+}
+
+void material_init(void)
+{
+    uint8_t *db;
+    uint8_t result;
+    bool    changed;
+    int     stm;
+    int     wksq;
+    int     bksq;
+    int     psq;
+    int     idx;
+
+    db = malloc(KPK_SIZE);
+    assert(db != NULL);
+
+    /* Find all positions that can be decided directly */
+    for (idx=0;idx<KPK_SIZE;idx++) {
+        kpk_decode(idx, &stm, &wksq, &bksq, &psq);
+        db[idx] = kpk_initial_result(stm, wksq, bksq, psq);
+    }
+
+    /* Iterate until no more positions can be resolved */
+    do {
+        changed = false;
+        for (idx=0;idx<KPK_SIZE;idx++) {
+            if (db[idx] != KPK_UNKNOWN) {
+                continue;
+            }
+            result = kpk_classify(db, idx);
+            if (result != KPK_UNKNOWN) {
+                db[idx] = result;
+                changed = true;
+            }
+        }
+    } while (changed);
+
+    /* Positions that could not be resolved are draws */
+    memset(kpk_bitbase, 0, sizeof(kpk_bitbase));
+    for (idx=0;idx<KPK_SIZE;idx++) {
+        if (db[idx] == KPK_WIN) {
+            kpk_bitbase[idx/32] |= (1U << (idx%32));
+        }
+    }
+
+    free(db);
+}
+
+void material_probe(struct position *pos, struct material_item *item)
+{
+    assert(valid_position(pos));
+    assert(item != NULL);
+
+    if ((pos->worker == NULL) ||
+        !hash_mattt_lookup(pos->worker, pos->matkey, item)) {
+        calculate_material_info(pos, item);
+        if (pos->worker != NULL) {
+            hash_mattt_store(pos->worker, item);
+        }
+    }
+}
+
+bool material_evaluate_endgame(struct position *pos,
+                               struct material_item *item, int *score)
+{
+    int strong;
+
+    assert(valid_position(pos));
+    assert(item != NULL);
+    assert(score != NULL);
+
+    strong = item->strong_side;
+    switch (item->endgame) {
+    case ENDGAME_KPK:
+        *score = evaluate_kpk(pos, strong);
+        break;
+    case ENDGAME_KBNK:
+        *score = evaluate_kbnk(pos, strong);
+        break;
+    case ENDGAME_KRKP:
+        *score = evaluate_krkp(pos, strong);
+        break;
+    case ENDGAME_NONE:
+    default:
+        return false;
+    }
+
+    /* Convert the score to the side to move point of view */
+    *score = (pos->stm == strong)?*score:-*score;
+
+    return true;
+}
@@ -0,0 +1,57 @@
+/*
+ * Marvin - an UCI/XBoard compatible chess engine
+ * Copyright (C) 2023 Martin Danielsson
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef MATERIAL_H
+#define MATERIAL_H
+
+#include <stdbool.h>
+
+#include "types.h"
+
+/* Scale factor used when the endgame score should not be scaled */
+#define MATERIAL_SCALE_NORMAL 64
+
+/*
+ * Initialize the material component. This includes generating the
+ * KPK bitbase so it must be called after the bitboard tables have
+ * been initialized.
+ */
+void material_init(void);
+
+/*
+ * Get information about the material configuration of a position. The
+ * information is taken from the material hash table if possible.
+ *
+ * @param pos The position.
+ * @param item Location to store the material information at.
+ */
+void material_probe(struct position *pos, struct material_item *item);
+
+/*
+ * Evaluate the position using a specialized endgame evaluator.
+ *
+ * @param pos The position.
+ * @param item The material information for the position.
+ * @param score Location to store the score at. The score is from
+ *              the side to move point of view.
+ * @return Returns true if a specialized evaluator was used, false
+ *         if the position should be evaluated normally.
+ */
+bool material_evaluate_endgame(struct position *pos,
+                               struct material_item *item, int *score);
+
+#endif
@@ -23,10 +23,37 @@
 #include "validation.h"
 #include "debug.h"
 #include "data.h"
+#include "utils.h"
 
 #define ADD_MOVE(l,f,t,p,fl) l->moves[l->size++] = MOVE((f), (t), (p), (fl))
 
-static void gen_en_passant_moves(struct position *pos, struct movelist *list)
+/*
+ * The generators take the side to move as a parameter and are always
+ * inlined. The public functions check the side to move once and call
+ * them with a constant side so that the compiler generates separate
+ * versions for white and black without any color dependent branches.
+ */
+
+/*
+ * Find the squares a pawn can be pushed to. Used instead of the generic
+ * bb_pawn_moves function since the side is known at compile time here.
+ */
+static ALWAYS_INLINE uint64_t pawn_pushes(uint64_t occ, int from, int side)
+{
+    uint64_t moves;
+
+    if (side == WHITE) {
+        moves = (sq_mask[from] << 8)&(~occ);
+        moves |= ((moves&rank_mask[RANK_3]) << 8)&(~occ);
+    } else {
+        moves = (sq_mask[from] >> 8)&(~occ);
+        moves |= ((moves&rank_mask[RANK_6]) >> 8)&(~occ);
+    }
+    return moves;
+}
+
+static ALWAYS_INLINE void gen_en_passant_moves(struct position *pos,
+                                              struct movelist *list, int side)
 {
     uint64_t pieces;
     int      pawn_pos;
@@ -40,7 +67,7 @@ static void gen_en_passant_moves(struct position *pos, struct movelist *list)
     }
 
     file = FILENR(pos->ep_sq);
-    offset = (pos->stm == WHITE)?-8:8;
+    offset = (side == WHITE)?-8:8;
     pieces = 0ULL;
 
     /* Find the square of the pawn that can be captured */
@@ -53,7 +80,7 @@ static void gen_en_passant_moves(struct position *pos, struct movelist *list)
     if (file != FILE_H) {
         SETBIT(pieces, pawn_pos+1);
     }
-    pieces &= pos->bb_pieces[PAWN+pos->stm];
+    pieces &= pos->bb_pieces[PAWN+side];
 
     /* Add en passant captures to move list */
     while (pieces != 0ULL) {
@@ -62,11 +89,12 @@ static void gen_en_passant_moves(struct position *pos, struct movelist *list)
     }
 }
 
-static void gen_kingside_castling_moves(struct position *pos,
-                                        struct movelist *list)
+static ALWAYS_INLINE void gen_kingside_castling_moves(struct position *pos,
+                                                      struct movelist *list,
+                                                      int side)
 {
-    int king_start = LSB(pos->bb_pieces[KING+pos->stm]);
-    int rook_start = (pos->stm == WHITE)?pos->castle_wk:pos->castle_bk;
+    int king_start = LSB(pos->bb_pieces[KING+side]);
+    int rook_start = (side == WHITE)?pos->castle_wk:pos->castle_bk;
 
     if (!pos_is_castling_allowed(pos, KINGSIDE_CASTLE)) {
         return;
@@ -75,11 +103,12 @@ static void gen_kingside_castling_moves(struct position *pos,
     ADD_MOVE(list, king_start, rook_start, NO_PIECE, KINGSIDE_CASTLE);
 }
 
-static void gen_queenside_castling_moves(struct position *pos,
-                                         struct movelist *list)
+static ALWAYS_INLINE void gen_queenside_castling_moves(struct position *pos,
+                                                       struct movelist *list,
+                                                       int side)
 {
-    int king_start = LSB(pos->bb_pieces[KING+pos->stm]);
-    int rook_start = (pos->stm == WHITE)?pos->castle_wq:pos->castle_bq;
+    int king_start = LSB(pos->bb_pieces[KING+side]);
+    int rook_start = (side == WHITE)?pos->castle_wq:pos->castle_bq;
 
     if (!pos_is_castling_allowed(pos, QUEENSIDE_CASTLE)) {
         return;
@@ -88,25 +117,25 @@ static void gen_queenside_castling_moves(struct position *pos,
     ADD_MOVE(list, king_start, rook_start, NO_PIECE, QUEENSIDE_CASTLE);
 }
 
-static void add_promotion_moves(struct position *pos, struct movelist *list,
-                                int from, uint64_t moves, int flags,
-                                bool underpromote)
+static ALWAYS_INLINE void add_promotion_moves(struct movelist *list, int from,
+                                              uint64_t moves, int flags,
+                                              bool underpromote, int side)
 {
     int to;
 
     while (moves != 0ULL) {
         to = POPBIT(&moves);
-        ADD_MOVE(list, from, to, QUEEN+pos->stm, flags);
+        ADD_MOVE(list, from, to, QUEEN+side, flags);
         if (underpromote) {
-            ADD_MOVE(list, from, to, ROOK+pos->stm, flags);
-            ADD_MOVE(list, from, to, BISHOP+pos->stm, flags);
-            ADD_MOVE(list, from, to, KNIGHT+pos->stm, flags);
+            ADD_MOVE(list, from, to, ROOK+side, flags);
+            ADD_MOVE(list, from, to, BISHOP+side, flags);
+            ADD_MOVE(list, from, to, KNIGHT+side, flags);
         }
     }
 }
 
-static void add_moves(struct movelist *list, int from, uint64_t moves,
-                      int flags)
+static ALWAYS_INLINE void add_moves(struct movelist *list, int from,
+                                    uint64_t moves, int flags)
 {
     int to;
 
@@ -116,114 +145,124 @@ static void add_moves(struct movelist *list, int from, uint64_t moves,
     }
 }
 
-static void gen_pawn_moves(struct position *pos, struct movelist *list,
-                           uint64_t mask)
+static ALWAYS_INLINE void gen_pawn_moves(struct position *pos,
+                                         struct movelist *list, uint64_t mask,
+                                         int side)
 {
     uint64_t pieces;
     int      sq;
 
-    pieces = pos->bb_pieces[PAWN+pos->stm];
-    pieces &= (~relative_rank_mask[pos->stm][RANK_7]);
+    pieces = pos->bb_pieces[PAWN+side];
+    pieces &= (~relative_rank_mask[side][RANK_7]);
     while (pieces != 0ULL) {
         sq = POPBIT(&pieces);
-        add_moves(list, sq, bb_pawn_moves(pos->bb_all, sq, pos->stm)&mask, 0);
+        add_moves(list, sq, pawn_pushes(pos->bb_all, sq, side)&mask, 0);
     }
 }
 
-static void gen_pawn_captures(struct position *pos, struct movelist *list,
-                              uint64_t mask)
+static ALWAYS_INLINE void gen_pawn_captures(struct position *pos,
+                                            struct movelist *list,
+                                            uint64_t mask, int side)
 {
     uint64_t pieces;
     int      sq;
 
-    pieces = pos->bb_pieces[PAWN+pos->stm];
-    pieces &= (~relative_rank_mask[pos->stm][RANK_7]);
+    pieces = pos->bb_pieces[PAWN+side];
+    pieces &= (~relative_rank_mask[side][RANK_7]);
     while (pieces != 0ULL) {
         sq = POPBIT(&pieces);
-        add_moves(list, sq, bb_pawn_attacks_from(sq, pos->stm)&mask, CAPTURE);
+        add_moves(list, sq, bb_pawn_attacks_from(sq, side)&mask, CAPTURE);
     }
 }
 
-static void gen_promotions(struct position *pos, struct movelist *list,
-                           bool underpromote, uint64_t mask)
+static ALWAYS_INLINE void gen_promotions(struct position *pos,
+                                         struct movelist *list,
+                                         bool underpromote, uint64_t mask,
+                                         int side)
 {
     uint64_t pieces;
     int      sq;
 
-    pieces = pos->bb_pieces[PAWN+pos->stm];
-    pieces &= relative_rank_mask[pos->stm][RANK_7];
+    pieces = pos->bb_pieces[PAWN+side];
+    pieces &= relative_rank_mask[side][RANK_7];
     while (pieces != 0ULL) {
         sq = POPBIT(&pieces);
-        add_promotion_moves(pos, list, sq,
-                            bb_pawn_moves(pos->bb_all, sq, pos->stm)&mask,
-                            PROMOTION, underpromote);
+        add_promotion_moves(list, sq,
+                            pawn_pushes(pos->bb_all, sq, side)&mask,
+                            PROMOTION, underpromote, side);
     }
 }
 
-static void gen_capture_promotions(struct position *pos, struct movelist *list,
-                                   bool underpromote, uint64_t mask)
+static ALWAYS_INLINE void gen_capture_promotions(struct position *pos,
+                                                 struct movelist *list,
+                                                 bool underpromote,
+                                                 uint64_t mask, int side)
 {
     uint64_t pieces;
     int      sq;
 
-    pieces = pos->bb_pieces[PAWN+pos->stm];
-    pieces &= relative_rank_mask[pos->stm][RANK_7];
+    pieces = pos->bb_pieces[PAWN+side];
+    pieces &= relative_rank_mask[side][RANK_7];
     while (pieces != 0ULL) {
         sq = POPBIT(&pieces);
-        add_promotion_moves(pos, list, sq,
-                            bb_pawn_attacks_from(sq, pos->stm)&mask,
-                            CAPTURE|PROMOTION, underpromote);
+        add_promotion_moves(list, sq,
+                            bb_pawn_attacks_from(sq, side)&mask,
+                            CAPTURE|PROMOTION, underpromote, side);
     }
 }
 
-static void gen_knight_moves(struct position *pos, struct movelist *list,
-                             uint64_t mask, int flags)
+static ALWAYS_INLINE void gen_knight_moves(struct position *pos,
+                                           struct movelist *list, uint64_t mask,
+                                           int flags, int side)
 {
     uint64_t pieces;
     int      sq;
 
-    pieces = pos->bb_pieces[KNIGHT+pos->stm];
+    pieces = pos->bb_pieces[KNIGHT+side];
     while (pieces != 0ULL) {
         sq = POPBIT(&pieces);
         add_moves(list, sq, bb_knight_moves(sq)&mask, flags);
     }
 }
 
-static void gen_diagonal_slider_moves(struct position *pos,
-                                      struct movelist *list, uint64_t mask,
-                                      int flags)
+static ALWAYS_INLINE void gen_diagonal_slider_moves(struct position *pos,
+                                                    struct movelist *list,
+                                                    uint64_t mask, int flags,
+                                                    int side)
 {
     uint64_t pieces;
     int      sq;
 
-    pieces = pos->bb_pieces[BISHOP+pos->stm]|pos->bb_pieces[QUEEN+pos->stm];
+    pieces = pos->bb_pieces[BISHOP+side]|pos->bb_pieces[QUEEN+side];
     while (pieces != 0ULL) {
         sq = POPBIT(&pieces);
         add_moves(list, sq, bb_bishop_moves(pos->bb_all, sq)&mask, flags);
     }
 }
 
-static void gen_straight_slider_moves(struct position *pos,
-                                      struct movelist *list, uint64_t mask,
-                                      int flags)
+static ALWAYS_INLINE void gen_straight_slider_moves(struct position *pos,
+                                                    struct movelist *list,
+                                                    uint64_t mask, int flags,
+                                                    int side)
 {
     uint64_t pieces;
     int      sq;
 
-    pieces = pos->bb_pieces[ROOK+pos->stm]|pos->bb_pieces[QUEEN+pos->stm];
+    pieces = pos->bb_pieces[ROOK+side]|pos->bb_pieces[QUEEN+side];
     while (pieces != 0ULL) {
         sq = POPBIT(&pieces);
         add_moves(list, sq, bb_rook_moves(pos->bb_all, sq)&mask, flags);
     }
 }
 
-static void gen_king_moves(struct position *pos, struct movelist *list,
-                           uint64_t mask, int flags)
+static ALWAYS_INLINE void gen_king_moves(struct position *pos,
+                                         struct movelist *list, uint64_t mask,
+                                         int flags, int side)
 {
     uint64_t pieces;
     int      sq;
 
-    pieces = pos->bb_pieces[KING+pos->stm];
+    pieces = pos->bb_pieces[KING+side];
     while (pieces != 0ULL) {
         sq = POPBIT(&pieces);
         add_moves(list, sq, bb_king_moves(sq)&mask, flags);
@@ -258,17 +297,15 @@ void gen_legal_moves(struct position *pos, struct movelist *list)
     assert(valid_position(pos));
     assert(list != NULL);
 
-    list->size = 0;
     count = 0;
     gen_moves(pos, &temp_list);
     for (k=0;k<temp_list.size;k++) {
         move = temp_list.moves[k];
-        if (pos_make_move(pos, move)) {
+        if (pos_is_legal(pos, move)) {
             list->moves[count++] = move;
-            list->size++;
-            pos_unmake_move(pos);
         }
     }
+    list->size = count;
 }
 
 void gen_check_evasions(struct position *pos, struct movelist *list)
@@ -282,7 +319,8 @@ void gen_check_evasions(struct position *pos, struct movelist *list)
     gen_tactical_check_evasions(pos, list);
 }
 
-void gen_quiet_check_evasions(struct position *pos, struct movelist *list)
+static ALWAYS_INLINE void quiet_check_evasions(struct position *pos,
+                                              struct movelist *list, int side)
 {
     int      kingsq;
     int      to;
@@ -297,17 +335,17 @@ void gen_quiet_check_evasions(struct position *pos, struct movelist *list)
     int      blocksq;
 
     /* Find the location of our king */
-    kingsq = LSB(pos->bb_pieces[KING+pos->stm]);
+    kingsq = LSB(pos->bb_pieces[KING+side]);
 
     /*
      * First try to move the king. Find all
      * moves to a safe square (excluding captures).
      */
-    occ = pos->bb_all&(~pos->bb_pieces[KING+pos->stm]);
+    occ = pos->bb_all&(~pos->bb_pieces[KING+side]);
     moves = bb_king_moves(kingsq)&(~pos->bb_all);
     while (moves != 0ULL) {
         to = POPBIT(&moves);
-        if (bb_attacks_to(pos, occ, to, FLIP_COLOR(pos->stm)) == 0ULL) {
+        if (bb_attacks_to(pos, occ, to, FLIP_COLOR(side)) == 0ULL) {
             ADD_MOVE(list, kingsq, to, NO_PIECE,
                      pos->pieces[to] != NO_PIECE?CAPTURE:0);
         }
@@ -318,7 +356,7 @@ void gen_quiet_check_evasions(struct position *pos, struct movelist *list)
      * more to try. But if there is only one attacker and
      * the attacker is a slider then also try to block it.
      */
-    attackers = bb_attacks_to(pos, pos->bb_all, kingsq, FLIP_COLOR(pos->stm));
+    attackers = bb_attacks_to(pos, pos->bb_all, kingsq, FLIP_COLOR(side));
     if (BITCOUNT(attackers) > 1) {
         return;
     }
@@ -352,9 +390,9 @@ void gen_quiet_check_evasions(struct position *pos, struct movelist *list)
         blocksq = POPBIT(&slide);
 
         /* Piece blockers */
-        blockers = bb_attacks_to(pos, occ, blocksq, pos->stm);
-        blockers &= (~pos->bb_pieces[KING+pos->stm]);
-        blockers &= (~pos->bb_pieces[PAWN+pos->stm]);
+        blockers = bb_attacks_to(pos, occ, blocksq, side);
+        blockers &= (~pos->bb_pieces[KING+side]);
+        blockers &= (~pos->bb_pieces[PAWN+side]);
         while (blockers != 0ULL) {
             from = POPBIT(&blockers);
             ADD_MOVE(list, from, blocksq, NO_PIECE, 0);
@@ -364,8 +402,8 @@ void gen_quiet_check_evasions(struct position *pos, struct movelist *list)
         if ((RANKNR(blocksq) == RANK_1) || (RANKNR(blocksq) == RANK_8)) {
             continue;
         }
-        blockers = bb_pawn_moves_to(occ, blocksq, pos->stm);
-        blockers &= pos->bb_pieces[PAWN+pos->stm];
+        blockers = bb_pawn_moves_to(occ, blocksq, side);
+        blockers &= pos->bb_pieces[PAWN+side];
         while (blockers != 0ULL) {
             from = POPBIT(&blockers);
             ADD_MOVE(list, from, blocksq, NO_PIECE, 0);
@@ -373,7 +411,21 @@ void gen_quiet_check_evasions(struct position *pos, struct movelist *list)
     }
 }
 
-void gen_tactical_check_evasions(struct position *pos, struct movelist *list)
+void gen_quiet_check_evasions(struct position *pos, struct movelist *list)
+{
+    assert(valid_position(pos));
+    assert(list != NULL);
+
+    if (pos->stm == WHITE) {
+        quiet_check_evasions(pos, list, WHITE);
+    } else {
+        quiet_check_evasions(pos, list, BLACK);
+    }
+}
+
+static ALWAYS_INLINE void tactical_check_evasions(struct position *pos,
+                                                 struct movelist *list,
+                                                 int side)
 {
     int      kingsq;
     int      to;
@@ -389,17 +441,17 @@ void gen_tactical_check_evasions(struct position *pos, struct movelist *list)
     bool     promotion;
 
     /* Find the location of our king */
-    kingsq = LSB(pos->bb_pieces[KING+pos->stm]);
+    kingsq = LSB(pos->bb_pieces[KING+side]);
 
     /*
      * First try to move the king. Find all
      * captures to a safe square.
      */
-    occ = pos->bb_all&(~pos->bb_pieces[KING+pos->stm]);
-    moves = bb_king_moves(kingsq)&(pos->bb_sides[FLIP_COLOR(pos->stm)]);
+    occ = pos->bb_all&(~pos->bb_pieces[KING+side]);
+    moves = bb_king_moves(kingsq)&(pos->bb_sides[FLIP_COLOR(side)]);
     while (moves != 0ULL) {
         to = POPBIT(&moves);
-        if (bb_attacks_to(pos, occ, to, FLIP_COLOR(pos->stm)) == 0ULL) {
+        if (bb_attacks_to(pos, occ, to, FLIP_COLOR(side)) == 0ULL) {
             ADD_MOVE(list, kingsq, to, NO_PIECE,
                      pos->pieces[to] != NO_PIECE?CAPTURE:0);
         }
@@ -410,7 +462,7 @@ void gen_tactical_check_evasions(struct position *pos, struct movelist *list)
      * more to try. But if there is only one attacker
      * then also try to capture the attacking piece.
      */
-    attackers = bb_attacks_to(pos, pos->bb_all, kingsq, FLIP_COLOR(pos->stm));
+    attackers = bb_attacks_to(pos, pos->bb_all, kingsq, FLIP_COLOR(side));
     if (BITCOUNT(attackers) > 1) {
         return;
     }
@@ -424,14 +476,14 @@ void gen_tactical_check_evasions(struct position *pos, struct movelist *list)
      */
     promotion =
         ((sq_mask[attacksq]&(rank_mask[RANK_1]|rank_mask[RANK_8])) != 0ULL);
-    moves = bb_attacks_to(pos, pos->bb_all, attacksq, pos->stm)&
-                                            (~pos->bb_pieces[KING+pos->stm]);
+    moves = bb_attacks_to(pos, pos->bb_all, attacksq, side)&
+                                            (~pos->bb_pieces[KING+side]);
     while (moves != 0ULL) {
         from = POPBIT(&moves);
         piece = pos->pieces[from];
         if ((VALUE(piece) == PAWN) && promotion) {
-            add_promotion_moves(pos, list, from, sq_mask[attacksq],
-                                CAPTURE|PROMOTION, true);
+            add_promotion_moves(list, from, sq_mask[attacksq],
+                                CAPTURE|PROMOTION, true, side);
         } else {
             ADD_MOVE(list, from, attacksq, NO_PIECE, CAPTURE);
         }
@@ -441,12 +493,12 @@ void gen_tactical_check_evasions(struct position *pos, struct movelist *list)
      * If the attacking piece is a pawn then also have to check
      * if it can be captured en-passant.
      */
-    if ((VALUE(attacker) == PAWN) && (pos->stm == WHITE) &&
+    if ((VALUE(attacker) == PAWN) && (side == WHITE) &&
         (attacksq == (pos->ep_sq-8))) {
-        gen_en_passant_moves(pos, list);
-    } else if ((VALUE(attacker) == PAWN) && (pos->stm == BLACK) &&
+        gen_en_passant_moves(pos, list, side);
+    } else if ((VALUE(attacker) == PAWN) && (side == BLACK) &&
                (attacksq == (pos->ep_sq+8))) {
-        gen_en_passant_moves(pos, list);
+        gen_en_passant_moves(pos, list, side);
     }
 
     /*
@@ -454,8 +506,8 @@ void gen_tactical_check_evasions(struct position *pos, struct movelist *list)
      * there are no more cases to consider.
      */
     if ((RANKNR(attacksq) != RANKNR(kingsq)) ||
-        ((pos->stm == WHITE) && (RANKNR(kingsq) != RANK_8)) ||
-        ((pos->stm == BLACK) && (RANKNR(kingsq) != RANK_1)) ||
+        ((side == WHITE) && (RANKNR(kingsq) != RANK_8)) ||
+        ((side == BLACK) && (RANKNR(kingsq) != RANK_1)) ||
         ((VALUE(attacker) != ROOK) && (VALUE(attacker) != QUEEN))) {
         return;
     }
@@ -468,7 +520,7 @@ void gen_tactical_check_evasions(struct position *pos, struct movelist *list)
     slide = bb_rook_moves(occ, attacksq)&bb_rook_moves(occ, kingsq);
     slide &= (~sq_mask[attacksq]);
     slide &= (~sq_mask[kingsq]);
-    if (pos->stm == WHITE) {
+    if (side == WHITE) {
         slide &= rank_mask[RANK_8];
         blockers = (slide >> 8)&pos->bb_pieces[WHITE_PAWN];
     } else {
@@ -477,56 +529,88 @@ void gen_tactical_check_evasions(struct position *pos, struct movelist *list)
     }
     while (blockers != 0ULL) {
         from = POPBIT(&blockers);
-        add_promotion_moves(pos, list, from,
-                            pos->stm==WHITE?sq_mask[from+8]:sq_mask[from-8],
-                            PROMOTION, true);
+        add_promotion_moves(list, from,
+                            side==WHITE?sq_mask[from+8]:sq_mask[from-8],
+                            PROMOTION, true, side);
     }
 }
 
-void gen_quiet_moves(struct position *pos, struct movelist *list)
+void gen_tactical_check_evasions(struct position *pos, struct movelist *list)
 {
-    uint64_t mask;
-
     assert(valid_position(pos));
     assert(list != NULL);
 
+    if (pos->stm == WHITE) {
+        tactical_check_evasions(pos, list, WHITE);
+    } else {
+        tactical_check_evasions(pos, list, BLACK);
+    }
+}
+
+static ALWAYS_INLINE void quiet_moves(struct position *pos,
+                                     struct movelist *list, int side)
+{
+    uint64_t mask;
+
     /* Setup masks for which moves to include */
     mask = ~pos->bb_all;
 
     /* Generate standard moves */
-    gen_knight_moves(pos, list, mask, 0);
-    gen_diagonal_slider_moves(pos, list, mask, 0);
-    gen_straight_slider_moves(pos, list, mask, 0);
-    gen_king_moves(pos, list, mask, 0);
-    gen_pawn_moves(pos, list, ~pos->bb_all);
+    gen_knight_moves(pos, list, mask, 0, side);
+    gen_diagonal_slider_moves(pos, list, mask, 0, side);
+    gen_straight_slider_moves(pos, list, mask, 0, side);
+    gen_king_moves(pos, list, mask, 0, side);
+    gen_pawn_moves(pos, list, ~pos->bb_all, side);
 
     /* Generate castling moves */
-    gen_kingside_castling_moves(pos, list);
-    gen_queenside_castling_moves(pos, list);
+    gen_kingside_castling_moves(pos, list, side);
+    gen_queenside_castling_moves(pos, list, side);
 }
 
-void gen_capture_moves(struct position *pos, struct movelist *list)
+void gen_quiet_moves(struct position *pos, struct movelist *list)
 {
-    uint64_t opp_mask;
-
     assert(valid_position(pos));
     assert(list != NULL);
 
+    if (pos->stm == WHITE) {
+        quiet_moves(pos, list, WHITE);
+    } else {
+        quiet_moves(pos, list, BLACK);
+    }
+}
+
+static ALWAYS_INLINE void capture_moves(struct position *pos,
+                                       struct movelist *list, int side)
+{
+    uint64_t opp_mask;
+
     /* Setup masks for which moves to include */
-    opp_mask = pos->bb_sides[FLIP_COLOR(pos->stm)];
+    opp_mask = pos->bb_sides[FLIP_COLOR(side)];
 
     /* Generate piece captures */
-    gen_knight_moves(pos, list, opp_mask, CAPTURE);
-    gen_diagonal_slider_moves(pos, list, opp_mask, CAPTURE);
-    gen_straight_slider_moves(pos, list, opp_mask, CAPTURE);
-    gen_king_moves(pos, list, opp_mask, CAPTURE);
+    gen_knight_moves(pos, list, opp_mask, CAPTURE, side);
+    gen_diagonal_slider_moves(pos, list, opp_mask, CAPTURE, side);
+    gen_straight_slider_moves(pos, list, opp_mask, CAPTURE, side);
+    gen_king_moves(pos, list, opp_mask, CAPTURE, side);
 
     /* Generate pawn captures */
-    gen_pawn_captures(pos, list, opp_mask);
-    gen_capture_promotions(pos, list, true, opp_mask);
+    gen_pawn_captures(pos, list, opp_mask, side);
+    gen_capture_promotions(pos, list, true, opp_mask, side);
 
     /* Generate en-passant captures */
-    gen_en_passant_moves(pos, list);
+    gen_en_passant_moves(pos, list, side);
+}
+
+void gen_capture_moves(struct position *pos, struct movelist *list)
+{
+    assert(valid_position(pos));
+    assert(list != NULL);
+
+    if (pos->stm == WHITE) {
+        capture_moves(pos, list, WHITE);
+    } else {
+        capture_moves(pos, list, BLACK);
+    }
 }
 
 void gen_promotion_moves(struct position *pos, struct movelist *list,
@@ -535,10 +619,15 @@ void gen_promotion_moves(struct position *pos, struct movelist *list,
     assert(valid_position(pos));
     assert(list != NULL);
 
-    gen_promotions(pos, list, underpromote, ~pos->bb_all);
+    if (pos->stm == WHITE) {
+        gen_promotions(pos, list, underpromote, ~pos->bb_all, WHITE);
+    } else {
+        gen_promotions(pos, list, underpromote, ~pos->bb_all, BLACK);
+    }
 }
 
-void gen_quiet_checks(struct position *pos, struct movelist *list)
+static ALWAYS_INLINE void quiet_checks(struct position *pos,
+                                      struct movelist *list, int side)
 {
     int      king_sq;
     int      from;
@@ -550,15 +639,12 @@ void gen_quiet_checks(struct position *pos, struct movelist *list)
     uint64_t blockers;
     uint64_t moves;
 
-    assert(valid_position(pos));
-    assert(list != NULL);
-   
     /* Find the opponents king */
-    king_sq = LSB(pos->bb_pieces[FLIP_COLOR(pos->stm)+KING]);
+    king_sq = LSB(pos->bb_pieces[FLIP_COLOR(side)+KING]);
 
     /* Keep track of pieces that potentially block or deliver checks */
     blockers = 0ULL;
-    attackers = pos->bb_sides[pos->stm];
+    attackers = pos->bb_sides[side];
 
     /*
      * Find all squares where pieces can reach the king. Occupied squares
@@ -566,12 +652,12 @@ void gen_quiet_checks(struct position *pos, struct movelist *list)
      * friendly pieces that can trigger discovered checks.
      */
     straight_attacks = bb_rook_moves(pos->bb_all, king_sq);
-    blockers |= straight_attacks&pos->bb_sides[pos->stm];
+    blockers |= straight_attacks&pos->bb_sides[side];
     straight_attacks &= (~pos->bb_all);
     diagonal_attacks = bb_bishop_moves(pos->bb_all, king_sq);
-    blockers |= diagonal_attacks&pos->bb_sides[pos->stm];
+    blockers |= diagonal_attacks&pos->bb_sides[side];
     diagonal_attacks &= (~pos->bb_all);
-    pawn_attacks = bb_pawn_attacks_to(king_sq, pos->stm)&(~pos->bb_all);
+    pawn_attacks = bb_pawn_attacks_to(king_sq, side)&(~pos->bb_all);
     knight_attacks = bb_knight_moves(king_sq)&(~pos->bb_all);
 
     /*
@@ -587,9 +673,9 @@ void gen_quiet_checks(struct position *pos, struct movelist *list)
          * if this blocker is removed.
          */
         moves = bb_bishop_moves(pos->bb_all&(~sq_mask[from]), king_sq) &
-            (pos->bb_pieces[pos->stm+BISHOP]|pos->bb_pieces[pos->stm+QUEEN]);
+            (pos->bb_pieces[side+BISHOP]|pos->bb_pieces[side+QUEEN]);
         moves |= (bb_rook_moves(pos->bb_all&(~sq_mask[from]), king_sq) &
-            (pos->bb_pieces[pos->stm+ROOK]|pos->bb_pieces[pos->stm+QUEEN]));
+            (pos->bb_pieces[side+ROOK]|pos->bb_pieces[side+QUEEN]));
 
         /*
          * If the king can be captured then generate all moves for
@@ -601,8 +687,8 @@ void gen_quiet_checks(struct position *pos, struct movelist *list)
         if (!ISEMPTY(moves)) {
             attackers &= (~sq_mask[from]);
             moves = bb_moves_for_piece(pos->bb_all, from, pos->pieces[from]);
-            if (pos->pieces[from] == (pos->stm+PAWN)) {
-                moves &= (~relative_rank_mask[pos->stm][RANK_8]);
+            if (pos->pieces[from] == (side+PAWN)) {
+                moves &= (~relative_rank_mask[side][RANK_8]);
             }
             moves &= (~pos->bb_all);
             moves &= (~range_mask[king_sq][from]);
@@ -618,7 +704,7 @@ void gen_quiet_checks(struct position *pos, struct movelist *list)
         from = POPBIT(&attackers);
         switch (VALUE(pos->pieces[from])) {
         case PAWN:
-            moves = bb_pawn_moves(pos->bb_all, from, pos->stm);
+            moves = pawn_pushes(pos->bb_all, from, side);
             moves &= pawn_attacks;
             add_moves(list, from, moves, 0);
             break;     
@@ -648,10 +734,22 @@ void gen_quiet_checks(struct position *pos, struct movelist *list)
     }
 
     /* Consider castling moves */
-    if (!ISEMPTY(straight_attacks&sq_mask[kingside_castle_to[pos->stm]-1])) {
-        gen_kingside_castling_moves(pos, list);
+    if (!ISEMPTY(straight_attacks&sq_mask[kingside_castle_to[side]-1])) {
+        gen_kingside_castling_moves(pos, list, side);
+    }
+    if (!ISEMPTY(straight_attacks&sq_mask[queenside_castle_to[side]+1])) {
+        gen_queenside_castling_moves(pos, list, side);
     }
-    if (!ISEMPTY(straight_attacks&sq_mask[queenside_castle_to[pos->stm]+1])) {
-        gen_queenside_castling_moves(pos, list);
+}
+
+void gen_quiet_checks(struct position *pos, struct movelist *list)
+{
+    assert(valid_position(pos));
+    assert(list != NULL);
+
+    if (pos->stm == WHITE) {
+        quiet_checks(pos, list, WHITE);
+    } else {
+        quiet_checks(pos, list, BLACK);
     }
 }
@@ -16,6 +16,7 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 #include <assert.h>
+#include <limits.h>
 
 #include "moveselect.h"
 #include "movegen.h"
@@ -32,6 +33,13 @@
  */
 #define RECAPTURE_ONLY_DEPTH -4
 
+/*
+ * Quiet moves with a history score above this margin times the depth
+ * are sorted when they are generated. The remaining moves are only
+ * picked if the search gets that far.
+ */
+#define QUIET_SORT_MARGIN -2000
+
 /*
  * Different move generation phases.
  */
@@ -106,18 +114,12 @@ static void add_moves(struct search_worker *worker, struct moveselector *ms,
         }
 
         /*
-         * If the SEE score is positive (normal moves or good captures) then
-         * the move is added to the moveinfo list. If the SEE score is
-         * negative (bad captures) then the move is added to the bad tacticals
-         * list.
+         * The SEE score of tactical moves is not calculated until the
+         * move is about to be searched since many moves are never
+         * tried because of cutoffs.
          */
-        if (ISTACTICAL(move) && !see_ge(pos, move, 0)) {
-            info = &ms->moveinfo[MAX_MOVES-1-ms->nbadtacticals];
-            ms->nbadtacticals++;
-        } else {
-            info = &ms->moveinfo[ms->last_idx];
-            ms->last_idx++;
-        }
+        info = &ms->moveinfo[ms->last_idx];
+        ms->last_idx++;
         info->move = move;
 
         /* Assign a score to the move */
@@ -129,6 +131,39 @@ static void add_moves(struct search_worker *worker, struct moveselector *ms,
     }
 }
 
+/*
+ * Move all moves with a score of at least threshold to the front of
+ * the list and sort them using insertion sort. The remaining moves
+ * are left for select_move to pick.
+ */
+static void sort_moves(struct moveselector *ms, int threshold)
+{
+    struct moveinfo temp;
+    int             sorted;
+    int             k;
+    int             l;
+
+    sorted = ms->idx;
+    for (k=ms->idx;k<ms->last_idx;k++) {
+        if (ms->moveinfo[k].score < threshold) {
+            continue;
+        }
+
+        /* Insert the move among the already sorted moves */
+        temp = ms->moveinfo[k];
+        ms->moveinfo[k] = ms->moveinfo[sorted];
+        for (l=sorted;l>ms->idx;l--) {
+            if (ms->moveinfo[l-1].score >= temp.score) {
+                break;
+            }
+            ms->moveinfo[l] = ms->moveinfo[l-1];
+        }
+        ms->moveinfo[l] = temp;
+        sorted++;
+    }
+    ms->sorted_idx = sorted;
+}
+
 static uint32_t select_move(struct moveselector *ms)
 {
     int             iter;
@@ -143,6 +178,11 @@ static uint32_t select_move(struct moveselector *ms)
         return NOMOVE;
     }
 
+    /* Moves in the sorted part of the list are already in order */
+    if (ms->idx < ms->sorted_idx) {
+        return ms->moveinfo[ms->idx].move;
+    }
+
     /* Try the moves in order of their score */
     start = ms->idx;
     iter = start + 1;
@@ -172,8 +212,10 @@ static bool get_move(struct moveselector *ms, struct search_worker *worker,
                      uint32_t *move)
 {
     struct movelist list;
+    struct moveinfo *info;
     uint32_t        killer;
     uint32_t        counter;
+    int             depth;
     struct position *pos = &worker->pos;
 
     do {
@@ -195,15 +237,27 @@ static bool get_move(struct moveselector *ms, struct search_worker *worker,
                 gen_promotion_moves(pos, &list, ms->underpromote);
             }
             add_moves(worker, ms, &list);
+            sort_moves(ms, INT_MIN);
             ms->phase++;
-            ms->idx = 0;
             /* Fall through */
         case PHASE_GOOD_TACTICAL:
-            if (ms->idx < ms->last_idx) {
-                break;
+            /*
+             * Tactical moves with a negative SEE score are postponed
+             * until all other moves have been tried.
+             */
+            while (ms->idx < ms->last_idx) {
+                info = &ms->moveinfo[ms->idx];
+                ms->idx++;
+                if (see_ge(pos, info->move, 0)) {
+                    *move = info->move;
+                    return true;
+                }
+                ms->moveinfo[MAX_MOVES-1-ms->nbadtacticals] = *info;
+                ms->nbadtacticals++;
             }
             if (ms->tactical_only && !ms->in_check && !ms->qchecks) {
-                break;
+                ms->phase = PHASE_DONE;
+                continue;
             }
             ms->phase++;
             /* Fall through */
@@ -211,7 +265,8 @@ static bool get_move(struct moveselector *ms, struct search_worker *worker,
             ms->phase++;
             killer = ms->killer;
             if ((killer != NOMOVE) && (killer != ms->ttmove) &&
-                pos_is_move_pseudo_legal(pos, killer)) {
+                pos_is_move_pseudo_legal(pos, killer) &&
+                pos_is_legal(pos, killer)) {
                 if ((!ms->qchecks || ms->in_check) ||
                     (ms->qchecks && !ms->in_check &&
                     pos_move_gives_check(pos, ms->killer))) {
@@ -225,7 +280,8 @@ static bool get_move(struct moveselector *ms, struct search_worker *worker,
             counter = ms->counter;
             if ((counter != NOMOVE) && (counter != ms->ttmove) &&
                 (counter != ms->killer) &&
-                pos_is_move_pseudo_legal(pos, counter)) {
+                pos_is_move_pseudo_legal(pos, counter) &&
+                pos_is_legal(pos, counter)) {
                 if ((!ms->qchecks || ms->in_check) ||
                     (ms->qchecks && !ms->in_check &&
                     pos_move_gives_check(pos, ms->counter))) {
@@ -239,14 +295,22 @@ static bool get_move(struct moveselector *ms, struct search_worker *worker,
             }
             /* Fall through */
         case PHASE_GEN_MOVES:
-            /* Generate all possible moves for this position */
+            /*
+             * Generate all possible moves for this position. All tactical
+             * moves have been handled at this point so the list can be
+             * reused.
+             */
             list.size = 0;
             if (ms->in_check) {
                 gen_quiet_check_evasions(pos, &list);
             } else {
                 gen_quiet_moves(pos, &list);
             }
+            ms->idx = 0;
+            ms->last_idx = 0;
             add_moves(worker, ms, &list);
+            depth = ms->depth > 0?ms->depth:0;
+            sort_moves(ms, QUIET_SORT_MARGIN*depth);
             ms->phase++;
             /* Fall through */
         case PHASE_MOVES:
@@ -256,20 +320,28 @@ static bool get_move(struct moveselector *ms, struct search_worker *worker,
             ms->phase++;
             /* Fall through */
         case PHASE_ADD_BAD_TACTICAL:
-            ms->last_idx = MAX_MOVES;
-            ms->idx = MAX_MOVES - ms->nbadtacticals;
+            ms->idx = 0;
             ms->phase++;
             /* Fall through */
         case PHASE_BAD_TACTICAL:
-            if (ms->idx < ms->last_idx) {
-                break;
+            /*
+             * The bad tactical moves were postponed in order
+             * so they don't have to be sorted again.
+             */
+            if (ms->idx < ms->nbadtacticals) {
+                *move = ms->moveinfo[MAX_MOVES-1-ms->idx].move;
+                ms->idx++;
+                return true;
             }
             ms->phase = PHASE_DONE;
             continue;
         case PHASE_GEN_QCHECKS:
             list.size = 0;
             gen_quiet_checks(pos, &list);
+            ms->idx = 0;
+            ms->last_idx = 0;
             add_moves(worker, ms, &list);
+            sort_moves(ms, INT_MIN);
             ms->phase++;
             /* Fall through */
         case PHASE_QCHECKS:
@@ -300,10 +372,14 @@ void select_init_node(struct moveselector *ms, struct search_worker *worker,
 {
     struct position *pos = &worker->pos;
 
+    assert(pos->height < MAX_PLY);
+
+    ms->moveinfo = worker->move_stack[pos->height];
     ms->phase = PHASE_TT;
     ms->tactical_only = tactical_only;
     ms->underpromote = !tactical_only;
-    if ((ttmove == NOMOVE) || !pos_is_move_pseudo_legal(pos, ttmove)) {
+    if ((ttmove == NOMOVE) || !pos_is_move_pseudo_legal(pos, ttmove) ||
+        !pos_is_legal(pos, ttmove)) {
         ms->ttmove = NOMOVE;
     } else if (tactical_only && !in_check && !ISTACTICAL(ttmove) &&
                (!qchecks || !pos_move_gives_check(pos, ttmove))) {
@@ -314,6 +390,7 @@ void select_init_node(struct moveselector *ms, struct search_worker *worker,
     ms->in_check = in_check;
     ms->idx = 0;
     ms->last_idx = 0;
+    ms->sorted_idx = 0;
     ms->nbadtacticals = 0;
     ms->killer = killer_get_move(worker);
     ms->counter = counter_get_move(worker);
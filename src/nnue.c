@@ -33,19 +33,68 @@
 #include "simd.h"
 #include "data.h"
 #include "hash.h"
+#include "numa.h"
 
 #define INCBIN_PREFIX
 #define INCBIN_STYLE INCBIN_STYLE_SNAKE
 #include "incbin.h"
 INCBIN(nnue_net, NETFILE_NAME);
 
-/* NNUE quantization parameters */
-#define OUTPUT_SCALE 16.0f
+/*
+ * Versions of the net format. Version 1 nets have a fixed architecture,
+ * 768->2x1024->1, and only a version field in the header. Later versions
+ * have a header that describes the architecture of the net.
+ */
+#define NET_VERSION_V1 0x0000000A
+#define NET_VERSION 0x0000000B
+#define NET_HEADER_V1_SIZE 4
+#define NET_HEADER_SIZE (9*4+NSQUARES)
+
+/* Output scale used by version 1 nets */
+#define NET_V1_OUTPUT_SCALE 16
+
+/* Limits for the architecture of a net */
+#define MAX_HIDDEN_SIZE 256
+#define MAX_OUTPUT_BUCKETS 8
+
+/*
+ * The sizes of hidden layers are padded to a multiple of this value so
+ * that all SIMD kernels can be used for them.
+ */
+#define LAYER_ALIGNMENT 64
+#define ALIGN_LAYER(s) (((s)+LAYER_ALIGNMENT-1)&~(LAYER_ALIGNMENT-1))
+
+/*
+ * Nets in the native format are stored exactly like they are laid out in
+ * memory, with each section aligned to 64 bytes. This allows the file to be
+ * mapped and used directly without any parsing.
+ */
+#define NATIVE_NET_MAGIC 0x4E4E564D
+#define NATIVE_HEADER_SIZE 64
+#define ALIGN_SECTION(s) (((s)+63)&~((uint64_t)63))
 
-/* Definition of the network architcechure */
-#define NET_VERSION 0x0000000A
-#define NET_HEADER_SIZE 4
-static int layer_sizes[NNUE_NUM_LAYERS] = {NNUE_INPUT_LAYER_SIZE*2, 1};
+/*
+ * Description of the architecture of a net. The first layer is the
+ * input layer, the last layer is the output layer and any layers in
+ * between are hidden layers. The input layer has 768 input features
+ * per king bucket and the output of the input layer is the accumulators
+ * for both perspectives. All layers after the input layer exist once
+ * for each output bucket.
+ */
+struct net_arch {
+    uint32_t version;
+    int      nlayers;
+    /* The sizes of all layers as stored in the net */
+    int      model_sizes[NNUE_MAX_LAYERS];
+    /* The sizes of all layers as used in memory, including padding */
+    int      sizes[NNUE_MAX_LAYERS];
+    int      nking_buckets;
+    uint8_t  king_buckets[NSQUARES];
+    int      noutput_buckets;
+    /* The number of bits to shift the output of hidden layers */
+    int      shift;
+    int      output_scale;
+};
 
 /* Struct holding information about a layer in the network */
 struct layer {
@@ -63,12 +112,208 @@ struct layer {
 struct net_data {
     alignas(64) int32_t intermediate[NNUE_INPUT_LAYER_SIZE*2];
     alignas(64) uint8_t output[NNUE_INPUT_LAYER_SIZE*2];
+    alignas(64) uint8_t hidden[NNUE_MAX_LAYERS-2][MAX_HIDDEN_SIZE];
+};
+
+/*
+ * The number of positions handled together by nnue_evaluate_batch and
+ * the number of accumulator values calculated in each pass over the
+ * batch.
+ */
+#define NNUE_BATCH_SIZE 64
+#define NNUE_BATCH_COLUMNS 256
+
+/* Struct for holding data during a batch evaluation */
+struct batch_data {
+    alignas(64) int16_t accumulators[NNUE_BATCH_SIZE*NSIDES]
+                                    [NNUE_INPUT_LAYER_SIZE];
+    uint16_t features[NNUE_BATCH_SIZE*NSIDES][NNUE_MAX_ACTIVE_FEATURES];
 };
 
+/* The architecture of the network */
+static struct net_arch arch;
+
 /* The network */
-static struct layer layers[NNUE_NUM_LAYERS];
+static struct layer layers[NNUE_MAX_LAYERS];
+
+/*
+ * Memory owned by the engine for holding a network. Nets in the native
+ * format are used directly from the mapped file instead.
+ */
+static struct layer allocated_layers[NNUE_MAX_LAYERS];
+
+/* The currently mapped native net, if any */
+static void *mapped_net = NULL;
+static uint64_t mapped_net_size = 0;
+
+/* Location of each section in a native net */
+struct native_layout {
+    uint64_t king_buckets;
+    uint64_t biases[NNUE_MAX_LAYERS];
+    uint64_t weights[NNUE_MAX_LAYERS];
+    uint64_t size;
+};
+
+/*
+ * Identifier of the currently loaded net. Used to detect
+ * that the refresh cache was calculated for a different net.
+ */
+static uint32_t net_id = 0;
+
+static void setup_v1_arch(struct net_arch *a)
+{
+    memset(a, 0, sizeof(struct net_arch));
+    a->version = NET_VERSION_V1;
+    a->nlayers = 2;
+    a->model_sizes[0] = NNUE_INPUT_LAYER_SIZE*2;
+    a->model_sizes[1] = 1;
+    a->nking_buckets = 1;
+    a->noutput_buckets = 1;
+    a->output_scale = NET_V1_OUTPUT_SCALE;
+}
+
+/*
+ * Check that an architecture is supported and calculate the sizes
+ * of all layers including padding.
+ */
+static bool setup_arch(struct net_arch *a)
+{
+    int half;
+    int sq;
+    int k;
+
+    if ((a->nlayers < 2) || (a->nlayers > NNUE_MAX_LAYERS)) {
+        return false;
+    }
+    half = a->model_sizes[0]/2;
+    if ((half <= 0) || (half > NNUE_INPUT_LAYER_SIZE) ||
+        ((half%NNUE_BATCH_COLUMNS) != 0)) {
+        return false;
+    }
+    if (a->model_sizes[a->nlayers-1] != 1) {
+        return false;
+    }
+    if ((a->nking_buckets < 1) || (a->nking_buckets > NNUE_MAX_KING_BUCKETS) ||
+        (a->noutput_buckets < 1) ||
+        (a->noutput_buckets > MAX_OUTPUT_BUCKETS)) {
+        return false;
+    }
+    for (sq=0;sq<NSQUARES;sq++) {
+        if (a->king_buckets[sq] >= a->nking_buckets) {
+            return false;
+        }
+    }
+    if ((a->shift < 0) || (a->shift > 31) || (a->output_scale <= 0)) {
+        return false;
+    }
+
+    a->sizes[0] = a->model_sizes[0];
+    for (k=1;k<a->nlayers-1;k++) {
+        if ((a->model_sizes[k] <= 0) ||
+            (a->model_sizes[k] > MAX_HIDDEN_SIZE)) {
+            return false;
+        }
+        a->sizes[k] = ALIGN_LAYER(a->model_sizes[k]);
+    }
+    a->sizes[a->nlayers-1] = 1;
+
+    return true;
+}
+
+/* The size in bytes of the biases of a layer */
+static uint64_t biases_size(struct net_arch *a, int idx)
+{
+    if (idx == 0) {
+        return (a->sizes[0]/2)*sizeof(int16_t);
+    }
+    return (uint64_t)a->sizes[idx]*a->noutput_buckets*sizeof(int32_t);
+}
+
+/* The size in bytes of the weights of a layer */
+static uint64_t weights_size(struct net_arch *a, int idx)
+{
+    if (idx == 0) {
+        return (uint64_t)(a->sizes[0]/2)*NNUE_NUM_INPUT_FEATURES*
+                                            a->nking_buckets*sizeof(int16_t);
+    }
+    return (uint64_t)a->sizes[idx]*a->sizes[idx-1]*a->noutput_buckets*
+                                                                sizeof(int8_t);
+}
+
+/*
+ * Layers with a number of outputs suitable for simd_fc_forward_sparse are
+ * evaluated by only processing the inputs that are non-zero. The weights
+ * for these layers are kept in the chunked layout used by the sparse kernel.
+ */
+static bool is_sparse_layer(struct net_arch *a, int idx)
+{
+    return ((a->sizes[idx]%SIMD_SPARSE_OUTPUT_BLOCK) == 0) &&
+           (a->sizes[idx-1] <= SIMD_MAX_SPARSE_INPUTS);
+}
+
+static int weight_index(struct net_arch *a, int idx, int output, int input)
+{
+    if (is_sparse_layer(a, idx)) {
+        return ((input/4)*a->sizes[idx]+output)*4 + input%4;
+    }
+    return output*a->sizes[idx-1] + input;
+}
+
+static bool allocate_layers(struct net_arch *a, struct layer *l)
+{
+    int k;
+
+    memset(l, 0, NNUE_MAX_LAYERS*sizeof(struct layer));
+    for (k=0;k<a->nlayers;k++) {
+        l[k].weights.i8 = aligned_malloc(64, weights_size(a, k));
+        l[k].biases.i32 = aligned_malloc(64, biases_size(a, k));
+        if ((l[k].weights.i8 == NULL) || (l[k].biases.i32 == NULL)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static void free_layers(struct layer *l)
+{
+    int k;
+
+    for (k=0;k<NNUE_MAX_LAYERS;k++) {
+        aligned_free(l[k].weights.i8);
+        aligned_free(l[k].biases.i32);
+    }
+    memset(l, 0, NNUE_MAX_LAYERS*sizeof(struct layer));
+}
+
+/*
+ * Find the king bucket to use for a perspective. The bucket layout is
+ * defined from white's point of view so the king square is mirrored
+ * for black.
+ */
+static int king_bucket(int ksq, int side)
+{
+    return arch.king_buckets[(side == BLACK)?MIRROR(ksq):ksq];
+}
+
+static int position_king_bucket(struct position *pos, int side)
+{
+    if (arch.nking_buckets == 1) {
+        return 0;
+    }
+    return king_bucket(LSB(pos->bb_pieces[KING+side]), side);
+}
+
+/*
+ * Find the output bucket to use for a position. The bucket is selected
+ * based on the number of pieces on the board.
+ */
+static int output_bucket(int npieces)
+{
+    return (npieces-2)/((32+arch.noutput_buckets-1)/arch.noutput_buckets);
+}
 
-static int feature_index(int sq, int piece, int side)
+static int feature_index(int sq, int piece, int side, int bucket)
 {
     int piece_index;
 
@@ -85,78 +330,225 @@ static int feature_index(int sq, int piece, int side)
         piece_index = piece*NSQUARES;
     }
 
-    return sq + piece_index;
+    return bucket*(NNUE_NUM_INPUT_FEATURES) + sq + piece_index;
 }
 
-static void accumulator_propagate(struct position *pos)
+static int16_t* feature_weights(int sq, int piece, int side, int bucket)
 {
-    int16_t                 *prev_data;
-    int16_t                 *data;
-    int                     side;
+    return &layers[0].weights.i16[(arch.sizes[0]/2)*
+                                  feature_index(sq, piece, side, bucket)];
+}
 
-    for (side=0;side<NSIDES;side++) {
-        prev_data = &pos->eval_stack[pos->height-1].accumulator.data[side][0];
-        data = &pos->eval_stack[pos->height].accumulator.data[side][0];
-        simd_copy(prev_data, data, layer_sizes[0]/2);
+static void accumulator_update(struct position *pos, int height, int side,
+                               int bucket)
+{
+    struct eval_item        *prev;
+    struct eval_item        *item;
+    struct nnue_dirty_piece *dp;
+    int16_t                 *sub[NNUE_MAX_DIRTY_PIECES];
+    int16_t                 *add[NNUE_MAX_DIRTY_PIECES];
+    int16_t                 *input;
+    int16_t                 *output;
+    int                     size = arch.sizes[0]/2;
+    int                     nsub;
+    int                     nadd;
+    int                     k;
+
+    prev = &pos->eval_stack[height-1];
+    item = &pos->eval_stack[height];
+    input = &prev->accumulator.data[side][0];
+    output = &item->accumulator.data[side][0];
+
+    /* Collect the weights of all features that are changed */
+    nsub = 0;
+    nadd = 0;
+    for (k=0;k<item->ndirty;k++) {
+        dp = &item->dirty[k];
+        if (dp->from != NO_SQUARE) {
+            sub[nsub++] = feature_weights(dp->from, dp->piece, side, bucket);
+        }
+        if (dp->to != NO_SQUARE) {
+            add[nadd++] = feature_weights(dp->to, dp->piece, side, bucket);
+        }
+    }
+
+    /*
+     * Use the fused kernels for the common cases so that the
+     * accumulator only has to be traversed once.
+     */
+    if ((nsub == 1) && (nadd == 1)) {
+        simd_copy_sub_add(input, output, sub[0], add[0], size);
+    } else if ((nsub == 2) && (nadd == 1)) {
+        simd_copy_sub_sub_add(input, output, sub[0], sub[1], add[0], size);
+    } else {
+        simd_copy(input, output, size);
+        for (k=0;k<nsub;k++) {
+            simd_sub(sub[k], output, size);
+        }
+        for (k=0;k<nadd;k++) {
+            simd_add(add[k], output, size);
+        }
     }
 }
 
-static void accumulator_add(struct position *pos, int piece, int sq)
+/*
+ * Check if the move leading to a ply moved the king of a perspective
+ * to a different king bucket. In that case all features change and
+ * the accumulator has to be refreshed instead of updated.
+ */
+static bool bucket_changed(struct eval_item *item, int side)
 {
-    struct nnue_accumulator *acc;
-    int16_t                 *data;
-    uint32_t                index;
-    uint32_t                offset;
-    int                     side;
+    struct nnue_dirty_piece *dp;
+    int                     k;
 
-    acc = &pos->eval_stack[pos->height].accumulator;
-    for (side=0;side<NSIDES;side++) {
-        data = &acc->data[side][0];
-        index = feature_index(sq, piece, side);
-        offset = (layer_sizes[0]/2)*index;
-        simd_add(&layers[0].weights.i16[offset], data, layer_sizes[0]/2);
+    for (k=0;k<item->ndirty;k++) {
+        dp = &item->dirty[k];
+        if ((dp->piece == KING+side) &&
+            (king_bucket(dp->from, side) != king_bucket(dp->to, side))) {
+            return true;
+        }
     }
+    return false;
 }
 
-static void accumulator_remove(struct position *pos, int piece, int sq)
+static void accumulator_refresh_cached(struct position *pos,
+                                       struct search_worker *worker, int side);
+
+static void accumulator_materialize(struct position *pos)
 {
-    struct nnue_accumulator *acc;
-    int16_t                 *data;
-    uint32_t                index;
-    uint32_t                offset;
-    int                     side;
+    bool refresh[NSIDES] = {false, false};
+    int  first;
+    int  height;
+    int  side;
+    int  bucket;
+
+    /* Find the last ply with an up to date accumulator */
+    first = pos->height;
+    while ((first > 0) && !pos->eval_stack[first].computed) {
+        first--;
+    }
+    assert(pos->eval_stack[first].computed);
+    if (first == pos->height) {
+        return;
+    }
 
-    acc = &pos->eval_stack[pos->height].accumulator;
+    /* Check if any perspective has to be refreshed */
+    if (arch.nking_buckets > 1) {
+        for (height=first+1;height<=pos->height;height++) {
+            for (side=0;side<NSIDES;side++) {
+                refresh[side] = refresh[side] ||
+                            bucket_changed(&pos->eval_stack[height], side);
+            }
+        }
+    }
+
+    /* Apply all pending updates */
     for (side=0;side<NSIDES;side++) {
-        data = &acc->data[side][0];
-        index = feature_index(sq, piece, side);
-        offset = (layer_sizes[0]/2)*index;
-        simd_sub(&layers[0].weights.i16[offset], data, layer_sizes[0]/2);
+        if (refresh[side]) {
+            accumulator_refresh_cached(pos, pos->worker, side);
+            continue;
+        }
+        bucket = position_king_bucket(pos, side);
+        for (height=first+1;height<=pos->height;height++) {
+            accumulator_update(pos, height, side, bucket);
+        }
+    }
+
+    /*
+     * If a perspective was refreshed then the accumulators for the
+     * plies in between are not valid.
+     */
+    if (refresh[WHITE] || refresh[BLACK]) {
+        pos->eval_stack[pos->height].computed = true;
+        return;
+    }
+    for (height=first+1;height<=pos->height;height++) {
+        pos->eval_stack[height].computed = true;
     }
 }
 
+static void add_dirty_piece(struct eval_item *item, int piece, int from,
+                            int to)
+{
+    struct nnue_dirty_piece *dp;
+
+    assert(item->ndirty < NNUE_MAX_DIRTY_PIECES);
+
+    dp = &item->dirty[item->ndirty++];
+    dp->piece = (int8_t)piece;
+    dp->from = (int8_t)from;
+    dp->to = (int8_t)to;
+}
+
 static void accumulator_refresh(struct position *pos, int side)
 {
     int      sq;
-    uint32_t index;
-    uint32_t offset;
+    int      bucket;
+    int      size = arch.sizes[0]/2;
     int16_t  *data;
     uint64_t bb;
 
     /* Setup data pointer */
     data = &pos->eval_stack[pos->height].accumulator.data[side][0];
+    bucket = position_king_bucket(pos, side);
 
     /* Add biases */
-    simd_copy(layers[0].biases.i16, data, layer_sizes[0]/2);
+    simd_copy(layers[0].biases.i16, data, size);
 
     /* Update the accumulator based on each piece */
     bb = pos->bb_all;
     while (bb != 0ULL) {
         sq = POPBIT(&bb);
-        index = feature_index(sq, pos->pieces[sq], side);
-        offset = (layer_sizes[0]/2)*index;
-        simd_add(&layers[0].weights.i16[offset], data, layer_sizes[0]/2);
+        simd_add(feature_weights(sq, pos->pieces[sq], side, bucket), data,
+                 size);
+    }
+}
+
+static void accumulator_refresh_cached(struct position *pos,
+                                       struct search_worker *worker, int side)
+{
+    struct nnue_refresh_item *item;
+    uint64_t                 added;
+    uint64_t                 removed;
+    int                      size = arch.sizes[0]/2;
+    int                      bucket;
+    int                      piece;
+    int                      sq;
+
+    if (worker->nnue_refresh_buckets != arch.nking_buckets) {
+        nnue_create_refresh_cache(worker);
+    }
+    bucket = position_king_bucket(pos, side);
+    item = &worker->nnue_refresh_cache[bucket*NSIDES+side];
+    worker->nnue_refreshes++;
+
+    /* Start from an empty board if the item is not valid */
+    if (item->net_id != net_id) {
+        simd_copy(layers[0].biases.i16, item->data, size);
+        memset(item->bb_pieces, 0, sizeof(item->bb_pieces));
+        item->net_id = net_id;
+        worker->nnue_full_refreshes++;
+    }
+
+    /* Only update the pieces that differ from the cached position */
+    for (piece=0;piece<NPIECES;piece++) {
+        removed = item->bb_pieces[piece]&~pos->bb_pieces[piece];
+        added = pos->bb_pieces[piece]&~item->bb_pieces[piece];
+        while (removed != 0ULL) {
+            sq = POPBIT(&removed);
+            simd_sub(feature_weights(sq, piece, side, bucket), item->data,
+                     size);
+        }
+        while (added != 0ULL) {
+            sq = POPBIT(&added);
+            simd_add(feature_weights(sq, piece, side, bucket), item->data,
+                     size);
+        }
+        item->bb_pieces[piece] = pos->bb_pieces[piece];
     }
+
+    simd_copy(item->data,
+              &pos->eval_stack[pos->height].accumulator.data[side][0], size);
 }
 
 static void input_layer_forward(struct position *pos, struct net_data *data)
@@ -169,7 +561,7 @@ static void input_layer_forward(struct position *pos, struct net_data *data)
      * Combine the two halves to form the inputs to the network. The
      * values are clamped to be in the range [0, 127].
      */
-    size = layer_sizes[0]/2;
+    size = arch.sizes[0]/2;
     dest = &data->output[0];
     half = pos->eval_stack[pos->height].accumulator.data[pos->stm];
     simd_clamp(half, dest, size);
@@ -177,147 +569,421 @@ static void input_layer_forward(struct position *pos, struct net_data *data)
     simd_clamp(half, dest+size, size);
 }
 
-static void output_layer_forward(int idx, struct net_data *data)
+static void layer_forward(int idx, int bucket, uint8_t *input,
+                          int32_t *output)
+{
+    int     ninputs = arch.sizes[idx-1];
+    int     noutputs = arch.sizes[idx];
+    int32_t *biases = layers[idx].biases.i32 + bucket*noutputs;
+    int8_t  *weights = layers[idx].weights.i8 + bucket*noutputs*ninputs;
+
+    if (is_sparse_layer(&arch, idx)) {
+        simd_fc_forward_sparse(input, output, ninputs, noutputs, biases,
+                               weights);
+    } else {
+        simd_fc_forward(input, output, ninputs, noutputs, biases, weights);
+    }
+}
+
+/*
+ * Run all layers after the input layer. The output of the input
+ * layer is expected to be available in data->output.
+ */
+static int output_layers_forward(struct net_data *data, int bucket)
 {
-    simd_fc_forward(data->output, data->intermediate, layer_sizes[idx-1],
-                    layer_sizes[idx], layers[idx].biases.i32,
-                    layers[idx].weights.i8);
+    uint8_t *input = data->output;
+    int     idx;
+
+    for (idx=1;idx<arch.nlayers;idx++) {
+        layer_forward(idx, bucket, input, data->intermediate);
+        if (idx < (arch.nlayers-1)) {
+            simd_shift_clamp(data->intermediate, data->hidden[idx-1],
+                             arch.shift, arch.sizes[idx]);
+            input = data->hidden[idx-1];
+        }
+    }
+
+    return data->intermediate[0]/(float)arch.output_scale;
 }
 
-static void network_forward(struct position *pos, struct net_data *data)
+static int network_forward(struct position *pos, struct net_data *data)
 {
     input_layer_forward(pos, data);
-    output_layer_forward(1, data);
+    return output_layers_forward(data,
+                                 output_bucket(BITCOUNT(pos->bb_all)));
 }
 
-static bool parse_header(uint8_t **data)
+static bool parse_header(uint8_t **data, uint64_t size, struct net_arch *a)
 {
     uint8_t  *iter = *data;
-    uint32_t version;
+    int      nhidden;
+    int      k;
 
-    version = read_uint32_le(iter);
+    if (size < NET_HEADER_V1_SIZE) {
+        return false;
+    }
+    a->version = read_uint32_le(iter);
     iter += 4;
+    if (a->version == NET_VERSION_V1) {
+        setup_v1_arch(a);
+        *data = iter;
+        return setup_arch(a);
+    } else if ((a->version != NET_VERSION) || (size < NET_HEADER_SIZE)) {
+        return false;
+    }
+
+    /*
+     * The header describes the size of the input layer (for one
+     * perspective), the number of king buckets, the sizes of up to
+     * two hidden layers, the number of output buckets and how the
+     * outputs are quantized. Finally the king bucket of each square
+     * is stored.
+     */
+    a->model_sizes[0] = read_uint32_le(iter)*2;
+    a->nking_buckets = read_uint32_le(iter+4);
+    nhidden = read_uint32_le(iter+8);
+    if ((nhidden < 0) || (nhidden > (NNUE_MAX_LAYERS-2))) {
+        return false;
+    }
+    a->nlayers = nhidden + 2;
+    for (k=0;k<nhidden;k++) {
+        a->model_sizes[k+1] = read_uint32_le(iter+12+k*4);
+    }
+    a->model_sizes[a->nlayers-1] = 1;
+    a->noutput_buckets = read_uint32_le(iter+20);
+    a->shift = read_uint32_le(iter+24);
+    a->output_scale = read_uint32_le(iter+28);
+    iter += 32;
+    memcpy(a->king_buckets, iter, NSQUARES);
+    iter += NSQUARES;
 
     *data = iter;
 
-    return version == NET_VERSION;
+    return setup_arch(a);
 }
 
-static uint8_t* read_input_layer(uint8_t *iter, struct layer *layer)
+static uint8_t* read_input_layer(uint8_t *iter, struct net_arch *a,
+                                 struct layer *layer)
 {
-    int k;
-    int half;
-    int model_half;
+    uint64_t k;
+    uint64_t nweights;
+    int      half;
 
-    model_half = layer_sizes[0]/2;
-    half = layer_sizes[0]/2;
-    for (k=0;k<model_half;k++,iter+=2) {
+    half = a->sizes[0]/2;
+    for (k=0;k<(uint64_t)half;k++,iter+=2) {
         layer->biases.i16[k] = read_uint16_le(iter);
     }
-    for (;k<half;k++) {
-        layer->biases.i16[k] = 0;
-    }
-    for (k=0;k<model_half*NNUE_NUM_INPUT_FEATURES;k++,iter+=2) {
+    nweights = (uint64_t)half*NNUE_NUM_INPUT_FEATURES*a->nking_buckets;
+    for (k=0;k<nweights;k++,iter+=2) {
         layer->weights.i16[k] = read_uint16_le(iter);
     }
-    for (;k<half*NNUE_NUM_INPUT_FEATURES;k++) {
-        layer->weights.i16[k] = 0;
-    }
 
     return iter;
 }
 
-static uint8_t* read_output_layer(uint8_t *iter, int idx, struct layer *layer)
+static uint8_t* read_output_layer(uint8_t *iter, struct net_arch *a, int idx,
+                                  int bucket, struct layer *layer)
 {
-    int k;
-    int l;
+    int32_t *biases = layer->biases.i32 + bucket*a->sizes[idx];
+    int8_t  *weights = layer->weights.i8 +
+                                        bucket*a->sizes[idx]*a->sizes[idx-1];
+    int     index;
+    int     k;
+    int     l;
 
-    for (k=0;k<layer_sizes[idx];k++,iter+=4) {
-        layer->biases.i32[k] = read_uint32_le(iter);
-    }
-    for (k=0;k<layer_sizes[idx];k++) {
-        for (l=0;l<layer_sizes[idx-1];l++,iter++) {
-            layer->weights.i8[k*layer_sizes[idx-1]+l] = (int8_t)*iter;
+    /* Padding outputs and inputs get weights and biases of zero */
+    for (k=0;k<a->sizes[idx];k++) {
+        biases[k] = 0;
+        if (k < a->model_sizes[idx]) {
+            biases[k] = read_uint32_le(iter);
+            iter += 4;
         }
-        for (;l<layer_sizes[idx-1];l++) {
-            layer->weights.i8[k*layer_sizes[idx-1]+l] = 0;
+    }
+    for (k=0;k<a->sizes[idx];k++) {
+        for (l=0;l<a->sizes[idx-1];l++) {
+            index = weight_index(a, idx, k, l);
+            weights[index] = 0;
+            if ((k < a->model_sizes[idx]) && (l < a->model_sizes[idx-1])) {
+                weights[index] = (int8_t)*iter;
+                iter++;
+            }
         }
     }
 
     return iter;
 }
 
-static bool parse_network(uint8_t **data)
+static void parse_network(uint8_t *iter, struct net_arch *a,
+                          struct layer *l)
 {
-    uint8_t *iter = *data;
+    int bucket;
+    int k;
 
     /* Read biases and weights for the input layer */
-    iter = read_input_layer(iter, &layers[0]);
+    iter = read_input_layer(iter, a, &l[0]);
+
+    /*
+     * Read biases and weights for the remaining layers. All
+     * layers for one output bucket are stored together.
+     */
+    for (bucket=0;bucket<a->noutput_buckets;bucket++) {
+        for (k=1;k<a->nlayers;k++) {
+            iter = read_output_layer(iter, a, k, bucket, &l[k]);
+        }
+    }
+}
+
+static uint64_t calculate_net_size(struct net_arch *a)
+{
+    uint64_t size;
+    int      k;
 
-    /* Read biases and weights for the output layer */
-    iter = read_output_layer(iter, 1, &layers[1]);
+    size = (a->version == NET_VERSION_V1)?NET_HEADER_V1_SIZE:NET_HEADER_SIZE;
 
-    *data = iter;
+    size += (a->model_sizes[0]/2)*sizeof(int16_t);
+    size += (uint64_t)(a->model_sizes[0]/2)*NNUE_NUM_INPUT_FEATURES*
+                                            a->nking_buckets*sizeof(int16_t);
 
-    return true;
+    for (k=1;k<a->nlayers;k++) {
+        size += (uint64_t)a->noutput_buckets*a->model_sizes[k]*
+                                                            sizeof(int32_t);
+        size += (uint64_t)a->noutput_buckets*a->model_sizes[k]*
+                                        a->model_sizes[k-1]*sizeof(int8_t);
+    }
+
+    return size;
 }
 
-static uint32_t calculate_net_size(void)
+static void calculate_native_layout(struct net_arch *a,
+                                    struct native_layout *layout)
 {
-    uint32_t size = 0;
+    uint64_t offset;
     int      k;
 
-    size += NET_HEADER_SIZE;
+    offset = NATIVE_HEADER_SIZE;
+    layout->king_buckets = 0;
+    if (a->version != NET_VERSION_V1) {
+        layout->king_buckets = offset;
+        offset += ALIGN_SECTION(NSQUARES);
+    }
+    for (k=0;k<a->nlayers;k++) {
+        layout->biases[k] = offset;
+        offset += ALIGN_SECTION(biases_size(a, k));
+        layout->weights[k] = offset;
+        offset += ALIGN_SECTION(weights_size(a, k));
+    }
+    layout->size = offset;
+}
 
-    size += NNUE_INPUT_LAYER_SIZE*sizeof(int16_t);
-    size += NNUE_INPUT_LAYER_SIZE*NNUE_NUM_INPUT_FEATURES*sizeof(int16_t);
+static void write_native_header(struct net_arch *a, uint8_t *header)
+{
+    uint32_t fields[NATIVE_HEADER_SIZE/sizeof(uint32_t)];
 
-    for (k=1;k<NNUE_NUM_LAYERS;k++) {
-        size += layer_sizes[k]*sizeof(int32_t);
-        size += layer_sizes[k]*layer_sizes[k-1]*sizeof(int8_t);
+    /*
+     * The header is stored in native byte order just like the weights.
+     * For version 1 nets only the first fields are used.
+     */
+    memset(fields, 0, sizeof(fields));
+    fields[0] = NATIVE_NET_MAGIC;
+    fields[1] = a->version;
+    fields[2] = a->model_sizes[0]/2;
+    fields[3] = NNUE_NUM_INPUT_FEATURES;
+    fields[4] = a->model_sizes[1];
+    if (a->version != NET_VERSION_V1) {
+        fields[5] = a->model_sizes[2];
+        fields[6] = a->model_sizes[3];
+        fields[7] = a->nlayers;
+        fields[8] = a->nking_buckets;
+        fields[9] = a->noutput_buckets;
+        fields[10] = a->shift;
+        fields[11] = a->output_scale;
     }
+    memcpy(header, fields, NATIVE_HEADER_SIZE);
+}
 
-    return size;
+static void release_mapped_net(void)
+{
+    unmap_file(mapped_net, mapped_net_size);
+    mapped_net = NULL;
+    mapped_net_size = 0;
+}
+
+static bool valid_native_net(uint8_t *data, uint64_t size, struct net_arch *a)
+{
+    struct native_layout layout;
+    uint32_t             fields[NATIVE_HEADER_SIZE/sizeof(uint32_t)];
+    uint8_t              expected[NATIVE_HEADER_SIZE];
+    int                  k;
+
+    if (size < NATIVE_HEADER_SIZE) {
+        return false;
+    }
+    memcpy(fields, data, NATIVE_HEADER_SIZE);
+    if (fields[0] != NATIVE_NET_MAGIC) {
+        return false;
+    }
+
+    /* Setup the architecture described by the header */
+    if (fields[1] == NET_VERSION_V1) {
+        setup_v1_arch(a);
+    } else if ((fields[1] == NET_VERSION) &&
+               (fields[7] <= NNUE_MAX_LAYERS) &&
+               (size >= (NATIVE_HEADER_SIZE+NSQUARES))) {
+        memset(a, 0, sizeof(struct net_arch));
+        a->version = fields[1];
+        a->model_sizes[0] = fields[2]*2;
+        a->nlayers = fields[7];
+        for (k=1;k<a->nlayers;k++) {
+            a->model_sizes[k] = fields[k+3];
+        }
+        a->nking_buckets = fields[8];
+        a->noutput_buckets = fields[9];
+        a->shift = fields[10];
+        a->output_scale = fields[11];
+        memcpy(a->king_buckets, data+NATIVE_HEADER_SIZE, NSQUARES);
+    } else {
+        return false;
+    }
+    if (!setup_arch(a)) {
+        return false;
+    }
+
+    /*
+     * Check that the data is a valid native net for the
+     * architecture. Since the weights are used as is the
+     * header also catches nets with the wrong endianess.
+     */
+    calculate_native_layout(a, &layout);
+    write_native_header(a, expected);
+    return (size == layout.size) &&
+           (memcmp(data, expected, NATIVE_HEADER_SIZE) == 0);
+}
+
+static void use_native_net(uint8_t *data, struct net_arch *a)
+{
+    struct native_layout layout;
+    int                  k;
+
+    calculate_native_layout(a, &layout);
+    memset(layers, 0, sizeof(layers));
+    for (k=0;k<a->nlayers;k++) {
+        layers[k].biases.i32 = (int32_t*)(data + layout.biases[k]);
+        layers[k].weights.i8 = (int8_t*)(data + layout.weights[k]);
+    }
+    arch = *a;
+}
+
+static void write_native_net(uint8_t *data)
+{
+    struct native_layout layout;
+    int                  k;
+
+    calculate_native_layout(&arch, &layout);
+    memset(data, 0, layout.size);
+    write_native_header(&arch, data);
+    if (arch.version != NET_VERSION_V1) {
+        memcpy(data+layout.king_buckets, arch.king_buckets, NSQUARES);
+    }
+    for (k=0;k<arch.nlayers;k++) {
+        memcpy(data+layout.biases[k], layers[k].biases.i32,
+               biases_size(&arch, k));
+        memcpy(data+layout.weights[k], layers[k].weights.i8,
+               weights_size(&arch, k));
+    }
+}
+
+static bool load_native_net(char *path)
+{
+    struct net_arch a;
+    uint8_t         *data;
+    uint64_t        size;
+
+    data = map_file(path, &size);
+    if (data == NULL) {
+        return false;
+    }
+    if (!valid_native_net(data, size, &a)) {
+        unmap_file(data, size);
+        return false;
+    }
+
+    /* Use the weights directly from the mapped file */
+    release_mapped_net();
+    free_layers(allocated_layers);
+    mapped_net = data;
+    mapped_net_size = size;
+    use_native_net(data, &a);
+
+    return true;
 }
 
 void nnue_init(void)
 {
-    /* Allocate space for layers */
-    layers[0].weights.i16 = aligned_malloc(64,
-                    layer_sizes[0]*NNUE_NUM_INPUT_FEATURES*sizeof(int16_t));
-    layers[0].biases.i16 = aligned_malloc(64, layer_sizes[0]*sizeof(int16_t));
-    layers[1].weights.i8 = aligned_malloc(64,
-                            layer_sizes[1]*layer_sizes[0]*sizeof(int8_t));
-    layers[1].biases.i32 = aligned_malloc(64,
-                            layer_sizes[1]*sizeof(int32_t));
+    /* Allocate space for layers of the default architecture */
+    setup_v1_arch(&arch);
+    (void)setup_arch(&arch);
+    (void)allocate_layers(&arch, allocated_layers);
+    memcpy(layers, allocated_layers, sizeof(layers));
 }
 
 void nnue_destroy(void)
 {
-    int k;
+    release_mapped_net();
+    free_layers(allocated_layers);
+}
+
+void nnue_create_refresh_cache(struct search_worker *worker)
+{
+    nnue_destroy_refresh_cache(worker);
+
+    worker->nnue_refresh_cache = numa_alloc(
+                    arch.nking_buckets*NSIDES*sizeof(struct nnue_refresh_item),
+                    numa_node_for_worker(worker->id));
+    assert(worker->nnue_refresh_cache != NULL);
+    worker->nnue_refresh_buckets = arch.nking_buckets;
+}
 
-    aligned_free(layers[0].weights.i16);
-    aligned_free(layers[0].biases.i16);
-    for (k=1;k<NNUE_NUM_LAYERS;k++) {
-        aligned_free(layers[k].weights.i8);
-        aligned_free(layers[k].biases.i32);
+void nnue_destroy_refresh_cache(struct search_worker *worker)
+{
+    if (worker->nnue_refresh_cache == NULL) {
+        return;
     }
+
+    numa_free(worker->nnue_refresh_cache, worker->nnue_refresh_buckets*
+                                NSIDES*sizeof(struct nnue_refresh_item));
+    worker->nnue_refresh_cache = NULL;
+    worker->nnue_refresh_buckets = 0;
 }
 
-void nnue_refresh_accumulator(struct position *pos)
+void nnue_refresh_accumulator(struct position *pos,
+                              struct search_worker *worker)
 {
-    accumulator_refresh(pos, WHITE);
-    accumulator_refresh(pos, BLACK);
+    if (worker != NULL) {
+        accumulator_refresh_cached(pos, worker, WHITE);
+        accumulator_refresh_cached(pos, worker, BLACK);
+    } else {
+        accumulator_refresh(pos, WHITE);
+        accumulator_refresh(pos, BLACK);
+    }
+    pos->eval_stack[pos->height].computed = true;
 }
 
 bool nnue_load_net(char *path)
 {
-    int32_t  size;
-    int32_t  count;
-    uint8_t  *data = NULL;
-    uint8_t  *iter;
-    FILE     *fh = NULL;
-    bool     ret = true;
+    struct net_arch a;
+    struct layer    l[NNUE_MAX_LAYERS];
+    int32_t         size;
+    int32_t         count;
+    uint8_t         *data = NULL;
+    uint8_t         *iter;
+    FILE            *fh = NULL;
+    bool            ret = true;
+
+    /* Nets in the native format are mapped instead of parsed */
+    if ((path != NULL) && load_native_net(path)) {
+        net_id++;
+        return true;
+    }
 
     /* If an external net is specified then read the complete file */
     if (path != NULL) {
@@ -326,10 +992,6 @@ bool nnue_load_net(char *path)
             ret = false;
             goto exit;
         }
-        if (size != (int32_t)calculate_net_size()) {
-            ret = false;
-            goto exit;
-        }
         fh = fopen(path, "rb");
         if (fh == NULL) {
             ret = false;
@@ -344,24 +1006,31 @@ bool nnue_load_net(char *path)
     } else {
         data = (uint8_t*)nnue_net_data;
         size = (int32_t)nnue_net_size;
-        if (size != (int32_t)calculate_net_size()) {
-            ret = false;
-            goto exit;
-        }
     }
 
     /* Parse network header */
     iter = data;
-    if (!parse_header(&iter)) {
+    if (!parse_header(&iter, size, &a) ||
+        ((uint64_t)size != calculate_net_size(&a))) {
         ret = false;
         goto exit;
     }
 
     /* Parse network */
-    if (!parse_network(&iter)) {
+    if (!allocate_layers(&a, l)) {
+        free_layers(l);
         ret = false;
         goto exit;
     }
+    parse_network(iter, &a, l);
+    release_mapped_net();
+    free_layers(allocated_layers);
+    memcpy(allocated_layers, l, sizeof(allocated_layers));
+    memcpy(layers, allocated_layers, sizeof(layers));
+    arch = a;
+
+    /* Invalidate all refresh caches */
+    net_id++;
 
 exit:
     if (path != NULL) {
@@ -373,17 +1042,94 @@ exit:
     return ret;
 }
 
+bool nnue_export_net(char *path)
+{
+    struct native_layout layout;
+    uint8_t              *data;
+    FILE                 *fh;
+    bool                 ret;
+
+    calculate_native_layout(&arch, &layout);
+    data = malloc(layout.size);
+    if (data == NULL) {
+        return false;
+    }
+    write_native_net(data);
+
+    fh = fopen(path, "wb");
+    if (fh == NULL) {
+        free(data);
+        return false;
+    }
+    ret = fwrite(data, 1, layout.size, fh) == layout.size;
+    fclose(fh);
+    free(data);
+
+    return ret;
+}
+
+uint64_t nnue_shared_size(void)
+{
+    struct native_layout layout;
+    struct net_arch      a;
+    uint8_t              *iter = (uint8_t*)nnue_net_data;
+
+    /* The shared memory holds the embedded net in the native format */
+    if (!parse_header(&iter, nnue_net_size, &a)) {
+        return 0;
+    }
+    calculate_native_layout(&a, &layout);
+    return layout.size;
+}
+
+uint64_t nnue_embedded_net_hash(void)
+{
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    uint32_t k;
+
+    /* FNV-1a */
+    for (k=0;k<nnue_net_size;k++) {
+        hash ^= nnue_net_data[k];
+        hash *= 0x100000001B3ULL;
+    }
+    return hash;
+}
+
+bool nnue_use_shared_net(void *memory, bool populate)
+{
+    struct net_arch a;
+
+    if (populate) {
+        if (!nnue_load_net(NULL)) {
+            return false;
+        }
+        write_native_net(memory);
+    }
+    if (!valid_native_net(memory, nnue_shared_size(), &a)) {
+        return false;
+    }
+
+    release_mapped_net();
+    free_layers(allocated_layers);
+    use_native_net(memory, &a);
+    net_id++;
+
+    return true;
+}
+
 int16_t nnue_evaluate(struct position *pos)
 {
     int             score;
     struct net_data data;
-    
+
     if ((pos->worker != NULL) && hash_nnue_lookup(pos->worker, &score)) {
         return score;
     }
 
-    network_forward(pos, &data);
-    score = data.intermediate[0]/OUTPUT_SCALE;
+    if (pos->worker != NULL) {
+        accumulator_materialize(pos);
+    }
+    score = network_forward(pos, &data);
     if (pos->worker != NULL) {
         hash_nnue_store(pos->worker, score);
     }
@@ -391,13 +1137,116 @@ int16_t nnue_evaluate(struct position *pos)
     return score;
 }
 
+void nnue_setup_batch_item(struct position *pos, struct nnue_batch_item *item)
+{
+    uint64_t bb;
+    int      sq;
+
+    assert(pos != NULL);
+    assert(item != NULL);
+
+    item->npieces = 0;
+    item->stm = pos->stm;
+    bb = pos->bb_all;
+    while (bb != 0ULL) {
+        sq = POPBIT(&bb);
+        item->squares[item->npieces] = sq;
+        item->pieces[item->npieces] = pos->pieces[sq];
+        item->npieces++;
+    }
+}
+
+void nnue_evaluate_batch(struct nnue_batch_item *items, int nitems,
+                         int16_t *scores)
+{
+    struct batch_data      *batch;
+    struct net_data        data;
+    struct nnue_batch_item *item;
+    int16_t                *rows[NNUE_MAX_ACTIVE_FEATURES];
+    int                    buckets[NSIDES];
+    uint32_t               size;
+    uint32_t               column;
+    int                    first;
+    int                    n;
+    int                    nrows;
+    int                    k;
+    int                    l;
+    int                    side;
+
+    assert(items != NULL);
+    assert(scores != NULL);
+
+    batch = aligned_malloc(64, sizeof(struct batch_data));
+    if (batch == NULL) {
+        return;
+    }
+    size = arch.sizes[0]/2;
+
+    for (first=0;first<nitems;first+=NNUE_BATCH_SIZE) {
+        n = MIN(NNUE_BATCH_SIZE, nitems-first);
+
+        /* Find the active features of all positions in the batch */
+        for (k=0;k<n;k++) {
+            item = &items[first+k];
+            buckets[WHITE] = 0;
+            buckets[BLACK] = 0;
+            for (l=0;(l<item->npieces)&&(arch.nking_buckets>1);l++) {
+                if (VALUE(item->pieces[l]) == KING) {
+                    side = COLOR(item->pieces[l]);
+                    buckets[side] = king_bucket(item->squares[l], side);
+                }
+            }
+            for (l=0;l<item->npieces;l++) {
+                for (side=0;side<NSIDES;side++) {
+                    batch->features[k*NSIDES+side][l] =
+                                feature_index(item->squares[l],
+                                              item->pieces[l], side,
+                                              buckets[side]);
+                }
+            }
+        }
+
+        /*
+         * Calculate the accumulators a block of columns at a time. The
+         * weights for a block of columns stay in the cache while they
+         * are used by all positions in the batch.
+         */
+        for (column=0;column<size;column+=NNUE_BATCH_COLUMNS) {
+            for (k=0;k<n*NSIDES;k++) {
+                nrows = items[first+k/NSIDES].npieces;
+                for (l=0;l<nrows;l++) {
+                    rows[l] = &layers[0].weights.i16[
+                                        size*batch->features[k][l]+column];
+                }
+                simd_add_rows(layers[0].biases.i16+column,
+                              batch->accumulators[k]+column, rows, nrows,
+                              NNUE_BATCH_COLUMNS);
+            }
+        }
+
+        /* Run the rest of the network for each position */
+        for (k=0;k<n;k++) {
+            side = items[first+k].stm;
+            simd_clamp(batch->accumulators[k*NSIDES+side], &data.output[0],
+                       size);
+            simd_clamp(batch->accumulators[k*NSIDES+FLIP_COLOR(side)],
+                       &data.output[size], size);
+            scores[first+k] = output_layers_forward(&data,
+                                    output_bucket(items[first+k].npieces));
+        }
+    }
+
+    aligned_free(batch);
+}
+
 void nnue_make_move(struct position *pos, uint32_t move)
 {
-    int from = FROM(move);
-    int to = TO(move);
-    int promotion = PROMOTION(move);
-    int capture = pos->pieces[to];
-    int piece = pos->pieces[from];
+    struct eval_item *item;
+    int              from = FROM(move);
+    int              to = TO(move);
+    int              promotion = PROMOTION(move);
+    int              capture = pos->pieces[to];
+    int              piece = pos->pieces[from];
 
     assert(pos->height > 0);
 
@@ -406,31 +1255,33 @@ void nnue_make_move(struct position *pos, uint32_t move)
         return;
     }
 
-    /* Copy accumulator data from the previous ply */
-    accumulator_propagate(pos);
-
-    /* Update accumulator */
+    /*
+     * Record the changes made by the move. The accumulator is
+     * not updated until the position is actually evaluated.
+     */
+    item = &pos->eval_stack[pos->height];
+    item->ndirty = 0;
+    item->computed = false;
     if (ISKINGSIDECASTLE(move)) {
-        accumulator_remove(pos, KING + pos->stm, from);
-        accumulator_add(pos, KING + pos->stm, KINGCASTLE_KINGMOVE(to));
-        accumulator_remove(pos, ROOK + pos->stm, to);
-        accumulator_add(pos, ROOK + pos->stm, KINGCASTLE_KINGMOVE(to) - 1);
+        add_dirty_piece(item, KING+pos->stm, from, KINGCASTLE_KINGMOVE(to));
+        add_dirty_piece(item, ROOK+pos->stm, to, KINGCASTLE_KINGMOVE(to)-1);
     } else if (ISQUEENSIDECASTLE(move)) {
-        accumulator_remove(pos, KING + pos->stm, from);
-        accumulator_add(pos, KING + pos->stm, QUEENCASTLE_KINGMOVE(to));
-        accumulator_remove(pos, ROOK + pos->stm, to);
-        accumulator_add(pos, ROOK + pos->stm, QUEENCASTLE_KINGMOVE(to) + 1);
+        add_dirty_piece(item, KING+pos->stm, from, QUEENCASTLE_KINGMOVE(to));
+        add_dirty_piece(item, ROOK+pos->stm, to, QUEENCASTLE_KINGMOVE(to)+1);
     } else if (ISENPASSANT(move)) {
-        accumulator_remove(pos, piece, from);
-        accumulator_add(pos, piece, to);
-        accumulator_remove(pos, PAWN + FLIP_COLOR(pos->stm),
-                           (pos->stm == WHITE)?to-8:to+8);
+        add_dirty_piece(item, piece, from, to);
+        add_dirty_piece(item, PAWN+FLIP_COLOR(pos->stm),
+                        (pos->stm == WHITE)?to-8:to+8, NO_SQUARE);
     } else {
-        accumulator_remove(pos, piece, from);
         if (ISCAPTURE(move)) {
-            accumulator_remove(pos, capture, to);
+            add_dirty_piece(item, capture, to, NO_SQUARE);
+        }
+        if (ISPROMOTION(move)) {
+            add_dirty_piece(item, piece, from, NO_SQUARE);
+            add_dirty_piece(item, promotion, NO_SQUARE, to);
+        } else {
+            add_dirty_piece(item, piece, from, to);
         }
-        accumulator_add(pos, ISPROMOTION(move)?promotion:piece, to);
     }
 }
 
@@ -438,5 +1289,6 @@ void nnue_make_null_move(struct position *pos)
 {
     assert(pos != NULL);
 
-    accumulator_propagate(pos);
+    pos->eval_stack[pos->height].ndirty = 0;
+    pos->eval_stack[pos->height].computed = false;
 }
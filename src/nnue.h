@@ -29,20 +29,82 @@ void nnue_init(void);
 void nnue_destroy(void);
 
 /*
- * Refresh the NNUE accumulator for a position.
+ * Allocate the accumulator refresh cache of a worker. The cache is
+ * sized for the currently loaded net. If a net with a different number
+ * of king buckets is loaded later then the cache is reallocated the
+ * next time it is used.
+ *
+ * @param worker The worker.
+ */
+void nnue_create_refresh_cache(struct search_worker *worker);
+
+/*
+ * Free the accumulator refresh cache of a worker.
+ *
+ * @param worker The worker.
+ */
+void nnue_destroy_refresh_cache(struct search_worker *worker);
+
+/*
+ * Refresh the NNUE accumulator for a position. If a worker is specified
+ * then the refresh cache of the worker is used so that only pieces that
+ * differ from the previous refresh have to be updated.
  *
  * @param pos The position.
+ * @param worker The worker whose refresh cache to use, or NULL
+ *               to do a full refresh.
  */
-void nnue_refresh_accumulator(struct position *pos);
+void nnue_refresh_accumulator(struct position *pos,
+                              struct search_worker *worker);
 
 /*
- * Load a NNUE net.
+ * Load a NNUE net. Nets in the native format (see nnue_export_net) are
+ * mapped read-only and used directly without being copied. Apart from the
+ * original fixed architecture nets can describe their own architecture,
+ * with king buckets, hidden layers and output buckets, in the header.
  *
  * @param path The path of the net to load.
  * @return Returns true if the new was succesfully loaded.
  */
 bool nnue_load_net(char *path);
 
+/*
+ * Write the currently loaded net to a file in the native format. In the
+ * native format the weights are stored pre-aligned exactly like they
+ * are used in memory.
+ *
+ * @param path The path of the file to write.
+ * @return Returns true if the net was succesfully written.
+ */
+bool nnue_export_net(char *path);
+
+/*
+ * Get the size needed to hold the embedded net in shared memory.
+ *
+ * @return Returns the size in bytes.
+ */
+uint64_t nnue_shared_size(void);
+
+/*
+ * Calculate a hash of the embedded net. Used to identify shared
+ * memory segments holding the net.
+ *
+ * @return Returns the hash.
+ */
+uint64_t nnue_embedded_net_hash(void);
+
+/*
+ * Use the embedded net from shared memory.
+ *
+ * @param memory Memory of at least nnue_shared_size() bytes, aligned
+ *               to 64 bytes.
+ * @param populate If true the embedded net is loaded and written to
+ *                 the memory, otherwise it is assumed to have been
+ *                 written by a different process already.
+ * @return Returns true if the net is used from shared memory.
+ */
+bool nnue_use_shared_net(void *memory, bool populate);
+
 /*
  * Evaluate a position.
  *
@@ -52,6 +114,28 @@ bool nnue_load_net(char *path);
  */
 int16_t nnue_evaluate(struct position *pos); 
 
+/*
+ * Prepare a position for evaluation with nnue_evaluate_batch.
+ *
+ * @param pos The position.
+ * @param item The batch item to initialize.
+ */
+void nnue_setup_batch_item(struct position *pos, struct nnue_batch_item *item);
+
+/*
+ * Evaluate a batch of positions. The accumulators for all positions in
+ * the batch are calculated together so that each weight row only has to
+ * be loaded once per batch. The positions don't need to have a refreshed
+ * accumulator.
+ *
+ * @param items The positions to evaluate.
+ * @param nitems The number of positions.
+ * @param scores Location to store the scores at. The scores are the
+ *               same as the ones returned by nnue_evaluate.
+ */
+void nnue_evaluate_batch(struct nnue_batch_item *items, int nitems,
+                         int16_t *scores);
+
 /*
  * Make a new move.
  *
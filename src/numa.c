@@ -0,0 +1,460 @@
+/*
+ * Marvin - an UCI/XBoard compatible chess engine
+ * Copyright (C) 2015 Martin Danielsson
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#if defined(__linux__) && !defined(WINDOWS)
+#define _GNU_SOURCE
+#endif
+#include <stdio.h>
+#include <string.h>
+#if defined(WINDOWS)
+#include <windows.h>
+#else
+#include <unistd.h>
+#include <sys/mman.h>
+#if defined(__linux__)
+#include <sched.h>
+#include <sys/syscall.h>
+#endif
+#endif
+
+#include "numa.h"
+#include "utils.h"
+
+/* The maximum number of nodes that fit in a node mask */
+#define MAX_NODES ((int)(sizeof(unsigned long)*8))
+
+/* The maximum number of CPUs that is supported */
+#define MAX_CPUS 1024
+
+/* Memory policies used by the mbind system call */
+#define MPOL_PREFERRED 1
+#define MPOL_INTERLEAVE 3
+
+/* The number of NUMA nodes in the system */
+static int number_of_nodes = 1;
+
+/* The node number of each NUMA node */
+static int node_ids[MAX_NODES];
+
+/* The node of each CPU, or -1 if the CPU is not available */
+static int cpu_node[MAX_CPUS];
+
+/* The policy used for placing worker threads */
+static enum numa_policy numa_policy = NUMA_POLICY_NONE;
+
+/* Names of the different policies */
+static char *policy_names[] = {"none", "node", "core"};
+
+#if defined(WINDOWS)
+/* The affinity of the process when it was started */
+static DWORD_PTR original_affinity = 0;
+#elif defined(__linux__)
+/* Mask with one bit set for each online node */
+static unsigned long node_mask = 1UL;
+
+/* The affinity of the process when it was started */
+static cpu_set_t original_affinity;
+
+static bool read_list(char *file, bool *set, int max)
+{
+    FILE *fp;
+    char buffer[1024];
+    char *iter;
+    bool found;
+    int  first;
+    int  last;
+    int  k;
+    int  n;
+
+    fp = fopen(file, "r");
+    if (fp == NULL) {
+        return false;
+    }
+    if (fgets(buffer, sizeof(buffer), fp) == NULL) {
+        fclose(fp);
+        return false;
+    }
+    fclose(fp);
+
+    /* The file contains ranges of numbers, e.g. "0-3,8-11" */
+    found = false;
+    iter = buffer;
+    while (sscanf(iter, "%d%n", &first, &n) == 1) {
+        iter += n;
+        last = first;
+        if (*iter == '-') {
+            iter++;
+            if (sscanf(iter, "%d%n", &last, &n) != 1) {
+                break;
+            }
+            iter += n;
+        }
+        for (k=first;(k<=last)&&(k<max);k++) {
+            set[k] = true;
+            found = true;
+        }
+        if (*iter != ',') {
+            break;
+        }
+        iter++;
+    }
+
+    return found;
+}
+#endif
+
+/* Count the CPUs of a node, or of all nodes if node is -1 */
+static int number_of_cpus(int node)
+{
+    int count;
+    int k;
+
+    count = 0;
+    for (k=0;k<MAX_CPUS;k++) {
+        if (cpu_node[k] < 0) {
+            continue;
+        }
+        if ((node < 0) || (cpu_node[k] == node)) {
+            count++;
+        }
+    }
+    return count;
+}
+
+#if defined(WINDOWS) || defined(__linux__)
+static int cpu_for_worker(int idx)
+{
+    int node;
+    int target;
+    int count;
+    int k;
+
+    /*
+     * Workers are distributed round-robin over the nodes and
+     * then over the CPUs of each node.
+     */
+    node = numa_node_for_worker(idx);
+    count = number_of_cpus(node);
+    if (count == 0) {
+        return -1;
+    }
+    target = (idx/number_of_nodes)%count;
+    for (k=0;k<MAX_CPUS;k++) {
+        if (cpu_node[k] != node) {
+            continue;
+        }
+        if (target == 0) {
+            return k;
+        }
+        target--;
+    }
+    return -1;
+}
+#endif
+
+void numa_init(void)
+{
+#if defined(WINDOWS)
+    DWORD_PTR system_affinity;
+    ULONGLONG mask;
+    ULONG     highest;
+    ULONG     node;
+    int       cpu;
+#elif defined(__linux__)
+    bool nodes[MAX_NODES];
+    bool cpus[MAX_CPUS];
+    char path[128];
+    int  node;
+    int  cpu;
+#endif
+    int k;
+
+    for (k=0;k<MAX_CPUS;k++) {
+        cpu_node[k] = -1;
+    }
+    number_of_nodes = 0;
+
+#if defined(WINDOWS)
+    if (!GetProcessAffinityMask(GetCurrentProcess(), &original_affinity,
+                                &system_affinity)) {
+        original_affinity = 0;
+    }
+    if (!GetNumaHighestNodeNumber(&highest)) {
+        highest = 0;
+    }
+    for (node=0;(node<=highest)&&((int)node<MAX_NODES);node++) {
+        if (!GetNumaNodeProcessorMask((UCHAR)node, &mask) || (mask == 0)) {
+            continue;
+        }
+        for (cpu=0;cpu<(int)(sizeof(DWORD_PTR)*8);cpu++) {
+            if ((mask&(1ULL<<cpu)) != 0) {
+                cpu_node[cpu] = node;
+            }
+        }
+        node_ids[number_of_nodes++] = node;
+    }
+#elif defined(__linux__)
+    if (sched_getaffinity(0, sizeof(original_affinity),
+                          &original_affinity) != 0) {
+        CPU_ZERO(&original_affinity);
+    }
+
+    /* Find all nodes that have CPUs */
+    memset(nodes, 0, sizeof(nodes));
+    node_mask = 0UL;
+    if (read_list("/sys/devices/system/node/online", nodes, MAX_NODES)) {
+        for (node=0;node<MAX_NODES;node++) {
+            if (!nodes[node]) {
+                continue;
+            }
+            memset(cpus, 0, sizeof(cpus));
+            sprintf(path, "/sys/devices/system/node/node%d/cpulist", node);
+            if (!read_list(path, cpus, MAX_CPUS)) {
+                continue;
+            }
+            for (cpu=0;cpu<MAX_CPUS;cpu++) {
+                if (cpus[cpu]) {
+                    cpu_node[cpu] = node;
+                }
+            }
+            node_ids[number_of_nodes++] = node;
+            node_mask |= (1UL<<node);
+        }
+    }
+    if (number_of_nodes == 0) {
+        node_mask = 1UL;
+    }
+#endif
+
+    /* If no topology information is available then assume a single node */
+    if (number_of_nodes == 0) {
+#if defined(WINDOWS)
+        for (k=0;k<(int)(sizeof(DWORD_PTR)*8);k++) {
+            if ((original_affinity&((DWORD_PTR)1<<k)) != 0) {
+                cpu_node[k] = 0;
+            }
+        }
+#else
+        for (k=0;(k<MAX_CPUS)&&(k<sysconf(_SC_NPROCESSORS_ONLN));k++) {
+            cpu_node[k] = 0;
+        }
+#endif
+        node_ids[0] = 0;
+        number_of_nodes = 1;
+    }
+}
+
+int numa_number_of_nodes(void)
+{
+    return number_of_nodes;
+}
+
+int numa_number_of_cpus(void)
+{
+    return number_of_cpus(-1);
+}
+
+void numa_set_policy(enum numa_policy policy)
+{
+    numa_policy = policy;
+}
+
+enum numa_policy numa_get_policy(void)
+{
+    return numa_policy;
+}
+
+char* numa_policy_name(enum numa_policy policy)
+{
+    return policy_names[policy];
+}
+
+bool numa_policy_from_name(char *name, enum numa_policy *policy)
+{
+    int k;
+
+    for (k=0;k<(int)(sizeof(policy_names)/sizeof(policy_names[0]));k++) {
+        if (!strcmp(name, policy_names[k])) {
+            *policy = (enum numa_policy)k;
+            return true;
+        }
+    }
+    return false;
+}
+
+int numa_node_for_worker(int idx)
+{
+    if (numa_policy == NUMA_POLICY_NONE) {
+        return -1;
+    }
+    return node_ids[idx%number_of_nodes];
+}
+
+void numa_bind_thread(int idx)
+{
+#if defined(WINDOWS)
+    DWORD_PTR mask;
+    int       node;
+    int       cpu;
+    int       k;
+
+    if (numa_policy == NUMA_POLICY_NONE) {
+        if (original_affinity != 0) {
+            (void)SetThreadAffinityMask(GetCurrentThread(), original_affinity);
+        }
+        return;
+    }
+
+    mask = 0;
+    if (numa_policy == NUMA_POLICY_CORE) {
+        cpu = cpu_for_worker(idx);
+        if ((cpu >= 0) && (cpu < (int)(sizeof(DWORD_PTR)*8))) {
+            mask = (DWORD_PTR)1<<cpu;
+        }
+    } else {
+        node = numa_node_for_worker(idx);
+        for (k=0;k<(int)(sizeof(DWORD_PTR)*8);k++) {
+            if (cpu_node[k] == node) {
+                mask |= (DWORD_PTR)1<<k;
+            }
+        }
+    }
+    if (mask != 0) {
+        (void)SetThreadAffinityMask(GetCurrentThread(), mask);
+    }
+#elif defined(__linux__)
+    cpu_set_t set;
+    int       node;
+    int       cpu;
+    int       k;
+
+    if (numa_policy == NUMA_POLICY_NONE) {
+        if (CPU_COUNT(&original_affinity) > 0) {
+            (void)sched_setaffinity(0, sizeof(original_affinity),
+                                    &original_affinity);
+        }
+        return;
+    }
+
+    CPU_ZERO(&set);
+    if (numa_policy == NUMA_POLICY_CORE) {
+        cpu = cpu_for_worker(idx);
+        if ((cpu >= 0) && (cpu < CPU_SETSIZE)) {
+            CPU_SET(cpu, &set);
+        }
+    } else {
+        node = numa_node_for_worker(idx);
+        for (k=0;(k<MAX_CPUS)&&(k<CPU_SETSIZE);k++) {
+            if (cpu_node[k] == node) {
+                CPU_SET(k, &set);
+            }
+        }
+    }
+    if (CPU_COUNT(&set) > 0) {
+        (void)sched_setaffinity(0, sizeof(set), &set);
+    }
+#else
+    (void)idx;
+#endif
+}
+
+void* numa_alloc(uint64_t size, int node)
+{
+#if defined(WINDOWS)
+    if (node >= 0) {
+        return VirtualAllocExNuma(GetCurrentProcess(), NULL, size,
+                                  MEM_RESERVE|MEM_COMMIT, PAGE_READWRITE,
+                                  node);
+    }
+    return VirtualAlloc(NULL, size, MEM_RESERVE|MEM_COMMIT, PAGE_READWRITE);
+#elif defined(__linux__)
+    unsigned long mask;
+    void          *ptr;
+
+    ptr = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS,
+               -1, 0);
+    if (ptr == MAP_FAILED) {
+        return NULL;
+    }
+
+    /*
+     * Ask the kernel to prefer the node when the
+     * memory is touched for the first time.
+     */
+    if ((node >= 0) && (node < MAX_NODES) && (number_of_nodes > 1)) {
+        mask = 1UL<<node;
+        (void)syscall(SYS_mbind, ptr, size, MPOL_PREFERRED, &mask,
+                      MAX_NODES+1, 0);
+    }
+    return ptr;
+#else
+    void *ptr;
+
+    (void)node;
+    ptr = aligned_malloc(sysconf(_SC_PAGESIZE), size);
+    if (ptr != NULL) {
+        memset(ptr, 0, size);
+    }
+    return ptr;
+#endif
+}
+
+void numa_free(void *memory, uint64_t size)
+{
+    if (memory == NULL) {
+        return;
+    }
+
+#if defined(WINDOWS)
+    (void)size;
+    VirtualFree(memory, 0, MEM_RELEASE);
+#elif defined(__linux__)
+    (void)munmap(memory, size);
+#else
+    (void)size;
+    aligned_free(memory);
+#endif
+}
+
+void numa_interleave_memory(void *memory, uint64_t size)
+{
+#if defined(__linux__) && !defined(WINDOWS)
+    if (number_of_nodes <= 1) {
+        return;
+    }
+
+    (void)syscall(SYS_mbind, memory, size, MPOL_INTERLEAVE, &node_mask,
+                  MAX_NODES+1, 0);
+#else
+    (void)memory;
+    (void)size;
+#endif
+}
+
+void numa_print_topology(void)
+{
+    int k;
+
+    printf("info string NUMA nodes: %d, CPUs: %d, policy: %s\n",
+           number_of_nodes, number_of_cpus(-1), policy_names[numa_policy]);
+    if (number_of_nodes > 1) {
+        for (k=0;k<number_of_nodes;k++) {
+            printf("info string NUMA node %d: %d CPUs\n", node_ids[k],
+                   number_of_cpus(node_ids[k]));
+        }
+    }
+}
@@ -0,0 +1,131 @@
+/*
+ * Marvin - an UCI/XBoard compatible chess engine
+ * Copyright (C) 2015 Martin Danielsson
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef NUMA_H
+#define NUMA_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Policies for placing worker threads on NUMA nodes */
+enum numa_policy {
+    NUMA_POLICY_NONE,
+    NUMA_POLICY_NODE,
+    NUMA_POLICY_CORE
+};
+
+/* Initialize the NUMA component */
+void numa_init(void);
+
+/*
+ * Get the number of NUMA nodes in the system.
+ *
+ * @return Returns the number of nodes.
+ */
+int numa_number_of_nodes(void);
+
+/*
+ * Get the number of CPUs in the system.
+ *
+ * @return Returns the number of CPUs, or 0 if the number is unknown.
+ */
+int numa_number_of_cpus(void);
+
+/*
+ * Set the policy to use for placing worker threads. The policy takes
+ * effect the next time the workers are created.
+ *
+ * @param policy The policy.
+ */
+void numa_set_policy(enum numa_policy policy);
+
+/*
+ * Get the policy used for placing worker threads.
+ *
+ * @return Returns the policy.
+ */
+enum numa_policy numa_get_policy(void);
+
+/*
+ * Get the name of a policy.
+ *
+ * @param policy The policy.
+ * @return Returns the name of the policy.
+ */
+char* numa_policy_name(enum numa_policy policy);
+
+/*
+ * Get the policy with a given name.
+ *
+ * @param name The name of the policy.
+ * @param policy Location to store the policy at.
+ * @return Returns true if the name is a valid policy name.
+ */
+bool numa_policy_from_name(char *name, enum numa_policy *policy);
+
+/*
+ * Get the node that a worker should run on according to the current policy.
+ *
+ * @param idx The index of the worker.
+ * @return Returns the node, or -1 if the worker is not bound to a node.
+ */
+int numa_node_for_worker(int idx);
+
+/*
+ * Bind the calling thread to the node (or core) assigned to a worker
+ * according to the current policy. If no policy is used then the
+ * original affinity of the process is restored.
+ *
+ * @param idx The index of the worker.
+ */
+void numa_bind_thread(int idx);
+
+/*
+ * Allocate memory on a specific node. The memory is page aligned and
+ * zero initialized. Where possible the pages are not committed until
+ * they are touched for the first time, so parts of the memory that
+ * are never used don't add to the resident size of the process.
+ *
+ * @param size The number of bytes to allocate.
+ * @param node The node to allocate the memory on, or -1 to use the
+ *             default placement.
+ * @return Returns a pointer to the allocated memory, or NULL on failure.
+ */
+void* numa_alloc(uint64_t size, int node);
+
+/*
+ * Free memory allocated with numa_alloc.
+ *
+ * @param memory Pointer to the memory to free.
+ * @param size The size that was passed to numa_alloc.
+ */
+void numa_free(void *memory, uint64_t size);
+
+/*
+ * Request that memory is interleaved over all NUMA nodes. Must be called
+ * before the memory is touched for the first time. Does nothing if the
+ * system only has one node or if the operation is not supported.
+ *
+ * @param memory Pointer to the memory. Must be page aligned.
+ * @param size The size of the memory (in bytes).
+ */
+void numa_interleave_memory(void *memory, uint64_t size);
+
+/* Print a summary of the NUMA topology */
+void numa_print_topology(void);
+
+#endif
@@ -324,9 +324,22 @@ struct polybook_entry {
     uint32_t learn;
 };
 
+/* The number of key bits used to index the opening book */
+#define INDEX_BITS 16
+#define INDEX_SIZE (1<<INDEX_BITS)
+
 static FILE *bookfp = NULL;
 static long booksize = 0;
 
+/*
+ * The opening book memory mapped. If the book could be mapped then
+ * index[k] contains the first entry with the INDEX_BITS most significant
+ * key bits greater than or equal to k.
+ */
+static uint8_t *bookdata = NULL;
+static uint64_t bookdata_size = 0ULL;
+static uint32_t *bookindex = NULL;
+
 static uint8_t engine2poly_piece(uint8_t piece)
 {
     if ((piece&0x01) == 0) {
@@ -438,42 +451,96 @@ static uint64_t generate_polykey(struct position *pos)
     return key;
 }
 
-static bool read_book_entry(long offset, struct polybook_entry *entry)
+static bool read_book_entry(int index, struct polybook_entry *entry)
 {
-    uint8_t buffer[16];
+    uint8_t buffer[BOOK_ENTRY_SIZE];
+    uint8_t *data;
     size_t  nbytes;
 
-    if (fseek(bookfp, offset, SEEK_SET) != 0) {
+    if (index < 0) {
         return false;
     }
-
-    nbytes = fread(buffer, 1, 16, bookfp);
-    if (nbytes != 16) {
-        return false;
+    if (bookdata != NULL) {
+        if (((uint64_t)index+1)*BOOK_ENTRY_SIZE > bookdata_size) {
+            return false;
+        }
+        data = bookdata + (uint64_t)index*BOOK_ENTRY_SIZE;
+    } else {
+        if (fseek(bookfp, (long)index*BOOK_ENTRY_SIZE, SEEK_SET) != 0) {
+            return false;
+        }
+        nbytes = fread(buffer, 1, BOOK_ENTRY_SIZE, bookfp);
+        if (nbytes != BOOK_ENTRY_SIZE) {
+            return false;
+        }
+        data = buffer;
     }
 
-    entry->key = read_uint64_be(buffer);
-    entry->move = read_uint16_be(buffer+8);
-    entry->weight = read_uint16_be(buffer+10);
-    entry->learn = read_uint32_be(buffer+12);
+    entry->key = read_uint64_be(data);
+    entry->move = read_uint16_be(data+8);
+    entry->weight = read_uint16_be(data+10);
+    entry->learn = read_uint32_be(data+12);
 
     return true;
 }
 
+static uint64_t read_book_key(int index)
+{
+    return read_uint64_be(bookdata+(uint64_t)index*BOOK_ENTRY_SIZE);
+}
+
+static void build_index(void)
+{
+    uint32_t nentries;
+    uint32_t k;
+    uint32_t prefix;
+    uint32_t next;
+
+    bookindex = malloc(sizeof(uint32_t)*(INDEX_SIZE+1));
+    if (bookindex == NULL) {
+        return;
+    }
+
+    /* The book is sorted by key so a single pass is enough */
+    nentries = booksize/BOOK_ENTRY_SIZE;
+    next = 0;
+    for (k=0;k<nentries;k++) {
+        prefix = (uint32_t)(read_book_key(k)>>(64-INDEX_BITS));
+        while (next <= prefix) {
+            bookindex[next++] = k;
+        }
+    }
+    while (next <= INDEX_SIZE) {
+        bookindex[next++] = nentries;
+    }
+}
+
 static int find_key(uint64_t key)
 {
     struct polybook_entry entry;
     int                   left;
     int                   right;
+    int                   end;
     int                   center;
+    int                   prefix;
 
-    /* Use a binary search to find the first entry with the correct key */
+    /*
+     * Use a binary search to find the first entry with the correct key. If
+     * the book is indexed then the search can be limited to the entries
+     * with the same key prefix.
+     */
     center = 0;
     left = 0;
     right = booksize/BOOK_ENTRY_SIZE;
+    if (bookindex != NULL) {
+        prefix = (int)(key>>(64-INDEX_BITS));
+        left = bookindex[prefix];
+        right = bookindex[prefix+1];
+    }
+    end = right;
     while (left < right) {
         center = (left + right)/2;
-        if (!read_book_entry(center*BOOK_ENTRY_SIZE, &entry)) {
+        if (!read_book_entry(center, &entry)) {
             return -1;
         }
 
@@ -483,7 +550,9 @@ static int find_key(uint64_t key)
             left = center + 1;
         }
     }
-    if (!read_book_entry(left*BOOK_ENTRY_SIZE, &entry)) {
+
+    /* The key is greater than all entries in the searched range */
+    if ((left >= end) || !read_book_entry(left, &entry)) {
         return -1;
     }
 
@@ -508,12 +577,34 @@ bool polybook_open(char *path)
         polybook_close();
         return false;
     }
+    booksize -= booksize%BOOK_ENTRY_SIZE;
+
+    /*
+     * Try to memory map the book so that probing doesn't require any
+     * system calls. If the book cannot be mapped all entries are
+     * read from the file instead.
+     */
+    if (booksize > 0) {
+        bookdata = map_file(path, &bookdata_size);
+        if (bookdata != NULL) {
+            build_index();
+        }
+    }
 
     return true;
 }
 
 void polybook_close(void)
 {
+    if (bookindex != NULL) {
+        free(bookindex);
+        bookindex = NULL;
+    }
+    if (bookdata != NULL) {
+        unmap_file(bookdata, bookdata_size);
+        bookdata = NULL;
+        bookdata_size = 0ULL;
+    }
     if (bookfp != NULL) {
         fclose(bookfp);
         bookfp = NULL;
@@ -558,7 +649,7 @@ uint32_t polybook_probe(struct position *pos)
     best_score = 0;
     last = booksize/BOOK_ENTRY_SIZE;
     while (index < last) {
-        if (!read_book_entry(index*BOOK_ENTRY_SIZE, &entry)) {
+        if (!read_book_entry(index, &entry)) {
             return NOMOVE;
         }
         if (key != entry.key) {
@@ -575,7 +666,7 @@ uint32_t polybook_probe(struct position *pos)
     }
 
     /* Convert the move to the internal format and return it */
-    if (!read_book_entry(best*BOOK_ENTRY_SIZE, &entry)) {
+    if (!read_book_entry(best, &entry)) {
         return NOMOVE;
     }
     gen_legal_moves(pos, &list);
@@ -621,7 +712,7 @@ struct book_entry* polybook_get_entries(struct position *pos, int *nentries)
     count = 0;
     last = booksize/BOOK_ENTRY_SIZE;
     while (index < last) {
-        if (!read_book_entry(index*BOOK_ENTRY_SIZE, &entry)) {
+        if (!read_book_entry(index, &entry)) {
             free(bookentries);
             *nentries = 0;
             return NULL;
@@ -32,6 +32,8 @@
 #include "engine.h"
 #include "nnue.h"
 #include "eval.h"
+#include "material.h"
+#include "utils.h"
 
 static void update_material(struct position *pos, int piece, bool added)
 {
@@ -159,6 +161,10 @@ void pos_reset(struct position *pos)
     pos->bb_all = 0ULL;
 
     pos->key = 0ULL;
+    pos->pawnkey = 0ULL;
+    pos->matkey = 0ULL;
+    pos->checkers = 0ULL;
+    pos->pinned = 0ULL;
 
     pos->ep_sq = NO_SQUARE;
     pos->castle = 0;
@@ -168,6 +174,52 @@ void pos_reset(struct position *pos)
     pos->fifty = 0;
 }
 
+void pos_copy_root(struct position *dst, struct position *src)
+{
+    int nmoves;
+    int first;
+
+    assert(valid_position(src));
+
+    memcpy(dst->pieces, src->pieces, sizeof(src->pieces));
+    memcpy(dst->bb_pieces, src->bb_pieces, sizeof(src->bb_pieces));
+    memcpy(dst->bb_sides, src->bb_sides, sizeof(src->bb_sides));
+    dst->bb_all = src->bb_all;
+    dst->key = src->key;
+    dst->pawnkey = src->pawnkey;
+    dst->matkey = src->matkey;
+    dst->checkers = src->checkers;
+    dst->pinned = src->pinned;
+    dst->ep_sq = src->ep_sq;
+    dst->castle = src->castle;
+    dst->castle_wk = src->castle_wk;
+    dst->castle_wq = src->castle_wq;
+    dst->castle_bk = src->castle_bk;
+    dst->castle_bq = src->castle_bq;
+    dst->stm = src->stm;
+    dst->ply = src->ply;
+    dst->height = src->height;
+    dst->fifty = src->fifty;
+    dst->fullmove = src->fullmove;
+    dst->material = src->material;
+
+    /*
+     * Positions before the last irreversible move are never looked at
+     * during the search. The last two moves are always copied since
+     * they are used by the move ordering heuristics.
+     */
+    nmoves = MAX(src->fifty, 2);
+    first = MAX(src->ply-nmoves, 0);
+    memcpy(&dst->history[first], &src->history[first],
+           (src->ply-first)*sizeof(struct unmake));
+
+    /* The accumulator for the root node is calculated by the caller */
+    dst->eval_stack[src->height] = src->eval_stack[src->height];
+
+    dst->worker = src->worker;
+    dst->engine = src->engine;
+}
+
 bool pos_setup_from_fen(struct position *pos, char *fenstr)
 {
     uint64_t pieces;
@@ -190,7 +242,11 @@ bool pos_setup_from_fen(struct position *pos, char *fenstr)
         update_material(pos, piece, true);
     }
 
-    nnue_refresh_accumulator(pos);
+    pos->pawnkey = key_generate_pawnkey(pos);
+    pos->matkey = key_generate_matkey(pos);
+    pos_update_check_info(pos);
+
+    nnue_refresh_accumulator(pos, pos->worker);
 
     return true;
 }
@@ -365,11 +421,20 @@ bool pos_in_check(struct position *pos, int side)
     assert(valid_position(pos));
     assert(valid_side(side));
 
+    if (side == pos->stm) {
+        return pos->checkers != 0ULL;
+    }
     return bb_is_attacked(pos, LSB(pos->bb_pieces[KING+side]),
                           FLIP_COLOR(side));
 }
 
-bool pos_make_move(struct position *pos, uint32_t move)
+/*
+ * Make a move for a specific side. Always inlined with a constant side
+ * so that separate versions without color dependent branches are
+ * generated for white and black.
+ */
+static ALWAYS_INLINE void make_move(struct position *pos, uint32_t move,
+                                    int side)
 {
     struct unmake *elem;
     int           capture;
@@ -379,11 +444,6 @@ bool pos_make_move(struct position *pos, uint32_t move)
     int           promotion;
     int           ep;
 
-    assert(valid_position(pos));
-    assert(valid_move(move));
-    assert(pos_is_move_pseudo_legal(pos, move));
-    assert(pos->ply < MAX_MOVES);
-
     from = FROM(move);
     to = TO_CASTLE(move);
     promotion = PROMOTION(move);
@@ -392,6 +452,15 @@ bool pos_make_move(struct position *pos, uint32_t move)
     capture = pos->pieces[to];
     piece = pos->pieces[from];
 
+    /*
+     * Prefetch hash table entries for the resulting position before
+     * the board is updated, so that the memory accesses overlap with
+     * the rest of the move.
+     */
+    if (pos->engine != NULL) {
+        hash_prefetch(pos->worker, key_after_move(pos, move));
+    }
+
     /* Update the history */
     elem = push_history(pos);
     elem->move = move;
@@ -401,13 +470,21 @@ bool pos_make_move(struct position *pos, uint32_t move)
     elem->ep_sq = pos->ep_sq;
     elem->fifty = pos->fifty;
     elem->key = pos->key;
+    elem->pawnkey = pos->pawnkey;
+    elem->matkey = pos->matkey;
+    elem->checkers = pos->checkers;
+    elem->pinned = pos->pinned;
+    memcpy(elem->bb_pieces, pos->bb_pieces, sizeof(pos->bb_pieces));
+    memcpy(elem->bb_sides, pos->bb_sides, sizeof(pos->bb_sides));
+    elem->bb_all = pos->bb_all;
+    elem->material = pos->material;
 
     /* Update NNUE */
     nnue_make_move(pos, move);
 
     /* Check if the move enables an en passant capture */
     if ((VALUE(piece) == PAWN) && (abs(to-from) == 16)) {
-        pos->ep_sq = (pos->stm == WHITE)?to-8:to+8;
+        pos->ep_sq = (side == WHITE)?to-8:to+8;
     } else {
         pos->ep_sq = NO_SQUARE;
     }
@@ -420,45 +497,65 @@ bool pos_make_move(struct position *pos, uint32_t move)
     /* Remove piece from current position */
     remove_piece(pos, piece, from);
     pos->key = key_update_piece(pos->key, piece, from);
+    if (VALUE(piece) == PAWN) {
+        pos->pawnkey = key_update_piece(pos->pawnkey, piece, from);
+    }
 
     /* If necessary remove captured piece */
     if (ISCAPTURE(move)) {
         remove_piece(pos, capture, to);
         pos->key = key_update_piece(pos->key, capture, to);
+        if (VALUE(capture) == PAWN) {
+            pos->pawnkey = key_update_piece(pos->pawnkey, capture, to);
+        }
+        pos->matkey = key_update_material(pos->matkey, capture,
+                                    BITCOUNT(pos->bb_pieces[capture])+1);
         update_material(pos, capture, false);
     } else if (ISENPASSANT(move)) {
-        ep = (pos->stm == WHITE)?to-8:to+8;
-        remove_piece(pos, PAWN+FLIP_COLOR(pos->stm), ep);
-        pos->key = key_update_piece(pos->key, PAWN+FLIP_COLOR(pos->stm), ep);
-        update_material(pos, PAWN+FLIP_COLOR(pos->stm), false);
+        ep = (side == WHITE)?to-8:to+8;
+        remove_piece(pos, PAWN+FLIP_COLOR(side), ep);
+        pos->key = key_update_piece(pos->key, PAWN+FLIP_COLOR(side), ep);
+        pos->pawnkey = key_update_piece(pos->pawnkey,
+                                        PAWN+FLIP_COLOR(side), ep);
+        pos->matkey = key_update_material(pos->matkey,
+                    PAWN+FLIP_COLOR(side),
+                    BITCOUNT(pos->bb_pieces[PAWN+FLIP_COLOR(side)])+1);
+        update_material(pos, PAWN+FLIP_COLOR(side), false);
     }
 
     /* If this is a castling we have to remove the rook as well */
     if (ISKINGSIDECASTLE(move) || ISQUEENSIDECASTLE(move)) {
-        remove_piece(pos, pos->stm+ROOK, TO(move));
-        pos->key = key_update_piece(pos->key, pos->stm+ROOK, TO(move));
+        remove_piece(pos, side+ROOK, TO(move));
+        pos->key = key_update_piece(pos->key, side+ROOK, TO(move));
     }
 
     /* Add piece to new position */
     if (ISPROMOTION(move)) {
         add_piece(pos, promotion, to);
         pos->key = key_update_piece(pos->key, promotion, to);
+        pos->matkey = key_update_material(pos->matkey, piece,
+                                        BITCOUNT(pos->bb_pieces[piece])+1);
+        pos->matkey = key_update_material(pos->matkey, promotion,
+                                        BITCOUNT(pos->bb_pieces[promotion]));
         update_material(pos, piece, false);
         update_material(pos, promotion, true);
     } else {
         add_piece(pos, piece, to);
         pos->key = key_update_piece(pos->key, piece, to);
+        if (VALUE(piece) == PAWN) {
+            pos->pawnkey = key_update_piece(pos->pawnkey, piece, to);
+        }
     }
 
     /* If this is a castling we have to add the rook */
     if (ISKINGSIDECASTLE(move)) {
-        add_piece(pos, pos->stm+ROOK, (pos->stm==WHITE)?F1:F8);
-        pos->key = key_update_piece(pos->key, pos->stm+ROOK,
-                                    (pos->stm==WHITE)?F1:F8);
+        add_piece(pos, side+ROOK, (side==WHITE)?F1:F8);
+        pos->key = key_update_piece(pos->key, side+ROOK,
+                                    (side==WHITE)?F1:F8);
     } else if (ISQUEENSIDECASTLE(move)) {
-        add_piece(pos, pos->stm+ROOK, (pos->stm==WHITE)?D1:D8);
-        pos->key = key_update_piece(pos->key, pos->stm+ROOK,
-                                    (pos->stm==WHITE)?D1:D8);
+        add_piece(pos, side+ROOK, (side==WHITE)?D1:D8);
+        pos->key = key_update_piece(pos->key, side+ROOK,
+                                    (side==WHITE)?D1:D8);
     }
 
     /* Update the fifty move draw counter */
@@ -469,29 +566,44 @@ bool pos_make_move(struct position *pos, uint32_t move)
     }
 
     /* Update fullmove counter */
-    if (pos->stm == BLACK) {
+    if (side == BLACK) {
         pos->fullmove++;
     }
 
     /* Change side to move */
-    pos->stm = FLIP_COLOR(pos->stm);
+    pos->stm = FLIP_COLOR(side);
     pos->key = key_update_side(pos->key, pos->stm);
 
-    /* Prefetch hash table entries */
-    if (pos->engine != NULL) {
-        hash_prefetch(pos->worker);
-    }
+    /* Update check information for the new side to move */
+    pos_update_check_info(pos);
+}
+
+bool pos_make_move(struct position *pos, uint32_t move)
+{
+    assert(valid_position(pos));
+    assert(valid_move(move));
+    assert(pos_is_move_pseudo_legal(pos, move));
+    assert(pos->ply < MAX_MOVES);
 
     /*
-     * If the king was left in check then the move
-     * was illegal and should be undone.
+     * Reject illegal moves up front so that no time is
+     * spent on making and unmaking them.
      */
-    if (pos_in_check(pos, FLIP_COLOR(pos->stm))) {
-        pos_unmake_move(pos);
+    if (!pos_is_legal(pos, move)) {
         return false;
     }
 
+    if (pos->stm == WHITE) {
+        make_move(pos, move, WHITE);
+    } else {
+        make_move(pos, move, BLACK);
+    }
+
+    assert(!bb_is_attacked(pos, LSB(pos->bb_pieces[KING+FLIP_COLOR(pos->stm)]),
+                           pos->stm));
     assert(pos->key == key_generate(pos));
+    assert(pos->pawnkey == key_generate_pawnkey(pos));
+    assert(pos->matkey == key_generate_matkey(pos));
     assert(valid_position(pos));
 
     return true;
@@ -503,8 +615,6 @@ void pos_unmake_move(struct position *pos)
     uint32_t      move;
     int           to;
     int           from;
-    int           piece;
-    int           color;
     int           move_color;
 
     assert(valid_position(pos));
@@ -516,54 +626,39 @@ void pos_unmake_move(struct position *pos)
     pos->ep_sq = elem->ep_sq;
     pos->fifty = elem->fifty;
     pos->key = elem->key;
+    pos->pawnkey = elem->pawnkey;
+    pos->matkey = elem->matkey;
+    pos->checkers = elem->checkers;
+    pos->pinned = elem->pinned;
 
-    /* Extract some information for later use */
-    to = TO_CASTLE(move);
-    from = FROM(move);
-    color = pos->stm;
-    move_color = FLIP_COLOR(color);
-
-    /* Find the moving piece */
-    piece = pos->pieces[to];
-
-    /* Remove piece from current position */
-    if (ISPROMOTION(move)) {
-        remove_piece(pos, piece, to);
-        update_material(pos, piece, false);
-        piece = PAWN + move_color;
-        update_material(pos, piece, true);
-    } else {
-        remove_piece(pos, piece, to);
-    }
+    /* Restore the bitboards and the material score */
+    memcpy(pos->bb_pieces, elem->bb_pieces, sizeof(pos->bb_pieces));
+    memcpy(pos->bb_sides, elem->bb_sides, sizeof(pos->bb_sides));
+    pos->bb_all = elem->bb_all;
+    pos->material = elem->material;
 
     /*
-     * If this a castling then remove the rook
-     * from it's current position.
+     * Restore the squares changed by the move. The squares are updated
+     * in the reverse order compared to when the move was made since they
+     * can overlap for castling moves in FRC.
      */
+    to = TO_CASTLE(move);
+    from = FROM(move);
+    move_color = FLIP_COLOR(pos->stm);
+    pos->pieces[to] = NO_PIECE;
     if (ISKINGSIDECASTLE(move)) {
-        remove_piece(pos, move_color+ROOK, (move_color==WHITE)?F1:F8);
+        pos->pieces[(move_color==WHITE)?F1:F8] = NO_PIECE;
     } else if (ISQUEENSIDECASTLE(move)) {
-        remove_piece(pos, move_color+ROOK, (move_color==WHITE)?D1:D8);
+        pos->pieces[(move_color==WHITE)?D1:D8] = NO_PIECE;
     }
-
-    /* Add piece to previous position */
-    add_piece(pos, piece, from);
-
-    /* Restore captured piece if necessary */
+    pos->pieces[from] = elem->piece;
     if (ISCAPTURE(move)) {
-        add_piece(pos, elem->capture, to);
-        update_material(pos, elem->capture, true);
+        pos->pieces[to] = elem->capture;
     } else if (ISENPASSANT(move)) {
-        add_piece(pos, PAWN+color, (move_color==WHITE)?to-8:to+8);
-        update_material(pos, PAWN+color, true);
+        pos->pieces[(move_color==WHITE)?to-8:to+8] = PAWN+pos->stm;
     }
-
-    /*
-     * If this a castling then put the rook
-     * back on it's original position.
-     */
     if (ISKINGSIDECASTLE(move) || ISQUEENSIDECASTLE(move)) {
-        add_piece(pos, move_color+ROOK, TO(move));
+        pos->pieces[TO(move)] = move_color+ROOK;
     }
 
     /* Update fullmove counter */
@@ -575,6 +670,8 @@ void pos_unmake_move(struct position *pos)
     pos->stm = move_color;
 
     assert(pos->key == key_generate(pos));
+    assert(pos->pawnkey == key_generate_pawnkey(pos));
+    assert(pos->matkey == key_generate_matkey(pos));
     assert(valid_position(pos));
 }
 
@@ -594,6 +691,10 @@ void pos_make_null_move(struct position *pos)
     elem->ep_sq = pos->ep_sq;
     elem->fifty = pos->fifty;
     elem->key = pos->key;
+    elem->pawnkey = pos->pawnkey;
+    elem->matkey = pos->matkey;
+    elem->checkers = pos->checkers;
+    elem->pinned = pos->pinned;
 
     /* Update NNUE */
     nnue_make_null_move(pos);
@@ -610,10 +711,15 @@ void pos_make_null_move(struct position *pos)
 
     /* Prefetch hash table entries */
     if (pos->engine != NULL) {
-        hash_prefetch(pos->worker);
+        hash_prefetch(pos->worker, pos->key);
     }
 
+    /* Update check information for the new side to move */
+    pos_update_check_info(pos);
+
     assert(pos->key == key_generate(pos));
+    assert(pos->pawnkey == key_generate_pawnkey(pos));
+    assert(pos->matkey == key_generate_matkey(pos));
     assert(valid_position(pos));
 }
 
@@ -630,6 +736,10 @@ void pos_unmake_null_move(struct position *pos)
     pos->ep_sq = elem->ep_sq;
     pos->fifty = elem->fifty;
     pos->key = elem->key;
+    pos->pawnkey = elem->pawnkey;
+    pos->matkey = elem->matkey;
+    pos->checkers = elem->checkers;
+    pos->pinned = elem->pinned;
 
     /* Update the position */
     if (pos->stm == WHITE) {
@@ -638,6 +748,8 @@ void pos_unmake_null_move(struct position *pos)
     pos->stm = FLIP_COLOR(pos->stm);
 
     assert(pos->key == key_generate(pos));
+    assert(pos->pawnkey == key_generate_pawnkey(pos));
+    assert(pos->matkey == key_generate_matkey(pos));
     assert(valid_position(pos));
 }
 
@@ -654,9 +766,11 @@ bool pos_is_repetition(struct position *pos)
      * counter can be used here as well.
      *
      * Also there is no need to consider position where the other side is to
-     * move so only check every other position in the history.
+     * move so only check every other position in the history. A position
+     * can't be repeated in less than four plies so the most recent
+     * positions can be skipped.
      */
-    idx = pos->ply - 2;
+    idx = pos->ply - 4;
     while ((idx >= 0) && (idx >= (pos->ply - pos->fifty))) {
         if (pos->history[idx].key == pos->key) {
             return true;
@@ -667,6 +781,61 @@ bool pos_is_repetition(struct position *pos)
     return false;
 }
 
+bool pos_has_upcoming_repetition(struct position *pos)
+{
+    int      k;
+    int      end;
+    int      from;
+    int      to;
+    int      piece;
+    uint32_t move;
+
+    assert(valid_position(pos));
+
+    /*
+     * Only positions reached after the last irreversible move, and after
+     * the last null move, can be repeated. For each earlier position with
+     * the other side to move, check if the difference in keys corresponds
+     * to a reversible move.
+     */
+    end = MIN(pos->fifty, pos->ply);
+    for (k=1;k<=end;k++) {
+        if (ISNULLMOVE(pos->history[pos->ply-k].move)) {
+            break;
+        }
+        if (((k%2) == 0) || (k < 3)) {
+            continue;
+        }
+
+        move = key_find_reversible_move(pos->key^pos->history[pos->ply-k].key);
+        if (move == NOMOVE) {
+            continue;
+        }
+
+        /*
+         * The move can go in either direction. It has to be made by a
+         * piece belonging to the side to move and the path between the
+         * squares must be free.
+         */
+        from = FROM(move);
+        to = TO(move);
+        if (pos->pieces[from] == NO_PIECE) {
+            from = TO(move);
+            to = FROM(move);
+        }
+        piece = pos->pieces[from];
+        if ((piece == NO_PIECE) || (pos->pieces[to] != NO_PIECE) ||
+            (COLOR(piece) != pos->stm) || (VALUE(piece) == PAWN)) {
+            continue;
+        }
+        if (ISBITSET(bb_moves_for_piece(pos->bb_all, from, piece), to)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
 bool pos_has_non_pawn(struct position *pos, int side)
 {
     assert(valid_position(pos));
@@ -905,6 +1074,119 @@ bool pos_move_gives_check(struct position *pos, uint32_t move)
     return gives_check;
 }
 
+bool pos_is_legal(struct position *pos, uint32_t move)
+{
+    uint64_t occ;
+    int      kingsq;
+    int      from;
+    int      to;
+    int      opp;
+    int      sq;
+
+    assert(valid_position(pos));
+    assert(valid_move(move));
+    assert(pos_is_move_pseudo_legal(pos, move));
+
+    from = FROM(move);
+    to = TO(move);
+    opp = FLIP_COLOR(pos->stm);
+    kingsq = LSB(pos->bb_pieces[KING+pos->stm]);
+
+    /*
+     * The squares passed by the king are checked when testing if castling
+     * is allowed so only the final square has to be checked. In FRC the
+     * castling rook can be shielding the king so the test is done using
+     * the occupancy after the move.
+     */
+    if (ISKINGSIDECASTLE(move) || ISQUEENSIDECASTLE(move)) {
+        if (ISKINGSIDECASTLE(move)) {
+            to = kingside_castle_to[pos->stm];
+            sq = (pos->stm == WHITE)?F1:F8;
+        } else {
+            to = queenside_castle_to[pos->stm];
+            sq = (pos->stm == WHITE)?D1:D8;
+        }
+        occ = pos->bb_all&(~sq_mask[from])&(~sq_mask[TO(move)]);
+        occ |= (sq_mask[to]|sq_mask[sq]);
+        return bb_attacks_to(pos, occ, to, opp) == 0ULL;
+    }
+
+    /* The king is not allowed to move to an attacked square */
+    if (from == kingsq) {
+        occ = (pos->bb_all&(~sq_mask[from]))|sq_mask[to];
+        return bb_attacks_to(pos, occ, to, opp) == 0ULL;
+    }
+
+    /*
+     * An en passant capture removes two pieces from the same rank so
+     * it is tested using the occupancy after the move.
+     */
+    if (ISENPASSANT(move)) {
+        sq = (pos->stm == WHITE)?to-8:to+8;
+        occ = (pos->bb_all&(~sq_mask[from])&(~sq_mask[sq]))|sq_mask[to];
+        return (bb_attacks_to(pos, occ, kingsq, opp)&(~sq_mask[sq])) == 0ULL;
+    }
+
+    /* A pinned piece can only move along the line of the pin */
+    if (((pos->pinned&sq_mask[from]) != 0ULL) &&
+        ((range_mask[kingsq][from]&sq_mask[to]) == 0ULL)) {
+        return false;
+    }
+
+    /*
+     * When in check the checking piece has to be captured or
+     * the check blocked. In case of a double check only the
+     * king can move.
+     */
+    if (pos->checkers != 0ULL) {
+        if (BITCOUNT(pos->checkers) > 1) {
+            return false;
+        }
+        sq = LSB(pos->checkers);
+        return ((sq_mask[sq]|between_mask[kingsq][sq])&sq_mask[to]) != 0ULL;
+    }
+
+    return true;
+}
+
+void pos_update_check_info(struct position *pos)
+{
+    uint64_t snipers;
+    uint64_t blockers;
+    int      kingsq;
+    int      opp;
+    int      sq;
+
+    pos->checkers = 0ULL;
+    pos->pinned = 0ULL;
+    if (pos->bb_pieces[KING+pos->stm] == 0ULL) {
+        return;
+    }
+
+    kingsq = LSB(pos->bb_pieces[KING+pos->stm]);
+    opp = FLIP_COLOR(pos->stm);
+
+    pos->checkers = bb_attacks_to(pos, pos->bb_all, kingsq, opp);
+
+    /*
+     * Find enemy sliders that would attack the king if there were
+     * no other enemy pieces. If exactly one piece is in between and
+     * it belongs to the side to move then that piece is pinned.
+     */
+    snipers = bb_rook_moves(pos->bb_sides[opp], kingsq)&
+                    (pos->bb_pieces[ROOK+opp]|pos->bb_pieces[QUEEN+opp]);
+    snipers |= bb_bishop_moves(pos->bb_sides[opp], kingsq)&
+                    (pos->bb_pieces[BISHOP+opp]|pos->bb_pieces[QUEEN+opp]);
+    while (snipers != 0ULL) {
+        sq = POPBIT(&snipers);
+        blockers = between_mask[kingsq][sq]&pos->bb_all;
+        if ((BITCOUNT(blockers) == 1) &&
+            ((blockers&pos->bb_sides[pos->stm]) != 0ULL)) {
+            pos->pinned |= blockers;
+        }
+    }
+}
+
 bool pos_is_castling_allowed(struct position *pos, int type)
 {
     int      king_start;
@@ -1032,53 +1314,21 @@ bool pos_is_castling_allowed(struct position *pos, int type)
  */
 bool pos_has_mating_material(struct position *pos)
 {
-    int wb;
-    int wn;
-    int bb;
-    int bn;
-
-    if ((pos->bb_pieces[WHITE_PAWN] != 0ULL) ||
-        (pos->bb_pieces[BLACK_PAWN] != 0ULL) ||
-        (pos->bb_pieces[WHITE_ROOK] != 0ULL) ||
-        (pos->bb_pieces[BLACK_ROOK] != 0ULL) ||
-        (pos->bb_pieces[WHITE_QUEEN] != 0ULL) ||
-        (pos->bb_pieces[BLACK_QUEEN] != 0ULL)) {
-        return true;
-    }
-
-    wn = BITCOUNT(pos->bb_pieces[WHITE_KNIGHT]);
-    bn = BITCOUNT(pos->bb_pieces[BLACK_KNIGHT]);
-    wb = BITCOUNT(pos->bb_pieces[WHITE_BISHOP]);
-    bb = BITCOUNT(pos->bb_pieces[BLACK_BISHOP]);
-
-    /* King vs King */
-    if ((wn == 0) && (bn == 0) && (wb == 0) && (bb == 0)) {
-        return false;
-    }
-
-    /* Knight+King vs King */
-    if ((wn == 1) && (bn == 0) && (wb == 0) && (bb == 0)) {
-        return false;
-    }
+    struct material_item item;
+    uint64_t             bishops;
 
-    /* King vs King+Knight */
-    if ((wn == 0) && (bn == 1) && (wb == 0) && (bb == 0)) {
+    material_probe(pos, &item);
+    switch (item.mating) {
+    case MATING_IMPOSSIBLE:
         return false;
+    case MATING_BISHOP_COLORS:
+        bishops = pos->bb_pieces[WHITE_BISHOP]|pos->bb_pieces[BLACK_BISHOP];
+        return ((bishops&white_square_mask) != 0ULL) &&
+                                    ((bishops&black_square_mask) != 0ULL);
+    case MATING_POSSIBLE:
+    default:
+        return true;
     }
-
-    /* King+Bishops vs King */
-    if ((wn == 0) && (bn == 0) && (wb > 0) && (bb == 0)) {
-        return (((pos->bb_pieces[WHITE_BISHOP]&white_square_mask) != 0ULL) &&
-                    ((pos->bb_pieces[WHITE_BISHOP]&black_square_mask) != 0ULL));
-    }
-
-    /* King vs King+Bishops */
-    if ((wn == 0) && (bn == 0) && (wb == 0) && (bb > 0)) {
-        return (((pos->bb_pieces[BLACK_BISHOP]&white_square_mask) != 0ULL) &&
-                    ((pos->bb_pieces[BLACK_BISHOP]&black_square_mask) != 0ULL));
-    }
-
-    return true;
 }
 
 bool pos_is_draw_by_rule(struct position *pos)
@@ -37,6 +37,16 @@ enum game_result {
  */
 void pos_reset(struct position *pos);
 
+/*
+ * Copy the state needed to search from a root position. Only the board,
+ * the game history back to the last irreversible move and the evaluation
+ * information for the root node are copied.
+ *
+ * @param dst The position to copy to.
+ * @param src The root position to copy from.
+ */
+void pos_copy_root(struct position *dst, struct position *src);
+
 /*
  * Initialize a board structure to the chess starting posuition.
  *
@@ -119,6 +129,15 @@ void pos_unmake_null_move(struct position *pos);
  */
 bool pos_is_repetition(struct position *pos);
 
+/*
+ * Check if the side to move can reach a repetition of an earlier
+ * position with a single reversible move.
+ *
+ * @param pos The chess board.
+ * @return Returns true if there is a move that repeats a position.
+ */
+bool pos_has_upcoming_repetition(struct position *pos);
+
 /*
  * Check if a specific player has a non-pawn, non-king piece.
  *
@@ -136,6 +155,26 @@ bool pos_has_non_pawn(struct position *pos, int side);
  */
 bool pos_is_move_pseudo_legal(struct position *pos, uint32_t move);
 
+/*
+ * Check if a pseudo-legal move is legal, i.e. if it doesn't leave the own
+ * king in check. The check uses the checkers and pinned pieces of the
+ * position so the move doesn't have to be made.
+ *
+ * @param pos The chess board.
+ * @param move The move to check. The move must be pseudo-legal.
+ * @return Returns true if the move is legal.
+ */
+bool pos_is_legal(struct position *pos, uint32_t move);
+
+/*
+ * Update the checkers and pinned pieces for the side to move. This must be
+ * called after the board has been setup by some other means than making
+ * moves.
+ *
+ * @param pos The chess board.
+ */
+void pos_update_check_info(struct position *pos);
+
 /*
  * Check if a move is a checking move.
  *
@@ -42,6 +42,9 @@
 #include "nnue.h"
 #include "data.h"
 #include "smp.h"
+#include "stats.h"
+#include "trace.h"
+#include "cluster.h"
 
 /* Calculates if it is time to check the clock and poll for commands */
 #define CHECKUP(n) (((n)&1023)==0)
@@ -84,9 +87,34 @@ static int lmp_counts[] = {0, 4, 6, 8, 12, 17, 24, 33, 44, 57, 72};
 static int counter_history_pruning_margin[] = {0, 0, -500, -1000};
 static int followup_history_pruning_margin[] = {0, -500, -1000, -2000};
 
+/* Configuration constants for ABDADA move deferral */
+#define ABDADA_DEPTH 3
+#define MAX_DEFERRED_MOVES 32
+
 /* Table of base reductions for LMR indexed by depth and move number */
 static int lmr_reductions[64][64];
 
+static int static_evaluation(struct search_worker *worker, bool tt_found,
+                             struct tt_item *tt_item)
+{
+    struct position *pos = &worker->pos;
+
+    if (!pos_has_mating_material(pos)) {
+        return 0;
+    }
+
+    /*
+     * The transposition table keeps the static evaluation
+     * so there is no need to evaluate the position again.
+     */
+    if (tt_found) {
+        return tt_item->eval;
+    }
+
+    worker->evals++;
+    return eval_evaluate(pos, false);
+}
+
 static bool check_tt_cutoff(struct tt_item *item, int depth, int alpha,
                             int beta, int score)
 {
@@ -122,23 +150,23 @@ static int adjust_mate_score(struct position *pos, int score)
     return score;
 }
 
-static bool is_multipv_move(struct search_worker *worker, uint32_t move)
-{
-    int k;
 
-    for (k=0;k<worker->mpvidx;k++) {
-        if (move == worker->mpv_moves[k]) {
-            return true;
-        }
-    }
-    return false;
+/*
+ * Get the number of moves in the move filter. The filter can be replaced
+ * by a background root probe during the search, see apply_root_probe,
+ * so the size is read with acquire semantics.
+ */
+static int move_filter_size(struct engine *engine)
+{
+    return __atomic_load_n(&engine->move_filter.size, __ATOMIC_ACQUIRE);
 }
 
 static bool is_filtered_move(struct search_worker *worker, uint32_t move)
 {
+    int size = move_filter_size(worker->engine);
     int k;
 
-    for (k=0;k<worker->engine->move_filter.size;k++) {
+    for (k=0;k<size;k++) {
         if (move == worker->engine->move_filter.moves[k]) {
             return true;
         }
@@ -174,62 +202,246 @@ static bool is_recapture(struct position *pos, uint32_t move)
     return false;
 }
 
+/*
+ * Get the part of the triangular PV table used for a specific ply. The
+ * variations are stored back to back with each one being one move
+ * shorter than the previous.
+ */
+static uint32_t* pv_row(struct search_worker *worker, int height)
+{
+    return &worker->pv_table[height*(MAX_PLY) - height*(height-1)/2];
+}
+
 static void update_pv(struct search_worker *worker, uint32_t move)
 {
-    struct position *pos;
-
-    pos = &worker->pos;
-    worker->pv_table[pos->height].moves[0] = move;
-    memcpy(&worker->pv_table[pos->height].moves[1],
-           &worker->pv_table[pos->height+1].moves[0],
-           worker->pv_table[pos->height+1].size*sizeof(uint32_t));
-    worker->pv_table[pos->height].size =
-                                    worker->pv_table[pos->height+1].size + 1;
+    uint32_t *row;
+    int      height;
+    int      length;
+
+    height = worker->pos.height;
+    row = pv_row(worker, height);
+    length = worker->pv_length[height+1];
+    assert(length < (MAX_PLY)-height);
+
+    row[0] = move;
+    memcpy(&row[1], pv_row(worker, height+1), length*sizeof(uint32_t));
+    worker->pv_length[height] = length + 1;
+}
+
+static void copy_pv(struct search_worker *worker, struct pvline *to)
+{
+    to->size = worker->pv_length[0];
+    memcpy(to->moves, pv_row(worker, 0), to->size*sizeof(uint32_t));
+}
+
+/*
+ * Insert the principle variation of the root node into the list of
+ * the best lines found in the current iteration. The list is sorted on
+ * score and only the best lines are kept.
+ */
+static void add_root_line(struct search_worker *worker, int score)
+{
+    int k;
+
+    if (worker->nroot_lines < worker->multipv) {
+        k = worker->nroot_lines++;
+    } else {
+        k = worker->multipv - 1;
+    }
+    while ((k > 0) && (worker->root_lines[k-1].score < score)) {
+        worker->root_lines[k] = worker->root_lines[k-1];
+        k--;
+    }
+
+    copy_pv(worker, &worker->root_lines[k].pv);
+    worker->root_lines[k].score = score;
+    worker->root_lines[k].depth = worker->depth;
+    worker->root_lines[k].seldepth = worker->seldepth;
+}
+
+/*
+ * Order a list of root moves based on an earlier search. The best move
+ * is placed first and the remaining moves are ordered by the number of
+ * nodes spent on them, which is usually larger for moves that are harder
+ * to refute.
+ */
+static void order_root_moves(struct root_move *moves, int nmoves,
+                             uint32_t best_move)
+{
+    struct root_move tmp;
+    int              k;
+    int              l;
+
+    for (k=1;k<nmoves;k++) {
+        tmp = moves[k];
+        for (l=k;l>0 && moves[l-1].nodes<tmp.nodes;l--) {
+            moves[l] = moves[l-1];
+        }
+        moves[l] = tmp;
+    }
+
+    for (k=0;k<nmoves;k++) {
+        if (moves[k].move == best_move) {
+            tmp = moves[k];
+            for (l=k;l>0;l--) {
+                moves[l] = moves[l-1];
+            }
+            moves[0] = tmp;
+            break;
+        }
+    }
 }
 
-void copy_pv(struct movelist *from, struct movelist *to)
+static void add_root_move_nodes(struct search_worker *worker, uint32_t move,
+                                uint64_t nodes)
 {
     int k;
 
-    to->size = from->size;
-    for (k=0;k<from->size;k++) {
-        to->moves[k] = from->moves[k];
+    for (k=0;k<worker->nroot_moves;k++) {
+        if (worker->root_moves[k].move == move) {
+            worker->root_moves[k].nodes += nodes;
+            break;
+        }
+    }
+}
+
+static thread_retval_t root_probe_func(void *data)
+{
+    struct engine     *engine = data;
+    struct root_probe *probe = &engine->root_probe;
+
+    probe->found = egtb_probe_dtz_tables(&engine->pos, &probe->move,
+                                         &probe->score);
+    atomic_store(&probe->done, true);
+
+    return (thread_retval_t)0;
+}
+
+/*
+ * Start probing the DTZ tables for the root position in the background.
+ * The position of the engine must not be changed until the probe has
+ * been finished.
+ */
+static void start_root_probe(struct engine *engine)
+{
+    struct root_probe *probe = &engine->root_probe;
+
+    atomic_store(&probe->done, false);
+    probe->applied = false;
+    probe->found = false;
+    probe->started = true;
+    thread_create(&probe->thread, root_probe_func, engine);
+}
+
+/*
+ * Apply the result of a finished root probe. If the position was found
+ * then only the move suggested by the tablebases is searched from now on.
+ * Otherwise probing of the WDL tables, which is turned off while the probe
+ * is running since Fathom doesn't allow other probes at the same time,
+ * is turned back on. Called by the master worker, or by the engine thread
+ * after the search.
+ *
+ * The other workers read the move filter and the WDL flag while searching
+ * so the move is stored before the size of the filter is published.
+ */
+static void apply_root_probe(struct engine *engine)
+{
+    struct root_probe *probe = &engine->root_probe;
+
+    probe->applied = true;
+    if (!probe->found) {
+        __atomic_store_n(&engine->probe_wdl, true, __ATOMIC_RELEASE);
+        return;
+    }
+
+    engine->root_tb_score = probe->score;
+    engine->root_in_tb = true;
+    engine->move_filter.moves[0] = probe->move;
+    __atomic_store_n(&engine->move_filter.size, 1, __ATOMIC_RELEASE);
+}
+
+static void finish_root_probe(struct engine *engine)
+{
+    struct root_probe *probe = &engine->root_probe;
+
+    if (!probe->started) {
+        return;
+    }
+
+    thread_join(&probe->thread);
+    probe->started = false;
+    if (!probe->applied) {
+        apply_root_probe(engine);
     }
 }
 
 static void checkup(struct search_worker *worker)
 {
+    struct engine *engine = worker->engine;
+
     /* Check if the worker is requested to stop */
-    if (smp_should_stop()) {
+    if (smp_should_stop(engine)) {
         longjmp(worker->env, 1);
     }
 
+    /* Make the node counters of this worker visible to the other threads */
+    smp_publish_counters(worker, false);
+
+    /*
+     * In reproducible mode each worker has its own node limit and
+     * stopping doesn't affect the other workers. Only new commands
+     * can stop the whole search.
+     */
+    if (engine->reproducible) {
+        if (((tc_get_flags(engine)&TC_NODE_LIMIT) != 0) &&
+            (worker->nodes >= engine->max_nodes)) {
+            longjmp(worker->env, 1);
+        }
+        if ((worker->id == 0) && engine_check_input(worker)) {
+            smp_stop_all(engine);
+            longjmp(worker->env, 1);
+        }
+        return;
+    }
+
     /* Only check time limits for the main worker */
     if (worker->id != 0) {
         return;
     }
 
-    /* Check if the node limit has been reached */
-    if (((tc_get_flags()&TC_NODE_LIMIT) != 0) &&
-        (smp_nodes() >= worker->engine->max_nodes)) {
-        smp_stop_all();
+    /*
+     * Check if the node limit has been reached. The nodes of this worker
+     * that have not been published yet are included so that the limit
+     * is exact when searching with a single thread.
+     */
+    if (((tc_get_flags(engine)&TC_NODE_LIMIT) != 0) &&
+        ((smp_nodes(engine)+worker->nodes-worker->published_nodes) >=
+                                                        engine->max_nodes)) {
+        smp_stop_all(engine);
         longjmp(worker->env, 1);
     }
 
-    /* Check if the time is up or if a new command have been received */
+    /*
+     * Check if a new command have been received. This only reads a flag
+     * set by the input thread so it is cheap enough to do for every node.
+     */
+    if (engine_check_input(worker)) {
+        smp_stop_all(engine);
+        longjmp(worker->env, 1);
+    }
+
+    /* Check if the time is up */
     if (!CHECKUP(worker->nodes)) {
         return;
     }
-
-    /* Perform checkup */
-    if (!worker->engine->pondering &&
-        ((tc_get_flags()&TC_TIME_LIMIT) != 0) &&
-        !tc_check_time(worker)) {
-        smp_stop_all();
-        longjmp(worker->env, 1);
+    if (engine->root_probe.started && !engine->root_probe.applied &&
+        atomic_load(&engine->root_probe.done)) {
+        apply_root_probe(engine);
     }
-    if (engine_check_input(worker)) {
-        smp_stop_all();
+    if (!engine->pondering &&
+        ((tc_get_flags(engine)&TC_TIME_LIMIT) != 0) &&
+        !tc_check_time(worker)) {
+        smp_stop_all(engine);
         longjmp(worker->env, 1);
     }
 }
@@ -264,16 +476,41 @@ static int quiescence(struct search_worker *worker, int depth, int alpha,
     checkup(worker);
 
     /* Reset the search tree for this ply */
-    worker->pv_table[pos->height].size = 0;
+    worker->pv_length[pos->height] = 0;
 
     /* Check if we should considered the game as a draw */
     if (pos_is_repetition(pos) || (pos->fifty >= 100)) {
         return 0;
     }
 
-    /* Evaluate the position */
-    static_score = pos_has_mating_material(pos)?eval_evaluate(pos, false):0;
+    /*
+     * If the side to move can repeat an earlier position then
+     * the score is at least a draw.
+     */
+    if ((alpha < 0) && pos_has_upcoming_repetition(pos)) {
+        alpha = 0;
+        if (alpha >= beta) {
+            return alpha;
+        }
+    }
+
+    /*
+     * Check if the position have been searched before. The static
+     * evaluation stored in the item can be used to avoid evaluating
+     * the position again.
+     */
+    tt_found = hash_tt_lookup(pos, &tt_item);
+
+    /*
+     * Evaluate the position. Most quiescence nodes are never stored
+     * in the transposition table so store the evaluation in order to
+     * reuse it if the position is reached again.
+     */
+    static_score = static_evaluation(worker, tt_found, &tt_item);
     pos->eval_stack[pos->height].score = static_score;
+    if (!tt_found) {
+        hash_tt_store(pos, NOMOVE, 0, 0, TT_EVAL_ONLY, static_score);
+    }
 
     /* If we have reached the maximum depth then we stop */
     if (pos->height >= (MAX_PLY-1)) {
@@ -297,11 +534,11 @@ static int quiescence(struct search_worker *worker, int depth, int alpha,
         }
     }
 
-    /* Check if the position have been searched before */
-    tt_found = hash_tt_lookup(pos, &tt_item);
+    /* Check if the transposition table entry allows a cutoff */
     if (tt_found) {
         score = adjust_mate_score(pos, tt_item.score);
         if (check_tt_cutoff(&tt_item, 0, alpha, beta, score)) {
+            STATS_INC(worker, tt_cutoffs);
             return score;
         }
     }
@@ -363,7 +600,7 @@ static int search(struct search_worker *worker, int depth, int alpha, int beta,
     struct position     *pos = &worker->pos;
     int                 in_check;
     int                 new_depth;
-    struct movelist     quiets;
+    struct movelist     *quiets;
     bool                tt_found;
     struct tt_item      tt_item;
     uint32_t            tt_move;
@@ -387,6 +624,17 @@ static int search(struct search_worker *worker, int depth, int alpha, int beta,
     bool                is_singular;
     bool                futility_pruning;
     bool                found_move;
+    bool                multipv_root;
+    bool                use_root_moves;
+    int                 root_idx;
+    uint64_t            move_nodes;
+    bool                defer_moves;
+    bool                deferred_pass;
+    uint32_t            deferred[MAX_DEFERRED_MOVES];
+    int                 ndeferred;
+    int                 deferred_idx;
+    uint64_t            child_key;
+    int                 k;
 
     /* Set node type */
     pv_node = (beta-alpha) > 1;
@@ -413,7 +661,7 @@ static int search(struct search_worker *worker, int depth, int alpha, int beta,
     }
 
     /* Reset the search tree for this ply */
-    worker->pv_table[pos->height].size = 0;
+    worker->pv_length[pos->height] = 0;
 
     /*
      * Check if the game should be considered a draw. A position is
@@ -426,6 +674,17 @@ static int search(struct search_worker *worker, int depth, int alpha, int beta,
         return 0;
     }
 
+    /*
+     * If the side to move can repeat an earlier position then
+     * the score is at least a draw.
+     */
+    if (!is_root && (alpha < 0) && pos_has_upcoming_repetition(pos)) {
+        alpha = 0;
+        if (alpha >= beta) {
+            return alpha;
+        }
+    }
+
     /*
      * Check the main transposition table to see if the positon
      * have been searched before. If this a singular extension
@@ -442,12 +701,15 @@ static int search(struct search_worker *worker, int depth, int alpha, int beta,
         tt_score = adjust_mate_score(pos, tt_item.score);
         if (!pv_node && (tt_move != exclude_move) &&
             check_tt_cutoff(&tt_item, depth, alpha, beta, tt_score)) {
+            STATS_INC(worker, tt_cutoffs);
             return tt_score;
         }
     }
 
     /* Probe tablebases */
-    if (!is_root && worker->engine->probe_wdl && egtb_should_probe(pos)) {
+    if (!is_root &&
+        __atomic_load_n(&worker->engine->probe_wdl, __ATOMIC_ACQUIRE) &&
+        egtb_should_probe(pos)) {
         if (egtb_probe_wdl_tables(pos, &tb_score)) {
             worker->tbhits++;
             if (check_tb_cutoff(tb_score, alpha, beta)) {
@@ -460,7 +722,7 @@ static int search(struct search_worker *worker, int depth, int alpha, int beta,
      * Evaluate the position in order to get a score
      * to use for pruning decisions.
      */
-    static_score = pos_has_mating_material(pos)?eval_evaluate(pos, false):0;
+    static_score = static_evaluation(worker, tt_found, &tt_item);
     pos->eval_stack[pos->height].score = static_score;
     improving = (pos->height >= 2 &&
                         static_score > pos->eval_stack[pos->height-2].score);
@@ -476,6 +738,7 @@ static int search(struct search_worker *worker, int depth, int alpha, int beta,
         if ((depth <= FUTILITY_DEPTH) && !in_check && !pv_node &&
             pos_has_non_pawn(pos, pos->stm) &&
             ((static_score-futility_margin[depth]) >= beta)) {
+            STATS_INC(worker, rfp_prunes);
             return static_score;
         }
 
@@ -508,6 +771,7 @@ static int search(struct search_worker *worker, int depth, int alpha, int beta,
             !in_check &&
             (depth > NULLMOVE_DEPTH) &&
             pos_has_non_pawn(pos, pos->stm)) {
+            STATS_INC(worker, null_tries);
             reduction = NULLMOVE_BASE_REDUCTION + depth/NULLMOVE_DIVISOR;
             pos_make_null_move(pos);
             score = -search(worker, depth-reduction-1, -beta, -beta+1, false,
@@ -519,6 +783,7 @@ static int search(struct search_worker *worker, int depth, int alpha, int beta,
                  * score doesn't necessarilly indicate a forced mate. So
                  * return beta instead in this case.
                  */
+                STATS_INC(worker, null_cutoffs);
                 return score < KNOWN_WIN?score:beta;
             }
         }
@@ -557,6 +822,7 @@ static int search(struct search_worker *worker, int depth, int alpha, int beta,
                                 -threshold+1, true, NOMOVE);
                 pos_unmake_move(pos);
                 if (score >= threshold) {
+                    STATS_INC(worker, probcut_cutoffs);
                     return score;
                 }
             }
@@ -569,7 +835,8 @@ static int search(struct search_worker *worker, int depth, int alpha, int beta,
             (tt_item.type == TT_BETA) &&
             (tt_item.depth >= (depth-3)) &&
             (abs(beta) < KNOWN_WIN) &&
-            pos_is_move_pseudo_legal(pos, tt_move)) {
+            pos_is_move_pseudo_legal(pos, tt_move) &&
+            pos_is_legal(pos, tt_move)) {
             threshold = tt_score-2*depth;
 
             score = search(worker, depth/2, threshold-1, threshold, true,
@@ -592,18 +859,60 @@ static int search(struct search_worker *worker, int depth, int alpha, int beta,
     }
 
     /* Search all moves */
-    quiets.size = 0;
+    quiets = &worker->quiet_stack[pos->height];
+    quiets->size = 0;
     tt_flag = TT_ALPHA;
     best_score = -INFINITE_SCORE;
     movenumber = 0;
     found_move = false;
+    defer_moves = engine_abdada && (worker->engine->pool.nworkers > 1) &&
+                  !worker->engine->reproducible && !is_root &&
+                  (depth >= ABDADA_DEPTH);
+    deferred_pass = false;
+    ndeferred = 0;
+    deferred_idx = 0;
+    multipv_root = is_root && (worker->multipv > 1);
+    use_root_moves = multipv_root || (is_root && worker->ordered_root);
+    root_idx = 0;
+    if (multipv_root) {
+        worker->nroot_lines = 0;
+    }
+    if (is_root) {
+        worker->root_nodes = worker->nodes;
+        worker->best_move_nodes = 0ULL;
+    }
+    if (use_root_moves && !multipv_root) {
+        order_root_moves(worker->root_moves, worker->nroot_moves,
+                         (worker->mpv_moves[0] != NOMOVE)?
+                            worker->mpv_moves[0]:worker->root_moves[0].move);
+    }
     select_init_node(&ms, worker, false, in_check, tt_move, false, NO_SQUARE,
                      depth);
-    while (select_get_move(&ms, worker, &move)) {
-        if (is_root && (worker->multipv > 1) && is_multipv_move(worker, move)) {
-            continue;
+    while (true) {
+        /*
+         * When all moves have been tried the moves that were deferred
+         * because another worker was searching them are searched.
+         */
+        if (use_root_moves) {
+            /*
+             * When searching several PV lines the root moves are searched
+             * in the order given by the scores from the previous iteration.
+             * When the root was seeded from an earlier search they are
+             * searched in the order given by the number of nodes.
+             */
+            if (root_idx >= worker->nroot_moves) {
+                break;
+            }
+            move = worker->root_moves[root_idx++].move;
+        } else if (deferred_pass || !select_get_move(&ms, worker, &move)) {
+            if (deferred_idx >= ndeferred) {
+                break;
+            }
+            deferred_pass = true;
+            move = deferred[deferred_idx++];
         }
-        if (is_root && (worker->engine->move_filter.size > 0) &&
+
+        if (is_root && (move_filter_size(worker->engine) > 0) &&
             !is_filtered_move(worker, move)) {
             continue;
         }
@@ -623,7 +932,7 @@ static int search(struct search_worker *worker, int depth, int alpha, int beta,
 
         /* Remeber all quiet moves */
         if (!ISTACTICAL(move)) {
-            quiets.moves[quiets.size++] = move;
+            quiets->moves[quiets->size++] = move;
         }
 
         /* Pruning of moves at low depths */
@@ -633,6 +942,7 @@ static int search(struct search_worker *worker, int depth, int alpha, int beta,
              * tactical ones.
              */
             if (futility_pruning && !tactical) {
+                STATS_INC(worker, futility_prunes);
                 continue;
             }
 
@@ -646,21 +956,25 @@ static int search(struct search_worker *worker, int depth, int alpha, int beta,
                 (movenumber > lmp_counts[depth]) &&
                 (abs(alpha) < KNOWN_WIN) &&
                 !tactical) {
+                STATS_INC(worker, lmp_prunes);
                 continue;
             }
 
             /* Prune moves that lose material according to SEE */
             if (depth < SEE_PRUNE_DEPTH &&
                 !see_ge(pos, move, see_prune_margin[tactical])) {
+                STATS_INC(worker, see_prunes);
                 continue;
             }
 
             /* Prune moves based on continuation history */
             if (!tactical && (depth <= HISTORY_PRUNING_DEPTH)) {
                 if (chist < counter_history_pruning_margin[depth]) {
+                    STATS_INC(worker, history_prunes);
                     continue;
                 }
                 if (fhist < followup_history_pruning_margin[depth]) {
+                    STATS_INC(worker, history_prunes);
                     continue;
                 }
             }
@@ -696,8 +1010,30 @@ static int search(struct search_worker *worker, int depth, int alpha, int beta,
         if (!pos_make_move(pos, move)) {
             continue;
         }
+
+        /*
+         * ABDADA. If the resulting position is already being searched
+         * by another worker then postpone the move until all other
+         * moves have been searched. By then the other worker has hopefully
+         * finished and the result can be picked up from the
+         * transposition table. The first move is always searched directly.
+         */
+        if (defer_moves && !deferred_pass && (movenumber > 0) &&
+            (ndeferred < MAX_DEFERRED_MOVES) && smp_is_busy(worker, pos->key)) {
+            pos_unmake_move(pos);
+            if (!ISTACTICAL(move)) {
+                quiets->size--;
+            }
+            deferred[ndeferred++] = move;
+            continue;
+        }
+        child_key = pos->key;
+        if (defer_moves) {
+            smp_set_busy(worker, child_key);
+        }
         movenumber++;
         found_move = true;
+        move_nodes = worker->nodes;
 
         /* Send stats for the first worker */
         if (is_root && worker->id == 0)  {
@@ -719,10 +1055,12 @@ static int search(struct search_worker *worker, int depth, int alpha, int beta,
 
         /* Recursivly search the move */
         reduction = CLAMP(reduction, 0, new_depth-1);
-        if (best_score == -INFINITE_SCORE) {
+        if ((best_score == -INFINITE_SCORE) ||
+            (multipv_root && (worker->nroot_lines < worker->multipv))) {
             /*
              * Perform a full search until a pv move is found. Usually
-             * this is the first move.
+             * this is the first move. When searching several PV lines
+             * a full search is done until all lines have been found.
              */
             score = -search(worker, new_depth-1, -beta, -alpha, true, NOMOVE);
         } else {
@@ -747,6 +1085,34 @@ static int search(struct search_worker *worker, int depth, int alpha, int beta,
             }
         }
         pos_unmake_move(pos);
+        if (defer_moves) {
+            smp_clear_busy(worker, child_key);
+        }
+        if (is_root) {
+            add_root_move_nodes(worker, move, worker->nodes-move_nodes);
+        }
+
+        /*
+         * When searching several PV lines at the root alpha is the score
+         * of the worst of the best lines found so far. A move that beats
+         * alpha replaces that line.
+         */
+        if (multipv_root) {
+            worker->root_moves[root_idx-1].score = score;
+            if ((worker->nroot_lines < worker->multipv) || (score > alpha)) {
+                update_pv(worker, move);
+                add_root_line(worker, score);
+                tt_flag = TT_EXACT;
+                if (worker->nroot_lines == worker->multipv) {
+                    alpha = worker->root_lines[worker->multipv-1].score;
+                }
+            }
+            if (score > best_score) {
+                best_score = score;
+                best_move = move;
+            }
+            continue;
+        }
 
         /* Check if a new best move have been found */
         if (score > best_score) {
@@ -769,6 +1135,10 @@ static int search(struct search_worker *worker, int depth, int alpha, int beta,
                             counter_add_move(worker, move);
                         }
                     }
+                    STATS_INC(worker, fail_highs);
+                    if (movenumber == 1) {
+                        STATS_INC(worker, first_move_fail_highs);
+                    }
                     tt_flag = TT_BETA;
                     break;
                 }
@@ -788,14 +1158,18 @@ static int search(struct search_worker *worker, int depth, int alpha, int beta,
                  * window since it's only then that the score can be trusted.
                  */
                 if (is_root) {
-                    worker->mpv_moves[worker->mpvidx] = move;
-                    copy_pv(&worker->pv_table[0],
-                            &worker->mpv_lines[worker->mpvidx].pv);
-                    worker->mpv_lines[worker->mpvidx].score = score;
-                    worker->mpv_lines[worker->mpvidx].depth = worker->depth;
-                    worker->mpv_lines[worker->mpvidx].seldepth =
-                                                            worker->seldepth;
-                    if ((worker->id == 0) && (worker->multipv == 1)) {
+                    worker->best_move_nodes = worker->nodes - move_nodes;
+                    if (worker->mpv_moves[0] != move) {
+                        trace_event(worker, TRACE_ROOT_MOVE, TRACE_INSTANT,
+                                    worker->depth, (int)move);
+                    }
+                    worker->mpv_moves[0] = move;
+                    copy_pv(worker, &worker->mpv_lines[0].pv);
+                    worker->mpv_lines[0].score = score;
+                    worker->mpv_lines[0].depth = worker->depth;
+                    worker->mpv_lines[0].seldepth = worker->seldepth;
+                    if (worker->id == 0) {
+                        smp_publish_counters(worker, true);
                         engine_send_pv_info(worker->engine,
                                             &worker->mpv_lines[0]);
                     }
@@ -804,9 +1178,21 @@ static int search(struct search_worker *worker, int depth, int alpha, int beta,
         }
     }
 
+    /* Publish the lines found when searching several PV lines */
+    if (multipv_root && (worker->nroot_lines > 0)) {
+        if (worker->mpv_moves[0] != worker->root_lines[0].pv.moves[0]) {
+            trace_event(worker, TRACE_ROOT_MOVE, TRACE_INSTANT, worker->depth,
+                        (int)worker->root_lines[0].pv.moves[0]);
+        }
+        for (k=0;k<worker->nroot_lines;k++) {
+            worker->mpv_lines[k] = worker->root_lines[k];
+            worker->mpv_moves[k] = worker->root_lines[k].pv.moves[0];
+        }
+    }
+
     /* If the best move is a quiet move then update the history table */
     if (!ISTACTICAL(best_move) && (tt_flag == TT_BETA)) {
-        history_update_tables(worker, &quiets, depth);
+        history_update_tables(worker, quiets, depth);
     }
 
     /*
@@ -823,7 +1209,7 @@ static int search(struct search_worker *worker, int depth, int alpha, int beta,
     }
 
     /* Store the result for this node in the transposition table */
-    hash_tt_store(pos, best_move, depth, best_score, tt_flag);
+    hash_tt_store(pos, best_move, depth, best_score, tt_flag, static_score);
 
     return best_score;
 }
@@ -876,7 +1262,10 @@ static void search_aspiration_window(struct search_worker *worker, int depth,
             }
             alpha = score - awindow;
             worker->resolving_root_fail = true;
-            if ((worker->id == 0) && (worker->multipv == 1)) {
+            trace_event(worker, TRACE_FAIL_LOW, TRACE_INSTANT, depth, score);
+            if (worker->id == 0) {
+                tc_report_fail_low(worker);
+                smp_publish_counters(worker, true);
                 engine_send_bound_info(worker, score, false);
             }
             continue;
@@ -888,7 +1277,9 @@ static void search_aspiration_window(struct search_worker *worker, int depth,
                 bwindow = INFINITE_SCORE;
             }
             beta = score + bwindow;
+            trace_event(worker, TRACE_FAIL_HIGH, TRACE_INSTANT, depth, score);
             if (worker->id == 0) {
+                smp_publish_counters(worker, true);
                 engine_send_bound_info(worker, score, true);
             }
             continue;
@@ -898,39 +1289,202 @@ static void search_aspiration_window(struct search_worker *worker, int depth,
     }
 }
 
-static thread_retval_t worker_search_func(void *data)
+static void init_root_moves(struct search_worker *worker)
+{
+    struct root_history *history = &worker->engine->root_history;
+    struct movelist     legal;
+    int                 nseeded;
+    int                 k;
+    int                 l;
+
+    worker->nroot_moves = 0;
+    gen_legal_moves(&worker->pos, &legal);
+    for (k=0;k<legal.size;k++) {
+        if ((move_filter_size(worker->engine) > 0) &&
+            !is_filtered_move(worker, legal.moves[k])) {
+            continue;
+        }
+        worker->root_moves[worker->nroot_moves].move = legal.moves[k];
+        worker->root_moves[worker->nroot_moves].score = -INFINITE_SCORE;
+        worker->root_moves[worker->nroot_moves].nodes = 0ULL;
+        worker->nroot_moves++;
+    }
+
+    /*
+     * If the root was seeded from an earlier search then take the order
+     * of the moves, and the number of nodes spent on them, from that
+     * search.
+     */
+    nseeded = 0;
+    if (history->key == worker->pos.key) {
+        for (k=0;k<history->nmoves;k++) {
+            for (l=nseeded;l<worker->nroot_moves;l++) {
+                if (worker->root_moves[l].move != history->moves[k].move) {
+                    continue;
+                }
+                worker->root_moves[l] = worker->root_moves[nseeded];
+                worker->root_moves[nseeded] = history->moves[k];
+                worker->root_moves[nseeded].score = -INFINITE_SCORE;
+                nseeded++;
+                break;
+            }
+        }
+    }
+    worker->ordered_root = nseeded > 0;
+}
+
+/*
+ * Check if the previous search can be used to seed the search of the
+ * current position. This is the case if the same position was searched,
+ * or if the position is the one expected after the best move and the
+ * reply. In the latter case only the next move of the PV is known.
+ */
+static void prepare_root_history(struct engine *engine)
+{
+    struct root_history *history = &engine->root_history;
+    struct position     *pos = &engine->pos;
+
+    if (history->key == pos->key) {
+        history->nplies = 0;
+        return;
+    }
+
+    if ((pos->ply >= 2) && (history->pv.size >= 3) &&
+        (pos->history[pos->ply-2].key == history->key) &&
+        (pos->history[pos->ply-2].move == history->pv.moves[0]) &&
+        (pos->history[pos->ply-1].move == history->pv.moves[1])) {
+        history->key = pos->key;
+        history->moves[0].move = history->pv.moves[2];
+        history->moves[0].score = -INFINITE_SCORE;
+        history->moves[0].nodes = 0ULL;
+        history->nmoves = 1;
+        history->nplies = 2;
+        return;
+    }
+
+    history->key = 0ULL;
+    history->nmoves = 0;
+}
+
+/*
+ * Keep the root moves of a finished search so that they can be used to
+ * seed later searches. The number of nodes spent on each move is summed
+ * over all workers.
+ */
+static void save_root_history(struct engine *engine, struct pvinfo *best_pv)
+{
+    struct root_history  *history = &engine->root_history;
+    struct search_worker *master = smp_get_worker(engine, 0);
+    struct search_worker *worker;
+    int                  k;
+    int                  l;
+    int                  m;
+
+    history->key = 0ULL;
+    history->nmoves = 0;
+    if ((engine->move_filter.size > 0) || (best_pv->pv.size == 0)) {
+        return;
+    }
+
+    for (k=0;k<master->nroot_moves;k++) {
+        history->moves[k] = master->root_moves[k];
+        for (l=1;l<smp_number_of_workers(engine);l++) {
+            worker = smp_get_worker(engine, l);
+            for (m=0;m<worker->nroot_moves;m++) {
+                if (worker->root_moves[m].move == master->root_moves[k].move) {
+                    history->moves[k].nodes += worker->root_moves[m].nodes;
+                    break;
+                }
+            }
+        }
+    }
+    history->nmoves = master->nroot_moves;
+    order_root_moves(history->moves, history->nmoves, best_pv->pv.moves[0]);
+    history->pv = best_pv->pv;
+    history->key = engine->pos.key;
+    history->nplies = 0;
+}
+
+/*
+ * Search all PV lines of an iteration in one pass over the root moves.
+ * The root moves are first sorted based on the scores from the previous
+ * iteration so that the best lines are likely to be found early.
+ */
+static void search_multipv(struct search_worker *worker, int depth)
+{
+    struct root_move tmp;
+    int              k;
+    int              l;
+
+    for (k=1;k<worker->nroot_moves;k++) {
+        tmp = worker->root_moves[k];
+        for (l=k;l>0 && worker->root_moves[l-1].score<tmp.score;l--) {
+            worker->root_moves[l] = worker->root_moves[l-1];
+        }
+        worker->root_moves[l] = tmp;
+    }
+
+    worker->depth = depth;
+    worker->seldepth = 0;
+    (void)search(worker, depth, -INFINITE_SCORE, INFINITE_SCORE, false,
+                 NOMOVE);
+}
+
+/*
+ * Called when a worker has finished its search. Normally all other workers
+ * are stopped as well, but in reproducible mode they are left to finish
+ * their own searches.
+ */
+static void stop_worker(struct search_worker *worker)
 {
-    struct search_worker *worker = data;
+    if (!worker->engine->reproducible) {
+        smp_stop_all(worker->engine);
+    }
+}
+
+static void worker_search_func(int idx, void *data)
+{
+    struct engine        *engine = data;
+    struct search_worker *worker = smp_get_worker(engine, idx);
     int                  score;
     int                  depth;
-    int                  mpvidx;
 
     assert(valid_position(&worker->pos));
 
     /* Setup the first iteration */
     depth = 1 + worker->id%2;
+    init_root_moves(worker);
 
     /* Main search loop */
+    trace_event(worker, TRACE_SEARCH, TRACE_BEGIN, depth, 0);
     score = 0;
     while (true) {
 		/* Handle aborted searches */
         if (setjmp(worker->env) != 0) {
+            trace_event(worker, TRACE_ABORT, TRACE_INSTANT, worker->depth, 0);
+            trace_event(worker, TRACE_ITERATION, TRACE_END, worker->depth, 0);
             break;
         }
 
-        /* Multipv loop */
-        for (mpvidx=0;mpvidx<worker->multipv;mpvidx++) {
-            worker->mpvidx = mpvidx;
-            search_aspiration_window(worker, depth, score);
-
-            if ((worker->id == 0) && (worker->multipv > 1)) {
+        /* Search the next iteration */
+        trace_event(worker, TRACE_ITERATION, TRACE_BEGIN, depth, 0);
+        if (worker->multipv > 1) {
+            search_multipv(worker, depth);
+            if (worker->id == 0) {
+                smp_publish_counters(worker, true);
                 engine_send_multipv_info(worker);
             }
+        } else {
+            search_aspiration_window(worker, depth, score);
         }
         score = worker->mpv_lines[0].score;
 
+        trace_event(worker, TRACE_ITERATION, TRACE_END, depth, 0);
+
         /* Report iteration as completed */
+        trace_event(worker, TRACE_COMPLETE_ITERATION, TRACE_BEGIN, depth, 0);
         depth = smp_complete_iteration(worker);
+        trace_event(worker, TRACE_COMPLETE_ITERATION, TRACE_END, depth, 0);
 
         /*
          * Check if the score indicates a known win in
@@ -939,14 +1493,14 @@ static thread_retval_t worker_search_func(void *data)
          */
         if (worker->engine->exit_on_mate && !worker->engine->pondering) {
             if ((score > KNOWN_WIN) || (score < (-KNOWN_WIN))) {
-                smp_stop_all();
+                stop_worker(worker);
                 break;
             }
         }
 
         /* Check if the worker has reached the maximum depth */
         if (depth > worker->engine->sd) {
-            smp_stop_all();
+            stop_worker(worker);
             break;
         }
 
@@ -960,11 +1514,16 @@ static thread_retval_t worker_search_func(void *data)
 
         /* Check if the is time for a new iteration */
         if (!tc_new_iteration(worker)) {
-            smp_stop_all();
+            smp_stop_all(engine);
             break;
         }
     }
 
+    /* Publish the final node counters of this worker */
+    smp_publish_counters(worker, true);
+    stats_update(worker);
+    trace_event(worker, TRACE_SEARCH, TRACE_END, worker->depth, 0);
+
     /*
      * In some rare cases the search may reach the maximum depth. If this
      * happens while the engine is pondering then wait until a ponderhit
@@ -973,15 +1532,13 @@ static thread_retval_t worker_search_func(void *data)
      */
 	while ((worker->id == 0) && worker->engine->pondering) {
 		if (engine_wait_for_input(worker)) {
-			smp_stop_all();
+			smp_stop_all(engine);
             break;
 		}
 		if (!worker->engine->pondering) {
-			smp_stop_all();
+			smp_stop_all(engine);
 		}
 	}
-
-    return (thread_retval_t)0;
 }
 
 void search_init(void)
@@ -1002,17 +1559,22 @@ uint32_t search_position(struct engine *engine, bool pondering,
     int                  k;
     struct search_worker *worker;
     struct pvinfo        *best_pv;
+    struct pvinfo        cluster_line;
+    struct pvinfo        tb_line;
     struct movelist      legal;
     bool                 send_pv;
+    bool                 probe_root;
     uint32_t             best_move;
     uint32_t             move;
 
     assert(engine != NULL);
     assert(valid_position(&engine->pos));
-    assert(smp_number_of_workers() > 0);
+    assert(smp_number_of_workers(engine) > 0);
 
     /* Reset the best move information */
     best_move = NOMOVE;
+    engine->best_line.pv.size = 0;
+    engine->best_line.depth = 0;
     if (ponder_move != NULL) {
         *ponder_move = NOMOVE;
     }
@@ -1023,25 +1585,36 @@ uint32_t search_position(struct engine *engine, bool pondering,
      * enters the normal search.
 	 */
 	if (!pondering) {
-		tc_allocate_time();
+		tc_allocate_time(engine);
 	}
 
     /* Prepare for search */
-    hash_tt_age_table();
+    hash_tt_age_table(engine);
+    hash_tt_partition_table(engine, engine->reproducible?
+                                        smp_number_of_workers(engine):1);
     engine->probe_wdl = true;
     engine->root_in_tb = false;
     engine->root_tb_score = 0;
     engine->pondering = pondering;
     engine->pos.height = 0;
     engine->completed_depth = 0;
+    tc_new_search(engine);
 
     /* Perform a full refresh of the accumulator */
-    nnue_refresh_accumulator(&engine->pos);
+    nnue_refresh_accumulator(&engine->pos, smp_get_worker(engine, 0));
 
-    /* Probe tablebases for the root position */
-    if (egtb_should_probe(&engine->pos) &&
-        (engine->move_filter.size == 0) &&
-        (engine->multipv == 1)) {
+    /*
+     * Probe tablebases for the root position. Probing the DTZ tables can
+     * be slow when the table files are not cached, so normally the probe
+     * runs in the background while the search starts and the result is
+     * applied to the search once it is available. In reproducible mode
+     * the probe is done before the search so that the result doesn't
+     * depend on timing.
+     */
+    probe_root = egtb_should_probe(&engine->pos) &&
+                 (engine->move_filter.size == 0) &&
+                 (engine->multipv == 1);
+    if (probe_root && engine->reproducible) {
         engine->root_in_tb = egtb_probe_dtz_tables(&engine->pos, &move,
                                                   &engine->root_tb_score);
         if (engine->root_in_tb) {
@@ -1049,6 +1622,7 @@ uint32_t search_position(struct engine *engine, bool pondering,
             engine->move_filter.size = 1;
         }
         engine->probe_wdl = !engine->root_in_tb;
+        probe_root = false;
     }
 
     /*
@@ -1077,34 +1651,50 @@ uint32_t search_position(struct engine *engine, bool pondering,
      */
     if ((legal.size == 1) &&
         !engine->pondering &&
-        ((tc_get_flags()&TC_TIME_LIMIT) != 0) &&
-        ((tc_get_flags()&(TC_INFINITE_TIME|TC_FIXED_TIME)) == 0)) {
+        ((tc_get_flags(engine)&TC_TIME_LIMIT) != 0) &&
+        ((tc_get_flags(engine)&(TC_INFINITE_TIME|TC_FIXED_TIME)) == 0)) {
         return best_move;
     }
 
+    /*
+     * Seed the search with the root moves of the previous search if
+     * possible. The best move from that search is also used as the move
+     * to play if the search is stopped before the first iteration is done.
+     */
+    prepare_root_history(engine);
+    if ((engine->root_history.key == engine->pos.key) &&
+        (engine->root_history.nmoves > 0) &&
+        (engine->move_filter.size == 0) &&
+        pos_is_move_pseudo_legal(&engine->pos,
+                                 engine->root_history.moves[0].move) &&
+        pos_is_legal(&engine->pos, engine->root_history.moves[0].move)) {
+        best_move = engine->root_history.moves[0].move;
+    }
+
     /* Prepare workers for a new search */
     smp_prepare_workers(engine);
-
-    /* Start helpers */
-    for (k=1;k<smp_number_of_workers();k++) {
-        smp_start_worker(smp_get_worker(k), (thread_func_t)worker_search_func);
+    if (probe_root) {
+        engine->probe_wdl = false;
+        start_root_probe(engine);
     }
 
-    /* Start the master worker thread */
-    (void)worker_search_func(smp_get_worker(0));
-
-    /* Wait for all helpers to finish */
-    for (k=1;k<smp_number_of_workers();k++) {
-        smp_wait_for_worker(smp_get_worker(k));
-    }
+    /*
+     * Wake up the helpers and let the calling thread act
+     * as the master worker. Returns when all workers are done.
+     */
+    trace_start_search(engine);
+    cluster_start_search(engine);
+    smp_run_job(engine, worker_search_func, engine);
+    trace_finish_search(engine);
+    finish_root_probe(engine);
 
     /* Find the worker with the best move */
-    worker = smp_get_worker(0);
+    worker = smp_get_worker(engine, 0);
     best_pv = &worker->mpv_lines[0];
     send_pv = false;
     if (engine->multipv == 1) {
-        for (k=1;k<smp_number_of_workers();k++) {
-            worker = smp_get_worker(k);
+        for (k=1;k<smp_number_of_workers(engine);k++) {
+            worker = smp_get_worker(engine, k);
             if (worker->mpv_lines[0].pv.size < 1) {
                 continue;
             }
@@ -1117,6 +1707,31 @@ uint32_t search_position(struct engine *engine, bool pondering,
         }
     }
 
+    /* Let the helper nodes of a cluster vote on the best move */
+    if (engine->cluster != NULL) {
+        cluster_line = *best_pv;
+        if (cluster_finish_search(engine, &cluster_line)) {
+            best_pv = &cluster_line;
+            send_pv = true;
+        }
+    }
+
+    /*
+     * If the root probe finished after the search had started then the
+     * best line may start with another move. The move suggested by the
+     * tablebases is always played.
+     */
+    if (engine->root_in_tb &&
+        ((best_pv->pv.size < 1) ||
+         (best_pv->pv.moves[0] != engine->move_filter.moves[0]))) {
+        tb_line = *best_pv;
+        tb_line.pv.moves[0] = engine->move_filter.moves[0];
+        tb_line.pv.size = 1;
+        tb_line.score = engine->root_tb_score;
+        best_pv = &tb_line;
+        send_pv = true;
+    }
+
     /*
      * If the best worker is not the first worker then send
      * an extra pv line to the GUI.
@@ -1125,7 +1740,11 @@ uint32_t search_position(struct engine *engine, bool pondering,
         engine_send_pv_info(engine, best_pv);
     }
 
+    /* Keep the root moves for the next search */
+    save_root_history(engine, best_pv);
+
     /* Get the best move and the ponder move */
+    engine->best_line = *best_pv;
     if (best_pv->pv.size >= 1) {
         best_move = best_pv->pv.moves[0];
         if (score != NULL) {
@@ -1140,7 +1759,7 @@ uint32_t search_position(struct engine *engine, bool pondering,
     engine->move_filter.size = 0;
 
     /* Reset workers */
-    smp_reset_workers();
+    smp_reset_workers(engine);
 
     return best_move;
 }
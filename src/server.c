@@ -0,0 +1,195 @@
+/*
+ * Marvin - an UCI/XBoard compatible chess engine
+ * Copyright (C) 2023 Martin Danielsson
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#if !defined(WINDOWS)
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#endif
+
+#include "server.h"
+#include "engine.h"
+#include "hash.h"
+#include "position.h"
+#include "cluster.h"
+#include "utils.h"
+#include "config.h"
+
+/* The maximum number of clients waiting for their session to start */
+#define SERVER_BACKLOG 64
+
+/* The address the server listens on unless another one is given */
+#define SERVER_DEFAULT_ADDRESS "127.0.0.1"
+
+#if !defined(WINDOWS)
+
+/*
+ * Restore the state that a client can change without it being
+ * reset by the protocol, so that every session starts out the same.
+ * The transposition table is kept to let later sessions benefit
+ * from earlier ones.
+ */
+static void reset_engine(struct engine *engine)
+{
+    engine_protocol = PROTOCOL_UNSPECIFIED;
+    engine_variant = VARIANT_STANDARD;
+    pos_setup_start_position(&engine->pos);
+    engine->move_filter.size = 0;
+    engine->multipv = 1;
+    engine->sd = MAX_SEARCH_DEPTH;
+    engine->max_nodes = 0ULL;
+    engine->pondering = false;
+}
+
+static void run_session(struct engine *engine, int fd)
+{
+    FILE *input;
+    FILE *output;
+    int  flag = 1;
+
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+
+    input = fdopen(fd, "r");
+    output = fdopen(dup(fd), "w");
+    if ((input == NULL) || (output == NULL)) {
+        if (input != NULL) {
+            fclose(input);
+        } else {
+            close(fd);
+        }
+        if (output != NULL) {
+            fclose(output);
+        }
+        return;
+    }
+    setbuf(input, NULL);
+    setbuf(output, NULL);
+
+    engine_open_session(input, output);
+    engine_loop(engine);
+
+    /*
+     * The session ends either when the client disconnects or when
+     * it sends quit. In the latter case the input thread is still
+     * waiting for data so the socket is shut down to wake it up.
+     */
+    shutdown(fd, SHUT_RDWR);
+    engine_close_session();
+    fclose(input);
+    fclose(output);
+
+    reset_engine(engine);
+}
+
+int server_run(int argc, char *argv[])
+{
+    struct engine *engine;
+    char          *address = SERVER_DEFAULT_ADDRESS;
+    char          *port;
+    int           nthreads = engine_default_num_threads;
+    int           hash_size = engine_default_hash_size;
+    int           listener;
+    int           fd;
+    int           nsessions;
+
+    if ((argc >= 4) && !strcmp(argv[2], "--bind")) {
+        address = argv[3];
+        argc -= 2;
+        argv += 2;
+    }
+    if ((argc < 3) || (argc > 5)) {
+        printf("Usage: marvin --server [--bind <address>] <port> "
+               "[<threads> [<hash>]]\n");
+        return 1;
+    }
+    port = argv[2];
+    if (argc > 3) {
+        nthreads = atoi(argv[3]);
+    }
+    if (argc > 4) {
+        hash_size = atoi(argv[4]);
+    }
+    if ((nthreads < 1) || (nthreads > MAX_WORKERS) ||
+        (hash_size < MIN_MAIN_HASH_SIZE) || (hash_size > hash_tt_max_size())) {
+        printf("Error: invalid options\n");
+        return 1;
+    }
+
+    /* Writing to a client that has disconnected should not be fatal */
+    signal(SIGPIPE, SIG_IGN);
+
+    listener = open_listen_socket(address, port, SERVER_BACKLOG);
+    if (listener < 0) {
+        printf("Error: failed to listen on %s port %s\n", address, port);
+        return 1;
+    }
+
+    engine = engine_create(hash_size, nthreads);
+    if (engine == NULL) {
+        close(listener);
+        return 1;
+    }
+    if (engine_cluster_nodes[0] != '\0') {
+        cluster_connect(engine, engine_cluster_nodes);
+    }
+
+    /*
+     * Serve one session at a time. Clients that connect while a
+     * session is running wait in the listen queue.
+     */
+    printf("Listening on %s port %s\n", address, port);
+    nsessions = 0;
+    while (true) {
+        fd = accept(listener, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+
+        nsessions++;
+        printf("Session %d started\n", nsessions);
+        run_session(engine, fd);
+        printf("Session %d finished\n", nsessions);
+    }
+
+    engine_destroy(engine);
+    close(listener);
+
+    return 0;
+}
+
+#else
+
+int server_run(int argc, char *argv[])
+{
+    (void)argc;
+    (void)argv;
+
+    printf("Server mode is not supported on this platform\n");
+    return 1;
+}
+
+#endif
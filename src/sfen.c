@@ -20,8 +20,19 @@
 #include <string.h>
 #include <assert.h>
 #include <inttypes.h>
+#include <stdatomic.h>
+#if !defined(WINDOWS)
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#endif
 
 #include "sfen.h" 
+#include "sfenio.h"
 #include "position.h"
 #include "bitboard.h"
 #include "key.h"
@@ -34,6 +45,8 @@
 #include "validation.h"
 #include "movegen.h"
 #include "fen.h"
+#include "nnue.h"
+#include "utils.h"
 
 #define BATCH_SIZE 10000
 #define EVAL_LIMIT 10000
@@ -45,271 +58,120 @@
 #define DRAW_COUNT 10
 #define EVAL_LIMIT 10000
 
-#define SFEN_BIN_SIZE 40
+#define MAX_GENERATORS 256
 
-struct packed_sfen {
-    uint8_t  position[32];
-    int16_t  stm_score;
-    uint16_t move;
-    uint16_t ply;
-    int8_t   stm_result;
-    uint8_t  padding;
-};
-
-/* Table containing Huffman encoding of each piece type */
-static struct {
-    uint8_t code;       /* Code for the piece */
-    uint8_t nbits;      /* The number of bits in the code */
-    uint8_t piece_type; /* The type of piece */
-} huffman_table[] = {
-    {0b0000, 1, NO_PIECE}, /* No piece */
-    {0b0001, 4, PAWN},     /* Pawn */
-    {0b0011, 4, KNIGHT},   /* Knight */
-    {0b0101, 4, BISHOP},   /* Bishop */
-    {0b0111, 4, ROOK},     /* Rook */
-    {0b1001, 4, QUEEN},    /* Queen */
-};
-
-static uint8_t encode_bit(uint8_t *data, uint8_t cursor, uint8_t value)
-{
-    if (value != 0) {
-        data[cursor/8] |= (1 << (cursor&0x7));
-    }
-
-    return cursor + 1;
-}
+/* The number of positions evaluated in each step of --evaluate */
+#define EVALUATE_SEGMENT_SIZE (1024*1024)
+#define EVALUATE_CHUNK_SIZE 256
 
-static int read_bit(uint8_t *data, int *cursor)
-{
-    int b = (data[*cursor/8] >> (*cursor&7))&1;
-    (*cursor)++;
-
-    return b;
-}
-
-static uint8_t encode_bits(uint8_t *data, uint8_t cursor, uint8_t value,
-                           uint8_t nbits)
-{
-    uint8_t k;
-
-    for (k=0;k<nbits;k++) {
-        cursor = encode_bit(data, cursor, value&(1 << k));
-    }
+/* The number of bits set for each position in the duplicate filter */
+#define FILTER_NBITS 4
 
-    return cursor;
-}
+/* The default number of positions used by --sfen-bench */
+#define BENCHMARK_POSITIONS 100000
+#define BENCHMARK_MAX_PLIES 120
 
-static int read_bits(uint8_t *data, int *cursor, int nbits)
-{
-    int k;
-    int result = 0;
+/* The phases of a rescore job that uses several processes */
+enum rescore_state {
+    RESCORE_SCORING,
+    RESCORE_JOINING,
+    RESCORE_JOINED
+};
 
-    for (k=0;k<nbits;k++) {
-        result |= read_bit(data, cursor)?(1 << k):0;
-    }
+/* Parameters of a rescore job, used to resume an interrupted job */
+struct checkpoint {
+    int64_t            offset;
+    int                npositions;
+    int                nthreads;
+    int64_t            base;
+    enum rescore_state state;
+};
 
-    return result;
-}
+/*
+ * Bloom filter used to skip positions that have already been generated.
+ * Each position sets FILTER_NBITS bits in a single word so that a lookup
+ * only touches one cache line. The filter is placed in shared memory so
+ * that it is shared by all generator processes.
+ */
+struct position_filter {
+    atomic_uint_fast64_t nprobes;
+    atomic_uint_fast64_t nduplicates;
+    uint64_t             size;
+    uint64_t             mask;
+    atomic_uint_fast64_t words[];
+};
 
-static uint8_t encode_piece(uint8_t *data, uint8_t cursor, int piece)
+static struct position_filter* create_filter(int size_mb)
 {
-    int value = VALUE(piece);
-    int color = COLOR(piece);
+    struct position_filter *filter;
+    uint64_t               nwords;
+    uint64_t               size;
 
-    if (piece == NO_PIECE) {
-        cursor = encode_bits(data, cursor, huffman_table[0].code,
-                             huffman_table[0].nbits);
-    } else {
-        cursor = encode_bits(data, cursor, huffman_table[value/2+1].code,
-                             huffman_table[value/2+1].nbits);
-        cursor = encode_bit(data, cursor, color);
+    nwords = 1ULL;
+    while ((nwords*2*sizeof(uint64_t)) <= ((uint64_t)size_mb*1024*1024)) {
+        nwords *= 2;
     }
+    size = sizeof(struct position_filter) + nwords*sizeof(uint64_t);
 
-    return cursor;
-}
-
-static int read_piece(uint8_t *data, int *cursor)
-{
-    int  color = WHITE;
-    int  code = 0;
-    int  nbits = 0;
-    bool found = false;
-    int  k;
-
-    while (!found) {
-        code |= read_bit(data, cursor) << nbits;
-        nbits++;
-
-        for (k=0;k<6;k++) {
-            if ((huffman_table[k].code == code) &&
-                (huffman_table[k].nbits == nbits)) {
-                found = true;
-                break;
-            }
-        }
+#if !defined(WINDOWS)
+    filter = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS,
+                  -1, 0);
+    if (filter == MAP_FAILED) {
+        return NULL;
     }
-
-    if (huffman_table[k].piece_type == NO_PIECE) {
-        return NO_PIECE;
+#else
+    filter = calloc(1, size);
+    if (filter == NULL) {
+        return NULL;
     }
+#endif
+    filter->size = size;
+    filter->mask = nwords - 1;
 
-    color = read_bit(data, cursor);
-
-    return color + huffman_table[k].piece_type;
+    return filter;
 }
 
-static void encode_position(struct position *pos, uint8_t *data)
+static void destroy_filter(struct position_filter *filter)
 {
-    uint8_t cursor = 0;
-    int     file;
-    int     rank;
-    int     piece;
-
-    /* Encode side to move */
-    cursor = encode_bit(data, cursor, pos->stm);
-
-    /* Encode king positions */
-    cursor = encode_bits(data, cursor, LSB(pos->bb_pieces[WHITE_KING]), 6);
-    cursor = encode_bits(data, cursor, LSB(pos->bb_pieces[BLACK_KING]), 6);
-
-    /* Encode piece positions */
-    for (rank=RANK_8;rank>=RANK_1;rank--) {
-        for (file=FILE_A;file<=FILE_H;file++) {
-            piece = pos->pieces[SQUARE(file, rank)];
-            if ((piece == WHITE_KING) || (piece == BLACK_KING)) {
-                continue;
-            }
-            cursor = encode_piece(data, cursor, piece);
-        }
-    }
-
-    /* Encode castling availability */
-    cursor = encode_bit(data, cursor, (pos->castle&WHITE_KINGSIDE) != 0);
-    cursor = encode_bit(data, cursor, (pos->castle&WHITE_QUEENSIDE) != 0);
-    cursor = encode_bit(data, cursor, (pos->castle&BLACK_KINGSIDE) != 0);
-    cursor = encode_bit(data, cursor, (pos->castle&BLACK_QUEENSIDE) != 0);
-
-    /* Encode en-passant square */
-    if  (pos->ep_sq == NO_SQUARE) {
-        cursor = encode_bit(data, cursor, 0);
-    } else {
-        cursor = encode_bit(data, cursor, 1);
-        cursor = encode_bits(data, cursor, pos->ep_sq, 6);
+    if (filter == NULL) {
+        return;
     }
 
-    /*
-     * Encode fifty-move counter. To keep compatibility with Stockfish
-     * only 6 bits are stored now. The last bit is stored at the end.
-     */
-    cursor = encode_bits(data, cursor, pos->fifty, 6);
-
-    /* Encode move counter */
-    cursor = encode_bits(data, cursor, pos->fullmove, 8);
-    cursor = encode_bits(data, cursor, pos->fullmove >> 8, 8);
-
-    /* Encode upper bit of the fifty-move counter */
-    cursor = encode_bit(data, cursor, (pos->fifty >> 6) & 1);
-}
-
-static void add_piece(struct position *pos, int piece, int sq)
-{
-    pos->pieces[sq] = piece;
-    SETBIT(pos->bb_pieces[piece], sq);
-    SETBIT(pos->bb_sides[COLOR(piece)], sq);
-    SETBIT(pos->bb_all, sq);
-    pos->key = key_set_piece(pos->key, piece, sq);
+#if !defined(WINDOWS)
+    munmap(filter, filter->size);
+#else
+    free(filter);
+#endif
 }
 
-static void position_from_sfen(uint8_t *data, struct position *pos)
+/*
+ * Add a position to the filter.
+ *
+ * @param filter The filter.
+ * @param key The key of the position.
+ * @return Returns true if the position was already in the filter. False
+ *         positives are possible but rare as long as the filter is large
+ *         compared to the number of generated positions.
+ */
+static bool filter_test_and_add(struct position_filter *filter, uint64_t key)
 {
-    int cursor = 0;
-    int sq;
-    int rank;
-    int file;
-    int piece;
-    int fifty;
-    int fullmove;
-
-    /* Initialize position */
-    pos_reset(pos);
-
-    /* The side to move */
-    pos->stm = read_bit(data, &cursor);
-    pos->key = key_set_side(pos->key, pos->stm);
-
-    /* King positions */
-    sq = read_bits(data, &cursor, 6);
-    add_piece(pos, WHITE_KING, sq);
-    sq = read_bits(data, &cursor, 6);
-    add_piece(pos, BLACK_KING, sq);
-
-    /* Piece positions */
-    for (rank=RANK_8;rank>=RANK_1;rank--) {
-        for (file=FILE_A;file<=FILE_H;file++) {
-            sq = SQUARE(file, rank);
-            if (pos->pieces[sq] != NO_PIECE) {
-                continue;
-            }
-
-            piece = read_piece(data, &cursor);
-            if (piece != NO_PIECE) {
-                add_piece(pos, piece, sq);
-            }
-        }
-    }
-
-    /* Castling */
-    if (read_bit(data, &cursor) == 1) {
-        pos->castle |= WHITE_KINGSIDE;
-    }
-    if (read_bit(data, &cursor) == 1) {
-        pos->castle |= WHITE_QUEENSIDE;
-    }
-    if (read_bit(data, &cursor) == 1) {
-        pos->castle |= BLACK_KINGSIDE;
-    }
-    if (read_bit(data, &cursor) == 1) {
-        pos->castle |= BLACK_QUEENSIDE;
-    }
-    pos->key = key_set_castling(pos->key, pos->castle);
+    uint64_t bits = 0ULL;
+    uint64_t old;
+    int      k;
 
-    /* En-passant square */
-    if (read_bit(data, &cursor) == 1) {
-        pos->ep_sq = read_bits(data, &cursor, 6);
-        pos->key = key_set_ep_square(pos->key, pos->ep_sq);
+    for (k=0;k<FILTER_NBITS;k++) {
+        bits |= 1ULL << ((key >> (64-6*(k+1)))&0x3F);
     }
-
-    /* 50-move counter, lower 6 bits */
-    fifty = read_bits(data, &cursor, 6);
-
-    /* Fullmove counter */
-    fullmove = read_bits(data, &cursor, 8);
-    fullmove |= (read_bits(data, &cursor, 8) << 8);
-    pos->fullmove = fullmove;
-
-    /* 50-move counter, upper 1 bit */
-    fifty |= (read_bit(data, &cursor) << 6);
-    pos->fifty = fifty;
-}
-
-static uint16_t encode_move(uint32_t move)
-{
-    uint16_t data = 0;
-    int      to = TO(move);
-    int      from = FROM(move);
-
-    data |= to;
-    data |= (from << 6);
-    if (ISPROMOTION(move)) {
-        data |= ((VALUE(PROMOTION(move))/2 - 1) << 12);
-        data |= (1 << 14);
-    } else if (ISENPASSANT(move)) {
-        data |= (2 << 14);
-    } else if (ISKINGSIDECASTLE(move) || ISQUEENSIDECASTLE(move)) {
-        data |= (3 << 14);
+    old = atomic_fetch_or_explicit(&filter->words[key&filter->mask], bits,
+                                   memory_order_relaxed);
+
+    atomic_fetch_add_explicit(&filter->nprobes, 1, memory_order_relaxed);
+    if ((old&bits) == bits) {
+        atomic_fetch_add_explicit(&filter->nduplicates, 1,
+                                  memory_order_relaxed);
+        return true;
     }
-
-    return data;
+    return false;
 }
 
 static void play_random_moves(struct position *pos, int nmoves)
@@ -346,22 +208,22 @@ static void setup_start_position(struct position *pos, float frc_prob)
     pos_setup_start_position(pos);
 }
 
-static int play_game(FILE *fp, struct engine *engine, int pos_left,
-                     float frc_prob)
+static int play_game(struct engine *engine, float frc_prob,
+                     struct position_filter *filter, struct packed_sfen *batch)
 {
-    struct position    *pos = &engine->pos;
-    struct packed_sfen batch[MAX_GAME_PLY];
-    int                npos = 0;
-    uint32_t           move;
-    int                stm_score;
-    int                white_score;
-    int                white_result = 0;
-    int                draw_count = 0;
-    int                k;
+    struct position *pos = &engine->pos;
+    int             start_ply;
+    int             npos = 0;
+    uint32_t        move;
+    int             stm_score;
+    int             white_score;
+    int             white_result = 0;
+    int             draw_count = 0;
+    int             k;
 
     /* Prepare for a new game */
     memset(batch, 0, sizeof(struct packed_sfen)*MAX_GAME_PLY);
-    smp_newgame();
+    smp_newgame(engine);
 
     /* Setup start position and play some random opening moves */
     setup_start_position(&engine->pos, frc_prob);
@@ -369,9 +231,28 @@ static int play_game(FILE *fp, struct engine *engine, int pos_left,
     if (pos_get_game_result(pos) != RESULT_UNDETERMINED) {
         return 0;
     }
+    start_ply = pos->ply;
 
     /* Play game */
     while (pos_get_game_result(pos) == RESULT_UNDETERMINED) {
+        /*
+         * Positions that have already been generated are neither searched
+         * nor written. If the opening is a duplicate then the whole game
+         * most likely is as well so it is skipped. Otherwise a random move
+         * is played to leave the known line.
+         */
+        if ((filter != NULL) && filter_test_and_add(filter, pos->key)) {
+            if (pos->ply == start_ply) {
+                return 0;
+            }
+            if (pos->ply >= MAX_GAME_PLY) {
+                white_result = 0;
+                break;
+            }
+            play_random_moves(pos, 1);
+            continue;
+        }
+
         /* Search the position */
         move = search_position(engine, false, NULL, &stm_score);
 
@@ -394,9 +275,9 @@ static int play_game(FILE *fp, struct engine *engine, int pos_left,
          * Encode the position and the result of the search. The game
          * result is filled in later.
          */
-        encode_position(pos, batch[npos].position);
+        sfenio_encode_position(pos, batch[npos].position);
         batch[npos].stm_score = stm_score;
-        batch[npos].move = encode_move(move);
+        batch[npos].move = sfenio_encode_move(move);
         batch[npos].ply = pos->ply;
         batch[npos].stm_result = (pos->stm == WHITE)?1:-1;
         batch[npos].padding = 0xFF;
@@ -441,211 +322,1021 @@ static int play_game(FILE *fp, struct engine *engine, int pos_left,
         batch[k].stm_result *= white_result;
     }
 
-    /* Write sfen positions to file */
-    if (npos > pos_left) {
-        npos = pos_left;
-    }
-    fwrite(batch, SFEN_BIN_SIZE, npos, fp);
-    fflush(fp);
-
     return npos;
 }
 
-static int generate(char *output, int depth, int npositions, double frc_prob)
+static struct engine* setup_engine(int depth)
 {
-    FILE          *outfp = NULL;
-    struct engine *engine = NULL;
-    int           ngenerated;
-
-    /* Open output file */
-    outfp = fopen(output, "ab");
-    if (outfp == NULL) {
-        printf("Error: failed to open output file, %s\n", output);
-        return 1;
-    }
+    struct engine *engine;
 
-    /* Setup engine */
-    hash_tt_destroy_table();
-    hash_tt_create_table(DEFAULT_MAIN_HASH_SIZE);
-    smp_destroy_workers();
-    smp_create_workers(1);
-    tc_configure_time_control(0, 0, 0, TC_INFINITE_TIME);
-    engine = engine_create();
+    engine = engine_create(DEFAULT_MAIN_HASH_SIZE, 1);
+    assert(engine != NULL);
+    tc_configure_time_control(engine, 0, 0, 0, TC_INFINITE_TIME);
     engine->sd = depth;
     engine->move_filter.size = 0;
     engine->exit_on_mate = true;
 
+    return engine;
+}
+
+static void generate_serial(struct sfen_writer *writer, int depth,
+                            int npositions, double frc_prob,
+                            struct position_filter *filter)
+{
+    struct engine      *engine;
+    struct packed_sfen batch[MAX_GAME_PLY];
+    int                ngenerated;
+    int                npos;
+
+    engine = setup_engine(depth);
+
     /* Play games to generate moves */
     ngenerated = 0;
     while (ngenerated < npositions) {
         /* Play game */
-        ngenerated += play_game(outfp, engine, npositions-ngenerated, frc_prob);
-        
+        npos = play_game(engine, frc_prob, filter, batch);
+
+        /* Write sfen positions to file */
+        npos = MIN(npos, npositions-ngenerated);
+        (void)sfenio_write(writer, batch, npos);
+        ngenerated += npos;
+
         /* Clear the transposition table */
-        hash_tt_clear_table();
+        hash_tt_clear_table(engine);
     }
 
-    /* Close the output file */
-    fclose(outfp);
-
-    /* Destroy the engine*/
     engine_destroy(engine);
+}
 
-    return 0;
+#if !defined(WINDOWS)
+/* State kept by the writer for each generator process */
+struct generator {
+    pid_t   pid;
+    int     fd;
+    int     len;
+    uint8_t data[SFEN_BIN_SIZE*MAX_GAME_PLY];
+};
+
+static bool write_all(int fd, void *data, size_t size)
+{
+    uint8_t *iter = data;
+    ssize_t n;
+
+    while (size > 0) {
+        n = write(fd, iter, size);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        iter += n;
+        size -= n;
+    }
+    return true;
 }
 
-static int rescore(char *input, char *output, int depth, int npositions,
-                   int64_t offset)
+static void generator_main(int fd, int depth, double frc_prob, int seed,
+                           struct position_filter *filter)
 {
-    int                k;
-    int                count;
-    int                ret = 0;
-    FILE               *infp = NULL;
-    FILE               *outfp = NULL;
-    uint64_t           size;
-    uint32_t           nentries;
-    int                nscored;
-    int                batch_size;
-    struct packed_sfen batch_data[BATCH_SIZE];
-    struct engine      *engine = NULL;
-    int                score;
+    struct engine      *engine;
+    struct packed_sfen batch[MAX_GAME_PLY];
+    int                npos;
 
-    /* Open input and output files */
-    infp = fopen(input, "rb");
-    if (infp == NULL) {
-        printf("Error: failed to open input file, %s\n", input);
+    srand(seed);
+    engine = setup_engine(depth);
+
+    /*
+     * Play games until the writer closes the pipe. Each game is written
+     * as a whole so the writer only ever has to deal with a partial game
+     * at the end of a read.
+     */
+    while (true) {
+        npos = play_game(engine, frc_prob, filter, batch);
+        if (!write_all(fd, batch, npos*SFEN_BIN_SIZE)) {
+            break;
+        }
+        hash_tt_clear_table(engine);
+    }
+
+    engine_destroy(engine);
+}
+
+static int generate_parallel(struct sfen_writer *writer, int depth,
+                             int npositions, double frc_prob, int nthreads,
+                             int seed, struct position_filter *filter)
+{
+    struct generator *generators;
+    struct pollfd    pfds[MAX_GENERATORS];
+    int              fds[2];
+    int              ngenerated;
+    int              nrunning;
+    int              nrecords;
+    int              ret = 0;
+    int              k;
+    int              l;
+    ssize_t          n;
+
+    generators = malloc(sizeof(struct generator)*nthreads);
+    if (generators == NULL) {
+        printf("Error: failed to allocate memory\n");
+        return 1;
+    }
+
+    /*
+     * Each generator is a separate process with its own engine and
+     * transposition table. The children never touch the writer, it
+     * is only used by this process.
+     */
+    fflush(stdout);
+    signal(SIGPIPE, SIG_IGN);
+    for (k=0;k<nthreads;k++) {
+        if (pipe(fds) < 0) {
+            printf("Error: failed to create pipe\n");
+            nthreads = k;
+            ret = 1;
+            break;
+        }
+        generators[k].pid = fork();
+        if (generators[k].pid == 0) {
+            for (l=0;l<k;l++) {
+                close(generators[l].fd);
+            }
+            close(fds[0]);
+            generator_main(fds[1], depth, frc_prob, seed+k, filter);
+            close(fds[1]);
+            _exit(0);
+        }
+        close(fds[1]);
+        if (generators[k].pid < 0) {
+            printf("Error: failed to start generator\n");
+            close(fds[0]);
+            nthreads = k;
+            ret = 1;
+            break;
+        }
+        generators[k].fd = fds[0];
+        generators[k].len = 0;
+        pfds[k].fd = fds[0];
+        pfds[k].events = POLLIN;
+    }
+
+    /* Collect games from the generators and pass them to the writer */
+    ngenerated = 0;
+    nrunning = nthreads;
+    while ((ret == 0) && (ngenerated < npositions) && (nrunning > 0)) {
+        if (poll(pfds, nthreads, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            ret = 1;
+            break;
+        }
+        for (k=0;(k<nthreads)&&(ngenerated<npositions);k++) {
+            if ((pfds[k].revents&(POLLIN|POLLHUP|POLLERR)) == 0) {
+                continue;
+            }
+            n = read(generators[k].fd,
+                     generators[k].data+generators[k].len,
+                     sizeof(generators[k].data)-generators[k].len);
+            if (n <= 0) {
+                pfds[k].fd = -1;
+                nrunning--;
+                continue;
+            }
+            generators[k].len += (int)n;
+
+            /* Write all complete positions */
+            nrecords = generators[k].len/SFEN_BIN_SIZE;
+            nrecords = MIN(nrecords, npositions-ngenerated);
+            if (!sfenio_write(writer, (struct packed_sfen*)generators[k].data,
+                              nrecords)) {
+                printf("Error: failed to write data\n");
+                ret = 1;
+                break;
+            }
+            ngenerated += nrecords;
+            generators[k].len -= nrecords*SFEN_BIN_SIZE;
+            memmove(generators[k].data,
+                    generators[k].data+nrecords*SFEN_BIN_SIZE,
+                    generators[k].len);
+        }
+    }
+    if ((ret == 0) && (ngenerated < npositions)) {
+        printf("Error: all generators exited unexpectedly\n");
         ret = 1;
-        goto done;
     }
-    outfp = fopen(output, "ab");
-    if (outfp == NULL) {
+
+    /* Stop all generators */
+    for (k=0;k<nthreads;k++) {
+        close(generators[k].fd);
+        kill(generators[k].pid, SIGTERM);
+    }
+    for (k=0;k<nthreads;k++) {
+        waitpid(generators[k].pid, NULL, 0);
+    }
+
+    free(generators);
+
+    return ret;
+}
+#endif
+
+static int generate(char *output, int depth, int npositions, double frc_prob,
+                    int nthreads, int seed, int filter_size, bool compressed)
+{
+    struct sfen_writer     writer;
+    struct position_filter *filter = NULL;
+    uint64_t               nprobes;
+    uint64_t               nduplicates;
+    int                    ret = 0;
+
+    /* Create the duplicate filter */
+    if (filter_size > 0) {
+        filter = create_filter(filter_size);
+        if (filter == NULL) {
+            printf("Error: failed to allocate memory\n");
+            return 1;
+        }
+    }
+
+    /* Open output file */
+    if (!sfenio_open_writer(&writer, output, compressed)) {
         printf("Error: failed to open output file, %s\n", output);
+        destroy_filter(filter);
+        return 1;
+    }
+
+    /* Generate positions */
+    if (nthreads == 1) {
+        srand(seed);
+        generate_serial(&writer, depth, npositions, frc_prob, filter);
+    } else {
+#if !defined(WINDOWS)
+        ret = generate_parallel(&writer, depth, npositions, frc_prob, nthreads,
+                                seed, filter);
+#else
+        printf("Error: multiple threads are not supported on this platform\n");
         ret = 1;
-        goto done;
+#endif
     }
 
-    /* Get the number of entries in the input file */
-    size = get_file_size(input);
-    if ((size%SFEN_BIN_SIZE) != 0ULL) {
-        printf("Error: invalid input size %"PRIu64"\n", size);
+    /* Close the output file */
+    if (!sfenio_close_writer(&writer)) {
+        printf("Error: failed to write data\n");
         ret = 1;
-        goto done;
     }
-    nentries = size/SFEN_BIN_SIZE;
-    if (npositions < 0) {
-        npositions = nentries;
+
+    /* Report how many positions were skipped as duplicates */
+    if (filter != NULL) {
+        nprobes = atomic_load(&filter->nprobes);
+        nduplicates = atomic_load(&filter->nduplicates);
+        printf("Skipped %"PRIu64" of %"PRIu64" positions as duplicates "
+               "(%.1f%%)\n", nduplicates, nprobes,
+               (nprobes > 0)?(100.0*nduplicates)/nprobes:0.0);
+        destroy_filter(filter);
     }
-    if ((uint32_t)offset >= nentries) {
-        printf("Error: invalid offset %d %d\n", (int)offset, nentries);
-        ret = 1;
-        goto done;
+
+    return ret;
+}
+
+static int rescore_range(char *input, char *output, int depth, int64_t first,
+                         int npositions)
+{
+    int                k;
+    int                ret = 0;
+    struct sfen_reader reader;
+    struct sfen_writer writer;
+    struct packed_sfen sfen;
+    struct packed_sfen *input_sfen;
+    struct engine      *engine;
+    int                score;
+
+    if (npositions <= 0) {
+        return 0;
     }
-    if (((uint32_t)npositions+(uint32_t)offset) > nentries) {
+
+    /* Open input and output files */
+    if (!sfenio_open_reader(&reader, input)) {
+        printf("Error: failed to open input file, %s\n", input);
+        return 1;
+    }
+    if (((uint64_t)first+npositions) > reader.npositions) {
         printf("Error: invalid number of positions\n");
-        ret = 1;
-        goto done;
+        sfenio_close_reader(&reader);
+        return 1;
     }
-
-    /* Seek to the correct position in the input file */
-    if (set_file_position(infp, offset*SFEN_BIN_SIZE, SEEK_SET) < 0) {
-        printf("Error: seek failed\n");
-        ret = 1;
-        goto done;
+    if (!sfenio_open_writer(&writer, output, false)) {
+        printf("Error: failed to open output file, %s\n", output);
+        sfenio_close_reader(&reader);
+        return 1;
     }
 
     /* Setup engine */
-    hash_tt_destroy_table();
-    hash_tt_create_table(DEFAULT_MAIN_HASH_SIZE);
-    smp_destroy_workers();
-    smp_create_workers(1);
-    tc_configure_time_control(0, 0, 0, TC_INFINITE_TIME);
-    engine = engine_create();
-    engine->sd = depth;
-    engine->move_filter.size = 0;
-    engine->exit_on_mate = true;
+    engine = setup_engine(depth);
 
-    /* Rescore positions */
-    nscored = 0;
-    batch_size = BATCH_SIZE;
-    while (nscored < npositions) {
-        /* Read batch */
-        if ((nscored+BATCH_SIZE) <= npositions) {
-           batch_size = BATCH_SIZE;
-        } else {
-           batch_size = npositions - nscored;
-        }
-        count = (int)fread(batch_data, SFEN_BIN_SIZE, batch_size, infp);
-        if (count != batch_size) {
-            printf("Error: failed to read data\n");
+    /*
+     * Rescore positions. The positions are decoded directly from the
+     * mapped input file and the rescored positions are passed to the
+     * writer which writes them to the output file in large chunks.
+     * The size of the output file doubles as progress information
+     * when a job is resumed, so the output is always a plain file.
+     */
+    for (k=0;k<npositions;k++) {
+        input_sfen = sfenio_position(&reader, first+k);
+        if (input_sfen == NULL) {
+            printf("Error: invalid input file, %s\n", input);
             ret = 1;
-            goto done;
-        }
-
-        /* Analyse all positions in the batch */
-        for (k=0;k<batch_size;k++) {
-            position_from_sfen(batch_data[k].position, &engine->pos);
-            assert(valid_position(&engine->pos));
-            assert(engine->pos.key == key_generate(&engine->pos));
-            smp_newgame();
-            (void)search_position(engine, false, NULL, &score);
-            if ((score > -EVAL_LIMIT) && (score < EVAL_LIMIT)) {
-                /*
-                 * The training code doesn't care about the actual move so
-                 * don't bother updating it.
-                 */
-                batch_data[k].stm_score = (int16_t)score;
-            }
+            break;
         }
-
-        /* Write the batch to the output file */
-        count = (int)fwrite(batch_data, SFEN_BIN_SIZE, batch_size, outfp);
-        if (count != batch_size) {
+        sfen = *input_sfen;
+        sfenio_decode_position(sfen.position, &engine->pos);
+        assert(valid_position(&engine->pos));
+        assert(engine->pos.key == key_generate(&engine->pos));
+        smp_newgame(engine);
+        (void)search_position(engine, false, NULL, &score);
+        if ((score > -EVAL_LIMIT) && (score < EVAL_LIMIT)) {
+            /*
+             * The training code doesn't care about the actual move so
+             * don't bother updating it.
+             */
+            sfen.stm_score = (int16_t)score;
+        }
+        if (!sfenio_write(&writer, &sfen, 1)) {
             printf("Error: failed to write data\n");
             ret = 1;
-            goto done;
+            break;
         }
-        nscored += batch_size;
-        fflush(outfp);
 
-        /* Clear the transposition table */
-        hash_tt_clear_table();
+        /* Clear the transposition table after each batch */
+        if (((k+1)%BATCH_SIZE) == 0) {
+            hash_tt_clear_table(engine);
+        }
     }
 
-done:
-    if (engine != NULL) {
-        engine_destroy(engine);
-    }
-    if (infp) {
-        fclose(infp);
-    }
-    if (outfp) {
-        fclose(outfp);
+    engine_destroy(engine);
+    if (!sfenio_close_writer(&writer)) {
+        printf("Error: failed to write data\n");
+        ret = 1;
     }
+    sfenio_close_reader(&reader);
 
     return ret;
 }
 
-static void generate_usage(void)
+static bool read_checkpoint(char *path, struct checkpoint *ckpt)
 {
-    printf("marvin --generate <options>\n");
-    printf("Options:\n");
-    printf("\t--output (-o) <file>\n");
-    printf("\t--depth (-d) <file>\n");
-    printf("\t--npositions (-n) <int>\n");
-    printf("\t--seed (-d) <int>\n");
-    printf("\t--frc-prob (-f) <float>\n");
-    printf("\t--help (-h) <int>\n");
+    FILE *fp;
+    char line[256];
+    bool found[4] = {false, false, false, false};
+    int  state;
+
+    fp = fopen(path, "r");
+    if (fp == NULL) {
+        return false;
+    }
+    ckpt->state = RESCORE_SCORING;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        if (sscanf(line, "OFFSET=%"SCNd64, &ckpt->offset) == 1) {
+            found[0] = true;
+        } else if (sscanf(line, "NPOSITIONS=%d", &ckpt->npositions) == 1) {
+            found[1] = true;
+        } else if (sscanf(line, "THREADS=%d", &ckpt->nthreads) == 1) {
+            found[2] = true;
+        } else if (sscanf(line, "BASE=%"SCNd64, &ckpt->base) == 1) {
+            found[3] = true;
+        } else if (sscanf(line, "STATE=%d", &state) == 1) {
+            ckpt->state = CLAMP(state, RESCORE_SCORING, RESCORE_JOINED);
+        }
+    }
+    fclose(fp);
+
+    return found[0] && found[1] && found[2] && found[3];
 }
 
-static void rescore_usage(void)
+static bool write_checkpoint(char *path, struct checkpoint *ckpt)
 {
-    printf("marvin --rescore <options>\n");
-    printf("Options:\n");
-    printf("\t--input (-i) <file>\n");
-    printf("\t--output (-o) <file>\n");
+    FILE *fp;
+    bool ret;
+
+    fp = fopen(path, "w");
+    if (fp == NULL) {
+        return false;
+    }
+    fprintf(fp, "OFFSET=%"PRId64"\n", ckpt->offset);
+    fprintf(fp, "NPOSITIONS=%d\n", ckpt->npositions);
+    fprintf(fp, "THREADS=%d\n", ckpt->nthreads);
+    fprintf(fp, "BASE=%"PRId64"\n", ckpt->base);
+    fprintf(fp, "STATE=%d\n", ckpt->state);
+    ret = fflush(fp) == 0;
+    fclose(fp);
+
+    return ret;
+}
+
+/*
+ * Find out how many positions have already been written to a file and
+ * drop any partially written position at the end.
+ */
+static int resume_file(char *path, int64_t base, int npositions)
+{
+    int64_t size;
+    int64_t done;
+
+    size = get_file_size(path);
+    if (size < 0) {
+        size = 0;
+    }
+    if (size < base) {
+        return -1;
+    }
+    done = (size-base)/SFEN_BIN_SIZE;
+    if (done > npositions) {
+        return -1;
+    }
+    if ((size != (base+done*SFEN_BIN_SIZE)) &&
+        !truncate_file(path, base+done*SFEN_BIN_SIZE)) {
+        return -1;
+    }
+
+    return (int)done;
+}
+
+#if !defined(WINDOWS)
+static bool append_file(FILE *outfp, char *path, uint8_t *buffer, int size)
+{
+    FILE   *infp;
+    size_t n;
+    bool   ret = true;
+
+    infp = fopen(path, "rb");
+    if (infp == NULL) {
+        return false;
+    }
+    while ((n=fread(buffer, 1, size, infp)) > 0) {
+        if (fwrite(buffer, 1, n, outfp) != n) {
+            ret = false;
+            break;
+        }
+    }
+    fclose(infp);
+
+    return ret;
+}
+
+static void remove_shards(char *output, int nshards)
+{
+    char path[MAX_PATH_LENGTH];
+    int  k;
+
+    for (k=0;k<nshards;k++) {
+        snprintf(path, sizeof(path), "%s.%d", output, k);
+        (void)remove(path);
+    }
+}
+
+static int rescore_parallel(char *input, char *output, int depth,
+                            char *ckpt_path, struct checkpoint *ckpt)
+{
+    pid_t   pids[MAX_GENERATORS];
+    char    path[MAX_PATH_LENGTH];
+    int64_t first;
+    int64_t last;
+    int     done;
+    int     status;
+    int     ret = 0;
+    int     k;
+    FILE    *outfp;
+    uint8_t *buffer;
+
+    /*
+     * If the shards were joined before the job was interrupted then
+     * only the clean up remains.
+     */
+    if (ckpt->state == RESCORE_JOINED) {
+        remove_shards(output, ckpt->nthreads);
+        return 0;
+    }
+
+    /*
+     * The input is split into one contiguous shard per worker process.
+     * Each shard is rescored into a separate file and the shards are
+     * joined in order once all of them are complete. When resuming in
+     * the join phase all shards are already complete so no workers
+     * are started.
+     */
+    fflush(NULL);
+    for (k=0;k<ckpt->nthreads;k++) {
+        first = ckpt->offset + ((int64_t)ckpt->npositions*k)/ckpt->nthreads;
+        last = ckpt->offset + ((int64_t)ckpt->npositions*(k+1))/ckpt->nthreads;
+        snprintf(path, sizeof(path), "%s.%d", output, k);
+        done = resume_file(path, 0, (int)(last-first));
+        if ((done < 0) ||
+            ((ckpt->state == RESCORE_JOINING) && (done != (last-first)))) {
+            printf("Error: invalid shard file, %s\n", path);
+            pids[k] = -1;
+            ret = 1;
+            continue;
+        }
+        if (done == (last-first)) {
+            pids[k] = -1;
+            continue;
+        }
+        pids[k] = fork();
+        if (pids[k] == 0) {
+            _exit(rescore_range(input, path, depth, first+done,
+                                (int)(last-first-done)));
+        } else if (pids[k] < 0) {
+            printf("Error: failed to start worker\n");
+            ret = 1;
+        }
+    }
+    for (k=0;k<ckpt->nthreads;k++) {
+        if (pids[k] <= 0) {
+            continue;
+        }
+        if ((waitpid(pids[k], &status, 0) < 0) || !WIFEXITED(status) ||
+            (WEXITSTATUS(status) != 0)) {
+            ret = 1;
+        }
+    }
+    if (ret != 0) {
+        return ret;
+    }
+
+    /*
+     * Join the shards. If this is interrupted the output file is
+     * truncated and the shards are joined again on the next run.
+     * The checkpoint records when the join starts and when it is
+     * done so that shards are never rescored after they have been
+     * joined.
+     */
+    ckpt->state = RESCORE_JOINING;
+    if (!write_checkpoint(ckpt_path, ckpt)) {
+        printf("Error: failed to write checkpoint, %s\n", ckpt_path);
+        return 1;
+    }
+    if ((get_file_size(output) > ckpt->base) &&
+        !truncate_file(output, ckpt->base)) {
+        printf("Error: failed to truncate output file, %s\n", output);
+        return 1;
+    }
+    outfp = fopen(output, "ab");
+    buffer = malloc(SFEN_BIN_SIZE*BATCH_SIZE);
+    if ((outfp == NULL) || (buffer == NULL)) {
+        printf("Error: failed to open output file, %s\n", output);
+        ret = 1;
+    }
+    for (k=0;(k<ckpt->nthreads)&&(ret==0);k++) {
+        snprintf(path, sizeof(path), "%s.%d", output, k);
+        if (!append_file(outfp, path, buffer, SFEN_BIN_SIZE*BATCH_SIZE)) {
+            printf("Error: failed to join shard file, %s\n", path);
+            ret = 1;
+        }
+    }
+    if (outfp != NULL) {
+        if (fclose(outfp) != 0) {
+            ret = 1;
+        }
+    }
+    free(buffer);
+    if (ret != 0) {
+        return ret;
+    }
+
+    ckpt->state = RESCORE_JOINED;
+    if (!write_checkpoint(ckpt_path, ckpt)) {
+        printf("Error: failed to write checkpoint, %s\n", ckpt_path);
+        return 1;
+    }
+    remove_shards(output, ckpt->nthreads);
+
+    return 0;
+}
+#endif
+
+static int rescore(char *input, char *output, int depth, int npositions,
+                   int64_t offset, int nthreads)
+{
+    struct sfen_reader reader;
+    uint32_t           nentries;
+    char               ckpt_path[MAX_PATH_LENGTH];
+    struct checkpoint  ckpt;
+    int                done;
+    int                ret;
+
+    /* Get the number of entries in the input file */
+    if (!sfenio_open_reader(&reader, input)) {
+        printf("Error: failed to open input file, %s\n", input);
+        return 1;
+    }
+    nentries = reader.npositions;
+    sfenio_close_reader(&reader);
+    if (npositions < 0) {
+        npositions = nentries;
+    }
+    if ((uint32_t)offset >= nentries) {
+        printf("Error: invalid offset %d %d\n", (int)offset, nentries);
+        return 1;
+    }
+    if (((uint32_t)npositions+(uint32_t)offset) > nentries) {
+        printf("Error: invalid number of positions\n");
+        return 1;
+    }
+
+    /*
+     * Look for a checkpoint from an earlier run that was interrupted. The
+     * checkpoint only records the parameters of the job, the progress is
+     * derived from the size of the output files.
+     */
+    snprintf(ckpt_path, sizeof(ckpt_path), "%s.ckpt", output);
+    if (read_checkpoint(ckpt_path, &ckpt)) {
+        if ((ckpt.offset != offset) || (ckpt.npositions != npositions) ||
+            (ckpt.nthreads != nthreads)) {
+            printf("Error: options do not match checkpoint, %s\n", ckpt_path);
+            return 1;
+        }
+        printf("Resuming from checkpoint, %s\n", ckpt_path);
+    } else {
+        ckpt.offset = offset;
+        ckpt.npositions = npositions;
+        ckpt.nthreads = nthreads;
+        ckpt.base = MAX(get_file_size(output), 0);
+        ckpt.state = RESCORE_SCORING;
+        if (!write_checkpoint(ckpt_path, &ckpt)) {
+            printf("Error: failed to write checkpoint, %s\n", ckpt_path);
+            return 1;
+        }
+    }
+
+    /* Rescore positions */
+    if (nthreads == 1) {
+        done = resume_file(output, ckpt.base, npositions);
+        if (done < 0) {
+            printf("Error: output file does not match checkpoint, %s\n",
+                   output);
+            return 1;
+        }
+        ret = rescore_range(input, output, depth, offset+done,
+                            npositions-done);
+    } else {
+#if !defined(WINDOWS)
+        ret = rescore_parallel(input, output, depth, ckpt_path, &ckpt);
+#else
+        printf("Error: multiple threads are not supported on this platform\n");
+        ret = 1;
+#endif
+    }
+
+    /* The job is complete so the checkpoint is no longer needed */
+    if (ret == 0) {
+        (void)remove(ckpt_path);
+    }
+
+    return ret;
+}
+
+/*
+ * A segment of positions evaluated by all workers together. The positions
+ * are read by the main thread and are updated in place by the workers.
+ */
+struct evaluate_job {
+    struct engine      *engine;
+    struct packed_sfen *positions;
+    int                npositions;
+    atomic_int         next;
+    /* Set if a position could not be decoded */
+    atomic_bool        invalid;
+};
+
+static void evaluate_job_func(int idx, void *data)
+{
+    struct evaluate_job    *job = data;
+    struct nnue_batch_item items[EVALUATE_CHUNK_SIZE];
+    int16_t                scores[EVALUATE_CHUNK_SIZE];
+    struct packed_sfen     *sfens;
+    int                    start;
+    int                    n;
+    int                    k;
+
+    (void)idx;
+
+    /* Process chunks of positions until the segment is done */
+    while ((start=atomic_fetch_add(&job->next, EVALUATE_CHUNK_SIZE)) <
+                                                        job->npositions) {
+        n = MIN(EVALUATE_CHUNK_SIZE, job->npositions-start);
+        sfens = &job->positions[start];
+        for (k=0;k<n;k++) {
+            if (!sfenio_decode_batch_item(sfens[k].position, &items[k])) {
+                atomic_store(&job->invalid, true);
+                return;
+            }
+        }
+        nnue_evaluate_batch(items, n, scores);
+        for (k=0;k<n;k++) {
+            sfens[k].stm_score = scores[k];
+        }
+    }
+}
+
+static int evaluate(char *input, char *output, int nthreads)
+{
+    struct sfen_reader  reader;
+    struct sfen_writer  writer;
+    struct evaluate_job job;
+    struct packed_sfen  *sfen;
+    uint64_t            first;
+    int                 ret = 0;
+    int                 k;
+
+    if (!sfenio_open_reader(&reader, input)) {
+        printf("Error: failed to open input file, %s\n", input);
+        return 1;
+    }
+    if (!sfenio_open_writer(&writer, output, false)) {
+        printf("Error: failed to open output file, %s\n", output);
+        sfenio_close_reader(&reader);
+        return 1;
+    }
+    job.positions = malloc(sizeof(struct packed_sfen)*EVALUATE_SEGMENT_SIZE);
+    if (job.positions == NULL) {
+        printf("Error: failed to allocate memory\n");
+        (void)sfenio_close_writer(&writer);
+        sfenio_close_reader(&reader);
+        return 1;
+    }
+    job.engine = engine_create(MIN_MAIN_HASH_SIZE, nthreads);
+    assert(job.engine != NULL);
+
+    /*
+     * Evaluate the input one segment at a time. The workers share each
+     * segment and the result is handed to the writer which writes it
+     * while the next segment is evaluated.
+     */
+    for (first=0;first<reader.npositions;first+=EVALUATE_SEGMENT_SIZE) {
+        job.npositions = MIN(reader.npositions-first, EVALUATE_SEGMENT_SIZE);
+        for (k=0;k<job.npositions;k++) {
+            sfen = sfenio_position(&reader, first+k);
+            if (sfen == NULL) {
+                printf("Error: invalid input file, %s\n", input);
+                ret = 1;
+                break;
+            }
+            job.positions[k] = *sfen;
+        }
+        if (ret != 0) {
+            break;
+        }
+        atomic_store(&job.next, 0);
+        atomic_store(&job.invalid, false);
+        smp_run_job(job.engine, evaluate_job_func, &job);
+        if (atomic_load(&job.invalid)) {
+            printf("Error: invalid input file, %s\n", input);
+            ret = 1;
+            break;
+        }
+        if (!sfenio_write(&writer, job.positions, job.npositions)) {
+            printf("Error: failed to write data\n");
+            ret = 1;
+            break;
+        }
+    }
+
+    engine_destroy(job.engine);
+    free(job.positions);
+    if (!sfenio_close_writer(&writer)) {
+        printf("Error: failed to write data\n");
+        ret = 1;
+    }
+    sfenio_close_reader(&reader);
+
+    return ret;
+}
+
+static int convert(char *input, char *output, bool compressed)
+{
+    struct sfen_reader reader;
+    struct sfen_writer writer;
+    struct packed_sfen *sfen;
+    uint64_t           k;
+    int                ret = 0;
+
+    if (!sfenio_open_reader(&reader, input)) {
+        printf("Error: failed to open input file, %s\n", input);
+        return 1;
+    }
+    if (!sfenio_open_writer(&writer, output, compressed)) {
+        printf("Error: failed to open output file, %s\n", output);
+        sfenio_close_reader(&reader);
+        return 1;
+    }
+
+    for (k=0;k<reader.npositions;k++) {
+        sfen = sfenio_position(&reader, k);
+        if (sfen == NULL) {
+            printf("Error: invalid input file, %s\n", input);
+            ret = 1;
+            break;
+        }
+        if (!sfenio_write(&writer, sfen, 1)) {
+            printf("Error: failed to write data\n");
+            ret = 1;
+            break;
+        }
+    }
+
+    if (!sfenio_close_writer(&writer)) {
+        printf("Error: failed to write data\n");
+        ret = 1;
+    }
+    sfenio_close_reader(&reader);
+
+    return ret;
+}
+
+static int load_benchmark_positions(char *input, struct position *pos,
+                                    struct packed_sfen *sfens, int npositions)
+{
+    struct sfen_reader reader;
+    struct packed_sfen *sfen;
+    int                k;
+
+    if (input != NULL) {
+        if (!sfenio_open_reader(&reader, input)) {
+            printf("Error: failed to open input file, %s\n", input);
+            return -1;
+        }
+        npositions = MIN((uint64_t)npositions, reader.npositions);
+        for (k=0;k<npositions;k++) {
+            sfen = sfenio_position(&reader, k);
+            if (sfen == NULL) {
+                printf("Error: invalid input file, %s\n", input);
+                npositions = -1;
+                break;
+            }
+            sfens[k] = *sfen;
+        }
+        sfenio_close_reader(&reader);
+        return npositions;
+    }
+
+    /* Generate positions by playing random moves from the start position */
+    memset(sfens, 0, sizeof(struct packed_sfen)*npositions);
+    for (k=0;k<npositions;k++) {
+        pos_setup_start_position(pos);
+        play_random_moves(pos, rand()%BENCHMARK_MAX_PLIES);
+        sfenio_encode_position(pos, sfens[k].position);
+    }
+
+    return npositions;
+}
+
+static double positions_per_second(uint64_t npositions, uint64_t start)
+{
+    uint64_t elapsed = MAX(get_current_time_us()-start, 1);
+
+    return (double)npositions/(double)elapsed;
+}
+
+static int benchmark(char *input, int npositions, int iterations)
+{
+    struct position        *pos;
+    struct nnue_batch_item item;
+    struct packed_sfen     *sfens;
+    uint8_t                data[SFEN_POSITION_SIZE];
+    uint64_t               start;
+    uint64_t               total;
+    uint64_t               checksum = 0ULL;
+    int                    nmismatches = 0;
+    int                    iter;
+    int                    k;
+
+    pos = malloc(sizeof(struct position));
+    sfens = malloc(sizeof(struct packed_sfen)*npositions);
+    if ((pos == NULL) || (sfens == NULL)) {
+        printf("Error: failed to allocate memory\n");
+        free(sfens);
+        free(pos);
+        return 1;
+    }
+    npositions = load_benchmark_positions(input, pos, sfens, npositions);
+    if (npositions < 0) {
+        free(sfens);
+        free(pos);
+        return 1;
+    }
+    total = (uint64_t)npositions*iterations;
+
+    /* Verify that all positions survive a decode/encode roundtrip */
+    for (k=0;k<npositions;k++) {
+        sfenio_decode_position(sfens[k].position, pos);
+        memset(data, 0, sizeof(data));
+        sfenio_encode_position(pos, data);
+        if (!sfenio_decode_batch_item(sfens[k].position, &item) ||
+            (memcmp(data, sfens[k].position, sizeof(data)) != 0) ||
+            (item.npieces != BITCOUNT(pos->bb_all)) ||
+            (item.stm != pos->stm)) {
+            nmismatches++;
+        }
+    }
+
+    start = get_current_time_us();
+    for (iter=0;iter<iterations;iter++) {
+        for (k=0;k<npositions;k++) {
+            sfenio_decode_position(sfens[k].position, pos);
+            checksum += pos->key;
+        }
+    }
+    printf("Decode position:   %.2f Mpos/s\n",
+           positions_per_second(total, start));
+
+    start = get_current_time_us();
+    for (iter=0;iter<iterations;iter++) {
+        for (k=0;k<npositions;k++) {
+            if (sfenio_decode_batch_item(sfens[k].position, &item)) {
+                checksum += item.npieces + item.squares[item.npieces-1];
+            }
+        }
+    }
+    printf("Decode batch item: %.2f Mpos/s\n",
+           positions_per_second(total, start));
+
+    sfenio_decode_position(sfens[npositions-1].position, pos);
+    start = get_current_time_us();
+    for (iter=0;iter<iterations;iter++) {
+        for (k=0;k<npositions;k++) {
+            memset(data, 0, sizeof(data));
+            sfenio_encode_position(pos, data);
+            checksum += data[k%SFEN_POSITION_SIZE];
+        }
+    }
+    printf("Encode position:   %.2f Mpos/s\n",
+           positions_per_second(total, start));
+
+    printf("Positions: %d, roundtrip mismatches: %d (checksum %016"PRIx64")\n",
+           npositions, nmismatches, checksum);
+
+    free(sfens);
+    free(pos);
+
+    return (nmismatches == 0)?0:1;
+}
+
+static void generate_usage(void)
+{
+    printf("marvin --generate <options>\n");
+    printf("Options:\n");
+    printf("\t--output (-o) <file>\n");
+    printf("\t--depth (-d) <file>\n");
+    printf("\t--npositions (-n) <int>\n");
+    printf("\t--seed (-d) <int>\n");
+    printf("\t--frc-prob (-f) <float>\n");
+    printf("\t--threads (-t) <int>\n");
+    printf("\t--dedup (-u) <MB>\n");
+    printf("\t--compress (-c)\n");
+    printf("\t--help (-h) <int>\n");
+}
+
+static void rescore_usage(void)
+{
+    printf("marvin --rescore <options>\n");
+    printf("Options:\n");
+    printf("\t--input (-i) <file>\n");
+    printf("\t--output (-o) <file>\n");
     printf("\t--depth (-d) <file>\n");
     printf("\t--npositions (-n) <int>\n");
     printf("\t--offset (-f) <int>\n");
+    printf("\t--threads (-t) <int>\n");
+    printf("\t--help (-h) <int>\n");
+}
+
+static void evaluate_usage(void)
+{
+    printf("marvin --evaluate <options>\n");
+    printf("Options:\n");
+    printf("\t--input (-i) <file>\n");
+    printf("\t--output (-o) <file>\n");
+    printf("\t--threads (-t) <int>\n");
+    printf("\t--help (-h) <int>\n");
+}
+
+static void convert_usage(void)
+{
+    printf("marvin --convert <options>\n");
+    printf("Options:\n");
+    printf("\t--input (-i) <file>\n");
+    printf("\t--output (-o) <file>\n");
+    printf("\t--compress (-c)\n");
+    printf("\t--help (-h) <int>\n");
+}
+
+static void benchmark_usage(void)
+{
+    printf("marvin --sfen-bench <options>\n");
+    printf("Options:\n");
+    printf("\t--input (-i) <file>\n");
+    printf("\t--npositions (-n) <int>\n");
+    printf("\t--iterations (-r) <int>\n");
     printf("\t--help (-h) <int>\n");
 }
 
@@ -657,6 +1348,9 @@ int sfen_generate(int argc, char *argv[])
     int64_t npositions = -1;
     int     seed = time(NULL);
     double  frc_prob = 0.0;
+    int     nthreads = 1;
+    int     filter_size = 0;
+    bool    compressed = false;
 
     /* Parse command line options */
     iter = 2;
@@ -685,6 +1379,18 @@ int sfen_generate(int argc, char *argv[])
                    ((iter+1) < argc)) {
             iter++;
             frc_prob = atof(argv[iter]);
+        } else if ((MATCH(argv[iter], "-t") ||
+                    MATCH(argv[iter], "--threads")) &&
+                   ((iter+1) < argc)) {
+            iter++;
+            nthreads = atoi(argv[iter]);
+        } else if ((MATCH(argv[iter], "-u") ||
+                    MATCH(argv[iter], "--dedup")) &&
+                   ((iter+1) < argc)) {
+            iter++;
+            filter_size = atoi(argv[iter]);
+        } else if (MATCH(argv[iter], "-c") || MATCH(argv[iter], "--compress")) {
+            compressed = true;
         } else if (MATCH(argv[iter], "-h") || MATCH(argv[iter], "--help")) {
             generate_usage();
             return 0;
@@ -700,16 +1406,15 @@ int sfen_generate(int argc, char *argv[])
     /* Validate options */
     if (!output_file ||
         (depth <= 0) || (depth >= MAX_SEARCH_DEPTH) ||
-        (npositions <= 0) || (frc_prob < 0.0) || (frc_prob >= 1.0)) {
+        (npositions <= 0) || (frc_prob < 0.0) || (frc_prob >= 1.0) ||
+        (nthreads <= 0) || (nthreads > MAX_GENERATORS) || (filter_size < 0)) {
         printf("Error: invalid options\n");
         generate_usage();
         return 1;
     }
 
-    /* Initialize random number generator */
-    srand(seed);
-
-    return generate(output_file, depth, npositions, frc_prob);
+    return generate(output_file, depth, npositions, frc_prob, nthreads, seed,
+                    filter_size, compressed);
 }
 
 int sfen_rescore(int argc, char *argv[])
@@ -720,6 +1425,7 @@ int sfen_rescore(int argc, char *argv[])
     int      depth = 8;
     int      offset = 0;
     int64_t  npositions = -1;
+    int      nthreads = 1;
 
     /* Parse command line options */
     iter = 2;
@@ -748,6 +1454,11 @@ int sfen_rescore(int argc, char *argv[])
                    ((iter+1) < argc)) {
             iter++;
             offset = atoi(argv[iter]);
+        } else if ((MATCH(argv[iter], "-t") ||
+                    MATCH(argv[iter], "--threads")) &&
+                   ((iter+1) < argc)) {
+            iter++;
+            nthreads = atoi(argv[iter]);
         } else if (MATCH(argv[iter], "-h") || MATCH(argv[iter], "--help")) {
             rescore_usage();
             return 0;
@@ -764,11 +1475,149 @@ int sfen_rescore(int argc, char *argv[])
     if (!input_file || !output_file ||
         (depth <= 0) || (depth >= MAX_SEARCH_DEPTH) ||
         (offset < 0) ||
-        (npositions == 0)) {
+        (npositions == 0) ||
+        (nthreads <= 0) || (nthreads > MAX_GENERATORS)) {
         printf("Error: invalid options\n");
         rescore_usage();
         return 1;
     }
 
-    return rescore(input_file, output_file, depth, npositions, offset);
+    return rescore(input_file, output_file, depth, npositions, offset,
+                   nthreads);
+}
+
+int sfen_evaluate(int argc, char *argv[])
+{
+    int  iter;
+    char *input_file = NULL;
+    char *output_file = NULL;
+    int  nthreads = 1;
+
+    /* Parse command line options */
+    iter = 2;
+    while (iter < argc) {
+        if ((MATCH(argv[iter], "-i") || MATCH(argv[iter], "--input")) &&
+            ((iter+1) < argc)) {
+            iter++;
+            input_file = argv[iter];
+        } else if ((MATCH(argv[iter], "-o") ||
+                    MATCH(argv[iter], "--output")) &&
+                   ((iter+1) < argc)) {
+            iter++;
+            output_file = argv[iter];
+        } else if ((MATCH(argv[iter], "-t") ||
+                    MATCH(argv[iter], "--threads")) &&
+                   ((iter+1) < argc)) {
+            iter++;
+            nthreads = atoi(argv[iter]);
+        } else if (MATCH(argv[iter], "-h") || MATCH(argv[iter], "--help")) {
+            evaluate_usage();
+            return 0;
+        } else {
+            printf("Error: unknown argument, %s\n", argv[iter]);
+            evaluate_usage();
+            return 1;
+        }
+
+        iter++;
+    }
+
+    /* Validate options */
+    if (!input_file || !output_file || (nthreads <= 0) ||
+        (nthreads > MAX_WORKERS)) {
+        printf("Error: invalid options\n");
+        evaluate_usage();
+        return 1;
+    }
+
+    return evaluate(input_file, output_file, nthreads);
+}
+
+int sfen_convert(int argc, char *argv[])
+{
+    int  iter;
+    char *input_file = NULL;
+    char *output_file = NULL;
+    bool compressed = false;
+
+    /* Parse command line options */
+    iter = 2;
+    while (iter < argc) {
+        if ((MATCH(argv[iter], "-i") || MATCH(argv[iter], "--input")) &&
+            ((iter+1) < argc)) {
+            iter++;
+            input_file = argv[iter];
+        } else if ((MATCH(argv[iter], "-o") ||
+                    MATCH(argv[iter], "--output")) &&
+                   ((iter+1) < argc)) {
+            iter++;
+            output_file = argv[iter];
+        } else if (MATCH(argv[iter], "-c") || MATCH(argv[iter], "--compress")) {
+            compressed = true;
+        } else if (MATCH(argv[iter], "-h") || MATCH(argv[iter], "--help")) {
+            convert_usage();
+            return 0;
+        } else {
+            printf("Error: unknown argument, %s\n", argv[iter]);
+            convert_usage();
+            return 1;
+        }
+
+        iter++;
+    }
+
+    /* Validate options */
+    if (!input_file || !output_file) {
+        printf("Error: invalid options\n");
+        convert_usage();
+        return 1;
+    }
+
+    return convert(input_file, output_file, compressed);
+}
+
+int sfen_benchmark(int argc, char *argv[])
+{
+    int  iter;
+    char *input_file = NULL;
+    int  npositions = BENCHMARK_POSITIONS;
+    int  iterations = 10;
+
+    /* Parse command line options */
+    iter = 2;
+    while (iter < argc) {
+        if ((MATCH(argv[iter], "-i") || MATCH(argv[iter], "--input")) &&
+            ((iter+1) < argc)) {
+            iter++;
+            input_file = argv[iter];
+        } else if ((MATCH(argv[iter], "-n") ||
+                    MATCH(argv[iter], "--npositions")) &&
+                   ((iter+1) < argc)) {
+            iter++;
+            npositions = atoi(argv[iter]);
+        } else if ((MATCH(argv[iter], "-r") ||
+                    MATCH(argv[iter], "--iterations")) &&
+                   ((iter+1) < argc)) {
+            iter++;
+            iterations = atoi(argv[iter]);
+        } else if (MATCH(argv[iter], "-h") || MATCH(argv[iter], "--help")) {
+            benchmark_usage();
+            return 0;
+        } else {
+            printf("Error: unknown argument, %s\n", argv[iter]);
+            benchmark_usage();
+            return 1;
+        }
+
+        iter++;
+    }
+
+    /* Validate options */
+    if ((npositions <= 0) || (iterations <= 0)) {
+        printf("Error: invalid options\n");
+        benchmark_usage();
+        return 1;
+    }
+
+    return benchmark(input_file, npositions, iterations);
 }
@@ -36,4 +36,34 @@ int sfen_generate(int argc, char *argv[]);
  */
 int sfen_rescore(int argc, char *argv[]);
 
+/*
+ * Evaluate all positions in a sfen file in bin format using the static
+ * NNUE evaluation. The positions are written to the output file with
+ * the score replaced by the static evaluation.
+ *
+ * @param argc The number of command line arguments.
+ * @param argv The command line arguments.
+ * @return Return 0 on success or a positive value in case of error.
+ */
+int sfen_evaluate(int argc, char *argv[]);
+
+/*
+ * Convert a sfen file between the plain and the compressed format.
+ *
+ * @param argc The number of command line arguments.
+ * @param argv The command line arguments.
+ * @return Return 0 on success or a positive value in case of error.
+ */
+int sfen_convert(int argc, char *argv[]);
+
+/*
+ * Measure the throughput of the sfen encoder and decoders, either on the
+ * positions in a sfen file or on positions generated by random playouts.
+ *
+ * @param argc The number of command line arguments.
+ * @param argv The command line arguments.
+ * @return Return 0 on success or a positive value in case of error.
+ */
+int sfen_benchmark(int argc, char *argv[]);
+
 #endif
@@ -0,0 +1,1168 @@
+/*
+ * Marvin - an UCI/XBoard compatible chess engine
+ * Copyright (C) 2023 Martin Danielsson
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "sfenio.h"
+#include "utils.h"
+#include "bitboard.h"
+#include "position.h"
+#include "key.h"
+#include "data.h"
+#include "movegen.h"
+
+/*
+ * The size of each write buffer. Large chunks keep the number of
+ * system calls low when writing to fast storage.
+ */
+#define WRITE_BUFFER_SIZE (SFEN_BIN_SIZE*100000)
+
+/* Magic values identifying a compressed sfen file and its index */
+#define CONTAINER_MAGIC "MRVNSFEN"
+#define INDEX_MAGIC 0x58444E49
+#define CONTAINER_VERSION 1
+
+/* Sizes of the different parts of a compressed sfen file */
+#define CONTAINER_HEADER_SIZE 16
+#define CHUNK_HEADER_SIZE 8
+#define INDEX_ENTRY_SIZE 16
+#define INDEX_TRAILER_SIZE 32
+
+/*
+ * The maximum size of an encoded position in a chunk, a flag byte, the
+ * board with its length, the ply and score as varints, the move, the
+ * result and the padding.
+ */
+#define MAX_ENCODED_SIZE (1+1+SFEN_POSITION_SIZE+3+3+2+1+1)
+
+/* Flags for each position in a chunk */
+#define FLAG_DERIVED 0x01
+#define FLAG_SAME_RESULT 0x02
+#define FLAG_DEFAULT_PADDING 0x04
+
+/* The padding used by positions generated with --generate */
+#define DEFAULT_PADDING 0xFF
+
+/*
+ * Pieces are Huffman coded with the bits stored least significant bit
+ * first. An empty square is a single 0 bit while a piece is a 4-bit code
+ * followed by the color of the piece.
+ */
+#define EMPTY_SQUARE_BITS 1
+#define PIECE_BITS 5
+
+/* The 4-bit code of each piece type, indexed by VALUE(piece)/2 */
+static uint8_t piece_codes[] = {0b0001, 0b0011, 0b0101, 0b0111, 0b1001};
+
+/*
+ * The number of bits decoded with each lookup in the decode table. The
+ * longest code is PIECE_BITS bits so each lookup decodes at least one
+ * square.
+ */
+#define DECODE_BITS 8
+
+/*
+ * Entry in the decode table. Each entry holds all complete codes that are
+ * found in a DECODE_BITS-bit window together with the number of bits that
+ * are used after each code.
+ */
+struct decode_entry {
+    uint8_t nsquares;
+    uint8_t pieces[DECODE_BITS];
+    uint8_t ends[DECODE_BITS];
+};
+
+/* Table for decoding the next DECODE_BITS bits of the board */
+static struct decode_entry decode_table[1 << DECODE_BITS];
+
+/* Table with the complete code, including color, of each piece */
+static struct {
+    uint8_t code;
+    uint8_t nbits;
+} encode_table[NPIECES+1];
+
+/*
+ * Reader for bits of an encoded position. The data is copied to a padded
+ * buffer so that 64 bits can always be read at the current position, even
+ * for corrupt positions where the board is encoded using more bits than
+ * are available.
+ */
+struct bit_reader {
+    uint8_t buffer[SFEN_POSITION_SIZE*2];
+    int     cursor;
+};
+
+/* Writer for bits of an encoded position */
+struct bit_writer {
+    uint8_t  *data;
+    uint64_t bits;
+    int      nbits;
+};
+
+static void init_reader(struct bit_reader *reader, uint8_t *data)
+{
+    memcpy(reader->buffer, data, SFEN_POSITION_SIZE);
+    memset(reader->buffer+SFEN_POSITION_SIZE, 0, SFEN_POSITION_SIZE);
+    reader->cursor = 0;
+}
+
+static uint64_t peek_bits(struct bit_reader *reader)
+{
+    return read_uint64_le(&reader->buffer[reader->cursor/8]) >>
+                                                        (reader->cursor&7);
+}
+
+static int read_bits(struct bit_reader *reader, int nbits)
+{
+    int value = (int)(peek_bits(reader)&((1ULL << nbits) - 1));
+
+    reader->cursor += nbits;
+    return value;
+}
+
+static void write_bits(struct bit_writer *writer, uint32_t value, int nbits)
+{
+    writer->bits |= (uint64_t)value << writer->nbits;
+    writer->nbits += nbits;
+    while (writer->nbits >= 8) {
+        *(writer->data++) |= (uint8_t)writer->bits;
+        writer->bits >>= 8;
+        writer->nbits -= 8;
+    }
+}
+
+static void flush_bits(struct bit_writer *writer)
+{
+    if (writer->nbits > 0) {
+        *writer->data |= (uint8_t)writer->bits;
+    }
+}
+
+static void add_piece(struct position *pos, int piece, int sq)
+{
+    pos->pieces[sq] = piece;
+    SETBIT(pos->bb_pieces[piece], sq);
+    SETBIT(pos->bb_sides[COLOR(piece)], sq);
+    SETBIT(pos->bb_all, sq);
+    pos->key = key_set_piece(pos->key, piece, sq);
+}
+
+/*
+ * Decode the pieces on the board. The squares are stored from a8 to h1,
+ * skipping the squares of the two kings which are encoded separately.
+ *
+ * @param reader The reader to use.
+ * @param wk The square of the white king.
+ * @param bk The square of the black king.
+ * @param squares Array to store the square of each piece in.
+ * @param pieces Array to store each piece in.
+ * @param max_pieces The capacity of the squares and pieces arrays.
+ * @return Returns the number of pieces found, or -1 if there are more
+ *         than max_pieces pieces.
+ */
+static int decode_board(struct bit_reader *reader, int wk, int bk,
+                        uint8_t *squares, uint8_t *pieces, int max_pieces)
+{
+    struct decode_entry *entry;
+    int                 nsquares;
+    int                 npieces = 0;
+    int                 index = 0;
+    int                 n;
+    int                 k;
+
+    /* The index is the position of the square in the encoded board */
+    nsquares = (wk == bk)?NSQUARES-1:NSQUARES-2;
+    while (nsquares > 0) {
+        entry = &decode_table[peek_bits(reader)&((1 << DECODE_BITS) - 1)];
+        n = MIN(entry->nsquares, nsquares);
+        for (k=0;k<n;k++) {
+            while (((index^56) == wk) || ((index^56) == bk)) {
+                index++;
+            }
+            if (entry->pieces[k] != NO_PIECE) {
+                if (npieces == max_pieces) {
+                    return -1;
+                }
+                squares[npieces] = index^56;
+                pieces[npieces] = entry->pieces[k];
+                npieces++;
+            }
+            index++;
+        }
+        reader->cursor += entry->ends[n-1];
+        nsquares -= n;
+    }
+
+    return npieces;
+}
+
+static int white_result(struct packed_sfen *sfen)
+{
+    return ((sfen->position[0]&1) == WHITE)?sfen->stm_result:
+                                            -sfen->stm_result;
+}
+
+static int predicted_score(struct packed_sfen *prev,
+                           struct packed_sfen *sfen)
+{
+    if (prev == NULL) {
+        return 0;
+    }
+    return ((prev->position[0]&1) == (sfen->position[0]&1))?
+                                        prev->stm_score:-prev->stm_score;
+}
+
+/*
+ * Find the position reached by playing the move of a position. Returns
+ * false if the move is not legal in the position.
+ *
+ * Consecutive positions in a chunk usually come from the same game so
+ * the board is only decoded if pos doesn't already hold the previous
+ * position. The move is then matched against the pseudo legal moves and
+ * pos_make_move takes care of rejecting it if it turns out to be illegal.
+ */
+static bool derive_position(struct packed_sfen *prev, struct position *pos,
+                            bool reuse, uint8_t *data)
+{
+    struct movelist list;
+    int             k;
+
+    if (!reuse || (pos->ply >= (MAX_HISTORY_SIZE-1))) {
+        sfenio_decode_position(prev->position, pos);
+    }
+    gen_moves(pos, &list);
+    for (k=0;k<list.size;k++) {
+        if (sfenio_encode_move(list.moves[k]) == prev->move) {
+            break;
+        }
+    }
+    if ((k == list.size) || !pos_make_move(pos, list.moves[k])) {
+        return false;
+    }
+
+    memset(data, 0, SFEN_POSITION_SIZE);
+    sfenio_encode_position(pos, data);
+
+    return true;
+}
+
+static uint8_t* write_varint(uint8_t *iter, int value)
+{
+    uint32_t v = ((uint32_t)value << 1)^(uint32_t)(value >> 31);
+
+    while (v >= 0x80) {
+        *(iter++) = (uint8_t)(v|0x80);
+        v >>= 7;
+    }
+    *(iter++) = (uint8_t)v;
+
+    return iter;
+}
+
+static uint8_t* read_varint(uint8_t *iter, uint8_t *end, int *value)
+{
+    uint32_t v = 0;
+    int      shift = 0;
+
+    while ((iter < end) && (shift < 32)) {
+        v |= (uint32_t)(*iter&0x7F) << shift;
+        if ((*(iter++)&0x80) == 0) {
+            *value = (int)(v >> 1)^-(int)(v&1);
+            return iter;
+        }
+        shift += 7;
+    }
+
+    return NULL;
+}
+
+/*
+ * Encode a chunk of positions. The first position is always stored in
+ * full so that each chunk can be decoded independently.
+ */
+static int encode_chunk(struct packed_sfen *sfens, int nsfens,
+                        struct position *pos, uint8_t *data)
+{
+    struct packed_sfen *prev = NULL;
+    struct packed_sfen *sfen;
+    uint8_t            derived[SFEN_POSITION_SIZE];
+    uint8_t            *iter = data;
+    uint8_t            *flags;
+    bool               reuse = false;
+    int                len;
+    int                k;
+
+    for (k=0;k<nsfens;k++) {
+        sfen = &sfens[k];
+        flags = iter++;
+        *flags = 0;
+
+        /* The board, unless it can be derived from the previous position */
+        if ((prev != NULL) && (sfen->ply == (prev->ply+1)) &&
+            derive_position(prev, pos, reuse, derived) &&
+            (memcmp(derived, sfen->position, SFEN_POSITION_SIZE) == 0)) {
+            *flags |= FLAG_DERIVED;
+            reuse = true;
+        } else {
+            reuse = false;
+            len = SFEN_POSITION_SIZE;
+            while ((len > 0) && (sfen->position[len-1] == 0)) {
+                len--;
+            }
+            *(iter++) = (uint8_t)len;
+            memcpy(iter, sfen->position, len);
+            iter += len;
+            iter = write_varint(iter, sfen->ply-((prev != NULL)?prev->ply:0));
+        }
+
+        /* Score, move, result and padding */
+        iter = write_varint(iter, sfen->stm_score-predicted_score(prev, sfen));
+        write_uint16_le(iter, sfen->move);
+        iter += 2;
+        if ((prev != NULL) && (white_result(prev) == white_result(sfen))) {
+            *flags |= FLAG_SAME_RESULT;
+        } else {
+            *(iter++) = (uint8_t)sfen->stm_result;
+        }
+        if (sfen->padding == DEFAULT_PADDING) {
+            *flags |= FLAG_DEFAULT_PADDING;
+        } else {
+            *(iter++) = sfen->padding;
+        }
+
+        prev = sfen;
+    }
+
+    return (int)(iter-data);
+}
+
+static bool decode_chunk(uint8_t *data, int size, struct position *pos,
+                         struct packed_sfen *sfens, int nsfens)
+{
+    struct packed_sfen *prev = NULL;
+    struct packed_sfen *sfen;
+    uint8_t            *iter = data;
+    uint8_t            *end = data + size;
+    uint8_t            flags;
+    bool               reuse = false;
+    int                value;
+    int                len;
+    int                k;
+
+    for (k=0;k<nsfens;k++) {
+        sfen = &sfens[k];
+        memset(sfen, 0, sizeof(struct packed_sfen));
+        if (iter >= end) {
+            return false;
+        }
+        flags = *(iter++);
+
+        if ((flags&FLAG_DERIVED) != 0) {
+            if ((prev == NULL) ||
+                !derive_position(prev, pos, reuse, sfen->position)) {
+                return false;
+            }
+            sfen->ply = prev->ply + 1;
+            reuse = true;
+        } else {
+            reuse = false;
+            if ((iter >= end) || (*iter > SFEN_POSITION_SIZE) ||
+                ((end-iter) < (*iter+1))) {
+                return false;
+            }
+            len = *(iter++);
+            memcpy(sfen->position, iter, len);
+            iter += len;
+            iter = read_varint(iter, end, &value);
+            if (iter == NULL) {
+                return false;
+            }
+            sfen->ply = ((prev != NULL)?prev->ply:0) + value;
+        }
+
+        iter = read_varint(iter, end, &value);
+        if ((iter == NULL) || ((end-iter) < 2)) {
+            return false;
+        }
+        sfen->stm_score = predicted_score(prev, sfen) + value;
+        sfen->move = read_uint16_le(iter);
+        iter += 2;
+        if ((flags&FLAG_SAME_RESULT) != 0) {
+            if (prev == NULL) {
+                return false;
+            }
+            sfen->stm_result = ((sfen->position[0]&1) == WHITE)?
+                                    white_result(prev):-white_result(prev);
+        } else {
+            if (iter >= end) {
+                return false;
+            }
+            sfen->stm_result = (int8_t)*(iter++);
+        }
+        if ((flags&FLAG_DEFAULT_PADDING) != 0) {
+            sfen->padding = DEFAULT_PADDING;
+        } else {
+            if (iter >= end) {
+                return false;
+            }
+            sfen->padding = *(iter++);
+        }
+
+        prev = sfen;
+    }
+
+    return iter == end;
+}
+
+static bool add_index_entry(struct sfen_index *index, uint64_t offset,
+                            uint64_t first)
+{
+    uint64_t *offsets;
+    uint64_t *firsts;
+
+    if (index->nchunks == index->max_chunks) {
+        index->max_chunks = MAX(2*index->max_chunks, 1024);
+        offsets = realloc(index->offsets, index->max_chunks*sizeof(uint64_t));
+        if (offsets != NULL) {
+            index->offsets = offsets;
+        }
+        firsts = realloc(index->firsts, index->max_chunks*sizeof(uint64_t));
+        if (firsts != NULL) {
+            index->firsts = firsts;
+        }
+        if ((offsets == NULL) || (firsts == NULL)) {
+            return false;
+        }
+    }
+    index->offsets[index->nchunks] = offset;
+    index->firsts[index->nchunks] = first;
+    index->nchunks++;
+
+    return true;
+}
+
+static void free_index(struct sfen_index *index)
+{
+    free(index->offsets);
+    free(index->firsts);
+    memset(index, 0, sizeof(struct sfen_index));
+}
+
+static bool is_compressed(uint8_t *data, uint64_t size)
+{
+    return (size >= CONTAINER_HEADER_SIZE) &&
+           (memcmp(data, CONTAINER_MAGIC, 8) == 0);
+}
+
+/*
+ * Load the index of a compressed file. If the file does not end with a
+ * valid index, for instance because the writer was interrupted, then the
+ * index is rebuilt by scanning all complete chunks.
+ */
+static bool load_index(uint8_t *data, uint64_t size, struct sfen_index *index)
+{
+    uint8_t  *trailer;
+    uint8_t  *entry;
+    uint64_t offset;
+    uint64_t nchunks;
+    uint64_t k;
+    uint32_t nsfens;
+    uint32_t len;
+
+    memset(index, 0, sizeof(struct sfen_index));
+    if ((read_uint32_le(data+8) != CONTAINER_VERSION) ||
+        (read_uint32_le(data+12) != SFEN_CHUNK_SIZE)) {
+        return false;
+    }
+
+    if (size >= (CONTAINER_HEADER_SIZE+INDEX_TRAILER_SIZE)) {
+        trailer = data + size - INDEX_TRAILER_SIZE;
+        offset = read_uint64_le(trailer);
+        nchunks = read_uint64_le(trailer+8);
+        if ((read_uint32_le(trailer+24) == INDEX_MAGIC) &&
+            (offset >= CONTAINER_HEADER_SIZE) &&
+            (nchunks <= (size/INDEX_ENTRY_SIZE)) &&
+            ((offset+nchunks*INDEX_ENTRY_SIZE+INDEX_TRAILER_SIZE) == size)) {
+            for (k=0;k<nchunks;k++) {
+                entry = data + offset + k*INDEX_ENTRY_SIZE;
+                if (!add_index_entry(index, read_uint64_le(entry),
+                                     read_uint64_le(entry+8))) {
+                    free_index(index);
+                    return false;
+                }
+            }
+            index->npositions = read_uint64_le(trailer+16);
+            index->end = offset;
+            return true;
+        }
+    }
+
+    offset = CONTAINER_HEADER_SIZE;
+    while ((offset+CHUNK_HEADER_SIZE) <= size) {
+        nsfens = read_uint32_le(data+offset);
+        len = read_uint32_le(data+offset+4);
+        if ((nsfens == 0) || (nsfens > SFEN_CHUNK_SIZE) ||
+            ((offset+CHUNK_HEADER_SIZE+len) > size)) {
+            break;
+        }
+        if (!add_index_entry(index, offset, index->npositions)) {
+            free_index(index);
+            return false;
+        }
+        index->npositions += nsfens;
+        offset += CHUNK_HEADER_SIZE + len;
+    }
+    index->end = offset;
+
+    return true;
+}
+
+static bool open_index(char *path, struct sfen_index *index, bool *compressed)
+{
+    uint8_t  *data;
+    uint64_t size;
+    bool     ret = true;
+
+    memset(index, 0, sizeof(struct sfen_index));
+    *compressed = false;
+    if (get_file_size(path) <= 0) {
+        return true;
+    }
+    data = map_file(path, &size);
+    if (data == NULL) {
+        return false;
+    }
+    if (is_compressed(data, size)) {
+        *compressed = true;
+        ret = load_index(data, size, index);
+    }
+    unmap_file(data, size);
+
+    return ret;
+}
+
+static thread_retval_t writer_thread_func(void *data)
+{
+    struct sfen_writer *writer = data;
+    uint8_t            *buffer;
+
+    while (true) {
+        event_wait(&writer->write_event);
+        if (writer->stop) {
+            break;
+        }
+
+        buffer = writer->buffers[writer->current^1];
+        if (fwrite(buffer, 1, writer->write_len, writer->fp) !=
+                                                (size_t)writer->write_len) {
+            atomic_store(&writer->error, true);
+        }
+        if (fflush(writer->fp) != 0) {
+            atomic_store(&writer->error, true);
+        }
+        event_set(&writer->done_event);
+    }
+
+    return (thread_retval_t)0;
+}
+
+static void wait_for_write(struct sfen_writer *writer)
+{
+    if (writer->pending) {
+        event_wait(&writer->done_event);
+        writer->pending = false;
+    }
+}
+
+static void submit_buffer(struct sfen_writer *writer)
+{
+    /*
+     * Wait for the previous write to complete before handing over
+     * the current buffer to the writer thread.
+     */
+    wait_for_write(writer);
+    writer->write_len = writer->len;
+    writer->current ^= 1;
+    writer->len = 0;
+    writer->pending = true;
+    event_set(&writer->write_event);
+}
+
+static uint64_t find_chunk(struct sfen_index *index, uint64_t idx)
+{
+    uint64_t low = 0;
+    uint64_t high = index->nchunks - 1;
+    uint64_t mid;
+
+    while (low < high) {
+        mid = (low+high+1)/2;
+        if (index->firsts[mid] <= idx) {
+            low = mid;
+        } else {
+            high = mid - 1;
+        }
+    }
+
+    return low;
+}
+
+static bool load_chunk(struct sfen_reader *reader, uint64_t k)
+{
+    struct sfen_index *index = &reader->index;
+    uint64_t          offset = index->offsets[k];
+    uint64_t          next;
+    uint32_t          nsfens;
+    uint32_t          len;
+
+    reader->chunk_len = 0;
+    next = (k < (index->nchunks-1))?index->firsts[k+1]:index->npositions;
+    if ((offset+CHUNK_HEADER_SIZE) > reader->size) {
+        return false;
+    }
+    nsfens = read_uint32_le(reader->data+offset);
+    len = read_uint32_le(reader->data+offset+4);
+    if ((nsfens == 0) || (nsfens > SFEN_CHUNK_SIZE) ||
+        (nsfens != (next-index->firsts[k])) ||
+        ((offset+CHUNK_HEADER_SIZE+len) > reader->size) ||
+        !decode_chunk(reader->data+offset+CHUNK_HEADER_SIZE, len,
+                      reader->pos, reader->chunk, nsfens)) {
+        return false;
+    }
+    reader->chunk_first = index->firsts[k];
+    reader->chunk_len = nsfens;
+
+    return true;
+}
+
+bool sfenio_open_reader(struct sfen_reader *reader, char *path)
+{
+    assert(reader != NULL);
+    assert(path != NULL);
+
+    memset(reader, 0, sizeof(struct sfen_reader));
+    reader->data = map_file(path, &reader->size);
+    if (reader->data == NULL) {
+        return false;
+    }
+
+    /* Plain files are just an array of positions */
+    if (!is_compressed(reader->data, reader->size)) {
+        if ((reader->size%SFEN_BIN_SIZE) != 0ULL) {
+            sfenio_close_reader(reader);
+            return false;
+        }
+        reader->npositions = reader->size/SFEN_BIN_SIZE;
+        return true;
+    }
+
+    /* Compressed files are decoded one chunk at a time */
+    reader->compressed = true;
+    reader->chunk = malloc(sizeof(struct packed_sfen)*SFEN_CHUNK_SIZE);
+    reader->pos = malloc(sizeof(struct position));
+    if ((reader->chunk == NULL) || (reader->pos == NULL) ||
+        !load_index(reader->data, reader->size, &reader->index)) {
+        sfenio_close_reader(reader);
+        return false;
+    }
+    reader->npositions = reader->index.npositions;
+
+    return true;
+}
+
+void sfenio_close_reader(struct sfen_reader *reader)
+{
+    assert(reader != NULL);
+
+    if (reader->data != NULL) {
+        unmap_file(reader->data, reader->size);
+        reader->data = NULL;
+    }
+    free_index(&reader->index);
+    free(reader->chunk);
+    free(reader->pos);
+    reader->chunk = NULL;
+    reader->pos = NULL;
+}
+
+struct packed_sfen* sfenio_position(struct sfen_reader *reader, uint64_t idx)
+{
+    assert(reader != NULL);
+    assert(idx < reader->npositions);
+
+    if (!reader->compressed) {
+        return (struct packed_sfen*)(reader->data + idx*SFEN_BIN_SIZE);
+    }
+
+    if ((reader->chunk_len == 0) || (idx < reader->chunk_first) ||
+        (idx >= (reader->chunk_first+reader->chunk_len))) {
+        if (!load_chunk(reader, find_chunk(&reader->index, idx))) {
+            return NULL;
+        }
+    }
+
+    return &reader->chunk[idx-reader->chunk_first];
+}
+
+static void append_data(struct sfen_writer *writer, uint8_t *data, int size)
+{
+    int n;
+
+    writer->offset += size;
+    while (size > 0) {
+        n = MIN(size, WRITE_BUFFER_SIZE-writer->len);
+        memcpy(writer->buffers[writer->current]+writer->len, data, n);
+        writer->len += n;
+        data += n;
+        size -= n;
+        if (writer->len == WRITE_BUFFER_SIZE) {
+            submit_buffer(writer);
+        }
+    }
+}
+
+static void write_chunk(struct sfen_writer *writer)
+{
+    uint8_t *data = writer->chunk_data;
+    int     len;
+
+    if (writer->chunk_len == 0) {
+        return;
+    }
+    if (!add_index_entry(&writer->index, writer->offset,
+                         writer->index.npositions)) {
+        atomic_store(&writer->error, true);
+        return;
+    }
+
+    len = encode_chunk(writer->chunk, writer->chunk_len, writer->pos,
+                       data+CHUNK_HEADER_SIZE);
+    write_uint32_le(data, writer->chunk_len);
+    write_uint32_le(data+4, len);
+    append_data(writer, data, CHUNK_HEADER_SIZE+len);
+    writer->index.npositions += writer->chunk_len;
+    writer->chunk_len = 0;
+}
+
+static void write_index(struct sfen_writer *writer)
+{
+    struct sfen_index *index = &writer->index;
+    uint8_t           data[INDEX_TRAILER_SIZE];
+    uint64_t          offset = writer->offset;
+    uint64_t          k;
+
+    for (k=0;k<index->nchunks;k++) {
+        write_uint64_le(data, index->offsets[k]);
+        write_uint64_le(data+8, index->firsts[k]);
+        append_data(writer, data, INDEX_ENTRY_SIZE);
+    }
+    memset(data, 0, sizeof(data));
+    write_uint64_le(data, offset);
+    write_uint64_le(data+8, index->nchunks);
+    write_uint64_le(data+16, index->npositions);
+    write_uint32_le(data+24, INDEX_MAGIC);
+    write_uint32_le(data+28, CONTAINER_VERSION);
+    append_data(writer, data, INDEX_TRAILER_SIZE);
+}
+
+static bool open_compressed_writer(struct sfen_writer *writer, char *path)
+{
+    uint8_t header[CONTAINER_HEADER_SIZE];
+    bool    compressed;
+
+    writer->chunk = malloc(sizeof(struct packed_sfen)*SFEN_CHUNK_SIZE);
+    writer->chunk_data = malloc(MAX_ENCODED_SIZE*SFEN_CHUNK_SIZE+
+                                CHUNK_HEADER_SIZE);
+    writer->pos = malloc(sizeof(struct position));
+    if ((writer->chunk == NULL) || (writer->chunk_data == NULL) ||
+        (writer->pos == NULL)) {
+        return false;
+    }
+
+    /*
+     * When appending to an existing file the index is dropped and then
+     * written again, including the new chunks, when the file is closed.
+     */
+    if (!open_index(path, &writer->index, &compressed)) {
+        return false;
+    }
+    if (writer->index.end > 0) {
+        if (!truncate_file(path, writer->index.end)) {
+            return false;
+        }
+        writer->offset = writer->index.end;
+    } else if (get_file_size(path) > 0) {
+        return false;
+    }
+
+    writer->fp = fopen(path, "ab");
+    if (writer->fp == NULL) {
+        return false;
+    }
+    if (writer->offset == 0ULL) {
+        memcpy(header, CONTAINER_MAGIC, 8);
+        write_uint32_le(header+8, CONTAINER_VERSION);
+        write_uint32_le(header+12, SFEN_CHUNK_SIZE);
+        if (fwrite(header, 1, sizeof(header), writer->fp) != sizeof(header)) {
+            return false;
+        }
+        writer->offset = sizeof(header);
+    }
+
+    return true;
+}
+
+static void free_writer(struct sfen_writer *writer)
+{
+    if (writer->fp != NULL) {
+        fclose(writer->fp);
+        writer->fp = NULL;
+    }
+    free(writer->buffers[0]);
+    free(writer->buffers[1]);
+    free_index(&writer->index);
+    free(writer->chunk);
+    free(writer->chunk_data);
+    free(writer->pos);
+}
+
+bool sfenio_open_writer(struct sfen_writer *writer, char *path,
+                        bool compressed)
+{
+    bool container;
+
+    assert(writer != NULL);
+    assert(path != NULL);
+
+    memset(writer, 0, sizeof(struct sfen_writer));
+    atomic_init(&writer->error, false);
+    writer->compressed = compressed;
+    if (compressed) {
+        if (!open_compressed_writer(writer, path)) {
+            free_writer(writer);
+            return false;
+        }
+    } else {
+        if (!open_index(path, &writer->index, &container) || container) {
+            free_writer(writer);
+            return false;
+        }
+        writer->fp = fopen(path, "ab");
+        if (writer->fp == NULL) {
+            return false;
+        }
+    }
+    writer->buffers[0] = malloc(WRITE_BUFFER_SIZE);
+    writer->buffers[1] = malloc(WRITE_BUFFER_SIZE);
+    if ((writer->buffers[0] == NULL) || (writer->buffers[1] == NULL)) {
+        free_writer(writer);
+        return false;
+    }
+
+    event_init(&writer->write_event);
+    event_init(&writer->done_event);
+    thread_create(&writer->thread, writer_thread_func, writer);
+
+    return true;
+}
+
+bool sfenio_write(struct sfen_writer *writer, struct packed_sfen *positions,
+                  int npositions)
+{
+    int n;
+
+    assert(writer != NULL);
+    assert(writer->fp != NULL);
+
+    if (!writer->compressed) {
+        append_data(writer, (uint8_t*)positions, npositions*SFEN_BIN_SIZE);
+        return !atomic_load(&writer->error);
+    }
+
+    while (npositions > 0) {
+        n = MIN(npositions, SFEN_CHUNK_SIZE-writer->chunk_len);
+        memcpy(&writer->chunk[writer->chunk_len], positions,
+               n*sizeof(struct packed_sfen));
+        writer->chunk_len += n;
+        positions += n;
+        npositions -= n;
+        if (writer->chunk_len == SFEN_CHUNK_SIZE) {
+            write_chunk(writer);
+        }
+    }
+
+    return !atomic_load(&writer->error);
+}
+
+bool sfenio_close_writer(struct sfen_writer *writer)
+{
+    bool ret;
+
+    assert(writer != NULL);
+    assert(writer->fp != NULL);
+
+    /* Write the last chunk and the index of compressed files */
+    if (writer->compressed) {
+        write_chunk(writer);
+        write_index(writer);
+    }
+
+    /* Write any remaining positions and stop the writer thread */
+    if (writer->len > 0) {
+        submit_buffer(writer);
+    }
+    wait_for_write(writer);
+    writer->stop = true;
+    event_set(&writer->write_event);
+    thread_join(&writer->thread);
+    event_destroy(&writer->write_event);
+    event_destroy(&writer->done_event);
+
+    ret = !atomic_load(&writer->error);
+    if (fclose(writer->fp) != 0) {
+        ret = false;
+    }
+    writer->fp = NULL;
+    free_writer(writer);
+
+    return ret;
+}
+
+void sfenio_init(void)
+{
+    struct decode_entry *entry;
+    int                 index;
+    int                 cursor;
+    int                 code;
+    int                 piece;
+    int                 k;
+
+    /* Codes for encoding */
+    encode_table[NO_PIECE].code = 0;
+    encode_table[NO_PIECE].nbits = EMPTY_SQUARE_BITS;
+    for (piece=0;piece<NPIECES;piece++) {
+        if (VALUE(piece) == KING) {
+            continue;
+        }
+        encode_table[piece].code = piece_codes[VALUE(piece)/2]|
+                                                        (COLOR(piece) << 4);
+        encode_table[piece].nbits = PIECE_BITS;
+    }
+
+    /*
+     * For each possible value of the next DECODE_BITS bits find all
+     * complete codes. Codes that do not correspond to any piece are
+     * treated as empty squares to avoid reading outside the buffer
+     * for corrupt positions.
+     */
+    for (index=0;index<(1 << DECODE_BITS);index++) {
+        entry = &decode_table[index];
+        entry->nsquares = 0;
+        cursor = 0;
+        while (cursor < DECODE_BITS) {
+            if (((index >> cursor)&1) == 0) {
+                piece = NO_PIECE;
+                cursor += EMPTY_SQUARE_BITS;
+            } else {
+                if ((cursor + PIECE_BITS) > DECODE_BITS) {
+                    break;
+                }
+                code = (index >> cursor)&0x0F;
+                piece = NO_PIECE;
+                for (k=0;k<(int)(sizeof(piece_codes)/sizeof(uint8_t));k++) {
+                    if (piece_codes[k] == code) {
+                        piece = k*2 + ((index >> (cursor+4))&1);
+                        break;
+                    }
+                }
+                cursor += PIECE_BITS;
+            }
+            entry->pieces[entry->nsquares] = piece;
+            entry->ends[entry->nsquares] = cursor;
+            entry->nsquares++;
+        }
+    }
+}
+
+void sfenio_encode_position(struct position *pos, uint8_t *data)
+{
+    struct bit_writer writer;
+    int               k;
+    int               piece;
+
+    assert(pos != NULL);
+    assert(data != NULL);
+
+    writer.data = data;
+    writer.bits = 0ULL;
+    writer.nbits = 0;
+
+    /* Side to move and king positions */
+    write_bits(&writer, pos->stm, 1);
+    write_bits(&writer, LSB(pos->bb_pieces[WHITE_KING]), 6);
+    write_bits(&writer, LSB(pos->bb_pieces[BLACK_KING]), 6);
+
+    /* Piece positions, from a8 to h1 */
+    for (k=0;k<NSQUARES;k++) {
+        piece = pos->pieces[k^56];
+        if ((piece == WHITE_KING) || (piece == BLACK_KING)) {
+            continue;
+        }
+        write_bits(&writer, encode_table[piece].code,
+                   encode_table[piece].nbits);
+    }
+
+    /* Castling availability */
+    write_bits(&writer, (pos->castle&WHITE_KINGSIDE) != 0, 1);
+    write_bits(&writer, (pos->castle&WHITE_QUEENSIDE) != 0, 1);
+    write_bits(&writer, (pos->castle&BLACK_KINGSIDE) != 0, 1);
+    write_bits(&writer, (pos->castle&BLACK_QUEENSIDE) != 0, 1);
+
+    /* En-passant square */
+    if (pos->ep_sq == NO_SQUARE) {
+        write_bits(&writer, 0, 1);
+    } else {
+        write_bits(&writer, 1|(pos->ep_sq << 1), 7);
+    }
+
+    /*
+     * Fifty-move counter and move counter. To keep compatibility with
+     * Stockfish only the lower 6 bits of the fifty-move counter are
+     * stored first. The last bit is stored at the end.
+     */
+    write_bits(&writer, pos->fifty&0x3F, 6);
+    write_bits(&writer, pos->fullmove&0xFFFF, 16);
+    write_bits(&writer, (pos->fifty >> 6)&1, 1);
+    flush_bits(&writer);
+}
+
+void sfenio_decode_position(uint8_t *data, struct position *pos)
+{
+    struct bit_reader reader;
+    uint8_t           squares[NSQUARES];
+    uint8_t           pieces[NSQUARES];
+    int               npieces;
+    int               wk;
+    int               bk;
+    int               k;
+
+    assert(data != NULL);
+    assert(pos != NULL);
+
+    init_reader(&reader, data);
+    pos_reset(pos);
+
+    /* The side to move and king positions */
+    pos->stm = read_bits(&reader, 1);
+    pos->key = key_set_side(pos->key, pos->stm);
+    wk = read_bits(&reader, 6);
+    bk = read_bits(&reader, 6);
+    add_piece(pos, WHITE_KING, wk);
+    add_piece(pos, BLACK_KING, bk);
+
+    /* Piece positions */
+    npieces = decode_board(&reader, wk, bk, squares, pieces, NSQUARES);
+    for (k=0;k<npieces;k++) {
+        add_piece(pos, pieces[k], squares[k]);
+    }
+
+    /* Castling */
+    if (read_bits(&reader, 1) == 1) {
+        pos->castle |= WHITE_KINGSIDE;
+    }
+    if (read_bits(&reader, 1) == 1) {
+        pos->castle |= WHITE_QUEENSIDE;
+    }
+    if (read_bits(&reader, 1) == 1) {
+        pos->castle |= BLACK_KINGSIDE;
+    }
+    if (read_bits(&reader, 1) == 1) {
+        pos->castle |= BLACK_QUEENSIDE;
+    }
+    pos->key = key_set_castling(pos->key, pos->castle);
+
+    /* The format is only used for standard chess */
+    pos->castle_wk = ((pos->castle&WHITE_KINGSIDE) != 0)?H1:NO_SQUARE;
+    pos->castle_wq = ((pos->castle&WHITE_QUEENSIDE) != 0)?A1:NO_SQUARE;
+    pos->castle_bk = ((pos->castle&BLACK_KINGSIDE) != 0)?H8:NO_SQUARE;
+    pos->castle_bq = ((pos->castle&BLACK_QUEENSIDE) != 0)?A8:NO_SQUARE;
+
+    /* En-passant square */
+    if (read_bits(&reader, 1) == 1) {
+        pos->ep_sq = read_bits(&reader, 6);
+        pos->key = key_set_ep_square(pos->key, pos->ep_sq);
+    }
+
+    /* Fifty-move counter and fullmove counter */
+    pos->fifty = read_bits(&reader, 6);
+    pos->fullmove = read_bits(&reader, 16);
+    pos->fifty |= (read_bits(&reader, 1) << 6);
+
+    pos->pawnkey = key_generate_pawnkey(pos);
+    pos->matkey = key_generate_matkey(pos);
+    pos_update_check_info(pos);
+}
+
+bool sfenio_decode_batch_item(uint8_t *data, struct nnue_batch_item *item)
+{
+    struct bit_reader reader;
+    int               npieces;
+    int               wk;
+    int               bk;
+
+    assert(data != NULL);
+    assert(item != NULL);
+
+    init_reader(&reader, data);
+
+    item->stm = read_bits(&reader, 1);
+    wk = read_bits(&reader, 6);
+    bk = read_bits(&reader, 6);
+    item->squares[0] = wk;
+    item->pieces[0] = WHITE_KING;
+    item->squares[1] = bk;
+    item->pieces[1] = BLACK_KING;
+    npieces = decode_board(&reader, wk, bk, &item->squares[2],
+                           &item->pieces[2], NNUE_MAX_ACTIVE_FEATURES-2);
+    if (npieces < 0) {
+        return false;
+    }
+    item->npieces = 2 + npieces;
+
+    return true;
+}
+
+uint16_t sfenio_encode_move(uint32_t move)
+{
+    uint16_t data = 0;
+    int      to = TO(move);
+    int      from = FROM(move);
+
+    data |= to;
+    data |= (from << 6);
+    if (ISPROMOTION(move)) {
+        data |= ((VALUE(PROMOTION(move))/2 - 1) << 12);
+        data |= (1 << 14);
+    } else if (ISENPASSANT(move)) {
+        data |= (2 << 14);
+    } else if (ISKINGSIDECASTLE(move) || ISQUEENSIDECASTLE(move)) {
+        data |= (3 << 14);
+    }
+
+    return data;
+}
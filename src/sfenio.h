@@ -0,0 +1,214 @@
+/*
+ * Marvin - an UCI/XBoard compatible chess engine
+ * Copyright (C) 2023 Martin Danielsson
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef SFENIO_H
+#define SFENIO_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#include "thread.h"
+#include "types.h"
+
+/* The size of a position in a sfen file in bin format */
+#define SFEN_BIN_SIZE 40
+
+/* The size of the encoded board in a sfen position */
+#define SFEN_POSITION_SIZE 32
+
+/* A position in a sfen file in bin format */
+struct packed_sfen {
+    uint8_t  position[SFEN_POSITION_SIZE];
+    int16_t  stm_score;
+    uint16_t move;
+    uint16_t ply;
+    int8_t   stm_result;
+    uint8_t  padding;
+};
+
+/* The maximum number of positions in a chunk of a compressed sfen file */
+#define SFEN_CHUNK_SIZE 4096
+
+/*
+ * Index of the chunks in a compressed sfen file. For each chunk the
+ * offset of the chunk in the file and the index of the first position
+ * in the chunk is stored.
+ */
+struct sfen_index {
+    uint64_t *offsets;
+    uint64_t *firsts;
+    uint64_t nchunks;
+    uint64_t max_chunks;
+    uint64_t npositions;
+    uint64_t end;
+};
+
+/*
+ * Reader for sfen files, the file is memory mapped. For compressed files
+ * the chunk containing the most recently requested position is kept
+ * decoded.
+ */
+struct sfen_reader {
+    uint8_t            *data;
+    uint64_t           size;
+    uint64_t           npositions;
+    bool               compressed;
+    struct sfen_index  index;
+    uint64_t           chunk_first;
+    int                chunk_len;
+    struct packed_sfen *chunk;
+    struct position    *pos;
+};
+
+/*
+ * Writer for sfen files. Positions are collected in one buffer while
+ * the other buffer is written to the file by a separate thread.
+ */
+struct sfen_writer {
+    FILE               *fp;
+    uint8_t            *buffers[2];
+    int                current;
+    int                len;
+    int                write_len;
+    bool               pending;
+    bool               stop;
+    /* Set by both the writer thread and the caller */
+    atomic_bool        error;
+    thread_t           thread;
+    event_t            write_event;
+    event_t            done_event;
+    bool               compressed;
+    uint64_t           offset;
+    struct sfen_index  index;
+    struct packed_sfen *chunk;
+    int                chunk_len;
+    uint8_t            *chunk_data;
+    struct position    *pos;
+};
+
+/* Initialize the tables used to encode and decode positions */
+void sfenio_init(void);
+
+/*
+ * Encode a position in the sfen bin format.
+ *
+ * @param pos The position to encode.
+ * @param data Location to store the encoded position at. The location
+ *             must be SFEN_POSITION_SIZE bytes and initialized to zero.
+ */
+void sfenio_encode_position(struct position *pos, uint8_t *data);
+
+/*
+ * Decode a position in the sfen bin format.
+ *
+ * @param data The encoded position.
+ * @param pos Location to store the decoded position at.
+ */
+void sfenio_decode_position(uint8_t *data, struct position *pos);
+
+/*
+ * Decode a position in the sfen bin format directly into an item for
+ * nnue_evaluate_batch. This is faster than decoding the complete position
+ * since no keys or other derived state have to be calculated.
+ *
+ * @param data The encoded position.
+ * @param item Location to store the batch item at.
+ * @return Returns false if the position has more pieces than fit in
+ *         a batch item, in which case the item should not be used.
+ */
+bool sfenio_decode_batch_item(uint8_t *data, struct nnue_batch_item *item);
+
+/*
+ * Encode a move in the sfen bin format.
+ *
+ * @param move The move to encode.
+ * @return Returns the encoded move.
+ */
+uint16_t sfenio_encode_move(uint32_t move);
+
+/*
+ * Open a sfen file for reading. Both plain and compressed files are
+ * supported.
+ *
+ * @param reader The reader.
+ * @param path The file to open.
+ * @return Returns true if the file was opened.
+ */
+bool sfenio_open_reader(struct sfen_reader *reader, char *path);
+
+/*
+ * Close a sfen file opened with sfenio_open_reader.
+ *
+ * @param reader The reader.
+ */
+void sfenio_close_reader(struct sfen_reader *reader);
+
+/*
+ * Get a position from a sfen file. For plain files the position points
+ * directly into the mapped file and must not be modified. For compressed
+ * files the position is only valid until the next call and the reader
+ * must not be shared between threads. Moving to a new chunk decodes the
+ * whole chunk, replaying the move of each position that is stored as a
+ * delta, which is roughly ten times slower than reading a plain file.
+ *
+ * @param reader The reader.
+ * @param idx The index of the position.
+ * @return Returns the position, or NULL if the chunk holding the
+ *         position is corrupt.
+ */
+struct packed_sfen* sfenio_position(struct sfen_reader *reader, uint64_t idx);
+
+/*
+ * Open a sfen file for writing. New positions are appended to the file.
+ *
+ * Compressed files consist of chunks of up to SFEN_CHUNK_SIZE positions
+ * followed by an index of the chunks. Consecutive positions from the same
+ * game are stored as the move leading to the position and scores and
+ * plies are delta coded.
+ *
+ * @param writer The writer.
+ * @param path The file to open.
+ * @param compressed Flag indicating if the file should be compressed. An
+ *                   existing file must have the same format.
+ * @return Returns true if the file was opened.
+ */
+bool sfenio_open_writer(struct sfen_writer *writer, char *path,
+                        bool compressed);
+
+/*
+ * Add positions to a sfen file. The positions are buffered and written
+ * to the file in large chunks.
+ *
+ * @param writer The writer.
+ * @param positions The positions to write.
+ * @param npositions The number of positions to write.
+ * @return Returns false if an earlier write has failed.
+ */
+bool sfenio_write(struct sfen_writer *writer, struct packed_sfen *positions,
+                  int npositions);
+
+/*
+ * Write all buffered positions and close the file.
+ *
+ * @param writer The writer.
+ * @return Returns true if all positions were written successfully.
+ */
+bool sfenio_close_writer(struct sfen_writer *writer);
+
+#endif
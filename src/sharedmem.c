@@ -0,0 +1,168 @@
+/*
+ * Marvin - an UCI/XBoard compatible chess engine
+ * Copyright (C) 2015 Martin Danielsson
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <stdalign.h>
+
+#include "sharedmem.h"
+#include "bitboard.h"
+#include "nnue.h"
+#include "utils.h"
+#include "debug.h"
+
+/* Identifier for a fully initialized segment */
+#define SEGMENT_MAGIC 0x4D52564E
+
+/* The maximum time to wait for another process to initialize the segment */
+#define MAX_WAIT_TIME 10000
+
+/* The interval for checking if the segment is ready */
+#define WAIT_INTERVAL 10
+
+/* Header at the start of the segment */
+struct segment_header {
+    alignas(64) uint32_t magic;
+    uint64_t size;
+    /*
+     * The PID of the process that created the segment. Used to detect
+     * segments left behind by a process that crashed before the segment
+     * was ready.
+     */
+    int32_t creator;
+};
+
+/* The attached segment */
+static void *segment = NULL;
+static uint64_t segment_size = 0ULL;
+
+/* Offsets of the tables in the segment */
+static uint64_t nnue_offset;
+static uint64_t bb_offset;
+
+static void calculate_layout(void)
+{
+    nnue_offset = sizeof(struct segment_header);
+    bb_offset = nnue_offset + nnue_shared_size();
+    segment_size = bb_offset + bb_shared_size();
+}
+
+static bool wait_for_segment(char *name)
+{
+    struct segment_header *header;
+    bool                  created;
+    int                   waited;
+    int                   creator;
+
+    /*
+     * The segment might not be fully setup yet if another process
+     * is initializing it at the same time so wait for it to
+     * become ready.
+     */
+    for (waited=0;waited<MAX_WAIT_TIME;waited+=WAIT_INTERVAL) {
+        if (segment == NULL) {
+            segment = shared_memory_open(name, segment_size, &created);
+            if ((segment != NULL) && created) {
+                header = segment;
+                __atomic_store_n(&header->creator, get_current_pid(),
+                                 __ATOMIC_RELEASE);
+                return true;
+            }
+        }
+        if (segment != NULL) {
+            header = segment;
+            if ((__atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) ==
+                 SEGMENT_MAGIC) && (header->size == segment_size)) {
+                return false;
+            }
+
+            /*
+             * If the creator is gone without marking the segment as
+             * ready then it is never going to be ready. Remove it and
+             * try to create a new one.
+             */
+            creator = __atomic_load_n(&header->creator, __ATOMIC_ACQUIRE);
+            if ((creator != 0) && !is_process_running(creator)) {
+                LOG_INFO1("Removing stale shared memory segment %s\n",
+                          name);
+                shared_memory_close(segment, segment_size);
+                shared_memory_remove(name);
+                segment = NULL;
+                continue;
+            }
+        }
+        sleep_ms(WAIT_INTERVAL);
+    }
+
+    shared_memory_close(segment, segment_size);
+    segment = NULL;
+    return false;
+}
+
+bool sharedmem_init(void)
+{
+    struct segment_header *header;
+    char                  name[128];
+    bool                  created;
+
+    /*
+     * Include the version and a hash of the embedded net in the name
+     * so that different builds never share a segment. The slider
+     * databases are laid out differently when PEXT is used so that
+     * is included as well.
+     */
+    calculate_layout();
+    snprintf(name, sizeof(name), "marvin-%s-%016"PRIx64"%s", APP_VERSION,
+             nnue_embedded_net_hash(), bb_uses_pext()?"-pext":"");
+
+    created = wait_for_segment(name);
+    if (segment == NULL) {
+        LOG_INFO1("Failed to attach to shared memory segment %s\n", name);
+        return false;
+    }
+
+    /* Setup the tables, populating them if the segment is new */
+    if (!nnue_use_shared_net((uint8_t*)segment+nnue_offset, created)) {
+        shared_memory_close(segment, segment_size);
+        segment = NULL;
+        if (created) {
+            /* Don't leave a segment that never becomes ready behind */
+            shared_memory_remove(name);
+        }
+        return false;
+    }
+    bb_init_shared((uint64_t*)((uint8_t*)segment+bb_offset), created);
+
+    /* Mark the segment as ready to be used by other processes */
+    if (created) {
+        header = segment;
+        header->size = segment_size;
+        __atomic_store_n(&header->magic, SEGMENT_MAGIC, __ATOMIC_RELEASE);
+    }
+
+    LOG_INFO2("%s shared memory segment %s\n",
+              created?"Created":"Attached to", name);
+
+    return true;
+}
+
+void sharedmem_destroy(void)
+{
+    shared_memory_close(segment, segment_size);
+    segment = NULL;
+}
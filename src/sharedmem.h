@@ -0,0 +1,39 @@
+/*
+ * Marvin - an UCI/XBoard compatible chess engine
+ * Copyright (C) 2015 Martin Danielsson
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef SHAREDMEM_H
+#define SHAREDMEM_H
+
+#include <stdbool.h>
+
+/*
+ * Place the large read-only tables (the embedded NNUE net and the
+ * magic move databases) in a named shared memory segment that is
+ * shared by all engine processes on the host. The first process
+ * creates and populates the segment and later processes attach to it.
+ * This replaces the normal initialization of these tables with
+ * bb_init and nnue_load_net.
+ *
+ * @return Returns true if the shared tables are used, false if the
+ *         tables have to be initialized privately.
+ */
+bool sharedmem_init(void);
+
+/* Detach from the shared memory segment */
+void sharedmem_destroy(void);
+
+#endif
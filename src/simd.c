@@ -18,6 +18,7 @@
 #include <assert.h>
 #include <stdlib.h>
 #include <stdalign.h>
+#include <string.h>
 #ifdef USE_SSE
 #include <emmintrin.h>
 #include <tmmintrin.h>
@@ -30,10 +31,38 @@
 #include <arm_neon.h>
 #endif
 
+/*
+ * In builds with runtime dispatch the kernels are renamed based on
+ * the variant being compiled so that all variants can be linked
+ * into the same binary.
+ */
+#if defined(USE_DISPATCH) && !defined(SIMD_VARIANT)
+#define SIMD_VARIANT generic
+#endif
+#ifdef SIMD_VARIANT
+#define SIMD_CONCAT2(a, b) a##_##b
+#define SIMD_CONCAT(a, b) SIMD_CONCAT2(a, b)
+#define SIMD_STRING2(a) #a
+#define SIMD_STRING(a) SIMD_STRING2(a)
+#define simd_fc_forward SIMD_CONCAT(simd_fc_forward, SIMD_VARIANT)
+#define simd_fc_forward_sparse SIMD_CONCAT(simd_fc_forward_sparse, \
+                                           SIMD_VARIANT)
+#define simd_clamp SIMD_CONCAT(simd_clamp, SIMD_VARIANT)
+#define simd_shift_clamp SIMD_CONCAT(simd_shift_clamp, SIMD_VARIANT)
+#define simd_copy SIMD_CONCAT(simd_copy, SIMD_VARIANT)
+#define simd_add SIMD_CONCAT(simd_add, SIMD_VARIANT)
+#define simd_sub SIMD_CONCAT(simd_sub, SIMD_VARIANT)
+#define simd_copy_sub_add SIMD_CONCAT(simd_copy_sub_add, SIMD_VARIANT)
+#define simd_copy_sub_sub_add SIMD_CONCAT(simd_copy_sub_sub_add, SIMD_VARIANT)
+#define simd_add_rows SIMD_CONCAT(simd_add_rows, SIMD_VARIANT)
+#endif
+
 #include "simd.h"
 #include "utils.h"
 
-#if defined(USE_AVX2)
+#if defined(USE_AVX512)
+#define MIN_SIZE 64
+#elif defined(USE_AVX2)
 #define MIN_SIZE 32
 #elif defined(USE_SSE)
 #define MIN_SIZE 16
@@ -45,7 +74,10 @@
 
 #define MAX_QUANTIZED_ACTIVATION 127.0f
 
-#if defined(USE_AVX2) || defined(USE_SSE)
+/* The number of registers used to hold the output in simd_add_rows */
+#define NUM_ROW_REGISTERS 8
+
+#if (defined(USE_AVX2) || defined(USE_SSE)) && !defined(USE_AVX512)
 static int32_t hsum_4x32(__m128i v)
 {
     v = _mm_add_epi32(v, _mm_srli_si128(v, 8));
@@ -54,7 +86,7 @@ static int32_t hsum_4x32(__m128i v)
 }
 #endif
 
-#if defined(USE_AVX2)
+#if defined(USE_AVX2) && !defined(USE_AVX512)
 static int32_t hsum_8x32(__m256i v)
 {
     __m128i sum128 = _mm_add_epi32(_mm256_castsi256_si128(v),
@@ -72,7 +104,30 @@ void simd_fc_forward(uint8_t *input, int32_t *output, int ninputs,
 
     assert((ninputs%MIN_SIZE) == 0);
 
-#if defined(USE_AVX2)
+#if defined(USE_AVX512)
+    for (k=0;k<noutputs;k++) {
+        __m512i *pi = (__m512i*)input;
+        __m512i *pw = (__m512i*)&weights[k*ninputs];
+        __m512i vsum = _mm512_setzero_si512();
+#if !defined(USE_VNNI)
+        __m512i c1 = _mm512_set1_epi16(1);
+#endif
+
+        for (l=0;l<niterations;l++) {
+            __m512i v1 = _mm512_load_si512(pi++);
+            __m512i v2 = _mm512_load_si512(pw++);
+#if defined(USE_VNNI)
+            vsum = _mm512_dpbusd_epi32(vsum, v1, v2);
+#else
+            __m512i t1 = _mm512_maddubs_epi16(v1, v2);
+            __m512i t2 = _mm512_madd_epi16(t1, c1);
+            vsum = _mm512_add_epi32(vsum, t2);
+#endif
+        }
+
+        output[k] = _mm512_reduce_add_epi32(vsum) + biases[k];
+    }
+#elif defined(USE_AVX2)
     __m256i c1 = _mm256_set1_epi16(1);
 
     for (k=0;k<noutputs;k++) {
@@ -144,9 +199,198 @@ void simd_fc_forward(uint8_t *input, int32_t *output, int ninputs,
 #endif
 }
 
-void simd_clamp(int16_t *input, uint8_t *output, int nvalues)
+/*
+ * Find all non-zero chunks of four inputs. The index of each chunk is
+ * stored in chunks and the four inputs, as a 32-bit value, in values.
+ */
+static int find_nonzero_chunks(uint8_t *input, int ninputs, uint16_t *chunks,
+                               int32_t *values)
 {
+    int      count = 0;
+    int      k;
+    int      l;
 #if defined(USE_AVX2)
+    uint32_t mask;
+    __m256i  *pi = (__m256i*)input;
+    __m256i  zero = _mm256_setzero_si256();
+
+    for (k=0;k<ninputs/32;k++) {
+        __m256i v = _mm256_load_si256(pi++);
+        __m256i z = _mm256_cmpeq_epi32(v, zero);
+        mask = ~_mm256_movemask_ps(_mm256_castsi256_ps(z))&0xFF;
+        while (mask != 0) {
+            l = __builtin_ctz(mask);
+            chunks[count] = k*8 + l;
+            memcpy(&values[count], &input[(k*8+l)*4], sizeof(int32_t));
+            count++;
+            mask &= (mask - 1);
+        }
+    }
+#elif defined(USE_SSE)
+    uint32_t mask;
+    __m128i  *pi = (__m128i*)input;
+    __m128i  zero = _mm_setzero_si128();
+
+    for (k=0;k<ninputs/16;k++) {
+        __m128i v = _mm_load_si128(pi++);
+        __m128i z = _mm_cmpeq_epi32(v, zero);
+        mask = ~_mm_movemask_ps(_mm_castsi128_ps(z))&0x0F;
+        while (mask != 0) {
+            l = __builtin_ctz(mask);
+            chunks[count] = k*4 + l;
+            memcpy(&values[count], &input[(k*4+l)*4], sizeof(int32_t));
+            count++;
+            mask &= (mask - 1);
+        }
+    }
+#elif defined(USE_NEON)
+    for (k=0;k<ninputs/16;k++) {
+        uint32x4_t v = vreinterpretq_u32_u8(vld1q_u8(&input[k*16]));
+        if (vmaxvq_u32(v) == 0) {
+            continue;
+        }
+        for (l=0;l<4;l++) {
+            memcpy(&values[count], &input[(k*4+l)*4], sizeof(int32_t));
+            if (values[count] != 0) {
+                chunks[count++] = k*4 + l;
+            }
+        }
+    }
+#else
+    for (k=0;k<ninputs/4;k++) {
+        memcpy(&values[count], &input[k*4], sizeof(int32_t));
+        if (values[count] != 0) {
+            chunks[count++] = k;
+        }
+    }
+    (void)l;
+#endif
+
+    return count;
+}
+
+void simd_fc_forward_sparse(uint8_t *input, int32_t *output, int ninputs,
+                            int noutputs, int32_t *biases, int8_t *weights)
+{
+    uint16_t chunks[SIMD_MAX_SPARSE_INPUTS/4];
+    int32_t  values[SIMD_MAX_SPARSE_INPUTS/4];
+    int      nchunks;
+    int      k;
+    int      l;
+
+    assert((ninputs%MIN_SIZE) == 0);
+    assert((noutputs%SIMD_SPARSE_OUTPUT_BLOCK) == 0);
+    assert(ninputs <= SIMD_MAX_SPARSE_INPUTS);
+
+    nchunks = find_nonzero_chunks(input, ninputs, chunks, values);
+
+#if defined(USE_AVX2)
+    int     r;
+    __m256i acc[SIMD_SPARSE_OUTPUT_BLOCK/8];
+    __m256i c1 = _mm256_set1_epi16(1);
+
+    for (k=0;k<noutputs;k+=SIMD_SPARSE_OUTPUT_BLOCK) {
+        for (r=0;r<SIMD_SPARSE_OUTPUT_BLOCK/8;r++) {
+            acc[r] = _mm256_loadu_si256((__m256i*)&biases[k+r*8]);
+        }
+        for (l=0;l<nchunks;l++) {
+            __m256i *pw = (__m256i*)&weights[(chunks[l]*noutputs+k)*4];
+            __m256i v1 = _mm256_set1_epi32(values[l]);
+            for (r=0;r<SIMD_SPARSE_OUTPUT_BLOCK/8;r++) {
+                __m256i t1 = _mm256_maddubs_epi16(v1,
+                                                  _mm256_load_si256(pw+r));
+                __m256i t2 = _mm256_madd_epi16(t1, c1);
+                acc[r] = _mm256_add_epi32(acc[r], t2);
+            }
+        }
+        for (r=0;r<SIMD_SPARSE_OUTPUT_BLOCK/8;r++) {
+            _mm256_storeu_si256((__m256i*)&output[k+r*8], acc[r]);
+        }
+    }
+#elif defined(USE_SSE)
+    int     r;
+    __m128i acc[SIMD_SPARSE_OUTPUT_BLOCK/4];
+    __m128i c1 = _mm_set1_epi16(1);
+
+    for (k=0;k<noutputs;k+=SIMD_SPARSE_OUTPUT_BLOCK) {
+        for (r=0;r<SIMD_SPARSE_OUTPUT_BLOCK/4;r++) {
+            acc[r] = _mm_loadu_si128((__m128i*)&biases[k+r*4]);
+        }
+        for (l=0;l<nchunks;l++) {
+            __m128i *pw = (__m128i*)&weights[(chunks[l]*noutputs+k)*4];
+            __m128i v1 = _mm_set1_epi32(values[l]);
+            for (r=0;r<SIMD_SPARSE_OUTPUT_BLOCK/4;r++) {
+                __m128i temp = _mm_maddubs_epi16(v1, _mm_load_si128(pw+r));
+                temp = _mm_madd_epi16(temp, c1);
+                acc[r] = _mm_add_epi32(acc[r], temp);
+            }
+        }
+        for (r=0;r<SIMD_SPARSE_OUTPUT_BLOCK/4;r++) {
+            _mm_storeu_si128((__m128i*)&output[k+r*4], acc[r]);
+        }
+    }
+#elif defined(USE_NEON)
+    int       r;
+    int32x4_t acc[SIMD_SPARSE_OUTPUT_BLOCK/4];
+
+    for (k=0;k<noutputs;k+=SIMD_SPARSE_OUTPUT_BLOCK) {
+        for (r=0;r<SIMD_SPARSE_OUTPUT_BLOCK/4;r++) {
+            acc[r] = vld1q_s32(&biases[k+r*4]);
+        }
+        for (l=0;l<nchunks;l++) {
+            int8_t   *pw = &weights[(chunks[l]*noutputs+k)*4];
+            int8x8_t v1 = vreinterpret_s8_s32(vdup_n_s32(values[l]));
+            for (r=0;r<SIMD_SPARSE_OUTPUT_BLOCK/4;r++) {
+                int16x8_t t1 = vmull_s8(v1, vld1_s8(pw+r*16));
+                int16x8_t t2 = vmull_s8(v1, vld1_s8(pw+r*16+8));
+                int32x4_t temp = vpaddq_s32(vpaddlq_s16(t1),
+                                            vpaddlq_s16(t2));
+                acc[r] = vaddq_s32(acc[r], temp);
+            }
+        }
+        for (r=0;r<SIMD_SPARSE_OUTPUT_BLOCK/4;r++) {
+            vst1q_s32(&output[k+r*4], acc[r]);
+        }
+    }
+#else
+    int     m;
+    uint8_t *pi;
+
+    for (k=0;k<noutputs;k++) {
+        output[k] = biases[k];
+    }
+    for (l=0;l<nchunks;l++) {
+        pi = &input[chunks[l]*4];
+        for (k=0;k<noutputs;k++) {
+            for (m=0;m<4;m++) {
+                output[k] += pi[m]*weights[(chunks[l]*noutputs+k)*4+m];
+            }
+        }
+    }
+#endif
+}
+
+void simd_clamp(int16_t *input, uint8_t *output, int nvalues)
+{
+#if defined(USE_AVX512)
+    int k;
+    int niterations = nvalues/64;
+
+    __m512i *pi = (__m512i*)input;
+    __m512i *po = (__m512i*)output;
+
+    __m512i min = _mm512_setzero_si512();
+    __m512i order = _mm512_set_epi64(7, 5, 3, 1, 6, 4, 2, 0);
+
+    for (k=0;k<niterations;k++) {
+        __m512i v1 = _mm512_load_si512(pi++);
+        __m512i v2 = _mm512_load_si512(pi++);
+        __m512i v8 = _mm512_packs_epi16(v1, v2);
+        __m512i s = _mm512_permutexvar_epi64(order, v8);
+        s = _mm512_max_epi8(s, min);
+        _mm512_store_si512(po++, s);
+    }
+#elif defined(USE_AVX2)
     int k;
     int niterations = nvalues/32;
 
@@ -207,9 +451,89 @@ void simd_clamp(int16_t *input, uint8_t *output, int nvalues)
 #endif
 }
 
-void simd_copy(int16_t *input, int16_t *output, int nvalues)
+void simd_shift_clamp(int32_t *input, uint8_t *output, int shift,
+                      int nvalues)
 {
+    int k;
+
+    assert((nvalues%32) == 0);
+
 #if defined(USE_AVX2)
+    int niterations = nvalues/32;
+
+    __m256i *pi = (__m256i*)input;
+    __m256i *po = (__m256i*)output;
+
+    __m128i count = _mm_cvtsi32_si128(shift);
+    __m256i min = _mm256_setzero_si256();
+    __m256i order = _mm256_set_epi32(7, 3, 6, 2, 5, 1, 4, 0);
+
+    for (k=0;k<niterations;k++) {
+        __m256i v1 = _mm256_sra_epi32(_mm256_load_si256(pi++), count);
+        __m256i v2 = _mm256_sra_epi32(_mm256_load_si256(pi++), count);
+        __m256i v3 = _mm256_sra_epi32(_mm256_load_si256(pi++), count);
+        __m256i v4 = _mm256_sra_epi32(_mm256_load_si256(pi++), count);
+        __m256i v16a = _mm256_packs_epi32(v1, v2);
+        __m256i v16b = _mm256_packs_epi32(v3, v4);
+        __m256i v8 = _mm256_packs_epi16(v16a, v16b);
+        __m256i s = _mm256_permutevar8x32_epi32(v8, order);
+        s = _mm256_max_epi8(s, min);
+        _mm256_store_si256(po++, s);
+    }
+#elif defined(USE_SSE)
+    int niterations = nvalues/16;
+
+    __m128i *pi = (__m128i*)input;
+    __m128i *po = (__m128i*)output;
+
+    __m128i count = _mm_cvtsi32_si128(shift);
+    __m128i min = _mm_setzero_si128();
+
+    for (k=0;k<niterations;k++) {
+        __m128i v1 = _mm_sra_epi32(_mm_load_si128(pi++), count);
+        __m128i v2 = _mm_sra_epi32(_mm_load_si128(pi++), count);
+        __m128i v3 = _mm_sra_epi32(_mm_load_si128(pi++), count);
+        __m128i v4 = _mm_sra_epi32(_mm_load_si128(pi++), count);
+        __m128i v16a = _mm_packs_epi32(v1, v2);
+        __m128i v16b = _mm_packs_epi32(v3, v4);
+        __m128i s = _mm_max_epi8(_mm_packs_epi16(v16a, v16b), min);
+        _mm_store_si128(po++, s);
+    }
+#elif defined(USE_NEON)
+    int niterations = nvalues/8;
+
+    int32x4_t *pi = (int32x4_t*)input;
+    int8x8_t  *po = (int8x8_t*)output;
+
+    int32x4_t count = vdupq_n_s32(-shift);
+    int8x8_t  min = vdup_n_s8(0);
+
+    for (k=0;k<niterations;k++) {
+        int16x4_t lower = vqmovn_s32(vshlq_s32(*(pi++), count));
+        int16x4_t upper = vqmovn_s32(vshlq_s32(*(pi++), count));
+        int8x8_t  s = vqmovn_s16(vcombine_s16(lower, upper));
+        *(po++) = vmax_s8(s, min);
+    }
+#else
+    for (k=0;k<nvalues;k++) {
+        output[k] = CLAMP(input[k]>>shift, 0, (int)MAX_QUANTIZED_ACTIVATION);
+    }
+#endif
+}
+
+void simd_copy(int16_t *input, int16_t *output, int nvalues)
+{
+#if defined(USE_AVX512)
+    int k;
+    int niterations = nvalues/32;
+
+    __m512i *pi = (__m512i*)input;
+    __m512i *po = (__m512i*)output;
+
+    for (k=0;k<niterations;k++) {
+        po[k] = _mm512_load_si512(pi++);
+    }
+#elif defined(USE_AVX2)
     int k;
     int niterations = nvalues/16;
 
@@ -250,7 +574,17 @@ void simd_copy(int16_t *input, int16_t *output, int nvalues)
 
 void simd_add(int16_t *input, int16_t *output, int nvalues)
 {
-#if defined(USE_AVX2)
+#if defined(USE_AVX512)
+    int k;
+    int niterations = nvalues/32;
+
+    __m512i *pi = (__m512i*)input;
+    __m512i *po = (__m512i*)output;
+
+    for (k=0;k<niterations;k++) {
+        po[k] = _mm512_add_epi16(po[k], pi[k]);
+    }
+#elif defined(USE_AVX2)
     int k;
     int niterations = nvalues/16;
 
@@ -291,7 +625,17 @@ void simd_add(int16_t *input, int16_t *output, int nvalues)
 
 void simd_sub(int16_t *input, int16_t *output, int nvalues)
 {
-#if defined(USE_AVX2)
+#if defined(USE_AVX512)
+    int k;
+    int niterations = nvalues/32;
+
+    __m512i *pi = (__m512i*)input;
+    __m512i *po = (__m512i*)output;
+
+    for (k=0;k<niterations;k++) {
+        po[k] = _mm512_sub_epi16(po[k], pi[k]);
+    }
+#elif defined(USE_AVX2)
     int k;
     int niterations = nvalues/16;
 
@@ -329,3 +673,269 @@ void simd_sub(int16_t *input, int16_t *output, int nvalues)
     }
 #endif
 }
+
+void simd_copy_sub_add(int16_t *input, int16_t *output, int16_t *sub1,
+                       int16_t *add1, int nvalues)
+{
+#if defined(USE_AVX512)
+    int k;
+    int niterations = nvalues/32;
+
+    __m512i *pi = (__m512i*)input;
+    __m512i *po = (__m512i*)output;
+    __m512i *ps1 = (__m512i*)sub1;
+    __m512i *pa1 = (__m512i*)add1;
+
+    for (k=0;k<niterations;k++) {
+        __m512i v = _mm512_sub_epi16(pi[k], ps1[k]);
+        po[k] = _mm512_add_epi16(v, pa1[k]);
+    }
+#elif defined(USE_AVX2)
+    int k;
+    int niterations = nvalues/16;
+
+    __m256i *pi = (__m256i*)input;
+    __m256i *po = (__m256i*)output;
+    __m256i *ps1 = (__m256i*)sub1;
+    __m256i *pa1 = (__m256i*)add1;
+
+    for (k=0;k<niterations;k++) {
+        __m256i v = _mm256_sub_epi16(pi[k], ps1[k]);
+        po[k] = _mm256_add_epi16(v, pa1[k]);
+    }
+#elif defined(USE_SSE)
+    int k;
+    int niterations = nvalues/8;
+
+    __m128i *pi = (__m128i*)input;
+    __m128i *po = (__m128i*)output;
+    __m128i *ps1 = (__m128i*)sub1;
+    __m128i *pa1 = (__m128i*)add1;
+
+    for (k=0;k<niterations;k++) {
+        __m128i v = _mm_sub_epi16(pi[k], ps1[k]);
+        po[k] = _mm_add_epi16(v, pa1[k]);
+    }
+#elif defined(USE_NEON)
+    int k;
+    int niterations = nvalues/8;
+
+    int16x8_t *pi = (int16x8_t*)input;
+    int16x8_t *po = (int16x8_t*)output;
+    int16x8_t *ps1 = (int16x8_t*)sub1;
+    int16x8_t *pa1 = (int16x8_t*)add1;
+
+    for (k=0;k<niterations;k++) {
+        int16x8_t v = vsubq_s16(pi[k], ps1[k]);
+        po[k] = vaddq_s16(v, pa1[k]);
+    }
+#else
+    int k;
+
+    for (k=0;k<nvalues;k++) {
+        output[k] = input[k] - sub1[k] + add1[k];
+    }
+#endif
+}
+
+void simd_copy_sub_sub_add(int16_t *input, int16_t *output, int16_t *sub1,
+                           int16_t *sub2, int16_t *add1, int nvalues)
+{
+#if defined(USE_AVX512)
+    int k;
+    int niterations = nvalues/32;
+
+    __m512i *pi = (__m512i*)input;
+    __m512i *po = (__m512i*)output;
+    __m512i *ps1 = (__m512i*)sub1;
+    __m512i *ps2 = (__m512i*)sub2;
+    __m512i *pa1 = (__m512i*)add1;
+
+    for (k=0;k<niterations;k++) {
+        __m512i v = _mm512_sub_epi16(pi[k], ps1[k]);
+        v = _mm512_sub_epi16(v, ps2[k]);
+        po[k] = _mm512_add_epi16(v, pa1[k]);
+    }
+#elif defined(USE_AVX2)
+    int k;
+    int niterations = nvalues/16;
+
+    __m256i *pi = (__m256i*)input;
+    __m256i *po = (__m256i*)output;
+    __m256i *ps1 = (__m256i*)sub1;
+    __m256i *ps2 = (__m256i*)sub2;
+    __m256i *pa1 = (__m256i*)add1;
+
+    for (k=0;k<niterations;k++) {
+        __m256i v = _mm256_sub_epi16(pi[k], ps1[k]);
+        v = _mm256_sub_epi16(v, ps2[k]);
+        po[k] = _mm256_add_epi16(v, pa1[k]);
+    }
+#elif defined(USE_SSE)
+    int k;
+    int niterations = nvalues/8;
+
+    __m128i *pi = (__m128i*)input;
+    __m128i *po = (__m128i*)output;
+    __m128i *ps1 = (__m128i*)sub1;
+    __m128i *ps2 = (__m128i*)sub2;
+    __m128i *pa1 = (__m128i*)add1;
+
+    for (k=0;k<niterations;k++) {
+        __m128i v = _mm_sub_epi16(pi[k], ps1[k]);
+        v = _mm_sub_epi16(v, ps2[k]);
+        po[k] = _mm_add_epi16(v, pa1[k]);
+    }
+#elif defined(USE_NEON)
+    int k;
+    int niterations = nvalues/8;
+
+    int16x8_t *pi = (int16x8_t*)input;
+    int16x8_t *po = (int16x8_t*)output;
+    int16x8_t *ps1 = (int16x8_t*)sub1;
+    int16x8_t *ps2 = (int16x8_t*)sub2;
+    int16x8_t *pa1 = (int16x8_t*)add1;
+
+    for (k=0;k<niterations;k++) {
+        int16x8_t v = vsubq_s16(pi[k], ps1[k]);
+        v = vsubq_s16(v, ps2[k]);
+        po[k] = vaddq_s16(v, pa1[k]);
+    }
+#else
+    int k;
+
+    for (k=0;k<nvalues;k++) {
+        output[k] = input[k] - sub1[k] - sub2[k] + add1[k];
+    }
+#endif
+}
+
+void simd_add_rows(int16_t *input, int16_t *output, int16_t **rows,
+                   int nrows, int nvalues)
+{
+#if defined(USE_AVX512)
+    int     k;
+    int     l;
+    int     r;
+    int     niterations = nvalues/32;
+    __m512i acc[NUM_ROW_REGISTERS];
+
+    __m512i *pi = (__m512i*)input;
+    __m512i *po = (__m512i*)output;
+
+    for (k=0;k<niterations;k+=NUM_ROW_REGISTERS) {
+        for (r=0;r<NUM_ROW_REGISTERS;r++) {
+            acc[r] = pi[k+r];
+        }
+        for (l=0;l<nrows;l++) {
+            __m512i *pr = (__m512i*)rows[l];
+            for (r=0;r<NUM_ROW_REGISTERS;r++) {
+                acc[r] = _mm512_add_epi16(acc[r], pr[k+r]);
+            }
+        }
+        for (r=0;r<NUM_ROW_REGISTERS;r++) {
+            po[k+r] = acc[r];
+        }
+    }
+#elif defined(USE_AVX2)
+    int     k;
+    int     l;
+    int     r;
+    int     niterations = nvalues/16;
+    __m256i acc[NUM_ROW_REGISTERS];
+
+    __m256i *pi = (__m256i*)input;
+    __m256i *po = (__m256i*)output;
+
+    for (k=0;k<niterations;k+=NUM_ROW_REGISTERS) {
+        for (r=0;r<NUM_ROW_REGISTERS;r++) {
+            acc[r] = pi[k+r];
+        }
+        for (l=0;l<nrows;l++) {
+            __m256i *pr = (__m256i*)rows[l];
+            for (r=0;r<NUM_ROW_REGISTERS;r++) {
+                acc[r] = _mm256_add_epi16(acc[r], pr[k+r]);
+            }
+        }
+        for (r=0;r<NUM_ROW_REGISTERS;r++) {
+            po[k+r] = acc[r];
+        }
+    }
+#elif defined(USE_SSE)
+    int     k;
+    int     l;
+    int     r;
+    int     niterations = nvalues/8;
+    __m128i acc[NUM_ROW_REGISTERS];
+
+    __m128i *pi = (__m128i*)input;
+    __m128i *po = (__m128i*)output;
+
+    for (k=0;k<niterations;k+=NUM_ROW_REGISTERS) {
+        for (r=0;r<NUM_ROW_REGISTERS;r++) {
+            acc[r] = pi[k+r];
+        }
+        for (l=0;l<nrows;l++) {
+            __m128i *pr = (__m128i*)rows[l];
+            for (r=0;r<NUM_ROW_REGISTERS;r++) {
+                acc[r] = _mm_add_epi16(acc[r], pr[k+r]);
+            }
+        }
+        for (r=0;r<NUM_ROW_REGISTERS;r++) {
+            po[k+r] = acc[r];
+        }
+    }
+#elif defined(USE_NEON)
+    int       k;
+    int       l;
+    int       r;
+    int       niterations = nvalues/8;
+    int16x8_t acc[NUM_ROW_REGISTERS];
+
+    int16x8_t *pi = (int16x8_t*)input;
+    int16x8_t *po = (int16x8_t*)output;
+
+    for (k=0;k<niterations;k+=NUM_ROW_REGISTERS) {
+        for (r=0;r<NUM_ROW_REGISTERS;r++) {
+            acc[r] = pi[k+r];
+        }
+        for (l=0;l<nrows;l++) {
+            int16x8_t *pr = (int16x8_t*)rows[l];
+            for (r=0;r<NUM_ROW_REGISTERS;r++) {
+                acc[r] = vaddq_s16(acc[r], pr[k+r]);
+            }
+        }
+        for (r=0;r<NUM_ROW_REGISTERS;r++) {
+            po[k+r] = acc[r];
+        }
+    }
+#else
+    int k;
+    int l;
+
+    for (k=0;k<nvalues;k++) {
+        output[k] = input[k];
+    }
+    for (l=0;l<nrows;l++) {
+        for (k=0;k<nvalues;k++) {
+            output[k] += rows[l][k];
+        }
+    }
+#endif
+}
+
+#ifdef SIMD_VARIANT
+const struct simd_kernels SIMD_CONCAT(simd_kernels, SIMD_VARIANT) = {
+    SIMD_STRING(SIMD_VARIANT),
+    simd_fc_forward,
+    simd_fc_forward_sparse,
+    simd_clamp,
+    simd_shift_clamp,
+    simd_copy,
+    simd_add,
+    simd_sub,
+    simd_copy_sub_add,
+    simd_copy_sub_sub_add,
+    simd_add_rows
+};
+#endif
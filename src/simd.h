@@ -20,6 +20,64 @@
 
 #include <stdint.h>
 
+/*
+ * Layers evaluated with simd_fc_forward_sparse must have a number of
+ * outputs that is a multiple of SIMD_SPARSE_OUTPUT_BLOCK and at most
+ * SIMD_MAX_SPARSE_INPUTS inputs.
+ */
+#define SIMD_SPARSE_OUTPUT_BLOCK 32
+#define SIMD_MAX_SPARSE_INPUTS 8192
+
+/*
+ * Table with one implementation of all SIMD kernels. In builds with runtime
+ * dispatch (USE_DISPATCH) simd.c is compiled once for each supported
+ * instruction set (selected by SIMD_VARIANT) and each compilation provides
+ * a table called simd_kernels_<variant>. The table to use is
+ * selected by cpu_init().
+ */
+struct simd_kernels {
+    const char *name;
+    void (*fc_forward)(uint8_t *input, int32_t *output, int ninputs,
+                       int noutputs, int32_t *biases, int8_t *weights);
+    void (*fc_forward_sparse)(uint8_t *input, int32_t *output, int ninputs,
+                              int noutputs, int32_t *biases,
+                              int8_t *weights);
+    void (*clamp)(int16_t *input, uint8_t *output, int nvalues);
+    void (*shift_clamp)(int32_t *input, uint8_t *output, int shift,
+                        int nvalues);
+    void (*copy)(int16_t *input, int16_t *output, int nvalues);
+    void (*add)(int16_t *input, int16_t *output, int nvalues);
+    void (*sub)(int16_t *input, int16_t *output, int nvalues);
+    void (*copy_sub_add)(int16_t *input, int16_t *output, int16_t *sub1,
+                         int16_t *add1, int nvalues);
+    void (*copy_sub_sub_add)(int16_t *input, int16_t *output, int16_t *sub1,
+                             int16_t *sub2, int16_t *add1, int nvalues);
+    void (*add_rows)(int16_t *input, int16_t *output, int16_t **rows,
+                     int nrows, int nvalues);
+};
+
+#if defined(USE_DISPATCH) && !defined(SIMD_VARIANT)
+/* The kernels selected at startup */
+extern struct simd_kernels simd_kernels;
+
+/* The available implementations */
+extern const struct simd_kernels simd_kernels_generic;
+extern const struct simd_kernels simd_kernels_sse;
+extern const struct simd_kernels simd_kernels_avx2;
+extern const struct simd_kernels simd_kernels_avx512;
+extern const struct simd_kernels simd_kernels_vnni;
+
+#define simd_fc_forward simd_kernels.fc_forward
+#define simd_fc_forward_sparse simd_kernels.fc_forward_sparse
+#define simd_clamp simd_kernels.clamp
+#define simd_shift_clamp simd_kernels.shift_clamp
+#define simd_copy simd_kernels.copy
+#define simd_add simd_kernels.add
+#define simd_sub simd_kernels.sub
+#define simd_copy_sub_add simd_kernels.copy_sub_add
+#define simd_copy_sub_sub_add simd_kernels.copy_sub_sub_add
+#define simd_add_rows simd_kernels.add_rows
+#else
 /*
  * SIMD implementation of a forward pass of a fully connected layer.
  * 
@@ -33,6 +91,24 @@
 void simd_fc_forward(uint8_t *input, int32_t *output, int ninputs,
                      int noutputs, int32_t *biases, int8_t *weights);
 
+/*
+ * SIMD implementation of a forward pass of a fully connected layer that
+ * only processes inputs that are non-zero. The inputs are handled in
+ * chunks of four and the weights are expected to be stored chunk by
+ * chunk, so that the four weights of all outputs for input chunk c are
+ * located at weights[c*noutputs*4]. The weight for output k and input i
+ * is thus found at index ((i/4)*noutputs+k)*4+i%4.
+ *
+ * @param input The layer input.
+ * @param output The layer output.
+ * @param ninputs The number of inputs.
+ * @param noutputs The number of outputs.
+ * @param biases Layer biases.
+ * @param weights Layer weights.
+ */
+void simd_fc_forward_sparse(uint8_t *input, int32_t *output, int ninputs,
+                            int noutputs, int32_t *biases, int8_t *weights);
+
 /*
  * SIMD implementation of a clamp operation. Values and the clamped between 0
  * and 127.
@@ -43,6 +119,19 @@ void simd_fc_forward(uint8_t *input, int32_t *output, int ninputs,
  */
 void simd_clamp(int16_t *input, uint8_t *output, int nvalues);
 
+/*
+ * SIMD implementation of the activation of a hidden layer. Values are
+ * shifted right and then clamped between 0 and 127. The number of values
+ * must be a multiple of 32.
+ *
+ * @param input Input values.
+ * @param output Output values.
+ * @param shift The number of bits to shift the values.
+ * @param nvalues The number of values.
+ */
+void simd_shift_clamp(int32_t *input, uint8_t *output, int shift,
+                      int nvalues);
+
 /*
  * SIMD implementation of a copy operation.
  *
@@ -70,4 +159,47 @@ void simd_add(int16_t *input, int16_t *output, int nvalues);
  */
 void simd_sub(int16_t *input, int16_t *output, int nvalues);
 
+/*
+ * SIMD implementation of a fused copy, sub and add operation. The result
+ * is output = input - sub1 + add1.
+ *
+ * @param input Input values.
+ * @param output Output values.
+ * @param sub1 Values to subtract.
+ * @param add1 Values to add.
+ * @param nvalues The number of values.
+ */
+void simd_copy_sub_add(int16_t *input, int16_t *output, int16_t *sub1,
+                       int16_t *add1, int nvalues);
+
+/*
+ * SIMD implementation of a fused copy, sub, sub and add operation. The
+ * result is output = input - sub1 - sub2 + add1.
+ *
+ * @param input Input values.
+ * @param output Output values.
+ * @param sub1 Values to subtract.
+ * @param sub2 More values to subtract.
+ * @param add1 Values to add.
+ * @param nvalues The number of values.
+ */
+void simd_copy_sub_sub_add(int16_t *input, int16_t *output, int16_t *sub1,
+                           int16_t *sub2, int16_t *add1, int nvalues);
+
+/*
+ * SIMD implementation of adding a number of rows to a set of values. The
+ * result is output = input + rows[0] + ... + rows[nrows-1]. The output is
+ * kept in registers while all rows are added so nvalues must be a multiple
+ * of 256.
+ *
+ * @param input Input values.
+ * @param output Output values.
+ * @param rows The rows to add.
+ * @param nrows The number of rows.
+ * @param nvalues The number of values.
+ */
+void simd_add_rows(int16_t *input, int16_t *output, int16_t **rows,
+                   int nrows, int nvalues);
+#endif
+
 #endif
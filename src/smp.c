@@ -32,55 +32,162 @@
 #include "position.h"
 #include "history.h"
 #include "nnue.h"
+#include "numa.h"
+#include "utils.h"
+#include "trace.h"
+#include "cluster.h"
 
-/* Lock for updating the engine struct during search */
-static mutex_t engine_lock;
+/*
+ * The number of nodes a worker searches between publishing
+ * its counters to the pool.
+ */
+#define PUBLISH_INTERVAL 1024
 
-/* Variables used to signal to workers to stop searching */
-static mutex_t stop_lock;
-static atomic_bool should_stop = false;
+/* The index of the last depth slot used by the depth scheduling */
+#define MAX_DEPTH_SLOT (MAX_SEARCH_DEPTH+1)
 
-/* Data for worker threads */
-static int number_of_workers = 0;
-static struct search_worker *workers = NULL;
+/* Job data used for parallel memset */
+struct memset_job {
+    void *memory;
+    size_t size_per_worker;
+    uint8_t value;
+};
 
-void smp_init(void)
+static thread_retval_t pool_thread_func(void *data)
 {
-    mutex_init(&engine_lock);
-    mutex_init(&stop_lock);
+    struct search_worker *worker = data;
+    struct worker_pool   *pool = &worker->engine->pool;
+
+    numa_bind_thread(worker->id);
+
+    while (true) {
+        event_wait(&worker->start_event);
+        if (worker->quit) {
+            break;
+        }
+        pool->job_func(worker->id, pool->job_data);
+        event_set(&worker->done_event);
+    }
+
+    return (thread_retval_t)0;
 }
 
-void smp_destroy(void)
+static void memset_job_func(int idx, void *data)
 {
-    mutex_destroy(&engine_lock);
-    mutex_destroy(&stop_lock);
+    struct memset_job *job = data;
+
+    memset((uint8_t*)job->memory + job->size_per_worker*idx, job->value,
+           job->size_per_worker);
 }
 
-void smp_create_workers(int nthreads)
+void smp_init(struct engine *engine)
 {
-    int k;
+    struct worker_pool *pool = &engine->pool;
+    int                k;
+
+    atomic_init(&pool->should_stop, false);
+    pool->nworkers = 0;
+    pool->workers = NULL;
+    pool->job_func = NULL;
+    pool->job_data = NULL;
+    pool->shared_nnue_cache = NULL;
+    pool->shared_nnue_cache_size = 0ULL;
+    pool->shared_nnue_cache_users = 0;
+    atomic_init(&pool->published_nodes, 0ULL);
+    atomic_init(&pool->published_tbhits, 0ULL);
+    for (k=0;k<=MAX_DEPTH_SLOT;k++) {
+        atomic_init(&pool->depth_count[k], 0);
+    }
+    atomic_init(&pool->scheduling_time, 0ULL);
+    atomic_init(&pool->scheduling_calls, 0ULL);
+    atomic_init(&pool->scheduling_retries, 0ULL);
+
+    pool->busy_table = aligned_malloc(64,
+                                BUSY_TABLE_SIZE*sizeof(atomic_uint_fast64_t));
+    assert(pool->busy_table != NULL);
+    for (k=0;k<BUSY_TABLE_SIZE;k++) {
+        atomic_init(&pool->busy_table[k], 0ULL);
+    }
+}
 
-    number_of_workers = nthreads;
-    workers = aligned_malloc(64,
-                             number_of_workers*sizeof(struct search_worker));
-    for (k=0;k<number_of_workers;k++) {
-        memset(&workers[k], 0, sizeof(struct search_worker));
-        hash_nnue_create_table(&workers[k], NNUE_CACHE_SIZE);
-        workers[k].engine = NULL;
-        workers[k].id = k;
+void smp_destroy(struct engine *engine)
+{
+    aligned_free(engine->pool.busy_table);
+    engine->pool.busy_table = NULL;
+}
+
+void smp_create_workers(struct engine *engine, int nthreads)
+{
+    struct worker_pool   *pool = &engine->pool;
+    struct search_worker **workers;
+    int                  k;
+
+    pool->nworkers = nthreads;
+    pool->workers = malloc(pool->nworkers*sizeof(struct search_worker*));
+    workers = pool->workers;
+
+    /*
+     * Each worker is allocated separately so that it ends up on
+     * the same NUMA node as the thread that uses it. The memory is
+     * already zeroed so it is not cleared here. That way the large
+     * per ply stacks are only committed as deep as the search goes.
+     */
+    for (k=0;k<pool->nworkers;k++) {
+        workers[k] = numa_alloc(sizeof(struct search_worker),
+                                numa_node_for_worker(k));
+        assert(workers[k] != NULL);
+        workers[k]->id = k;
+        workers[k]->engine = engine;
+        hash_nnue_create_table(workers[k], engine_eval_cache_size,
+                               engine_eval_cache_shared);
+        hash_pawntt_create_table(workers[k], engine_low_memory?
+                                 LOW_MEMORY_PAWN_HASH_SIZE:PAWN_HASH_SIZE);
+        hash_mattt_create_table(workers[k], engine_low_memory?
+                                LOW_MEMORY_MATERIAL_HASH_SIZE:
+                                MATERIAL_HASH_SIZE);
+        nnue_create_refresh_cache(workers[k]);
+    }
+
+    /*
+     * Start a parked thread for each helper. The first worker is
+     * always executed by the calling thread.
+     */
+    numa_bind_thread(0);
+    for (k=1;k<pool->nworkers;k++) {
+        event_init(&workers[k]->start_event);
+        event_init(&workers[k]->done_event);
+        workers[k]->quit = false;
+        thread_create(&workers[k]->thread, pool_thread_func, workers[k]);
     }
 }
 
-void smp_destroy_workers(void)
+void smp_destroy_workers(struct engine *engine)
 {
-    int k;
+    struct worker_pool   *pool = &engine->pool;
+    struct search_worker **workers = pool->workers;
+    int                  k;
 
-    for (k=0;k<number_of_workers;k++) {
-        hash_nnue_destroy_table(&workers[k]);
+    /* A table being resized in the background is cleared by the workers */
+    hash_tt_wait_for_table(engine);
+
+    for (k=1;k<pool->nworkers;k++) {
+        workers[k]->quit = true;
+        event_set(&workers[k]->start_event);
+        thread_join(&workers[k]->thread);
+        event_destroy(&workers[k]->start_event);
+        event_destroy(&workers[k]->done_event);
+    }
+    for (k=0;k<pool->nworkers;k++) {
+        hash_nnue_destroy_table(workers[k]);
+        hash_pawntt_destroy_table(workers[k]);
+        hash_mattt_destroy_table(workers[k]);
+        nnue_destroy_refresh_cache(workers[k]);
+        trace_destroy(workers[k]);
+        numa_free(workers[k], sizeof(struct search_worker));
     }
-    aligned_free(workers);
-    workers = NULL;
-    number_of_workers = 0;
+    free(workers);
+    pool->workers = NULL;
+    pool->nworkers = 0;
 }
 
 void smp_prepare_workers(struct engine *engine)
@@ -89,21 +196,64 @@ void smp_prepare_workers(struct engine *engine)
     int                  mpvidx;
     int                  k;
 
-    should_stop = false;
-    for (k=0;k<number_of_workers;k++) {
-        worker = &workers[k];
-
-        /* Copy data from engine */
-        worker->pos = engine->pos;
+    atomic_store(&engine->pool.should_stop, false);
+    if (atomic_load(&engine->stop_requested)) {
+        smp_stop_all(engine);
+    }
+    atomic_store(&engine->pool.published_nodes, 0ULL);
+    atomic_store(&engine->pool.published_tbhits, 0ULL);
+    atomic_store(&engine->pool.scheduling_time, 0ULL);
+    atomic_store(&engine->pool.scheduling_calls, 0ULL);
+    atomic_store(&engine->pool.scheduling_retries, 0ULL);
+    for (k=0;k<=MAX_DEPTH_SLOT;k++) {
+        atomic_store(&engine->pool.depth_count[k], 0);
+    }
+    atomic_store(&engine->pool.depth_count[0], engine->pool.nworkers);
+    for (k=0;k<BUSY_TABLE_SIZE;k++) {
+        atomic_store_explicit(&engine->pool.busy_table[k], 0ULL,
+                              memory_order_relaxed);
+    }
+    for (k=0;k<engine->pool.nworkers;k++) {
+        worker = engine->pool.workers[k];
+
+        /*
+         * Copy data from engine. The root accumulator has already been
+         * calculated by the caller so it only has to be copied.
+         */
+        pos_copy_root(&worker->pos, &engine->pos);
+
+        /*
+         * The killer moves are kept if the root has advanced along the
+         * line of the previous search, since the positions close to the
+         * new root were then searched already. The counter moves don't
+         * depend on the distance to the root so they are always kept.
+         */
+        if (engine->root_history.key == engine->pos.key) {
+            killer_shift_table(worker, engine->root_history.nplies);
+        } else {
+            killer_clear_table(worker);
+        }
 
-        /* Clear tables */
-        killer_clear_table(worker);
-        counter_clear_table(worker);
+        /*
+         * Clear the depth from the previous search since it is used
+         * to decide which depth the helpers should search next.
+         */
+        worker->depth = 0;
+        worker->scheduled_depth = 0;
 
         /* Clear statistics */
         worker->nodes = 0;
         worker->qnodes = 0;
         worker->tbhits = 0ULL;
+        worker->published_nodes = 0ULL;
+        worker->published_tbhits = 0ULL;
+        worker->evals = 0ULL;
+        worker->tt_probes = 0ULL;
+        worker->tt_hits = 0ULL;
+        worker->nnue_cache_probes = 0ULL;
+        worker->nnue_cache_hits = 0ULL;
+        worker->egtb_probes = 0ULL;
+        worker->egtb_cache_hits = 0ULL;
 
         /* Clear best move information */
         for (mpvidx=0;mpvidx<engine->multipv;mpvidx++) {
@@ -121,134 +271,304 @@ void smp_prepare_workers(struct engine *engine)
         worker->resolving_root_fail = false;
 
         /* Setup parent pointers */
-        worker->engine = engine;
         worker->pos.engine = engine;
         worker->pos.worker = worker;
     }
 }
 
-void smp_reset_workers(void)
+void smp_reset_workers(struct engine *engine)
 {
     struct search_worker *worker;
     int                  k;
 
-    for (k=0;k<number_of_workers;k++) {
-        worker = &workers[k];
+    for (k=0;k<engine->pool.nworkers;k++) {
+        worker = engine->pool.workers[k];
 
-        worker->engine = NULL;
         worker->pos.engine = NULL;
         worker->pos.worker = NULL;
     }
 }
 
-struct search_worker* smp_get_worker(int idx)
+struct search_worker* smp_get_worker(struct engine *engine, int idx)
 {
-    assert((idx >= 0) && (idx < number_of_workers));
+    assert((idx >= 0) && (idx < engine->pool.nworkers));
 
-    return &workers[idx];
+    return engine->pool.workers[idx];
 }
 
-int smp_number_of_workers(void)
+int smp_number_of_workers(struct engine *engine)
 {
-    return number_of_workers;
+    return engine->pool.nworkers;
 }
 
-void smp_start_worker(struct search_worker *worker, thread_func_t func)
+void smp_run_job(struct engine *engine, smp_job_func_t func, void *data)
 {
-    thread_create(&worker->thread, func, worker);
+    struct worker_pool *pool = &engine->pool;
+    int                k;
+
+    pool->job_func = func;
+    pool->job_data = data;
+
+    /* Wake up all helpers */
+    for (k=1;k<pool->nworkers;k++) {
+        event_set(&pool->workers[k]->start_event);
+    }
+
+    /* Let the calling thread act as the first worker */
+    func(0, data);
+
+    /* Wait for all helpers to finish */
+    for (k=1;k<pool->nworkers;k++) {
+        event_wait(&pool->workers[k]->done_event);
+    }
+
+    pool->job_func = NULL;
+    pool->job_data = NULL;
 }
 
-void smp_wait_for_worker(struct search_worker *worker)
+void smp_parallel_memset(struct engine *engine, void *memory, uint8_t value,
+                         size_t size)
 {
-    thread_join(&worker->thread);
+    struct memset_job job;
+    size_t            nworkers;
+
+    nworkers = MAX(engine->pool.nworkers, 1);
+    job.memory = memory;
+    job.size_per_worker = size/nworkers;
+    job.value = value;
+
+    if (engine->pool.nworkers > 0) {
+        smp_run_job(engine, memset_job_func, &job);
+    } else {
+        memset_job_func(0, &job);
+    }
+    memset((uint8_t*)memory + job.size_per_worker*nworkers, value,
+           size%nworkers);
 }
 
-void smp_newgame(void)
+void smp_newgame(struct engine *engine)
 {
     int k;
 
-    for (k=0;k<number_of_workers;k++) {
-        history_clear_tables(&workers[k]);
+    for (k=0;k<engine->pool.nworkers;k++) {
+        history_clear_tables(engine->pool.workers[k]);
+        killer_clear_table(engine->pool.workers[k]);
+        counter_clear_table(engine->pool.workers[k]);
+    }
+    engine->root_history.key = 0ULL;
+    engine->root_history.nmoves = 0;
+}
+
+void smp_publish_counters(struct search_worker *worker, bool force)
+{
+    struct worker_pool *pool = &worker->engine->pool;
+
+    if (!force &&
+        ((worker->nodes-worker->published_nodes) < PUBLISH_INTERVAL)) {
+        return;
     }
+
+    atomic_fetch_add_explicit(&pool->published_nodes,
+                              worker->nodes-worker->published_nodes,
+                              memory_order_relaxed);
+    atomic_fetch_add_explicit(&pool->published_tbhits,
+                              worker->tbhits-worker->published_tbhits,
+                              memory_order_relaxed);
+    worker->published_nodes = worker->nodes;
+    worker->published_tbhits = worker->tbhits;
+}
+
+bool smp_is_busy(struct search_worker *worker, uint64_t key)
+{
+    struct worker_pool *pool = &worker->engine->pool;
+
+    return atomic_load_explicit(&pool->busy_table[key&(BUSY_TABLE_SIZE-1)],
+                                memory_order_relaxed) == key;
+}
+
+void smp_set_busy(struct search_worker *worker, uint64_t key)
+{
+    struct worker_pool *pool = &worker->engine->pool;
+
+    atomic_store_explicit(&pool->busy_table[key&(BUSY_TABLE_SIZE-1)], key,
+                          memory_order_relaxed);
+}
+
+void smp_clear_busy(struct search_worker *worker, uint64_t key)
+{
+    struct worker_pool   *pool = &worker->engine->pool;
+    uint_fast64_t        expected = key;
+
+    /*
+     * Only clear the entry if it still belongs to this position. The
+     * entry may have been taken over by another position since the
+     * table is indexed by only a part of the key.
+     */
+    (void)atomic_compare_exchange_strong_explicit(
+                            &pool->busy_table[key&(BUSY_TABLE_SIZE-1)],
+                            &expected, 0ULL, memory_order_relaxed,
+                            memory_order_relaxed);
+}
+
+uint64_t smp_nodes(struct engine *engine)
+{
+    return atomic_load_explicit(&engine->pool.published_nodes,
+                                memory_order_relaxed) + cluster_nodes(engine);
 }
 
-uint64_t smp_nodes(void)
+uint64_t smp_qnodes(struct engine *engine)
 {
-    uint64_t nodes;
+    uint64_t qnodes;
     int      k;
 
-    nodes = 0ULL;
-    for (k=0;k<number_of_workers;k++) {
-        nodes += workers[k].nodes;
+    qnodes = 0ULL;
+    for (k=0;k<engine->pool.nworkers;k++) {
+        qnodes += engine->pool.workers[k]->qnodes;
     }
-    return nodes;
+    return qnodes;
+}
+
+uint64_t smp_tbhits(struct engine *engine)
+{
+    return atomic_load_explicit(&engine->pool.published_tbhits,
+                                memory_order_relaxed);
 }
 
-uint64_t smp_tbhits(void)
+uint64_t smp_evals(struct engine *engine)
 {
-    uint64_t tbhits;
+    uint64_t evals;
     int      k;
 
-    tbhits = 0ULL;
-    for (k=0;k<number_of_workers;k++) {
-        tbhits += workers[k].tbhits;
+    evals = 0ULL;
+    for (k=0;k<engine->pool.nworkers;k++) {
+        evals += engine->pool.workers[k]->evals;
+    }
+    return evals;
+}
+
+void smp_eval_cache_stats(struct engine *engine, uint64_t *probes,
+                          uint64_t *hits)
+{
+    int k;
+
+    *probes = 0ULL;
+    *hits = 0ULL;
+    for (k=0;k<engine->pool.nworkers;k++) {
+        *probes += engine->pool.workers[k]->nnue_cache_probes;
+        *hits += engine->pool.workers[k]->nnue_cache_hits;
+    }
+}
+
+void smp_egtb_cache_stats(struct engine *engine, uint64_t *probes,
+                          uint64_t *hits)
+{
+    int k;
+
+    *probes = 0ULL;
+    *hits = 0ULL;
+    for (k=0;k<engine->pool.nworkers;k++) {
+        *probes += engine->pool.workers[k]->egtb_probes;
+        *hits += engine->pool.workers[k]->egtb_cache_hits;
+    }
+}
+
+void smp_tt_stats(struct engine *engine, uint64_t *probes, uint64_t *hits)
+{
+    int k;
+
+    *probes = 0ULL;
+    *hits = 0ULL;
+    for (k=0;k<engine->pool.nworkers;k++) {
+        *probes += engine->pool.workers[k]->tt_probes;
+        *hits += engine->pool.workers[k]->tt_hits;
     }
-    return tbhits;
 }
 
-void smp_stop_all(void)
+void smp_stop_all(struct engine *engine)
 {
-    atomic_store_explicit(&should_stop, true, memory_order_relaxed);
+    atomic_store_explicit(&engine->pool.should_stop, true,
+                          memory_order_relaxed);
 }
 
-bool smp_should_stop(void)
+bool smp_should_stop(struct engine *engine)
 {
-    return atomic_load_explicit(&should_stop, memory_order_relaxed);
+    return atomic_load_explicit(&engine->pool.should_stop,
+                                memory_order_relaxed);
 }
 
 int smp_complete_iteration(struct search_worker *worker)
 {
-    int new_depth;
-    int count;
-    int k;
+    struct engine      *engine = worker->engine;
+    struct worker_pool *pool = &engine->pool;
+    uint64_t           start;
+    int                completed;
+    int                new_depth;
+    int                count;
+    int                k;
 
-    mutex_lock(&engine_lock);
+    start = get_current_time_us();
 
     /*
      * If this is the first time completing this depth then
      * update the completed_depth counter.
      */
-    if ((worker->depth > worker->engine->completed_depth) &&
-        (worker->mpv_lines[0].pv.size >= 1)) {
-        worker->engine->completed_depth = worker->depth;
+    if (worker->mpv_lines[0].pv.size >= 1) {
+        completed = atomic_load(&engine->completed_depth);
+        while ((worker->depth > completed) &&
+               !atomic_compare_exchange_weak(&engine->completed_depth,
+                                             &completed, worker->depth)) {
+            atomic_fetch_add_explicit(&pool->scheduling_retries, 1,
+                                      memory_order_relaxed);
+        }
     }
 
     /*
      * Calculate the next depth for this worker to search. For the first worker
      * always search the next depth since it is responsible for search output.
+     * Helpers search the lowest depth that is not already searched by at
+     * least half of the workers. The number of workers searching a depth
+     * greater than or equal to a candidate depth is calculated from the
+     * per-depth counters, starting with all workers and removing the ones
+     * at lower depths. In reproducible mode all workers search every depth
+     * so that the schedule doesn't depend on timing.
      */
-    new_depth = worker->depth;
-    if (worker->id == 0) {
-        new_depth++;
-    } else {
-        while (true) {
+    new_depth = worker->depth + 1;
+    if ((worker->id != 0) && (pool->nworkers > 1) && !engine->reproducible) {
+        count = pool->nworkers;
+        for (k=0;(k<new_depth)&&(k<=MAX_DEPTH_SLOT);k++) {
+            count -= atomic_load_explicit(&pool->depth_count[k],
+                                          memory_order_relaxed);
+        }
+        while ((((count+1)/2) >= (pool->nworkers/2)) &&
+               (new_depth < MAX_DEPTH_SLOT)) {
+            count -= atomic_load_explicit(&pool->depth_count[new_depth],
+                                          memory_order_relaxed);
             new_depth++;
-            count = 0;
-            for (k=0;k<number_of_workers;k++) {
-                if (workers[k].depth >= new_depth) {
-                    count++;
-                }
-                if (((count+1)/2) >= (number_of_workers/2)) {
-                    break;
-                }
-            }
-            if (k == number_of_workers || (number_of_workers == 1)) {
-                break;
-            }
         }
     }
 
-    mutex_unlock(&engine_lock);
+    /* Move the worker to the new depth */
+    atomic_fetch_sub_explicit(&pool->depth_count[worker->scheduled_depth], 1,
+                              memory_order_relaxed);
+    worker->scheduled_depth = (new_depth < MAX_DEPTH_SLOT)?
+                                                    new_depth:MAX_DEPTH_SLOT;
+    atomic_fetch_add_explicit(&pool->depth_count[worker->scheduled_depth], 1,
+                              memory_order_relaxed);
+
+    /* Update statistics */
+    atomic_fetch_add_explicit(&pool->scheduling_time,
+                              get_current_time_us()-start,
+                              memory_order_relaxed);
+    atomic_fetch_add_explicit(&pool->scheduling_calls, 1,
+                              memory_order_relaxed);
 
     return new_depth;
 }
+
+void smp_scheduling_stats(struct engine *engine, uint64_t *time,
+                          uint64_t *calls, uint64_t *retries)
+{
+    *time = atomic_load(&engine->pool.scheduling_time);
+    *calls = atomic_load(&engine->pool.scheduling_calls);
+    *retries = atomic_load(&engine->pool.scheduling_retries);
+}
@@ -21,21 +21,42 @@
 #include "types.h"
 #include "thread.h"
 
-/* Initilaize the SMP component */
-void smp_init(void);
+/*
+ * Function executed by the worker thread pool.
+ *
+ * @param idx Index of the worker executing the job.
+ * @param data Data passed to smp_run_job.
+ */
+typedef void (*smp_job_func_t)(int idx, void *data);
 
-/* Clean up the SMP component */
-void smp_destroy(void);
+/*
+ * Initilaize the worker pool of an engine.
+ *
+ * @param engine The engine.
+ */
+void smp_init(struct engine *engine);
+
+/*
+ * Clean up the worker pool of an engine.
+ *
+ * @param engine The engine.
+ */
+void smp_destroy(struct engine *engine);
 
 /*
  * Create worker threads.
  *
+ * @param engine The engine owning the workers.
  * @param nthreads The number of threads to create.
  */
-void smp_create_workers(int nthreads);
+void smp_create_workers(struct engine *engine, int nthreads);
 
-/* Destroy all workers */
-void smp_destroy_workers(void);
+/*
+ * Destroy all workers.
+ *
+ * @param engine The engine.
+ */
+void smp_destroy_workers(struct engine *engine);
 
 /*
  * Prepare all workers for a new search.
@@ -44,67 +65,177 @@ void smp_destroy_workers(void);
  */
 void smp_prepare_workers(struct engine *engine);
 
-/* Reset all workers */
-void smp_reset_workers(void);
+/*
+ * Reset all workers.
+ *
+ * @param engine The engine.
+ */
+void smp_reset_workers(struct engine *engine);
 
 /*
  * Get a pointer to the worker at a given index.
  *
+ * @param engine The engine.
  * @param idx Index of the worker to get.
  * @return Returns the worker at the spcified index.
  */
-struct search_worker* smp_get_worker(int idx);
+struct search_worker* smp_get_worker(struct engine *engine, int idx);
 
 /*
  * Get the number of workers being used.
  *
+ * @param engine The engine.
  * @return Returns the number of workers.
  */
-int smp_number_of_workers(void);
+int smp_number_of_workers(struct engine *engine);
 
 /*
- * Start a worker.
+ * Run a job on all workers. The job is executed by the parked helper
+ * threads and by the calling thread, which acts as worker 0. The function
+ * returns when all workers have finished the job.
  *
- * @param worker The worker to start.
- * @param func The search function.
- * */
-void smp_start_worker(struct search_worker *worker, thread_func_t func);
+ * @param engine The engine owning the workers.
+ * @param func The job function.
+ * @param data Data passed to the job function.
+ */
+void smp_run_job(struct engine *engine, smp_job_func_t func, void *data);
 
 /*
- * Wait for a worker to stop searching.
+ * Parallel version of memset using the worker thread pool.
  *
- * @param worker The worker to wait for.
- * */
-void smp_wait_for_worker(struct search_worker *worker);
+ * @param engine The engine owning the workers.
+ * @param memory Pointer to the memory to set.
+ * @param value The value to write
+ * @param size The number of bytes to write.
+ */
+void smp_parallel_memset(struct engine *engine, void *memory, uint8_t value,
+                         size_t size);
 
-/* Indicate the start of a new game */
-void smp_newgame(void);
+/*
+ * Indicate the start of a new game. This also clears the move ordering
+ * information that is kept between searches.
+ *
+ * @param engine The engine.
+ */
+void smp_newgame(struct engine *engine);
 
 /*
- * The number of nodes searched.
+ * Publish the node and tablebase hit counters of a worker to the
+ * shared counters of the pool. In order to avoid contention the
+ * counters are only published once enough nodes have been searched
+ * since the last time, unless forced.
  *
+ * @param worker The worker.
+ * @param force Flag indicating if the counters should always be published.
+ */
+void smp_publish_counters(struct search_worker *worker, bool force);
+
+/*
+ * Check if a position is currently being searched by some worker.
+ *
+ * @param worker The worker.
+ * @param key The key of the position.
+ * @return Returns true if the position is being searched.
+ */
+bool smp_is_busy(struct search_worker *worker, uint64_t key);
+
+/*
+ * Mark a position as being searched.
+ *
+ * @param worker The worker.
+ * @param key The key of the position.
+ */
+void smp_set_busy(struct search_worker *worker, uint64_t key);
+
+/*
+ * Mark a position as no longer being searched.
+ *
+ * @param worker The worker.
+ * @param key The key of the position.
+ */
+void smp_clear_busy(struct search_worker *worker, uint64_t key);
+
+/*
+ * The number of nodes searched. During a search the number only
+ * includes nodes that have been published by the workers. If the
+ * engine is part of a cluster the nodes searched by the helper nodes
+ * are included as well.
+ *
+ * @param engine The engine.
  * @return Returns the total number of nodes searched (by all workers).
  */
-uint64_t smp_nodes(void);
+uint64_t smp_nodes(struct engine *engine);
 
 /*
- * The number of tablebase hits during search.
+ * The number of quiescence nodes searched.
  *
+ * @param engine The engine.
+ * @return Returns the total number of quiescence nodes searched (by all
+ *         workers).
+ */
+uint64_t smp_qnodes(struct engine *engine);
+
+/*
+ * The number of tablebase hits during search. During a search the
+ * number only includes hits that have been published by the workers.
+ *
+ * @param engine The engine.
  * @return Returns the total number of tablebase hits.
  */
-uint64_t smp_tbhits(void);
+uint64_t smp_tbhits(struct engine *engine);
+
+/*
+ * The number of static evaluations done during search.
+ *
+ * @param engine The engine.
+ * @return Returns the total number of static evaluations.
+ */
+uint64_t smp_evals(struct engine *engine);
 
 /*
- * Stop all workers.
+ * Statistics for the NNUE evaluation cache.
+ *
+ * @param engine The engine.
+ * @param probes Location to store the total number of cache probes at.
+ * @param hits Location to store the total number of cache hits at.
  */
-void smp_stop_all(void);
+void smp_eval_cache_stats(struct engine *engine, uint64_t *probes,
+                          uint64_t *hits);
+
+/*
+ * Statistics for the tablebase WDL cache.
+ *
+ * @param engine The engine.
+ * @param probes Location to store the total number of tablebase probes at.
+ * @param hits Location to store the number of probes answered by
+ *             the cache at.
+ */
+void smp_egtb_cache_stats(struct engine *engine, uint64_t *probes,
+                          uint64_t *hits);
+
+/*
+ * Statistics for the transposition table.
+ *
+ * @param engine The engine.
+ * @param probes Location to store the total number of probes at.
+ * @param hits Location to store the total number of hits at.
+ */
+void smp_tt_stats(struct engine *engine, uint64_t *probes, uint64_t *hits);
+
+/*
+ * Stop all workers. This function may be called from any thread.
+ *
+ * @param engine The engine.
+ */
+void smp_stop_all(struct engine *engine);
 
 /*
  * Check if searching should stop.
  *
+ * @param engine The engine.
  * @return Returns true if searching should stop.
  */
-bool smp_should_stop(void);
+bool smp_should_stop(struct engine *engine);
 
 /*
  * Called by workers when they have finished a search iteration.
@@ -115,4 +246,17 @@ bool smp_should_stop(void);
  */
 int smp_complete_iteration(struct search_worker *worker);
 
+/*
+ * Get statistics about the depth scheduling done by
+ * smp_complete_iteration during the last search.
+ *
+ * @param engine The engine.
+ * @param time Location to store the total time spent (in microseconds) at.
+ * @param calls Location to store the number of completed iterations at.
+ * @param retries Location to store the number of times an update had
+ *                to be retried because of another worker at.
+ */
+void smp_scheduling_stats(struct engine *engine, uint64_t *time,
+                          uint64_t *calls, uint64_t *retries);
+
 #endif
@@ -0,0 +1,145 @@
+/*
+ * Marvin - an UCI/XBoard compatible chess engine
+ * Copyright (C) 2023 Martin Danielsson
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "stats.h"
+#include "smp.h"
+
+#ifdef SEARCH_STATS
+static double percent(uint64_t a, uint64_t b)
+{
+    return b > 0?(100.0*a)/b:0.0;
+}
+
+static void add_stats(struct search_stats *total, struct search_stats *stats)
+{
+    total->nodes += stats->nodes;
+    total->qnodes += stats->qnodes;
+    total->tbhits += stats->tbhits;
+    total->evals += stats->evals;
+    total->tt_probes += stats->tt_probes;
+    total->tt_hits += stats->tt_hits;
+    total->tt_cutoffs += stats->tt_cutoffs;
+    total->nnue_cache_probes += stats->nnue_cache_probes;
+    total->nnue_cache_hits += stats->nnue_cache_hits;
+    total->nnue_refreshes += stats->nnue_refreshes;
+    total->nnue_full_refreshes += stats->nnue_full_refreshes;
+    total->rfp_prunes += stats->rfp_prunes;
+    total->null_tries += stats->null_tries;
+    total->null_cutoffs += stats->null_cutoffs;
+    total->probcut_cutoffs += stats->probcut_cutoffs;
+    total->futility_prunes += stats->futility_prunes;
+    total->lmp_prunes += stats->lmp_prunes;
+    total->see_prunes += stats->see_prunes;
+    total->history_prunes += stats->history_prunes;
+    total->fail_highs += stats->fail_highs;
+    total->first_move_fail_highs += stats->first_move_fail_highs;
+}
+
+static void print_stats(char *name, struct search_stats *stats)
+{
+    printf("%s:\n", name);
+    printf("  Nodes: %"PRIu64" (%.1f%% quiescence)\n", stats->nodes,
+           percent(stats->qnodes, stats->nodes));
+    printf("  Tablebase hits: %"PRIu64"\n", stats->tbhits);
+    printf("  TT probes: %"PRIu64", hits: %.1f%%, cutoffs: %.1f%%\n",
+           stats->tt_probes, percent(stats->tt_hits, stats->tt_probes),
+           percent(stats->tt_cutoffs, stats->tt_probes));
+    printf("  Evaluations: %"PRIu64", NNUE cache hits: %.1f%%\n",
+           stats->evals,
+           percent(stats->nnue_cache_hits, stats->nnue_cache_probes));
+    printf("  Accumulator refreshes: %"PRIu64" (%"PRIu64" full)\n",
+           stats->nnue_refreshes, stats->nnue_full_refreshes);
+    printf("  Reverse futility prunes: %"PRIu64"\n", stats->rfp_prunes);
+    printf("  Null moves: %"PRIu64", cutoffs: %.1f%%\n", stats->null_tries,
+           percent(stats->null_cutoffs, stats->null_tries));
+    printf("  Probcut cutoffs: %"PRIu64"\n", stats->probcut_cutoffs);
+    printf("  Move prunes: futility %"PRIu64", LMP %"PRIu64", SEE %"PRIu64
+           ", history %"PRIu64"\n", stats->futility_prunes, stats->lmp_prunes,
+           stats->see_prunes, stats->history_prunes);
+    printf("  Fail highs: %"PRIu64", on first move: %.1f%%\n",
+           stats->fail_highs,
+           percent(stats->first_move_fail_highs, stats->fail_highs));
+}
+#endif
+
+void stats_update(struct search_worker *worker)
+{
+#ifdef SEARCH_STATS
+    /*
+     * The refresh counters are never cleared by the search so they
+     * already contain the total since the last reset.
+     */
+    worker->stats.nodes += worker->nodes;
+    worker->stats.qnodes += worker->qnodes;
+    worker->stats.tbhits += worker->tbhits;
+    worker->stats.evals += worker->evals;
+    worker->stats.tt_probes += worker->tt_probes;
+    worker->stats.tt_hits += worker->tt_hits;
+    worker->stats.nnue_cache_probes += worker->nnue_cache_probes;
+    worker->stats.nnue_cache_hits += worker->nnue_cache_hits;
+    worker->stats.nnue_refreshes = worker->nnue_refreshes;
+    worker->stats.nnue_full_refreshes = worker->nnue_full_refreshes;
+#else
+    (void)worker;
+#endif
+}
+
+void stats_reset(struct engine *engine)
+{
+#ifdef SEARCH_STATS
+    struct search_worker *worker;
+    int                  k;
+
+    for (k=0;k<smp_number_of_workers(engine);k++) {
+        worker = smp_get_worker(engine, k);
+        memset(&worker->stats, 0, sizeof(struct search_stats));
+        worker->nnue_refreshes = 0ULL;
+        worker->nnue_full_refreshes = 0ULL;
+    }
+#else
+    (void)engine;
+#endif
+}
+
+void stats_print(struct engine *engine)
+{
+#ifdef SEARCH_STATS
+    struct search_worker *worker;
+    struct search_stats  total;
+    char                 name[32];
+    int                  k;
+
+    memset(&total, 0, sizeof(total));
+    for (k=0;k<smp_number_of_workers(engine);k++) {
+        worker = smp_get_worker(engine, k);
+        if (smp_number_of_workers(engine) > 1) {
+            snprintf(name, sizeof(name), "Worker %d", k);
+            print_stats(name, &worker->stats);
+        }
+        add_stats(&total, &worker->stats);
+    }
+    print_stats("Search statistics", &total);
+#else
+    (void)engine;
+    printf("Search statistics are not available, build with variant=stats\n");
+#endif
+    fflush(stdout);
+}
@@ -0,0 +1,58 @@
+/*
+ * Marvin - an UCI/XBoard compatible chess engine
+ * Copyright (C) 2023 Martin Danielsson
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdbool.h>
+
+#include "types.h"
+
+/*
+ * Increase a search statistics counter of a worker. In builds without
+ * search statistics (SEARCH_STATS not defined) the counters are not
+ * compiled in at all.
+ */
+#ifdef SEARCH_STATS
+#define STATS_INC(w, c) ((w)->stats.c++)
+#else
+#define STATS_INC(w, c)
+#endif
+
+/*
+ * Add the per search counters of a worker to the statistics of the
+ * worker. Should be called by each worker when a search is finished.
+ *
+ * @param worker The worker.
+ */
+void stats_update(struct search_worker *worker);
+
+/*
+ * Clear the search statistics for all workers.
+ *
+ * @param engine The engine.
+ */
+void stats_reset(struct engine *engine);
+
+/*
+ * Print the search statistics for all workers to stdout.
+ *
+ * @param engine The engine.
+ */
+void stats_print(struct engine *engine);
+
+#endif
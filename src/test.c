@@ -17,7 +17,11 @@
  */
 #include <assert.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
 #include <inttypes.h>
+#include <stdatomic.h>
 
 #include "test.h"
 #include "config.h"
@@ -33,10 +37,31 @@
 #include "engine.h"
 #include "timectl.h"
 #include "smp.h"
+#include "cpu.h"
+#include "stats.h"
+#include "nnue.h"
+#include "see.h"
+#include "eval.h"
 
 /* Depth to search the benchmark positions to */
 #define BENCH_DEPTH 17
 
+/* Number of untimed samples to run before measuring a primitive */
+#define MICROBENCH_WARMUP 3
+
+/* Default number of timed samples for each primitive */
+#define MICROBENCH_REPETITIONS 15
+
+/* Maximum number of timed samples for each primitive */
+#define MICROBENCH_MAX_REPETITIONS 1000
+
+/*
+ * Number of times each primitive is repeated for every position in a
+ * sample. Makes each measurement long enough for the clock resolution
+ * not to matter.
+ */
+#define MICROBENCH_PASSES 50
+
 /* Benchmark positions */
 static char *positions[] = {
     "r4rk1/pp3ppp/2npb3/2p5/P1B1Pb1q/2PPN3/1P3R1P/R1BQ2K1 w - - 0 1",
@@ -73,129 +98,945 @@ static char *positions[] = {
     "2K5/r6k/7p/4N3/5P2/8/8/8 b - - 0 1"
 };
 
-static void perft(struct position *pos, int depth, uint32_t *nleafs)
+/* Entry in the perft hash table */
+struct perft_entry {
+    uint64_t key;
+    uint64_t data;
+};
+
+/* Shared state for a perft run where root moves are split between workers */
+struct perft_job {
+    struct engine      *engine;
+    int                depth;
+    struct movelist    moves;
+    uint64_t           counts[MAX_MOVES];
+    atomic_int         next;
+    struct perft_entry *table;
+    uint64_t           size;
+};
+
+/*
+ * The hash key is mixed with the depth so that the same position
+ * searched to different depths ends up in different entries.
+ */
+static uint64_t perft_key(uint64_t key, int depth)
+{
+    return key^((uint64_t)depth*0x9E3779B97F4A7C15ULL);
+}
+
+/*
+ * The key is stored xor:ed with the data so that entries that are
+ * only partially written by another thread are detected and ignored.
+ */
+static bool perft_probe(struct perft_job *job, uint64_t key, int depth,
+                        uint64_t *nleafs)
+{
+    struct perft_entry *entry;
+    uint64_t           data;
+
+    if (job->table == NULL) {
+        return false;
+    }
+
+    entry = &job->table[key&(job->size-1)];
+    data = entry->data;
+    if (((entry->key^data) != key) || ((int)(data&0xFF) != depth)) {
+        return false;
+    }
+    *nleafs = data >> 8;
+    return true;
+}
+
+static void perft_store(struct perft_job *job, uint64_t key, int depth,
+                        uint64_t nleafs)
+{
+    struct perft_entry *entry;
+    uint64_t           data;
+
+    if (job->table == NULL) {
+        return;
+    }
+
+    entry = &job->table[key&(job->size-1)];
+    data = (nleafs << 8)|(uint64_t)depth;
+    entry->key = key^data;
+    entry->data = data;
+}
+
+static uint64_t perft(struct position *pos, int depth, struct perft_job *job)
 {
     struct movelist list;
+    uint64_t        nleafs;
+    uint64_t        key;
     int             k;
 
     /* Check if its time to stop */
     if (depth == 0) {
-        (*nleafs)++;
-        return;
+        return 1ULL;
+    }
+
+    /* Check if this position has already been counted */
+    key = perft_key(pos->key, depth);
+    if ((depth > 1) && perft_probe(job, key, depth, &nleafs)) {
+        return nleafs;
+    }
+
+    /*
+     * All generated moves are legal so at the last
+     * ply it is enough to count them.
+     */
+    gen_legal_moves(pos, &list);
+    if (depth == 1) {
+        return (uint64_t)list.size;
     }
 
     /* Search all moves */
-    gen_moves(pos, &list);
+    nleafs = 0ULL;
     for (k=0;k<list.size;k++) {
-        if (!pos_make_move(pos, list.moves[k])) {
-            continue;
+        (void)pos_make_move(pos, list.moves[k]);
+        nleafs += perft(pos, depth-1, job);
+        pos_unmake_move(pos);
+    }
+
+    perft_store(job, key, depth, nleafs);
+
+    return nleafs;
+}
+
+static void perft_job_func(int idx, void *data)
+{
+    struct perft_job     *job = data;
+    struct search_worker *worker;
+    struct position      *pos;
+    int                  k;
+
+    /*
+     * Give each worker its own copy of the position. The parent pointers
+     * are cleared since the search tables are not used by perft.
+     */
+    worker = smp_get_worker(job->engine, idx);
+    pos = &worker->pos;
+    pos_copy_root(pos, &job->engine->pos);
+    pos->engine = NULL;
+    pos->worker = NULL;
+
+    /* Grab root moves until all have been counted */
+    while (true) {
+        k = atomic_fetch_add(&job->next, 1);
+        if (k >= job->moves.size) {
+            break;
         }
-        perft(pos, depth-1, nleafs);
+        (void)pos_make_move(pos, job->moves.moves[k]);
+        job->counts[k] = perft(pos, job->depth-1, job);
         pos_unmake_move(pos);
     }
 }
 
-void test_run_perft(struct position *pos, int depth)
+static uint64_t run_perft(struct engine *engine, int depth, int hash_size,
+                          struct perft_job *job, time_t *elapsed)
 {
-    uint32_t nleafs;
-    char     fenstr[FEN_MAX_LENGTH];
+    uint64_t nleafs;
+    uint64_t size;
+    time_t   start;
+    int      k;
 
-    assert(valid_position(pos));
+    assert(valid_position(&engine->pos));
     assert(depth > 0);
 
-    fen_build_string(pos, fenstr);
+    /* The workers might still be clearing a resized transposition table */
+    hash_tt_wait_for_table(engine);
 
-    nleafs = 0;
-    perft(pos, depth, &nleafs);
-    printf("Nodes: %u\n", nleafs);
+    /* Allocate the hash table, the number of entries must be a power of 2 */
+    job->table = NULL;
+    job->size = 0ULL;
+    if (hash_size > 0) {
+        size = ((uint64_t)hash_size*1024ULL*1024ULL)/sizeof(struct perft_entry);
+        job->size = 1ULL;
+        while ((job->size*2) <= size) {
+            job->size *= 2;
+        }
+        job->table = aligned_malloc(64, job->size*sizeof(struct perft_entry));
+        if (job->table != NULL) {
+            smp_parallel_memset(engine, job->table, 0,
+                                job->size*sizeof(struct perft_entry));
+        } else {
+            job->size = 0ULL;
+        }
+    }
+
+    job->engine = engine;
+    job->depth = depth;
+    gen_legal_moves(&engine->pos, &job->moves);
+    atomic_init(&job->next, 0);
+
+    start = get_current_time();
+    smp_run_job(engine, perft_job_func, job);
+    *elapsed = get_current_time() - start;
+
+    nleafs = 0ULL;
+    for (k=0;k<job->moves.size;k++) {
+        nleafs += job->counts[k];
+    }
+
+    aligned_free(job->table);
+    job->table = NULL;
+
+    return nleafs;
 }
 
-void test_run_divide(struct position *pos, int depth)
+static double mnps(uint64_t nleafs, time_t elapsed)
 {
-    struct movelist list;
-    uint32_t        nleafs;
-    uint32_t        ntotal;
-    int             k;
-    char            movestr[MAX_MOVESTR_LENGTH];
-    char            fenstr[FEN_MAX_LENGTH];
+    return elapsed > 0?((double)nleafs)/(elapsed*1000.0):0.0;
+}
 
-    assert(valid_position(pos));
-    assert(depth > 0);
+void test_run_perft(struct engine *engine, int depth, int hash_size)
+{
+    struct perft_job job;
+    uint64_t         nleafs;
+    time_t           elapsed;
 
-    fen_build_string(pos, fenstr);
+    nleafs = run_perft(engine, depth, hash_size, &job, &elapsed);
 
-    ntotal = 0;
-    gen_moves(pos, &list);
-    for (k=0;k<list.size;k++) {
-        if (!pos_make_move(pos, list.moves[k])) {
+    printf("Nodes: %"PRIu64"\n", nleafs);
+    printf("Time: %.2fs\n", elapsed/1000.0);
+    printf("Speed: %.2fMnps\n", mnps(nleafs, elapsed));
+}
+
+void test_run_divide(struct engine *engine, int depth, int hash_size)
+{
+    struct perft_job job;
+    uint64_t         ntotal;
+    time_t           elapsed;
+    int              k;
+    char             movestr[MAX_MOVESTR_LENGTH];
+
+    ntotal = run_perft(engine, depth, hash_size, &job, &elapsed);
+
+    for (k=0;k<job.moves.size;k++) {
+        pos_move2str(job.moves.moves[k], movestr);
+        printf("%s %"PRIu64"\n", movestr, job.counts[k]);
+    }
+
+    printf("Moves: %d\n", job.moves.size);
+    printf("Leafs: %"PRIu64"\n", ntotal);
+    printf("Time: %.2fs\n", elapsed/1000.0);
+    printf("Speed: %.2fMnps\n", mnps(ntotal, elapsed));
+}
+
+/* Statistics for a benchmark run, either for one position or in total */
+struct bench_stats {
+    uint64_t nodes;
+    uint64_t qnodes;
+    uint64_t evals;
+    uint64_t tt_probes;
+    uint64_t tt_hits;
+    uint64_t cache_probes;
+    uint64_t cache_hits;
+    time_t   time;
+};
+
+static double ratio(uint64_t a, uint64_t b)
+{
+    return b > 0?((double)a)/b:0.0;
+}
+
+static double nps(struct bench_stats *stats)
+{
+    return stats->time > 0?((double)stats->nodes)/(stats->time/1000.0):0.0;
+}
+
+static void add_stats(struct bench_stats *total, struct bench_stats *stats)
+{
+    total->nodes += stats->nodes;
+    total->qnodes += stats->qnodes;
+    total->evals += stats->evals;
+    total->tt_probes += stats->tt_probes;
+    total->tt_hits += stats->tt_hits;
+    total->cache_probes += stats->cache_probes;
+    total->cache_hits += stats->cache_hits;
+    total->time += stats->time;
+}
+
+static void print_json_stats(struct bench_stats *stats)
+{
+    printf("\"nodes\": %"PRIu64", ", stats->nodes);
+    printf("\"time_ms\": %"PRId64", ", (int64_t)stats->time);
+    printf("\"nps\": %.0f, ", nps(stats));
+    printf("\"tt_hit_rate\": %.4f, ", ratio(stats->tt_hits, stats->tt_probes));
+    printf("\"nnue_cache_hit_rate\": %.4f, ",
+           ratio(stats->cache_hits, stats->cache_probes));
+    printf("\"qnode_fraction\": %.4f, ", ratio(stats->qnodes, stats->nodes));
+    printf("\"evals_per_node\": %.4f", ratio(stats->evals, stats->nodes));
+}
+
+static char** read_fen_file(char *fenfile, int *npos)
+{
+    FILE *fp;
+    char buffer[FEN_MAX_LENGTH];
+    char **list = NULL;
+    char **tmp;
+    int  size = 0;
+    int  len;
+
+    *npos = 0;
+    fp = fopen(fenfile, "r");
+    if (fp == NULL) {
+        return NULL;
+    }
+    while (fgets(buffer, sizeof(buffer), fp) != NULL) {
+        len = strlen(buffer);
+        while ((len > 0) && isspace((unsigned char)buffer[len-1])) {
+            buffer[--len] = '\0';
+        }
+        if ((len == 0) || (buffer[0] == '#')) {
             continue;
         }
-        nleafs = 0;
-        perft(pos, depth-1, &nleafs);
-        ntotal += nleafs;
-        pos_move2str(list.moves[k], movestr);
-        printf("%s %u\n", movestr, nleafs);
-        pos_unmake_move(pos);
+        if (*npos == size) {
+            size = MAX(2*size, 64);
+            tmp = realloc(list, size*sizeof(char*));
+            if (tmp == NULL) {
+                break;
+            }
+            list = tmp;
+        }
+        list[*npos] = malloc(len+1);
+        if (list[*npos] == NULL) {
+            break;
+        }
+        strcpy(list[*npos], buffer);
+        (*npos)++;
+    }
+    fclose(fp);
+
+    return list;
+}
+
+/* A stored benchmark result that later runs are compared against */
+struct bench_baseline {
+    int      depth;
+    int      nthreads;
+    int      hash_size;
+    uint64_t nodes;
+    bool     reproducible;
+    uint64_t signature;
+    double   nps;
+};
+
+static bool read_baseline(char *path, struct bench_baseline *baseline)
+{
+    FILE *fp;
+    char buffer[256];
+    char *iter;
+    int  nvalues = 0;
+
+    fp = fopen(path, "r");
+    if (fp == NULL) {
+        return false;
+    }
+    memset(baseline, 0, sizeof(struct bench_baseline));
+    while (fgets(buffer, sizeof(buffer), fp) != NULL) {
+        iter = strchr(buffer, '=');
+        if ((buffer[0] == '#') || (iter == NULL)) {
+            continue;
+        }
+        *iter = '\0';
+        iter++;
+        if (!strcmp(buffer, "depth")) {
+            baseline->depth = atoi(iter);
+        } else if (!strcmp(buffer, "threads")) {
+            baseline->nthreads = atoi(iter);
+        } else if (!strcmp(buffer, "hash")) {
+            baseline->hash_size = atoi(iter);
+        } else if (!strcmp(buffer, "nodes")) {
+            baseline->nodes = strtoull(iter, NULL, 10);
+        } else if (!strcmp(buffer, "reproducible")) {
+            baseline->reproducible = atoi(iter) != 0;
+        } else if (!strcmp(buffer, "signature")) {
+            baseline->signature = strtoull(iter, NULL, 10);
+        } else if (!strcmp(buffer, "nps")) {
+            baseline->nps = atof(iter);
+        } else {
+            continue;
+        }
+        nvalues++;
+    }
+    fclose(fp);
+
+    return (nvalues > 0) && (baseline->nps > 0.0);
+}
+
+static bool write_baseline(char *path, struct bench_baseline *baseline)
+{
+    FILE *fp;
+
+    fp = fopen(path, "w");
+    if (fp == NULL) {
+        return false;
     }
+    fprintf(fp, "# %s %s (%s) benchmark baseline\n", APP_NAME, APP_VERSION,
+            APP_ARCH);
+    fprintf(fp, "depth=%d\n", baseline->depth);
+    fprintf(fp, "threads=%d\n", baseline->nthreads);
+    fprintf(fp, "hash=%d\n", baseline->hash_size);
+    fprintf(fp, "nodes=%"PRIu64"\n", baseline->nodes);
+    fprintf(fp, "reproducible=%d\n", baseline->reproducible?1:0);
+    fprintf(fp, "signature=%"PRIu64"\n", baseline->signature);
+    fprintf(fp, "nps=%.0f\n", baseline->nps);
+    fclose(fp);
 
-    printf("Moves: %d\n", list.size);
-    printf("Leafs: %u\n", ntotal);
+    return true;
 }
 
-void test_run_benchmark(void)
+/*
+ * Compare a benchmark result with a baseline. The signature is only
+ * compared for deterministic runs, that is single-threaded runs or
+ * runs in reproducible mode.
+ */
+static bool compare_baseline(struct bench_baseline *result,
+                             struct bench_baseline *baseline, int threshold,
+                             bool json)
 {
-    struct engine *engine;
-    int           k;
-    int           npos;
-    uint64_t      nodes;
-    time_t        start;
-    time_t        total;
-    int           nworkers;
-    int           tt_size;
+    bool   same_settings;
+    bool   deterministic;
+    bool   signature_ok;
+    bool   speed_ok;
+    double change;
 
-    printf("%s %s (%s)\n", APP_NAME, APP_VERSION, APP_ARCH);
-    if (engine_using_nnue) {
-        printf("Using NNUE evaluation\n");
+    same_settings = (result->depth == baseline->depth) &&
+                    (result->nthreads == baseline->nthreads) &&
+                    (result->hash_size == baseline->hash_size) &&
+                    (result->nodes == baseline->nodes) &&
+                    (result->reproducible == baseline->reproducible);
+    deterministic = (result->nthreads == 1) || result->reproducible;
+    signature_ok = !deterministic ||
+                   (result->signature == baseline->signature);
+    change = 100.0*(result->nps-baseline->nps)/baseline->nps;
+    speed_ok = change >= -threshold;
+
+    if (json) {
+        printf(",\n \"baseline\": {\"same_settings\": %s, ",
+               same_settings?"true":"false");
+        printf("\"signature\": %"PRIu64", ", baseline->signature);
+        printf("\"signature_match\": %s, ", signature_ok?"true":"false");
+        printf("\"nps\": %.0f, \"change\": %.2f, ", baseline->nps, change);
+        printf("\"threshold\": %d, \"passed\": %s}", threshold,
+               (same_settings && signature_ok && speed_ok)?"true":"false");
     } else {
-        printf("Using classic evaluation\n");
+        if (!same_settings) {
+            printf("Baseline was created with different settings\n");
+        }
+        if (!deterministic) {
+            printf("Baseline signature: not compared\n");
+        } else {
+            printf("Baseline signature: %"PRIu64" (%s)\n",
+                   baseline->signature, signature_ok?"match":"mismatch");
+        }
+        printf("Baseline speed: %.2fkN/s (%+.1f%%, threshold -%d%%)\n",
+               baseline->nps/1000, change, threshold);
+        printf("Baseline comparison: %s\n",
+               (same_settings && signature_ok && speed_ok)?"passed":"failed");
     }
 
-    nworkers = smp_number_of_workers();
-    tt_size = hash_tt_size();
-    hash_tt_destroy_table();
-    hash_tt_create_table(DEFAULT_MAIN_HASH_SIZE);
-    smp_destroy_workers();
-    smp_create_workers(1);
+    return same_settings && signature_ok && speed_ok;
+}
+
+bool test_run_benchmark(struct bench_options *options)
+{
+    struct engine         *engine;
+    struct search_worker  *worker;
+    struct bench_stats    stats;
+    struct bench_stats    total;
+    struct bench_baseline result;
+    struct bench_baseline baseline;
+    char                  **fens;
+    int                   depth;
+    int                   nthreads;
+    int                   hash_size;
+    int                   k;
+    int                   l;
+    int                   npos;
+    uint64_t              refreshes;
+    uint64_t              full_refreshes;
+    time_t                start;
+    bool                  json = options->json;
+    bool                  passed = true;
+
+    depth = (options->depth > 0)?options->depth:BENCH_DEPTH;
+    nthreads = (options->nthreads > 0)?
+                            CLAMP(options->nthreads, 1, MAX_WORKERS):1;
+    hash_size = (options->hash_size > 0)?
+                            CLAMP(options->hash_size, MIN_MAIN_HASH_SIZE,
+                                  hash_tt_max_size()):
+                            DEFAULT_MAIN_HASH_SIZE;
 
-    engine = engine_create();
-    nodes = 0ULL;
-    total = 0;
-    npos = sizeof(positions)/sizeof(char*);
+    /* Read the baseline before spending time on the benchmark */
+    if ((options->baseline != NULL) &&
+        !read_baseline(options->baseline, &baseline)) {
+        printf("Failed to read baseline from %s\n", options->baseline);
+        return false;
+    }
+
+    /* Get the positions to search */
+    if (options->fenfile != NULL) {
+        fens = read_fen_file(options->fenfile, &npos);
+        if (npos == 0) {
+            printf("Failed to read positions from %s\n", options->fenfile);
+            free(fens);
+            return false;
+        }
+    } else {
+        fens = positions;
+        npos = sizeof(positions)/sizeof(char*);
+    }
+
+    if (json) {
+        printf("{\"name\": \"%s\", \"version\": \"%s\", \"arch\": \"%s\", ",
+               APP_NAME, APP_VERSION, APP_ARCH);
+        printf("\"evaluation\": \"%s\", ",
+               engine_using_nnue?cpu_simd_name():"classic");
+        printf("\"depth\": %d, \"threads\": %d, \"hash\": %d, ",
+               depth, nthreads, hash_size);
+        printf("\"nodes\": %"PRIu64", \"reproducible\": %s,\n",
+               options->nodes, options->reproducible?"true":"false");
+        printf(" \"positions\": [\n");
+    } else {
+        printf("%s %s (%s)\n", APP_NAME, APP_VERSION, APP_ARCH);
+        if (engine_using_nnue) {
+            printf("Using NNUE evaluation (%s)\n", cpu_simd_name());
+        } else {
+            printf("Using classic evaluation\n");
+        }
+        printf("Depth: %d, threads: %d, hash: %dMB", depth, nthreads,
+               hash_size);
+        if (options->nodes > 0ULL) {
+            printf(", nodes: %"PRIu64"%s", options->nodes,
+                   options->reproducible?" per thread":"");
+        }
+        printf("%s\n", options->reproducible?", reproducible":"");
+    }
+
+    engine = engine_create(hash_size, nthreads);
+    if (engine == NULL) {
+        printf("Failed to create engine\n");
+        return false;
+    }
+    engine->reproducible = options->reproducible;
+    memset(&total, 0, sizeof(total));
     for (k=0;k<npos;k++) {
-        pos_setup_from_fen(&engine->pos, positions[k]);
-        tc_configure_time_control(0, 0, 0, TC_INFINITE_TIME);
-        smp_newgame();
-        engine->sd = BENCH_DEPTH;
+        if (!pos_setup_from_fen(&engine->pos, fens[k])) {
+            printf("Invalid position: %s\n", fens[k]);
+            continue;
+        }
+        if (options->nodes > 0ULL) {
+            tc_configure_time_control(engine, 0, 0, 0,
+                                      TC_INFINITE_TIME|TC_NODE_LIMIT);
+        } else {
+            tc_configure_time_control(engine, 0, 0, 0, TC_INFINITE_TIME);
+        }
+        smp_newgame(engine);
+        engine->sd = depth;
+        engine->max_nodes = options->nodes;
         engine->move_filter.size = 0;
         engine->exit_on_mate = true;
 
         start = get_current_time();
         (void)search_position(engine, false, NULL, NULL);
-        total += (get_current_time() - start);
-        nodes += smp_nodes();
+        stats.time = get_current_time() - start;
+        stats.nodes = smp_nodes(engine);
+        stats.qnodes = smp_qnodes(engine);
+        stats.evals = smp_evals(engine);
+        smp_tt_stats(engine, &stats.tt_probes, &stats.tt_hits);
+        smp_eval_cache_stats(engine, &stats.cache_probes, &stats.cache_hits);
+        add_stats(&total, &stats);
 
-        printf("#");
+        if (json) {
+            printf("  {\"fen\": \"%s\", ", fens[k]);
+            print_json_stats(&stats);
+            printf("}%s\n", (k < (npos-1))?",":"");
+        } else {
+            printf("%3d: %12"PRIu64" nodes %8.2fs %10.2fkN/s  TT %5.1f%%\n",
+                   k+1, stats.nodes, stats.time/1000.0, nps(&stats)/1000,
+                   100.0*ratio(stats.tt_hits, stats.tt_probes));
+        }
     }
-    printf("\n");
 
-    printf("Total time: %.2fs\n", total/1000.0);
-    printf("Total number of nodes: %"PRIu64"\n", nodes);
-    printf("Speed: %.2fkN/s\n", ((double)nodes)/(total/1000.0)/1000);
+    /* Accumulator refresh statistics for all workers */
+    refreshes = 0ULL;
+    full_refreshes = 0ULL;
+    for (l=0;l<smp_number_of_workers(engine);l++) {
+        worker = smp_get_worker(engine, l);
+        refreshes += worker->nnue_refreshes;
+        full_refreshes += worker->nnue_full_refreshes;
+    }
+
+    /*
+     * The total number of nodes is used as a signature for the search.
+     * It is only deterministic for single-threaded runs and for runs
+     * in reproducible mode.
+     */
+    if (json) {
+        printf(" ],\n \"total\": {");
+        print_json_stats(&total);
+        printf(", \"accumulator_refreshes\": %"PRIu64", ", refreshes);
+        printf("\"full_refreshes_avoided\": %"PRIu64", ",
+               refreshes-full_refreshes);
+        printf("\"signature\": %"PRIu64"}", total.nodes);
+    } else {
+        printf("Total time: %.2fs\n", total.time/1000.0);
+        printf("Total number of nodes: %"PRIu64"\n", total.nodes);
+        printf("Speed: %.2fkN/s\n", nps(&total)/1000);
+        printf("Evaluations per node: %.3f\n", ratio(total.evals, total.nodes));
+        printf("Quiescence nodes: %.1f%%\n",
+               100.0*ratio(total.qnodes, total.nodes));
+        printf("TT hit rate: %.1f%%\n",
+               100.0*ratio(total.tt_hits, total.tt_probes));
+        printf("NNUE cache hit rate: %.1f%%\n",
+               100.0*ratio(total.cache_hits, total.cache_probes));
+        printf("Accumulator refreshes: %"PRIu64" (%"PRIu64" full avoided)\n",
+               refreshes, refreshes-full_refreshes);
+        printf("Signature: %"PRIu64"\n", total.nodes);
+#ifdef SEARCH_STATS
+        stats_print(engine);
+#endif
+    }
+
+    /* Compare with the baseline and optionally save a new one */
+    result.depth = depth;
+    result.nthreads = nthreads;
+    result.hash_size = hash_size;
+    result.nodes = options->nodes;
+    result.reproducible = options->reproducible;
+    result.signature = total.nodes;
+    result.nps = nps(&total);
+    if (options->baseline != NULL) {
+        passed = compare_baseline(&result, &baseline, options->threshold,
+                                  json);
+    }
+    if (json) {
+        printf("}\n");
+    }
+    if ((options->save_baseline != NULL) &&
+        !write_baseline(options->save_baseline, &result)) {
+        printf("Failed to write baseline to %s\n", options->save_baseline);
+        passed = false;
+    }
+    fflush(stdout);
 
     engine_destroy(engine);
+    if (fens != positions) {
+        for (k=0;k<npos;k++) {
+            free(fens[k]);
+        }
+        free(fens);
+    }
+
+    return passed;
+}
+
+/* Primitives measured by the microbenchmark */
+enum {
+    MB_GEN_MOVES,
+    MB_MAKE_UNMAKE,
+    MB_SEE_GE,
+    MB_TT_LOOKUP,
+    MB_HCE_EVALUATE,
+    MB_NNUE_MAKE_MOVE,
+    MB_NNUE_EVALUATE,
+    MB_NNUE_INCREMENTAL,
+    MB_NPRIMITIVES
+};
+
+static char *microbench_names[MB_NPRIMITIVES] = {
+    "gen_moves",
+    "pos_make_move",
+    "see_ge",
+    "hash_tt_lookup",
+    "hce_evaluate",
+    "nnue_make_move",
+    "nnue_evaluate",
+    "nnue_evaluate_incremental"
+};
+
+/* Results are accumulated here to keep the compiler from removing work */
+static volatile uint64_t microbench_sink;
+
+/*
+ * Time one primitive on a position. The primitive is applied to all legal
+ * moves, or to the position itself, MICROBENCH_PASSES times.
+ */
+static uint64_t microbench_sample(struct position *pos,
+                                  struct movelist *legal, uint64_t *keys,
+                                  int primitive, uint64_t *nops)
+{
+    struct search_worker *worker = pos->worker;
+    struct engine        *engine = pos->engine;
+    struct movelist      list;
+    struct tt_item       item;
+    uint64_t             key = pos->key;
+    uint64_t             sink = 0ULL;
+    uint64_t             start;
+    uint64_t             elapsed;
+    int                  pass;
+    int                  k;
+
+    /*
+     * Without parent pointers moves only update the board and the
+     * evaluation uses the root accumulator directly, bypassing the
+     * NNUE cache.
+     */
+    if (primitive == MB_MAKE_UNMAKE) {
+        pos->engine = NULL;
+        pos->worker = NULL;
+    } else if (primitive == MB_NNUE_EVALUATE) {
+        pos->worker = NULL;
+    }
 
-    hash_tt_destroy_table();
-    hash_tt_create_table(tt_size);
-    smp_destroy_workers();
-    smp_create_workers(nworkers);
+    start = get_current_time_ns();
+    for (pass=0;pass<MICROBENCH_PASSES;pass++) {
+        switch (primitive) {
+        case MB_GEN_MOVES:
+            gen_moves(pos, &list);
+            sink += list.size;
+            break;
+        case MB_MAKE_UNMAKE:
+            for (k=0;k<legal->size;k++) {
+                sink += pos_make_move(pos, legal->moves[k]);
+                pos_unmake_move(pos);
+            }
+            break;
+        case MB_NNUE_MAKE_MOVE:
+            pos->height++;
+            for (k=0;k<legal->size;k++) {
+                nnue_make_move(pos, legal->moves[k]);
+                sink += pos->eval_stack[pos->height].ndirty;
+            }
+            pos->height--;
+            break;
+        case MB_HCE_EVALUATE:
+            for (k=0;k<legal->size;k++) {
+                (void)pos_make_move(pos, legal->moves[k]);
+                sink += eval_evaluate(pos, true);
+                pos_unmake_move(pos);
+            }
+            break;
+        case MB_NNUE_EVALUATE:
+            sink += nnue_evaluate(pos);
+            break;
+        case MB_NNUE_INCREMENTAL:
+            for (k=0;k<legal->size;k++) {
+                (void)pos_make_move(pos, legal->moves[k]);
+                sink += nnue_evaluate(pos);
+                pos_unmake_move(pos);
+            }
+            break;
+        case MB_SEE_GE:
+            for (k=0;k<legal->size;k++) {
+                sink += see_ge(pos, legal->moves[k], 0);
+            }
+            break;
+        case MB_TT_LOOKUP:
+            for (k=0;k<legal->size;k++) {
+                pos->key = keys[k];
+                sink += hash_tt_lookup(pos, &item);
+            }
+            pos->key = key;
+            break;
+        default:
+            assert(false);
+            break;
+        }
+    }
+    elapsed = get_current_time_ns() - start;
+
+    pos->engine = engine;
+    pos->worker = worker;
+    microbench_sink += sink;
+
+    switch (primitive) {
+    case MB_GEN_MOVES:
+    case MB_NNUE_EVALUATE:
+        *nops = MICROBENCH_PASSES;
+        break;
+    default:
+        *nops = (uint64_t)MICROBENCH_PASSES*legal->size;
+        break;
+    }
+
+    return elapsed;
+}
+
+static int compare_samples(const void *a, const void *b)
+{
+    double sa = *(const double*)a;
+    double sb = *(const double*)b;
+
+    return (sa > sb) - (sa < sb);
+}
+
+static double percentile(double *samples, int nsamples, int p)
+{
+    return samples[((nsamples-1)*p+50)/100];
+}
+
+void test_run_microbenchmark(int repetitions, char *fenfile, bool json)
+{
+    struct engine        *engine;
+    struct search_worker *worker;
+    struct position      *pos;
+    struct movelist      legal;
+    uint64_t             keys[MAX_MOVES];
+    uint64_t             *elapsed;
+    uint64_t             nops[MB_NPRIMITIVES];
+    uint64_t             ops;
+    uint64_t             ns;
+    double               samples[MICROBENCH_MAX_REPETITIONS];
+    char                 **fens;
+    char                 *name;
+    int                  cache_size;
+    int                  nprimitives;
+    int                  npos;
+    int                  nvalid;
+    int                  k;
+    int                  l;
+    int                  r;
+
+    repetitions = (repetitions > 0)?
+                            MIN(repetitions, MICROBENCH_MAX_REPETITIONS):
+                            MICROBENCH_REPETITIONS;
+
+    /* Get the positions to measure on */
+    if (fenfile != NULL) {
+        fens = read_fen_file(fenfile, &npos);
+        if (npos == 0) {
+            printf("Failed to read positions from %s\n", fenfile);
+            free(fens);
+            return;
+        }
+    } else {
+        fens = positions;
+        npos = sizeof(positions)/sizeof(char*);
+    }
+
+    /* The NNUE primitives are only measured when a net is used */
+    nprimitives = MB_NPRIMITIVES;
+    if (!engine_using_nnue || !engine_loaded_net) {
+        nprimitives = MB_NNUE_MAKE_MOVE;
+    }
+
+    /*
+     * The engine is created without an NNUE cache so that repeated
+     * evaluations of the same position measure the network itself.
+     */
+    cache_size = engine_eval_cache_size;
+    engine_eval_cache_size = 0;
+    engine = engine_create(DEFAULT_MAIN_HASH_SIZE, 1);
+    engine_eval_cache_size = cache_size;
+    if (engine == NULL) {
+        printf("Failed to create engine\n");
+        return;
+    }
+    worker = smp_get_worker(engine, 0);
+
+    elapsed = calloc(MB_NPRIMITIVES*repetitions, sizeof(uint64_t));
+    if (elapsed == NULL) {
+        printf("Failed to allocate memory\n");
+        engine_destroy(engine);
+        return;
+    }
+    memset(nops, 0, sizeof(nops));
+
+    nvalid = 0;
+    for (k=0;k<npos;k++) {
+        if (!pos_setup_from_fen(&engine->pos, fens[k])) {
+            printf("Invalid position: %s\n", fens[k]);
+            continue;
+        }
+        nvalid++;
+        engine->pos.height = 0;
+        nnue_refresh_accumulator(&engine->pos, worker);
+        smp_prepare_workers(engine);
+        pos = &worker->pos;
+        gen_legal_moves(pos, &legal);
+
+        /*
+         * Store every other child position in the transposition table
+         * so that lookups are a mix of hits and misses.
+         */
+        for (l=0;l<legal.size;l++) {
+            (void)pos_make_move(pos, legal.moves[l]);
+            keys[l] = pos->key;
+            if ((l%2) != 0) {
+                hash_tt_store_entry(engine, pos->key, NOMOVE, 1, 0, TT_ALPHA,
+                                    0);
+            }
+            pos_unmake_move(pos);
+        }
+
+        for (l=0;l<nprimitives;l++) {
+            for (r=0;r<MICROBENCH_WARMUP;r++) {
+                (void)microbench_sample(pos, &legal, keys, l, &ops);
+            }
+            for (r=0;r<repetitions;r++) {
+                elapsed[l*repetitions+r] +=
+                            microbench_sample(pos, &legal, keys, l, &ops);
+            }
+            nops[l] += ops;
+        }
+        smp_reset_workers(engine);
+    }
+
+    if (json) {
+        printf("{\"name\": \"%s\", \"version\": \"%s\", ", APP_NAME,
+               APP_VERSION);
+        printf("\"arch\": \"%s\", ", APP_ARCH);
+        printf("\"positions\": %d, \"repetitions\": %d,\n", nvalid,
+               repetitions);
+        printf(" \"results\": [\n");
+    } else {
+        printf("%s %s (%s)\n", APP_NAME, APP_VERSION, APP_ARCH);
+        printf("Positions: %d, repetitions: %d\n", nvalid, repetitions);
+        printf("%-26s %10s %10s %10s %10s %12s\n", "Primitive", "Median",
+               "P10", "P90", "Min", "Ops/sample");
+    }
+
+    /* Print the distribution of the samples in ns per operation */
+    for (l=0;l<nprimitives;l++) {
+        name = microbench_names[l];
+        for (r=0;r<repetitions;r++) {
+            ns = elapsed[l*repetitions+r];
+            samples[r] = (nops[l] > 0)?((double)ns)/nops[l]:0.0;
+        }
+        qsort(samples, repetitions, sizeof(double), compare_samples);
+
+        if (json) {
+            printf("  {\"primitive\": \"%s\", ", name);
+            printf("\"median_ns\": %.2f, ",
+                   percentile(samples, repetitions, 50));
+            printf("\"p10_ns\": %.2f, ", percentile(samples, repetitions, 10));
+            printf("\"p90_ns\": %.2f, ", percentile(samples, repetitions, 90));
+            printf("\"min_ns\": %.2f, ", samples[0]);
+            printf("\"ops_per_sample\": %"PRIu64"}%s\n", nops[l],
+                   (l < (nprimitives-1))?",":"");
+        } else {
+            printf("%-26s %10.2f %10.2f %10.2f %10.2f %12"PRIu64"\n", name,
+                   percentile(samples, repetitions, 50),
+                   percentile(samples, repetitions, 10),
+                   percentile(samples, repetitions, 90), samples[0], nops[l]);
+        }
+    }
+    if (json) {
+        printf(" ]}\n");
+    } else {
+        printf("All times are in ns per operation\n");
+    }
+    fflush(stdout);
+
+    free(elapsed);
+    engine_destroy(engine);
+    if (fens != positions) {
+        for (k=0;k<npos;k++) {
+            free(fens[k]);
+        }
+        free(fens);
+    }
 }
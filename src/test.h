@@ -18,19 +18,25 @@
 #ifndef TEST_H
 #define TEST_H
 
+#include <stdint.h>
+#include <stdbool.h>
+
 #include "types.h"
 
 /*
- * Run perft on a specific position. Perft results can be compared with the
+ * Run perft on a specific position. The root moves are split between the
+ * workers of the engine and positions that are reached more than once are
+ * looked up in a hash table. Perft results can be compared with the
  * engine ROCE.
  *
  * Perft info: http://www.rocechess.ch/perft.html
  * ROCE: http://www.rocechess.ch/rocee.html
  *
- * @param pos The position to run perft for.
+ * @param engine The engine, the current position of the engine is used.
  * @param depth The depth to run perft to.
+ * @param hash_size The size of the perft hash table in MB, 0 disables it.
  */
-void test_run_perft(struct position *pos, int depth);
+void test_run_perft(struct engine *engine, int depth, int hash_size);
 
 /*
  * Run divide on a specific position. Divide is a variant of perft that counts
@@ -41,12 +47,69 @@ void test_run_perft(struct position *pos, int depth);
  * Divide info: http://www.rocechess.ch/perft.html
  * ROCE: http://www.rocechess.ch/rocee.html
  *
- * @param pos The position to run divide for.
+ * @param engine The engine, the current position of the engine is used.
  * @param depth The depth to run divide to.
+ * @param hash_size The size of the perft hash table in MB, 0 disables it.
  */
-void test_run_divide(struct position *pos, int depth);
+void test_run_divide(struct engine *engine, int depth, int hash_size);
+
+/* The default maximum slowdown allowed compared to a baseline (in %) */
+#define DEFAULT_BENCH_THRESHOLD 5
+
+/* Options for the benchmark */
+struct bench_options {
+    /* The depth to search to, or 0 for the default depth */
+    int depth;
+    /* The number of threads to use, or 0 for a single thread */
+    int nthreads;
+    /* The size of the transposition table (in MB), or 0 for the default */
+    int hash_size;
+    /* File with positions to search, or NULL for the built-in positions */
+    char *fenfile;
+    /* If true the result is printed in JSON format */
+    bool json;
+    /* If true the search is reproducible also with several threads */
+    bool reproducible;
+    /* Node limit for each position (per thread if reproducible), or 0 */
+    uint64_t nodes;
+    /* File with a baseline to compare the result with, or NULL */
+    char *baseline;
+    /* The maximum slowdown compared to the baseline (in %) */
+    int threshold;
+    /* File to save the result to as a new baseline, or NULL */
+    char *save_baseline;
+};
 
-/* Run a benchmark to check evaluate the performance of the engine */
-void test_run_benchmark(void);
+/*
+ * Run a benchmark to check evaluate the performance of the engine. Each
+ * position is searched to a fixed depth and statistics are printed for
+ * each position and in total. The total number of nodes is printed as a
+ * signature of the search. The signature is deterministic for single-
+ * threaded runs and for reproducible runs.
+ *
+ * If a baseline is given the speed is compared with the baseline and the
+ * run fails if it is slower than allowed by the threshold. For
+ * deterministic runs the signature must also match the baseline.
+ *
+ * @param options The benchmark options.
+ * @return Returns false if the benchmark failed or did not pass the
+ *         comparison with the baseline.
+ */
+bool test_run_benchmark(struct bench_options *options);
+
+/*
+ * Run a microbenchmark that measures the cost of the individual components
+ * of the search, like move generation, making moves, NNUE evaluation,
+ * static exchange evaluation and transposition table lookups. Each
+ * primitive is applied to a fixed set of positions and the time per
+ * operation is reported as the median and spread of a number of samples.
+ *
+ * @param repetitions The number of samples to take for each primitive, or
+ *                    0 for the default number.
+ * @param fenfile File with positions to use, one FEN string per line.
+ *                If NULL a built-in set of positions is used.
+ * @param json If true the result is printed in JSON format.
+ */
+void test_run_microbenchmark(int repetitions, char *fenfile, bool json);
 
 #endif
@@ -30,112 +30,132 @@
  */
 #define MOVES_TO_TIME_CONTROL 30
 
-/* Flags indicating special time control modes */
-static int tc_flags = 0;
-
-/* The time increment (in milliseconds) */
-static int tc_increment = 0;
-
-/* The number of moves to the next time control */
-static int tc_movestogo = 0;
-
-/* The number of milliseconds left on the clock */
-static int tc_time_left = 0;
+/*
+ * Limits for how much the allocated time can be scaled based on how
+ * the search develops.
+ */
+#define MIN_TIME_SCALE 0.35
+#define MAX_TIME_SCALE 2.5
 
 /*
- * Limit on how long the engine is allowed to search. In
- * some special circumstances it can be ok to exceed
- * this limit.
+ * A score drop between two iterations of this size (in centipawns) or
+ * more gives the maximum time increase for score drops.
  */
-static time_t soft_time_limit = 0;
+#define MAX_SCORE_DROP 100
 
-/* A hard time limit that may not be exceeded */
-static time_t hard_time_limit = 0;
+/*
+ * Assumed growth in time from one iteration to the next until it has
+ * been measured, and the limits for the measured growth.
+ */
+#define DEFAULT_ITERATION_GROWTH 2.0
+#define MIN_ITERATION_GROWTH 1.2
+#define MAX_ITERATION_GROWTH 4.0
 
-/* The time when the current search was started */
-static time_t search_start = 0;
+/*
+ * Scale factors for the allocated time depending on for how many
+ * iterations the best move has been unchanged.
+ */
+static double stability_scale[] = {1.8, 1.4, 1.2, 1.1, 1.0, 0.9, 0.85};
 
-/* Keeps track if the clock is running or not */
-static bool clock_is_running = false;
+void tc_init(struct engine *engine)
+{
+    struct time_control *tc = &engine->tc;
 
-/* Safety margin to avoid loosing on time (in ms) */
-static int safety_margin = DEFAULT_MOVE_OVERHEAD;
+    tc->flags = 0;
+    tc->increment = 0;
+    tc->movestogo = 0;
+    tc->time_left = 0;
+    tc->soft_limit = 0;
+    tc->hard_limit = 0;
+    tc->search_start = 0;
+    tc->optimum = 0;
+    tc->clock_is_running = false;
+    tc->safety_margin = DEFAULT_MOVE_OVERHEAD;
+}
 
-void tc_set_move_overhead(int overhead)
+void tc_set_move_overhead(struct engine *engine, int overhead)
 {
-    safety_margin = overhead;
+    engine->tc.safety_margin = overhead;
 }
 
-void tc_configure_time_control(int time, int inc, int movestogo, int flags)
+void tc_configure_time_control(struct engine *engine, int time, int inc,
+                               int movestogo, int flags)
 {
-    tc_time_left = time;
-    tc_increment = inc;
-    tc_movestogo = movestogo > 0?movestogo:MOVES_TO_TIME_CONTROL;
-    tc_flags = flags;
-    soft_time_limit = 0;
-    hard_time_limit = 0;
+    struct time_control *tc = &engine->tc;
+
+    tc->time_left = time;
+    tc->increment = inc;
+    tc->movestogo = movestogo > 0?movestogo:MOVES_TO_TIME_CONTROL;
+    tc->flags = flags;
+    tc->soft_limit = 0;
+    tc->hard_limit = 0;
 }
 
-int tc_get_flags(void)
+int tc_get_flags(struct engine *engine)
 {
-    return tc_flags;
+    return engine->tc.flags;
 }
 
-void tc_start_clock(void)
+void tc_start_clock(struct engine *engine)
 {
-    search_start = get_current_time();
-    clock_is_running = true;
+    engine->tc.search_start = get_current_time();
+    engine->tc.clock_is_running = true;
 }
 
-void tc_stop_clock(void)
+void tc_stop_clock(struct engine *engine)
 {
-    clock_is_running = false;
+    engine->tc.clock_is_running = false;
 }
 
-bool tc_is_clock_running(void)
+bool tc_is_clock_running(struct engine *engine)
 {
-    return clock_is_running;
+    return engine->tc.clock_is_running;
 }
 
-void tc_allocate_time(void)
+void tc_allocate_time(struct engine *engine)
 {
-    time_t allocated = 0;
+    struct time_control *tc = &engine->tc;
+    time_t              allocated = 0;
 
     /* Handle special cases first */
-    if (tc_flags&TC_INFINITE_TIME) {
-        soft_time_limit = 0;
-        hard_time_limit = 0;
+    if (tc->flags&TC_INFINITE_TIME) {
+        tc->optimum = 0;
+        tc->soft_limit = 0;
+        tc->hard_limit = 0;
         return;
-    } else if (tc_flags&TC_FIXED_TIME) {
-        allocated = MAX(tc_time_left, 0);
-        soft_time_limit = search_start + allocated;
-        hard_time_limit = soft_time_limit;
+    } else if (tc->flags&TC_FIXED_TIME) {
+        allocated = MAX(tc->time_left, 0);
+        tc->optimum = allocated;
+        tc->soft_limit = tc->search_start + allocated;
+        tc->hard_limit = tc->soft_limit;
         return;
     }
 
     /* Calculate how much time to allocate */
-    allocated = tc_time_left/tc_movestogo + tc_increment;
-    allocated = MIN(allocated, tc_time_left-safety_margin);
+    allocated = tc->time_left/tc->movestogo + tc->increment;
+    allocated = MIN(allocated, tc->time_left-tc->safety_margin);
 
     /*
      * Setup time limits. The soft time limit is time the engine is
      * expected to spend and the hard limit is the amount of time it
-     * is allowed to spend in case of panic.
+     * is allowed to spend in case of panic. The soft limit is adjusted
+     * after each iteration, see tc_new_iteration.
      */
-    soft_time_limit = search_start + allocated;
-    allocated = MIN(5*allocated, tc_time_left*0.8);
-    allocated = MIN(allocated, tc_time_left-safety_margin);
-    hard_time_limit = search_start + allocated;
+    tc->optimum = allocated;
+    tc->soft_limit = tc->search_start + allocated;
+    allocated = MIN(5*allocated, tc->time_left*0.8);
+    allocated = MIN(allocated, tc->time_left-tc->safety_margin);
+    tc->hard_limit = tc->search_start + allocated;
 }
 
-time_t tc_elapsed_time(void)
+time_t tc_elapsed_time(struct engine *engine)
 {
-    return get_current_time() - search_start;
+    return get_current_time() - engine->tc.search_start;
 }
 
-void tc_update_time(int time)
+void tc_update_time(struct engine *engine, int time)
 {
-    tc_time_left = time;
+    engine->tc.time_left = time;
 }
 
 bool tc_check_time(struct search_worker *worker)
@@ -156,14 +176,114 @@ bool tc_check_time(struct search_worker *worker)
      */
     if (worker->resolving_root_fail &&
         (worker->depth > worker->engine->completed_depth)) {
-        return get_current_time() < hard_time_limit;
+        return get_current_time() < worker->engine->tc.hard_limit;
     } else {
-        return get_current_time() < soft_time_limit;
+        return get_current_time() < worker->engine->tc.soft_limit;
+    }
+}
+
+void tc_new_search(struct engine *engine)
+{
+    struct time_control *tc = &engine->tc;
+
+    tc->best_move = NOMOVE;
+    tc->best_score = 0;
+    tc->stability = 0;
+    tc->iterations = 0;
+    tc->fail_lows = 0;
+    tc->iteration_start = get_current_time();
+    tc->iteration_time = 0;
+    tc->iteration_growth = DEFAULT_ITERATION_GROWTH;
+}
+
+void tc_report_fail_low(struct search_worker *worker)
+{
+    worker->engine->tc.fail_lows++;
+}
+
+/*
+ * Calculate how much the allocated time should be scaled based on the
+ * iteration that was just completed. More time is used when the best
+ * move is unstable, when the score drops and when a large part of the
+ * root nodes are spent on other moves than the best one, since all of
+ * these indicate that the position is difficult.
+ */
+static double time_scale(struct search_worker *worker)
+{
+    struct time_control *tc = &worker->engine->tc;
+    uint64_t            nodes;
+    double              scale;
+    int                 drop;
+    int                 nscales;
+
+    nscales = sizeof(stability_scale)/sizeof(stability_scale[0]);
+    scale = stability_scale[MIN(tc->stability, nscales-1)];
+
+    if (tc->iterations > 0) {
+        drop = tc->best_score - worker->mpv_lines[0].score;
+        if (drop > 0) {
+            scale *= 1.0 + MIN(drop, MAX_SCORE_DROP)/(2.0*MAX_SCORE_DROP);
+        }
     }
+    scale *= 1.0 + 0.25*MIN(tc->fail_lows, 2);
+
+    nodes = worker->nodes - worker->root_nodes;
+    if ((worker->multipv == 1) && (nodes > 0ULL)) {
+        scale *= 1.5 - 0.75*((double)worker->best_move_nodes/nodes);
+    }
+
+    return CLAMP(scale, MIN_TIME_SCALE, MAX_TIME_SCALE);
 }
 
 bool tc_new_iteration(struct search_worker *worker)
 {
-    return worker->engine->pondering || ((tc_flags&TC_TIME_LIMIT) == 0) ||
-           worker->depth <= 1 || (get_current_time() < soft_time_limit);
+    struct engine       *engine = worker->engine;
+    struct time_control *tc = &engine->tc;
+    time_t              now;
+    time_t              elapsed;
+    time_t              soft_limit;
+    time_t              predicted;
+    double              scale;
+
+    /* Update the information about the iterations */
+    now = get_current_time();
+    if ((tc->iterations > 0) && (worker->mpv_moves[0] == tc->best_move)) {
+        tc->stability++;
+    } else {
+        tc->stability = 0;
+    }
+    scale = time_scale(worker);
+    elapsed = now - tc->iteration_start;
+    if ((tc->iteration_time > 0) && (elapsed > 0)) {
+        tc->iteration_growth = (tc->iteration_growth +
+                        CLAMP((double)elapsed/tc->iteration_time,
+                              MIN_ITERATION_GROWTH, MAX_ITERATION_GROWTH))/2;
+    }
+    tc->best_move = worker->mpv_moves[0];
+    tc->best_score = worker->mpv_lines[0].score;
+    tc->iteration_time = elapsed;
+    tc->iteration_start = now;
+    tc->fail_lows = 0;
+    tc->iterations++;
+
+    if (engine->pondering || ((tc->flags&TC_TIME_LIMIT) == 0) ||
+        (worker->depth <= 1)) {
+        return true;
+    }
+    if ((tc->flags&TC_FIXED_TIME) != 0) {
+        return now < tc->soft_limit;
+    }
+
+    /* Adjust the soft limit, but never beyond the hard limit */
+    soft_limit = tc->search_start + (time_t)(tc->optimum*scale);
+    tc->soft_limit = MIN(soft_limit, tc->hard_limit);
+
+    /*
+     * Only start a new iteration if it is predicted to get at least
+     * halfway before the soft limit is reached. Otherwise it is unlikely
+     * to finish searching the best move and the time is better saved
+     * for later moves.
+     */
+    predicted = (time_t)(tc->iteration_time*tc->iteration_growth);
+    return (now + predicted/2) < tc->soft_limit;
 }
@@ -30,73 +30,94 @@
 #define TC_NODE_LIMIT    0x00000010
 #define TC_REGULAR       0x00000020
 
+/*
+ * Initialize the time control state of an engine.
+ *
+ * @param engine The engine.
+ */
+void tc_init(struct engine *engine);
+
 /*
  * Set move overheaed.
  *
+ * @param engine The engine.
  * @param overhead The overhead to set (in ms).
  */
-void tc_set_move_overhead(int overhead);
+void tc_set_move_overhead(struct engine *engine, int overhead);
 
 /*
  * Configure the time control to use for the next search.
  *
+ * @param engine The engine.
  * @param time The number of milliseconds left on the clock for the engine.
  * @param inc The time increment.
  * @param movestogo The number of moves left to the next time control.
  * @param flags Time control flags.
  */
-void tc_configure_time_control(int time, int inc, int movestogo, int flags);
+void tc_configure_time_control(struct engine *engine, int time, int inc,
+                               int movestogo, int flags);
 
 /*
  * Get the currently configured time control flags.
  *
+ * @param engine The engine.
  * @return Returns the time control flags.
  */
-int tc_get_flags(void);
+int tc_get_flags(struct engine *engine);
 
 /*
  * Check if the infinite time control has been configured.
  *
+ * @param engine The engine.
  * @return Return true if the time control is infinite.
  */
-bool tc_is_infinite(void);
+bool tc_is_infinite(struct engine *engine);
 
 /*
  * Start the clock.
+ *
+ * @param engine The engine.
  */
-void tc_start_clock(void);
+void tc_start_clock(struct engine *engine);
 
 /*
  * Stop the clock.
+ *
+ * @param engine The engine.
  */
-void tc_stop_clock(void);
+void tc_stop_clock(struct engine *engine);
 
 /*
  * Check if the clock is running.
  *
+ * @param engine The engine.
  * @return Returns TRUE if the clock is running.
  */
-bool tc_is_clock_running(void);
+bool tc_is_clock_running(struct engine *engine);
 
 /*
  * Allocate time for the current search.
+ *
+ * @param engine The engine.
  */
-void tc_allocate_time(void);
+void tc_allocate_time(struct engine *engine);
 
 /*
  * Update the remaining time.
  *
+ * @param engine The engine.
  * @param time The remaining time.
  */
-void tc_update_time(int time);
+void tc_update_time(struct engine *engine, int time);
 
 /*
  * Get the time since the search was started.
  *
+ * @param engine The engine.
  * @return Returns the number of elapsed milli seconds since the search was
  *         started.
  */
-time_t tc_elapsed_time(void);
+time_t tc_elapsed_time(struct engine *engine);
 
 /*
  * Check if there is still time left.
@@ -107,7 +128,27 @@ time_t tc_elapsed_time(void);
 bool tc_check_time(struct search_worker *worker);
 
 /*
- * Check if there is enough time left to start a new search iteration.
+ * Reset the information about previous iterations at the start
+ * of a new search.
+ *
+ * @param engine The engine.
+ */
+void tc_new_search(struct engine *engine);
+
+/*
+ * Report that the search of the root failed low during the current
+ * iteration. Fail-lows make the engine use more time on the move.
+ *
+ * @param worker The worker.
+ */
+void tc_report_fail_low(struct search_worker *worker);
+
+/*
+ * Called after each completed iteration to check if there is enough time
+ * left to start a new iteration. The soft limit is adjusted based on the
+ * stability of the best move, score drops and the fraction of the root
+ * nodes spent on the best move. A new iteration is only started if it is
+ * predicted to get far enough before the soft limit is reached.
  *
  * @param worker The worker.
  * @return Returns true if there is enough time left.
@@ -0,0 +1,152 @@
+/*
+ * Marvin - an UCI/XBoard compatible chess engine
+ * Copyright (C) 2023 Martin Danielsson
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+
+#include "trace.h"
+#include "engine.h"
+#include "position.h"
+#include "smp.h"
+#include "utils.h"
+#include "debug.h"
+
+/* Names of the different events */
+static char *event_names[] = {
+    "search",
+    "iteration",
+    "complete_iteration",
+    "fail_low",
+    "fail_high",
+    "root_move",
+    "abort"
+};
+
+/* Chrome trace phase for each event phase */
+static char *phase_names[] = {"B", "E", "i"};
+
+void trace_start_search(struct engine *engine)
+{
+    struct search_worker *worker;
+    int                  k;
+
+    for (k=0;k<smp_number_of_workers(engine);k++) {
+        worker = smp_get_worker(engine, k);
+        if (engine_trace_file[0] == '\0') {
+            trace_destroy(worker);
+            continue;
+        }
+        if (worker->trace == NULL) {
+            worker->trace = malloc(sizeof(struct trace_buffer));
+            if (worker->trace == NULL) {
+                continue;
+            }
+        }
+        worker->trace->count = 0ULL;
+    }
+    engine->pool.trace_start = get_current_time_us();
+}
+
+void trace_finish_search(struct engine *engine)
+{
+    struct search_worker *worker;
+    struct trace_buffer  *trace;
+    struct trace_event   *event;
+    FILE                 *fp;
+    char                 movestr[MAX_MOVESTR_LENGTH];
+    uint64_t             first;
+    uint64_t             idx;
+    bool                 first_event;
+    int                  k;
+
+    if (engine_trace_file[0] == '\0') {
+        return;
+    }
+
+    fp = fopen(engine_trace_file, "w");
+    if (fp == NULL) {
+        LOG_INFO1("Failed to open trace file %s\n", engine_trace_file);
+        return;
+    }
+
+    fprintf(fp, "{\"traceEvents\": [\n");
+    first_event = true;
+    for (k=0;k<smp_number_of_workers(engine);k++) {
+        worker = smp_get_worker(engine, k);
+        trace = worker->trace;
+        if (trace == NULL) {
+            continue;
+        }
+
+        fprintf(fp, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, "
+                "\"tid\": %d, \"args\": {\"name\": \"Worker %d\"}}",
+                first_event?"":",\n", k, k);
+        first_event = false;
+
+        /* If the buffer has wrapped then start with the oldest event */
+        first = (trace->count > TRACE_BUFFER_SIZE)?
+                                        trace->count-TRACE_BUFFER_SIZE:0ULL;
+        for (idx=first;idx<trace->count;idx++) {
+            event = &trace->events[idx%TRACE_BUFFER_SIZE];
+            fprintf(fp, ",\n{\"name\": \"%s\", \"ph\": \"%s\", \"ts\": %"PRIu64
+                    ", \"pid\": 1, \"tid\": %d", event_names[event->type],
+                    phase_names[event->phase], event->time, k);
+            if (event->phase == TRACE_INSTANT) {
+                fprintf(fp, ", \"s\": \"t\"");
+            }
+            if (event->type == TRACE_ROOT_MOVE) {
+                pos_move2str((uint32_t)event->value, movestr);
+                fprintf(fp, ", \"args\": {\"depth\": %d, \"move\": \"%s\"}}",
+                        event->depth, movestr);
+            } else if ((event->type == TRACE_FAIL_LOW) ||
+                       (event->type == TRACE_FAIL_HIGH)) {
+                fprintf(fp, ", \"args\": {\"depth\": %d, \"score\": %d}}",
+                        event->depth, event->value);
+            } else {
+                fprintf(fp, ", \"args\": {\"depth\": %d}}", event->depth);
+            }
+        }
+    }
+    fprintf(fp, "\n]}\n");
+    fclose(fp);
+}
+
+void trace_destroy(struct search_worker *worker)
+{
+    free(worker->trace);
+    worker->trace = NULL;
+}
+
+void trace_event(struct search_worker *worker, enum trace_type type,
+                 enum trace_phase phase, int depth, int value)
+{
+    struct trace_buffer *trace = worker->trace;
+    struct trace_event  *event;
+
+    if (trace == NULL) {
+        return;
+    }
+
+    event = &trace->events[trace->count%TRACE_BUFFER_SIZE];
+    event->time = get_current_time_us() - worker->engine->pool.trace_start;
+    event->value = value;
+    event->depth = (int16_t)depth;
+    event->type = (uint8_t)type;
+    event->phase = (uint8_t)phase;
+    trace->count++;
+}
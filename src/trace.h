@@ -0,0 +1,82 @@
+/*
+ * Marvin - an UCI/XBoard compatible chess engine
+ * Copyright (C) 2023 Martin Danielsson
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+#include "types.h"
+
+/* Events that can be recorded */
+enum trace_type {
+    TRACE_SEARCH,
+    TRACE_ITERATION,
+    TRACE_COMPLETE_ITERATION,
+    TRACE_FAIL_LOW,
+    TRACE_FAIL_HIGH,
+    TRACE_ROOT_MOVE,
+    TRACE_ABORT
+};
+
+/* Phases of an event */
+enum trace_phase {
+    TRACE_BEGIN,
+    TRACE_END,
+    TRACE_INSTANT
+};
+
+/*
+ * Prepare for tracing a new search. If tracing is enabled (a trace file
+ * is set) then a trace buffer is made available for each worker,
+ * otherwise any existing buffers are released.
+ *
+ * @param engine The engine.
+ */
+void trace_start_search(struct engine *engine);
+
+/*
+ * Write the events recorded during a search to the trace file. The file
+ * is written in the Chrome trace event format, which can be viewed in
+ * for instance chrome://tracing or Perfetto.
+ *
+ * @param engine The engine.
+ */
+void trace_finish_search(struct engine *engine);
+
+/*
+ * Release the trace buffer of a worker.
+ *
+ * @param worker The worker.
+ */
+void trace_destroy(struct search_worker *worker);
+
+/*
+ * Record an event for a worker. Does nothing if tracing is not enabled.
+ * Only the most recent events are kept if the buffer becomes full.
+ *
+ * @param worker The worker.
+ * @param type The type of event.
+ * @param phase The phase of the event.
+ * @param depth The current search depth.
+ * @param value Additional event data. A score for fail low/high events
+ *              and a move for root move events.
+ */
+void trace_event(struct search_worker *worker, enum trace_type type,
+                 enum trace_phase phase, int depth, int value);
+
+#endif
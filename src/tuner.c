@@ -0,0 +1,763 @@
+/*
+ * Marvin - an UCI/XBoard compatible chess engine
+ * Copyright (C) 2023 Martin Danielsson
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <math.h>
+
+#include "tuner.h"
+#include "config.h"
+#include "engine.h"
+#include "eval.h"
+#include "evalparams.h"
+#include "material.h"
+#include "position.h"
+#include "sfenio.h"
+#include "smp.h"
+#include "utils.h"
+
+#ifdef TUNER
+
+/* Default options */
+#define DEFAULT_ITERATIONS 1000
+#define DEFAULT_LEARNING_RATE 1.0
+
+/* Parameters for the Adam optimizer */
+#define ADAM_BETA1 0.9
+#define ADAM_BETA2 0.999
+#define ADAM_EPSILON 1e-8
+
+/* The range searched for the scaling constant of the sigmoid */
+#define MIN_K 0.1
+#define MAX_K 5.0
+#define K_PRECISION 0.0001
+
+/* The number of iterations between each progress report */
+#define REPORT_INTERVAL 50
+
+/*
+ * A tunable evaluation parameter. The divisor is used for parameters
+ * whose contribution is divided by a constant in the evaluation.
+ */
+struct param {
+    char *name;
+    int  *values;
+    int  size;
+    int  phase;
+    int  divisor;
+};
+
+#define SCALAR(name, phase) {#name, &name, 1, phase, 1}
+#define ARRAY(name, phase) \
+                    {#name, name, (int)(sizeof(name)/sizeof(int)), phase, 1}
+
+/* All tunable parameters, in the order they are defined in evalparams.c */
+static struct param params[] = {
+    SCALAR(DOUBLE_PAWNS_MG, MIDDLEGAME),
+    SCALAR(DOUBLE_PAWNS_EG, ENDGAME),
+    SCALAR(ISOLATED_PAWN_MG, MIDDLEGAME),
+    SCALAR(ISOLATED_PAWN_EG, ENDGAME),
+    SCALAR(ROOK_OPEN_FILE_MG, MIDDLEGAME),
+    SCALAR(ROOK_OPEN_FILE_EG, ENDGAME),
+    SCALAR(ROOK_HALF_OPEN_FILE_MG, MIDDLEGAME),
+    SCALAR(ROOK_HALF_OPEN_FILE_EG, ENDGAME),
+    SCALAR(QUEEN_OPEN_FILE_MG, MIDDLEGAME),
+    SCALAR(QUEEN_OPEN_FILE_EG, ENDGAME),
+    SCALAR(QUEEN_HALF_OPEN_FILE_MG, MIDDLEGAME),
+    SCALAR(QUEEN_HALF_OPEN_FILE_EG, ENDGAME),
+    SCALAR(ROOK_ON_7TH_MG, MIDDLEGAME),
+    SCALAR(ROOK_ON_7TH_EG, ENDGAME),
+    SCALAR(BISHOP_PAIR_MG, MIDDLEGAME),
+    SCALAR(BISHOP_PAIR_EG, ENDGAME),
+    ARRAY(PAWN_SHIELD, MIDDLEGAME),
+    ARRAY(PASSED_PAWN_MG, MIDDLEGAME),
+    ARRAY(PASSED_PAWN_EG, ENDGAME),
+    SCALAR(KNIGHT_MOBILITY_MG, MIDDLEGAME),
+    SCALAR(BISHOP_MOBILITY_MG, MIDDLEGAME),
+    SCALAR(ROOK_MOBILITY_MG, MIDDLEGAME),
+    SCALAR(QUEEN_MOBILITY_MG, MIDDLEGAME),
+    SCALAR(KNIGHT_MOBILITY_EG, ENDGAME),
+    SCALAR(BISHOP_MOBILITY_EG, ENDGAME),
+    SCALAR(ROOK_MOBILITY_EG, ENDGAME),
+    SCALAR(QUEEN_MOBILITY_EG, ENDGAME),
+    ARRAY(PSQ_TABLE_PAWN_MG, MIDDLEGAME),
+    ARRAY(PSQ_TABLE_KNIGHT_MG, MIDDLEGAME),
+    ARRAY(PSQ_TABLE_BISHOP_MG, MIDDLEGAME),
+    ARRAY(PSQ_TABLE_ROOK_MG, MIDDLEGAME),
+    ARRAY(PSQ_TABLE_QUEEN_MG, MIDDLEGAME),
+    ARRAY(PSQ_TABLE_KING_MG, MIDDLEGAME),
+    ARRAY(PSQ_TABLE_PAWN_EG, ENDGAME),
+    ARRAY(PSQ_TABLE_KNIGHT_EG, ENDGAME),
+    ARRAY(PSQ_TABLE_BISHOP_EG, ENDGAME),
+    ARRAY(PSQ_TABLE_ROOK_EG, ENDGAME),
+    ARRAY(PSQ_TABLE_QUEEN_EG, ENDGAME),
+    ARRAY(PSQ_TABLE_KING_EG, ENDGAME),
+    SCALAR(KNIGHT_MATERIAL_VALUE_MG, MIDDLEGAME),
+    SCALAR(BISHOP_MATERIAL_VALUE_MG, MIDDLEGAME),
+    SCALAR(ROOK_MATERIAL_VALUE_MG, MIDDLEGAME),
+    SCALAR(QUEEN_MATERIAL_VALUE_MG, MIDDLEGAME),
+    SCALAR(KNIGHT_MATERIAL_VALUE_EG, ENDGAME),
+    SCALAR(BISHOP_MATERIAL_VALUE_EG, ENDGAME),
+    SCALAR(ROOK_MATERIAL_VALUE_EG, ENDGAME),
+    SCALAR(QUEEN_MATERIAL_VALUE_EG, ENDGAME),
+    {"KING_ATTACK_SCALE_MG", &KING_ATTACK_SCALE_MG, 1, MIDDLEGAME, 100},
+    {"KING_ATTACK_SCALE_EG", &KING_ATTACK_SCALE_EG, 1, ENDGAME, 100},
+    SCALAR(KNIGHT_OUTPOST, MIDDLEGAME),
+    SCALAR(PROTECTED_KNIGHT_OUTPOST, MIDDLEGAME),
+    ARRAY(CANDIDATE_PASSED_PAWN_MG, MIDDLEGAME),
+    ARRAY(CANDIDATE_PASSED_PAWN_EG, ENDGAME),
+    SCALAR(FRIENDLY_KING_PASSER_DIST, ENDGAME),
+    SCALAR(OPPONENT_KING_PASSER_DIST, ENDGAME),
+    SCALAR(BACKWARD_PAWN_MG, MIDDLEGAME),
+    SCALAR(BACKWARD_PAWN_EG, ENDGAME),
+    SCALAR(FREE_PASSED_PAWN_MG, MIDDLEGAME),
+    SCALAR(FREE_PASSED_PAWN_EG, ENDGAME),
+    SCALAR(SPACE_SQUARE, MIDDLEGAME),
+    ARRAY(CONNECTED_PAWNS_MG, MIDDLEGAME),
+    ARRAY(CONNECTED_PAWNS_EG, ENDGAME),
+    SCALAR(THREAT_MINOR_BY_PAWN_MG, MIDDLEGAME),
+    SCALAR(THREAT_MINOR_BY_PAWN_EG, ENDGAME),
+    SCALAR(THREAT_PAWN_PUSH_MG, MIDDLEGAME),
+    SCALAR(THREAT_PAWN_PUSH_EG, ENDGAME),
+    ARRAY(THREAT_BY_KNIGHT_MG, MIDDLEGAME),
+    ARRAY(THREAT_BY_KNIGHT_EG, ENDGAME),
+    ARRAY(THREAT_BY_BISHOP_MG, MIDDLEGAME),
+    ARRAY(THREAT_BY_BISHOP_EG, ENDGAME),
+    ARRAY(THREAT_BY_ROOK_MG, MIDDLEGAME),
+    ARRAY(THREAT_BY_ROOK_EG, ENDGAME),
+    ARRAY(THREAT_BY_QUEEN_MG, MIDDLEGAME),
+    ARRAY(THREAT_BY_QUEEN_EG, ENDGAME)
+};
+#define NPARAMS ((int)(sizeof(params)/sizeof(params[0])))
+
+/*
+ * Information about each individual value, with array elements counted
+ * separately. Values are identified by their index in this flat list.
+ */
+static int param_first[NPARAMS];
+static int value_phase[TUNER_MAX_PARAMS];
+static double value_weight[TUNER_MAX_PARAMS];
+static int nvalues = 0;
+
+/* A non-zero coefficient of a position from white's point of view */
+struct coeff {
+    uint16_t index;
+    int16_t  value;
+};
+
+/*
+ * A position prepared for tuning. The part of the score that doesn't
+ * depend on any parameter is kept in base.
+ */
+struct entry {
+    uint64_t first;
+    int      ncoeffs;
+    float    base[NPHASES];
+    float    phase;
+    float    scale[NSIDES];
+    float    tempo;
+    float    result;
+};
+
+/*
+ * The positions handled by one worker together with the result of the
+ * last pass over them.
+ */
+struct slice {
+    struct entry *entries;
+    uint64_t     nentries;
+    uint64_t     max_entries;
+    struct coeff *coeffs;
+    uint64_t     ncoeffs;
+    uint64_t     max_coeffs;
+    uint64_t     nskipped;
+    bool         failed;
+    double       error;
+    double       gradient[TUNER_MAX_PARAMS];
+};
+
+struct tuner_job {
+    char         *input;
+    uint64_t     npositions;
+    int          nworkers;
+    struct slice *slices;
+    double       values[TUNER_MAX_PARAMS];
+    double       k;
+    bool         gradient;
+};
+
+static void setup_values(void)
+{
+    int k;
+    int l;
+
+    nvalues = 0;
+    for (k=0;k<NPARAMS;k++) {
+        param_first[k] = nvalues;
+        for (l=0;l<params[k].size;l++) {
+            assert(nvalues < TUNER_MAX_PARAMS);
+            value_phase[nvalues] = params[k].phase;
+            value_weight[nvalues] = 1.0/params[k].divisor;
+            nvalues++;
+        }
+    }
+}
+
+static double sigmoid(double k, double score)
+{
+    return 1.0/(1.0 + pow(10.0, -k*score/400.0));
+}
+
+static bool add_entry(struct slice *slice, struct eval_trace *trace,
+                      double result)
+{
+    struct entry *entry;
+    struct coeff *coeff;
+    double       linear[NPHASES];
+    void         *ptr;
+    int          value;
+    int          k;
+    int          l;
+
+    if (slice->nentries == slice->max_entries) {
+        slice->max_entries = MAX(2*slice->max_entries, 1024);
+        ptr = realloc(slice->entries,
+                      slice->max_entries*sizeof(struct entry));
+        if (ptr == NULL) {
+            return false;
+        }
+        slice->entries = ptr;
+    }
+    if ((slice->max_coeffs-slice->ncoeffs) < (uint64_t)nvalues) {
+        slice->max_coeffs = MAX(2*slice->max_coeffs, 65536);
+        ptr = realloc(slice->coeffs, slice->max_coeffs*sizeof(struct coeff));
+        if (ptr == NULL) {
+            return false;
+        }
+        slice->coeffs = ptr;
+    }
+
+    /*
+     * Only keep the coefficients that are non-zero. The contribution
+     * of the current parameter values is subtracted from the score to
+     * get the part of the score that can't be tuned.
+     */
+    entry = &slice->entries[slice->nentries];
+    entry->first = slice->ncoeffs;
+    entry->ncoeffs = 0;
+    linear[MIDDLEGAME] = 0.0;
+    linear[ENDGAME] = 0.0;
+    for (k=0;k<NPARAMS;k++) {
+        for (l=0;l<params[k].size;l++) {
+            value = trace->coeffs[param_first[k]+l][WHITE] -
+                    trace->coeffs[param_first[k]+l][BLACK];
+            if (value == 0) {
+                continue;
+            }
+            coeff = &slice->coeffs[slice->ncoeffs++];
+            coeff->index = param_first[k] + l;
+            coeff->value = value;
+            entry->ncoeffs++;
+            linear[params[k].phase] += ((double)value*params[k].values[l])/
+                                                        params[k].divisor;
+        }
+    }
+    entry->base[MIDDLEGAME] = trace->score[MIDDLEGAME] - linear[MIDDLEGAME];
+    entry->base[ENDGAME] = trace->score[ENDGAME] - linear[ENDGAME];
+    entry->phase = trace->phase/256.0;
+    entry->scale[WHITE] = trace->scale[WHITE]/(double)MATERIAL_SCALE_NORMAL;
+    entry->scale[BLACK] = trace->scale[BLACK]/(double)MATERIAL_SCALE_NORMAL;
+    entry->tempo = trace->tempo;
+    entry->result = result;
+    slice->nentries++;
+
+    return true;
+}
+
+/*
+ * Trace the evaluation of the positions in one part of the input file.
+ * Each worker uses its own reader since readers can't be shared.
+ */
+static void load_job_func(int idx, void *data)
+{
+    struct tuner_job   *job = data;
+    struct slice       *slice = &job->slices[idx];
+    struct sfen_reader reader;
+    struct packed_sfen *sfen;
+    struct position    *pos;
+    struct eval_trace  *trace;
+    uint64_t           first;
+    uint64_t           last;
+    uint64_t           k;
+    int                result;
+
+    pos = calloc(1, sizeof(struct position));
+    trace = malloc(sizeof(struct eval_trace));
+    if ((pos == NULL) || (trace == NULL) ||
+        !sfenio_open_reader(&reader, job->input)) {
+        free(pos);
+        free(trace);
+        slice->failed = true;
+        return;
+    }
+
+    first = (job->npositions*idx)/job->nworkers;
+    last = (job->npositions*(idx+1))/job->nworkers;
+    for (k=first;k<last;k++) {
+        sfen = sfenio_position(&reader, k);
+        if (sfen == NULL) {
+            slice->failed = true;
+            break;
+        }
+        sfenio_decode_position(sfen->position, pos);
+
+        /* Positions in check are not quiet so they are skipped */
+        if (pos_in_check(pos, pos->stm) || !eval_trace_position(pos, trace)) {
+            slice->nskipped++;
+            continue;
+        }
+
+        result = (pos->stm == WHITE)?sfen->stm_result:-sfen->stm_result;
+        if (!add_entry(slice, trace, (result+1)/2.0)) {
+            slice->failed = true;
+            break;
+        }
+    }
+
+    sfenio_close_reader(&reader);
+    free(trace);
+    free(pos);
+}
+
+/*
+ * Calculate the score of a position for the current parameters. The
+ * scale factor used for the endgame score is stored in egscale.
+ */
+static double evaluate_entry(struct tuner_job *job, struct entry *entry,
+                             struct coeff *coeffs, double *egscale)
+{
+    double score[NPHASES];
+    double scale;
+    int    k;
+
+    score[MIDDLEGAME] = entry->base[MIDDLEGAME];
+    score[ENDGAME] = entry->base[ENDGAME];
+    for (k=0;k<entry->ncoeffs;k++) {
+        score[value_phase[coeffs[k].index]] +=
+                coeffs[k].value*job->values[coeffs[k].index]*
+                                                value_weight[coeffs[k].index];
+    }
+    scale = (score[ENDGAME] > 0.0)?entry->scale[WHITE]:entry->scale[BLACK];
+    *egscale = scale;
+
+    return score[MIDDLEGAME]*(1.0-entry->phase) +
+                        score[ENDGAME]*scale*entry->phase + entry->tempo;
+}
+
+/*
+ * Calculate the error for the positions of one worker and, if requested,
+ * the part of the gradient that is common for all positions. Constant
+ * factors are applied when the results of all workers are combined.
+ */
+static void error_job_func(int idx, void *data)
+{
+    struct tuner_job *job = data;
+    struct slice     *slice = &job->slices[idx];
+    struct entry     *entry;
+    struct coeff     *coeffs;
+    double           sig;
+    double           scale;
+    double           delta;
+    double           factor[NPHASES];
+    uint64_t         k;
+    int              l;
+
+    slice->error = 0.0;
+    if (job->gradient) {
+        memset(slice->gradient, 0, sizeof(slice->gradient));
+    }
+
+    for (k=0;k<slice->nentries;k++) {
+        entry = &slice->entries[k];
+        coeffs = &slice->coeffs[entry->first];
+        sig = sigmoid(job->k, evaluate_entry(job, entry, coeffs, &scale));
+        delta = entry->result - sig;
+        slice->error += delta*delta;
+        if (!job->gradient) {
+            continue;
+        }
+
+        /*
+         * The derivative of the loss with respect to a parameter is the
+         * derivative of the sigmoid times the derivative of the tapered
+         * score, which only depends on the phase the parameter is used in.
+         */
+        delta *= sig*(1.0-sig);
+        factor[MIDDLEGAME] = 1.0 - entry->phase;
+        factor[ENDGAME] = entry->phase*scale;
+        for (l=0;l<entry->ncoeffs;l++) {
+            slice->gradient[coeffs[l].index] +=
+                    delta*coeffs[l].value*value_weight[coeffs[l].index]*
+                                    factor[value_phase[coeffs[l].index]];
+        }
+    }
+}
+
+static double calculate_error(struct engine *engine, struct tuner_job *job,
+                              double *gradient, uint64_t nentries)
+{
+    double error = 0.0;
+    int    k;
+    int    l;
+
+    job->gradient = (gradient != NULL);
+    smp_run_job(engine, error_job_func, job);
+
+    if (gradient != NULL) {
+        memset(gradient, 0, nvalues*sizeof(double));
+    }
+    for (k=0;k<job->nworkers;k++) {
+        error += job->slices[k].error;
+        if (gradient == NULL) {
+            continue;
+        }
+        for (l=0;l<nvalues;l++) {
+            gradient[l] += job->slices[k].gradient[l];
+        }
+    }
+
+    /* Apply the constant factors of the derivative */
+    if (gradient != NULL) {
+        for (l=0;l<nvalues;l++) {
+            gradient[l] *= (-2.0*job->k*log(10.0)/400.0)/nentries;
+        }
+    }
+
+    return error/nentries;
+}
+
+/*
+ * Find the scaling constant for the sigmoid that gives the lowest error
+ * for the current parameters using a golden section search.
+ */
+static double find_k(struct engine *engine, struct tuner_job *job,
+                     uint64_t nentries)
+{
+    double ratio = (sqrt(5.0)-1.0)/2.0;
+    double a = MIN_K;
+    double b = MAX_K;
+    double c;
+    double d;
+    double fc;
+    double fd;
+
+    c = b - ratio*(b-a);
+    d = a + ratio*(b-a);
+    job->k = c;
+    fc = calculate_error(engine, job, NULL, nentries);
+    job->k = d;
+    fd = calculate_error(engine, job, NULL, nentries);
+    while ((b-a) > K_PRECISION) {
+        if (fc < fd) {
+            b = d;
+            d = c;
+            fd = fc;
+            c = b - ratio*(b-a);
+            job->k = c;
+            fc = calculate_error(engine, job, NULL, nentries);
+        } else {
+            a = c;
+            c = d;
+            fc = fd;
+            d = a + ratio*(b-a);
+            job->k = d;
+            fd = calculate_error(engine, job, NULL, nentries);
+        }
+    }
+
+    return (a+b)/2.0;
+}
+
+static void print_params(FILE *fp, double *values)
+{
+    int k;
+    int l;
+    int value;
+
+    for (k=0;k<NPARAMS;k++) {
+        if (params[k].size == 1) {
+            fprintf(fp, "int %s = %d;\n", params[k].name,
+                    (int)round(values[param_first[k]]));
+            continue;
+        }
+
+        if (params[k].size == NSQUARES) {
+            fprintf(fp, "int %s[NSQUARES] = {\n", params[k].name);
+        } else {
+            fprintf(fp, "int %s[%d] = {\n", params[k].name,
+                    params[k].size);
+        }
+        for (l=0;l<params[k].size;l++) {
+            value = (int)round(values[param_first[k]+l]);
+            fprintf(fp, "%s%d", ((l%8) == 0)?"    ":"", value);
+            if (l == (params[k].size-1)) {
+                fprintf(fp, "\n");
+            } else {
+                fprintf(fp, "%s", ((l%8) == 7)?",\n":", ");
+            }
+        }
+        fprintf(fp, "};\n");
+    }
+}
+
+static int tune(char *input, char *output, int nthreads, int niterations,
+                double rate)
+{
+    struct sfen_reader reader;
+    struct engine      *engine;
+    struct tuner_job   *job;
+    double             *gradient;
+    double             *m;
+    double             *v;
+    double             error;
+    double             mhat;
+    double             vhat;
+    uint64_t           nentries;
+    uint64_t           nskipped;
+    time_t             start;
+    FILE               *fp;
+    bool               failed;
+    int                iter;
+    int                k;
+    int                l;
+    int                ret = 0;
+
+    setup_values();
+
+    /* Find the number of positions in the file */
+    if (!sfenio_open_reader(&reader, input)) {
+        printf("Error: failed to open input file, %s\n", input);
+        return 1;
+    }
+    if (reader.npositions == 0ULL) {
+        printf("Error: no positions in input file, %s\n", input);
+        sfenio_close_reader(&reader);
+        return 1;
+    }
+
+    job = malloc(sizeof(struct tuner_job));
+    gradient = calloc(3*nvalues, sizeof(double));
+    if ((job == NULL) || (gradient == NULL)) {
+        printf("Error: failed to allocate memory\n");
+        free(job);
+        free(gradient);
+        sfenio_close_reader(&reader);
+        return 1;
+    }
+    memset(job, 0, sizeof(struct tuner_job));
+    job->input = input;
+    job->npositions = reader.npositions;
+    job->nworkers = nthreads;
+    job->slices = calloc(nthreads, sizeof(struct slice));
+    sfenio_close_reader(&reader);
+    m = gradient + nvalues;
+    v = m + nvalues;
+    for (k=0;k<NPARAMS;k++) {
+        for (l=0;l<params[k].size;l++) {
+            job->values[param_first[k]+l] = params[k].values[l];
+        }
+    }
+    engine = engine_create(MIN_MAIN_HASH_SIZE, nthreads);
+    assert(engine != NULL);
+
+    /*
+     * Trace the evaluation of all positions once. After this the
+     * positions are never evaluated again, the error for a set of
+     * parameters is calculated directly from the coefficients.
+     */
+    start = get_current_time();
+    smp_run_job(engine, load_job_func, job);
+    nentries = 0ULL;
+    nskipped = 0ULL;
+    failed = false;
+    for (k=0;k<nthreads;k++) {
+        nentries += job->slices[k].nentries;
+        nskipped += job->slices[k].nskipped;
+        failed = failed || job->slices[k].failed;
+    }
+    if (failed || (nentries == 0ULL)) {
+        printf("Error: failed to load positions, %s\n", input);
+        ret = 1;
+        goto cleanup;
+    }
+    printf("Loaded %"PRIu64" positions (%"PRIu64" skipped) in %ds\n",
+           nentries, nskipped, (int)((get_current_time()-start)/1000));
+
+    /* Find the best scaling constant for the initial parameters */
+    job->k = find_k(engine, job, nentries);
+    error = calculate_error(engine, job, NULL, nentries);
+    printf("K: %.4f, initial error: %.8f\n", job->k, error);
+
+    /* Minimize the error using the Adam optimizer */
+    for (iter=1;iter<=niterations;iter++) {
+        error = calculate_error(engine, job, gradient, nentries);
+        for (k=0;k<nvalues;k++) {
+            m[k] = ADAM_BETA1*m[k] + (1.0-ADAM_BETA1)*gradient[k];
+            v[k] = ADAM_BETA2*v[k] + (1.0-ADAM_BETA2)*gradient[k]*gradient[k];
+            mhat = m[k]/(1.0-pow(ADAM_BETA1, iter));
+            vhat = v[k]/(1.0-pow(ADAM_BETA2, iter));
+            job->values[k] -= rate*mhat/(sqrt(vhat)+ADAM_EPSILON);
+        }
+        if (((iter%REPORT_INTERVAL) == 0) || (iter == niterations)) {
+            printf("Iteration %d, error: %.8f\n", iter, error);
+        }
+    }
+    error = calculate_error(engine, job, NULL, nentries);
+    printf("Final error: %.8f\n", error);
+
+    /* Write the parameters in the same format as evalparams.c */
+    if (output == NULL) {
+        print_params(stdout, job->values);
+    } else {
+        fp = fopen(output, "w");
+        if (fp == NULL) {
+            printf("Error: failed to open output file, %s\n", output);
+            ret = 1;
+            goto cleanup;
+        }
+        print_params(fp, job->values);
+        fclose(fp);
+    }
+
+cleanup:
+    engine_destroy(engine);
+    for (k=0;k<nthreads;k++) {
+        free(job->slices[k].entries);
+        free(job->slices[k].coeffs);
+    }
+    free(job->slices);
+    free(job);
+    free(gradient);
+
+    return ret;
+}
+
+static void tune_usage(void)
+{
+    printf("marvin --tune <options>\n");
+    printf("Options:\n");
+    printf("\t--input (-i) <file>\n");
+    printf("\t--output (-o) <file>\n");
+    printf("\t--threads (-t) <int>\n");
+    printf("\t--iterations (-n) <int>\n");
+    printf("\t--rate (-r) <float>\n");
+    printf("\t--help (-h) <int>\n");
+}
+
+void tuner_trace_param(struct eval_trace *trace, int *param, int side,
+                       int count)
+{
+    int k;
+
+    if (trace == NULL) {
+        return;
+    }
+
+    for (k=0;k<NPARAMS;k++) {
+        if ((param >= params[k].values) &&
+            (param < (params[k].values+params[k].size))) {
+            trace->coeffs[param_first[k]+(param-params[k].values)][side] +=
+                                                                        count;
+            return;
+        }
+    }
+    assert(false);
+}
+
+int tuner_run(int argc, char *argv[])
+{
+    int    iter;
+    char   *input_file = NULL;
+    char   *output_file = NULL;
+    int    nthreads = 1;
+    int    niterations = DEFAULT_ITERATIONS;
+    double rate = DEFAULT_LEARNING_RATE;
+
+    /* Parse command line options */
+    iter = 2;
+    while (iter < argc) {
+        if ((MATCH(argv[iter], "-i") || MATCH(argv[iter], "--input")) &&
+            ((iter+1) < argc)) {
+            iter++;
+            input_file = argv[iter];
+        } else if ((MATCH(argv[iter], "-o") ||
+                    MATCH(argv[iter], "--output")) &&
+                   ((iter+1) < argc)) {
+            iter++;
+            output_file = argv[iter];
+        } else if ((MATCH(argv[iter], "-t") ||
+                    MATCH(argv[iter], "--threads")) &&
+                   ((iter+1) < argc)) {
+            iter++;
+            nthreads = atoi(argv[iter]);
+        } else if ((MATCH(argv[iter], "-n") ||
+                    MATCH(argv[iter], "--iterations")) &&
+                   ((iter+1) < argc)) {
+            iter++;
+            niterations = atoi(argv[iter]);
+        } else if ((MATCH(argv[iter], "-r") || MATCH(argv[iter], "--rate")) &&
+                   ((iter+1) < argc)) {
+            iter++;
+            rate = atof(argv[iter]);
+        } else if (MATCH(argv[iter], "-h") || MATCH(argv[iter], "--help")) {
+            tune_usage();
+            return 0;
+        } else {
+            printf("Error: unknown argument, %s\n", argv[iter]);
+            tune_usage();
+            return 1;
+        }
+
+        iter++;
+    }
+
+    /* Validate options */
+    if (!input_file || (nthreads <= 0) || (nthreads > MAX_WORKERS) ||
+        (niterations < 0) || (rate <= 0.0)) {
+        printf("Error: invalid options\n");
+        tune_usage();
+        return 1;
+    }
+
+    return tune(input_file, output_file, nthreads, niterations, rate);
+}
+
+#else
+
+int tuner_run(int argc, char *argv[])
+{
+    (void)argc;
+    (void)argv;
+
+    printf("Tuning is only supported in builds with variant=tuner\n");
+    return 1;
+}
+
+#endif
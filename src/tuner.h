@@ -0,0 +1,75 @@
+/*
+ * Marvin - an UCI/XBoard compatible chess engine
+ * Copyright (C) 2023 Martin Danielsson
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef TUNER_H
+#define TUNER_H
+
+#include <stdint.h>
+
+#include "types.h"
+
+#ifdef TUNER
+
+/* The maximum number of tunable values, counting each array element */
+#define TUNER_MAX_PARAMS 1024
+
+/*
+ * How the classical evaluation of a position depends on the evaluation
+ * parameters. The evaluation is linear in the parameters so the score
+ * before tapering is the sum of each parameter multiplied by its
+ * coefficient, plus terms that can't be tuned.
+ */
+struct eval_trace {
+    /* The coefficient of each parameter for each side */
+    int16_t coeffs[TUNER_MAX_PARAMS][NSIDES];
+    /* The score for each game phase from white's point of view */
+    int score[NPHASES];
+    /* The weight of the endgame score (0-256) */
+    int phase;
+    /* The endgame scale factor to use depending on the stronger side */
+    int scale[NSIDES];
+    /* The tempo bonus from white's point of view */
+    int tempo;
+};
+
+/*
+ * Record the contribution of a parameter to the evaluation of a position.
+ *
+ * @param trace The trace to update. If NULL nothing is recorded.
+ * @param param Pointer to the parameter.
+ * @param side The side that the parameter applies to.
+ * @param count The number of times the parameter is applied.
+ */
+void tuner_trace_param(struct eval_trace *trace, int *param, int side,
+                       int count);
+
+#endif
+
+/*
+ * Tune the parameters of the classical evaluation using positions in
+ * sfen bin format, such as the ones created with --generate. Only
+ * available in builds with TUNER defined.
+ *
+ * Syntax: --tune <options>
+ *
+ * @param argc The number of command line arguments.
+ * @param argv The command line arguments.
+ * @return Return 0 on success or a positive value in case of error.
+ */
+int tuner_run(int argc, char *argv[]);
+
+#endif
@@ -23,6 +23,7 @@
 #include <time.h>
 #include <setjmp.h>
 #include <stdalign.h>
+#include <stdatomic.h>
 
 #include "thread.h"
 #include "config.h"
@@ -234,6 +235,12 @@ enum {
 /* The maximum number of possible plies in the search tree */
 #define MAX_PLY MAX_SEARCH_DEPTH+MAX_QUIESCENCE_DEPTH
 
+/*
+ * The number of moves in the triangular PV table. A variation starting
+ * at a certain ply can be at most MAX_PLY-ply moves long.
+ */
+#define PV_TABLE_SIZE ((MAX_PLY)*((MAX_PLY)+1)/2)
+
 /*
  * The material value for pawns. This value is not tuned in order to
  * make sure there is fix base value for all scores.
@@ -256,6 +263,14 @@ struct moveinfo {
     int score;
 };
 
+/* A variation, bounded by the maximum number of plies */
+struct pvline {
+    /* The moves of the variation */
+    uint32_t moves[MAX_PLY];
+    /* The number of moves in the variation */
+    int size;
+};
+
 /* Principle variation with additional information */
 struct pvinfo {
     /* The depth of the pv */
@@ -263,7 +278,7 @@ struct pvinfo {
     /* The selective depth of the pv */
     int seldepth;
     /* The principle variation */
-    struct movelist pv;
+    struct pvline pv;
     /* The score */
     int score;
 };
@@ -279,10 +294,15 @@ struct moveselector {
     uint32_t killer;
     /* Counter move for this position */
     uint32_t counter;
-    /* Additional information for the availables moves */
-    struct moveinfo moveinfo[MAX_MOVES];
+    /*
+     * Additional information for the availables moves. Points to the
+     * move storage for the current ply in the worker.
+     */
+    struct moveinfo *moveinfo;
     /* Index of the last move plus one */
     int last_idx;
+    /* Index of the last sorted move plus one */
+    int sorted_idx;
     /* The number of bad tactical moves */
     int nbadtacticals;
     /* Index of the move currently being searched */
@@ -322,6 +342,22 @@ struct unmake {
     int fifty;
     /* The unique position key before the move was made */
     uint64_t key;
+    /* The pawn key before the move was made */
+    uint64_t pawnkey;
+    /* The material key before the move was made */
+    uint64_t matkey;
+    /* Check information before the move was made */
+    uint64_t checkers;
+    uint64_t pinned;
+    /*
+     * The bitboards and the material score before the move was made.
+     * Restoring them with a copy is cheaper than undoing the move
+     * piece by piece.
+     */
+    uint64_t bb_pieces[NPIECES];
+    uint64_t bb_sides[NSIDES];
+    uint64_t bb_all;
+    int material;
 };
 
 /* An opening book entry */
@@ -335,8 +371,6 @@ struct book_entry {
  * which represents a single position.
  */
 struct tt_item {
-    /* The key of this position */
-    uint64_t key;
     /* The best move found */
     uint32_t move;
     /*
@@ -344,6 +378,16 @@ struct tt_item {
      * the score is determined by the flags parameter.
      */
     int16_t score;
+    /* The static evaluation of the position */
+    int16_t eval;
+    /*
+     * The upper 16 bits of the position key xor:ed with a checksum
+     * of the rest of the item. Since the lower bits of the key are
+     * used to select the bucket this is enough to verify that the item
+     * belongs to the position. The checksum makes sure that items that
+     * are torn by concurrent writes are detected.
+     */
+    uint16_t key;
     /* The depth to which the position was searched */
     uint8_t depth;
     /*
@@ -354,7 +398,7 @@ struct tt_item {
 };
 
 /* The number of items stored in each transposition table bucket */
-#define TT_BUCKET_SIZE 3
+#define TT_BUCKET_SIZE 5
 
 /*
  * Transposition table bucket. The size should be a
@@ -363,31 +407,138 @@ struct tt_item {
 struct tt_bucket {
     /* Items stored in this bucket */
     struct tt_item items[TT_BUCKET_SIZE];
-    uint8_t pad[16];
+    /*
+     * The epoch of the table when the bucket was last written. Items
+     * in buckets from an earlier epoch are considered to be empty.
+     */
+    uint32_t epoch;
 };
 
 /*
- * An item in the NNUE cache. The size should be a power-of-2
- * for best performance.
+ * An item in the NNUE cache. The key is stored xor:ed with the score
+ * which allows torn items to be detected when the cache is shared
+ * between threads.
  */
 struct nnue_cache_item {
     uint64_t key;
-    int score;
+    uint64_t score;
+};
+
+/*
+ * An item in the tablebase WDL cache. The result is the WDL result
+ * reported by the tablebases plus one so that an item with a result of
+ * zero is unused.
+ */
+struct egtb_cache_item {
+    uint64_t key;
+    uint8_t result;
+};
+
+/*
+ * An item in the pawn hash table. The item contains all evaluation terms
+ * and masks that only depend on the pawn structure.
+ */
+struct pawntt_item {
+    uint64_t pawnkey;
+    uint64_t passers;
+    uint64_t candidates;
+    uint64_t attacks[NSIDES];
+    uint64_t attacks2[NSIDES];
+    uint64_t rear_span[NSIDES];
+    int score[NPHASES][NSIDES];
+    int shield[NSIDES][2];
+};
+
+/* Specialized endgame evaluators */
+enum {
+    ENDGAME_NONE,
+    ENDGAME_KPK,
+    ENDGAME_KBNK,
+    ENDGAME_KRKP
+};
+
+/* Different cases for if there is enough material left to deliver mate */
+enum {
+    MATING_POSSIBLE,
+    MATING_IMPOSSIBLE,
+    MATING_BISHOP_COLORS
+};
+
+/*
+ * An item in the material hash table. The item contains information
+ * that only depends on the number of pieces of each type.
+ */
+struct material_item {
+    uint64_t matkey;
+    int16_t phase;
+    uint8_t scale[NSIDES];
+    uint8_t mating;
+    uint8_t endgame;
+    uint8_t strong_side;
+};
+
+/* The number of items stored in each NNUE cache bucket */
+#define NNUE_CACHE_BUCKET_SIZE 4
+
+/*
+ * NNUE cache bucket. The size should be a power-of-2
+ * for best performance.
+ */
+struct nnue_cache_bucket {
+    struct nnue_cache_item items[NNUE_CACHE_BUCKET_SIZE];
 };
 
 /* Accumulator for NNUE input features for a position */
 #define NNUE_NUM_INPUT_FEATURES 64*12
 #define NNUE_MAX_ACTIVE_FEATURES 32
-#define NNUE_NUM_LAYERS 2
+#define NNUE_MAX_LAYERS 4
 #define NNUE_INPUT_LAYER_SIZE 1024
+#define NNUE_MAX_KING_BUCKETS 32
 struct nnue_accumulator {
     alignas(64) int16_t data[NSIDES][NNUE_INPUT_LAYER_SIZE];
 };
 
+/*
+ * Item in the accumulator refresh cache. Holds the accumulator for one
+ * perspective together with the pieces that were used to calculate it.
+ */
+struct nnue_refresh_item {
+    alignas(64) int16_t data[NNUE_INPUT_LAYER_SIZE];
+    uint64_t bb_pieces[NPIECES];
+    /* The net the accumulator was calculated for */
+    uint32_t net_id;
+};
+
+/*
+ * A piece that was moved, added or removed by a move. Used to update
+ * the NNUE accumulator lazily. A from square of NO_SQUARE means that
+ * piece was added and a to square of NO_SQUARE means that the piece
+ * was removed.
+ */
+#define NNUE_MAX_DIRTY_PIECES 3
+struct nnue_dirty_piece {
+    int8_t piece;
+    int8_t from;
+    int8_t to;
+};
+
+/* A position to evaluate with nnue_evaluate_batch */
+struct nnue_batch_item {
+    uint8_t squares[NNUE_MAX_ACTIVE_FEATURES];
+    uint8_t pieces[NNUE_MAX_ACTIVE_FEATURES];
+    uint8_t npieces;
+    uint8_t stm;
+};
+
 /* Item in the evaluation stack */
 struct eval_item {
     /* Accumulator for NNUE input features */
     struct nnue_accumulator accumulator;
+    /* Pieces changed by the move leading to this ply */
+    struct nnue_dirty_piece dirty[NNUE_MAX_DIRTY_PIECES];
+    int ndirty;
+    /* Indicates if the accumulator is up to date */
+    bool computed;
     /* The evaluation score */
     int score;
 };
@@ -407,6 +558,14 @@ struct position {
     uint64_t bb_all;
     /* Key that uniquely identifies the current position */
     uint64_t key;
+    /* Key that identifies the pawn structure of the current position */
+    uint64_t pawnkey;
+    /* Key that identifies the material configuration of the position */
+    uint64_t matkey;
+    /* Pieces giving check to the king of the side to move */
+    uint64_t checkers;
+    /* Pieces of the side to move that are pinned to their own king */
+    uint64_t pinned;
     /* The en-passant target square */
     int ep_sq;
     /* Castling availability for both sides */
@@ -440,6 +599,90 @@ struct position {
     struct engine *engine;
 };
 
+/* A root move, its score and the number of nodes spent searching it */
+struct root_move {
+    uint32_t move;
+    int score;
+    uint64_t nodes;
+};
+
+/*
+ * Root moves kept from the last search of an engine, ordered with the
+ * best move first. The key identifies the position the moves belong to
+ * and the PV is used to recognize the position expected two plies later.
+ */
+struct root_history {
+    uint64_t key;
+    struct root_move moves[MAX_MOVES];
+    int nmoves;
+    struct pvline pv;
+    /* The number of plies the position has advanced since it was searched */
+    int nplies;
+};
+
+/*
+ * A probe of the DTZ tables for the root position running in the
+ * background while the search starts.
+ */
+struct root_probe {
+    thread_t thread;
+    /* Indicates if the probe was started and has not been finished */
+    bool started;
+    /* Set by the probe thread when the result is available */
+    atomic_bool done;
+    /* Indicates if the result has been applied to the search */
+    bool applied;
+    /* The result of the probe */
+    bool found;
+    uint32_t move;
+    int score;
+};
+
+/* An event recorded when tracing a search */
+struct trace_event {
+    /* Time since the start of the search (in microseconds) */
+    uint64_t time;
+    int32_t value;
+    int16_t depth;
+    uint8_t type;
+    uint8_t phase;
+};
+
+/* Ring buffer with the trace events of a worker */
+struct trace_buffer {
+    struct trace_event events[TRACE_BUFFER_SIZE];
+    /* The total number of events recorded */
+    uint64_t count;
+};
+
+/*
+ * Detailed search statistics. Only collected in builds with
+ * SEARCH_STATS defined.
+ */
+struct search_stats {
+    uint64_t nodes;
+    uint64_t qnodes;
+    uint64_t tbhits;
+    uint64_t evals;
+    uint64_t tt_probes;
+    uint64_t tt_hits;
+    uint64_t tt_cutoffs;
+    uint64_t nnue_cache_probes;
+    uint64_t nnue_cache_hits;
+    uint64_t nnue_refreshes;
+    uint64_t nnue_full_refreshes;
+    uint64_t rfp_prunes;
+    uint64_t null_tries;
+    uint64_t null_cutoffs;
+    uint64_t probcut_cutoffs;
+    uint64_t futility_prunes;
+    uint64_t lmp_prunes;
+    uint64_t see_prunes;
+    uint64_t history_prunes;
+    uint64_t fail_highs;
+    uint64_t first_move_fail_highs;
+};
+
 /* Per-thread worker instance */
 struct search_worker {
     /* The id of this thread */
@@ -447,19 +690,36 @@ struct search_worker {
     /* The current position */
     struct position pos;
     /*
-     * Parameter used during the search to keep track of the current
-     * principle variation at a certain depth. After the search the
-     * complete variation can be found in pv_table[0].
+     * Triangular table used during the search to keep track of the
+     * current principle variation at a certain depth. The variation for
+     * a ply is stored directly after the one for the previous ply and
+     * pv_length holds the number of moves in each of them. After the
+     * search the complete variation can be found at the start of the
+     * table.
      */
-    struct movelist pv_table[MAX_PLY];
+    uint32_t pv_table[PV_TABLE_SIZE];
+    int pv_length[MAX_PLY];
     /* Tables used for killer move heuristics */
     uint32_t killer_table[MAX_PLY];
+    /*
+     * Move storage used by the move selectors, indexed by ply. Keeping
+     * it here instead of on the stack means that only the entries that
+     * are actually filled in are touched. There is never more than one
+     * active move selector per ply.
+     */
+    struct moveinfo move_stack[MAX_PLY][MAX_MOVES];
+    /* The quiet moves searched at each ply, used for history updates */
+    struct movelist quiet_stack[MAX_PLY];
     /* Table used for counter move heuristics */
     uint32_t countermove_table[NPIECES][NSQUARES];
-    /* Tables used for history heuristics */
-    int history_table[NPIECES][NSQUARES];
-    int counter_history[NPIECES][NSQUARES][NPIECES][NSQUARES];
-    int follow_history[NPIECES][NSQUARES][NPIECES][NSQUARES];
+    /*
+     * Tables used for history heuristics. The scores are bounded by the
+     * updates so 16-bit entries are enough, which keeps the continuation
+     * tables small enough to make better use of the caches.
+     */
+    int16_t history_table[NPIECES][NSQUARES];
+    int16_t counter_history[NPIECES][NSQUARES][NPIECES][NSQUARES];
+    int16_t follow_history[NPIECES][NSQUARES][NPIECES][NSQUARES];
     /* Indicates if the engine is resolving a fail-low at the root */
     bool resolving_root_fail;
     /* The number of nodes searched so far */
@@ -468,29 +728,214 @@ struct search_worker {
     uint64_t qnodes;
     /* The current search depth in plies */
     int depth;
+    /* The depth the worker is counted at by the depth scheduling */
+    int scheduled_depth;
     /* The current selective search depth in plies */
     int seldepth;
     /* The number of tablebase hits */
     uint64_t tbhits;
+    /*
+     * The value of the node counter when the last search of the root
+     * started and the number of nodes spent on the current best move.
+     */
+    uint64_t root_nodes;
+    uint64_t best_move_nodes;
+    /* The part of the node and tablebase hit counters already published */
+    uint64_t published_nodes;
+    uint64_t published_tbhits;
+    /* The number of static evaluations done */
+    uint64_t evals;
+    /* Statistics for the transposition table */
+    uint64_t tt_probes;
+    uint64_t tt_hits;
 
     /* Cache for NNUE evaluations */
-    struct nnue_cache_item *nnue_cache;
-    int nnue_cache_size;
+    struct nnue_cache_bucket *nnue_cache;
+    uint64_t nnue_cache_size;
+    bool nnue_cache_shared;
+    uint64_t nnue_cache_probes;
+    uint64_t nnue_cache_hits;
+
+    /* Pawn hash table used by the classical evaluation */
+    struct pawntt_item *pawntt;
+    uint64_t pawntt_size;
+
+    /* Material hash table */
+    struct material_item *mattt;
+    uint64_t mattt_size;
+
+    /* Buffer for trace events, NULL if tracing is disabled */
+    struct trace_buffer *trace;
+
+#ifdef SEARCH_STATS
+    /* Detailed statistics accumulated over all searches */
+    struct search_stats stats;
+#endif
+
+    /* Cache for tablebase WDL probes */
+    struct egtb_cache_item egtb_cache[EGTB_CACHE_SIZE];
+    uint64_t egtb_probes;
+    uint64_t egtb_cache_hits;
+
+    /*
+     * Cache used to speed up accumulator refreshes. There is one
+     * item for each king bucket of the loaded net and perspective.
+     */
+    struct nnue_refresh_item *nnue_refresh_cache;
+    int nnue_refresh_buckets;
+    uint64_t nnue_refreshes;
+    uint64_t nnue_full_refreshes;
 
     /* PV information */
     int multipv;
-    int mpvidx;
     uint32_t mpv_moves[MAX_MULTIPV_LINES];
     struct pvinfo mpv_lines[MAX_MULTIPV_LINES];
 
+    /*
+     * The root moves. The moves are kept across iterations together with
+     * the score from the latest iteration and the number of nodes spent
+     * on each move. When searching several PV lines the moves are ordered
+     * by score. When the root was seeded from an earlier search they are
+     * ordered by the number of nodes instead.
+     */
+    struct root_move root_moves[MAX_MOVES];
+    int nroot_moves;
+    bool ordered_root;
+    /* The best lines found so far in the current iteration */
+    struct pvinfo root_lines[MAX_MULTIPV_LINES];
+    int nroot_lines;
+
     /* Data for the worker thread */
     thread_t thread;
+    event_t start_event;
+    event_t done_event;
+    bool quit;
     jmp_buf env;
 
     /* Pointer to the owning engine */
     struct engine *engine;
 };
 
+/* Transposition table owned by an engine */
+struct tt_table {
+    struct tt_bucket *buckets;
+    /* The requested size in MB */
+    int size_in_mb;
+    /* The number of buckets */
+    uint64_t size;
+    /*
+     * The number of buckets in the private part of the table used by
+     * each worker, or 0 if all workers share the whole table.
+     */
+    uint64_t partition_size;
+    /* The date of the current search */
+    uint8_t date;
+    /*
+     * The current epoch. Increasing the epoch clears the table
+     * without having to touch all buckets.
+     */
+    uint32_t epoch;
+    /* Flags describing how the memory was allocated */
+    bool mapped;
+    bool large_pages;
+    /* Flag indicating if the table is borrowed from another engine */
+    bool borrowed;
+    /* Flag indicating if the table is lent to other engines */
+    bool shared;
+    /* Thread used to allocate and clear the table in the background */
+    thread_t resize_thread;
+    bool resizing;
+};
+
+/* Worker threads owned by an engine */
+struct worker_pool {
+    /* Flag used to signal to workers to stop searching */
+    atomic_bool should_stop;
+    /* The workers of the pool */
+    int nworkers;
+    struct search_worker **workers;
+    /* The job currently being executed by the pool */
+    void (*job_func)(int idx, void *data);
+    void *job_data;
+    /* NNUE cache shared by all workers of the pool */
+    struct nnue_cache_bucket *shared_nnue_cache;
+    uint64_t shared_nnue_cache_size;
+    int shared_nnue_cache_users;
+    /*
+     * Node and tablebase hit counters published by the workers. Workers
+     * only update the counters in batches and the counters are placed
+     * on a separate cache line to avoid false sharing.
+     */
+    alignas(64) atomic_uint_fast64_t published_nodes;
+    atomic_uint_fast64_t published_tbhits;
+    /*
+     * The number of workers assigned to each search depth. Used to
+     * decide which depth helpers should search next without locking.
+     */
+    alignas(64) atomic_int depth_count[MAX_SEARCH_DEPTH+2];
+    /*
+     * Keys of positions that are currently being searched by some
+     * worker. Used to let workers defer moves that another worker
+     * is already searching (ABDADA).
+     */
+    atomic_uint_fast64_t *busy_table;
+    /* Statistics about the depth scheduling */
+    atomic_uint_fast64_t scheduling_time;
+    atomic_uint_fast64_t scheduling_calls;
+    atomic_uint_fast64_t scheduling_retries;
+    /* The time when tracing of the current search started */
+    uint64_t trace_start;
+};
+
+/* Time control state of an engine */
+struct time_control {
+    /* Flags indicating special time control modes */
+    int flags;
+    /* The time increment (in milliseconds) */
+    int increment;
+    /* The number of moves to the next time control */
+    int movestogo;
+    /* The number of milliseconds left on the clock */
+    int time_left;
+    /*
+     * Limit on how long the engine is allowed to search. In
+     * some special circumstances it can be ok to exceed
+     * this limit.
+     */
+    time_t soft_limit;
+    /* A hard time limit that may not be exceeded */
+    time_t hard_limit;
+    /* The time when the current search was started */
+    time_t search_start;
+    /*
+     * The time the engine is expected to spend on the move before it is
+     * adjusted based on how the search develops.
+     */
+    time_t optimum;
+    /* The best move and the score of the last completed iteration */
+    uint32_t best_move;
+    int best_score;
+    /* The number of iterations the best move has been unchanged for */
+    int stability;
+    /* The number of completed iterations */
+    int iterations;
+    /* The number of fail-lows at the root during the current iteration */
+    int fail_lows;
+    /* The time when the current iteration was started */
+    time_t iteration_start;
+    /* The time spent on the last completed iteration */
+    time_t iteration_time;
+    /* Estimated growth in time from one iteration to the next */
+    double iteration_growth;
+    /* Keeps track if the clock is running or not */
+    bool clock_is_running;
+    /* Safety margin to avoid loosing on time (in ms) */
+    int safety_margin;
+};
+
+/* Opaque cluster state, see cluster.c */
+struct cluster;
+
 /* Data structure representing an engine */
 struct engine {
     /* The current position */
@@ -503,24 +948,56 @@ struct engine {
     struct movelist move_filter;
     /* Flag indicating if the WDL tables should be probed during search */
     bool probe_wdl;
+    /* Probe of the DTZ tables for the root position */
+    struct root_probe root_probe;
     /*
      * Indicates if it is ok for the engine to abort a
      * search if it detects a mate.
      */
     bool exit_on_mate;
+    /*
+     * Flag indicating if searches should be reproducible also when using
+     * several threads. In this mode the workers search independently of
+     * each other, each with a private part of the transposition table, a
+     * fixed depth schedule and its own node limit.
+     */
+    bool reproducible;
     /* The maximum depth the engine should search to */
     int sd;
-    /* The maximum number of nodes the engine should search */
+    /*
+     * The maximum number of nodes the engine should search. In
+     * reproducible mode the limit applies to each worker.
+     */
     uint64_t max_nodes;
     /*
      * Flag indicating if the engine is currently
      * searching in pondering mode.
      */
     bool pondering;
+    /*
+     * Set when a search has been requested to stop through the API.
+     * Unlike the stop flag of the worker pool it is not reset when the
+     * workers are prepared, so a stop that arrives before the search
+     * has started is not lost.
+     */
+    atomic_bool stop_requested;
     /* The highest completed depth */
-    int completed_depth;
+    atomic_int completed_depth;
     /* The number of lines to search */
     int multipv;
+    /* The best line found by the last search */
+    struct pvinfo best_line;
+    /* The root moves of the last search */
+    struct root_history root_history;
+    /*
+     * State owned by this engine. Keeping it here rather than in
+     * globals allows several independent engines in one process.
+     */
+    struct tt_table tt;
+    struct worker_pool pool;
+    struct time_control tc;
+    /* The cluster the engine is part of, or NULL if it searches alone */
+    struct cluster *cluster;
 };
 
 #endif
@@ -38,6 +38,9 @@
 #include "smp.h"
 #include "nnue.h"
 #include "polybook.h"
+#include "numa.h"
+#include "cluster.h"
+#include "mate.h"
 
 /* Different UCI modes */
 static bool ponder_mode = false;
@@ -46,6 +49,22 @@ static bool own_book_mode = true;
 /* Helper variable used for sorting pv lines */
 static struct pvinfo sorted_mpv_lines[MAX_MULTIPV_LINES];
 
+/*
+ * Format a score the way UCI expects it. Mate scores are converted
+ * to the number of moves until mate, negative if the engine is
+ * getting mated.
+ */
+static void score2str(int score, char *str)
+{
+    if (score > FORCED_MATE) {
+        sprintf(str, "mate %d", (CHECKMATE-score+1)/2);
+    } else if (score < -FORCED_MATE) {
+        sprintf(str, "mate %d", -(CHECKMATE+score)/2);
+    } else {
+        sprintf(str, "cp %d", score);
+    }
+}
+
 static void uci_cmd_go(char *cmd, struct engine *engine)
 {
     char     *iter;
@@ -62,6 +81,7 @@ static void uci_cmd_go(char *cmd, struct engine *engine)
     bool     infinite_time = false;
     bool     fixed_time = false;
     int      depth = 0;
+    int      mate = 0;
     uint64_t nodes = 0ULL;
     bool     in_movelist = false;
     char     *temp;
@@ -70,9 +90,17 @@ static void uci_cmd_go(char *cmd, struct engine *engine)
     bool     skip_book = false;
     uint32_t best_move = NOMOVE;
     uint32_t ponder_move = NOMOVE;
+    uint64_t probes;
+    uint64_t hits;
+    uint64_t sched_time;
+    uint64_t sched_calls;
+    uint64_t sched_retries;
 
     /* Start the clock */
-    tc_start_clock();
+    tc_start_clock(engine);
+
+    /* Make sure that a resize of the transposition table has completed */
+    hash_tt_wait_for_table(engine);
 
     /* Set default search parameters */
     engine->move_filter.size = 0;
@@ -156,6 +184,14 @@ static void uci_cmd_go(char *cmd, struct engine *engine)
             iter = strchr(iter, ' ');
             in_movelist = false;
             flags |= TC_DEPTH_LIMIT;
+        } else if (MATCH(iter, "mate")) {
+            if ((sscanf(iter, "mate %d", &mate) != 1) || (mate <= 0)) {
+                return;
+            }
+            iter = strchr(iter, ' ');
+            iter = skip_whitespace(iter);
+            iter = strchr(iter, ' ');
+            in_movelist = false;
         } else if (MATCH(iter, "nodes")) {
             if (sscanf(iter, "nodes %" SCNu64 "", &nodes) != 1) {
                 return;
@@ -212,7 +248,16 @@ static void uci_cmd_go(char *cmd, struct engine *engine)
         movetime = engine->pos.stm == WHITE?wtime:btime;
         moveinc = engine->pos.stm == WHITE?winc:binc;
     }
-    tc_configure_time_control(movetime, moveinc, movestogo, flags);
+    tc_configure_time_control(engine, movetime, moveinc, movestogo, flags);
+
+    /*
+     * Searching for a mate is handled by a dedicated search since
+     * the normal search prunes too aggressively to prove mates.
+     */
+    if (mate > 0) {
+        best_move = mate_search_position(engine, mate, NULL);
+        skip_book = true;
+    }
 
     /* Try to find a move in the opening book */
     if (own_book_mode && !skip_book) {
@@ -220,9 +265,35 @@ static void uci_cmd_go(char *cmd, struct engine *engine)
     }
 
     /* Search the position for a move */
-    if (best_move == NOMOVE) {
+    if ((best_move == NOMOVE) && (mate == 0)) {
         best_move = search_position(engine, ponder && ponder_mode, &ponder_move,
                                     NULL);
+
+        /* Report how well the evaluation cache performed */
+        smp_eval_cache_stats(engine, &probes, &hits);
+        if (probes > 0) {
+            engine_queue_command(
+                    "info string EvalCache hits %.1f%% (%"PRIu64" of %"PRIu64")",
+                    (100.0*hits)/probes, hits, probes);
+        }
+
+        /* Report how well the tablebase cache performed */
+        smp_egtb_cache_stats(engine, &probes, &hits);
+        if (probes > 0) {
+            engine_queue_command(
+                    "info string TBCache hits %.1f%% (%"PRIu64" of %"PRIu64")",
+                    (100.0*hits)/probes, hits, probes);
+        }
+
+        /* Report the time spent on assigning search depths to helpers */
+        smp_scheduling_stats(engine, &sched_time, &sched_calls,
+                             &sched_retries);
+        if (smp_number_of_workers(engine) > 1) {
+            engine_queue_command(
+                    "info string DepthScheduling time %.3f ms (%"PRIu64
+                    " iterations, %"PRIu64" retries)",
+                    sched_time/1000.0, sched_calls, sched_retries);
+        }
     }
 
     /* Send the best move */
@@ -234,7 +305,7 @@ static void uci_cmd_go(char *cmd, struct engine *engine)
     } else {
         engine_write_command("bestmove %s", best_movestr);
     }
-    tc_stop_clock();
+    tc_stop_clock(engine);
 }
 
 static void uci_cmd_isready(void)
@@ -316,10 +387,11 @@ static void uci_cmd_position(char *cmd, struct engine *engine)
 
 static void uci_cmd_setoption(char *cmd, struct engine *engine)
 {
-    char *iter;
-    char *namestr;
-    char *valuestr;
-    int  value;
+    char             *iter;
+    char             *namestr;
+    char             *valuestr;
+    int              value;
+    enum numa_policy policy;
 
     /*
      * Handle options. Options that are not
@@ -349,7 +421,25 @@ static void uci_cmd_setoption(char *cmd, struct engine *engine)
                 } else if (value < MIN_MAIN_HASH_SIZE) {
                     value = MIN_MAIN_HASH_SIZE;
                 }
-                hash_tt_create_table(value);
+                hash_tt_create_table_async(engine, value);
+            }
+        } else if (MATCH(namestr, "LargePages")) {
+            if (MATCH(valuestr, "false")) {
+                engine_large_pages = false;
+            } else if (MATCH(valuestr, "true")) {
+                engine_large_pages = true;
+            }
+            hash_tt_create_table_async(engine, hash_tt_size(engine));
+        } else if (MATCH(namestr, "SaveHash")) {
+            if (!hash_tt_save_table(engine, valuestr)) {
+                engine_write_command("info string Failed to save hash to %s",
+                                     valuestr);
+            }
+        } else if (MATCH(namestr, "LoadHash")) {
+            if (!hash_tt_load_table(engine, valuestr)) {
+                engine_write_command(
+                                "info string Failed to load hash from %s",
+                                valuestr);
             }
         } else if (MATCH(namestr, "OwnBook")) {
             if (MATCH(valuestr, "false")) {
@@ -372,6 +462,19 @@ static void uci_cmd_setoption(char *cmd, struct engine *engine)
         } else if (MATCH(namestr, "SyzygyPath")) {
             strncpy(engine_syzygy_path, valuestr, MAX_PATH_LENGTH);
             egtb_init(engine_syzygy_path);
+        } else if (MATCH(namestr, "SyzygyPreloadPieces")) {
+            if (sscanf(valuestr, "%d", &value) == 1) {
+                engine_syzygy_preload_pieces = CLAMP(value, 0, TB_MAX_PIECES);
+                egtb_preload(engine_syzygy_path, engine_syzygy_preload_pieces,
+                             engine_syzygy_preload_memory);
+            }
+        } else if (MATCH(namestr, "SyzygyPreloadMemory")) {
+            if (sscanf(valuestr, "%d", &value) == 1) {
+                engine_syzygy_preload_memory = CLAMP(value, 0,
+                                                MAX_SYZYGY_PRELOAD_MEMORY);
+                egtb_preload(engine_syzygy_path, engine_syzygy_preload_pieces,
+                             engine_syzygy_preload_memory);
+            }
         } else if (MATCH(namestr, "Threads")) {
             if (sscanf(valuestr, "%d", &value) == 1) {
                 if (value > MAX_WORKERS) {
@@ -379,8 +482,54 @@ static void uci_cmd_setoption(char *cmd, struct engine *engine)
                 } else if (value < 1) {
                     value = 1;
                 }
-                smp_destroy_workers();
-                smp_create_workers(value);
+                smp_destroy_workers(engine);
+                smp_create_workers(engine, value);
+            }
+        } else if (MATCH(namestr, "NumaPolicy")) {
+            if (numa_policy_from_name(valuestr, &policy)) {
+                numa_set_policy(policy);
+                value = smp_number_of_workers(engine);
+                smp_destroy_workers(engine);
+                smp_create_workers(engine, value);
+            } else {
+                engine_write_command("info string Unknown NUMA policy %s",
+                                     valuestr);
+            }
+        } else if (MATCH(namestr, "TraceFile")) {
+            strncpy(engine_trace_file, valuestr, MAX_PATH_LENGTH);
+        } else if (MATCH(namestr, "ClusterNodes")) {
+            strncpy(engine_cluster_nodes, valuestr, MAX_PATH_LENGTH);
+            value = cluster_connect(engine, engine_cluster_nodes);
+            if (value > 0) {
+                engine_write_command("info string Connected to %d cluster"
+                                     " nodes", value);
+            }
+        } else if (MATCH(namestr, "ABDADA")) {
+            if (MATCH(valuestr, "false")) {
+                engine_abdada = false;
+            } else if (MATCH(valuestr, "true")) {
+                engine_abdada = true;
+            }
+        } else if (MATCH(namestr, "EvalCacheShared")) {
+            if (MATCH(valuestr, "false")) {
+                engine_eval_cache_shared = false;
+            } else if (MATCH(valuestr, "true")) {
+                engine_eval_cache_shared = true;
+            }
+            value = smp_number_of_workers(engine);
+            smp_destroy_workers(engine);
+            smp_create_workers(engine, value);
+        } else if (MATCH(namestr, "EvalCache")) {
+            if (sscanf(valuestr, "%d", &value) == 1) {
+                if (value > MAX_EVAL_CACHE_SIZE) {
+                    value = MAX_EVAL_CACHE_SIZE;
+                } else if (value < MIN_EVAL_CACHE_SIZE) {
+                    value = MIN_EVAL_CACHE_SIZE;
+                }
+                engine_eval_cache_size = value;
+                value = smp_number_of_workers(engine);
+                smp_destroy_workers(engine);
+                smp_create_workers(engine, value);
             }
         } else if (MATCH(namestr, "MoveOverhead")) {
             if (sscanf(valuestr, "%d", &value) == 1) {
@@ -389,7 +538,7 @@ static void uci_cmd_setoption(char *cmd, struct engine *engine)
                 } else if (value > MAX_MOVE_OVERHEAD) {
                     value = MAX_MOVE_OVERHEAD;
                 }
-                tc_set_move_overhead(value);
+                tc_set_move_overhead(engine, value);
             }
         } else if (MATCH(namestr, "LogLevel")) {
             if (sscanf(valuestr, "%d", &value) == 1) {
@@ -433,39 +582,64 @@ static void uci_cmd_uci(void)
     engine_protocol = PROTOCOL_UCI;
     engine_variant = VARIANT_STANDARD;
 
-    engine_write_command("id name %s %s", APP_NAME, APP_VERSION);
-    engine_write_command("id author %s", APP_AUTHOR);
-    engine_write_command("option name Hash type spin default %d min %d max %d",
+    engine_queue_command("id name %s %s", APP_NAME, APP_VERSION);
+    engine_queue_command("id author %s", APP_AUTHOR);
+    engine_queue_command("option name Hash type spin default %d min %d max %d",
                          engine_default_hash_size, MIN_MAIN_HASH_SIZE,
 						 hash_tt_max_size());
-    engine_write_command("option name OwnBook type check default true");
-    engine_write_command("option name Ponder type check default false");
-    engine_write_command("option name UCI_Chess960 type check default false");
-    engine_write_command("option name SyzygyPath type string default %s",
+    engine_queue_command("option name LargePages type check default %s",
+                         engine_large_pages?"true":"false");
+    engine_queue_command("option name SaveHash type string default ");
+    engine_queue_command("option name LoadHash type string default ");
+    engine_queue_command("option name OwnBook type check default true");
+    engine_queue_command("option name Ponder type check default false");
+    engine_queue_command("option name UCI_Chess960 type check default false");
+    engine_queue_command("option name SyzygyPath type string default %s",
                          engine_syzygy_path[0] != '\0'?
                                                 engine_syzygy_path:"");
-    engine_write_command(
+    engine_queue_command(
+                "option name SyzygyPreloadPieces type spin default %d min 0"
+                " max %d", engine_syzygy_preload_pieces, TB_MAX_PIECES);
+    engine_queue_command(
+                "option name SyzygyPreloadMemory type spin default %d min 0"
+                " max %d", engine_syzygy_preload_memory,
+                MAX_SYZYGY_PRELOAD_MEMORY);
+    engine_queue_command(
                         "option name Threads type spin default %d min 1 max %d",
                         engine_default_num_threads, MAX_WORKERS);
-    engine_write_command(
+    engine_queue_command(
+                "option name NumaPolicy type combo default %s var none var node"
+                " var core", numa_policy_name(numa_get_policy()));
+    engine_queue_command(
                         "option name MultiPV type spin default 1 min 1 max %d",
                         MAX_MULTIPV_LINES);
-    engine_write_command(
+    engine_queue_command(
                  "option name MoveOverhead type spin default %d min %d max %d",
                  DEFAULT_MOVE_OVERHEAD, MIN_MOVE_OVERHEAD, MAX_MOVE_OVERHEAD);
-    engine_write_command(
+    engine_queue_command(
                        "option name LogLevel type spin default %d min 0 max %d",
                         dbg_get_log_level(), LOG_HIGHEST_LEVEL);
-    engine_write_command("option name UseNNUE type check default %s",
+    engine_queue_command("option name UseNNUE type check default %s",
                          engine_using_nnue && engine_loaded_net?"true":"false");
-    engine_write_command("option name EvalFile type string default ");
+    engine_queue_command("option name EvalFile type string default ");
+    engine_queue_command(
+                "option name EvalCache type spin default %d min %d max %d",
+                engine_eval_cache_size, MIN_EVAL_CACHE_SIZE,
+                MAX_EVAL_CACHE_SIZE);
+    engine_queue_command("option name EvalCacheShared type check default %s",
+                         engine_eval_cache_shared?"true":"false");
+    engine_queue_command("option name ABDADA type check default %s",
+                         engine_abdada?"true":"false");
+    engine_queue_command("option name TraceFile type string default ");
+    engine_queue_command("option name ClusterNodes type string default %s",
+                         engine_cluster_nodes);
     engine_write_command("uciok");
 }
 
-static void uci_cmd_ucinewgame(void)
+static void uci_cmd_ucinewgame(struct engine *engine)
 {
-    hash_tt_clear_table();
-    smp_newgame();
+    hash_tt_clear_table(engine);
+    smp_newgame(engine);
 }
 
 bool uci_handle_command(struct engine *engine, char *cmd, bool *stop)
@@ -495,7 +669,7 @@ bool uci_handle_command(struct engine *engine, char *cmd, bool *stop)
     } else if (MATCH(cmd, "uci") && (strlen(cmd) == 3)) {
         uci_cmd_uci();
     } else if (MATCH(cmd, "ucinewgame") && (strlen(cmd) == 10)) {
-        uci_cmd_ucinewgame();
+        uci_cmd_ucinewgame(engine);
     } else if (MATCH(cmd, "quit")) {
         /* Both UCI and Xboard protocol has a quit command */
         if (engine_protocol == PROTOCOL_UCI) {
@@ -518,15 +692,19 @@ bool uci_check_input(struct search_worker *worker)
     /* Read command */
     cmd = engine_read_command();
     if (cmd == NULL) {
-        /* The GUI exited unexpectedly */
-        return false;
+        /*
+         * The GUI exited unexpectedly. Stop searches that would
+         * otherwise never finish on their own.
+         */
+        return ((tc_get_flags(worker->engine)&TC_INFINITE_TIME) != 0) ||
+               worker->engine->pondering;
     }
 
     /* Process command */
     if (MATCH(cmd, "isready")) {
         uci_cmd_isready();
     } else if(MATCH(cmd, "ponderhit")) {
-        tc_allocate_time();
+        tc_allocate_time(worker->engine);
         worker->engine->pondering = false;
     } else if (MATCH(cmd, "stop")) {
         worker->engine->pondering = false;
@@ -539,6 +717,7 @@ bool uci_check_input(struct search_worker *worker)
 void uci_send_pv_info(struct engine *engine, struct pvinfo *pvinfo)
 {
     char     movestr[MAX_MOVESTR_LENGTH];
+    char     scorestr[16];
     char     buffer[1024];
     int      msec;
     int      nps;
@@ -548,10 +727,10 @@ void uci_send_pv_info(struct engine *engine, struct pvinfo *pvinfo)
     int      score;
 
     /* Get information about the search */
-    msec = (int)tc_elapsed_time();
-    nodes = smp_nodes();
+    msec = (int)tc_elapsed_time(engine);
+    nodes = smp_nodes(engine);
     nps = (msec > 0)?(nodes/msec)*1000:0;
-    tbhits = engine->root_in_tb?1:smp_tbhits();
+    tbhits = engine->root_in_tb?1:smp_tbhits(engine);
 
     /* Adjust score in case the root position was found in tablebases */
     score = pvinfo->score;
@@ -561,10 +740,11 @@ void uci_send_pv_info(struct engine *engine, struct pvinfo *pvinfo)
     }
 
     /* Build command */
+    score2str(score, scorestr);
     sprintf(buffer, "info depth %d seldepth %d nodes %"PRIu64" time %d nps %d "
-            "tbhits %"PRIu64" hashfull %d score cp %d pv",
+            "tbhits %"PRIu64" hashfull %d score %s pv",
             pvinfo->depth, pvinfo->seldepth,
-            nodes, msec, nps, tbhits, hash_tt_usage(), score);
+            nodes, msec, nps, tbhits, hash_tt_usage(engine), scorestr);
     for (k=0;k<pvinfo->pv.size;k++) {
         strcat(buffer, " ");
         pos_move2str(pvinfo->pv.moves[k], movestr);
@@ -577,6 +757,7 @@ void uci_send_pv_info(struct engine *engine, struct pvinfo *pvinfo)
 
 void uci_send_bound_info(struct search_worker *worker, int score, bool lower)
 {
+    char     scorestr[16];
     char     buffer[1024];
     int      msec;
     int      nps;
@@ -584,10 +765,10 @@ void uci_send_bound_info(struct search_worker *worker, int score, bool lower)
     uint64_t nodes;
 
     /* Get information about the search */
-    msec = (int)tc_elapsed_time();
-    nodes = smp_nodes();
+    msec = (int)tc_elapsed_time(worker->engine);
+    nodes = smp_nodes(worker->engine);
     nps = (msec > 0)?(nodes/msec)*1000:0;
-    tbhits = worker->engine->root_in_tb?1:smp_tbhits();
+    tbhits = worker->engine->root_in_tb?1:smp_tbhits(worker->engine);
 
     /* Adjust score in case the root position was found in tablebases */
     if (worker->engine->root_in_tb) {
@@ -596,11 +777,12 @@ void uci_send_bound_info(struct search_worker *worker, int score, bool lower)
     }
 
     /* Build command */
+    score2str(score, scorestr);
     sprintf(buffer, "info depth %d seldepth %d nodes %"PRIu64" time %d nps %d "
-            "tbhits %"PRIu64" hashfull %d score cp %d %s",
+            "tbhits %"PRIu64" hashfull %d score %s %s",
             worker->depth, worker->seldepth,
-            nodes, msec, nps, tbhits, hash_tt_usage(),
-            score, lower?"lowerbound":"upperbound");
+            nodes, msec, nps, tbhits, hash_tt_usage(worker->engine),
+            scorestr, lower?"lowerbound":"upperbound");
 
     /* Write command */
     engine_write_command(buffer);
@@ -613,7 +795,7 @@ void uci_send_move_info(struct search_worker *worker, int movenumber,
     int  msec;
 
     /* Get the currently searched time */
-    msec = (int)tc_elapsed_time();
+    msec = (int)tc_elapsed_time(worker->engine);
     if (msec < 3000) {
         /* Wait some time before starting to send move info to avoid traffic */
         return;
@@ -628,6 +810,7 @@ void uci_send_move_info(struct search_worker *worker, int movenumber,
 void uci_send_multipv_info(struct search_worker *worker)
 {
     char          movestr[MAX_MOVESTR_LENGTH];
+    char          scorestr[16];
     char          buffer[1024];
     int           msec;
     int           nps;
@@ -641,11 +824,11 @@ void uci_send_multipv_info(struct search_worker *worker)
     struct pvinfo pv;
 
     /* Get information common for all lines */
-    msec = (int)tc_elapsed_time();
-    nodes = smp_nodes();
+    msec = (int)tc_elapsed_time(worker->engine);
+    nodes = smp_nodes(worker->engine);
     nps = (msec > 0)?(nodes/msec)*1000:0;
-    tbhits = worker->engine->root_in_tb?1:smp_tbhits();
-    ttusage = hash_tt_usage();
+    tbhits = worker->engine->root_in_tb?1:smp_tbhits(worker->engine);
+    ttusage = hash_tt_usage(worker->engine);
 
     /* Sort pv lines based on score */
     memcpy(sorted_mpv_lines, worker->mpv_lines, sizeof(sorted_mpv_lines));
@@ -670,16 +853,32 @@ void uci_send_multipv_info(struct search_worker *worker)
         if (sorted_mpv_lines[k].depth == 0) {
             continue;
         }
+        score2str(sorted_mpv_lines[k].score, scorestr);
         sprintf(buffer, "info multipv %d depth %d seldepth %d nodes %"PRIu64" "
-                "time %d nps %d tbhits %"PRIu64" hashfull %d score cp %d pv",
+                "time %d nps %d tbhits %"PRIu64" hashfull %d score %s pv",
                 k+1, sorted_mpv_lines[k].depth, sorted_mpv_lines[k].seldepth,
-                nodes, msec, nps, tbhits, ttusage, sorted_mpv_lines[k].score);
+                nodes, msec, nps, tbhits, ttusage, scorestr);
         for (l=0;l<sorted_mpv_lines[k].pv.size;l++) {
             strcat(buffer, " ");
             pos_move2str(sorted_mpv_lines[k].pv.moves[l], movestr);
             strcat(buffer, movestr);
         }
 
-        engine_write_command(buffer);
+        engine_queue_command(buffer);
     }
+    engine_flush_commands();
+}
+
+void uci_send_depth_info(struct engine *engine, int depth)
+{
+    int      msec;
+    int      nps;
+    uint64_t nodes;
+
+    msec = (int)tc_elapsed_time(engine);
+    nodes = smp_nodes(engine);
+    nps = (msec > 0)?(nodes/msec)*1000:0;
+
+    engine_write_command("info depth %d nodes %"PRIu64" time %d nps %d",
+                         depth, nodes, msec, nps);
 }
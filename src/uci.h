@@ -74,4 +74,13 @@ void uci_send_move_info(struct search_worker *worker, int movenumber,
  */
 void uci_send_multipv_info(struct search_worker *worker);
 
+/*
+ * Send information about a completed iteration that didn't produce
+ * a new principle variation.
+ *
+ * @param engine The engine.
+ * @param depth The depth of the iteration.
+ */
+void uci_send_depth_info(struct engine *engine, int depth);
+
 #endif
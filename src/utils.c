@@ -16,39 +16,42 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 #include <stdlib.h>
+#include <string.h>
 #include <ctype.h>
 #include <assert.h>
-#include <string.h>
 #if defined(WINDOWS)
 #include <windows.h>
 #include <sys/timeb.h>
 #include <process.h>
 #include <io.h>
+#include <fcntl.h>
 #else
 #include <sys/time.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <time.h>
 #include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <netdb.h>
 #endif
 
 #include "utils.h"
-#include "thread.h"
-
-struct memset_task {
-    thread_t thread;
-    void *start;
-    size_t size;
-    uint8_t value;
-};
 
-static thread_retval_t memset_func(void *data)
-{
-    struct memset_task *task = data;
+/* The size of a large page on Linux */
+#define LARGE_PAGE_SIZE (2ULL*1024ULL*1024ULL)
+#define HUGE_PAGE_SIZE (1024ULL*1024ULL*1024ULL)
 
-    memset(task->start, task->value, task->size);
-    return (thread_retval_t)0;
-}
+/* Flags for selecting the page size with MAP_HUGETLB */
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+#ifndef MAP_HUGE_1GB
+#define MAP_HUGE_1GB (30<<MAP_HUGE_SHIFT)
+#endif
 
 #if USE_POPCNT
 int pop_count (uint64_t v)
@@ -64,7 +67,7 @@ const uint64_t k1 = 0x5555555555555555ULL;
 const uint64_t k2 = 0x3333333333333333ULL;
 const uint64_t k4 = 0x0f0f0f0f0f0f0f0fULL;
 const uint64_t kf = 0x0101010101010101ULL;
-int pop_count (uint64_t v)
+static int software_pop_count(uint64_t v)
 {
     v =  v - ((v >> 1) & k1);
     v = (v & k2) + ((v >> 2) & k2);
@@ -72,6 +75,25 @@ int pop_count (uint64_t v)
     v = (v * kf) >> 56;
     return (int) v;
 }
+
+#ifdef USE_DISPATCH
+__attribute__((target("popcnt"))) static int hardware_pop_count(uint64_t v)
+{
+    return __builtin_popcountll(v);
+}
+
+int (*pop_count)(uint64_t v) = software_pop_count;
+
+void select_pop_count(bool use_hardware)
+{
+    pop_count = use_hardware?hardware_pop_count:software_pop_count;
+}
+#else
+int pop_count (uint64_t v)
+{
+    return software_pop_count(v);
+}
+#endif
 #endif
 
 int bitscan_forward(uint64_t v)
@@ -118,6 +140,42 @@ time_t get_current_time(void)
 #endif
 }
 
+uint64_t get_current_time_us(void)
+{
+#ifdef WINDOWS
+    LARGE_INTEGER counter;
+    LARGE_INTEGER frequency;
+
+    QueryPerformanceCounter(&counter);
+    QueryPerformanceFrequency(&frequency);
+    return (uint64_t)((counter.QuadPart*1000000)/frequency.QuadPart);
+#else
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return ((uint64_t)tv.tv_sec)*1000000ULL + (uint64_t)tv.tv_usec;
+#endif
+}
+
+uint64_t get_current_time_ns(void)
+{
+#ifdef WINDOWS
+    LARGE_INTEGER counter;
+    LARGE_INTEGER frequency;
+
+    QueryPerformanceCounter(&counter);
+    QueryPerformanceFrequency(&frequency);
+    return (uint64_t)((counter.QuadPart/frequency.QuadPart)*1000000000ULL +
+                ((counter.QuadPart%frequency.QuadPart)*1000000000ULL)/
+                                                        frequency.QuadPart);
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec)*1000000000ULL + (uint64_t)ts.tv_nsec;
+#endif
+}
+
 int get_current_pid(void)
 {
 #ifdef WINDOWS
@@ -127,37 +185,21 @@ int get_current_pid(void)
 #endif
 }
 
-bool poll_input(void)
+bool is_process_running(int pid)
 {
 #ifdef WINDOWS
-    HANDLE handle;
-    DWORD  temp;
-
-    handle = GetStdHandle(STD_INPUT_HANDLE);
-    if (handle == INVALID_HANDLE_VALUE)
-        return FALSE;
-    if (GetConsoleMode(handle, &temp)) {
-        SetConsoleMode(handle, ENABLE_ECHO_INPUT|ENABLE_LINE_INPUT|
-                       ENABLE_PROCESSED_INPUT);
-        FlushConsoleInputBuffer(handle);
-        if (!GetNumberOfConsoleInputEvents(handle, &temp))
-            return FALSE;
-        return (bool)(temp > 1);
-    } else {
-        if (!PeekNamedPipe(handle, NULL, 0, NULL, &temp, NULL)) {
-            return FALSE;
-        }
-        return (bool)(temp != 0);
+    HANDLE ph;
+    bool   running;
+
+    ph = OpenProcess(SYNCHRONIZE, FALSE, (DWORD)pid);
+    if (ph == NULL) {
+        return GetLastError() != ERROR_INVALID_PARAMETER;
     }
+    running = WaitForSingleObject(ph, 0) == WAIT_TIMEOUT;
+    CloseHandle(ph);
+    return running;
 #else
-    fd_set         set;
-    struct timeval tv;
-
-    FD_ZERO(&set);
-    FD_SET(STDIN_FILENO, &set);
-    tv.tv_sec = 0;
-    tv.tv_usec = 0;
-    return (select(STDIN_FILENO+1, &set, NULL, NULL, &tv) > 0);
+    return (kill((pid_t)pid, 0) == 0) || (errno == EPERM);
 #endif
 }
 
@@ -295,6 +337,30 @@ uint64_t read_uint64_be(uint8_t *buffer)
     return val;
 }
 
+void write_uint16_le(uint8_t *buffer, uint16_t value)
+{
+    buffer[0] = (uint8_t)value;
+    buffer[1] = (uint8_t)(value >> 8);
+}
+
+void write_uint32_le(uint8_t *buffer, uint32_t value)
+{
+    int k;
+
+    for (k=0;k<4;k++) {
+        buffer[k] = (uint8_t)(value >> (8*k));
+    }
+}
+
+void write_uint64_le(uint8_t *buffer, uint64_t value)
+{
+    int k;
+
+    for (k=0;k<8;k++) {
+        buffer[k] = (uint8_t)(value >> (8*k));
+    }
+}
+
 char* skip_whitespace(char *str)
 {
     while (isspace(*str)) {
@@ -325,31 +391,98 @@ void aligned_free(void *ptr)
 #endif
 }
 
-void parallel_memset(void *memory, uint8_t value, size_t size, int nthreads)
+void* large_pages_malloc(uint64_t size, bool *mapped)
 {
-    int k;
-    size_t size_per_thread;
-    size_t remaining_size;
-    struct memset_task *task_list;
+#ifdef WINDOWS
+    HANDLE           token;
+    TOKEN_PRIVILEGES tp;
+    SIZE_T           page_size;
+    void             *ptr;
 
-    size_per_thread = size/nthreads;
-    remaining_size = size%nthreads;
+    /*
+     * Large pages require the SeLockMemoryPrivilege privilege
+     * so try to enable it for the process first.
+     */
+    ptr = NULL;
+    page_size = GetLargePageMinimum();
+    if ((page_size > 0) &&
+        OpenProcessToken(GetCurrentProcess(),
+                         TOKEN_ADJUST_PRIVILEGES|TOKEN_QUERY, &token)) {
+        if (LookupPrivilegeValue(NULL, SE_LOCK_MEMORY_NAME,
+                                 &tp.Privileges[0].Luid)) {
+            tp.PrivilegeCount = 1;
+            tp.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+            if (AdjustTokenPrivileges(token, FALSE, &tp, 0, NULL, NULL) &&
+                (GetLastError() == ERROR_SUCCESS)) {
+                ptr = VirtualAlloc(NULL,
+                                   (size+page_size-1)&~(page_size-1),
+                                   MEM_RESERVE|MEM_COMMIT|MEM_LARGE_PAGES,
+                                   PAGE_READWRITE);
+            }
+        }
+        CloseHandle(token);
+    }
+    if (ptr != NULL) {
+        *mapped = true;
+        return ptr;
+    }
 
-    task_list = malloc(sizeof(struct memset_task)*nthreads);
-    for (k=0;k<nthreads;k++) {
-        task_list[k].start = memory + size_per_thread*k;
-        task_list[k].size = size_per_thread;
-        task_list[k].value = value;
-        thread_create(&task_list[k].thread, memset_func, &task_list[k]);
+    *mapped = false;
+    return aligned_malloc(CACHE_LINE_SIZE, size);
+#elif defined(__linux__)
+    void     *ptr;
+    uint64_t alloc_size;
+
+    /* First try to use pages from the reserved huge page pool */
+    alloc_size = (size+LARGE_PAGE_SIZE-1)&~(LARGE_PAGE_SIZE-1);
+    ptr = MAP_FAILED;
+    if ((alloc_size%HUGE_PAGE_SIZE) == 0) {
+        ptr = mmap(NULL, alloc_size, PROT_READ|PROT_WRITE,
+                   MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB|MAP_HUGE_1GB, -1, 0);
+    }
+    if (ptr == MAP_FAILED) {
+        ptr = mmap(NULL, alloc_size, PROT_READ|PROT_WRITE,
+                   MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+    }
+    if (ptr != MAP_FAILED) {
+        *mapped = true;
+        return ptr;
     }
 
-    for (k=0;k<nthreads;k++) {
-        thread_join(&task_list[k].thread);
+    /*
+     * Fall back to transparent huge pages. The memory is aligned
+     * to the large page size to allow the kernel to use large pages
+     * for the whole area.
+     */
+    *mapped = false;
+    ptr = aligned_malloc(LARGE_PAGE_SIZE, alloc_size);
+    if (ptr != NULL) {
+        (void)madvise(ptr, alloc_size, MADV_HUGEPAGE);
+        return ptr;
     }
+    return aligned_malloc(CACHE_LINE_SIZE, size);
+#else
+    *mapped = false;
+    return aligned_malloc(CACHE_LINE_SIZE, size);
+#endif
+}
 
-    memset(memory+size_per_thread*nthreads, value, remaining_size);
+void large_pages_free(void *ptr, uint64_t size, bool mapped)
+{
+    if (ptr == NULL) {
+        return;
+    }
+    if (!mapped) {
+        aligned_free(ptr);
+        return;
+    }
 
-    free(task_list);
+#ifdef WINDOWS
+    (void)size;
+    VirtualFree(ptr, 0, MEM_RELEASE);
+#else
+    (void)munmap(ptr, (size+LARGE_PAGE_SIZE-1)&~(LARGE_PAGE_SIZE-1));
+#endif
 }
 
 bool is64bit(void)
@@ -406,3 +539,232 @@ int set_file_position(FILE *fp, int64_t offset, int whence)
     return ret >= 0?0:-1;
 #endif
 }
+
+bool truncate_file(char *file, int64_t size)
+{
+    assert(file != NULL);
+
+#ifdef WINDOWS
+    int fd;
+    int ret;
+
+    fd = _open(file, _O_RDWR|_O_BINARY);
+    if (fd < 0) {
+        return false;
+    }
+    ret = _chsize_s(fd, size);
+    _close(fd);
+    return ret == 0;
+#else
+    return truncate(file, (off_t)size) == 0;
+#endif
+}
+
+void* map_file(char *file, uint64_t *size)
+{
+    assert(file != NULL);
+    assert(size != NULL);
+
+#ifdef WINDOWS
+    HANDLE        fh;
+    HANDLE        mh;
+    LARGE_INTEGER fsize;
+    void          *addr;
+
+    fh = CreateFileA(file, GENERIC_READ, FILE_SHARE_READ, NULL,
+                     OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (fh == INVALID_HANDLE_VALUE) {
+        return NULL;
+    }
+    if (!GetFileSizeEx(fh, &fsize) || (fsize.QuadPart == 0)) {
+        CloseHandle(fh);
+        return NULL;
+    }
+    mh = CreateFileMapping(fh, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(fh);
+    if (mh == NULL) {
+        return NULL;
+    }
+    addr = MapViewOfFile(mh, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mh);
+    if (addr == NULL) {
+        return NULL;
+    }
+
+    *size = (uint64_t)fsize.QuadPart;
+    return addr;
+#else
+    struct stat sb;
+    void        *addr;
+    int         fd;
+
+    fd = open(file, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    if ((fstat(fd, &sb) != 0) || (sb.st_size == 0)) {
+        close(fd);
+        return NULL;
+    }
+    addr = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        return NULL;
+    }
+
+    *size = (uint64_t)sb.st_size;
+    return addr;
+#endif
+}
+
+void unmap_file(void *addr, uint64_t size)
+{
+    if (addr == NULL) {
+        return;
+    }
+
+#ifdef WINDOWS
+    (void)size;
+    UnmapViewOfFile(addr);
+#else
+    munmap(addr, size);
+#endif
+}
+
+void* shared_memory_open(char *name, uint64_t size, bool *created)
+{
+    char path[256];
+
+    assert(name != NULL);
+    assert(created != NULL);
+
+#ifdef WINDOWS
+    HANDLE mh;
+    void   *addr;
+
+    snprintf(path, sizeof(path), "Local\\%s", name);
+    mh = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+                            (DWORD)(size>>32), (DWORD)(size&0xFFFFFFFF),
+                            path);
+    if (mh == NULL) {
+        return NULL;
+    }
+    *created = GetLastError() != ERROR_ALREADY_EXISTS;
+
+    /*
+     * The handle is intentionally kept open so that the segment stays
+     * around for as long as this process is running.
+     */
+    addr = MapViewOfFile(mh, (*created)?FILE_MAP_WRITE:FILE_MAP_READ, 0, 0,
+                         size);
+    if (addr == NULL) {
+        CloseHandle(mh);
+        return NULL;
+    }
+    return addr;
+#else
+    struct stat sb;
+    void        *addr;
+    int         fd;
+
+    snprintf(path, sizeof(path), "/%s", name);
+
+    /* Try to create the segment */
+    fd = shm_open(path, O_RDWR|O_CREAT|O_EXCL, 0600);
+    if (fd >= 0) {
+        if (ftruncate(fd, size) != 0) {
+            close(fd);
+            shm_unlink(path);
+            return NULL;
+        }
+        addr = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (addr == MAP_FAILED) {
+            shm_unlink(path);
+            return NULL;
+        }
+        *created = true;
+        return addr;
+    }
+
+    /* Attach to the existing segment */
+    fd = shm_open(path, O_RDONLY, 0);
+    if (fd < 0) {
+        return NULL;
+    }
+    if ((fstat(fd, &sb) != 0) || ((uint64_t)sb.st_size != size)) {
+        close(fd);
+        return NULL;
+    }
+    addr = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        return NULL;
+    }
+    *created = false;
+    return addr;
+#endif
+}
+
+void shared_memory_close(void *addr, uint64_t size)
+{
+    unmap_file(addr, size);
+}
+
+void shared_memory_remove(char *name)
+{
+#ifdef WINDOWS
+    /* The segment is removed when the last process closes it */
+    (void)name;
+#else
+    char path[256];
+
+    assert(name != NULL);
+
+    snprintf(path, sizeof(path), "/%s", name);
+    (void)shm_unlink(path);
+#endif
+}
+
+int open_listen_socket(char *address, char *port, int backlog)
+{
+#if defined(WINDOWS)
+    (void)address;
+    (void)port;
+    (void)backlog;
+
+    return -1;
+#else
+    struct addrinfo hints;
+    struct addrinfo *result;
+    struct addrinfo *iter;
+    int             fd;
+    int             flag = 1;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = (address == NULL)?AI_PASSIVE:0;
+    if (getaddrinfo(address, port, &hints, &result) != 0) {
+        return -1;
+    }
+
+    fd = -1;
+    for (iter=result;iter!=NULL;iter=iter->ai_next) {
+        fd = socket(iter->ai_family, iter->ai_socktype, iter->ai_protocol);
+        if (fd < 0) {
+            continue;
+        }
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag));
+        if ((bind(fd, iter->ai_addr, iter->ai_addrlen) == 0) &&
+            (listen(fd, backlog) == 0)) {
+            break;
+        }
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(result);
+
+    return fd;
+#endif
+}
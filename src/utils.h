@@ -32,6 +32,16 @@
 /* The cache line size */
 #define CACHE_LINE_SIZE 64
 
+/*
+ * Macro for forcing a function to be inlined. Used for functions that
+ * are specialized on a constant parameter at each call site.
+ */
+#ifdef __GNUC__
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+#else
+#define ALWAYS_INLINE inline
+#endif
+
 /* Macro for prefetching the data at an address in to the cache */
 #ifdef __GNUC__
 #define PREFETCH_ADDRESS(a) __builtin_prefetch((a))
@@ -45,7 +55,18 @@
  * @param v The value to count the number of bits for.
  * @return Returns the number of bits that are set.
  */
+#if defined(USE_DISPATCH) && !USE_POPCNT
+extern int (*pop_count)(uint64_t v);
+
+/*
+ * Select the implementation to use for pop_count.
+ *
+ * @param use_hardware Flag indicating if the popcnt instruction is available.
+ */
+void select_pop_count(bool use_hardware);
+#else
 int pop_count(uint64_t v);
+#endif
 
 /*
  * Find the least significant bit.
@@ -80,6 +101,21 @@ int pop_bit(uint64_t *v);
  */
 time_t get_current_time(void);
 
+/*
+ * Get the current time in a portable way with microsecond resolution.
+ *
+ * @return Returns the current time in microseconds.
+ */
+uint64_t get_current_time_us(void);
+
+/*
+ * Get the time of a monotonic clock with nanosecond resolution. Only
+ * useful for measuring elapsed time.
+ *
+ * @return Returns the current time in nanoseconds.
+ */
+uint64_t get_current_time_ns(void);
+
 /*
  * Get the PID of the calling process.
  *
@@ -88,11 +124,12 @@ time_t get_current_time(void);
 int get_current_pid(void);
 
 /*
- * Function to check for input in a portable way.
+ * Check if a process is still running.
  *
- * @return Returns true if there is a command waiting.
+ * @param pid The PID of the process.
+ * @return Returns true if the process is running.
  */
-bool poll_input(void);
+bool is_process_running(int pid);
 
 /*
  * Sleep for a specified number of milliseconds.
@@ -149,6 +186,30 @@ uint64_t read_uint64_le(uint8_t *buffer);
  */
 uint64_t read_uint64_be(uint8_t *buffer);
 
+/*
+ * Write a 16-bit unsigned integer in little endian format.
+ *
+ * @param buffer The buffer to write to.
+ * @param value The value to write.
+ */
+void write_uint16_le(uint8_t *buffer, uint16_t value);
+
+/*
+ * Write a 32-bit unsigned integer in little endian format.
+ *
+ * @param buffer The buffer to write to.
+ * @param value The value to write.
+ */
+void write_uint32_le(uint8_t *buffer, uint32_t value);
+
+/*
+ * Write a 64-bit unsigned integer in little endian format.
+ *
+ * @param buffer The buffer to write to.
+ * @param value The value to write.
+ */
+void write_uint64_le(uint8_t *buffer, uint64_t value);
+
 /*
  * Remove leading white space from a string.
  *
@@ -174,14 +235,25 @@ void* aligned_malloc(int alignment, uint64_t size);
 void aligned_free(void *ptr);
 
 /*
- * Parallel version of memset.
+ * Allocate memory backed by large pages. If large pages are not available
+ * then ordinary memory is allocated instead. The memory is aligned to at
+ * least a cache line.
  *
- * @param memory Pointer to the memory to set.
- * @param value The value to write
- * @param size The number of bytes to write.
- * @param nthreads The number of threads to use.
+ * @param size The number of bytes to allocate.
+ * @param mapped Set to true if the memory was mapped directly from the
+ *               operating system.
+ * @return Returns a pointer to the allocated memory, or NULL on failure.
  */
-void parallel_memset(void *memory, uint8_t value, size_t size, int nthreads);
+void* large_pages_malloc(uint64_t size, bool *mapped);
+
+/*
+ * Free memory allocated with large_pages_malloc.
+ *
+ * @param ptr Pointer to the memory to free.
+ * @param size The size that was passed to large_pages_malloc.
+ * @param mapped The mapped value returned by large_pages_malloc.
+ */
+void large_pages_free(void *ptr, uint64_t size, bool mapped);
 
 /*
  * Check this is a 64-bit build.
@@ -208,4 +280,73 @@ int64_t get_file_size(char *file);
  */
 int set_file_position(FILE *fp, int64_t offset, int whence);
 
+/*
+ * Truncate a file to a given size.
+ *
+ * @param file The file.
+ * @param size The new size of the file.
+ * @return Returns true if the file was truncated.
+ */
+bool truncate_file(char *file, int64_t size);
+
+/*
+ * Map a complete file read-only into memory. The mapping is shared between
+ * all processes that map the same file.
+ *
+ * @param file The file.
+ * @param size Location to store the size of the file at.
+ * @return Returns a pointer to the mapped file, or NULL in case of error.
+ */
+void* map_file(char *file, uint64_t *size);
+
+/*
+ * Unmap a file that was mapped using map_file.
+ *
+ * @param addr The address returned by map_file.
+ * @param size The size of the mapped file.
+ */
+void unmap_file(void *addr, uint64_t size);
+
+/*
+ * Open a named shared memory segment. If the segment does not exist then
+ * it is created and mapped read-write. Otherwise the existing segment is
+ * mapped read-only.
+ *
+ * @param name The name of the segment.
+ * @param size The size of the segment.
+ * @param created Location to store a flag indicating if the segment
+ *                was created.
+ * @return Returns a pointer to the segment, or NULL in case of error or
+ *         if an existing segment does not have the expected size (yet).
+ */
+void* shared_memory_open(char *name, uint64_t size, bool *created);
+
+/*
+ * Close a shared memory segment opened with shared_memory_open.
+ *
+ * @param addr The address returned by shared_memory_open.
+ * @param size The size of the segment.
+ */
+void shared_memory_close(void *addr, uint64_t size);
+
+/*
+ * Remove a named shared memory segment. Processes that have the segment
+ * open can continue to use it but no new processes can attach to it.
+ *
+ * @param name The name of the segment.
+ */
+void shared_memory_remove(char *name);
+
+/*
+ * Open a TCP socket listening for connections.
+ *
+ * @param address The address (or host name) to bind to, or NULL to
+ *                listen on all interfaces.
+ * @param port The port (or service name) to listen on.
+ * @param backlog The maximum number of pending connections.
+ * @return Returns the socket, or -1 in case of error or if sockets
+ *         are not supported on the platform.
+ */
+int open_listen_socket(char *address, char *port, int backlog);
+
 #endif
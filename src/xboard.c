@@ -129,8 +129,8 @@ static void make_engine_move(struct engine *engine)
     int              flags;
 
     /* Start the clock */
-    if (!tc_is_clock_running()) {
-        tc_start_clock();
+    if (!tc_is_clock_running(engine)) {
+        tc_start_clock(engine);
     }
 
     /* Set default search parameters */
@@ -156,8 +156,9 @@ static void make_engine_move(struct engine *engine)
         /* Set time control */
         engine->sd = search_depth_limit;
         update_moves_to_time_control(engine);
-        tc_configure_time_control(engine_time_left, engine_time_increment,
-                                  moves_to_time_control, flags);
+        tc_configure_time_control(engine, engine_time_left,
+                                  engine_time_increment, moves_to_time_control,
+                                  flags);
 
         /* Try to find a move in the opening book */
         best_move = polybook_probe(&engine->pos);
@@ -184,7 +185,7 @@ static void make_engine_move(struct engine *engine)
         /* Send move */
         pos_move2str(best_move, best_movestr);
         engine_write_command("move %s", best_movestr);
-		tc_stop_clock();
+		tc_stop_clock(engine);
 
         /* Check if the game is over */
         result = pos_get_game_result(&engine->pos);
@@ -208,7 +209,7 @@ static void make_engine_move(struct engine *engine)
 
             ponder = true;
             pondering_on = ponder_move;
-            tc_start_clock();
+            tc_start_clock(engine);
         } else {
             break;
         }
@@ -220,14 +221,14 @@ static void xboard_cmd_analyze(struct engine *engine)
     char *cmd;
 
     analyze_mode = true;
-    tc_start_clock();
+    tc_start_clock(engine);
 
     while (true) {
         /* Set default search parameters */
         engine->sd = MAX_SEARCH_DEPTH;
         engine->exit_on_mate = false;
         engine_clear_pending_command();
-        tc_configure_time_control(0, 0, 0, TC_INFINITE_TIME);
+        tc_configure_time_control(engine, 0, 0, 0, TC_INFINITE_TIME);
 
         /* Search until told otherwise */
         (void)search_position(engine, false, NULL, NULL);
@@ -252,7 +253,7 @@ static void xboard_cmd_analyze(struct engine *engine)
         }
     }
 
-    tc_stop_clock();
+    tc_stop_clock(engine);
     analyze_mode = false;
 }
 
@@ -288,7 +289,7 @@ static void xboard_cmd_bk(struct engine *engine)
     free(entries);
 }
 
-static void xboard_cmd_cores(char *cmd)
+static void xboard_cmd_cores(char *cmd, struct engine *engine)
 {
     int ncores;
 
@@ -298,8 +299,8 @@ static void xboard_cmd_cores(char *cmd)
         } else if (ncores < 1) {
             ncores = 1;
         }
-        smp_destroy_workers();
-        smp_create_workers(ncores);
+        smp_destroy_workers(engine);
+        smp_create_workers(engine, ncores);
     } else {
         engine_write_command("Error (malformed command): %s", cmd);
     }
@@ -422,7 +423,7 @@ static void xboard_cmd_level(char *cmd)
     engine_time_increment = increment;
 }
 
-static void xboard_cmd_memory(char *cmd)
+static void xboard_cmd_memory(char *cmd, struct engine *engine)
 {
     int size;
 
@@ -432,7 +433,7 @@ static void xboard_cmd_memory(char *cmd)
         } else if (size < MIN_MAIN_HASH_SIZE) {
             size = MIN_MAIN_HASH_SIZE;
         }
-        hash_tt_create_table(size);
+        hash_tt_create_table(engine, size);
     } else {
         engine_write_command("Error (malformed command): %s", cmd);
     }
@@ -441,8 +442,8 @@ static void xboard_cmd_memory(char *cmd)
 static void xboard_cmd_new(struct engine *engine)
 {
     pos_setup_start_position(&engine->pos);
-    hash_tt_clear_table();
-    smp_newgame();
+    hash_tt_clear_table(engine);
+    smp_newgame(engine);
 
     search_depth_limit = MAX_SEARCH_DEPTH;
     engine_side = BLACK;
@@ -483,21 +484,21 @@ static void xboard_cmd_post(void)
 
 static void xboard_cmd_protover(void)
 {
-	engine_write_command("feature ping=1");
-	engine_write_command("feature setboard=1");
-    engine_write_command("feature playother=1");
-    engine_write_command("feature usermove=1");
-	engine_write_command("feature draw=0");
-	engine_write_command("feature sigint=0");
-	engine_write_command("feature sigterm=0");
-	engine_write_command("feature myname=\"%s %s\"", APP_NAME, APP_VERSION);
-	engine_write_command("feature variants=\"normal,fischerandom\"");
-	engine_write_command("feature colors=0");
-	engine_write_command("feature name=1");
-	engine_write_command("feature nps=0");
-	engine_write_command("feature memory=1");
-	engine_write_command("feature smp=1");
-	engine_write_command("feature egt=\"syzygy\"");
+	engine_queue_command("feature ping=1");
+	engine_queue_command("feature setboard=1");
+    engine_queue_command("feature playother=1");
+    engine_queue_command("feature usermove=1");
+	engine_queue_command("feature draw=0");
+	engine_queue_command("feature sigint=0");
+	engine_queue_command("feature sigterm=0");
+	engine_queue_command("feature myname=\"%s %s\"", APP_NAME, APP_VERSION);
+	engine_queue_command("feature variants=\"normal,fischerandom\"");
+	engine_queue_command("feature colors=0");
+	engine_queue_command("feature name=1");
+	engine_queue_command("feature nps=0");
+	engine_queue_command("feature memory=1");
+	engine_queue_command("feature smp=1");
+	engine_queue_command("feature egt=\"syzygy\"");
     engine_write_command("feature done=1");
 }
 
@@ -674,7 +675,7 @@ bool xboard_handle_command(struct engine *engine, char *cmd, bool *stop)
     } else if (MATCH(cmd, "computer")) {
         /* Ignore */
     } else if (MATCH(cmd, "cores")) {
-        xboard_cmd_cores(cmd);
+        xboard_cmd_cores(cmd, engine);
     } else if (MATCH(cmd, "easy")) {
         xboard_cmd_easy();
     } else if (MATCH(cmd, "exit")) {
@@ -690,7 +691,7 @@ bool xboard_handle_command(struct engine *engine, char *cmd, bool *stop)
     } else if (MATCH(cmd, "level")) {
         xboard_cmd_level(cmd);
     } else if (MATCH(cmd, "memory")) {
-        xboard_cmd_memory(cmd);
+        xboard_cmd_memory(cmd, engine);
     } else if (MATCH(cmd, "name")) {
         /* Ignore */
     } else if (MATCH(cmd, "new")) {
@@ -755,8 +756,12 @@ bool xboard_check_input(struct search_worker *worker)
     /* Read command */
     cmd = engine_read_command();
     if (cmd == NULL) {
-        /* The GUI exited unexpectedly */
-        return false;
+        /*
+         * The GUI exited unexpectedly. Stop searches that would
+         * otherwise never finish on their own.
+         */
+        return ((tc_get_flags(worker->engine)&TC_INFINITE_TIME) != 0) ||
+               worker->engine->pondering;
     }
 
     /* Process command */
@@ -783,7 +788,7 @@ bool xboard_check_input(struct search_worker *worker)
     } else if (MATCH(cmd, "time")) {
         xboard_cmd_time(cmd);
         if (worker->engine->pondering) {
-            tc_update_time(engine_time_left);
+            tc_update_time(worker->engine, engine_time_left);
         }
     } else if (MATCH(cmd, "usermove")) {
         if (!worker->engine->pondering) {
@@ -806,9 +811,9 @@ bool xboard_check_input(struct search_worker *worker)
             } else {
                 engine_set_pending_command(cmd);
                 stop = true;
-                tc_start_clock();
+                tc_start_clock(worker->engine);
             }
-            tc_allocate_time();
+            tc_allocate_time(worker->engine);
             worker->engine->pondering = false;
         }
     } else if (MATCH(cmd, "bk") ||
@@ -830,7 +835,7 @@ void xboard_send_pv_info(struct engine *engine, struct pvinfo *pvinfo)
     int             k;
     char            movestr[MAX_MOVESTR_LENGTH];
     uint32_t        msec;
-    struct movelist *pv;
+    struct pvline   *pv;
     int             score;
 
     /* Only display thinking in post mode */
@@ -846,9 +851,9 @@ void xboard_send_pv_info(struct engine *engine, struct pvinfo *pvinfo)
     }
 
     /* Display thinking according to the current output mode */
-    msec = tc_elapsed_time();
+    msec = tc_elapsed_time(engine);
     sprintf(buffer, "%3d %6d %7d %9"PRIu64"", pvinfo->depth,
-            score, msec/10, smp_nodes());
+            score, msec/10, smp_nodes(engine));
     pv = &pvinfo->pv;
     for (k=0;k<pv->size;k++) {
         strcat(buffer, " ");
@@ -0,0 +1,69 @@
+#!/usr/bin/env python3
+#
+# Regression test for the server mode. A client that sends quit followed
+# by more commands than fit in the input queue must not prevent later
+# clients from being served.
+#
+# Usage: server_quit_flood.py <marvin executable>
+#
+import socket
+import subprocess
+import sys
+import time
+
+QUEUED_COMMANDS = 64
+TIMEOUT = 10
+
+
+def free_port():
+    with socket.socket() as s:
+        s.bind(("127.0.0.1", 0))
+        return s.getsockname()[1]
+
+
+def connect(port):
+    deadline = time.time() + TIMEOUT
+    while True:
+        try:
+            return socket.create_connection(("127.0.0.1", port),
+                                            timeout=TIMEOUT)
+        except OSError:
+            if time.time() > deadline:
+                raise
+            time.sleep(0.1)
+
+
+def main():
+    port = free_port()
+    server = subprocess.Popen([sys.argv[1], "--server", str(port)],
+                              stdout=subprocess.DEVNULL)
+    try:
+        first = connect(port)
+        first.sendall(b"uci\nquit\n" + b"isready\n"*QUEUED_COMMANDS)
+        time.sleep(0.5)
+        first.close()
+
+        second = connect(port)
+        second.sendall(b"uci\n")
+        data = b""
+        while b"uciok" not in data:
+            chunk = second.recv(4096)
+            if not chunk:
+                break
+            data += chunk
+        second.close()
+    except OSError as e:
+        print("Error: %s" % e)
+        return 1
+    finally:
+        server.kill()
+        server.wait()
+
+    if b"uciok" not in data:
+        print("Error: the second session was not served")
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())